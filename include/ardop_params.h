@@ -70,6 +70,7 @@ struct ARDOP_PARAMS {
   float	timeOff,slantOff; /*Characteristic Timing Offset (manually entered.*/
   float	xmi;		     /* bias value for i values			   */
   float	xmq;		     /* bias value for q values			   */
+  int	nthreads;	     /* Patches to focus at once (0 = one per CPU) */
 };
 
 struct INPUT_ARDOP_PARAMS {
@@ -103,6 +104,7 @@ struct INPUT_ARDOP_PARAMS {
   float *fdd;
   float *fddd;
   int *iflag;
+  int *nthreads;
 };
 
 struct INPUT_ARDOP_PARAMS *get_input_ardop_params_struct(char *in1, char *out);
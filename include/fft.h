@@ -5,9 +5,11 @@
 	This file is an external interface to asf_fft.a.
 It contains the 1-D fft routines.  Also see fft2d.h
 
-Note: To use these routines, be SURE to call fftInit
-with the size you intend to use-- the routines, for speed,
-do NOT check to make sure they have been initialized.
+Note: To use the real (rffts, riffts) routines, be SURE to call
+fftInit with the size you intend to use-- the routines, for speed,
+do NOT check to make sure they have been initialized.  ffts and
+iffts use the FFT plans declared at the end of this file, and
+need no initialization.
 */
 /*******************************************************************
 	This file extends the fftlib with calls to maintain the cosine and bit reversed tables
@@ -84,6 +86,36 @@ void rspectprod(float *data1, float *data2, float *outdata, int N);
 /* OUTPUTS */
 /* *outdata = output data array spectra */
 
+/*******************************************************************
+	FFT plans (fftplan.c): complex FFTs of any length.  A plan is
+	built once per length and direction, cached, and may be shared
+	between threads.  ffts and iffts above are wrappers over these
+	plans, so they need no fftInit (rffts and riffts still do).
+*******************************************************************/
+#define FFT_FORWARD (-1)	/* exp(-2*pi*i*j*k/n) */
+#define FFT_INVERSE 1		/* exp(+2*pi*i*j*k/n) */
+
+typedef struct fft_plan fft_plan;
+
+const fft_plan *fft_plan_get(int n, int dir);
+/* Return the (cached) plan for an n point transform in direction dir	*/
+/* n may be any positive length; powers of two are fastest.	*/
+
+void fft_plan_execute(const fft_plan *plan, float *data, int rows);
+/* Compute in-place complex ffts on the rows of the input array	*/
+/* Transforms are unnormalized in both directions.	*/
+/* INPUTS */
+/* *data = input data array, interleaved real and imaginary parts	*/
+/* rows = number of rows of fft_plan_size(plan) complex values	*/
+/* OUTPUTS */
+/* *data = output data array	*/
+
+int fft_plan_size(const fft_plan *plan);
+/* Number of complex values the plan transforms	*/
+
+void set_fft_simd(int enable);
+/* Turn the SSE2 kernels on (the default) or off, for benchmarking	*/
+
 
 /* The following is FYI*/
 
@@ -57,6 +57,9 @@ void give_usage(char *name)
  *  "                         for the azimuth reference function weighting\n" */
     "   -m CAL_PARAMS   NO    Read the Elevation Angle and Gain vectors from the\n"
     "            CAL_PARAMS file to correct for the antenna gain\n"
+    "   -threads count  1     Number of patches to process at once (0 = one\n"
+    "                         per processor).  Each needs its own patch of\n"
+    "                         memory; the output does not depend on count.\n"
     "   -debug dbg_flg  1     Debug: for options enter -debug 0\n"
     "   -log logfile       NO    Allows output to be written to a log file\n"
     "   -quiet     NO    Suppresses the output to the essential\n"
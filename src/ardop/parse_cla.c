@@ -114,6 +114,8 @@ int parse_cla(int argc,char *argv[], struct INPUT_ARDOP_PARAMS *g)
         else if (strmatch(key,"-c")) {CHK_ARG_ASP(1); strcpy(fName_doppler,GET_ARG(1));
                         read_dopplr = 1;}
         else if (strmatch(key,"-m")) {CHK_ARG_ASP(1);strcpy(g->CALPRMS,GET_ARG(1));}
+        else if (strmatch(key,"-threads")) {CHK_ARG_ASP(1); g->nthreads = intParm(atoi(GET_ARG(1)));
+                        if (*(g->nthreads)<0) {printf("**Invalid number of threads: %d\n\n",*(g->nthreads)); return 0;}}
         else {printf("**Invalid option: %s\n\n",argv[currArg-1]); return 0;}
     }
     if ((strcmp(g->CALPRMS,"NO")==0)&&(cal_check==1))
@@ -302,11 +302,26 @@ const char *bin_postfix(void);
 /* wrapper for unlink */
 int remove_file(const char *file);
 
+/* Function for remove_file() to call after removing a file -- used by
+   libraries that keep files open or mapped, to let go of them. */
+void set_remove_file_callback(void (*callback)(void));
+
 /* delete image and metadata files given a basename */
 void removeImgAndMeta(const char *base);
 
 void catFile(char *file);
 
+/***************************************************************************
+ * Scratch files: intermediate files kept in memory (scratch.c).  See the
+ * comments in scratch.c. */
+void scratch_files_begin(long long memory_limit);
+void scratch_file_add(const char *name);
+void scratch_files_end(long long *memory_bytes, long long *disk_bytes,
+                       long long *peak_bytes);
+FILE *scratch_fopen(const char *name, const char *mode);
+int scratch_file_exists(const char *name);
+int scratch_file_remove(const char *name);
+
 /***************************************************************************
  * Get the location of the ASF Share Directory, (and some other stuff) */
 const char * get_asf_share_dir(void);
@@ -245,11 +245,13 @@ void FREE_BANDS(char **ptr)
 
 FILE *FOPEN(const char *file,const char *mode)
 {
+    FILE *ret=scratch_fopen(file,mode);
+    if (ret==NULL)
 #if defined(win32) || defined(darwin)
     // fopen is 64-bit ok on Cygwin and darwin -- no fopen64().
-    FILE *ret=fopen(file,mode);
+        ret=fopen(file,mode);
 #else
-    FILE *ret=fopen64(file,mode);
+        ret=fopen64(file,mode);
 #endif
     char error_message[1024];
 
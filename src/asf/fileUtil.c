@@ -98,6 +98,8 @@ int numFiles(const char *path)
 
 int fileExists(const char *name)
 {
+  if (scratch_file_exists(name))
+    return 1;
   FILE *f = fopen (name,"r");
   if (f == NULL)
     return 0;
@@ -495,7 +497,9 @@ FILE *fopenImage(const char *fName,const char *access)
 /*Try to open this name.*/
     if (NULL!=openName)
     {
-        fRet=fopen(openName,access);
+        fRet=scratch_fopen(openName,access);
+        if (fRet==NULL)
+            fRet=fopen(openName,access);
         if (fRet!=NULL)
         {/*We've sucessfully opened the file.*/
             free(openName);/*Free the name.*/
@@ -774,9 +778,21 @@ const char *bin_postfix()
 #endif
 }
 
+static void (*remove_file_callback)(void) = NULL;
+
+void set_remove_file_callback(void (*callback)(void))
+{
+  remove_file_callback = callback;
+}
+
 int remove_file(const char *file)
 {
-  if (is_dir(file)) {
+  if (scratch_file_remove(file)) {
+    if (remove_file_callback)
+      remove_file_callback();
+    return 0;
+  }
+  else if (is_dir(file)) {
     int ret = rmdir(file);
     if (ret < 0) {
       asfPrintWarning("Could not remove directory '%s': %s\n",
@@ -793,6 +809,9 @@ int remove_file(const char *file)
       asfPrintWarning("Could not remove file '%s': %s\n",
                       file, strerror(errno));
     }
+    else if (remove_file_callback) {
+      remove_file_callback();
+    }
     return ret;
   }
   return 0; // success, I guess
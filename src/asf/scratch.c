@@ -0,0 +1,524 @@
+/*******************************************************************
+Scratch files
+
+A multi-step process such as terrain correction hands its intermediate
+images from one step to the next through files that are deleted at the
+end.  Once scratch files are turned on with scratch_files_begin(), the
+files named with scratch_file_add() are kept in memory instead: FOPEN(),
+fopenImage(), fileExists() and remove_file() all know about them, so
+the steps themselves need no changes.
+
+A scratch file only goes to disk if keeping it would take the memory
+in use past the limit given to scratch_files_begin() (with a limit of 0
+every scratch file is on disk), or if it still exists when
+scratch_files_end() is called.  Either way, the bytes written are
+counted, so a caller can report what it saved.
+
+The streams are built with fopencookie() (glibc) or funopen() (BSD,
+darwin).  Elsewhere, scratch files are never turned on and everything
+goes to disk as usual.  The list of scratch files and their streams are
+guarded by a lock, since FOPEN() and friends look in the list from any
+thread; only one set of scratch files can be in use at a time, though.
+*******************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "asf.h"
+
+#if defined(__GLIBC__)
+#define SCRATCH_FOPENCOOKIE
+#elif defined(darwin) || defined(__APPLE__) || defined(__FreeBSD__)
+#define SCRATCH_FUNOPEN
+#endif
+
+#if defined(SCRATCH_FOPENCOOKIE) || defined(SCRATCH_FUNOPEN)
+#include <pthread.h>
+static pthread_mutex_t scratch_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SCRATCH_LOCK() pthread_mutex_lock(&scratch_lock)
+#define SCRATCH_UNLOCK() pthread_mutex_unlock(&scratch_lock)
+#else
+#define SCRATCH_LOCK()
+#define SCRATCH_UNLOCK()
+#endif
+
+// Buffer size for scratch streams.
+#define SCRATCH_BUFFER (256*1024)
+
+typedef struct scratch_file {
+  char *name;
+  int exists;            // Has it been created (and not removed)?
+  char *data;            // Contents, while in memory.
+  long long size, capacity;
+  FILE *fp;              // Once on disk, the stream for it.
+  int refs;              // Open streams.
+  int detached;          // Removed while open: free on last close.
+  struct scratch_file *next;
+} scratch_file;
+
+typedef struct {
+  scratch_file *file;
+  long long pos;
+  int append;
+} scratch_handle;
+
+static struct {
+  int enabled;
+  long long limit;       // Most memory scratch files may use.
+  long long in_memory;   // Memory they use now.
+  long long peak;
+  long long memory_bytes, disk_bytes;
+  scratch_file *files;
+} scratch;
+
+static FILE *raw_fopen(const char *name, const char *mode)
+{
+#if defined(win32) || defined(darwin)
+  return fopen(name, mode);
+#else
+  return fopen64(name, mode);
+#endif
+}
+
+static scratch_file *scratch_find(const char *name)
+{
+  scratch_file *f;
+
+  if (!scratch.enabled || !name)
+    return NULL;
+  for (f = scratch.files; f; f = f->next)
+    if (strcmp(f->name, name) == 0)
+      return f;
+  return NULL;
+}
+
+static void free_contents(scratch_file *f)
+{
+  if (f->data) {
+    free(f->data);
+    scratch.in_memory -= f->capacity;
+  }
+  if (f->fp)
+    fclose(f->fp);
+  f->data = NULL;
+  f->fp = NULL;
+  f->size = f->capacity = 0;
+}
+
+static void free_scratch_file(scratch_file *f)
+{
+  free_contents(f);
+  free(f->name);
+  free(f);
+}
+
+// Move a scratch file's contents out to disk, where it stays.  The
+// messages go through fileExists() (to look for a stop file), so the
+// lock has to be let go first.
+static void scratch_spill(scratch_file *f)
+{
+  f->fp = raw_fopen(f->name, "w+b");
+  if (!f->fp) {
+    SCRATCH_UNLOCK();
+    asfPrintError("Cannot create '%s' for an intermediate image.\n",
+                  f->name);
+  }
+  if (f->size > 0 &&
+      (long long) fwrite(f->data, 1, f->size, f->fp) != f->size) {
+    SCRATCH_UNLOCK();
+    asfPrintError("Error writing '%s'.\n", f->name);
+  }
+  scratch.disk_bytes += f->size;
+
+  if (f->data) {
+    free(f->data);
+    scratch.in_memory -= f->capacity;
+  }
+  f->data = NULL;
+  f->capacity = 0;
+}
+
+// Make room for 'needed' bytes in memory, if the limit allows.
+static int scratch_grow(scratch_file *f, long long needed)
+{
+  long long capacity = needed > 2*f->capacity ? needed : 2*f->capacity;
+  char *data;
+
+  if (scratch.in_memory - f->capacity + capacity > scratch.limit)
+    capacity = needed;
+  if (scratch.in_memory - f->capacity + capacity > scratch.limit)
+    return FALSE;
+  if ((long long) (size_t) capacity != capacity)
+    return FALSE;
+
+  data = (char *) realloc(f->data, (size_t) capacity);
+  if (!data)
+    return FALSE;
+
+  f->data = data;
+  scratch.in_memory += capacity - f->capacity;
+  if (scratch.in_memory > scratch.peak)
+    scratch.peak = scratch.in_memory;
+  f->capacity = capacity;
+  return TRUE;
+}
+
+// The stream functions below take the lock themselves; everything else
+// static is called with it held.
+
+static long long scratch_read(scratch_handle *h, char *buf, long long len)
+{
+  scratch_file *f = h->file;
+  long long n;
+
+  SCRATCH_LOCK();
+  if (h->pos >= f->size) {
+    SCRATCH_UNLOCK();
+    return 0;
+  }
+  n = f->size - h->pos < len ? f->size - h->pos : len;
+  if (f->fp) {
+    FSEEK64(f->fp, h->pos, SEEK_SET);
+    n = fread(buf, 1, n, f->fp);
+  }
+  else {
+    memcpy(buf, f->data + h->pos, n);
+  }
+  h->pos += n;
+  SCRATCH_UNLOCK();
+  return n;
+}
+
+static long long scratch_write(scratch_handle *h, const char *buf,
+                               long long len)
+{
+  scratch_file *f = h->file;
+  long long end;
+  int spilled = FALSE;
+
+  SCRATCH_LOCK();
+  if (h->append)
+    h->pos = f->size;
+  end = h->pos + len;
+
+  if (!f->fp && end > f->capacity && !scratch_grow(f, end)) {
+    scratch_spill(f);
+    spilled = TRUE;
+  }
+
+  if (f->fp) {
+    FSEEK64(f->fp, h->pos, SEEK_SET);
+    if ((long long) fwrite(buf, 1, len, f->fp) != len) {
+      SCRATCH_UNLOCK();
+      return -1;
+    }
+    scratch.disk_bytes += len;
+  }
+  else {
+    // Writing past the end leaves a hole, which reads back as zeros.
+    if (h->pos > f->size)
+      memset(f->data + f->size, 0, h->pos - f->size);
+    memcpy(f->data + h->pos, buf, len);
+    scratch.memory_bytes += len;
+  }
+
+  h->pos = end;
+  if (end > f->size)
+    f->size = end;
+  SCRATCH_UNLOCK();
+
+  if (spilled)
+    asfPrintStatus("Not enough memory to keep %s, writing it to disk.\n",
+                   f->name);
+  return len;
+}
+
+static int scratch_seek(scratch_handle *h, long long *offset, int whence)
+{
+  long long pos;
+
+  SCRATCH_LOCK();
+  switch (whence) {
+    case SEEK_SET: pos = *offset; break;
+    case SEEK_CUR: pos = h->pos + *offset; break;
+    case SEEK_END: pos = h->file->size + *offset; break;
+    default: pos = -1; break;
+  }
+  if (pos >= 0) {
+    h->pos = pos;
+    *offset = pos;
+  }
+  SCRATCH_UNLOCK();
+  return pos >= 0 ? 0 : -1;
+}
+
+static int scratch_close(scratch_handle *h)
+{
+  scratch_file *f = h->file;
+
+  SCRATCH_LOCK();
+  if (f->fp)
+    fflush(f->fp);
+  if (--f->refs == 0 && f->detached)
+    free_scratch_file(f);
+  SCRATCH_UNLOCK();
+  free(h);
+  return 0;
+}
+
+#if defined(SCRATCH_FOPENCOOKIE)
+
+static ssize_t cookie_read(void *cookie, char *buf, size_t size)
+{
+  return scratch_read((scratch_handle *) cookie, buf, size);
+}
+
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size)
+{
+  // fopencookie wants 0, not -1, for a failed write.
+  long long ret = scratch_write((scratch_handle *) cookie, buf, size);
+  return ret < 0 ? 0 : ret;
+}
+
+static int cookie_seek(void *cookie, off64_t *offset, int whence)
+{
+  long long pos = *offset;
+  int ret = scratch_seek((scratch_handle *) cookie, &pos, whence);
+  *offset = pos;
+  return ret;
+}
+
+static int cookie_close(void *cookie)
+{
+  return scratch_close((scratch_handle *) cookie);
+}
+
+static FILE *open_stream(scratch_handle *h, const char *mode)
+{
+  cookie_io_functions_t io = { cookie_read, cookie_write, cookie_seek,
+                               cookie_close };
+  return fopencookie(h, mode, io);
+}
+
+#elif defined(SCRATCH_FUNOPEN)
+
+static int funopen_read(void *cookie, char *buf, int size)
+{
+  return (int) scratch_read((scratch_handle *) cookie, buf, size);
+}
+
+static int funopen_write(void *cookie, const char *buf, int size)
+{
+  return (int) scratch_write((scratch_handle *) cookie, buf, size);
+}
+
+static fpos_t funopen_seek(void *cookie, fpos_t offset, int whence)
+{
+  long long pos = offset;
+  if (scratch_seek((scratch_handle *) cookie, &pos, whence) < 0)
+    return -1;
+  return pos;
+}
+
+static int funopen_close(void *cookie)
+{
+  return scratch_close((scratch_handle *) cookie);
+}
+
+static FILE *open_stream(scratch_handle *h, const char *mode)
+{
+  int readable = mode[0] == 'r' || strchr(mode, '+');
+  int writable = mode[0] != 'r' || strchr(mode, '+');
+  return funopen(h, readable ? funopen_read : NULL,
+                 writable ? funopen_write : NULL, funopen_seek, funopen_close);
+}
+
+#endif
+
+/*******************************************************************
+FUNCTION NAME:   scratch_files_begin - start keeping scratch files
+                 in memory
+
+  memory_limit is the most memory, in bytes, the scratch files may use
+between them; with 0, they are all written to disk, but the bytes
+written are still counted.  Scratch files can't be nested: call
+scratch_files_end() first.
+*******************************************************************/
+void scratch_files_begin(long long memory_limit)
+{
+#if defined(SCRATCH_FOPENCOOKIE) || defined(SCRATCH_FUNOPEN)
+  SCRATCH_LOCK();
+  asfRequire(!scratch.enabled, "Scratch files are already in use.\n");
+  memset(&scratch, 0, sizeof(scratch));
+  scratch.limit = memory_limit > 0 ? memory_limit : 0;
+  scratch.enabled = TRUE;
+  SCRATCH_UNLOCK();
+#endif
+}
+
+/* Treat the file with the given name (as it will be opened, extension
+   and all) as a scratch file.  Does nothing unless scratch files have
+   been turned on. */
+static void add_scratch_file(const char *name)
+{
+  scratch_file *f;
+
+  if (!scratch.enabled || scratch_find(name))
+    return;
+
+  f = (scratch_file *) MALLOC(sizeof(scratch_file));
+  memset(f, 0, sizeof(scratch_file));
+  f->name = STRDUP(name);
+  f->next = scratch.files;
+  scratch.files = f;
+}
+
+void scratch_file_add(const char *name)
+{
+  SCRATCH_LOCK();
+  add_scratch_file(name);
+  SCRATCH_UNLOCK();
+}
+
+/*******************************************************************
+FUNCTION NAME:   scratch_files_end - stop keeping scratch files in
+                 memory
+
+  Scratch files that still exist are written to disk, where they would
+have been all along.  Returns the number of bytes written to scratch
+files in memory and on disk, and the most memory they used at once;
+any of the pointers may be NULL.
+*******************************************************************/
+void scratch_files_end(long long *memory_bytes, long long *disk_bytes,
+                       long long *peak_bytes)
+{
+  scratch_file *f, *next;
+
+  SCRATCH_LOCK();
+  for (f = scratch.files; f; f = next) {
+    next = f->next;
+    if (f->exists && !f->fp)
+      scratch_spill(f);
+    if (f->refs > 0) {
+      // Still open somewhere: it goes once the last stream is closed.
+      fflush(f->fp);
+      f->detached = TRUE;
+    }
+    else {
+      free_scratch_file(f);
+    }
+  }
+  scratch.files = NULL;
+  scratch.enabled = FALSE;
+
+  if (memory_bytes) *memory_bytes = scratch.memory_bytes;
+  if (disk_bytes) *disk_bytes = scratch.disk_bytes;
+  if (peak_bytes) *peak_bytes = scratch.peak;
+  SCRATCH_UNLOCK();
+}
+
+/* Open a scratch file.  Returns NULL if name isn't a scratch file, or
+   is one that doesn't exist and is being opened for reading: either
+   way, the caller should fall back to fopen(). */
+FILE *scratch_fopen(const char *name, const char *mode)
+{
+#if defined(SCRATCH_FOPENCOOKIE) || defined(SCRATCH_FUNOPEN)
+  scratch_file *f;
+  scratch_handle *h;
+  FILE *fp = NULL;
+
+  SCRATCH_LOCK();
+  f = scratch_find(name);
+  if (!f || (mode[0] == 'r' && !f->exists))
+    goto done;
+
+  if (mode[0] == 'w') {
+    // Truncate.
+    if (f->fp) {
+      fclose(f->fp);
+      f->fp = raw_fopen(f->name, "w+b");
+      if (!f->fp)
+        goto done;
+    }
+    f->size = 0;
+  }
+  if (!f->exists && !f->fp && scratch.limit <= 0)
+    scratch_spill(f);
+  f->exists = TRUE;
+
+  h = (scratch_handle *) MALLOC(sizeof(scratch_handle));
+  h->file = f;
+  h->pos = 0;
+  h->append = mode[0] == 'a';
+
+  fp = open_stream(h, mode);
+  if (!fp) {
+    free(h);
+    goto done;
+  }
+  setvbuf(fp, NULL, _IOFBF, SCRATCH_BUFFER);
+  f->refs++;
+
+ done:
+  SCRATCH_UNLOCK();
+  return fp;
+#else
+  return NULL;
+#endif
+}
+
+/* TRUE if name is a scratch file that exists. */
+int scratch_file_exists(const char *name)
+{
+  scratch_file *f;
+  int exists;
+
+  SCRATCH_LOCK();
+  f = scratch_find(name);
+  exists = f && f->exists;
+  SCRATCH_UNLOCK();
+  return exists;
+}
+
+/* Remove a scratch file.  Returns FALSE if name isn't a scratch file
+   that exists, and the caller should remove it itself. */
+int scratch_file_remove(const char *name)
+{
+  scratch_file *f;
+  int unlinked = TRUE;
+
+  SCRATCH_LOCK();
+  f = scratch_find(name);
+  if (!f || !f->exists) {
+    SCRATCH_UNLOCK();
+    return FALSE;
+  }
+
+  if (f->fp && unlink(f->name) < 0)
+    unlinked = FALSE;
+
+  if (f->refs > 0) {
+    // Open streams keep the old contents; later opens get a new file.
+    scratch_file *g;
+    f->detached = TRUE;
+    if (scratch.files == f)
+      scratch.files = f->next;
+    else {
+      for (g = scratch.files; g->next != f; g = g->next)
+        ;
+      g->next = f->next;
+    }
+    add_scratch_file(name);
+  }
+  else {
+    free_contents(f);
+    f->exists = FALSE;
+  }
+  SCRATCH_UNLOCK();
+
+  if (!unlinked)
+    asfPrintWarning("Could not remove file '%s'\n", name);
+  return TRUE;
+}
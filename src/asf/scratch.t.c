@@ -0,0 +1,66 @@
+#include "CUnit/Basic.h"
+#include "asf.h"
+
+#define SCRATCH_TEST_FILE "test_data/scratch_test.img"
+
+static void fill(unsigned char *buf, int n, int seed)
+{
+  int i;
+  for (i=0; i<n; ++i)
+    buf[i] = (unsigned char) (i*7 + seed);
+}
+
+static int read_back(const unsigned char *expected, int n)
+{
+  unsigned char *buf = MALLOC(n + 1);
+  FILE *fp = FOPEN(SCRATCH_TEST_FILE, "rb");
+  int got = fread(buf, 1, n + 1, fp);
+  int ok = got == n && memcmp(buf, expected, n) == 0;
+  FCLOSE(fp);
+  FREE(buf);
+  return ok;
+}
+
+void test_scratch()
+{
+  const int small = 1000, large = 5000;
+  unsigned char *data = MALLOC(large);
+  long long memory_bytes, disk_bytes, peak_bytes;
+  FILE *fp;
+
+  remove(SCRATCH_TEST_FILE);
+  scratch_files_begin(4096);
+  scratch_file_add(SCRATCH_TEST_FILE);
+  CU_ASSERT(!fileExists(SCRATCH_TEST_FILE));
+
+  // Small enough to stay in memory
+  fill(data, small, 1);
+  fp = FOPEN(SCRATCH_TEST_FILE, "wb");
+  CU_ASSERT(fwrite(data, 1, small, fp) == small);
+  FCLOSE(fp);
+  CU_ASSERT(fileExists(SCRATCH_TEST_FILE));
+  CU_ASSERT(!fopen(SCRATCH_TEST_FILE, "rb"));
+  CU_ASSERT(read_back(data, small));
+
+  // Rewritten past the limit, so it goes out to disk
+  fill(data, large, 2);
+  fp = FOPEN(SCRATCH_TEST_FILE, "wb");
+  CU_ASSERT(fwrite(data, 1, large, fp) == large);
+  FCLOSE(fp);
+  fp = fopen(SCRATCH_TEST_FILE, "rb");
+  CU_ASSERT(fp != NULL);
+  if (fp)
+    fclose(fp);
+  CU_ASSERT(read_back(data, large));
+
+  remove_file(SCRATCH_TEST_FILE);
+  CU_ASSERT(!fileExists(SCRATCH_TEST_FILE));
+  CU_ASSERT(!fopen(SCRATCH_TEST_FILE, "rb"));
+
+  scratch_files_end(&memory_bytes, &disk_bytes, &peak_bytes);
+  CU_ASSERT(memory_bytes == small);
+  CU_ASSERT(disk_bytes == large);
+  CU_ASSERT(peak_bytes > 0 && peak_bytes <= 4096);
+
+  FREE(data);
+}
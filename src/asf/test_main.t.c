@@ -4,6 +4,7 @@ void test_vector();
 void test_strUtil();
 void test_complex();
 void test_solve1d();
+void test_scratch();
 
 int main()
 {
@@ -24,7 +25,8 @@ int main()
    if ((NULL == CU_add_test(pSuite, "vector", test_vector)) ||
        (NULL == CU_add_test(pSuite, "strUtil", test_strUtil)) ||
        (NULL == CU_add_test(pSuite, "solve1d", test_solve1d)) ||
-       (NULL == CU_add_test(pSuite, "complex", test_complex)))
+       (NULL == CU_add_test(pSuite, "complex", test_complex)) ||
+       (NULL == CU_add_test(pSuite, "scratch", test_scratch)))
    {
       CU_cleanup_registry();
       return CU_get_error();
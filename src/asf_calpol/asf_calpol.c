@@ -3,7 +3,7 @@
 #define ASF_USAGE_STRING \
 "   "ASF_NAME_STRING" [-log <logfile>] [-quiet] [-c <classification file>]\n"\
 "          [-pauli] [-sinclair] [-freeman] [-make-feasible-boundary <size>]\n"\
-"          <in_base_name> <out_base_name>\n"
+"          [-threads <count>] <in_base_name> <out_base_name>\n"
 
 #define ASF_DESCRIPTION_STRING \
 "     This program decomposes SLC quad-pol data into data required\n"\
@@ -78,6 +78,10 @@
 "          processing, it will be added to the _ea_hist and _class_map\n"\
 "          temporary files.\n"\
 "\n"\
+"     -threads <count>\n"\
+"          Number of threads to compute the output lines on (default: one\n"\
+"          per processor).  The output does not depend on it.\n"\
+"\n"\
 "     -log <log file>\n"\
 "          Output will be written to a specified log file.\n"\
 "\n"\
@@ -173,6 +177,12 @@ main (int argc, char *argv[])
   int sinclair = extract_flag_options(&argc,&argv,"-sinclair","-s",NULL);
   int freeman = extract_flag_options(&argc,&argv,"-freeman","-f",NULL);
 
+  int thread_count=0;
+  extract_int_options(&argc,&argv,&thread_count,"-threads","--threads",NULL);
+  if (thread_count < 0)
+    asfPrintError("Invalid number of threads: %d\n", thread_count);
+  set_polarimetry_thread_count(thread_count);
+
   int sz;
   int make_boundary_file =
     extract_int_options(&argc,&argv,&sz,"-make-feasible-boundary",NULL);
@@ -12,6 +12,8 @@ following defines.
 "   "ASF_NAME_STRING" [-format <output_format>] [-byte <sample mapping option>]\n"\
 "              [-rgb <red> <green> <blue>] [-band <band_id | all>]\n"\
 "              [-lut <look up table file>] [-truecolor] [-falsecolor]\n"\
+"              [-cog] [-compression <deflate | lzw | zstd | none>]\n"\
+"              [-threads <count>]\n"\
 "              [-log <log_file>] [-quiet] [-license] [-version] [-help]\n"\
 "              <in_base_name> <out_full_name>\n"
 
@@ -146,6 +148,19 @@ following defines.
 "        specified rather than a band_id, then export all available bands into\n"\
 "        individual files, one for each band.  Default is '-band all'.\n"\
 "        Cannot be chosen together with the -rgb option.\n"\
+"   -cog\n"\
+"        Writes TIFF and GeoTIFF files as Cloud Optimized GeoTIFFs: the image\n"\
+"        is stored in compressed 512x512 tiles, together with reduced\n"\
+"        resolution overviews (each half the size of the one before), so that\n"\
+"        viewers, GIS packages and tile servers don't need to build their own.\n"\
+"        The tiles are compressed on all available processors.\n"\
+"   -compression <deflate | lzw | zstd | none>\n"\
+"        Compression for the tiles of a -cog file.  Default is 'deflate'.\n"\
+"        'zstd' is only available if the TIFF library supports it.\n"\
+"   -threads <count>\n"\
+"        Number of threads used to gather band statistics, read the bands\n"\
+"        ahead of the file writers and compress -cog tiles.  Default is one\n"\
+"        per processor.  With '-threads 1' everything is done in one thread.\n"\
 "   -log <logFile>\n"\
 "        Output will be written to a specified log file.\n"\
 "   -quiet\n"\
@@ -300,7 +315,7 @@ main (int argc, char *argv[])
   command_line.use_pixel_is_point = 0;
 
   int formatFlag, logFlag, quietFlag, byteFlag, rgbFlag, bandFlag, lutFlag, pixelIsPointFlag;
-  int truecolorFlag, falsecolorFlag;
+  int truecolorFlag, falsecolorFlag, cogFlag, compressionFlag, threadsFlag;
   int needed_args = 3;  //command & argument & argument
   int ii;
   char sample_mapping_string[25];
@@ -324,6 +339,9 @@ main (int argc, char *argv[])
   truecolorFlag = checkForOption("-truecolor", argc, argv);
   falsecolorFlag = checkForOption("-falsecolor", argc, argv);
   pixelIsPointFlag = checkForOption("-point", argc, argv);
+  cogFlag = checkForOption("-cog", argc, argv);
+  compressionFlag = checkForOption("-compression", argc, argv);
+  threadsFlag = checkForOption("-threads", argc, argv);
 
   if ( formatFlag != FLAG_NOT_SET ) {
     needed_args += 2;           // Option & parameter.
@@ -355,6 +373,15 @@ main (int argc, char *argv[])
   if ( pixelIsPointFlag != FLAG_NOT_SET ) {
     needed_args += 1;
   }
+  if ( cogFlag != FLAG_NOT_SET ) {
+    needed_args += 1;           // Option only
+  }
+  if ( compressionFlag != FLAG_NOT_SET ) {
+    needed_args += 2;           // Option & parameter.
+  }
+  if ( threadsFlag != FLAG_NOT_SET ) {
+    needed_args += 2;           // Option & parameter.
+  }
   if ( argc != needed_args ) {
     print_usage ();                   // This exits with a failure.
   }
@@ -399,6 +426,16 @@ main (int argc, char *argv[])
       print_usage ();
     }
   }
+  if ( compressionFlag != FLAG_NOT_SET ) {
+    if ( argv[compressionFlag + 1][0] == '-' || compressionFlag >= argc - 3 ) {
+      print_usage ();
+    }
+  }
+  if ( threadsFlag != FLAG_NOT_SET ) {
+    if ( argv[threadsFlag + 1][0] == '-' || threadsFlag >= argc - 3 ) {
+      print_usage ();
+    }
+  }
 
   // Make sure there are no flag incompatibilities
   if ( (rgbFlag != FLAG_NOT_SET           &&
@@ -768,6 +805,43 @@ main (int argc, char *argv[])
     command_line.use_pixel_is_point = pixelIsPointFlag != FLAG_NOT_SET; 
   }
 
+  if ( cogFlag != FLAG_NOT_SET ) {
+    tiff_compression_t compression = TIFF_DEFLATE;
+    if ( compressionFlag != FLAG_NOT_SET ) {
+      char *type = argv[compressionFlag + 1];
+      if ( strcmp_case(type, "DEFLATE") == 0 )
+        compression = TIFF_DEFLATE;
+      else if ( strcmp_case(type, "LZW") == 0 )
+        compression = TIFF_LZW;
+      else if ( strcmp_case(type, "ZSTD") == 0 )
+        compression = TIFF_ZSTD;
+      else if ( strcmp_case(type, "NONE") == 0 )
+        compression = TIFF_UNCOMPRESSED;
+      else
+        asfPrintError("Unrecognized compression type '%s'.\n", type);
+    }
+    if (strcmp_case(command_line.format, "GEOTIFF") != 0 &&
+        strcmp_case(command_line.format, "GEOTIF") != 0 &&
+        strcmp_case(command_line.format, "TIFF") != 0 &&
+        strcmp_case(command_line.format, "TIF") != 0)
+    {
+      asfPrintWarning("-cog option only applies to TIFF and GeoTIFF output\n");
+    }
+    set_tiff_export_layout(TIFF_COG, compression);
+  }
+  else if ( compressionFlag != FLAG_NOT_SET ) {
+    asfPrintWarning("-compression option has no effect without -cog\n");
+  }
+
+  if ( threadsFlag != FLAG_NOT_SET ) {
+    int thread_count = atoi(argv[threadsFlag + 1]);
+    if (thread_count < 1)
+      asfPrintError("Invalid number of threads: %s\n", argv[threadsFlag + 1]);
+    set_export_thread_count(thread_count);
+    set_stats_thread_count(thread_count);
+    set_tiff_export_thread_count(thread_count);
+  }
+
 /***********************END COMMAND LINE PARSING STUFF***********************/
 
   if ( strcmp_case (command_line.format, "ENVI") == 0 ) {
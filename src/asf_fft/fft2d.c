@@ -250,7 +250,7 @@ else
 			if(M==0) ifft2d(data, M3, M2);
 }
 
-void rfft2d(float *data, int M2, int M){
+void rfft2d_r(float *data, int M2, int M, float *cols){
 /* Compute 2D real fft and return results in-place	*/
 /* First performs real fft on rows using size from M to compute positive frequencies */
 /* then performs transform on columns using size from M2 to compute wavenumbers */
@@ -265,40 +265,43 @@ void rfft2d(float *data, int M2, int M){
 /* *data = input data array	*/
 /* M2 = log2 of fft size number of rows in */
 /* M = log2 of fft size number of columns in */
+/* *cols = scratch for 4 columns, 4*2*pow(2,M2) floats	*/
 /* OUTPUTS */
 /* *data = output data array	*/
+/* Since the caller supplies the column storage, several threads may run */
+/* rfft2d_r and rifft2d_r at once (fft2dInit must still be called first) */
 int i1;
 if((M2>0)&&(M>0)){
 	rffts(data, M, POW2(M2));
 	if (M==1){
-		cxpose(data, POW2(M)/2, Array2d[M2]+POW2(M2)*2, POW2(M2), POW2(M2), 1);
-		xpose(Array2d[M2]+POW2(M2)*2, 2, Array2d[M2], POW2(M2), POW2(M2), 2);
-		rffts(Array2d[M2], M2, 2);
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, cols+POW2(M2)*2, POW2(M2), POW2(M2), 1);
+		xpose(cols+POW2(M2)*2, 2, cols, POW2(M2), POW2(M2), 2);
+		rffts(cols, M2, 2);
+		cxpose(cols, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 	}
 	else if (M==2){
-		cxpose(data, POW2(M)/2, Array2d[M2]+POW2(M2)*2, POW2(M2), POW2(M2), 1);
-		xpose(Array2d[M2]+POW2(M2)*2, 2, Array2d[M2], POW2(M2), POW2(M2), 2);
-		rffts(Array2d[M2], M2, 2);
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, cols+POW2(M2)*2, POW2(M2), POW2(M2), 1);
+		xpose(cols+POW2(M2)*2, 2, cols, POW2(M2), POW2(M2), 2);
+		rffts(cols, M2, 2);
+		cxpose(cols, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		ffts(Array2d[M2], M2, 1);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, cols, POW2(M2), POW2(M2), 1);
+		ffts(cols, M2, 1);
+		cxpose(cols, POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
 	}
 	else{
-		cxpose(data, POW2(M)/2, Array2d[M2]+POW2(M2)*2, POW2(M2), POW2(M2), 1);
-		xpose(Array2d[M2]+POW2(M2)*2, 2, Array2d[M2], POW2(M2), POW2(M2), 2);
-		rffts(Array2d[M2], M2, 2);
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, cols+POW2(M2)*2, POW2(M2), POW2(M2), 1);
+		xpose(cols+POW2(M2)*2, 2, cols, POW2(M2), POW2(M2), 2);
+		rffts(cols, M2, 2);
+		cxpose(cols, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 3);
-		ffts(Array2d[M2], M2, 3);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, cols, POW2(M2), POW2(M2), 3);
+		ffts(cols, M2, 3);
+		cxpose(cols, POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
 		for (i1=4; i1<POW2(M)/2; i1+=4){
-			cxpose(data + i1*2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 4);
-			ffts(Array2d[M2], M2, 4);
-			cxpose(Array2d[M2], POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
+			cxpose(data + i1*2, POW2(M)/2, cols, POW2(M2), POW2(M2), 4);
+			ffts(cols, M2, 4);
+			cxpose(cols, POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
 		}
 	}
 }
@@ -306,46 +309,53 @@ else
 	rffts(data, M2+M, 1);
 }
 
-void rifft2d(float *data, int M2, int M){
+void rfft2d(float *data, int M2, int M){
+/* Compute 2D real fft and return results in-place	*/
+/* See rfft2d_r; this version uses the private column storage from fft2dInit */
+rfft2d_r(data, M2, M, Array2d[M2]);
+}
+
+void rifft2d_r(float *data, int M2, int M, float *cols){
 /* Compute 2D real ifft and return results in-place	*/
 /* The input must be in the order as outout from rfft2d */
 /* INPUTS */
 /* *data = input data array	*/
 /* M2 = log2 of fft size number of rows out */
 /* M = log2 of fft size number of columns out */
+/* *cols = scratch for 4 columns, 4*2*pow(2,M2) floats	*/
 /* OUTPUTS */
 /* *data = output data array	*/
 int i1;
 if((M2>0)&&(M>0)){
 	if (M==1){
-		cxpose(data, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		riffts(Array2d[M2], M2, 2);
-		xpose(Array2d[M2], POW2(M2), Array2d[M2]+POW2(M2)*2, 2, 2, POW2(M2));
-		cxpose(Array2d[M2]+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, cols, POW2(M2), POW2(M2), 1);
+		riffts(cols, M2, 2);
+		xpose(cols, POW2(M2), cols+POW2(M2)*2, 2, 2, POW2(M2));
+		cxpose(cols+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 	}
 	else if (M==2){
-		cxpose(data, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		riffts(Array2d[M2], M2, 2);
-		xpose(Array2d[M2], POW2(M2), Array2d[M2]+POW2(M2)*2, 2, 2, POW2(M2)); 
-		cxpose(Array2d[M2]+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, cols, POW2(M2), POW2(M2), 1);
+		riffts(cols, M2, 2);
+		xpose(cols, POW2(M2), cols+POW2(M2)*2, 2, 2, POW2(M2)); 
+		cxpose(cols+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		iffts(Array2d[M2], M2, 1);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, cols, POW2(M2), POW2(M2), 1);
+		iffts(cols, M2, 1);
+		cxpose(cols, POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
 	}
 	else{
-		cxpose(data, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		riffts(Array2d[M2], M2, 2);
-		xpose(Array2d[M2], POW2(M2), Array2d[M2]+POW2(M2)*2, 2, 2, POW2(M2));
-		cxpose(Array2d[M2]+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, cols, POW2(M2), POW2(M2), 1);
+		riffts(cols, M2, 2);
+		xpose(cols, POW2(M2), cols+POW2(M2)*2, 2, 2, POW2(M2));
+		cxpose(cols+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 3);
-		iffts(Array2d[M2], M2, 3);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, cols, POW2(M2), POW2(M2), 3);
+		iffts(cols, M2, 3);
+		cxpose(cols, POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
 		for (i1=4; i1<POW2(M)/2; i1+=4){
-			cxpose(data + i1*2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 4);
-			iffts(Array2d[M2], M2, 4);
-			cxpose(Array2d[M2], POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
+			cxpose(data + i1*2, POW2(M)/2, cols, POW2(M2), POW2(M2), 4);
+			iffts(cols, M2, 4);
+			cxpose(cols, POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
 		}
 	}
 	riffts(data, M, POW2(M2));
@@ -354,6 +364,12 @@ else
 	riffts(data, M2+M, 1);
 }
 
+void rifft2d(float *data, int M2, int M){
+/* Compute 2D real ifft and return results in-place	*/
+/* See rifft2d_r; this version uses the private column storage from fft2dInit */
+rifft2d_r(data, M2, M, Array2d[M2]);
+}
+
 void rspect2dprod(float *data1, float *data2, float *outdata, int N2, int N1){
 /* When multiplying a pair of 2d spectra from rfft2d care must be taken to multiply the*/
 /* four real values seperately from the complex ones. This routine does it correctly.*/
@@ -121,3 +121,10 @@ void rspect2dprod(float *data1, float *data2, float *outdata, int N2, int N1);
 /* *data2 = input data array	second spectra */
 /* N2 = fft size number of rows into rfft2d for both data1 and data2 */
 /* N1 = fft size number of columns into rfft2d for both data1 and data2 */
+
+void rfft2d_r(float *data, int M2, int M, float *cols);
+void rifft2d_r(float *data, int M2, int M, float *cols);
+/* Same as rfft2d and rifft2d, but using the column storage cols	*/
+/* (4*2*pow(2,M2) floats) instead of the private storage from fft2dInit, */
+/* so that several threads can transform at once.  fft2dInit must	*/
+/* still be called first, for the 1d fft tables.	*/
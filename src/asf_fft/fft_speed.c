@@ -0,0 +1,148 @@
+/*******************************************************************
+fft_speed:
+	Benchmark for the FFT plans in fftplan.c.  For typical sizes,
+reports the time per transform of the original ffts1() and of the plans
+(with and without their SSE2 kernels), and the largest difference from
+ffts1() relative to the size of the spectrum.  Lengths that are not a
+power of two, which ffts1() can't do, are timed against the next power
+of two up and checked against a direct DFT instead.
+*******************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "asf.h"
+#include "fft.h"
+#include "fftlib.h"
+
+/* From fftext.c */
+extern float *UtblArray[];
+extern short *BRLowArray[];
+
+/* Minimum time to spend on each measurement, in seconds. */
+#define MIN_TIME 0.25
+
+static double wall_clock(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* Forward DFT of in, the slow way, in double precision. */
+static void direct_dft(const float *in, int n, double *out)
+{
+	int j, k;
+
+	for (k = 0; k < n; k++) {
+		double re = 0, im = 0;
+		for (j = 0; j < n; j++) {
+			double angle = -2.0 * PI * ((long long)j * k % n) / n;
+			double c = cos(angle), s = sin(angle);
+			re += in[2*j] * c - in[2*j+1] * s;
+			im += in[2*j] * s + in[2*j+1] * c;
+		}
+		out[2*k] = re;
+		out[2*k+1] = im;
+	}
+}
+
+/* Microseconds per transform, either with ffts1 (plan==NULL) or a plan. */
+static double measure(const fft_plan *plan, int n, const float *in,
+	float *data)
+{
+	int M = (int)(log(n) / log(2.0) + 0.5);
+	double start = wall_clock(), elapsed;
+	long calls = 0;
+
+	memcpy(data, in, 2 * n * sizeof(float));
+	do {
+		int ii;
+		for (ii = 0; ii < 16; ii++) {
+			if (plan)
+				fft_plan_execute(plan, data, 1);
+			else
+				ffts1(data, M, 1, UtblArray[M], BRLowArray[M/2]);
+		}
+		calls += 16;
+		elapsed = wall_clock() - start;
+	} while (elapsed < MIN_TIME);
+
+	return elapsed / calls * 1e6;
+}
+
+static int benchmark(int n)
+{
+	int pow2 = (n & (n - 1)) == 0;
+	int M = (int)(ceil(log(n) / log(2.0)) + 0.5);
+	int ii, ok = TRUE;
+	/* Room for the power of two ffts1 is timed at. */
+	float *in = (float *) MALLOC(2 * (1 << M) * sizeof(float));
+	float *ref = (float *) MALLOC(2 * n * sizeof(float));
+	float *out = (float *) MALLOC(2 * (1 << M) * sizeof(float));
+	/* What the plan is compared with: ffts1(), or a direct DFT. */
+	double *dft = (double *) MALLOC(2 * n * sizeof(double));
+	double ffts_time, scalar_time, simd_time;
+
+	for (ii = 0; ii < 2 * (1 << M); ii++)
+		in[ii] = (float) rand() / RAND_MAX - 0.5;
+
+	fftInit(M);
+	ffts_time = measure(NULL, 1 << M, in, out);
+
+	set_fft_simd(FALSE);
+	scalar_time = measure(fft_plan_get(n, FFT_FORWARD), n, in, out);
+	set_fft_simd(TRUE);
+	simd_time = measure(fft_plan_get(n, FFT_FORWARD), n, in, out);
+
+	printf("%6d  ffts1%s %8.1f us  plan scalar %8.1f us  plan %8.1f us"
+	       "  x%4.1f", n, pow2 ? "   " : "(*)", ffts_time, scalar_time,
+	       simd_time, ffts_time / simd_time);
+
+	{
+		double err = 0, mag = 0;
+		memcpy(out, in, 2 * n * sizeof(float));
+		fft_plan_execute(fft_plan_get(n, FFT_FORWARD), out, 1);
+		if (pow2) {
+			memcpy(ref, in, 2 * n * sizeof(float));
+			ffts1(ref, M, 1, UtblArray[M], BRLowArray[M/2]);
+			for (ii = 0; ii < 2 * n; ii++)
+				dft[ii] = ref[ii];
+		}
+		else
+			direct_dft(in, n, dft);
+		for (ii = 0; ii < 2 * n; ii++) {
+			err = fmax(err, fabs(out[ii] - dft[ii]));
+			mag = fmax(mag, fabs(dft[ii]));
+		}
+		printf("  rel. diff %.1e", err / mag);
+		if (err / mag > 1e-5) {
+			printf("  MISMATCH");
+			ok = FALSE;
+		}
+	}
+	printf("\n");
+
+	FREE(in);
+	FREE(ref);
+	FREE(out);
+	FREE(dft);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	/* Powers of two from 1K to 32K, and some lengths from real data:
+	   ERS range lines, and patch/chip sizes people pick by hand. */
+	static const int sizes[] = { 1024, 2048, 4096, 8192, 16384, 32768,
+				     1000, 3000, 5616, 10000 };
+	int ii, ok = TRUE;
+
+	for (ii = 0; ii < (int)(sizeof(sizes) / sizeof(sizes[0])); ii++)
+		ok &= benchmark(sizes[ii]);
+	printf("(*) ffts1 timed at the next power of two.\n");
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
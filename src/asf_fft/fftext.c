@@ -71,7 +71,9 @@ for (i1=8*sizeof(int)-1; i1>=0; i1--){
 
 /*************************************************
  The following calls are easier than calling to fftlib directly.
- Just make sure fftlib has been called for each M first.
+ ffts and iffts go through the cached plans in fftplan.c and need no
+ initialization; for rffts and riffts, make sure fftInit has been
+ called for each M first.
 **************************************************/
 
 void ffts(float *data, int M, int Rows){
@@ -82,7 +84,7 @@ void ffts(float *data, int M, int Rows){
 /* Rows = number of rows in ioptr array (use 1 for Rows for a single fft)	*/
 /* OUTPUTS */
 /* *ioptr = output data array	*/
-	ffts1(data, M, Rows, UtblArray[M], BRLowArray[M/2]);
+	fft_plan_execute(fft_plan_get(POW2(M), FFT_FORWARD), data, Rows);
 }
 
 void iffts(float *data, int M, int Rows){
@@ -93,7 +95,11 @@ void iffts(float *data, int M, int Rows){
 /* Rows = number of rows in ioptr array (use 1 for Rows for a single fft)	*/
 /* OUTPUTS */
 /* *ioptr = output data array	*/
-	iffts1(data, M, Rows, UtblArray[M], BRLowArray[M/2]);
+	const float scale = 1.0/POW2(M);
+	size_t i1, count = 2 * POW2(M) * (size_t)Rows;
+	fft_plan_execute(fft_plan_get(POW2(M), FFT_INVERSE), data, Rows);
+	for (i1 = 0; i1 < count; i1++)
+		data[i1] *= scale;
 }
 
 void rffts(float *data, int M, int Rows){
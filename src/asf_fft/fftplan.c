@@ -0,0 +1,520 @@
+/*******************************************************************
+fftplan.c:
+	Complex FFTs of any length, through plans that are built once
+per size and direction and then shared.
+
+	A plan holds everything that depends only on the length and the
+direction of the transform -- twiddle factors, and for lengths that are
+not a power of two the Bluestein chirp and its transform -- so calling
+code never recomputes tables.  fft_plan_get() keeps every plan it builds
+in a cache, and is safe to call from any thread; a plan is never freed,
+so callers may hold on to the pointer.
+
+	Powers of two are transformed with a radix-4 Stockham (self
+sorting) FFT, with a final radix-2 pass when log2(n) is odd.  It needs
+no bit reversal, and every pass reads and writes the data in long unit
+stride runs, which lets the SSE2 butterflies work on two complex values
+at a time.  Other lengths are done as a circular convolution of a
+power of two length (Bluestein's algorithm), which costs roughly three
+power-of-two transforms.
+
+	Transforms are in place and unnormalized in both directions:
+FFT_FORWARD computes sum(x[j]*exp(-2*pi*i*j*k/n)), FFT_INVERSE the same
+with exp(+2*pi*i*j*k/n).  ffts() and iffts() in fftext.c are wrappers over
+these plans (iffts() applies the 1/n scaling).
+*******************************************************************/
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+
+#include "asf.h"
+#include "fft.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    defined(__SSE2__)
+#  define ASF_SSE2_FFT
+#  include <emmintrin.h>
+#endif
+
+struct fft_plan {
+	int n;			/* transform length (complex values)	*/
+	int dir;		/* FFT_FORWARD or FFT_INVERSE		*/
+	int work_size;		/* complex values of scratch needed	*/
+
+	/* Power of two lengths. */
+	float *tw;		/* tw[k] = exp(dir*2*pi*i*k/n), k<n	*/
+	float *tw1, *tw2, *tw3;	/* first pass twiddles, k<n/4	*/
+
+	/* Other lengths (Bluestein). */
+	const fft_plan *fwd, *inv;	/* power of two sub-plans	*/
+	float *chirp;		/* exp(dir*pi*i*k*k/n), k<n		*/
+	float *filter;		/* transformed conjugate chirp, over m	*/
+};
+
+/* Read once per transform, and only changed by set_fft_simd(). */
+static volatile gint use_simd = TRUE;
+
+/*******************************************************************
+Twiddle factors are computed in double precision from k mod n, so the
+tables are as accurate as single precision allows at every size.
+*******************************************************************/
+static void unit_root(float *w, long long k, long long n, int dir)
+{
+	double angle = dir * 2.0 * PI * (double)(k % n) / (double)n;
+	w[0] = (float)cos(angle);
+	w[1] = (float)sin(angle);
+}
+
+static int is_pow2(int n)
+{
+	return n > 0 && (n & (n - 1)) == 0;
+}
+
+/*******************************************************************
+Radix-4 and radix-2 Stockham passes, scalar versions.  A pass of
+length l and stride s reads x as s interleaved sequences of length l
+and writes the l/4 (or l/2) point sub-sequences that the next pass, with
+stride 4*s (or 2*s), works on.  x and y are interleaved complex floats.
+*******************************************************************/
+static void radix4_pass(const fft_plan *plan, int l, int s,
+	const float *x, float *y)
+{
+	int m = l / 4;
+	int stride = plan->n / l;	/* into plan->tw */
+	int p, q;
+
+	for (p = 0; p < m; p++) {
+		const float *w1 = plan->tw + 2 * (p * stride);
+		const float *w2 = plan->tw + 2 * (2 * p * stride);
+		const float *w3 = plan->tw + 2 * (3 * p * stride);
+		for (q = 0; q < s; q++) {
+			const float *a = x + 2 * (q + s * p);
+			const float *b = a + 2 * s * m;
+			const float *c = b + 2 * s * m;
+			const float *d = c + 2 * s * m;
+			float *out = y + 2 * (q + s * 4 * p);
+			float apc_r = a[0] + c[0], apc_i = a[1] + c[1];
+			float amc_r = a[0] - c[0], amc_i = a[1] - c[1];
+			float bpd_r = b[0] + d[0], bpd_i = b[1] + d[1];
+			/* (b-d) times -i (forward) or i (inverse) */
+			float jbmd_r, jbmd_i, t_r, t_i;
+			if (plan->dir == FFT_FORWARD) {
+				jbmd_r = b[1] - d[1];
+				jbmd_i = d[0] - b[0];
+			}
+			else {
+				jbmd_r = d[1] - b[1];
+				jbmd_i = b[0] - d[0];
+			}
+
+			out[0] = apc_r + bpd_r;
+			out[1] = apc_i + bpd_i;
+			t_r = amc_r + jbmd_r;
+			t_i = amc_i + jbmd_i;
+			out[2 * s] = t_r * w1[0] - t_i * w1[1];
+			out[2 * s + 1] = t_r * w1[1] + t_i * w1[0];
+			t_r = apc_r - bpd_r;
+			t_i = apc_i - bpd_i;
+			out[4 * s] = t_r * w2[0] - t_i * w2[1];
+			out[4 * s + 1] = t_r * w2[1] + t_i * w2[0];
+			t_r = amc_r - jbmd_r;
+			t_i = amc_i - jbmd_i;
+			out[6 * s] = t_r * w3[0] - t_i * w3[1];
+			out[6 * s + 1] = t_r * w3[1] + t_i * w3[0];
+		}
+	}
+}
+
+static void radix2_pass(int s, const float *x, float *y)
+{
+	int q;
+	for (q = 0; q < s; q++) {
+		const float *a = x + 2 * q;
+		const float *b = a + 2 * s;
+		y[2 * q] = a[0] + b[0];
+		y[2 * q + 1] = a[1] + b[1];
+		y[2 * (q + s)] = a[0] - b[0];
+		y[2 * (q + s) + 1] = a[1] - b[1];
+	}
+}
+
+#ifdef ASF_SSE2_FFT
+/*******************************************************************
+SSE2 versions of the passes: each __m128 holds two complex values.
+They do the same arithmetic as the scalar passes, so the results are
+identical.
+*******************************************************************/
+
+/* z times w, where wr = (w.r,w.r,w.r,w.r) and wi = (-w.i,w.i,-w.i,w.i). */
+static inline __m128 cmul_sse2(__m128 z, __m128 wr, __m128 wi)
+{
+	__m128 zswap = _mm_shuffle_ps(z, z, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_add_ps(_mm_mul_ps(z, wr), _mm_mul_ps(zswap, wi));
+}
+
+/* Split one or two complex twiddles into the form cmul_sse2() wants. */
+static inline void twiddle_sse2(__m128 w, __m128 *wr, __m128 *wi)
+{
+	const __m128 neg_even = _mm_castsi128_ps(
+		_mm_set_epi32(0, 0x80000000, 0, 0x80000000));
+	*wr = _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 0, 0));
+	*wi = _mm_xor_ps(_mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 1, 1)),
+			 neg_even);
+}
+
+static inline __m128 load_twiddle_sse2(const float *w)
+{
+	return _mm_castpd_ps(_mm_load1_pd((const double *)w));
+}
+
+/* The radix-4 butterfly on two complex values from each quarter. */
+#define BUTTERFLY4_SSE2(a, b, c, d, jmask, o0, o1, o2, o3)		\
+	do {								\
+		__m128 apc = _mm_add_ps(a, c), amc = _mm_sub_ps(a, c);	\
+		__m128 bpd = _mm_add_ps(b, d), bmd = _mm_sub_ps(b, d);	\
+		__m128 jbmd = _mm_xor_ps(_mm_shuffle_ps(bmd, bmd,	\
+				_MM_SHUFFLE(2, 3, 0, 1)), jmask);	\
+		o0 = _mm_add_ps(apc, bpd);				\
+		o1 = _mm_add_ps(amc, jbmd);				\
+		o2 = _mm_sub_ps(apc, bpd);				\
+		o3 = _mm_sub_ps(amc, jbmd);				\
+	} while (0)
+
+/* Multiplying by -i (forward) or i (inverse) after swapping re and im. */
+static inline __m128 jmask_sse2(int dir)
+{
+	if (dir == FFT_FORWARD)
+		return _mm_castsi128_ps(_mm_set_epi32(0x80000000, 0,
+						      0x80000000, 0));
+	return _mm_castsi128_ps(_mm_set_epi32(0, 0x80000000, 0, 0x80000000));
+}
+
+/* The first pass (stride 1): vectorized over pairs of butterflies. */
+static void radix4_first_pass_sse2(const fft_plan *plan, const float *x,
+	float *y)
+{
+	int m = plan->n / 4;
+	const __m128 jmask = jmask_sse2(plan->dir);
+	int p;
+
+	for (p = 0; p < m; p += 2) {
+		__m128 a = _mm_loadu_ps(x + 2 * p);
+		__m128 b = _mm_loadu_ps(x + 2 * (p + m));
+		__m128 c = _mm_loadu_ps(x + 2 * (p + 2 * m));
+		__m128 d = _mm_loadu_ps(x + 2 * (p + 3 * m));
+		__m128 o0, o1, o2, o3, wr, wi;
+		BUTTERFLY4_SSE2(a, b, c, d, jmask, o0, o1, o2, o3);
+		twiddle_sse2(_mm_loadu_ps(plan->tw1 + 2 * p), &wr, &wi);
+		o1 = cmul_sse2(o1, wr, wi);
+		twiddle_sse2(_mm_loadu_ps(plan->tw2 + 2 * p), &wr, &wi);
+		o2 = cmul_sse2(o2, wr, wi);
+		twiddle_sse2(_mm_loadu_ps(plan->tw3 + 2 * p), &wr, &wi);
+		o3 = cmul_sse2(o3, wr, wi);
+		/* Butterfly p goes to y[4p..4p+3], p+1 to y[4p+4..4p+7]. */
+		_mm_storeu_ps(y + 8 * p, _mm_movelh_ps(o0, o1));
+		_mm_storeu_ps(y + 8 * p + 4, _mm_movelh_ps(o2, o3));
+		_mm_storeu_ps(y + 8 * p + 8, _mm_movehl_ps(o1, o0));
+		_mm_storeu_ps(y + 8 * p + 12, _mm_movehl_ps(o3, o2));
+	}
+}
+
+/* Later passes (stride >= 4): vectorized along the stride. */
+static void radix4_pass_sse2(const fft_plan *plan, int l, int s,
+	const float *x, float *y)
+{
+	int m = l / 4;
+	int stride = plan->n / l;
+	const __m128 jmask = jmask_sse2(plan->dir);
+	int p, q;
+
+	for (p = 0; p < m; p++) {
+		__m128 w1r, w1i, w2r, w2i, w3r, w3i;
+		const float *xp = x + 2 * s * p;
+		float *yp = y + 2 * s * 4 * p;
+		twiddle_sse2(load_twiddle_sse2(plan->tw + 2 * (p * stride)),
+			     &w1r, &w1i);
+		twiddle_sse2(load_twiddle_sse2(plan->tw + 2 * (2 * p * stride)),
+			     &w2r, &w2i);
+		twiddle_sse2(load_twiddle_sse2(plan->tw + 2 * (3 * p * stride)),
+			     &w3r, &w3i);
+		for (q = 0; q < s; q += 2) {
+			__m128 a = _mm_loadu_ps(xp + 2 * q);
+			__m128 b = _mm_loadu_ps(xp + 2 * (q + s * m));
+			__m128 c = _mm_loadu_ps(xp + 2 * (q + 2 * s * m));
+			__m128 d = _mm_loadu_ps(xp + 2 * (q + 3 * s * m));
+			__m128 o0, o1, o2, o3;
+			BUTTERFLY4_SSE2(a, b, c, d, jmask, o0, o1, o2, o3);
+			_mm_storeu_ps(yp + 2 * q, o0);
+			_mm_storeu_ps(yp + 2 * (q + s), cmul_sse2(o1, w1r, w1i));
+			_mm_storeu_ps(yp + 2 * (q + 2 * s),
+				      cmul_sse2(o2, w2r, w2i));
+			_mm_storeu_ps(yp + 2 * (q + 3 * s),
+				      cmul_sse2(o3, w3r, w3i));
+		}
+	}
+}
+
+static void radix2_pass_sse2(int s, const float *x, float *y)
+{
+	int q;
+	for (q = 0; q < s; q += 2) {
+		__m128 a = _mm_loadu_ps(x + 2 * q);
+		__m128 b = _mm_loadu_ps(x + 2 * (q + s));
+		_mm_storeu_ps(y + 2 * q, _mm_add_ps(a, b));
+		_mm_storeu_ps(y + 2 * (q + s), _mm_sub_ps(a, b));
+	}
+}
+#endif /* ASF_SSE2_FFT */
+
+/*******************************************************************
+Power of two transform of one row, using work (n complex values).
+*******************************************************************/
+static void stockham(const fft_plan *plan, float *data, float *work)
+{
+	int n = plan->n;
+	float *x = data, *y = work, *t;
+	int l = n, s = 1;
+#ifdef ASF_SSE2_FFT
+	int simd = g_atomic_int_get(&use_simd);
+#endif
+
+	if (n == 1)
+		return;
+
+	while (l >= 4) {
+#ifdef ASF_SSE2_FFT
+		if (simd && s == 1 && l >= 8)
+			radix4_first_pass_sse2(plan, x, y);
+		else if (simd && s >= 2)
+			radix4_pass_sse2(plan, l, s, x, y);
+		else
+#endif
+			radix4_pass(plan, l, s, x, y);
+		t = x; x = y; y = t;
+		l /= 4;
+		s *= 4;
+	}
+	if (l == 2) {
+#ifdef ASF_SSE2_FFT
+		if (simd && s >= 2)
+			radix2_pass_sse2(s, x, y);
+		else
+#endif
+			radix2_pass(s, x, y);
+		t = x; x = y; y = t;
+	}
+	if (x != data)
+		memcpy(data, x, n * 2 * sizeof(float));
+}
+
+/*******************************************************************
+Bluestein: with c[k] = exp(dir*pi*i*k*k/n), the transform is
+X[k] = c[k] * sum_j (x[j]*c[j]) * conj(c[k-j]), a convolution that is
+done circularly at a power of two length m >= 2n-1.  work holds 2m
+complex values.
+*******************************************************************/
+static void bluestein(const fft_plan *plan, float *data, float *work)
+{
+	int n = plan->n, m = plan->fwd->n;
+	float *a = work, *inner = work + 2 * m;
+	int k;
+
+	for (k = 0; k < n; k++) {
+		const float *c = plan->chirp + 2 * k;
+		float re = data[2 * k], im = data[2 * k + 1];
+		a[2 * k] = re * c[0] - im * c[1];
+		a[2 * k + 1] = re * c[1] + im * c[0];
+	}
+	memset(a + 2 * n, 0, (m - n) * 2 * sizeof(float));
+
+	stockham(plan->fwd, a, inner);
+	for (k = 0; k < m; k++) {
+		const float *f = plan->filter + 2 * k;
+		float re = a[2 * k], im = a[2 * k + 1];
+		a[2 * k] = re * f[0] - im * f[1];
+		a[2 * k + 1] = re * f[1] + im * f[0];
+	}
+	stockham(plan->inv, a, inner);
+
+	for (k = 0; k < n; k++) {
+		const float *c = plan->chirp + 2 * k;
+		float re = a[2 * k], im = a[2 * k + 1];
+		data[2 * k] = re * c[0] - im * c[1];
+		data[2 * k + 1] = re * c[1] + im * c[0];
+	}
+}
+
+/*******************************************************************
+Plan construction and the plan cache.
+*******************************************************************/
+static fft_plan *plan_new(int n, int dir)
+{
+	fft_plan *plan = (fft_plan *) MALLOC(sizeof(fft_plan));
+	int k;
+
+	memset(plan, 0, sizeof(fft_plan));
+	plan->n = n;
+	plan->dir = dir;
+
+	if (is_pow2(n)) {
+		plan->work_size = n;
+		plan->tw = (float *) MALLOC(2 * n * sizeof(float));
+		for (k = 0; k < n; k++)
+			unit_root(plan->tw + 2 * k, k, n, dir);
+		if (n >= 4) {
+			int m = n / 4;
+			plan->tw1 = (float *) MALLOC(6 * m * sizeof(float));
+			plan->tw2 = plan->tw1 + 2 * m;
+			plan->tw3 = plan->tw2 + 2 * m;
+			for (k = 0; k < m; k++) {
+				memcpy(plan->tw1 + 2 * k, plan->tw + 2 * k,
+				       2 * sizeof(float));
+				memcpy(plan->tw2 + 2 * k, plan->tw + 4 * k,
+				       2 * sizeof(float));
+				memcpy(plan->tw3 + 2 * k, plan->tw + 6 * k,
+				       2 * sizeof(float));
+			}
+		}
+	}
+	else {
+		int m = 1;
+		float *b;
+		while (m < 2 * n - 1)
+			m *= 2;
+		plan->fwd = fft_plan_get(m, FFT_FORWARD);
+		plan->inv = fft_plan_get(m, FFT_INVERSE);
+		plan->work_size = 2 * m;
+
+		/* k*k mod 2n keeps the chirp's phase exact for large k. */
+		plan->chirp = (float *) MALLOC(2 * n * sizeof(float));
+		for (k = 0; k < n; k++)
+			unit_root(plan->chirp + 2 * k,
+				  ((long long)k * k) % (2LL * n), 2LL * n, dir);
+
+		/* conj(chirp), wrapped around for the circular convolution,
+		   transformed, and scaled for the unnormalized inverse. */
+		b = (float *) CALLOC(2 * m, sizeof(float));
+		for (k = 0; k < n; k++) {
+			b[2 * k] = plan->chirp[2 * k];
+			b[2 * k + 1] = -plan->chirp[2 * k + 1];
+			if (k > 0) {
+				b[2 * (m - k)] = b[2 * k];
+				b[2 * (m - k) + 1] = b[2 * k + 1];
+			}
+		}
+		plan->filter = (float *) MALLOC(2 * m * sizeof(float));
+		{
+			float *work = (float *) MALLOC(2 * m * sizeof(float));
+			stockham(plan->fwd, b, work);
+			FREE(work);
+		}
+		for (k = 0; k < 2 * m; k++)
+			plan->filter[k] = b[k] / m;
+		FREE(b);
+	}
+
+	return plan;
+}
+
+G_LOCK_DEFINE_STATIC(fft_plan_cache);
+static GHashTable *fft_plan_cache = NULL;
+
+const fft_plan *fft_plan_get(int n, int dir)
+{
+	fft_plan *plan;
+	gpointer key;
+
+	if (n <= 0)
+		asfPrintError("fft_plan_get: invalid FFT length %d\n", n);
+	dir = dir < 0 ? FFT_FORWARD : FFT_INVERSE;
+	key = GINT_TO_POINTER(dir == FFT_FORWARD ? 2 * n : 2 * n + 1);
+
+	G_LOCK(fft_plan_cache);
+	if (!fft_plan_cache)
+		fft_plan_cache = g_hash_table_new(g_direct_hash, g_direct_equal);
+	plan = (fft_plan *) g_hash_table_lookup(fft_plan_cache, key);
+	G_UNLOCK(fft_plan_cache);
+	if (plan)
+		return plan;
+
+	/* Built outside the lock: a Bluestein plan gets its sub-plans from
+	   here.  If two threads race, one of the plans is thrown away. */
+	plan = plan_new(n, dir);
+
+	G_LOCK(fft_plan_cache);
+	{
+		fft_plan *other = (fft_plan *)
+			g_hash_table_lookup(fft_plan_cache, key);
+		if (other) {
+			FREE(plan->tw);
+			FREE(plan->tw1);
+			FREE(plan->chirp);
+			FREE(plan->filter);
+			FREE(plan);
+			plan = other;
+		}
+		else
+			g_hash_table_insert(fft_plan_cache, key, plan);
+	}
+	G_UNLOCK(fft_plan_cache);
+	return plan;
+}
+
+int fft_plan_size(const fft_plan *plan)
+{
+	return plan->n;
+}
+
+/*******************************************************************
+Scratch space: one buffer per thread, grown as needed and kept, so
+executing a plan does not allocate.
+*******************************************************************/
+typedef struct {
+	float *buf;
+	int size;	/* complex values */
+} fft_scratch;
+
+static void fft_scratch_free(gpointer data)
+{
+	fft_scratch *scratch = (fft_scratch *) data;
+	FREE(scratch->buf);
+	FREE(scratch);
+}
+
+static GPrivate fft_scratch_key = G_PRIVATE_INIT(fft_scratch_free);
+
+static float *get_scratch(int size)
+{
+	fft_scratch *scratch = (fft_scratch *) g_private_get(&fft_scratch_key);
+	if (!scratch) {
+		scratch = (fft_scratch *) MALLOC(sizeof(fft_scratch));
+		scratch->buf = NULL;
+		scratch->size = 0;
+		g_private_set(&fft_scratch_key, scratch);
+	}
+	if (scratch->size < size) {
+		FREE(scratch->buf);
+		scratch->buf = (float *) MALLOC(2 * size * sizeof(float));
+		scratch->size = size;
+	}
+	return scratch->buf;
+}
+
+void fft_plan_execute(const fft_plan *plan, float *data, int rows)
+{
+	float *work = get_scratch(plan->work_size);
+	int row;
+
+	for (row = 0; row < rows; row++) {
+		float *r = data + 2 * (size_t)plan->n * row;
+		if (plan->chirp)
+			bluestein(plan, r, work);
+		else
+			stockham(plan, r, work);
+	}
+}
+
+void set_fft_simd(int enable)
+{
+	g_atomic_int_set(&use_simd, enable);
+}
@@ -0,0 +1,94 @@
+/*******************************************************************
+fftplan.t:
+	Checks the FFT plans in fftplan.c against a direct DFT computed in
+double precision, in both directions, for powers of two and for the
+other lengths that go through Bluestein's algorithm.  Each length is
+also run with the SSE2 kernels turned off.
+*******************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asf.h"
+#include "fft.h"
+
+/* Largest error allowed, relative to the largest output value. */
+#define TOLERANCE 1e-5
+
+static int failures = 0;
+
+/* out = sum_j in[j]*exp(dir*2*pi*i*j*k/n), in double precision. */
+static void direct_dft(const float *in, int n, int dir, double *out)
+{
+	int j, k;
+
+	for (k = 0; k < n; k++) {
+		double re = 0, im = 0;
+		for (j = 0; j < n; j++) {
+			double angle = dir * 2.0 * PI * ((long long)j * k % n) / n;
+			double c = cos(angle), s = sin(angle);
+			re += in[2*j] * c - in[2*j+1] * s;
+			im += in[2*j] * s + in[2*j+1] * c;
+		}
+		out[2*k] = re;
+		out[2*k+1] = im;
+	}
+}
+
+static void plan_test(int n, int dir, int simd)
+{
+	float *in = (float *) MALLOC(2 * n * sizeof(float));
+	float *out = (float *) MALLOC(2 * n * sizeof(float));
+	double *ref = (double *) MALLOC(2 * n * sizeof(double));
+	double err = 0, mag = 0;
+	int ii;
+
+	for (ii = 0; ii < 2 * n; ii++)
+		in[ii] = (float) rand() / RAND_MAX - 0.5;
+	direct_dft(in, n, dir, ref);
+
+	set_fft_simd(simd);
+	memcpy(out, in, 2 * n * sizeof(float));
+	fft_plan_execute(fft_plan_get(n, dir), out, 1);
+	set_fft_simd(TRUE);
+
+	for (ii = 0; ii < 2 * n; ii++) {
+		err = fmax(err, fabs(out[ii] - ref[ii]));
+		mag = fmax(mag, fabs(ref[ii]));
+	}
+	if (err / mag > TOLERANCE) {
+		printf("%6d %s%s: relative error %.1e <-- FAILED\n", n,
+		       dir == FFT_FORWARD ? "forward" : "inverse",
+		       simd ? "" : " (scalar)", err / mag);
+		failures++;
+	}
+
+	FREE(in);
+	FREE(out);
+	FREE(ref);
+}
+
+int main(int argc, char *argv[])
+{
+	/* Powers of two with both an even and an odd number of radix-4
+	   passes, and other lengths: small primes, products of small
+	   primes, and sizes from real data. */
+	static const int sizes[] = { 1, 2, 4, 8, 32, 1024, 2048,
+				     3, 5, 7, 12, 100, 127, 1000, 3000, 5616 };
+	int ii;
+
+	srand(4242);
+	for (ii = 0; ii < (int)(sizeof(sizes) / sizeof(sizes[0])); ii++) {
+		plan_test(sizes[ii], FFT_FORWARD, TRUE);
+		plan_test(sizes[ii], FFT_INVERSE, TRUE);
+		plan_test(sizes[ii], FFT_FORWARD, FALSE);
+	}
+
+	if (failures > 0) {
+		printf("%d checks FAILED\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+	return EXIT_SUCCESS;
+}
@@ -26,7 +26,8 @@ trouble, and use edit_man_header. :)
 "             [-force] [-resample-method <method>] [-height <height>]\n"\
 "             [-datum <datum>] [-pixel-size <pixel size>] [-band <band_id | all>]\n"\
 "             [-log <file>] [-write-proj-file <file>] [-read-proj-file <file>]\n"\
-"             [-save-mapping] [-background <value>] [-quiet] [-license]\n"\
+"             [-save-mapping] [-background <value>] [-threads <count>]\n"\
+"             [-quiet] [-license]\n"\
 "             [-version] [-help]\n"\
 "             <in_base_name> <out_base_name>\n"\
 "\n"\
@@ -58,6 +59,11 @@ trouble, and use edit_man_header. :)
 "          original file, the other the sample numbers.  Together, these\n"\
 "          define the mapping of pixels performed by the geocoding.\n"\
 "\n"\
+"     -threads <count>\n"\
+"          Resample the output image using this many threads.  Use 0 to\n"\
+"          run one thread per processor.  The default is 1.  The output\n"\
+"          does not depend on the number of threads.\n"\
+"\n"\
 "     -log <log file>\n"\
 "          Output will be written to a specified log file.\n"\
 "\n"\
@@ -189,6 +195,8 @@ main (int argc, char **argv)
   double background_val = 0.0;
   // Should we save the mapping files?
   int save_map_flag;
+  // Number of resampling threads
+  int thread_count = 1;
 
   if (detect_flag_options(argc, argv, "-help", "--help", "-h", NULL)) {
     print_help();
@@ -205,6 +213,10 @@ main (int argc, char **argv)
   }
   quietflag = detect_flag_options(argc, argv, "-quiet", "--quiet", NULL);
   save_map_flag = extract_flag_options(&argc, &argv, "-save-mapping", "--save_mapping", NULL);
+  extract_int_options(&argc, &argv, &thread_count, "-threads", "--threads", NULL);
+  if (thread_count < 0)
+    asfPrintError("Invalid number of threads: %d\n", thread_count);
+  set_geocode_thread_count(thread_count);
 
   handle_license_and_version_args(argc, argv, ASF_NAME_STRING);
 
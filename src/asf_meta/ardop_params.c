@@ -37,6 +37,7 @@ struct INPUT_ARDOP_PARAMS *get_input_ardop_params_struct(char *in1, char *out)
     ret->fdd = NULL;
     ret->fddd = NULL;
     ret->iflag = NULL;
+    ret->nthreads = NULL;
 
     return ret;
 }
@@ -79,6 +80,7 @@ void apply_in_ardop_params_to_ardop_params(struct INPUT_ARDOP_PARAMS *in,
     ApplyField(fdd);
     ApplyField(fddd);
     ApplyField(iflag);
+    ApplyField(nthreads);
 
 #undef ApplyField
 }
@@ -611,6 +611,20 @@ void ddr2meta(struct DDR *ddr, meta_parameters *meta);
 /* In meta_copy.c: Allocates new structure and fills it will values from src */
 meta_parameters *meta_copy(meta_parameters *src);
 
+/* In meta_cache.c: parsed metadata is cached, and meta_read() returns
+   copies of it.  meta_read_shared() returns the cached structure itself,
+   read only, until it is given back with meta_release().  The cache is
+   on by default; the binary sidecar (<image>.metab, loaded without
+   parsing the .meta) is off, unless asf_mapready's "save binary
+   metadata" turns it on.  */
+const meta_parameters *meta_read_shared(const char *inName);
+void meta_release(const meta_parameters *meta);
+void meta_cache_forget(const char *inName);
+void meta_set_read_cache(int enable);
+int meta_get_read_cache(void);
+void meta_set_binary_sidecar(int enable);
+int meta_get_binary_sidecar(void);
+
 /* In meta_write.c */
 char *data_type2str(data_type_t data_type);
 char *image_data_type2str(image_data_type_t image_data_type);
@@ -707,6 +721,53 @@ double meta_look(meta_parameters *sar,double y,double x);
 double slant_from_incid(double incid,double er,double ht);
 double look_from_incid(double incid,double er,double ht);
 
+/************* Geometry grids ***********************
+Geometry grid calls: in meta_grid.c.
+Incidence and look angle, slant range and Doppler sampled on a coarse
+grid over a SAR image, and interpolated from there.  Much cheaper than
+calling meta_incid() and friends for every pixel; the grid is dense
+enough to keep the interpolation error below a microradian, a
+centimeter and a hundredth of a Hz. */
+typedef enum {
+  GRID_INCID=0,     // radians
+  GRID_LOOK,        // radians
+  GRID_SLANT,       // meters
+  GRID_DOPPLER,     // Hz
+  GRID_QUANTITY_COUNT
+} grid_quantity_t;
+
+/* Grids only sample (and are only refined for) the quantities asked for,
+   as an or of these. */
+#define GRID_QUANTITY_BIT(q) (1 << (q))
+#define GRID_ALL_QUANTITIES ((1 << GRID_QUANTITY_COUNT) - 1)
+
+typedef enum {
+  GRID_BILINEAR=0,
+  GRID_BICUBIC
+} grid_interp_t;
+
+typedef struct meta_geo_grid meta_geo_grid;
+
+/* Grids need SAR (or UAVSAR) metadata, and no pseudo projection. */
+int meta_geo_grid_supported(meta_parameters *meta);
+meta_geo_grid *meta_geo_grid_new(meta_parameters *meta, grid_interp_t interp,
+                                 int quantities);
+/* Grid for an image file.  If persistence is on, the grid saved next to
+   the .meta is used, or saved there once built. */
+meta_geo_grid *meta_geo_grid_get(const char *inFile, meta_parameters *meta,
+                                 grid_interp_t interp, int quantities);
+void meta_set_geo_grid_persist(int enable);
+int meta_get_geo_grid_persist(void);
+int meta_geo_grid_write(const meta_geo_grid *g, const char *file);
+meta_geo_grid *meta_geo_grid_read(const char *file, meta_parameters *meta);
+double meta_geo_grid_value(const meta_geo_grid *g, grid_quantity_t q,
+                           double y, double x);
+/* A whole line at once, for the angles and Doppler only: a float is
+   too coarse for slant range, which is rejected. */
+void meta_geo_grid_line(const meta_geo_grid *g, grid_quantity_t q, int line,
+                        float *out);
+void meta_geo_grid_free(meta_geo_grid *g);
+
 /************* Geolocation ***********************
 Geolocation Calls: in meta_get_geo.c.
 Here, latitude and longitude are always in degrees.*/
@@ -732,6 +793,10 @@ int meta_get_latLon(meta_parameters *sar,
 latitude and longitude. */
 void meta_set_lineSamp_tolerance(double tol);
 double meta_get_lineSamp_tolerance(void);
+/* Slant and ground range images are normally inverted directly with a
+range-Doppler solver; turning this off forces the iterative search. */
+void meta_set_lineSamp_range_doppler(int enable);
+int meta_get_lineSamp_range_doppler(void);
 int meta_get_lineSamp(meta_parameters *meta,
                       double lat,double lon,double elev,
                       double *yLine,double *xSample);
@@ -857,6 +922,43 @@ double unpacked_deg(double angle);
 /* Size of line chunk to read or write.  */
 #define CHUNK_OF_LINES 32
 
+/* Converts count samples of big endian src_data_type data (from a file) to
+   host byte order dest_data_type data, or the other way around.  Complex
+   types count as one sample per pair.  Implemented in sample_convert.c,
+   with vectorised kernels for the common conversions, which
+   set_sample_convert_simd(FALSE) turns off.  */
+void big_endian_to_native(const void *src, int src_data_type,
+                          void *dest, int dest_data_type, size_t count);
+void native_to_big_endian(const void *src, int src_data_type,
+                          void *dest, int dest_data_type, size_t count);
+void set_sample_convert_simd(int enable);
+
+/* Turns on (or back off) reading read-only streams in get_data_lines()
+   through memory mappings of their files.  Off by default: it is only safe
+   on files no other process truncates while they are read (see
+   mapped_image.c).  */
+void set_data_lines_use_mmap(int enable);
+int get_data_lines_use_mmap(void);
+/* Lets go of the files get_data_lines() keeps mapped.  remove_file() does
+   this, so that deleted files don't stay allocated. */
+void file_map_cache_flush(void);
+
+/******************************************************************************
+ * mapped_image: Read-only, memory-mapped access to a data file.  Lines are
+ * numbered across bands as in get_data_lines().  mapped_image_open() returns
+ * NULL if the file can't be mapped, or mapping is off (see
+ * set_data_lines_use_mmap()).  Implemented in asf.a/mapped_image.c */
+typedef struct mapped_image_struct mapped_image;
+
+mapped_image *mapped_image_open(const char *data_file, meta_parameters *meta);
+const void *mapped_image_lines(mapped_image *mi, int line_number,
+                               int num_lines);
+int mapped_image_get_lines(mapped_image *mi,
+                           int line_number, int num_lines_to_get,
+                           int sample_number, int num_samples_to_get,
+                           void *dest, int dest_data_type);
+void mapped_image_close(mapped_image *mi);
+
 int get_byte_line(FILE *file, meta_parameters *meta, int line_number,
                   unsigned char *dest);
 int get_byte_lines(FILE *file, meta_parameters *meta, int line_number,
@@ -1014,8 +1116,18 @@ void create_cal_params_ext(const char *inSAR, meta_parameters *meta, int db);
 float *incid_init(meta_parameters *meta);
 float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
 		 float inDn, char *bandExt, int dbFlag);
+typedef struct cal_kernel cal_kernel;
+cal_kernel *cal_kernel_new(meta_parameters *meta, const char *bandExt,
+                           const float *incid, int dbFlag);
+void cal_kernel_line(const cal_kernel *k, const float *inDn,
+                     const float *incid, float *out);
+float cal_kernel_value(const cal_kernel *k, int sample, float incidence_angle,
+                       float inDn);
+void cal_kernel_free(cal_kernel *k);
 float get_rad_cal_dn(meta_parameters *meta, int line, int sample, char *bandExt,
 		     float inDn, float radCorr);
+float get_rad_cal_dn_incid(meta_parameters *meta, double incid, int sample,
+			   char *bandExt, float inDn, float radCorr);
 float cal2amp(meta_parameters *meta, float incid, int sample, char *bandExt, 
 	      float calValue);
 quadratic_2d find_quadratic(const double *out, const double *x,
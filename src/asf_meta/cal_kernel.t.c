@@ -0,0 +1,165 @@
+#include "CUnit/Basic.h"
+#include "asf_meta.h"
+
+// Linear values are compared relative to their size, decibels (which
+// pass through zero) to within a fixed amount.
+static int within_tol(double a, double b, int db)
+{
+  static const double tol = .00001;
+  if (db || fabs(b) < tol) {
+    return fabs(a-b) < tol;
+  } else {
+    return fabs((a-b)/b) < tol;
+  }
+}
+
+// Calibrate a few lines of made up amplitudes with the kernel, both with
+// the incidence angles compiled in and passed per line, and compare with
+// get_cal_dn().  The lines passed their own angles are spread along
+// azimuth, so that the kernel has to use the angles it is given.
+static void compare_kernel(meta_parameters *meta, char *bandExt)
+{
+  static const radiometry_t radiometries[] = {
+    r_SIGMA, r_BETA, r_GAMMA, r_SIGMA_DB, r_BETA_DB, r_GAMMA_DB
+  };
+  int ns = meta->general->sample_count;
+  int nl = meta->general->line_count;
+  float *incid = incid_init(meta);
+  float *line_incid = (float *) MALLOC(sizeof(float)*ns);
+  float *in = (float *) MALLOC(sizeof(float)*ns);
+  float *out = (float *) MALLOC(sizeof(float)*ns);
+  float *out2 = (float *) MALLOC(sizeof(float)*ns);
+  int ii, jj, kk, bad = 0;
+
+  for (kk=0; kk<6; kk++) {
+    radiometry_t radiometry = radiometries[kk];
+    if (meta->calibration->type == uavsar_cal && radiometry != r_GAMMA &&
+        radiometry != r_GAMMA_DB)
+      continue;
+    meta->general->radiometry = radiometry;
+    int db = radiometry >= r_SIGMA_DB;
+
+    cal_kernel *k = cal_kernel_new(meta, bandExt, incid, db);
+    cal_kernel *k2 = cal_kernel_new(meta, bandExt, NULL, db);
+    for (ii=0; ii<3; ii++) {
+      int line = ii*(nl - 1)/2;
+      for (jj=0; jj<ns; jj++) {
+        in[jj] = 1 + (jj*37 + ii*101) % 255;
+        line_incid[jj] = meta_incid(meta, line, jj);
+      }
+      cal_kernel_line(k, in, NULL, out);
+      cal_kernel_line(k2, in, line_incid, out2);
+      for (jj=0; jj<ns; jj++) {
+        float expected =
+          get_cal_dn(meta, incid[jj], jj, in[jj], bandExt, db);
+        float line_expected =
+          get_cal_dn(meta, line_incid[jj], jj, in[jj], bandExt, db);
+        float value = cal_kernel_value(k2, jj, line_incid[jj], in[jj]);
+        if (!within_tol(out[jj], expected, db) ||
+            !within_tol(out2[jj], line_expected, db) ||
+            !within_tol(value, line_expected, db))
+          ++bad;
+      }
+    }
+    cal_kernel_free(k);
+    cal_kernel_free(k2);
+  }
+  CU_ASSERT(bad == 0);
+  if (bad)
+    printf("%d calibrated values differ from get_cal_dn\n", bad);
+
+  FREE(incid);
+  FREE(line_incid);
+  FREE(in);
+  FREE(out);
+  FREE(out2);
+}
+
+// The ERS-1 scene, with its calibration block replaced by one of the
+// given type, so that every calibration scheme is tried with the
+// incidence angles of a real scene.
+static meta_parameters *ers1_with_cal(cal_type type)
+{
+  meta_parameters *meta = meta_read("test_input/ers1.meta");
+  meta_calibration *cal = meta->calibration;
+  int ns = meta->general->sample_count;
+  int ii;
+
+  FREE(cal->asf);
+  cal->asf = NULL;
+  cal->type = type;
+
+  if (type == asf_scansar_cal) {
+    cal->asf_scansar = CALLOC(1, sizeof(asf_scansar_cal_params));
+    cal->asf_scansar->a1 = 0.0013470502;
+    cal->asf_scansar->a2 = 0.0001;
+  }
+  else if (type == esa_cal) {
+    cal->esa = CALLOC(1, sizeof(esa_cal_params));
+    cal->esa->k = 708251.4;
+    cal->esa->ref_incid = 23.0;
+  }
+  else if (type == rsat_cal) {
+    cal->rsat = CALLOC(1, sizeof(rsat_cal_params));
+    cal->rsat->n = 20;
+    cal->rsat->samp_inc = (ns + 18) / 19;
+    for (ii=0; ii<cal->rsat->n; ii++)
+      cal->rsat->lut[ii] = 3000 + 25*ii - ii*ii;
+    cal->rsat->a3 = 100;
+  }
+  else if (type == tsx_cal) {
+    cal->tsx = CALLOC(1, sizeof(tsx_cal_params));
+    cal->tsx->k = 1.3e-5;
+  }
+  else if (type == r2_cal) {
+    cal->r2 = CALLOC(1, sizeof(r2_cal_params));
+    cal->r2->num_elements = ns;
+    for (ii=0; ii<ns; ii++) {
+      cal->r2->a_beta[ii] = 500 + ii*0.1;
+      cal->r2->a_sigma[ii] = 400 + ii*0.2;
+      cal->r2->a_gamma[ii] = 450 + ii*0.15;
+    }
+    cal->r2->b = 50;
+  }
+  else if (type == uavsar_cal) {
+    cal->uavsar = CALLOC(1, sizeof(uavsar_cal_params));
+  }
+
+  return meta;
+}
+
+void test_cal_kernel()
+{
+  meta_parameters *meta;
+  cal_type types[] = { asf_scansar_cal, esa_cal, rsat_cal, tsx_cal, r2_cal,
+                       uavsar_cal };
+  int ii;
+
+  meta = meta_read("test_input/ers1.meta");
+  CU_ASSERT(meta->calibration->type == asf_cal);
+  compare_kernel(meta, "");
+  meta_free(meta);
+
+  meta = meta_read("test_input/palsar_fbd.meta");
+  CU_ASSERT(meta->calibration->type == alos_cal);
+  compare_kernel(meta, "HH");
+  compare_kernel(meta, "HV");
+  meta_free(meta);
+
+  for (ii=0; ii<6; ii++) {
+    meta = ers1_with_cal(types[ii]);
+    compare_kernel(meta, "");
+    if (types[ii] == rsat_cal) {
+      // SLC, and FOCUS processed
+      meta->calibration->rsat->slc = TRUE;
+      compare_kernel(meta, "");
+      meta->calibration->rsat->focus = TRUE;
+      compare_kernel(meta, "");
+    }
+    if (types[ii] == r2_cal) {
+      meta->calibration->r2->slc = TRUE;
+      compare_kernel(meta, "");
+    }
+    meta_free(meta);
+  }
+}
@@ -929,6 +929,299 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
   return calValue;
 }
 
+/*----------------------------------------------------------------------
+  Calibration kernel:
+        get_cal_dn() works out from the calibration block how to
+        calibrate a pixel every time it is called.  cal_kernel_new()
+        does that once for a scene, giving a gain and an offset for
+        each sample, so that cal_kernel_line() only has to do
+
+           (gain*inDn*inDn + offset) * factor(incidence angle)
+
+        for every pixel of a line, followed by the dB conversion if
+        asked for.  If the incidence angle of each sample is known when
+        the kernel is made (the incid_init() array for images that
+        aren't geocoded), the incidence angle factor is folded into the
+        gain and the offset as well.
+----------------------------------------------------------------------*/
+
+// How the calibration depends on the incidence angle -- exactly as
+// get_cal_dn() has it
+#define INCID_NONE       0
+#define INCID_INV_COS    1  // 1/cos(incid)
+#define INCID_INV_SIN    2  // 1/sin(incid)
+#define INCID_INV_TAN    3  // 1/tan(incid)
+#define INCID_TAN        4  // tan(incid)
+#define INCID_ESA_SIGMA  5  // sin(ref_incid)/sin(incid)
+#define INCID_ESA_GAMMA  6  // sin(ref_incid)/sin(incid)*cos(incid*D2R)
+
+struct cal_kernel {
+  int sample_count;
+  int power;            // input is power already (UAVSAR), not amplitude
+  int db;
+  int incid_form;
+  double sin_ref_incid; // ESA only
+  double *gain;         // per sample, without the incidence angle factor
+  double *offset;
+  double *incid_gain;   // per sample, with it (NULL if the incidence
+  double *incid_offset; // angles weren't given to cal_kernel_new())
+};
+
+static double incid_factor(const cal_kernel *k, double incid)
+{
+  switch (k->incid_form) {
+    case INCID_INV_COS:   return 1/cos(incid);
+    case INCID_INV_SIN:   return 1/sin(incid);
+    case INCID_INV_TAN:   return 1/tan(incid);
+    case INCID_TAN:       return tan(incid);
+    case INCID_ESA_SIGMA: return k->sin_ref_incid/sin(incid);
+    case INCID_ESA_GAMMA: return k->sin_ref_incid/sin(incid)*cos(incid*D2R);
+    default:              return 1.0;
+  }
+}
+
+static int is_sigma(radiometry_t r) { return r == r_SIGMA || r == r_SIGMA_DB; }
+static int is_gamma(radiometry_t r) { return r == r_GAMMA || r == r_GAMMA_DB; }
+static int is_beta(radiometry_t r)  { return r == r_BETA  || r == r_BETA_DB; }
+
+// Compiles the calibration of the scene described by meta, for the band
+// with the given extension, into a kernel.  incid is the incidence angle
+// of each sample (as returned by incid_init() for images that are not
+// geocoded), or NULL if it has to be passed to cal_kernel_line() with
+// every line.
+cal_kernel *cal_kernel_new(meta_parameters *meta, const char *bandExt,
+                           const float *incid, int dbFlag)
+{
+  radiometry_t radiometry = meta->general->radiometry;
+  int ns = meta->general->sample_count;
+  int ii;
+
+  cal_kernel *k = (cal_kernel *) MALLOC(sizeof(cal_kernel));
+  k->sample_count = ns;
+  k->power = FALSE;
+  k->db = dbFlag;
+  k->incid_form = INCID_NONE;
+  k->sin_ref_incid = 0.0;
+  k->gain = (double *) MALLOC(sizeof(double)*ns);
+  k->offset = (double *) MALLOC(sizeof(double)*ns);
+  k->incid_gain = k->incid_offset = NULL;
+
+  for (ii=0; ii<ns; ii++) {
+    k->gain[ii] = 0.0;
+    k->offset[ii] = 0.0;
+  }
+
+  if (!meta->calibration) {
+    asfPrintWarning("Called cal_kernel_new with no calibration block!\n");
+    k->db = FALSE;
+  }
+  else if (meta->calibration->type == asf_cal ||
+           meta->calibration->type == asf_scansar_cal) {
+    // ASF style data (PP and SSP), ScanSAR
+    double a1, a2;
+    if (meta->calibration->type == asf_cal) {
+      a1 = meta->calibration->asf->a1;
+      a2 = meta->calibration->asf->a2;
+    }
+    else {
+      a1 = meta->calibration->asf_scansar->a1;
+      a2 = meta->calibration->asf_scansar->a2;
+    }
+    if (is_gamma(radiometry))
+      k->incid_form = INCID_INV_COS;
+    else if (is_beta(radiometry))
+      k->incid_form = INCID_INV_SIN;
+    for (ii=0; ii<ns; ii++) {
+      k->gain[ii] = a1;
+      k->offset[ii] = a2;
+    }
+  }
+  else if (meta->calibration->type == esa_cal) { // ESA style ERS and JERS
+    esa_cal_params *p = meta->calibration->esa;
+    k->sin_ref_incid = sin(p->ref_incid*D2R);
+    if (is_sigma(radiometry))
+      k->incid_form = INCID_ESA_SIGMA;
+    else if (is_gamma(radiometry))
+      k->incid_form = INCID_ESA_GAMMA;
+    if (is_beta(radiometry) || is_sigma(radiometry) || is_gamma(radiometry))
+      for (ii=0; ii<ns; ii++)
+        k->gain[ii] = 1/p->k;
+  }
+  else if (meta->calibration->type == rsat_cal) { // CDPF style Radarsat
+    rsat_cal_params *p = meta->calibration->rsat;
+    if (is_sigma(radiometry))
+      k->incid_form = INCID_INV_TAN;
+    else if (is_gamma(radiometry))
+      k->incid_form = INCID_TAN;
+    for (ii=0; ii<ns; ii++) {
+      // look up table value for this sample, same as get_cal_dn()
+      double a2;
+      if (p->focus)
+        a2 = p->lut[0];
+      else if (ii < (p->samp_inc*(p->n-1))) {
+        int i_low = ii/p->samp_inc;
+        int i_up = i_low + 1;
+        a2 = p->lut[i_low] +
+          ((p->lut[i_up] - p->lut[i_low])*((ii/p->samp_inc) - i_low));
+      }
+      else
+        a2 = p->lut[p->n-1] +
+          ((p->lut[p->n-1] - p->lut[p->n-2])*((ii/p->samp_inc) - p->n-1));
+      if (p->slc)
+        k->gain[ii] = 1/(a2*a2);
+      else {
+        k->gain[ii] = 1/a2;
+        k->offset[ii] = p->a3/a2;
+      }
+    }
+  }
+  else if (meta->calibration->type == alos_cal) { // ALOS
+    alos_cal_params *p = meta->calibration->alos;
+    double cf;
+    if (bandExt && strstr(bandExt, "HH"))
+      cf = p->cf_hh;
+    else if (bandExt && strstr(bandExt, "HV"))
+      cf = p->cf_hv;
+    else if (bandExt && strstr(bandExt, "VH"))
+      cf = p->cf_vh;
+    else if (bandExt && strstr(bandExt, "VV"))
+      cf = p->cf_vv;
+    else
+      cf = p->cf_hh;
+    if (is_gamma(radiometry))
+      k->incid_form = INCID_INV_COS;
+    else if (is_beta(radiometry))
+      k->incid_form = INCID_INV_SIN;
+    for (ii=0; ii<ns; ii++)
+      k->gain[ii] = pow(10, cf/10.0);
+  }
+  else if (meta->calibration->type == tsx_cal) { // TerraSAR-X
+    if (is_sigma(radiometry))
+      k->incid_form = INCID_INV_TAN;
+    else if (is_gamma(radiometry))
+      k->incid_form = INCID_TAN;
+    for (ii=0; ii<ns; ii++)
+      k->gain[ii] = meta->calibration->tsx->k;
+  }
+  else if (meta->calibration->type == r2_cal) { // Radarsat-2
+    r2_cal_params *p = meta->calibration->r2;
+    double *a;
+    if (ns-1 > p->num_elements)
+      asfPrintError("Calibration not defined for sample (%d)!\n", ns-1);
+    if (is_beta(radiometry))
+      a = p->a_beta;
+    else if (is_sigma(radiometry))
+      a = p->a_sigma;
+    else if (is_gamma(radiometry))
+      a = p->a_gamma;
+    else
+      asfPrintError("Unsupported radiometry for Radarsat-2 calibration!\n");
+    for (ii=0; ii<ns; ii++) {
+      if (p->slc)
+        k->gain[ii] = 1/(a[ii]*a[ii]);
+      else {
+        k->gain[ii] = 1/a[ii];
+        k->offset[ii] = p->b/a[ii];
+      }
+    }
+  }
+  else if (meta->calibration->type == uavsar_cal) {
+    if (is_beta(radiometry))
+      asfPrintError("Calibration currently does not support BETA values!\n");
+    else if (is_sigma(radiometry))
+      asfPrintError("Calibration currently does not support SIGMA values!\n");
+    // Values are already stored as "linear power"
+    k->power = TRUE;
+    for (ii=0; ii<ns; ii++)
+      k->gain[ii] = 1.0;
+  }
+  else
+    // should never get here
+    asfPrintError("Unknown calibration data type!\n");
+
+  if (k->incid_form == INCID_NONE) {
+    k->incid_gain = k->gain;
+    k->incid_offset = k->offset;
+  }
+  else if (incid) {
+    k->incid_gain = (double *) MALLOC(sizeof(double)*ns);
+    k->incid_offset = (double *) MALLOC(sizeof(double)*ns);
+    for (ii=0; ii<ns; ii++) {
+      double f = incid_factor(k, incid[ii]);
+      k->incid_gain[ii] = k->gain[ii]*f;
+      k->incid_offset[ii] = k->offset[ii]*f;
+    }
+  }
+
+  return k;
+}
+
+// Calibrates a line of amplitude values (power for UAVSAR).  incid is
+// the incidence angle of each sample on the line, it may be NULL if the
+// incidence angles were given to cal_kernel_new().  in and out may be
+// the same buffer.
+void cal_kernel_line(const cal_kernel *k, const float *inDn,
+                     const float *incid, float *out)
+{
+  int ns = k->sample_count;
+  int ii;
+
+  if (incid && k->incid_form != INCID_NONE) {
+    for (ii=0; ii<ns; ii++) {
+      double dn = inDn[ii];
+      double p = k->power ? dn : dn*dn;
+      out[ii] = (k->gain[ii]*p + k->offset[ii])*incid_factor(k, incid[ii]);
+    }
+  }
+  else {
+    const double *gain = k->incid_gain;
+    const double *offset = k->incid_offset;
+    if (!gain)
+      asfPrintError("cal_kernel_line: no incidence angles given!\n");
+    if (k->power) {
+      for (ii=0; ii<ns; ii++)
+        out[ii] = gain[ii]*inDn[ii] + offset[ii];
+    }
+    else {
+      for (ii=0; ii<ns; ii++) {
+        double dn = inDn[ii];
+        out[ii] = gain[ii]*dn*dn + offset[ii];
+      }
+    }
+  }
+
+  if (k->db)
+    for (ii=0; ii<ns; ii++)
+      out[ii] = 10.0 * log10(out[ii]);
+}
+
+// Calibrates a single value, for callers that don't go line by line.
+// Same as get_cal_dn(), for the scene and band the kernel was made for.
+float cal_kernel_value(const cal_kernel *k, int sample, float incidence_angle,
+                       float inDn)
+{
+  double dn = inDn;
+  double p = k->power ? dn : dn*dn;
+  double scaledPower =
+    (k->gain[sample]*p + k->offset[sample])*incid_factor(k, incidence_angle);
+
+  if (k->db)
+    return 10.0 * log10(scaledPower);
+  else
+    return scaledPower;
+}
+
+void cal_kernel_free(cal_kernel *k)
+{
+  if (k->incid_gain != k->gain) {
+    FREE(k->incid_gain);
+    FREE(k->incid_offset);
+  }
+  FREE(k->gain);
+  FREE(k->offset);
+  FREE(k);
+}
+
 // Determine radiometrically correction amplitude value
 float get_rad_cal_dn(meta_parameters *meta, int line, int sample, char *bandExt,
 		     float inDn, float radCorr)
@@ -937,8 +1230,20 @@ float get_rad_cal_dn(meta_parameters *meta, int line, int sample, char *bandExt,
   if (FLOAT_EQUIVALENT(inDn, 0.0))
     return 0.0;
 
+  return get_rad_cal_dn_incid(meta, meta_incid(meta, line, sample), sample,
+			      bandExt, inDn, radCorr);
+}
+
+// Same as get_rad_cal_dn, for callers that already have the incidence
+// angle (radians) at hand, e.g. from a geometry grid
+float get_rad_cal_dn_incid(meta_parameters *meta, double incid, int sample,
+			   char *bandExt, float inDn, float radCorr)
+{
+  // Return background value unchanged
+  if (FLOAT_EQUIVALENT(inDn, 0.0))
+    return 0.0;
+
   meta->general->radiometry = r_SIGMA;
-  double incid = meta_incid(meta, line, sample);
   double sigma = get_cal_dn(meta, incid, sample, inDn, bandExt, FALSE);
   double calValue=0, invIncAngle=1;
 
@@ -0,0 +1,121 @@
+// Benchmark for the sample conversion kernels get_data_lines() and
+// put_data_lines() use.  For each conversion, reports the throughput
+// (bytes read plus bytes written, in GB/s) of the scalar kernels and of
+// the kernels actually used, and checks that they agree.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "asf.h"
+#include "asf_meta.h"
+
+// Samples per call: a long line of a full resolution scene.
+#define SAMPLES (32*1024)
+
+// Minimum time to spend on each measurement, in seconds.
+#define MIN_TIME 0.25
+
+static const char *type_name(int data_type)
+{
+  switch (data_type) {
+    case ASF_BYTE:  return "BYTE";
+    case INTEGER16: return "INTEGER16";
+    case INTEGER32: return "INTEGER32";
+    case REAL32:    return "REAL32";
+    case REAL64:    return "REAL64";
+    case COMPLEX_REAL32: return "COMPLEX_REAL32";
+    default:        return "?";
+  }
+}
+
+typedef void (*convert_func)(const void *, int, void *, int, size_t);
+
+static double measure(convert_func convert, const void *src, int src_type,
+                      void *dest, int dest_type)
+{
+  GTimer *timer = g_timer_new ();
+  size_t bytes = SAMPLES * (data_type2sample_size (src_type) +
+                            data_type2sample_size (dest_type));
+  long calls = 0;
+  double elapsed;
+
+  do {
+    int ii;
+    for (ii = 0; ii < 64; ii++)
+      convert (src, src_type, dest, dest_type, SAMPLES);
+    calls += 64;
+    elapsed = g_timer_elapsed (timer, NULL);
+  } while (elapsed < MIN_TIME);
+
+  g_timer_destroy (timer);
+  return calls * (double) bytes / elapsed / 1e9;
+}
+
+static int benchmark(const char *direction, convert_func convert,
+                     int src_type, int dest_type)
+{
+  size_t src_size = data_type2sample_size (src_type) * SAMPLES;
+  size_t dest_size = data_type2sample_size (dest_type) * SAMPLES;
+  unsigned char *src = g_malloc (src_size);
+  unsigned char *scalar_out = g_malloc0 (dest_size);
+  unsigned char *simd_out = g_malloc0 (dest_size);
+  double scalar_rate, simd_rate;
+  size_t ii;
+  int ok;
+
+  // Fill the source with values in the range of a byte, which are valid
+  // for every conversion: big endian for reading, host order for writing.
+  float *values = g_new (float, 2 * SAMPLES);
+  for (ii = 0; ii < 2 * SAMPLES; ii++)
+    values[ii] = (float) (rand () % 256);
+  native_to_big_endian (values, src_type >= COMPLEX_BYTE ? COMPLEX_REAL32
+                        : REAL32, src, src_type, SAMPLES);
+  if (convert == native_to_big_endian) {
+    big_endian_to_native (src, src_type, values, src_type, SAMPLES);
+    memcpy (src, values, src_size);
+  }
+  g_free (values);
+
+  set_sample_convert_simd (FALSE);
+  scalar_rate = measure (convert, src, src_type, scalar_out, dest_type);
+  set_sample_convert_simd (TRUE);
+  simd_rate = measure (convert, src, src_type, simd_out, dest_type);
+
+  ok = memcmp (scalar_out, simd_out, dest_size) == 0;
+  printf ("%-5s %-14s -> %-14s  scalar %6.2f GB/s  best %6.2f GB/s  "
+          "x%4.1f%s\n", direction, type_name (src_type), type_name (dest_type),
+          scalar_rate, simd_rate, simd_rate / scalar_rate,
+          ok ? "" : "  MISMATCH");
+
+  g_free (src);
+  g_free (scalar_out);
+  g_free (simd_out);
+  return ok;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const int types[] = { ASF_BYTE, INTEGER16, INTEGER32, REAL32,
+                               REAL64 };
+  int ntypes = sizeof (types) / sizeof (types[0]);
+  int ii, jj, ok = TRUE;
+
+  // Reading: file data type to the buffer types get_*_line(s) fill in.
+  for (ii = 0; ii < ntypes; ii++)
+    for (jj = 0; jj < ntypes; jj++)
+      ok &= benchmark ("get", big_endian_to_native, types[ii], types[jj]);
+  ok &= benchmark ("get", big_endian_to_native, COMPLEX_REAL32,
+                   COMPLEX_REAL32);
+
+  // Writing: buffer types to file data types.
+  for (ii = 0; ii < ntypes; ii++)
+    for (jj = 0; jj < ntypes; jj++)
+      ok &= benchmark ("put", native_to_big_endian, types[ii], types[jj]);
+  ok &= benchmark ("put", native_to_big_endian, COMPLEX_REAL32,
+                   COMPLEX_REAL32);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -7,6 +7,7 @@ io_util:
 #include "asf_meta.h"
 #include "asf_endian.h"
 #include "asf_complex.h"
+#include "mapped_image.h"
 
 /*******************************************************************************
  * Return the number of bytes that a data_type is made of, kill program on
@@ -38,17 +39,21 @@ int data_type2sample_size(int data_type)
  * with it. The data is assumed to be in big endian format and will be converted
  * to the native machine's format. The line_number argument is the zero-indexed
  * line number to get. The dest argument must be a pointer to existing memory.
+ * Streams opened read-only are read through a memory mapping of the file (see
+ * mapped_image.c); others are read with stdio.
  * Returns the amount of samples successfully read & converted. */
 int get_data_lines(FILE *file, meta_parameters *meta,
        int line_number, int num_lines_to_get,
        int sample_number, int num_samples_to_get,
        void *dest, int dest_data_type)
 {
-  int ii;               /* Sample index.  */
+  int ii;               /* Line index.  */
   int samples_gotten=0; /* Number of samples retrieved */
   int line_samples_gotten;
   size_t sample_size;   /* Sample size in bytes.  */
+  size_t dest_size;     /* Destination sample size in bytes.  */
   void *temp_buffer;    /* Buffer for unconverted data.  */
+  file_map *map;
   int sample_count = meta->general->sample_count;
   int line_count = meta->general->line_count;
   int band_count = meta->general->band_count;
@@ -84,148 +89,69 @@ int get_data_lines(FILE *file, meta_parameters *meta,
 
   /* Determine sample size.  */
   sample_size = data_type2sample_size(data_type);
+  dest_size = data_type2sample_size(dest_data_type);
+
+  /* Offset of the first sample we want.  */
+  offset = (long long)sample_size *
+      ((long long)sample_count * (long long)line_number + (long long)sample_number);
+  if (offset<0) {
+      asfPrintError("File offset overflow error ...file is too large to read.\n"
+                    "offset = %lld (sample_size * (sample_count * line_number + sample_number)\n"
+                    "sample_size = %d\n"
+                    "sample_count = %d\n"
+                    "line_number = %d\n"
+                    "sample_number = %d\n",
+                    offset, (int)sample_size, sample_count, line_number, sample_number);
+  }
 
-  temp_buffer = MALLOC( sample_size * num_lines_to_get * num_samples_to_get);
+  /* Read straight out of the page cache if we can.  Requests running past
+     the end of the file are left to stdio, which reports them. */
+  map = file_map_for_stream(file);
+  if (map) {
+    long long size;
+    long long line_bytes = (long long)sample_size * sample_count;
+    long long end = offset + line_bytes*(num_lines_to_get-1) +
+        (long long)sample_size*num_samples_to_get;
+    const unsigned char *base = file_map_data(map, &size);
+
+    if (num_lines_to_get > 0 && end <= size) {
+      for (ii=0; ii<num_lines_to_get; ii++)
+        big_endian_to_native(base + offset + line_bytes*ii, data_type,
+            (unsigned char *)dest + dest_size*num_samples_to_get*ii,
+            dest_data_type, num_samples_to_get);
+      samples_gotten = num_lines_to_get * num_samples_to_get;
+      file_map_release(map);
+
+      // Leave the stream where a read would have.
+      FSEEK64(file, end, SEEK_SET);
+      return samples_gotten;
+    }
+    file_map_release(map);
+  }
 
+  temp_buffer = MALLOC( sample_size * num_lines_to_get * num_samples_to_get);
 
-  // Scan to the beginning of the line sample.
-  for (ii=0; ii<num_lines_to_get; ii++) {
-    offset = (long long)sample_size *
-        ((long long)sample_count * ((long long)line_number + (long long)ii) + (long long)sample_number);
-    if (offset<0) {
-        asfPrintError("File offset overflow error ...file is too large to read.\n"
-                      "offset = %ld (sample_size * (sample_count * (line_number + ii) + sample_number)\n"
-                      "sample_size = %d\n"
-                      "sample_count = %d\n"
-                      "line_number = %d\n"
-                      "ii = %d\n"
-                      "sample_number = %d\n",
-                      offset, sample_size, sample_count, line_number, ii, sample_number);
-    }
+  if (num_samples_to_get == sample_count) {
+    // Whole lines are contiguous in the file, read them all at once.
     FSEEK64(file, offset, SEEK_SET);
-    line_samples_gotten = ASF_FREAD(temp_buffer+ii*num_samples_to_get*sample_size,
-        sample_size, num_samples_to_get, file);
-    samples_gotten += line_samples_gotten;
+    samples_gotten = ASF_FREAD(temp_buffer, sample_size,
+        (size_t)num_lines_to_get*num_samples_to_get, file);
+    big_endian_to_native(temp_buffer, data_type, dest, dest_data_type,
+                         samples_gotten);
   }
-
-  /* Fill in destination array.  */
-  switch (data_type) {
-    case REAL32:
-      for ( ii=0; ii<samples_gotten; ii++ ) {
-        ieee_big32(((float*)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case ASF_BYTE:((unsigned char*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case INTEGER16:((short int*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case INTEGER32:((int*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case REAL32:((float*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case REAL64:((double*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case COMPLEX_REAL32:
-      for ( ii=0; ii<samples_gotten*2; ii++ ) {
-        ieee_big32(((float*)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER32:((int*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case COMPLEX_REAL32:((float*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case COMPLEX_REAL64:((double*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case ASF_BYTE:
-      for ( ii=0; ii<samples_gotten; ii++ ) {
-        switch (dest_data_type) {
-         case ASF_BYTE:((unsigned char*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case INTEGER16:((short int*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case INTEGER32:((int*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case REAL32:((float*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case REAL64:((double*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-        }
-      }
-     break;
-    case INTEGER16:
-      for ( ii=0; ii<samples_gotten; ii++ ) {
-        big16(((short int *)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case ASF_BYTE:((unsigned char*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case INTEGER16:((short int*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case INTEGER32:((int*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case REAL32:((float*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case REAL64:((double*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case INTEGER32:
-      for ( ii=0; ii<samples_gotten; ii++ ) {
-        big32(((int *)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case ASF_BYTE:((unsigned char*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case INTEGER16:((short int*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case INTEGER32:((int*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case REAL32:((float*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case REAL64:((double*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case REAL64:
-      for ( ii=0; ii<samples_gotten; ii++ ) {
-        ieee_big64(((double*)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case ASF_BYTE:((unsigned char*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case INTEGER16:((short int*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case INTEGER32:((int*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case REAL32:((float*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case REAL64:((double*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-        }
-      }
-    case COMPLEX_BYTE:
-      for ( ii=0; ii<samples_gotten*2; ii++ ) {
-        switch (dest_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER32:((int*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case COMPLEX_REAL32:((float*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case COMPLEX_REAL64:((double*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case COMPLEX_INTEGER16:
-      for ( ii=0; ii<samples_gotten*2; ii++ ) {
-        big16(((short int *)temp_buffer)[ii]);
-         switch (dest_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER32:((int*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case COMPLEX_REAL32:((float*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case COMPLEX_REAL64:((double*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case COMPLEX_INTEGER32:
-      for ( ii=0; ii<samples_gotten*2; ii++ ) {
-        big32(((int *)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER32:((int*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case COMPLEX_REAL32:((float*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case COMPLEX_REAL64:((double*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case COMPLEX_REAL64:
-      for ( ii=0; ii<samples_gotten*2; ii++ ) {
-        ieee_big64(((double*)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER32:((int*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case COMPLEX_REAL32:((float*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case COMPLEX_REAL64:((double*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-        }
-      }
+  else {
+    // Scan to the beginning of each line's samples.
+    for (ii=0; ii<num_lines_to_get; ii++) {
+      unsigned char *line_buffer =
+          (unsigned char *)temp_buffer + sample_size*num_samples_to_get*ii;
+      FSEEK64(file, offset + (long long)sample_size*sample_count*ii, SEEK_SET);
+      line_samples_gotten = ASF_FREAD(line_buffer, sample_size,
+          num_samples_to_get, file);
+      big_endian_to_native(line_buffer, data_type,
+          (unsigned char *)dest + dest_size*num_samples_to_get*ii,
+          dest_data_type, line_samples_gotten);
+      samples_gotten += line_samples_gotten;
+    }
   }
 
   FREE(temp_buffer);
@@ -377,7 +303,6 @@ static int put_data_lines(FILE *file, meta_parameters *meta, int band_number,
                           int line_number_in_band, int num_lines_to_put,
                           const void *source, int source_data_type)
 {
-  int ii;               /* Sample index.                       */
   int samples_put;      /* Number of samples written           */
   size_t sample_size;   /* Sample size in bytes.               */
   void *out_buffer;     /* Buffer of converted data to write.  */
@@ -421,125 +346,9 @@ static int put_data_lines(FILE *file, meta_parameters *meta, int band_number,
   out_buffer = MALLOC( sample_size * sample_count * num_lines_to_put );
 
   /* Fill in destination array.  */
-  switch (data_type) {
-    case REAL32:
-      for ( ii=0; ii<num_samples_to_put; ii++ ) {
-        switch (source_data_type) {
-         case ASF_BYTE:((float*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case INTEGER16:((float*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case INTEGER32:((float*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case REAL32:((float*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case REAL64:((float*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        ieee_big32( ((float*)out_buffer)[ii] );
-      }
-      break;
-    case COMPLEX_REAL32:
-      for ( ii=0; ii<num_samples_to_put*2; ii++ ) {
-        switch (source_data_type) {
-         case COMPLEX_BYTE:((float*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case COMPLEX_INTEGER16:((float*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case COMPLEX_INTEGER32:((float*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case COMPLEX_REAL32:((float*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case COMPLEX_REAL64:((float*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        ieee_big32( ((float*)out_buffer)[ii] );
-      }
-      break;
-    case ASF_BYTE:
-      for ( ii=0; ii<num_samples_to_put; ii++ ) {
-        switch (source_data_type) {
-         case ASF_BYTE:((unsigned char*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case INTEGER16:((unsigned char*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case INTEGER32:((unsigned char*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case REAL32:((unsigned char*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case REAL64:((unsigned char*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-      }
-      break;
-    case INTEGER16:
-      for ( ii=0; ii<num_samples_to_put; ii++ ) {
-        switch (source_data_type) {
-         case ASF_BYTE:((short int*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case INTEGER16:((short int*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case INTEGER32:((short int*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case REAL32:((short int*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case REAL64:((short int*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        big16( ((short int*)out_buffer)[ii] );
-      }
-      break;
-    case INTEGER32:
-      for ( ii=0; ii<num_samples_to_put; ii++ ) {
-        switch (source_data_type) {
-         case ASF_BYTE:((int*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case INTEGER16:((int*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case INTEGER32:((int*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case REAL32:((int*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case REAL64:((int*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        big32( ((int*)out_buffer)[ii] );
-      }
-      break;
-    case REAL64:
-      for ( ii=0; ii<num_samples_to_put; ii++ ) {
-        switch (source_data_type) {
-         case ASF_BYTE:((double*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case INTEGER16:((double*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case INTEGER32:((double*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case REAL32:((double*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case REAL64:((double*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        ieee_big64( ((double*)out_buffer)[ii] );
-      }
-      break;
-    case COMPLEX_BYTE:
-      for ( ii=0; ii<num_samples_to_put*2; ii++ )
-        switch (source_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case COMPLEX_INTEGER16:((unsigned char*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case COMPLEX_INTEGER32:((unsigned char*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case COMPLEX_REAL32:((unsigned char*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case COMPLEX_REAL64:((unsigned char*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-     break;
-    case COMPLEX_INTEGER16:
-      for ( ii=0; ii<num_samples_to_put*2; ii++ ) {
-        switch (source_data_type) {
-         case COMPLEX_BYTE:((short int*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case COMPLEX_INTEGER32:((short int*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case COMPLEX_REAL32:((short int*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case COMPLEX_REAL64:((short int*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        big16( ((short int*)out_buffer)[ii] );
-      }
-      break;
-    case COMPLEX_INTEGER32:
-      for ( ii=0; ii<num_samples_to_put*2; ii++ ) {
-        switch (source_data_type) {
-         case COMPLEX_BYTE:((int*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case COMPLEX_INTEGER16:((int*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case COMPLEX_INTEGER32:((int*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case COMPLEX_REAL32:((int*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case COMPLEX_REAL64:((int*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        big32( ((int*)out_buffer)[ii] );
-      }
-      break;
-    case COMPLEX_REAL64:
-      for ( ii=0; ii<num_samples_to_put*2; ii++ ) {
-        switch (source_data_type) {
-         case COMPLEX_BYTE:((double*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case COMPLEX_INTEGER16:((double*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case COMPLEX_INTEGER32:((double*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case COMPLEX_REAL32:((double*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case COMPLEX_REAL64:((double*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        ieee_big64( ((double*)out_buffer)[ii] );
-      }
-      break;
-  }
+  native_to_big_endian(source, source_data_type, out_buffer, data_type,
+                       num_samples_to_put);
+
   samples_put = ASF_FWRITE(out_buffer, sample_size, num_samples_to_put, file);
   FREE(out_buffer);
 
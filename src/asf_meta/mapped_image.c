@@ -0,0 +1,358 @@
+/*******************************************************************************
+mapped_image:
+  Read-only, memory-mapped access to ASF internal (.img) files.
+
+  A data file is mapped once and line ranges are handed out as views
+  straight into the page cache: no seeking, no per-line reads, and no
+  intermediate buffers.  The views are still in the file's (big endian)
+  byte order; mapped_image_get_lines() returns converted data the same
+  way get_data_lines() does.
+
+  get_data_lines() uses the same mappings for any stream that was opened
+  read-only on a regular file, so the existing get_*_line(s) callers go
+  through here without changes.  Mappings are kept in a small cache keyed
+  by the file's device, inode, size and modification time, so a file that
+  is rewritten or grows is mapped again rather than read stale.  A mapping
+  keeps its file's blocks allocated, so the cache lets go of files that
+  have been deleted: remove_file() flushes it, and mappings of files
+  removed some other way are dropped the next time a file is mapped.
+
+  mapped_image_open() maps the file for itself, and the mapping goes away
+  with mapped_image_close().
+
+  Mapping is off unless set_data_lines_use_mmap() turns it on (asf_mapready
+  does for "memory map inputs = 1").  A mapping is only safe on a file
+  nobody else changes while it is read: the size and modification time are
+  checked each time get_data_lines() looks a file up, but if another
+  process truncates the file between that check and the copy, touching the
+  pages past the new end raises SIGBUS rather than a read error.  The look
+  up also costs an fcntl(), an fstat() and the seek that leaves the stream
+  where a read would have, for every call; that is less than the reads it
+  replaces on whole lines, but not on short partial ones.
+*/
+
+#include "asf.h"
+#include "asf_meta.h"
+#include "mapped_image.h"
+#include <glib.h>
+
+#if !defined(win32) && !defined(mingw)
+#  define ASF_USE_MMAP
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+/* Prototype from ioLine.c */
+int data_type2sample_size(int data_type);
+
+/* Number of files we keep mapped for get_data_lines().  */
+#define FILE_MAP_CACHE_SIZE 16
+
+struct file_map {
+  const unsigned char *base;
+  long long size;
+#ifdef ASF_USE_MMAP
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  int fd;          /* Cached maps only: to see if the file is deleted.  */
+#endif
+  int refcount;    /* Users, plus one while the map is in the cache.  */
+};
+
+struct mapped_image_struct {
+  meta_parameters *meta;
+  file_map *map;
+  int sample_size;
+};
+
+static int use_mmap = FALSE;
+
+void set_data_lines_use_mmap(int enable)
+{
+  use_mmap = enable;
+}
+
+int get_data_lines_use_mmap(void)
+{
+  return use_mmap;
+}
+
+#ifdef ASF_USE_MMAP
+
+G_LOCK_DEFINE_STATIC (file_map_cache);
+static file_map *file_map_cache[FILE_MAP_CACHE_SIZE];
+static int file_map_cache_count = 0;
+
+/* Maps the file open on fd.  Maps for the cache keep a descriptor of
+   their own for file_map_cache_sweep_locked().  */
+static file_map *file_map_new(int fd, const struct stat *st, int cached)
+{
+  void *base;
+  file_map *map;
+
+  // Nothing to map, or too big for our address space.
+  if (st->st_size <= 0 || (unsigned long long)st->st_size > (size_t)-1)
+    return NULL;
+
+  base = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    return NULL;
+
+  map = MALLOC(sizeof(file_map));
+  map->base = base;
+  map->size = st->st_size;
+  map->dev = st->st_dev;
+  map->ino = st->st_ino;
+  map->mtime = st->st_mtime;
+  map->fd = cached ? dup(fd) : -1;
+  map->refcount = 1;
+  return map;
+}
+
+/* Called with the cache lock held.  */
+static void file_map_unref_locked(file_map *map)
+{
+  if (--map->refcount == 0) {
+    munmap((void *)map->base, (size_t)map->size);
+    if (map->fd >= 0)
+      close(map->fd);
+    FREE(map);
+  }
+}
+
+/* Drop a map from the cache; called with the cache lock held.  */
+static void file_map_cache_remove_locked(int ii)
+{
+  file_map *map = file_map_cache[ii];
+  memmove(file_map_cache + ii, file_map_cache + ii + 1,
+          (file_map_cache_count - ii - 1) * sizeof(file_map *));
+  --file_map_cache_count;
+  file_map_unref_locked(map);
+}
+
+/* Drop the maps of files that have been deleted (or that we can't tell
+   about); called with the cache lock held.  */
+static void file_map_cache_sweep_locked(void)
+{
+  struct stat st;
+  int ii = 0;
+
+  while (ii < file_map_cache_count) {
+    file_map *m = file_map_cache[ii];
+    if (m->fd < 0 || fstat(m->fd, &st) != 0 || st.st_nlink == 0)
+      file_map_cache_remove_locked(ii);
+    else
+      ++ii;
+  }
+}
+
+/* Drops every map from the cache.  Maps that are in use go away when
+   they are released.  */
+void file_map_cache_flush(void)
+{
+  G_LOCK (file_map_cache);
+  while (file_map_cache_count > 0)
+    file_map_cache_remove_locked(file_map_cache_count - 1);
+  G_UNLOCK (file_map_cache);
+}
+
+static file_map *file_map_for_fd(int fd)
+{
+  struct stat st;
+  file_map *map = NULL;
+  int ii;
+
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    return NULL;
+
+  G_LOCK (file_map_cache);
+
+  for (ii = 0; ii < file_map_cache_count; ii++) {
+    file_map *m = file_map_cache[ii];
+    if (m->dev == st.st_dev && m->ino == st.st_ino) {
+      if (m->size == st.st_size && m->mtime == st.st_mtime) {
+        map = m;
+        // Move it to the front, we evict from the back.
+        memmove(file_map_cache + 1, file_map_cache, ii * sizeof(file_map *));
+        file_map_cache[0] = map;
+      }
+      else {
+        // The file has changed since we mapped it.
+        file_map_cache_remove_locked(ii);
+      }
+      break;
+    }
+  }
+
+  if (!map) {
+    file_map_cache_sweep_locked();
+    map = file_map_new(fd, &st, TRUE);
+    if (map) {
+      if (file_map_cache_count == 0)
+        set_remove_file_callback(file_map_cache_flush);
+      if (file_map_cache_count == FILE_MAP_CACHE_SIZE)
+        file_map_cache_remove_locked(file_map_cache_count - 1);
+      memmove(file_map_cache + 1, file_map_cache,
+              file_map_cache_count * sizeof(file_map *));
+      file_map_cache[0] = map;
+      ++file_map_cache_count;
+    }
+  }
+
+  if (map)
+    ++map->refcount;
+
+  G_UNLOCK (file_map_cache);
+
+  return map;
+}
+
+file_map *file_map_for_stream(FILE *file)
+{
+  int fd, flags;
+
+  if (!use_mmap)
+    return NULL;
+
+  // Only streams that are read-only -- anything we could be writing to
+  // ourselves goes through stdio, so we see our own buffered writes.
+  fd = fileno(file);
+  if (fd < 0)
+    return NULL;
+  flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || (flags & O_ACCMODE) != O_RDONLY)
+    return NULL;
+
+  return file_map_for_fd(fd);
+}
+
+void file_map_release(file_map *map)
+{
+  G_LOCK (file_map_cache);
+  file_map_unref_locked(map);
+  G_UNLOCK (file_map_cache);
+}
+
+const unsigned char *file_map_data(file_map *map, long long *size)
+{
+  *size = map->size;
+  return map->base;
+}
+
+#else /* ASF_USE_MMAP */
+
+void file_map_cache_flush(void)
+{
+}
+
+file_map *file_map_for_stream(FILE *file)
+{
+  return NULL;
+}
+
+void file_map_release(file_map *map)
+{
+}
+
+const unsigned char *file_map_data(file_map *map, long long *size)
+{
+  *size = 0;
+  return NULL;
+}
+
+#endif /* ASF_USE_MMAP */
+
+/*******************************************************************************
+ * Map the given data file, described by meta, for reading.  Returns NULL if
+ * the file can't be mapped (or mapping has been turned off), in which case
+ * the caller should fall back on get_data_lines().  */
+mapped_image *mapped_image_open(const char *data_file, meta_parameters *meta)
+{
+  mapped_image *mi;
+  file_map *map = NULL;
+
+  if (!use_mmap)
+    return NULL;
+
+#ifdef ASF_USE_MMAP
+  {
+    FILE *fp = FOPEN(data_file, "rb");
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode))
+      map = file_map_new(fileno(fp), &st, FALSE);
+    FCLOSE(fp);   /* the mapping stays valid after the file is closed */
+  }
+#endif
+  if (!map)
+    return NULL;
+
+  mi = MALLOC(sizeof(mapped_image));
+  mi->meta = meta;
+  mi->map = map;
+  mi->sample_size = data_type2sample_size(meta->general->data_type);
+  return mi;
+}
+
+/*******************************************************************************
+ * Return a pointer to the raw (big endian, unconverted) data of lines
+ * line_number .. line_number+num_lines-1, counting lines across all bands
+ * the same way get_data_lines() does.  Returns NULL if the lines aren't all
+ * in the file.  The pointer is valid until mapped_image_close().  */
+const void *mapped_image_lines(mapped_image *mi, int line_number,
+                               int num_lines)
+{
+  long long size;
+  const unsigned char *base = file_map_data(mi->map, &size);
+  long long line_bytes =
+    (long long)mi->sample_size * mi->meta->general->sample_count;
+  long long offset = line_bytes * line_number;
+
+  if (line_number < 0 || num_lines < 0 ||
+      offset + line_bytes * num_lines > size)
+    return NULL;
+
+  return base + offset;
+}
+
+/*******************************************************************************
+ * Same as get_data_lines(), but reading from the mapping.  Returns the number
+ * of samples converted.  */
+int mapped_image_get_lines(mapped_image *mi,
+                           int line_number, int num_lines_to_get,
+                           int sample_number, int num_samples_to_get,
+                           void *dest, int dest_data_type)
+{
+  int ii;
+  int sample_count = mi->meta->general->sample_count;
+  int data_type = mi->meta->general->data_type;
+  size_t dest_size = data_type2sample_size(dest_data_type);
+  const unsigned char *src = mapped_image_lines(mi, line_number,
+                                                num_lines_to_get);
+
+  if (!src || sample_number < 0 ||
+      sample_number + num_samples_to_get > sample_count)
+    asfPrintError("mapped_image_get_lines: Cannot read lines %d-%d, "
+                  "samples %d-%d.\n", line_number,
+                  line_number + num_lines_to_get - 1, sample_number,
+                  sample_number + num_samples_to_get - 1);
+
+  for (ii=0; ii<num_lines_to_get; ii++)
+    big_endian_to_native(
+      src + mi->sample_size*((size_t)sample_count*ii + sample_number),
+      data_type, (unsigned char *)dest + dest_size*num_samples_to_get*ii,
+      dest_data_type, num_samples_to_get);
+
+  return num_lines_to_get * num_samples_to_get;
+}
+
+void mapped_image_close(mapped_image *mi)
+{
+  if (mi) {
+    file_map_release(mi->map);
+    FREE(mi);
+  }
+}
@@ -0,0 +1,23 @@
+/*
+	mapped_image.h:
+		Internal interface between ioLine.c and mapped_image.c --
+	the cache of read-only file mappings get_data_lines() reads
+	through.  The public mapped_image routines are in asf_meta.h.
+*/
+#ifndef _MAPPED_IMAGE_H_
+#define _MAPPED_IMAGE_H_
+
+#include <stdio.h>
+
+typedef struct file_map file_map;
+
+/* Returns the (cached) mapping of the file behind the given stream, or
+   NULL if the stream isn't a read-only stream on a regular file that we
+   can map.  Release it with file_map_release() when done. */
+file_map *file_map_for_stream(FILE *file);
+void file_map_release(file_map *map);
+
+/* The mapped bytes, and how many of them there are. */
+const unsigned char *file_map_data(file_map *map, long long *size);
+
+#endif
@@ -0,0 +1,728 @@
+/****************************************************************
+FUNCTION NAME:  meta_read_shared, meta_release, meta_cache_*
+
+DESCRIPTION:
+   Metadata cache.  A tool like asf_convert reads the same .meta files
+over and over (every processing step does a meta_read() on its input
+and output), and each of those reads goes through the lex/yacc
+parser.  Parsed new style metadata is therefore kept here, keyed by
+the full path of the .meta file together with its device, inode, size
+and modification time, so that a file that changed on disk is never
+served from the cache.  meta_write() drops the entry of the file it
+writes, which covers rewrites that don't change any of those.
+
+   meta_read() hands out copies (meta_copy()) of the cached structure,
+which the caller owns and frees as before.  Code that only looks at
+the metadata can use meta_read_shared() instead, which returns the
+cached structure itself; it has to be given back with meta_release().
+
+   Optionally (meta_set_binary_sidecar()) the parsed structure is also
+saved next to the .meta file, as <image>.metab, and loaded from there
+by later processes without running the parser.  The sidecar is only
+used if it was written for the same size and time stamp of the .meta,
+by a build with the same structure layout.
+
+RETURN VALUE:
+
+SPECIAL CONSIDERATIONS:
+   Old style metadata, DDR and CEOS input aren't cached.  Neither is
+SMAP metadata, whose lat/lon arrays come from the image file.
+****************************************************************/
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <glib.h>
+#ifndef win32
+#include <unistd.h>
+#endif
+#include "asf.h"
+#include "asf_meta.h"
+#include "metadata_parser.h"
+
+// Largest number of parsed files kept around.
+#define META_CACHE_SIZE 32
+
+#define META_SIDECAR_EXT ".metab"
+#define META_SIDECAR_MAGIC "ASFMETAB"
+#define META_SIDECAR_VERSION 1
+
+// Largest block a sidecar can hold -- anything bigger means the file
+// is damaged.
+#define META_SIDECAR_MAX_BLOCK (1<<30)
+
+/* Prototypes from meta_read.c */
+int meta_is_new_style(const char *file_name);
+
+// Identifies one version of a .meta file on disk.
+typedef struct {
+  char *path;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  long mtime_nsec;
+} meta_file_id;
+
+typedef struct meta_cache_entry {
+  meta_file_id id;
+  meta_parameters *meta;
+  int refs;             // Handles given out by meta_read_shared().
+  unsigned long used;   // For finding the least recently used entry.
+  struct meta_cache_entry *next;
+} meta_cache_entry;
+
+G_LOCK_DEFINE_STATIC(meta_cache);
+static meta_cache_entry *meta_cache[META_CACHE_SIZE];
+// Entries still referenced by handles, but no longer in the cache
+// because their file changed or they were pushed out.
+static meta_cache_entry *meta_cache_detached = NULL;
+static unsigned long meta_cache_clock = 0;
+
+static int meta_cache_enabled = TRUE;
+static int meta_sidecar_enabled = FALSE;
+
+void meta_set_read_cache(int enable)
+{
+  meta_cache_enabled = enable;
+  if (!enable)
+    meta_cache_forget(NULL);
+}
+
+int meta_get_read_cache(void)
+{
+  return meta_cache_enabled;
+}
+
+void meta_set_binary_sidecar(int enable)
+{
+  meta_sidecar_enabled = enable;
+}
+
+int meta_get_binary_sidecar(void)
+{
+  return meta_sidecar_enabled;
+}
+
+static int get_file_id(const char *meta_name, meta_file_id *id)
+{
+  struct stat st;
+
+  if (stat(meta_name, &st) == -1)
+    return FALSE;
+#ifdef win32
+  // "realpath" not available on Windows
+  id->path = STRDUP(meta_name);
+#else
+  id->path = realpath(meta_name, NULL);
+  if (!id->path)
+    return FALSE;
+#endif
+  id->dev = st.st_dev;
+  id->ino = st.st_ino;
+  id->size = st.st_size;
+  id->mtime = st.st_mtime;
+#ifdef linux
+  id->mtime_nsec = st.st_mtim.tv_nsec;
+#else
+  id->mtime_nsec = 0;
+#endif
+  return TRUE;
+}
+
+static int same_file(const meta_file_id *a, const meta_file_id *b)
+{
+  return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+    a->mtime == b->mtime && a->mtime_nsec == b->mtime_nsec &&
+    strcmp(a->path, b->path) == 0;
+}
+
+static void entry_free(meta_cache_entry *e)
+{
+  meta_free(e->meta);
+  free(e->id.path);
+  FREE(e);
+}
+
+// Takes entry ii out of the cache.  Must be called with the lock held.
+static void entry_remove(int ii)
+{
+  meta_cache_entry *e = meta_cache[ii];
+
+  meta_cache[ii] = NULL;
+  if (e->refs > 0) {
+    e->next = meta_cache_detached;
+    meta_cache_detached = e;
+  }
+  else
+    entry_free(e);
+}
+
+// Looks up the cached structure for a file, throwing out an entry for
+// an older version of it.  Must be called with the lock held.
+static meta_cache_entry *entry_find(const meta_file_id *id)
+{
+  int ii;
+
+  for (ii=0; ii<META_CACHE_SIZE; ii++) {
+    meta_cache_entry *e = meta_cache[ii];
+    if (e && strcmp(e->id.path, id->path) == 0) {
+      if (same_file(&e->id, id)) {
+        e->used = ++meta_cache_clock;
+        return e;
+      }
+      entry_remove(ii);
+    }
+  }
+  return NULL;
+}
+
+// Puts a freshly read structure into the cache, which takes ownership
+// of both it and the path in id.  If another thread got there first,
+// its entry is returned instead.  Must be called with the lock held.
+static meta_cache_entry *entry_insert(meta_file_id *id, meta_parameters *meta)
+{
+  meta_cache_entry *e = entry_find(id);
+  int ii, slot = 0;
+
+  if (e) {
+    meta_free(meta);
+    free(id->path);
+    return e;
+  }
+
+  for (ii=0; ii<META_CACHE_SIZE; ii++) {
+    if (!meta_cache[ii]) {
+      slot = ii;
+      break;
+    }
+    if (meta_cache[ii]->used < meta_cache[slot]->used)
+      slot = ii;
+  }
+  if (meta_cache[slot])
+    entry_remove(slot);
+
+  e = (meta_cache_entry *) MALLOC(sizeof(meta_cache_entry));
+  e->id = *id;
+  e->meta = meta;
+  e->refs = 0;
+  e->used = ++meta_cache_clock;
+  e->next = NULL;
+  meta_cache[slot] = e;
+  return e;
+}
+
+/****************************************************************
+ * Binary sidecar.  A header, followed by the blocks of the structure,
+ * each written as its size (-1 for a NULL pointer) and its bytes.  The
+ * pointers stored with the blocks are meaningless, and are replaced
+ * when the structure is put back together.  */
+typedef struct {
+  char magic[8];
+  int32_t version;
+  uint32_t layout;       // See sidecar_layout().
+  int64_t size;          // Of the .meta file it was written for.
+  int64_t mtime;
+  int64_t mtime_nsec;
+} meta_sidecar_header;
+
+// The blocks are written as they are in memory, so a sidecar can only
+// be read back by a build that lays them out the same way.  This mixes
+// the sizes of all of them with the byte order.
+static uint32_t sidecar_layout(void)
+{
+  static const size_t sizes[] = {
+    sizeof(meta_parameters), sizeof(meta_general), sizeof(meta_sar),
+    sizeof(meta_optical), sizeof(meta_thermal), sizeof(meta_projection),
+    sizeof(meta_transform), sizeof(meta_airsar), sizeof(meta_uavsar),
+    sizeof(meta_statistics), sizeof(meta_stats), sizeof(meta_state_vectors),
+    sizeof(state_loc), sizeof(meta_location), sizeof(meta_calibration),
+    sizeof(asf_cal_params), sizeof(asf_scansar_cal_params),
+    sizeof(esa_cal_params), sizeof(rsat_cal_params), sizeof(alos_cal_params),
+    sizeof(tsx_cal_params), sizeof(r2_cal_params), sizeof(uavsar_cal_params),
+    sizeof(sentinel_cal_params), sizeof(meta_colormap), sizeof(meta_rgb),
+    sizeof(meta_doppler), sizeof(tsx_doppler_params), sizeof(tsx_doppler_t),
+    sizeof(radarsat2_doppler_params), sizeof(meta_insar), sizeof(meta_dem),
+    sizeof(meta_quality)
+  };
+  uint32_t order = 0x01020304;
+  uint32_t h = 2166136261u;
+  unsigned char *p = (unsigned char *) &order;
+  unsigned int ii;
+
+  for (ii=0; ii<sizeof(order); ii++)
+    h = (h ^ p[ii]) * 16777619u;
+  for (ii=0; ii<sizeof(sizes)/sizeof(sizes[0]); ii++)
+    h = (h ^ (uint32_t) sizes[ii]) * 16777619u;
+  return h;
+}
+
+static void put_block(FILE *fp, const void *p, size_t size, int *ok)
+{
+  int64_t n = p ? (int64_t) size : -1;
+
+  if (*ok && fwrite(&n, sizeof(n), 1, fp) != 1)
+    *ok = FALSE;
+  if (*ok && p && size > 0 && fwrite(p, size, 1, fp) != 1)
+    *ok = FALSE;
+}
+
+// Reads back a block of any size, which is returned in *size.
+static void *get_block(FILE *fp, size_t *size, int *ok)
+{
+  int64_t n;
+  void *p;
+
+  *size = 0;
+  if (!*ok)
+    return NULL;
+  if (fread(&n, sizeof(n), 1, fp) != 1 || n < -1 ||
+      n > META_SIDECAR_MAX_BLOCK) {
+    *ok = FALSE;
+    return NULL;
+  }
+  if (n < 0)
+    return NULL;
+  p = MALLOC(n > 0 ? n : 1);
+  if (n > 0 && fread(p, n, 1, fp) != 1) {
+    FREE(p);
+    *ok = FALSE;
+    return NULL;
+  }
+  *size = n;
+  return p;
+}
+
+// Reads back a block that has to be of the given size.
+static void *get_sized_block(FILE *fp, size_t size, int *ok)
+{
+  size_t n;
+  void *p = get_block(fp, &n, ok);
+
+  if (p && n != size) {
+    FREE(p);
+    *ok = FALSE;
+    return NULL;
+  }
+  return p;
+}
+
+static void put_calibration(FILE *fp, meta_calibration *cal, int *ok)
+{
+  put_block(fp, cal, sizeof(meta_calibration), ok);
+  if (!cal)
+    return;
+  put_block(fp, cal->asf, sizeof(asf_cal_params), ok);
+  put_block(fp, cal->asf_scansar, sizeof(asf_scansar_cal_params), ok);
+  put_block(fp, cal->esa, sizeof(esa_cal_params), ok);
+  put_block(fp, cal->rsat, sizeof(rsat_cal_params), ok);
+  put_block(fp, cal->alos, sizeof(alos_cal_params), ok);
+  put_block(fp, cal->tsx, sizeof(tsx_cal_params), ok);
+  put_block(fp, cal->r2, sizeof(r2_cal_params), ok);
+  put_block(fp, cal->uavsar, sizeof(uavsar_cal_params), ok);
+  put_block(fp, cal->sentinel, sizeof(sentinel_cal_params), ok);
+}
+
+static meta_calibration *get_calibration(FILE *fp, int *ok)
+{
+  meta_calibration *cal =
+    get_sized_block(fp, sizeof(meta_calibration), ok);
+
+  if (!cal)
+    return NULL;
+  cal->asf = get_sized_block(fp, sizeof(asf_cal_params), ok);
+  cal->asf_scansar = get_sized_block(fp, sizeof(asf_scansar_cal_params), ok);
+  cal->esa = get_sized_block(fp, sizeof(esa_cal_params), ok);
+  cal->rsat = get_sized_block(fp, sizeof(rsat_cal_params), ok);
+  cal->alos = get_sized_block(fp, sizeof(alos_cal_params), ok);
+  cal->tsx = get_sized_block(fp, sizeof(tsx_cal_params), ok);
+  cal->r2 = get_sized_block(fp, sizeof(r2_cal_params), ok);
+  cal->uavsar = get_sized_block(fp, sizeof(uavsar_cal_params), ok);
+  cal->sentinel = get_sized_block(fp, sizeof(sentinel_cal_params), ok);
+  return cal;
+}
+
+static void put_doppler(FILE *fp, meta_doppler *dop, int *ok)
+{
+  int ii;
+
+  put_block(fp, dop, sizeof(meta_doppler), ok);
+  if (!dop)
+    return;
+  put_block(fp, dop->tsx, sizeof(tsx_doppler_params), ok);
+  if (dop->tsx) {
+    tsx_doppler_params *tsx = dop->tsx;
+    put_block(fp, tsx->dop, sizeof(tsx_doppler_t)*tsx->doppler_count, ok);
+    if (tsx->dop)
+      for (ii=0; ii<tsx->doppler_count; ii++)
+        put_block(fp, tsx->dop[ii].coefficient,
+                  sizeof(double)*(tsx->dop[ii].poly_degree+1), ok);
+  }
+  put_block(fp, dop->r2, sizeof(radarsat2_doppler_params), ok);
+  if (dop->r2) {
+    size_t sz = sizeof(double)*dop->r2->doppler_count;
+    put_block(fp, dop->r2->centroid, sz, ok);
+    put_block(fp, dop->r2->rate, sz, ok);
+  }
+}
+
+// The counts are only filled in once the arrays they describe are
+// there, so that meta_free() can always clean up after a damaged file.
+static meta_doppler *get_doppler(FILE *fp, int *ok)
+{
+  meta_doppler *dop = get_sized_block(fp, sizeof(meta_doppler), ok);
+  int ii, count;
+
+  if (!dop)
+    return NULL;
+  dop->tsx = get_sized_block(fp, sizeof(tsx_doppler_params), ok);
+  if (dop->tsx) {
+    tsx_doppler_params *tsx = dop->tsx;
+    count = tsx->doppler_count > 0 ? tsx->doppler_count : 0;
+    tsx->doppler_count = 0;
+    tsx->dop = get_sized_block(fp, sizeof(tsx_doppler_t)*count, ok);
+    if (tsx->dop) {
+      for (ii=0; ii<count; ii++)
+        tsx->dop[ii].coefficient = NULL;
+      tsx->doppler_count = count;
+      for (ii=0; ii<count; ii++)
+        tsx->dop[ii].coefficient = get_sized_block(fp,
+          sizeof(double)*(tsx->dop[ii].poly_degree+1), ok);
+    }
+  }
+  dop->r2 = get_sized_block(fp, sizeof(radarsat2_doppler_params), ok);
+  if (dop->r2) {
+    size_t sz = sizeof(double)*
+      (dop->r2->doppler_count > 0 ? dop->r2->doppler_count : 0);
+    dop->r2->centroid = NULL;
+    dop->r2->rate = NULL;
+    dop->r2->centroid = get_sized_block(fp, sz, ok);
+    dop->r2->rate = get_sized_block(fp, sz, ok);
+  }
+  return dop;
+}
+
+static char *sidecar_name(const char *meta_name)
+{
+  return appendExt(meta_name, META_SIDECAR_EXT);
+}
+
+static void sidecar_write(const char *meta_name, const meta_file_id *id,
+                          meta_parameters *meta)
+{
+  char *name = sidecar_name(meta_name);
+  char *tmp = (char *) MALLOC(sizeof(char)*(strlen(name)+32));
+  meta_sidecar_header hdr;
+  int ok = TRUE;
+  FILE *fp;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, META_SIDECAR_MAGIC, sizeof(hdr.magic));
+  hdr.version = META_SIDECAR_VERSION;
+  hdr.layout = sidecar_layout();
+  hdr.size = id->size;
+  hdr.mtime = id->mtime;
+  hdr.mtime_nsec = id->mtime_nsec;
+
+  // write to a temporary file and move it into place, so that another
+  // process never reads a partly written sidecar
+  sprintf(tmp, "%s.%d", name, (int) getpid());
+  fp = fopen(tmp, "wb");
+  if (!fp) {
+    // Not being able to write next to the input is fine
+    FREE(tmp);
+    FREE(name);
+    return;
+  }
+
+  if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+    ok = FALSE;
+  put_block(fp, meta, sizeof(meta_parameters), &ok);
+  put_block(fp, meta->general, sizeof(meta_general), &ok);
+  put_block(fp, meta->sar, sizeof(meta_sar), &ok);
+  put_block(fp, meta->optical, sizeof(meta_optical), &ok);
+  put_block(fp, meta->thermal, sizeof(meta_thermal), &ok);
+  put_block(fp, meta->projection, sizeof(meta_projection), &ok);
+  put_block(fp, meta->transform, sizeof(meta_transform), &ok);
+  put_block(fp, meta->airsar, sizeof(meta_airsar), &ok);
+  put_block(fp, meta->uavsar, sizeof(meta_uavsar), &ok);
+  put_block(fp, meta->stats, meta->stats ? sizeof(meta_statistics) +
+            meta->stats->band_count*sizeof(meta_stats) : 0, &ok);
+  put_block(fp, meta->state_vectors, meta->state_vectors ?
+            sizeof(meta_state_vectors) +
+            meta->state_vectors->vector_count*sizeof(state_loc) : 0, &ok);
+  put_block(fp, meta->location, sizeof(meta_location), &ok);
+  put_calibration(fp, meta->calibration, &ok);
+  put_block(fp, meta->colormap, sizeof(meta_colormap), &ok);
+  if (meta->colormap)
+    put_block(fp, meta->colormap->rgb,
+              sizeof(meta_rgb)*meta->colormap->num_elements, &ok);
+  put_doppler(fp, meta->doppler, &ok);
+  put_block(fp, meta->insar, sizeof(meta_insar), &ok);
+  put_block(fp, meta->dem, sizeof(meta_dem), &ok);
+  put_block(fp, meta->quality, sizeof(meta_quality), &ok);
+
+  if (fclose(fp) != 0)
+    ok = FALSE;
+  if (!ok || rename(tmp, name) != 0)
+    remove(tmp);
+
+  FREE(tmp);
+  FREE(name);
+}
+
+// Returns NULL if there is no usable sidecar for this version of the
+// .meta file.
+static meta_parameters *sidecar_read(const char *meta_name,
+                                     const meta_file_id *id)
+{
+  char *name = sidecar_name(meta_name);
+  FILE *fp = fopen(name, "rb");
+  meta_sidecar_header hdr;
+  meta_parameters *meta;
+  size_t n;
+  int ok = TRUE;
+
+  FREE(name);
+  if (!fp)
+    return NULL;
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+      memcmp(hdr.magic, META_SIDECAR_MAGIC, sizeof(hdr.magic)) != 0 ||
+      hdr.version != META_SIDECAR_VERSION ||
+      hdr.layout != sidecar_layout() ||
+      hdr.size != (int64_t) id->size || hdr.mtime != (int64_t) id->mtime ||
+      hdr.mtime_nsec != (int64_t) id->mtime_nsec) {
+    fclose(fp);
+    return NULL;
+  }
+
+  meta = get_sized_block(fp, sizeof(meta_parameters), &ok);
+  if (!meta) {
+    fclose(fp);
+    return NULL;
+  }
+  meta->general = get_sized_block(fp, sizeof(meta_general), &ok);
+  meta->sar = get_sized_block(fp, sizeof(meta_sar), &ok);
+  meta->optical = get_sized_block(fp, sizeof(meta_optical), &ok);
+  meta->thermal = get_sized_block(fp, sizeof(meta_thermal), &ok);
+  meta->projection = get_sized_block(fp, sizeof(meta_projection), &ok);
+  meta->transform = get_sized_block(fp, sizeof(meta_transform), &ok);
+  meta->airsar = get_sized_block(fp, sizeof(meta_airsar), &ok);
+  meta->uavsar = get_sized_block(fp, sizeof(meta_uavsar), &ok);
+  meta->stats = get_block(fp, &n, &ok);
+  if (meta->stats && (n < sizeof(meta_statistics) ||
+      meta->stats->band_count < 0 || n != sizeof(meta_statistics) +
+      meta->stats->band_count*sizeof(meta_stats)))
+    ok = FALSE;
+  meta->state_vectors = get_block(fp, &n, &ok);
+  if (meta->state_vectors && (n < sizeof(meta_state_vectors) ||
+      meta->state_vectors->vector_count < 0 || n !=
+      sizeof(meta_state_vectors) +
+      meta->state_vectors->vector_count*sizeof(state_loc)))
+    ok = FALSE;
+  meta->location = get_sized_block(fp, sizeof(meta_location), &ok);
+  meta->calibration = get_calibration(fp, &ok);
+  meta->colormap = get_sized_block(fp, sizeof(meta_colormap), &ok);
+  if (meta->colormap) {
+    int count = meta->colormap->num_elements;
+    meta->colormap->rgb =
+      get_sized_block(fp, sizeof(meta_rgb)*(count > 0 ? count : 0), &ok);
+  }
+  meta->doppler = get_doppler(fp, &ok);
+  meta->insar = get_sized_block(fp, sizeof(meta_insar), &ok);
+  meta->dem = get_sized_block(fp, sizeof(meta_dem), &ok);
+  meta->quality = get_sized_block(fp, sizeof(meta_quality), &ok);
+  meta->latlon = NULL;
+  if (ok && fread(&n, 1, 1, fp) == 1)
+    ok = FALSE;    // trailing garbage
+  fclose(fp);
+
+  if (!ok || !meta->general) {
+    // Whatever did get read has its pointers set up by now
+    meta_free(meta);
+    return NULL;
+  }
+  return meta;
+}
+
+/****************************************************************
+ * meta_cache_read:
+ * Returns a copy of the parsed new style metadata file meta_name,
+ * from the cache if possible, and NULL for an old style file.  Used
+ * by meta_read().  */
+meta_parameters *meta_cache_read(const char *meta_name)
+{
+  meta_file_id id;
+  meta_parameters *meta = NULL;
+  int have_id = meta_cache_enabled && get_file_id(meta_name, &id);
+
+  if (have_id) {
+    meta_cache_entry *e;
+    G_LOCK(meta_cache);
+    e = entry_find(&id);
+    if (e)
+      meta = meta_copy(e->meta);
+    G_UNLOCK(meta_cache);
+    if (meta) {
+      free(id.path);
+      return meta;
+    }
+  }
+
+  if (!meta_is_new_style(meta_name)) {
+    if (have_id)
+      free(id.path);
+    return NULL;
+  }
+
+  if (!have_id && meta_sidecar_enabled)
+    have_id = get_file_id(meta_name, &id);
+  if (have_id && meta_sidecar_enabled)
+    meta = sidecar_read(meta_name, &id);
+  if (!meta) {
+    // The file's time stamp was taken before parsing it, so a change
+    // while it is being parsed shows up as a changed file next time.
+    meta = raw_init();
+    parse_metadata(meta, (char *) meta_name);
+    if (have_id && meta_sidecar_enabled)
+      sidecar_write(meta_name, &id, meta);
+  }
+
+  if (have_id && meta_cache_enabled &&
+      strcmp_case(meta->general->sensor, "SMAP") != 0) {
+    G_LOCK(meta_cache);
+    entry_insert(&id, meta_copy(meta));
+    G_UNLOCK(meta_cache);
+  }
+  else if (have_id)
+    free(id.path);
+
+  return meta;
+}
+
+/****************************************************************
+ * meta_read_shared:
+ * Like meta_read(), but returns the cached structure itself rather
+ * than a copy.  It must not be changed, and has to be handed back with
+ * meta_release() when done.  Metadata that isn't cached is read with
+ * meta_read() and freed by meta_release().  */
+const meta_parameters *meta_read_shared(const char *inName)
+{
+  char *meta_name = appendExt(inName, ".meta");
+  meta_cache_entry *e = NULL;
+  meta_parameters *meta = NULL;
+  meta_file_id id;
+
+  if (meta_cache_enabled && get_file_id(meta_name, &id)) {
+    G_LOCK(meta_cache);
+    e = entry_find(&id);
+    if (e)
+      e->refs++;
+    G_UNLOCK(meta_cache);
+    free(id.path);
+  }
+
+  if (!e) {
+    // meta_read() puts it into the cache, if it can be cached at all
+    meta = meta_read(inName);
+    if (meta_cache_enabled && get_file_id(meta_name, &id)) {
+      G_LOCK(meta_cache);
+      e = entry_find(&id);
+      if (e)
+        e->refs++;
+      G_UNLOCK(meta_cache);
+      free(id.path);
+    }
+  }
+  FREE(meta_name);
+
+  if (e) {
+    meta_free(meta);
+    return e->meta;
+  }
+
+  e = (meta_cache_entry *) CALLOC(1, sizeof(meta_cache_entry));
+  e->meta = meta;
+  e->refs = 1;
+  G_LOCK(meta_cache);
+  e->next = meta_cache_detached;
+  meta_cache_detached = e;
+  G_UNLOCK(meta_cache);
+
+  return e->meta;
+}
+
+/****************************************************************
+ * meta_release:
+ * Hands back metadata obtained from meta_read_shared().  */
+void meta_release(const meta_parameters *meta)
+{
+  meta_cache_entry *e, **prev;
+  int ii;
+
+  if (!meta)
+    return;
+
+  G_LOCK(meta_cache);
+  for (ii=0; ii<META_CACHE_SIZE; ii++) {
+    e = meta_cache[ii];
+    if (e && e->meta == meta && e->refs > 0) {
+      e->refs--;
+      G_UNLOCK(meta_cache);
+      return;
+    }
+  }
+  for (prev = &meta_cache_detached; *prev; prev = &(*prev)->next) {
+    e = *prev;
+    if (e->meta == meta) {
+      if (--e->refs == 0) {
+        *prev = e->next;
+        entry_free(e);
+      }
+      G_UNLOCK(meta_cache);
+      return;
+    }
+  }
+  G_UNLOCK(meta_cache);
+
+  asfPrintWarning("meta_release: metadata was not from meta_read_shared()\n");
+}
+
+/****************************************************************
+ * meta_cache_forget:
+ * Drops the cached metadata, and any binary sidecar, of the given
+ * file.  Called by meta_write(), so a file rewritten within the time
+ * stamp resolution isn't taken for the old one.  NULL drops the whole
+ * cache.  Structures with handles out stay valid until released.  */
+void meta_cache_forget(const char *inName)
+{
+  char *meta_name = NULL, *path = NULL;
+  int ii;
+
+  if (inName) {
+    char *sidecar;
+    meta_name = appendExt(inName, ".meta");
+    sidecar = sidecar_name(meta_name);
+    if (fileExists(sidecar))
+      remove(sidecar);
+    FREE(sidecar);
+#ifdef win32
+    path = STRDUP(meta_name);
+#else
+    path = realpath(meta_name, NULL);
+#endif
+    if (!path) {
+      // The file is gone, nothing can match it
+      FREE(meta_name);
+      return;
+    }
+  }
+
+  G_LOCK(meta_cache);
+  for (ii=0; ii<META_CACHE_SIZE; ii++)
+    if (meta_cache[ii] && (!path || strcmp(meta_cache[ii]->id.path, path) == 0))
+      entry_remove(ii);
+  G_UNLOCK(meta_cache);
+
+  free(path);
+  FREE(meta_name);
+}
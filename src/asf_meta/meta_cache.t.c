@@ -0,0 +1,247 @@
+#include "CUnit/Basic.h"
+#include "asf_meta.h"
+
+static int same_meta(const meta_parameters *a, const meta_parameters *b)
+{
+  int n = a->state_vectors->vector_count;
+
+  return strcmp(a->general->sensor, b->general->sensor) == 0 &&
+    a->general->line_count == b->general->line_count &&
+    a->general->sample_count == b->general->sample_count &&
+    a->sar->range_time_per_pixel == b->sar->range_time_per_pixel &&
+    a->sar->slant_range_first_pixel == b->sar->slant_range_first_pixel &&
+    n == b->state_vectors->vector_count &&
+    a->state_vectors->vecs[n-1].vec.pos.x ==
+      b->state_vectors->vecs[n-1].vec.pos.x &&
+    a->calibration->type == b->calibration->type;
+}
+
+// Whether two files have exactly the same contents
+static int same_contents(const char *file1, const char *file2)
+{
+  FILE *fp1 = FOPEN(file1, "rb");
+  FILE *fp2 = FOPEN(file2, "rb");
+  int c1, c2;
+
+  do {
+    c1 = fgetc(fp1);
+    c2 = fgetc(fp2);
+  } while (c1 == c2 && c1 != EOF);
+  FCLOSE(fp1);
+  FCLOSE(fp2);
+
+  return c1 == c2;
+}
+
+// The ERS-1 scene with the blocks that meta_copy() and the sidecar
+// have to follow pointers for: Doppler and calibration in their
+// TerraSAR-X/Radarsat-2 or Radarsat-2/Sentinel flavours, and quality,
+// colormap and statistics.
+static meta_parameters *ers1_with_blocks(int radarsat2)
+{
+  meta_parameters *meta = meta_read("test_input/ers1.meta");
+  meta_calibration *cal = meta->calibration;
+  int ii, kk;
+
+  FREE(cal->asf);
+  cal->asf = NULL;
+  meta->doppler = meta_doppler_init();
+
+  if (radarsat2) {
+    radarsat2_doppler_params *r2 =
+      (radarsat2_doppler_params *) MALLOC(sizeof(radarsat2_doppler_params));
+    r2->ref_time_centroid = 0.0051;
+    r2->ref_time_rate = 0.0052;
+    r2->time_first_sample = 0.0053;
+    r2->doppler_count = 3;
+    r2->centroid = (double *) MALLOC(sizeof(double)*r2->doppler_count);
+    r2->rate = (double *) MALLOC(sizeof(double)*r2->doppler_count);
+    for (ii=0; ii<r2->doppler_count; ii++) {
+      r2->centroid[ii] = 12.5 - ii*3.25;
+      r2->rate[ii] = -2100.0 + ii*40.5;
+    }
+    meta->doppler->type = radarsat2_doppler;
+    meta->doppler->r2 = r2;
+
+    cal->type = sentinel_cal;
+    cal->sentinel =
+      (sentinel_cal_params *) MALLOC(sizeof(sentinel_cal_params));
+    cal->sentinel->noise_mean = 0.0123;
+    return meta;
+  }
+
+  tsx_doppler_params *tsx =
+    (tsx_doppler_params *) MALLOC(sizeof(tsx_doppler_params));
+  tsx->year = 2010;
+  tsx->julDay = 123;
+  tsx->second = 4567.5;
+  tsx->doppler_count = 2;
+  tsx->dop = (tsx_doppler_t *) MALLOC(sizeof(tsx_doppler_t)*2);
+  for (ii=0; ii<tsx->doppler_count; ii++) {
+    tsx->dop[ii].time = ii*1.5;
+    tsx->dop[ii].first_range_time = 0.0041;
+    tsx->dop[ii].reference_time = 0.0042 + ii*0.0001;
+    tsx->dop[ii].poly_degree = ii + 1;
+    tsx->dop[ii].coefficient = (double *) MALLOC(sizeof(double)*(ii + 2));
+    for (kk=0; kk<=ii+1; kk++)
+      tsx->dop[ii].coefficient[kk] = 10.0/(kk + 1) + ii;
+  }
+  meta->doppler->type = tsx_doppler;
+  meta->doppler->tsx = tsx;
+
+  cal->type = r2_cal;
+  cal->r2 = (r2_cal_params *) CALLOC(1, sizeof(r2_cal_params));
+  cal->r2->num_elements = 4;
+  for (ii=0; ii<cal->r2->num_elements; ii++) {
+    cal->r2->a_beta[ii] = 500 + ii;
+    cal->r2->a_gamma[ii] = 450 + ii;
+    cal->r2->a_sigma[ii] = 400 + ii;
+  }
+
+  meta->quality = meta_quality_init();
+  meta->quality->bit_error_rate = 0.001;
+  meta->quality->azimuth_resolution = 4.5;
+  meta->quality->range_resolution = 9.6;
+  meta->quality->signal_to_noise_ratio = 17.25;
+  meta->quality->peak_sidelobe_ratio = -22.5;
+  meta->quality->integrated_sidelobe_ratio = -18.75;
+
+  meta->colormap = meta_colormap_init();
+  strcpy(meta->colormap->look_up_table, "test.lut");
+  strcpy(meta->colormap->band_id, "AMP");
+  meta->colormap->num_elements = 3;
+  meta->colormap->rgb = (meta_rgb *) MALLOC(sizeof(meta_rgb)*3);
+  for (ii=0; ii<meta->colormap->num_elements; ii++) {
+    meta->colormap->rgb[ii].red = 10 + ii;
+    meta->colormap->rgb[ii].green = 100 + ii;
+    meta->colormap->rgb[ii].blue = 200 + ii;
+  }
+
+  FREE(meta->stats);
+  meta->stats = meta_statistics_init(2);
+  for (ii=0; ii<meta->stats->band_count; ii++) {
+    sprintf(meta->stats->band_stats[ii].band_id, "BAND%d", ii + 1);
+    meta->stats->band_stats[ii].min = ii;
+    meta->stats->band_stats[ii].max = 255 - ii;
+    meta->stats->band_stats[ii].mean = 101.5 + ii;
+    meta->stats->band_stats[ii].rmse = 3.25;
+    meta->stats->band_stats[ii].std_deviation = 40.125 + ii;
+    meta->stats->band_stats[ii].percent_valid = 99.5;
+    meta->stats->band_stats[ii].mask = 0;
+  }
+
+  return meta;
+}
+
+// Whatever the parser makes of a .meta file, copies from the cache and
+// structures loaded from the binary sidecar have to have all of it, so
+// meta_write() has to write the same file for all three.
+static void check_round_trip(meta_parameters *meta)
+{
+  meta_parameters *parsed, *cached, *loaded;
+
+  meta_write(meta, "test_output/blocks.meta");
+  meta_set_read_cache(FALSE);
+  parsed = meta_read("test_output/blocks");
+  meta_set_read_cache(TRUE);
+  CU_ASSERT(parsed->doppler && parsed->doppler->type == meta->doppler->type);
+  CU_ASSERT(parsed->calibration->type == meta->calibration->type);
+  CU_ASSERT((parsed->quality != NULL) == (meta->quality != NULL));
+  CU_ASSERT((parsed->colormap != NULL) == (meta->colormap != NULL));
+  CU_ASSERT((parsed->stats != NULL) == (meta->stats != NULL));
+  meta_write(parsed, "test_output/blocks_parsed.meta");
+
+  // The first read parses the file, the second one is a cache hit
+  cached = meta_read("test_output/blocks");
+  meta_free(cached);
+  cached = meta_read("test_output/blocks");
+  meta_write(cached, "test_output/blocks_cached.meta");
+  CU_ASSERT(same_contents("test_output/blocks_parsed.meta",
+                          "test_output/blocks_cached.meta"));
+
+  meta_set_binary_sidecar(TRUE);
+  meta_cache_forget("test_output/blocks");
+  loaded = meta_read("test_output/blocks");
+  meta_free(loaded);
+  CU_ASSERT(fileExists("test_output/blocks.metab"));
+  meta_set_read_cache(FALSE);
+  loaded = meta_read("test_output/blocks");
+  meta_set_read_cache(TRUE);
+  meta_write(loaded, "test_output/blocks_sidecar.meta");
+  CU_ASSERT(same_contents("test_output/blocks_parsed.meta",
+                          "test_output/blocks_sidecar.meta"));
+  meta_set_binary_sidecar(FALSE);
+  meta_cache_forget("test_output/blocks");
+
+  remove("test_output/blocks.meta");
+  remove("test_output/blocks_parsed.meta");
+  remove("test_output/blocks_cached.meta");
+  remove("test_output/blocks_sidecar.meta");
+  meta_free(parsed);
+  meta_free(cached);
+  meta_free(loaded);
+}
+
+void test_meta_cache()
+{
+  meta_parameters *meta, *meta2;
+  const meta_parameters *shared, *shared2;
+
+  // Copies from the cache are the caller's own
+  meta = meta_read("test_input/ers1.meta");
+  meta2 = meta_read("test_input/ers1");
+  CU_ASSERT(meta != meta2);
+  CU_ASSERT(meta->calibration != meta2->calibration);
+  CU_ASSERT(same_meta(meta, meta2));
+  meta2->general->line_count = 1;
+  meta_free(meta2);
+
+  // Shared handles are the cached structure itself
+  shared = meta_read_shared("test_input/ers1");
+  shared2 = meta_read_shared("test_input/ers1.meta");
+  CU_ASSERT(shared == shared2);
+  CU_ASSERT(same_meta(meta, shared));
+  meta_release(shared);
+  meta_release(shared2);
+
+  // Writing a file drops it from the cache
+  meta_write(meta, "test_output/cache.meta");
+  meta2 = meta_read("test_output/cache");
+  CU_ASSERT(same_meta(meta, meta2));
+  shared = meta_read_shared("test_output/cache");
+  meta2->general->line_count = 123;
+  meta_write(meta2, "test_output/cache.meta");
+  meta_free(meta2);
+  meta2 = meta_read("test_output/cache");
+  CU_ASSERT(meta2->general->line_count == 123);
+  meta_free(meta2);
+  // ... but handles given out before stay valid
+  CU_ASSERT(same_meta(meta, shared));
+  meta_release(shared);
+
+  // The binary sidecar gives back the same structure as the parser
+  meta_set_binary_sidecar(TRUE);
+  meta_write(meta, "test_output/cache.meta");
+  meta2 = meta_read("test_output/cache");
+  meta_free(meta2);
+  CU_ASSERT(fileExists("test_output/cache.metab"));
+  meta_set_read_cache(FALSE);
+  meta2 = meta_read("test_output/cache");
+  CU_ASSERT(same_meta(meta, meta2));
+  meta_free(meta2);
+  meta_set_read_cache(TRUE);
+  meta_set_binary_sidecar(FALSE);
+  meta_cache_forget("test_output/cache");
+  CU_ASSERT(!fileExists("test_output/cache.metab"));
+
+  remove("test_output/cache.meta");
+  meta_free(meta);
+
+  // Every block comes back from the cache and the sidecar
+  meta = ers1_with_blocks(FALSE);
+  check_round_trip(meta);
+  meta_free(meta);
+  meta = ers1_with_blocks(TRUE);
+  check_round_trip(meta);
+  meta_free(meta);
+}
@@ -40,8 +40,11 @@ meta_parameters *meta_copy(meta_parameters *src)
     ret->state_vectors = NULL;
 
   if (src->stats) {
-    if (!ret->stats) ret->stats = meta_statistics_init(src->stats->band_count);
-    memcpy(ret->stats, src->stats, sizeof(meta_stats));
+    int band_count = src->stats->band_count > 0 ? src->stats->band_count : 0;
+    FREE(ret->stats);
+    ret->stats = meta_statistics_init(band_count);
+    memcpy(ret->stats, src->stats,
+	   sizeof(meta_statistics) + band_count*sizeof(meta_stats));
   } else
     ret->stats = NULL;
 
@@ -120,15 +123,78 @@ meta_parameters *meta_copy(meta_parameters *src)
       ret->calibration->tsx = (tsx_cal_params *) MALLOC(sizeof(tsx_cal_params));
       memcpy(ret->calibration->tsx, src->calibration->tsx, sizeof(tsx_cal_params));
     }
+    if(src->calibration->r2) {
+      ret->calibration->r2 = (r2_cal_params *) MALLOC(sizeof(r2_cal_params));
+      memcpy(ret->calibration->r2, src->calibration->r2, sizeof(r2_cal_params));
+    }
     if(src->calibration->uavsar) {
       ret->calibration->uavsar = 
 	(uavsar_cal_params *) MALLOC(sizeof(uavsar_cal_params));
       memcpy(ret->calibration->uavsar, src->calibration->uavsar,
 	     sizeof(uavsar_cal_params));
     }
+    if(src->calibration->sentinel) {
+      ret->calibration->sentinel =
+	(sentinel_cal_params *) MALLOC(sizeof(sentinel_cal_params));
+      memcpy(ret->calibration->sentinel, src->calibration->sentinel,
+	     sizeof(sentinel_cal_params));
+    }
   } else
     ret->calibration = NULL;
 
+  if (src->doppler) {
+    int ii;
+    ret->doppler = meta_doppler_init();
+    ret->doppler->type = src->doppler->type;
+    if (src->doppler->tsx) {
+      tsx_doppler_params *tsx =
+	(tsx_doppler_params *) MALLOC(sizeof(tsx_doppler_params));
+      memcpy(tsx, src->doppler->tsx, sizeof(tsx_doppler_params));
+      if (src->doppler->tsx->dop) {
+	tsx->dop = (tsx_doppler_t *)
+	  MALLOC(sizeof(tsx_doppler_t)*tsx->doppler_count);
+	memcpy(tsx->dop, src->doppler->tsx->dop,
+	       sizeof(tsx_doppler_t)*tsx->doppler_count);
+	for (ii=0; ii<tsx->doppler_count; ii++) {
+	  size_t sz = sizeof(double)*(tsx->dop[ii].poly_degree+1);
+	  tsx->dop[ii].coefficient = (double *) MALLOC(sz);
+	  memcpy(tsx->dop[ii].coefficient,
+		 src->doppler->tsx->dop[ii].coefficient, sz);
+	}
+      }
+      ret->doppler->tsx = tsx;
+    }
+    if (src->doppler->r2) {
+      radarsat2_doppler_params *r2 =
+	(radarsat2_doppler_params *) MALLOC(sizeof(radarsat2_doppler_params));
+      size_t sz = sizeof(double)*src->doppler->r2->doppler_count;
+      memcpy(r2, src->doppler->r2, sizeof(radarsat2_doppler_params));
+      if (src->doppler->r2->centroid) {
+	r2->centroid = (double *) MALLOC(sz);
+	memcpy(r2->centroid, src->doppler->r2->centroid, sz);
+      }
+      if (src->doppler->r2->rate) {
+	r2->rate = (double *) MALLOC(sz);
+	memcpy(r2->rate, src->doppler->r2->rate, sz);
+      }
+      ret->doppler->r2 = r2;
+    }
+  }
+
+  if (src->quality) {
+    ret->quality = meta_quality_init();
+    memcpy(ret->quality, src->quality, sizeof(meta_quality));
+  }
+
+  if (src->latlon && src->general) {
+    size_t sz = sizeof(float)*
+      src->general->line_count*src->general->sample_count;
+    ret->latlon = meta_latlon_init(src->general->line_count,
+				   src->general->sample_count);
+    memcpy(ret->latlon->lat, src->latlon->lat, sz);
+    memcpy(ret->latlon->lon, src->latlon->lon, sz);
+  }
+
   if (src->colormap) {
     // free default created one, if there
     if (ret->colormap) {
@@ -138,9 +204,13 @@ meta_parameters *meta_copy(meta_parameters *src)
     // now create the copy
     ret->colormap = meta_colormap_init();
     memcpy(ret->colormap, src->colormap, sizeof(meta_colormap));
-    size_t sz = sizeof(meta_rgb)*ret->colormap->num_elements;
-    ret->colormap->rgb = MALLOC(sz);
-    memcpy(ret->colormap->rgb, src->colormap->rgb, sz);
+    if (src->colormap->rgb && src->colormap->num_elements > 0) {
+      size_t sz = sizeof(meta_rgb)*ret->colormap->num_elements;
+      ret->colormap->rgb = MALLOC(sz);
+      memcpy(ret->colormap->rgb, src->colormap->rgb, sz);
+    }
+    else
+      ret->colormap->rgb = NULL;
   }
 
 /* Copy Depricated structures
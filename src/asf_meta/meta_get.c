@@ -164,7 +164,7 @@ double meta_get_dop(meta_parameters *meta,double yLine, double xSample)
       xSample * meta->sar->azimuth_time_per_pixel;
     refTime = meta->doppler->tsx->dop[min].reference_time;
     coeff = (double *) MALLOC(sizeof(double)*
-			      meta->doppler->tsx->dop[min].poly_degree);
+			      (meta->doppler->tsx->dop[min].poly_degree+1));
     double dopplerMin = 0.0;
     for (ii=0; ii<=meta->doppler->tsx->dop[min].poly_degree; ii++) {
       coeff[ii] = meta->doppler->tsx->dop[min].coefficient[ii];
@@ -174,7 +174,7 @@ double meta_get_dop(meta_parameters *meta,double yLine, double xSample)
     double dopAzimuthMax = dopAzimuthStart + meta->doppler->tsx->dop[max].time;
     refTime = meta->doppler->tsx->dop[min].reference_time;
     coeff = (double *) MALLOC(sizeof(double)*
-			      meta->doppler->tsx->dop[max].poly_degree);
+			      (meta->doppler->tsx->dop[max].poly_degree+1));
     double dopplerMax = 0.0;
     for (ii=0; ii<=meta->doppler->tsx->dop[max].poly_degree; ii++) {
       coeff[ii] = meta->doppler->tsx->dop[max].coefficient[ii];
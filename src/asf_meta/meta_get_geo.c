@@ -19,6 +19,10 @@ PROGRAM HISTORY:
 #include <libasf_proj.h>
 //#include "jpl_proj.h"
 
+#ifndef SQR
+# define SQR(x) ((x)*(x))
+#endif
+
 /*******************************************************************
  * Prototypes                                                     */
 double *get_a_coeffs(meta_parameters *meta);
@@ -403,6 +407,141 @@ static int meta_get_lineSamp_imp(meta_parameters *meta,
   return 0;
 }
 
+/******************************************************************
+ * Range-Doppler inversion for slant and ground range images.
+ *
+ * For images geolocated directly from the state vectors, we do not
+ * need to search with the forward geolocation at all: the target's
+ * position is known, so we solve for the azimuth time at which its
+ * Doppler matches the image's Doppler (zero, for deskewed images),
+ * using Newton's method along the orbit.  The derivative of the
+ * Doppler is analytic, from the state vector velocity and the
+ * orbital acceleration in the earth-fixed frame.  The slant range
+ * at that time then gives the sample.  The earth model and Doppler
+ * convention match getLatLongMeta(), so this is the exact inverse of
+ * meta_get_latLon() for these images. */
+static int use_range_doppler = TRUE;
+void meta_set_lineSamp_range_doppler(int enable)
+{
+  use_range_doppler = enable;
+}
+
+int meta_get_lineSamp_range_doppler(void)
+{
+  return use_range_doppler;
+}
+
+/* Is this an image that meta_get_latLon() geolocates with the state
+   vectors and Doppler?  (Keep this in sync with meta_get_latLon.) */
+static int is_range_doppler_image(meta_parameters *meta)
+{
+  return !meta->projection && !meta->airsar && !meta->uavsar &&
+    !meta->latlon && !meta->transform && meta->sar &&
+    (meta->sar->image_type=='S' || meta->sar->image_type=='G') &&
+    meta->state_vectors && meta->state_vectors->vector_count >= 2 &&
+    meta_is_valid_double(meta->sar->azimuth_time_per_pixel) &&
+    meta->sar->azimuth_time_per_pixel != 0.0;
+}
+
+/* Inverse of meta_get_slant() for slant and ground range images. */
+static double slant_to_sample(meta_parameters *meta, double yLine,
+                              double slant)
+{
+  slant -= meta->sar->slant_shift;
+  if (meta->sar->image_type=='S')
+    return (slant - meta->sar->slant_range_first_pixel)
+      / meta->general->x_pixel_size - meta->general->start_sample;
+  else {
+    double er = meta_get_earth_radius(meta,yLine,0);
+    double ht = meta_get_sat_height(meta,yLine,0);
+    double minPhi = acos((SQR(ht)+SQR(er)
+      - SQR(meta->sar->slant_range_first_pixel)) / (2.0*ht*er));
+    double phi = acos((SQR(ht)+SQR(er) - SQR(slant)) / (2.0*ht*er));
+    return (phi - minPhi)*er/meta->general->x_pixel_size
+      - meta->general->start_sample;
+  }
+}
+
+static int meta_get_lineSamp_rd(meta_parameters *meta,
+          double lat,double lon,double elev,
+          double *yLine,double *xSamp)
+{
+  const int max_iter = 20;
+  meta_general *mg = meta->general;
+  meta_sar *ms = meta->sar;
+  double re, rp, psi, rad, t, line=0, samp=0;
+  double angVel, gxMe, lambda;
+  vector targ;
+  int iter;
+
+  /* Target position, on the same elevated ellipsoid getLatLongMeta()
+     intersects, converting geodetic latitude to geocentric the same
+     way it does (in reverse). */
+  GEOLOCATE_REC *g = init_geolocate_meta(&meta->state_vectors->vecs[0].vec,
+                                         meta);
+  re = g->re + elev;
+  rp = g->rp + elev;
+  angVel = g->angularVelocity;
+  gxMe = g->gxMe;
+  lambda = g->lambda;
+  free_geolocate(g);
+
+  psi = atan2(sin(lat*D2R)*rp*rp, cos(lat*D2R)*re*re);
+  rad = re*rp/sqrt(SQR(rp*cos(psi)) + SQR(re*sin(psi)));
+  sph2cart(rad, psi, lon*D2R, &targ);
+
+  /* Start at the center of the scene. */
+  t = meta_get_time(meta, mg->line_count/2, 0);
+
+  for (iter=0; iter<max_iter; ++iter) {
+    stateVector st = meta_get_stVec(meta,t);
+    vector u, acc;
+    double R, uv, r3, dop, f, df, dt;
+
+    vecSub(targ, st.pos, &u);
+    R = vecMagnitude(u);
+    uv = vecDot(u, st.vel);
+
+    line = (t - ms->time_shift)/ms->azimuth_time_per_pixel - mg->start_line;
+    samp = slant_to_sample(meta, line, R);
+    if (!meta_is_valid_double(line) || !meta_is_valid_double(samp))
+      return 1;
+
+    /* Gravity, plus the Coriolis and centrifugal terms of the
+       rotating frame. */
+    r3 = pow(vecMagnitude(st.pos), 3);
+    acc.x = -gxMe*st.pos.x/r3 + 2*angVel*st.vel.y + angVel*angVel*st.pos.x;
+    acc.y = -gxMe*st.pos.y/r3 - 2*angVel*st.vel.x + angVel*angVel*st.pos.y;
+    acc.z = -gxMe*st.pos.z/r3;
+
+    /* Doppler is 2/lambda * d(range)/dt; f is that minus the image's
+       Doppler, scaled to m/s.  The image Doppler only varies slowly
+       along the orbit, so it is left out of the derivative. */
+    dop = ms->deskewed == 1 ? 0.0 : meta_get_dop(meta, line, samp);
+    f = uv/R - 0.5*lambda*dop;
+    df = (vecDot(u,acc) - vecDot(st.vel,st.vel))/R + uv*uv/(R*R*R);
+    if (df == 0.0)
+      return 1;
+
+    dt = -f/df;
+    t += dt;
+
+    if (fabs(dt) < 1e-4*fabs(ms->azimuth_time_per_pixel)) {
+      st = meta_get_stVec(meta,t);
+      vecSub(targ, st.pos, &u);
+      line = (t - ms->time_shift)/ms->azimuth_time_per_pixel - mg->start_line;
+      samp = slant_to_sample(meta, line, vecMagnitude(u));
+      if (!meta_is_valid_double(line) || !meta_is_valid_double(samp))
+        return 1;
+      *yLine = line;
+      *xSamp = samp;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
 static double tolerance = 0.2;
 void meta_set_lineSamp_tolerance(double tol)
 {
@@ -691,6 +830,12 @@ int meta_get_lineSamp(meta_parameters *meta,
     }
   }
 
+  // slant & ground range images can be inverted directly, only fall
+  // back on the iterative search if that doesn't converge
+  if (use_range_doppler && is_range_doppler_image(meta) &&
+      meta_get_lineSamp_rd(meta, lat, lon, elev, yLine, xSamp) == 0)
+    return 0;
+
   // no shortcuts -- use the iterative method
   double tol_incr = tolerance;
   double x0, y0, tol = tolerance;
@@ -154,7 +154,77 @@ void test_meta_get_latLon()
 }
 
 
-void test_meta_get_lineSamp()
+// Compare the range-Doppler inversion with the iterative search it
+// replaced, over a grid covering (and a little beyond) the image.
+static void range_doppler_test(meta_parameters *meta, const char *what)
 {
+  int nl = meta->general->line_count;
+  int ns = meta->general->sample_count;
+  double tolerance = meta_get_lineSamp_tolerance();
+  int i, j;
+
+  for (i=-1; i<=5; ++i) {
+    for (j=-1; j<=5; ++j) {
+      double line = i*nl/4., samp = j*ns/4.;
+      double elev = (i+j)%2 ? 0 : 1000;
+      double lat, lon, line_rd, samp_rd, line_it, samp_it;
+
+      meta_get_latLon(meta, line, samp, elev, &lat, &lon);
+
+      meta_set_lineSamp_range_doppler(TRUE);
+      CU_ASSERT(meta_get_lineSamp(meta, lat, lon, elev, &line_rd, &samp_rd)==0);
+
+      // The search stops once a step is smaller than a tenth of its
+      // tolerance, which with the default of 0.2 can leave it 0.1 of a
+      // pixel out on the coarse slant range grid; tighten it here so it
+      // is a fair reference
+      meta_set_lineSamp_range_doppler(FALSE);
+      meta_set_lineSamp_tolerance(0.05);
+      CU_ASSERT(meta_get_lineSamp(meta, lat, lon, elev, &line_it, &samp_it)==0);
+      meta_set_lineSamp_tolerance(tolerance);
+
+      CU_ASSERT(fabs(line_rd-line) < .02);
+      CU_ASSERT(fabs(samp_rd-samp) < .02);
+      CU_ASSERT(fabs(line_rd-line_it) < .1);
+      CU_ASSERT(fabs(samp_rd-samp_it) < .1);
+
+      if (fabs(line_rd-line) >= .02 || fabs(samp_rd-samp) >= .02 ||
+          fabs(line_rd-line_it) >= .1 || fabs(samp_rd-samp_it) >= .1)
+        printf("%s: (%g,%g) -> (%g,%g) -> rd (%g,%g), iterative (%g,%g)\n",
+               what, line, samp, lat, lon, line_rd, samp_rd,
+               line_it, samp_it);
+    }
+  }
+
+  meta_set_lineSamp_range_doppler(TRUE);
 }
 
+void test_meta_get_lineSamp()
+{
+  meta_parameters *meta;
+
+  // Ground range, deskewed (zero Doppler)
+  meta = meta_read("test_input/ers1.meta");
+  range_doppler_test(meta, "ground range");
+  meta_free(meta);
+
+  // The same scene in slant range: the 10 km ground range pixels are
+  // about 4 km in slant range at ERS-1's incidence angles
+  meta = meta_read("test_input/ers1.meta");
+  meta->sar->image_type = 'S';
+  meta->general->x_pixel_size = 4000;
+  range_doppler_test(meta, "slant range");
+  meta_free(meta);
+
+  // Not deskewed, so each line is at the scene's Doppler centroid
+  // (about 400 Hz here, varying across the swath and, made up for the
+  // test, along it) rather than at zero Doppler
+  meta = meta_read("test_input/ers1.meta");
+  meta->sar->deskewed = 0;
+  meta->sar->azimuth_doppler_coefficients[1] = 0.05;
+  range_doppler_test(meta, "ground range, Doppler");
+  meta->sar->image_type = 'S';
+  meta->general->x_pixel_size = 4000;
+  range_doppler_test(meta, "slant range, Doppler");
+  meta_free(meta);
+}
@@ -0,0 +1,505 @@
+/****************************************************************
+FUNCTION NAME:  meta_geo_grid_*
+
+DESCRIPTION:
+   Geometry grids.  meta_incid(), meta_look(), meta_get_slant() and
+meta_get_dop() each go through state vector interpolation and a bit of
+geometry, which adds up when they are called for every pixel of a
+scene.  All four vary smoothly over an image, so a grid holds them at
+nodes spaced GEO_GRID_STEP pixels apart and interpolates (bilinearly
+or bicubically) in between.
+
+   The spacing is halved, separately in range and azimuth, until the
+values interpolated halfway between the nodes are within the
+tolerances below of the exact ones, but not below GEO_GRID_MIN_STEP
+pixels: if the geometry is noisier than that (e.g. jittery state
+vectors), the grid is used anyway, with a warning.  Images smaller than
+GEO_GRID_STEP pixels in a direction (multilooked previews, test scenes)
+can be refined down to a node on every pixel, which is still a small
+grid.  Only the quantities
+asked for are sampled, and only they decide the spacing.
+
+   Grids can be saved next to the image's .meta (as <image>.geogrid),
+so that later processing steps on the same image don't have to build
+them again.  That is turned on with meta_set_geo_grid_persist().
+
+RETURN VALUE:
+
+SPECIAL CONSIDERATIONS:
+   Only for SAR images in slant range, ground range or ScanSAR
+projection.  Pseudo projected images aren't supported by the functions
+being sampled either.  UAVSAR grids are all zeros, the same placeholder
+meta_incid() returns.
+****************************************************************/
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "asf.h"
+#include "asf_meta.h"
+
+// Initial and smallest node spacing, in pixels.
+#define GEO_GRID_STEP 64
+#define GEO_GRID_MIN_STEP 4
+
+// Largest acceptable interpolation errors.
+#define GEO_GRID_ANGLE_TOLERANCE 1.0e-6   // radians
+#define GEO_GRID_SLANT_TOLERANCE 0.01     // meters
+#define GEO_GRID_DOPPLER_TOLERANCE 0.01   // Hz
+
+#define GEO_GRID_EXT ".geogrid"
+#define GEO_GRID_MAGIC "ASF geometry grid"
+#define GEO_GRID_VERSION 2
+
+static const double grid_tolerance[GRID_QUANTITY_COUNT] = {
+  GEO_GRID_ANGLE_TOLERANCE,
+  GEO_GRID_ANGLE_TOLERANCE,
+  GEO_GRID_SLANT_TOLERANCE,
+  GEO_GRID_DOPPLER_TOLERANCE
+};
+
+static int geo_grid_persist = FALSE;
+
+struct meta_geo_grid {
+  int line_count, sample_count;   // Of the image.
+  int rows, cols;                 // Grid nodes.
+  double line_step, sample_step;  // Pixels between nodes.
+  grid_interp_t interp;
+  int quantities;                 // GRID_QUANTITY_BIT()s of those sampled
+  // Node values (NULL for quantities not sampled), with an extra row and column of nodes all around,
+  // extrapolated linearly from the edge, so that the interpolation never
+  // has to check for the edges.  Node (r,c) is
+  // values[q][(r+1)*(cols+2) + c+1].
+  double *values[GRID_QUANTITY_COUNT];
+  // For meta_geo_grid_line(): first padded column used by each sample,
+  // and the four weights.
+  int *sample_col;
+  double *sample_weight;
+};
+
+void meta_set_geo_grid_persist(int enable)
+{
+  geo_grid_persist = enable;
+}
+
+int meta_get_geo_grid_persist(void)
+{
+  return geo_grid_persist;
+}
+
+static int is_uavsar(meta_parameters *meta)
+{
+  return strcmp_case(meta->general->sensor, "UAVSAR") == 0;
+}
+
+// Whether meta_geo_grid_new() can sample this image's geometry.
+int meta_geo_grid_supported(meta_parameters *meta)
+{
+  return (meta->sar || is_uavsar(meta)) &&
+    !(meta->projection &&
+      meta->projection->type == LAT_LONG_PSEUDO_PROJECTION);
+}
+
+static double exact_value(meta_parameters *meta, grid_quantity_t q,
+                          double y, double x)
+{
+  // UAVSAR has no geometry to go on, meta_incid() returns a placeholder
+  if (is_uavsar(meta))
+    return 0.0;
+
+  switch (q) {
+    case GRID_INCID:
+      return meta_incid(meta, y, x);
+    case GRID_LOOK:
+      return meta_look(meta, y, x);
+    case GRID_SLANT:
+      return meta_get_slant(meta, y, x);
+    case GRID_DOPPLER:
+      return meta_get_dop(meta, y, x);
+    default:
+      asfPrintError("Invalid geometry grid quantity: %d\n", q);
+  }
+  return 0.0;
+}
+
+// Interpolation weights for the four nodes around position f (in node
+// units), relative to the padded node *index.
+static void get_weights(grid_interp_t interp, double f, int n,
+                        int *index, double *w)
+{
+  int i = (int) floor(f);
+  if (i < 0) i = 0;
+  if (i > n - 2) i = n - 2;
+  double t = f - i;
+
+  // Padded index of node i-1
+  *index = i;
+
+  if (interp == GRID_BICUBIC) {
+    // Catmull-Rom
+    double t2 = t*t, t3 = t2*t;
+    w[0] = 0.5*(-t3 + 2*t2 - t);
+    w[1] = 0.5*(3*t3 - 5*t2 + 2);
+    w[2] = 0.5*(-3*t3 + 4*t2 + t);
+    w[3] = 0.5*(t3 - t2);
+  }
+  else {
+    w[0] = 0.0;
+    w[1] = 1.0 - t;
+    w[2] = t;
+    w[3] = 0.0;
+  }
+}
+
+static void fill_padding(meta_geo_grid *g, double *v)
+{
+  int pc = g->cols + 2;
+  int r, c;
+
+  for (r = 1; r <= g->rows; r++) {
+    v[r*pc] = 2*v[r*pc + 1] - v[r*pc + 2];
+    v[r*pc + pc-1] = 2*v[r*pc + pc-2] - v[r*pc + pc-3];
+  }
+  for (c = 0; c < pc; c++) {
+    v[c] = 2*v[pc + c] - v[2*pc + c];
+    v[(g->rows+1)*pc + c] = 2*v[g->rows*pc + c] - v[(g->rows-1)*pc + c];
+  }
+}
+
+static void set_sample_weights(meta_geo_grid *g)
+{
+  int jj;
+
+  g->sample_col = (int *) MALLOC(sizeof(int)*g->sample_count);
+  g->sample_weight = (double *) MALLOC(sizeof(double)*4*g->sample_count);
+  for (jj = 0; jj < g->sample_count; jj++)
+    get_weights(g->interp, jj/g->sample_step, g->cols, &g->sample_col[jj],
+                &g->sample_weight[4*jj]);
+}
+
+static meta_geo_grid *grid_alloc(meta_parameters *meta, int rows, int cols,
+                                 grid_interp_t interp, int quantities)
+{
+  meta_geo_grid *g = (meta_geo_grid *) MALLOC(sizeof(meta_geo_grid));
+  int q;
+
+  g->line_count = meta->general->line_count;
+  g->sample_count = meta->general->sample_count;
+  g->rows = rows;
+  g->cols = cols;
+  g->line_step = g->line_count > 1 ?
+    (double)(g->line_count - 1) / (rows - 1) : 1.0;
+  g->sample_step = g->sample_count > 1 ?
+    (double)(g->sample_count - 1) / (cols - 1) : 1.0;
+  g->interp = interp;
+  g->quantities = quantities;
+  for (q = 0; q < GRID_QUANTITY_COUNT; q++)
+    g->values[q] = quantities & GRID_QUANTITY_BIT(q) ?
+      (double *) MALLOC(sizeof(double)*(rows+2)*(cols+2)) : NULL;
+  g->sample_col = NULL;
+  g->sample_weight = NULL;
+
+  return g;
+}
+
+static int nodes_for_step(int pixels, int step)
+{
+  int n = (pixels - 1 + step - 1) / step + 1;
+  return n < 2 ? 2 : n;
+}
+
+/*******************************************************************
+FUNCTION NAME:   meta_geo_grid_new - samples the image geometry
+
+  Builds the grid of the given quantities (GRID_QUANTITY_BIT()s, or
+GRID_ALL_QUANTITIES) from scratch, refining it until the interpolation
+(bilinear or bicubic, as given) meets their tolerances.
+*******************************************************************/
+meta_geo_grid *meta_geo_grid_new(meta_parameters *meta, grid_interp_t interp,
+                                 int quantities)
+{
+  int nl = meta->general->line_count;
+  int ns = meta->general->sample_count;
+  int line_step = GEO_GRID_STEP, sample_step = GEO_GRID_STEP;
+  int min_line_step = nl < GEO_GRID_STEP ? 1 : GEO_GRID_MIN_STEP;
+  int min_sample_step = ns < GEO_GRID_STEP ? 1 : GEO_GRID_MIN_STEP;
+  meta_geo_grid *g = NULL;
+
+  if (!(quantities & GRID_ALL_QUANTITIES) || (quantities & ~GRID_ALL_QUANTITIES))
+    asfPrintError("Invalid geometry grid quantities: %d\n", quantities);
+
+  if (!meta->sar && !is_uavsar(meta))
+    asfPrintError("Geometry grids need SAR metadata\n");
+  if (meta->projection &&
+      meta->projection->type == LAT_LONG_PSEUDO_PROJECTION)
+    asfPrintError("Geometry grids don't work with pseudo projected images\n");
+
+  while (1) {
+    int rows = nodes_for_step(nl, line_step);
+    int cols = nodes_for_step(ns, sample_step);
+    int pc = cols + 2;
+    int r, c, q, range_ok = TRUE, azimuth_ok = TRUE;
+
+    g = grid_alloc(meta, rows, cols, interp, quantities);
+    for (r = 0; r < rows; r++) {
+      for (c = 0; c < cols; c++) {
+        for (q = 0; q < GRID_QUANTITY_COUNT; q++)
+          if (g->values[q])
+            g->values[q][(r+1)*pc + c+1] =
+              exact_value(meta, q, r*g->line_step, c*g->sample_step);
+      }
+    }
+    for (q = 0; q < GRID_QUANTITY_COUNT; q++)
+      if (g->values[q])
+        fill_padding(g, g->values[q]);
+
+    // Check halfway between the nodes across range, then along azimuth
+    for (r = 0; r < rows && range_ok && g->sample_step > 1; r++) {
+      for (c = 0; c < cols-1 && range_ok; c++) {
+        double y = r*g->line_step, x = (c + 0.5)*g->sample_step;
+        for (q = 0; q < GRID_QUANTITY_COUNT; q++)
+          if (g->values[q] &&
+              fabs(meta_geo_grid_value(g, q, y, x) -
+                   exact_value(meta, q, y, x)) > grid_tolerance[q])
+            range_ok = FALSE;
+      }
+    }
+    for (r = 0; r < rows-1 && azimuth_ok && g->line_step > 1; r++) {
+      for (c = 0; c < cols && azimuth_ok; c++) {
+        double y = (r + 0.5)*g->line_step, x = c*g->sample_step;
+        for (q = 0; q < GRID_QUANTITY_COUNT; q++)
+          if (g->values[q] &&
+              fabs(meta_geo_grid_value(g, q, y, x) -
+                   exact_value(meta, q, y, x)) > grid_tolerance[q])
+            azimuth_ok = FALSE;
+      }
+    }
+
+    if (range_ok && azimuth_ok)
+      break;
+    // Directions already at the smallest spacing stay as they are
+    if (!range_ok && sample_step <= min_sample_step)
+      range_ok = TRUE;
+    if (!azimuth_ok && line_step <= min_line_step)
+      azimuth_ok = TRUE;
+    if (range_ok && azimuth_ok) {
+      asfPrintWarning("Geometry grid interpolation is not within tolerance "
+                      "even with nodes every %d lines and %d samples\n",
+                      line_step, sample_step);
+      break;
+    }
+    meta_geo_grid_free(g);
+    if (!range_ok)
+      sample_step /= 2;
+    if (!azimuth_ok)
+      line_step /= 2;
+  }
+
+  asfPrintStatus("Geometry grid: %d x %d nodes, every %.1f lines and "
+                 "%.1f samples\n", g->rows, g->cols, g->line_step,
+                 g->sample_step);
+  set_sample_weights(g);
+
+  return g;
+}
+
+// Makes sure quantity q was sampled, and returns its node values.
+static const double *grid_values(const meta_geo_grid *g, grid_quantity_t q)
+{
+  if (q < 0 || q >= GRID_QUANTITY_COUNT || !g->values[q])
+    asfPrintError("Geometry grid quantity %d was not sampled\n", q);
+  return g->values[q];
+}
+
+double meta_geo_grid_value(const meta_geo_grid *g, grid_quantity_t q,
+                           double y, double x)
+{
+  const double *v = grid_values(g, q);
+  int pc = g->cols + 2;
+  int r, c, ii, jj;
+  double wy[4], wx[4], value = 0.0;
+
+  get_weights(g->interp, y/g->line_step, g->rows, &r, wy);
+  get_weights(g->interp, x/g->sample_step, g->cols, &c, wx);
+  for (ii = 0; ii < 4; ii++) {
+    double row = 0.0;
+    for (jj = 0; jj < 4; jj++)
+      row += wx[jj]*v[(r+ii)*pc + c+jj];
+    value += wy[ii]*row;
+  }
+
+  return value;
+}
+
+// Interpolates quantity q for all samples of the given line, for the
+// float kernels that calibration works with.  A float holds an angle to
+// well within GEO_GRID_ANGLE_TOLERANCE and a Doppler to within
+// GEO_GRID_DOPPLER_TOLERANCE, but a slant range only to several cm, so
+// slant range has to go through meta_geo_grid_value().
+void meta_geo_grid_line(const meta_geo_grid *g, grid_quantity_t q, int line,
+                        float *out)
+{
+  if (q == GRID_SLANT)
+    asfPrintError("Geometry grid lines can't hold slant ranges to the grid's "
+                  "precision, use meta_geo_grid_value()\n");
+
+  const double *v = grid_values(g, q);
+  int pc = g->cols + 2;
+  int r, c, ii, jj;
+  double wy[4];
+  double *col = (double *) MALLOC(sizeof(double)*pc);
+
+  get_weights(g->interp, line/g->line_step, g->rows, &r, wy);
+  for (c = 0; c < pc; c++) {
+    col[c] = 0.0;
+    for (ii = 0; ii < 4; ii++)
+      col[c] += wy[ii]*v[(r+ii)*pc + c];
+  }
+  for (jj = 0; jj < g->sample_count; jj++) {
+    const double *w = &g->sample_weight[4*jj];
+    const double *cv = &col[g->sample_col[jj]];
+    out[jj] = w[0]*cv[0] + w[1]*cv[1] + w[2]*cv[2] + w[3]*cv[3];
+  }
+
+  FREE(col);
+}
+
+void meta_geo_grid_free(meta_geo_grid *g)
+{
+  int q;
+
+  if (!g)
+    return;
+  for (q = 0; q < GRID_QUANTITY_COUNT; q++)
+    FREE(g->values[q]);
+  FREE(g->sample_col);
+  FREE(g->sample_weight);
+  FREE(g);
+}
+
+int meta_geo_grid_write(const meta_geo_grid *g, const char *file)
+{
+  int pc = g->cols + 2;
+  int q, r, c;
+  char *tmp = (char *) MALLOC(sizeof(char)*(strlen(file) + 10));
+  sprintf(tmp, "%s.tmp", file);
+
+  FILE *fp = fopen(tmp, "w");
+  if (!fp) {
+    asfPrintWarning("Could not save geometry grid %s\n", file);
+    FREE(tmp);
+    return FALSE;
+  }
+  fprintf(fp, "%s %d\n", GEO_GRID_MAGIC, GEO_GRID_VERSION);
+  fprintf(fp, "%d %d %d %d %d %d\n", g->line_count, g->sample_count,
+          g->rows, g->cols, g->interp, g->quantities);
+  for (q = 0; q < GRID_QUANTITY_COUNT; q++) {
+    if (!g->values[q])
+      continue;
+    for (r = 0; r < g->rows; r++) {
+      for (c = 0; c < g->cols; c++)
+        fprintf(fp, "%.17g%c", g->values[q][(r+1)*pc + c+1],
+                c == g->cols-1 ? '\n' : ' ');
+    }
+  }
+  int ok = !ferror(fp);
+  ok = fclose(fp) == 0 && ok;
+  // Write to the side and move into place, so that nobody reads half of
+  // a grid.
+  if (ok)
+    ok = rename(tmp, file) == 0;
+  if (!ok) {
+    asfPrintWarning("Could not save geometry grid %s\n", file);
+    remove(tmp);
+  }
+
+  FREE(tmp);
+  return ok;
+}
+
+// Reads a grid saved with meta_geo_grid_write().  Returns NULL if the
+// file is not there, or not a grid for an image of this size.
+meta_geo_grid *meta_geo_grid_read(const char *file, meta_parameters *meta)
+{
+  char magic[64];
+  int version, nl, ns, rows, cols, interp, quantities, q, r, c;
+  meta_geo_grid *g = NULL;
+
+  FILE *fp = fopen(file, "r");
+  if (!fp)
+    return NULL;
+
+  if (!fgets(magic, sizeof(magic), fp) ||
+      strncmp(magic, GEO_GRID_MAGIC, strlen(GEO_GRID_MAGIC)) != 0 ||
+      sscanf(magic + strlen(GEO_GRID_MAGIC), "%d", &version) != 1 ||
+      version != GEO_GRID_VERSION ||
+      fscanf(fp, "%d %d %d %d %d %d", &nl, &ns, &rows, &cols, &interp,
+             &quantities) != 6 ||
+      nl != meta->general->line_count || ns != meta->general->sample_count ||
+      rows < 2 || cols < 2 || rows > nl + 1 || cols > ns + 1 ||
+      (interp != GRID_BILINEAR && interp != GRID_BICUBIC) ||
+      !(quantities & GRID_ALL_QUANTITIES) ||
+      (quantities & ~GRID_ALL_QUANTITIES)) {
+    fclose(fp);
+    return NULL;
+  }
+
+  g = grid_alloc(meta, rows, cols, interp, quantities);
+  for (q = 0; q < GRID_QUANTITY_COUNT; q++) {
+    if (!g->values[q])
+      continue;
+    for (r = 0; r < rows; r++) {
+      for (c = 0; c < cols; c++) {
+        if (fscanf(fp, "%lf", &g->values[q][(r+1)*(cols+2) + c+1]) != 1) {
+          meta_geo_grid_free(g);
+          fclose(fp);
+          return NULL;
+        }
+      }
+    }
+    fill_padding(g, g->values[q]);
+  }
+  fclose(fp);
+  set_sample_weights(g);
+
+  return g;
+}
+
+/*******************************************************************
+FUNCTION NAME:   meta_geo_grid_get - geometry grid for an image file
+
+  With persistence turned on, the grid saved next to inFile's .meta is
+used if it is there, newer than the .meta, of the interpolation asked
+for and has (at least) the quantities asked for.  Otherwise the grid is
+built, and saved for next time.
+*******************************************************************/
+meta_geo_grid *meta_geo_grid_get(const char *inFile, meta_parameters *meta,
+                                 grid_interp_t interp, int quantities)
+{
+  meta_geo_grid *g = NULL;
+
+  if (!geo_grid_persist)
+    return meta_geo_grid_new(meta, interp, quantities);
+
+  char *metaName = appendExt(inFile, ".meta");
+  char *gridName = appendExt(inFile, GEO_GRID_EXT);
+  struct stat meta_stat, grid_stat;
+
+  if (stat(metaName, &meta_stat) == 0 && stat(gridName, &grid_stat) == 0 &&
+      grid_stat.st_mtime >= meta_stat.st_mtime) {
+    g = meta_geo_grid_read(gridName, meta);
+    if (g && (g->interp != interp ||
+              (g->quantities & quantities) != quantities)) {
+      meta_geo_grid_free(g);
+      g = NULL;
+    }
+    if (g)
+      asfPrintStatus("Using geometry grid %s\n", gridName);
+  }
+  if (!g) {
+    g = meta_geo_grid_new(meta, interp, quantities);
+    meta_geo_grid_write(g, gridName);
+  }
+
+  FREE(metaName);
+  FREE(gridName);
+  return g;
+}
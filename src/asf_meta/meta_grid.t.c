@@ -0,0 +1,203 @@
+#include <sys/stat.h>
+#include <utime.h>
+#include "CUnit/Basic.h"
+#include "asf_meta.h"
+
+// Allowed error, at any point of the image.  The grid guarantees half of
+// this halfway between its nodes.
+static const double tolerance[GRID_QUANTITY_COUNT] = {
+  2.0e-6, 2.0e-6, 0.02, 0.02
+};
+
+static double exact(meta_parameters *meta, grid_quantity_t q,
+                    double y, double x)
+{
+  switch (q) {
+    case GRID_INCID:   return meta_incid(meta, y, x);
+    case GRID_LOOK:    return meta_look(meta, y, x);
+    case GRID_SLANT:   return meta_get_slant(meta, y, x);
+    case GRID_DOPPLER: return meta_get_dop(meta, y, x);
+    default:           return 0.0;
+  }
+}
+
+static void check_grid(meta_parameters *meta, grid_interp_t interp,
+                       int quantities)
+{
+  int nl = meta->general->line_count;
+  int ns = meta->general->sample_count;
+  meta_geo_grid *g = meta_geo_grid_new(meta, interp, quantities);
+  float *line = (float *) MALLOC(sizeof(float)*ns);
+  int ii, jj, bad = 0, q;
+
+  for (ii = 0; ii < nl; ii += nl/7 + 1) {
+    for (q = 0; q < GRID_QUANTITY_COUNT; q++) {
+      if (!(quantities & GRID_QUANTITY_BIT(q)))
+        continue;
+      // Slant range lines are rejected, a float can't hold them
+      if (q != GRID_SLANT)
+        meta_geo_grid_line(g, q, ii, line);
+      for (jj = 0; jj < ns; jj += ns/11 + 1) {
+        double value = meta_geo_grid_value(g, q, ii, jj);
+        if (fabs(value - exact(meta, q, ii, jj)) > tolerance[q] ||
+            (q != GRID_SLANT &&
+             fabs(line[jj] - value) > fabs(value)*1.0e-6 + 1.0e-9))
+          ++bad;
+      }
+    }
+  }
+  CU_ASSERT(bad == 0);
+
+  // Saved and read back, the grid has to give the same values
+  CU_ASSERT(meta_geo_grid_write(g, "test_output/grid.geogrid"));
+  meta_geo_grid *g2 = meta_geo_grid_read("test_output/grid.geogrid", meta);
+  CU_ASSERT(g2 != NULL);
+  if (g2) {
+    for (q = 0; q < GRID_QUANTITY_COUNT; q++)
+      if (quantities & GRID_QUANTITY_BIT(q))
+        CU_ASSERT(meta_geo_grid_value(g, q, nl/3., ns/5.) ==
+                  meta_geo_grid_value(g2, q, nl/3., ns/5.));
+    meta_geo_grid_free(g2);
+  }
+  remove("test_output/grid.geogrid");
+
+  meta_geo_grid_free(g);
+  FREE(line);
+}
+
+// Scales the (subsampled) test metadata back up to the full size of the
+// original image, with pixels to match.
+static void full_size(meta_parameters *meta)
+{
+  double fy = (double)meta->general->line_count /
+    meta->sar->original_line_count;
+  double fx = (double)meta->general->sample_count /
+    meta->sar->original_sample_count;
+
+  meta->general->line_count = meta->sar->original_line_count;
+  meta->general->sample_count = meta->sar->original_sample_count;
+  meta->general->x_pixel_size *= fx;
+  meta->general->y_pixel_size *= fy;
+  meta->sar->range_time_per_pixel *= fx;
+  meta->sar->azimuth_time_per_pixel *= fy;
+  meta->sar->range_doppler_coefficients[1] *= fx;
+  meta->sar->range_doppler_coefficients[2] *= fx*fx;
+  meta->sar->azimuth_doppler_coefficients[1] *= fy;
+  meta->sar->azimuth_doppler_coefficients[2] *= fy*fy;
+}
+
+void test_meta_grid()
+{
+  meta_parameters *meta;
+
+  meta = meta_read("test_input/ers1.meta");
+  check_grid(meta, GRID_BILINEAR, GRID_ALL_QUANTITIES);
+  check_grid(meta, GRID_BICUBIC, GRID_ALL_QUANTITIES);
+  check_grid(meta, GRID_BICUBIC, GRID_QUANTITY_BIT(GRID_INCID));
+  meta_free(meta);
+
+  meta = meta_read("test_input/palsar_fbd.meta");
+  check_grid(meta, GRID_BICUBIC, GRID_ALL_QUANTITIES);
+  meta_free(meta);
+
+  // A whole scene, as calibration and radiometric terrain correction use
+  // it
+  meta = meta_read("test_input/ers1.meta");
+  full_size(meta);
+  check_grid(meta, GRID_BICUBIC, GRID_ALL_QUANTITIES);
+  check_grid(meta, GRID_BICUBIC, GRID_QUANTITY_BIT(GRID_INCID));
+  meta_free(meta);
+}
+
+// Saves a grid built for a different scene (shifted 1 km in range) as
+// the one for test_output/grid_get, with its time stamp the given number
+// of seconds after (or before) that of the .meta, and returns one of its
+// incidence angles.
+static double plant_grid(meta_parameters *meta, int age)
+{
+  meta_parameters *shifted = meta_copy(meta);
+  struct stat meta_stat;
+  struct utimbuf times;
+  double value;
+
+  shifted->sar->slant_range_first_pixel += 1000;
+  meta_geo_grid *g = meta_geo_grid_new(shifted, GRID_BICUBIC,
+                                       GRID_ALL_QUANTITIES);
+  value = meta_geo_grid_value(g, GRID_INCID, 3, 4);
+  CU_ASSERT(meta_geo_grid_write(g, "test_output/grid_get.geogrid"));
+  meta_geo_grid_free(g);
+  meta_free(shifted);
+
+  stat("test_output/grid_get.meta", &meta_stat);
+  times.actime = times.modtime = meta_stat.st_mtime + age;
+  utime("test_output/grid_get.geogrid", &times);
+
+  return value;
+}
+
+// Gets the grid for test_output/grid_get, and tells whether it is the
+// planted one (with the given incidence angle) rather than a new one.
+static int got_planted(meta_parameters *meta, grid_interp_t interp,
+                       int quantities, double planted)
+{
+  meta_geo_grid *g = meta_geo_grid_get("test_output/grid_get", meta,
+                                       interp, quantities);
+  double value = meta_geo_grid_value(g, GRID_INCID, 3, 4);
+
+  meta_geo_grid_free(g);
+  if (value == planted)
+    return TRUE;
+  CU_ASSERT(fabs(value - meta_incid(meta, 3, 4)) < tolerance[GRID_INCID]);
+  return FALSE;
+}
+
+void test_meta_geo_grid_get()
+{
+  meta_parameters *meta = meta_read("test_input/ers1.meta");
+  int incid = GRID_QUANTITY_BIT(GRID_INCID);
+  double planted;
+
+  meta_write(meta, "test_output/grid_get.meta");
+  remove("test_output/grid_get.geogrid");
+
+  // Without persistence nothing is saved or read
+  meta_set_geo_grid_persist(FALSE);
+  meta_geo_grid_free(meta_geo_grid_get("test_output/grid_get", meta,
+                                       GRID_BICUBIC, incid));
+  CU_ASSERT(!fileExists("test_output/grid_get.geogrid"));
+  planted = plant_grid(meta, 10);
+  CU_ASSERT(!got_planted(meta, GRID_BICUBIC, incid, planted));
+
+  meta_set_geo_grid_persist(TRUE);
+
+  // A grid newer than the .meta is used, also for fewer quantities than
+  // it has
+  planted = plant_grid(meta, 10);
+  CU_ASSERT(got_planted(meta, GRID_BICUBIC, GRID_ALL_QUANTITIES, planted));
+  CU_ASSERT(got_planted(meta, GRID_BICUBIC, incid, planted));
+
+  // ... but not for another interpolation
+  CU_ASSERT(!got_planted(meta, GRID_BILINEAR, incid, planted));
+
+  // A grid older than the .meta is built again, and saved over the old one
+  planted = plant_grid(meta, -10);
+  CU_ASSERT(!got_planted(meta, GRID_BICUBIC, incid, planted));
+  meta_geo_grid *g = meta_geo_grid_read("test_output/grid_get.geogrid", meta);
+  CU_ASSERT(g != NULL);
+  if (g) {
+    CU_ASSERT(meta_geo_grid_value(g, GRID_INCID, 3, 4) != planted);
+    meta_geo_grid_free(g);
+  }
+
+  // A grid without the quantities asked for is built again
+  planted = plant_grid(meta, 10);
+  g = meta_geo_grid_new(meta, GRID_BICUBIC, GRID_QUANTITY_BIT(GRID_LOOK));
+  meta_geo_grid_write(g, "test_output/grid_get.geogrid");
+  meta_geo_grid_free(g);
+  CU_ASSERT(!got_planted(meta, GRID_BICUBIC, incid, planted));
+
+  meta_set_geo_grid_persist(FALSE);
+  remove("test_output/grid_get.geogrid");
+  remove("test_output/grid_get.meta");
+  meta_free(meta);
+}
@@ -19,6 +19,9 @@ meta_projection *meta_projection_init(void);
 void add_meta_ddr_struct(const char *name, meta_parameters *meta, struct DDR *ddr);
 meta_state_vectors *meta_state_vectors_init(int vector_count);
 
+/* Prototype from meta_cache.c */
+meta_parameters *meta_cache_read(const char *meta_name);
+
 /* Prototype from unpacked_deg */
 double unpacked_deg(double angle);
 
@@ -69,11 +72,14 @@ meta_parameters *meta_read(const char *inName)
      meta_name, ddr_name);*/
   }
   else if ( fileExists(meta_name) ) {
-    if ( !meta_is_new_style(meta_name) ) {
-      meta_read_old(meta, meta_name);
+    // New style metadata comes parsed from the cache
+    meta_parameters *parsed = meta_cache_read(meta_name);
+    if ( parsed ) {
+      meta_free(meta);
+      meta = parsed;
     }
     else {
-      parse_metadata(meta, meta_name);
+      meta_read_old(meta, meta_name);
     }
   }
   // Generate metadata if CEOS files could be detected
@@ -1371,14 +1371,14 @@ void fill_structure_field(char *field_name, void *valp)
       // Initialize all the type pointers
       if ( ! strcmp(VALP_AS_CHAR_POINTER, "TSX") ) {
 	tsx_doppler_params *tsx = 
-	  (tsx_doppler_params *) MALLOC(sizeof(tsx_doppler_params));
+	  (tsx_doppler_params *) CALLOC(1, sizeof(tsx_doppler_params));
 	(MDOPPLER)->tsx = tsx;
 	(MDOPPLER)->type = tsx_doppler;
 	return;
       }
       if ( ! strcmp(VALP_AS_CHAR_POINTER, "RADARSAT2") ) {
 	radarsat2_doppler_params *r2 =
-	  (radarsat2_doppler_params *) MALLOC(sizeof(radarsat2_doppler_params));
+	  (radarsat2_doppler_params *) CALLOC(1, sizeof(radarsat2_doppler_params));
 	(MDOPPLER)->r2 = r2;
 	(MDOPPLER)->type = radarsat2_doppler;
 	return;
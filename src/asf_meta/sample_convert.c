@@ -0,0 +1,459 @@
+/*******************************************************************************
+sample_convert:
+  Byte order and data type conversion of sample buffers, for ioLine.c.
+
+  Data files are big endian; every line read or written goes through one of
+  these conversions.  There is a kernel for each (source type, destination
+  type, swap) triple, where swap says whether the source or the destination
+  is in big endian byte order (or neither, on big endian hosts).  A kernel is
+  looked up once per call and then runs over the whole buffer.
+
+  All the kernels have a portable scalar version.  On x86 the most common
+  ones -- the straight byte swaps, and the conversions between floats and
+  bytes or 16 bit integers -- are replaced with SSE2 versions, and AVX2
+  versions when the processor has it.  The vector kernels give the same
+  results as the scalar ones, including the truncation of out of range
+  values when converting floats to integer types.
+*/
+
+#include "asf.h"
+#include "asf_meta.h"
+#include <glib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    defined(__SSE2__)
+#  define ASF_SSE2_KERNELS
+#  include <emmintrin.h>
+#  if (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) || \
+      defined(__clang__)
+#    define ASF_AVX2_KERNELS
+#    include <immintrin.h>
+#  endif
+#endif
+
+typedef void (*convert_kernel)(const void *src, void *dest, size_t n);
+
+enum {
+  SWAP_NONE,     /* both sides in host byte order */
+  SWAP_SOURCE,   /* source is big endian (reading a file) */
+  SWAP_DEST,     /* destination is big endian (writing a file) */
+  NUM_SWAP_MODES
+};
+
+/* Indexed by the simple (non-complex) data types.  */
+#define NUM_TYPES (REAL64 + 1)
+
+static convert_kernel scalar_kernels[NUM_TYPES][NUM_TYPES][NUM_SWAP_MODES];
+static convert_kernel best_kernels[NUM_TYPES][NUM_TYPES][NUM_SWAP_MODES];
+static int use_simd = TRUE;
+
+/*******************************************************************************
+ * Scalar kernels.  */
+static inline uint8_t swap_u8(uint8_t x)
+{
+  return x;
+}
+
+static inline uint16_t swap_u16(uint16_t x)
+{
+  return (uint16_t)((x >> 8) | (x << 8));
+}
+
+static inline uint32_t swap_u32(uint32_t x)
+{
+  return (x >> 24) | ((x >> 8) & 0x0000ff00u) |
+         ((x << 8) & 0x00ff0000u) | (x << 24);
+}
+
+static inline uint64_t swap_u64(uint64_t x)
+{
+  return ((uint64_t)swap_u32((uint32_t)x) << 32) |
+    swap_u32((uint32_t)(x >> 32));
+}
+
+/* The three kernels for one (source, destination) pair.  Values are moved
+   between the raw (swappable) and typed representations with fixed size
+   memcpy's, which compile to register moves.  */
+#define SCALAR_KERNELS(SN, ST, SR, SS, DN, DT, DR, DS)                        \
+static void SN##_to_##DN(const void *src, void *dest, size_t n)               \
+{                                                                             \
+  const ST *s = src;                                                          \
+  DT *d = dest;                                                               \
+  size_t i;                                                                   \
+  for (i = 0; i < n; i++)                                                     \
+    d[i] = (DT)s[i];                                                          \
+}                                                                             \
+static void swapped_##SN##_to_##DN(const void *src, void *dest, size_t n)     \
+{                                                                             \
+  const SR *s = src;                                                          \
+  DT *d = dest;                                                               \
+  size_t i;                                                                   \
+  for (i = 0; i < n; i++) {                                                   \
+    SR r = SS(s[i]);                                                          \
+    ST v;                                                                     \
+    memcpy(&v, &r, sizeof(v));                                                \
+    d[i] = (DT)v;                                                             \
+  }                                                                           \
+}                                                                             \
+static void SN##_to_swapped_##DN(const void *src, void *dest, size_t n)       \
+{                                                                             \
+  const ST *s = src;                                                          \
+  DR *d = dest;                                                               \
+  size_t i;                                                                   \
+  for (i = 0; i < n; i++) {                                                   \
+    DT v = (DT)s[i];                                                          \
+    DR r;                                                                     \
+    memcpy(&r, &v, sizeof(r));                                                \
+    d[i] = DS(r);                                                             \
+  }                                                                           \
+}
+
+/* Apply M to every (source, destination) pair of simple types, passing for
+   each type its name, C type, raw type, and swap function.  */
+#define FOR_EACH_DEST(M, SN, ST, SR, SS)                                      \
+  M(SN, ST, SR, SS, byte, unsigned char, uint8_t, swap_u8)                    \
+  M(SN, ST, SR, SS, int16, short int, uint16_t, swap_u16)                     \
+  M(SN, ST, SR, SS, int32, int, uint32_t, swap_u32)                           \
+  M(SN, ST, SR, SS, real32, float, uint32_t, swap_u32)                        \
+  M(SN, ST, SR, SS, real64, double, uint64_t, swap_u64)
+
+#define FOR_EACH_PAIR(M)                                                      \
+  FOR_EACH_DEST(M, byte, unsigned char, uint8_t, swap_u8)                     \
+  FOR_EACH_DEST(M, int16, short int, uint16_t, swap_u16)                      \
+  FOR_EACH_DEST(M, int32, int, uint32_t, swap_u32)                            \
+  FOR_EACH_DEST(M, real32, float, uint32_t, swap_u32)                         \
+  FOR_EACH_DEST(M, real64, double, uint64_t, swap_u64)
+
+FOR_EACH_PAIR(SCALAR_KERNELS)
+
+/* Map the names used above to data types.  */
+#define TYPE_byte   ASF_BYTE
+#define TYPE_int16  INTEGER16
+#define TYPE_int32  INTEGER32
+#define TYPE_real32 REAL32
+#define TYPE_real64 REAL64
+
+#define REGISTER_SCALAR_KERNELS(SN, ST, SR, SS, DN, DT, DR, DS)               \
+  scalar_kernels[TYPE_##SN][TYPE_##DN][SWAP_NONE] = SN##_to_##DN;             \
+  scalar_kernels[TYPE_##SN][TYPE_##DN][SWAP_SOURCE] = swapped_##SN##_to_##DN; \
+  scalar_kernels[TYPE_##SN][TYPE_##DN][SWAP_DEST] = SN##_to_swapped_##DN;
+
+#ifdef ASF_SSE2_KERNELS
+
+/*******************************************************************************
+ * SSE2 kernels.  Each handles whole vectors and leaves the tail (and
+ * anything else) to the scalar kernel it replaces.  */
+static inline __m128i sse2_swap16(__m128i x)
+{
+  return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+static inline __m128i sse2_swap32(__m128i x)
+{
+  const __m128i mask = _mm_set1_epi32(0x00ff00ff);
+  // Swap the bytes in each 16 bit half, then swap the halves.
+  x = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 8), mask),
+                   _mm_slli_epi32(_mm_and_si128(x, mask), 8));
+  return _mm_or_si128(_mm_srli_epi32(x, 16), _mm_slli_epi32(x, 16));
+}
+
+/* Truncate 32 bit integers to their low 16 bits, sign extended, so that the
+   saturating pack gives the same result as a C conversion to short.  */
+static inline __m128i sse2_low16(__m128i x)
+{
+  return _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+}
+
+static void sse2_swap16_copy(const void *src, void *dest, size_t n)
+{
+  const unsigned char *s = src;
+  unsigned char *d = dest;
+  size_t i;
+  for (i = 0; i + 8 <= n; i += 8)
+    _mm_storeu_si128((__m128i *)(d + 2*i),
+                     sse2_swap16(_mm_loadu_si128((const __m128i *)(s + 2*i))));
+  swapped_int16_to_int16(s + 2*i, d + 2*i, n - i);
+}
+
+static void sse2_swap32_copy(const void *src, void *dest, size_t n)
+{
+  const unsigned char *s = src;
+  unsigned char *d = dest;
+  size_t i;
+  for (i = 0; i + 4 <= n; i += 4)
+    _mm_storeu_si128((__m128i *)(d + 4*i),
+                     sse2_swap32(_mm_loadu_si128((const __m128i *)(s + 4*i))));
+  swapped_int32_to_int32(s + 4*i, d + 4*i, n - i);
+}
+
+static void sse2_swapped_int16_to_real32(const void *src, void *dest, size_t n)
+{
+  const short int *s = src;
+  float *d = dest;
+  size_t i;
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i x = sse2_swap16(_mm_loadu_si128((const __m128i *)(s + i)));
+    // Sign extend by unpacking each value into the top half of 32 bits.
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_ps(d + i, _mm_cvtepi32_ps(lo));
+    _mm_storeu_ps(d + i + 4, _mm_cvtepi32_ps(hi));
+  }
+  swapped_int16_to_real32(s + i, d + i, n - i);
+}
+
+static void sse2_byte_to_real32(const void *src, void *dest, size_t n)
+{
+  const unsigned char *s = src;
+  float *d = dest;
+  const __m128i zero = _mm_setzero_si128();
+  size_t i;
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i lo = _mm_unpacklo_epi8(x, zero);
+    __m128i hi = _mm_unpackhi_epi8(x, zero);
+    _mm_storeu_ps(d + i,      _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+    _mm_storeu_ps(d + i + 4,  _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+    _mm_storeu_ps(d + i + 8,  _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+    _mm_storeu_ps(d + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+  }
+  byte_to_real32(s + i, d + i, n - i);
+}
+
+static void sse2_real32_to_swapped_int16(const void *src, void *dest, size_t n)
+{
+  const float *s = src;
+  short int *d = dest;
+  size_t i;
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i lo = sse2_low16(_mm_cvttps_epi32(_mm_loadu_ps(s + i)));
+    __m128i hi = sse2_low16(_mm_cvttps_epi32(_mm_loadu_ps(s + i + 4)));
+    _mm_storeu_si128((__m128i *)(d + i), sse2_swap16(_mm_packs_epi32(lo, hi)));
+  }
+  real32_to_swapped_int16(s + i, d + i, n - i);
+}
+
+static void sse2_real32_to_byte(const void *src, void *dest, size_t n)
+{
+  const float *s = src;
+  unsigned char *d = dest;
+  const __m128i mask = _mm_set1_epi32(0xff);
+  size_t i;
+  for (i = 0; i + 16 <= n; i += 16) {
+    // Keep the low byte of each truncated value, like a C conversion.
+    __m128i a = _mm_and_si128(_mm_cvttps_epi32(_mm_loadu_ps(s + i)), mask);
+    __m128i b = _mm_and_si128(_mm_cvttps_epi32(_mm_loadu_ps(s + i + 4)), mask);
+    __m128i c = _mm_and_si128(_mm_cvttps_epi32(_mm_loadu_ps(s + i + 8)), mask);
+    __m128i e = _mm_and_si128(_mm_cvttps_epi32(_mm_loadu_ps(s + i + 12)), mask);
+    _mm_storeu_si128((__m128i *)(d + i),
+                     _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                      _mm_packs_epi32(c, e)));
+  }
+  real32_to_byte(s + i, d + i, n - i);
+}
+
+#endif /* ASF_SSE2_KERNELS */
+
+#ifdef ASF_AVX2_KERNELS
+
+/*******************************************************************************
+ * AVX2 kernels, used only if the processor supports them.  */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static void avx2_swap16_copy(const void *src, void *dest, size_t n)
+{
+  const unsigned char *s = src;
+  unsigned char *d = dest;
+  const __m256i shuf = _mm256_setr_epi8(
+    1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+    1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+  size_t i;
+  for (i = 0; i + 16 <= n; i += 16)
+    _mm256_storeu_si256((__m256i *)(d + 2*i), _mm256_shuffle_epi8(
+      _mm256_loadu_si256((const __m256i *)(s + 2*i)), shuf));
+  swapped_int16_to_int16(s + 2*i, d + 2*i, n - i);
+}
+
+AVX2 static void avx2_swap32_copy(const void *src, void *dest, size_t n)
+{
+  const unsigned char *s = src;
+  unsigned char *d = dest;
+  const __m256i shuf = _mm256_setr_epi8(
+    3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+    3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+  size_t i;
+  for (i = 0; i + 8 <= n; i += 8)
+    _mm256_storeu_si256((__m256i *)(d + 4*i), _mm256_shuffle_epi8(
+      _mm256_loadu_si256((const __m256i *)(s + 4*i)), shuf));
+  swapped_int32_to_int32(s + 4*i, d + 4*i, n - i);
+}
+
+AVX2 static void avx2_swap64_copy(const void *src, void *dest, size_t n)
+{
+  const unsigned char *s = src;
+  unsigned char *d = dest;
+  const __m256i shuf = _mm256_setr_epi8(
+    7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+    7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+  size_t i;
+  for (i = 0; i + 4 <= n; i += 4)
+    _mm256_storeu_si256((__m256i *)(d + 8*i), _mm256_shuffle_epi8(
+      _mm256_loadu_si256((const __m256i *)(s + 8*i)), shuf));
+  swapped_real64_to_real64(s + 8*i, d + 8*i, n - i);
+}
+
+AVX2 static void avx2_swapped_int16_to_real32(const void *src, void *dest,
+                                              size_t n)
+{
+  const short int *s = src;
+  float *d = dest;
+  const __m128i shuf = _mm_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+  size_t i;
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(s + i)),
+                                 shuf);
+    _mm256_storeu_ps(d + i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x)));
+  }
+  swapped_int16_to_real32(s + i, d + i, n - i);
+}
+
+AVX2 static void avx2_byte_to_real32(const void *src, void *dest, size_t n)
+{
+  const unsigned char *s = src;
+  float *d = dest;
+  size_t i;
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadl_epi64((const __m128i *)(s + i));
+    _mm256_storeu_ps(d + i, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(x)));
+  }
+  byte_to_real32(s + i, d + i, n - i);
+}
+
+#endif /* ASF_AVX2_KERNELS */
+
+/*******************************************************************************
+ * Kernel table.  */
+static void init_kernels(void)
+{
+  FOR_EACH_PAIR(REGISTER_SCALAR_KERNELS)
+  memcpy(best_kernels, scalar_kernels, sizeof(best_kernels));
+
+#ifdef ASF_SSE2_KERNELS
+  best_kernels[INTEGER16][INTEGER16][SWAP_SOURCE] = sse2_swap16_copy;
+  best_kernels[INTEGER16][INTEGER16][SWAP_DEST] = sse2_swap16_copy;
+  best_kernels[INTEGER32][INTEGER32][SWAP_SOURCE] = sse2_swap32_copy;
+  best_kernels[INTEGER32][INTEGER32][SWAP_DEST] = sse2_swap32_copy;
+  best_kernels[REAL32][REAL32][SWAP_SOURCE] = sse2_swap32_copy;
+  best_kernels[REAL32][REAL32][SWAP_DEST] = sse2_swap32_copy;
+  best_kernels[INTEGER16][REAL32][SWAP_SOURCE] = sse2_swapped_int16_to_real32;
+  best_kernels[ASF_BYTE][REAL32][SWAP_SOURCE] = sse2_byte_to_real32;
+  best_kernels[ASF_BYTE][REAL32][SWAP_NONE] = sse2_byte_to_real32;
+  best_kernels[REAL32][INTEGER16][SWAP_DEST] = sse2_real32_to_swapped_int16;
+  best_kernels[REAL32][ASF_BYTE][SWAP_DEST] = sse2_real32_to_byte;
+  best_kernels[REAL32][ASF_BYTE][SWAP_NONE] = sse2_real32_to_byte;
+#endif
+
+#ifdef ASF_AVX2_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    best_kernels[INTEGER16][INTEGER16][SWAP_SOURCE] = avx2_swap16_copy;
+    best_kernels[INTEGER16][INTEGER16][SWAP_DEST] = avx2_swap16_copy;
+    best_kernels[INTEGER32][INTEGER32][SWAP_SOURCE] = avx2_swap32_copy;
+    best_kernels[INTEGER32][INTEGER32][SWAP_DEST] = avx2_swap32_copy;
+    best_kernels[REAL32][REAL32][SWAP_SOURCE] = avx2_swap32_copy;
+    best_kernels[REAL32][REAL32][SWAP_DEST] = avx2_swap32_copy;
+    best_kernels[REAL64][REAL64][SWAP_SOURCE] = avx2_swap64_copy;
+    best_kernels[REAL64][REAL64][SWAP_DEST] = avx2_swap64_copy;
+    best_kernels[INTEGER16][REAL32][SWAP_SOURCE] = avx2_swapped_int16_to_real32;
+    best_kernels[ASF_BYTE][REAL32][SWAP_SOURCE] = avx2_byte_to_real32;
+    best_kernels[ASF_BYTE][REAL32][SWAP_NONE] = avx2_byte_to_real32;
+  }
+#endif
+}
+
+/* The component type of a complex type, e.g. REAL32 for COMPLEX_REAL32. */
+static int component_data_type(int data_type)
+{
+  return data_type >= COMPLEX_BYTE ? data_type - COMPLEX_BYTE + ASF_BYTE
+                                   : data_type;
+}
+
+/* Does big endian data of this type need swapping on this host?  Integer
+   and floating point byte order are configured separately.  */
+static int big_endian_needs_swap(int type)
+{
+  switch (type) {
+    case ASF_BYTE:
+      return FALSE;
+    case INTEGER16:
+    case INTEGER32:
+#if defined(ASF_LIL_ENDIAN)
+      return TRUE;
+#else
+      return FALSE;
+#endif
+    default:
+#if defined(ASF_LIL_IEEE)
+      return TRUE;
+#else
+      return FALSE;
+#endif
+  }
+}
+
+static convert_kernel get_kernel(int src_type, int dest_type, int swap)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    init_kernels();
+    g_once_init_leave (&initialized, 1);
+  }
+
+  if (src_type < ASF_BYTE || src_type > REAL64 ||
+      dest_type < ASF_BYTE || dest_type > REAL64)
+    asfPrintError("Unsupported sample conversion: data type %d to %d\n",
+                  src_type, dest_type);
+
+  return use_simd ? best_kernels[src_type][dest_type][swap]
+                  : scalar_kernels[src_type][dest_type][swap];
+}
+
+/*******************************************************************************
+ * Convert count samples of big endian src_data_type data (from a file) to host
+ * byte order dest_data_type data.  Complex types count as one sample per
+ * pair.  */
+void big_endian_to_native(const void *src, int src_data_type,
+                          void *dest, int dest_data_type, size_t count)
+{
+  int src_type = component_data_type(src_data_type);
+  int dest_type = component_data_type(dest_data_type);
+  size_t n = src_data_type >= COMPLEX_BYTE ? 2*count : count;
+
+  get_kernel(src_type, dest_type,
+             big_endian_needs_swap(src_type) ? SWAP_SOURCE : SWAP_NONE)
+    (src, dest, n);
+}
+
+/*******************************************************************************
+ * Convert count samples of host byte order src_data_type data to big endian
+ * dest_data_type data (for a file).  */
+void native_to_big_endian(const void *src, int src_data_type,
+                          void *dest, int dest_data_type, size_t count)
+{
+  int src_type = component_data_type(src_data_type);
+  int dest_type = component_data_type(dest_data_type);
+  size_t n = src_data_type >= COMPLEX_BYTE ? 2*count : count;
+
+  get_kernel(src_type, dest_type,
+             big_endian_needs_swap(dest_type) ? SWAP_DEST : SWAP_NONE)
+    (src, dest, n);
+}
+
+/* For testing and benchmarking: use only the scalar kernels.  */
+void set_sample_convert_simd(int enable)
+{
+  use_simd = enable;
+}
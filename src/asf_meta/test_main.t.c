@@ -7,6 +7,10 @@ void test_read_proj_file();
 void test_meta_read();
 void test_date();
 void test_longdate();
+void test_cal_kernel();
+void test_meta_grid();
+void test_meta_geo_grid_get();
+void test_meta_cache();
 
 int main()
 {
@@ -29,6 +33,10 @@ int main()
        (NULL == CU_add_test(pSuite, "meta_read", test_meta_read)) ||
        (NULL == CU_add_test(pSuite, "date", test_date)) ||
        (NULL == CU_add_test(pSuite, "longdate", test_longdate)) ||
+       (NULL == CU_add_test(pSuite, "cal_kernel", test_cal_kernel)) ||
+       (NULL == CU_add_test(pSuite, "meta_grid", test_meta_grid)) ||
+       (NULL == CU_add_test(pSuite, "meta_geo_grid_get", test_meta_geo_grid_get)) ||
+       (NULL == CU_add_test(pSuite, "meta_cache", test_meta_cache)) ||
        (NULL == CU_add_test(pSuite, "meta_get_latLon", test_meta_get_latLon)) ||
        (NULL == CU_add_test(pSuite, "meta_get_lineSamp", test_meta_get_lineSamp)))
    {
@@ -10,7 +10,8 @@
 "          [-no-match] [-grid-match] [-offsets <range> <azimuth>]\n"\
 "          [-use-zero-offsets-if-match-fails] [-save-ground-range-dem]\n"\
 "          [-save-incidence-angles] [-use-nearest-neighbor]\n"\
-"          [-use-bilinear]\n"\
+"          [-use-bilinear] [-memory <megabytes>]\n"\
+"          [-dem-cache <dir>] [-dem-cache-size <megabytes>]\n"\
 "          <in_base_name> <dem_base_name> <out_base_name>\n"
 
 #define ASF_DESCRIPTION_STRING \
@@ -59,6 +60,23 @@
 "          if you wish to keep these files around you may do so with this\n"\
 "          option.\n"\
 "\n"\
+"     -memory <megabytes>\n"\
+"          Unless -keep is given, the intermediate files are kept in memory\n"\
+"          instead of being written to disk, as long as they fit in this\n"\
+"          much memory.  Those that don't fit are written to disk as usual.\n"\
+"          By default (or with 0), they are all written to disk.\n"\
+"\n"\
+"     -dem-cache <dir>\n"\
+"          When a DEM is built from a directory of DEMs, keep it in the given\n"\
+"          directory, so that later runs covering the same area use it instead\n"\
+"          of building their own.  An index of the DEM directory is kept there\n"\
+"          as well, so that only DEMs that are new or have changed are looked\n"\
+"          at again.  Several runs at the same time may share the directory.\n"\
+"\n"\
+"     -dem-cache-size <megabytes>\n"\
+"          With -dem-cache, remove the least recently used DEMs from the cache\n"\
+"          when it grows past this size.  By default there is no limit.\n"\
+"\n"\
 "     -no-resample\n"\
 "          If the DEM has a pixel size that is significantly larger (a factor\n"\
 "          of 2) than the SAR image, by default the SAR image is downsampled\n"\
@@ -347,6 +365,8 @@ main (int argc, char *argv[])
   int use_nearest_neighbor = FALSE;
   double range_offset = 0.0;
   double azimuth_offset = 0.0;
+  char *dem_cache = NULL;
+  int dem_cache_size = 0;
   char *other_files[MAX_OTHER];
   int i,n_other = 0;
 
@@ -370,6 +390,24 @@ main (int argc, char *argv[])
     if (strmatches(key,"-keep","--keep","-k",NULL)) {
         clean_files = FALSE;
     }
+    else if (strmatches(key,"-memory","--memory",NULL)) {
+        CHECK_ARG(1);
+        int megabytes = atoi(GET_ARG(1));
+        if (megabytes < 0)
+            asfPrintError("Invalid -memory value: %d\n", megabytes);
+        set_terrcorr_memory_limit((long long) megabytes * 1024 * 1024);
+    }
+    else if (strmatches(key,"-dem-cache","--dem-cache",NULL)) {
+        CHECK_ARG(1);
+        dem_cache = GET_ARG(1);
+    }
+    else if (strmatches(key,"-dem-cache-size","--dem-cache-size",NULL)) {
+        CHECK_ARG(1);
+        dem_cache_size = atoi(GET_ARG(1));
+        if (dem_cache_size < 0)
+            asfPrintError("Invalid -dem-cache-size value: %d\n",
+                          dem_cache_size);
+    }
     else if (strmatches(key,"-no-resample","--no-resample",NULL)) {
         do_resample = FALSE;
     }
@@ -510,6 +548,12 @@ main (int argc, char *argv[])
                     "request a water mask.\n");
   }
 
+  if (dem_cache)
+    set_dem_cache(dem_cache, (long long) dem_cache_size * 1024 * 1024);
+  else if (dem_cache_size > 0)
+    asfPrintWarning("Ignoring -dem-cache-size option, as you did not "
+                    "give a -dem-cache directory.\n");
+
   inFile = argv[currArg];
   demFile = argv[currArg+1];
   outFile = argv[currArg+2];
@@ -7,7 +7,8 @@ void usage()
 {
   printf("Usage:\n\n");
   printf(" kernel -type <kernel_type> [ -size <kernel size> ] [ -nlooks <value> ]\n");
-  printf("        [ -dampling <damping factor> ] <infile> <outfile>\n\n");
+  printf("        [ -dampling <damping factor> ] [ -threads <count> ]\n");
+  printf("        <infile> <outfile>\n\n");
   printf("Produces an outfile with the specified kernel applied.\n");
   printf("The given kernel is applied to all pixels in the input.\n");
   printf("image, to produce the output.\n\n");
@@ -15,7 +16,9 @@ void usage()
   printf("  Note that not all options apply to all kernel types!\n\n");
   printf("  -size     Kernel size to use, must be odd.\n");
   printf("  -nlooks   Number of looks in the radar image.\n");
-  printf("  -damping  Exponential damping factor.\n\n");
+  printf("  -damping  Exponential damping factor.\n");
+  printf("  -threads  Number of threads to filter with (default: one per\n");
+  printf("            processor).  The output does not depend on it.\n\n");
   printf("Valid kernel types:\n");
   printf("  Name      Description (options used)\n");
   printf("  ----      --------------------------\n");
@@ -50,6 +53,13 @@ int main(int argc, char *argv[])
      extract_int_options(&argc, &argv, &nLooks, "-looks","--looks","-nlooks",
                          "--nlooks","-n","-l",NULL);
 
+  int thread_count=0;
+  extract_int_options(&argc, &argv, &thread_count, "-threads","--threads",
+                      NULL);
+  if (thread_count < 0)
+    asfPrintError("Invalid number of threads: %d\n", thread_count);
+  set_filter_thread_count(thread_count);
+
   filter_type_t ktype;
 
   if (strcmp_case(type, "AVERAGE") == 0 || strcmp_case(type, "AVG") == 0) {
@@ -48,6 +48,7 @@ PROGRAM HISTORY:   Converted from FORTRAN subroutine for ROI.f 	T. Logan 8/96
 #include "asf.h"
 #include "asf_meta.h"
 #include "ardop_defs.h"
+#include <glib.h>
 
 int ac_direction=0;/*Used only by dop_prf*/
 
@@ -74,16 +75,18 @@ void acpatch(patch *p,const satellite *s)
 	/*float alpha;*/
 
 	
-	if (sinCosTable==NULL)
+	/*Built once, by whichever patch-processing thread gets here first.*/
+	if (g_once_init_enter(&sinCosTable))
 	{
 		int tableIndex;
-		sinCosTable=(complexFloat *)MALLOC(sizeof(complexFloat)*sinCosTableEntries);
+		complexFloat *table=(complexFloat *)MALLOC(sizeof(complexFloat)*sinCosTableEntries);
 		for (tableIndex=0;tableIndex<sinCosTableEntries;tableIndex++)
 		{
 			float tablePhase=(float)tableIndex/sinCosTableConv;
-			sinCosTable[tableIndex].real = cos(tablePhase);
-			sinCosTable[tableIndex].imag = sin(tablePhase);
+			table[tableIndex].real = cos(tablePhase);
+			table[tableIndex].imag = sin(tablePhase);
 		}
+		g_once_init_leave(&sinCosTable,table);
 	}
 
 	for (lineNo=0; lineNo< p->n_range; lineNo++)
@@ -100,6 +100,142 @@ BUGS:
 #include "asf.h"
 #include "asf_meta.h"
 #include "ardop_defs.h"
+#include <glib.h>
+
+/*Debugging flags that make the processor write intermediate files; these
+  are only honored when patches are processed one at a time.*/
+#define DEBUG_OUTPUT_FLAGS (AZ_X_T|AZ_X_F|AZ_REF_F|AZ_REF_T|AZ_MIG_F|AZ_RAW_F|\
+                            AZ_RAW_T|RANGE_REF_MAP|RANGE_X_F|RANGE_REF_F|\
+                            RANGE_REF_T|RANGE_RAW_F|RANGE_RAW_T)
+
+/*
+Patches shared between the worker threads that focus them and the
+thread that writes them out.  Patch number k (counting from 0) lives in
+ring[k % ring_size].  The writer sets up each patch's location before a
+worker may claim it, and all access to the metadata happens on the writer's
+thread, so the workers only ever touch their own patch.
+*/
+typedef struct {
+    int nPatches;       /*Number of patches to process.*/
+    int ring_size;      /*Number of patches in memory at once.*/
+    patch **ring;
+    int *ready;         /*Has the patch in this slot been processed?*/
+    int loaded;         /*Patches whose location has been set.*/
+    int next;           /*Next patch for a worker to claim.*/
+    GMutex lock;
+    GCond patch_loaded, patch_done;
+    const getRec *signalGetRec;
+    const rangeRef *r;
+    const satellite *s;
+} patch_queue;
+
+static gpointer patch_worker(gpointer data)
+{
+    patch_queue *q=(patch_queue *)data;
+
+    for (;;)
+    {
+        int patchIdx,slot;
+
+        g_mutex_lock(&q->lock);
+        while (q->next<q->nPatches && q->next>=q->loaded)
+            g_cond_wait(&q->patch_loaded,&q->lock);
+        if (q->next>=q->nPatches) {
+            g_mutex_unlock(&q->lock);
+            break;
+        }
+        patchIdx=q->next++;
+        g_mutex_unlock(&q->lock);
+
+        slot=patchIdx%q->ring_size;
+        processPatch(q->ring[slot],q->signalGetRec,q->r,q->s);
+
+        g_mutex_lock(&q->lock);
+        q->ready[slot]=1;
+        g_cond_broadcast(&q->patch_done);
+        g_mutex_unlock(&q->lock);
+    }
+    return NULL;
+}
+
+/*
+processPatchesThreaded:
+Range compress, migrate and azimuth compress nPatches patches, up to
+thread_count at a time, writing them out in order.  Every patch is
+processed exactly as the serial loop in ardop() does it, so the output
+is the same.  Needs thread_count+1 patches' worth of memory.
+*/
+static void processPatchesThreaded(int thread_count,int nPatches,
+    int n_az,int n_range,satellite *s,rangeRef *r,file *f,
+    getRec *signalGetRec,meta_parameters *meta)
+{
+    patch_queue q;
+    GThread **threads;
+    int ii,patchIdx;
+
+    q.nPatches=nPatches;
+    q.ring_size=MIN(thread_count+1,nPatches);
+    q.ring=(patch **)MALLOC(q.ring_size*sizeof(patch *));
+    q.ready=(int *)CALLOC(q.ring_size,sizeof(int));
+    q.next=0;
+    q.signalGetRec=signalGetRec;
+    q.r=r;
+    q.s=s;
+    g_mutex_init(&q.lock);
+    g_cond_init(&q.patch_loaded);
+    g_cond_init(&q.patch_done);
+
+    for (ii=0; ii<q.ring_size; ii++)
+    {
+        q.ring[ii]=newPatch(n_az,n_range);
+        setPatchLoc(q.ring[ii],s,meta,f->skipFile,f->skipSamp,
+                    f->firstLineToProcess + ii * f->n_az_valid);
+    }
+    q.loaded=q.ring_size;
+
+    threads=(GThread **)MALLOC(thread_count*sizeof(GThread *));
+    for (ii=0; ii<thread_count; ii++)
+        threads[ii]=g_thread_new("ardop",patch_worker,&q);
+
+    for (patchIdx=0; patchIdx<nPatches; patchIdx++)
+    {
+        int slot=patchIdx%q.ring_size;
+        int nextIdx=patchIdx+q.ring_size;
+
+        g_mutex_lock(&q.lock);
+        while (!q.ready[slot])
+            g_cond_wait(&q.patch_done,&q.lock);
+        q.ready[slot]=0;
+        g_mutex_unlock(&q.lock);
+
+        if (!quietflag) printf("\n   *****    WRITING PATCH %i    *****\n\n",patchIdx+1);
+        printPatchTimes(q.ring[slot]);
+        writePatch(q.ring[slot],s,meta,f,patchIdx+1);
+
+        /*Hand this slot to the patch that follows it.*/
+        if (nextIdx<nPatches)
+        {
+            setPatchLoc(q.ring[slot],s,meta,f->skipFile,f->skipSamp,
+                        f->firstLineToProcess + nextIdx * f->n_az_valid);
+            g_mutex_lock(&q.lock);
+            q.loaded++;
+            g_cond_broadcast(&q.patch_loaded);
+            g_mutex_unlock(&q.lock);
+        }
+    }
+
+    for (ii=0; ii<thread_count; ii++)
+        g_thread_join(threads[ii]);
+    FREE(threads);
+
+    for (ii=0; ii<q.ring_size; ii++)
+        destroyPatch(q.ring[ii]);
+    FREE(q.ring);
+    FREE(q.ready);
+    g_mutex_clear(&q.lock);
+    g_cond_clear(&q.patch_loaded);
+    g_cond_clear(&q.patch_done);
+}
 
 int ardop(struct INPUT_ARDOP_PARAMS * params_in)
 {
@@ -118,6 +254,7 @@ int ardop(struct INPUT_ARDOP_PARAMS * params_in)
 /*Variables.*/
     int n_az,n_range;/*Region to be processed.*/
     int patchNo;/*Loop counter.*/
+    int thread_count;/*Number of patches to process at once.*/
 
 /*Setup metadata*/
     /*Create ARDOP_PARAMS struct as well as meta_parameters.*/
@@ -195,33 +332,64 @@ int ardop(struct INPUT_ARDOP_PARAMS * params_in)
       printf("   Of the %d azimuth lines, only %d are valid.\n",n_az,f->n_az_valid);
     }
 
-/*
-Create "patch" of data.  This patch is re-used to process
-all of the input data.
-*/
-    p=newPatch(n_az,n_range);
+    thread_count=params.nthreads;
+    if (thread_count<=0)
+        thread_count=g_get_num_processors();
+    if ((s->debugFlag & DEBUG_OUTPUT_FLAGS) || s->hamming)
+        thread_count=1;/*Debugging output is written as we go.*/
 
-/*Loop over each patch of data present, and process it.*/
-    for (patchNo=1; patchNo<=f->nPatches; patchNo++)
+    if (thread_count>1)
     {
-        int lineToBeRead;
-        if (!quietflag) printf("\n   *****    PROCESSING PATCH %i    *****\n\n",patchNo);
-
-        lineToBeRead = f->firstLineToProcess + (patchNo-1) * f->n_az_valid;
-        if (lineToBeRead+p->n_az>signalGetRec->nLines) {
-          if (!quietflag) printf("   Read all the patches in the input file.\n");
-          if (logflag) printLog("   Read all the patches in the input file.\n");
-          break;
+    /*Count the patches that fit in the input file.*/
+        int nPatches=0;
+        while (nPatches<f->nPatches &&
+               f->firstLineToProcess+nPatches*f->n_az_valid+n_az<=signalGetRec->nLines)
+            nPatches++;
+        thread_count=MIN(thread_count,nPatches);
+        if (thread_count>1)
+        {
+            if (!quietflag)
+                printf("   Processing %d patches at a time.\n",thread_count);
+            processPatchesThreaded(thread_count,nPatches,n_az,n_range,
+                                   s,r,f,signalGetRec,meta);
+            if (nPatches<f->nPatches) {
+              if (!quietflag) printf("   Read all the patches in the input file.\n");
+              if (logflag) printLog("   Read all the patches in the input file.\n");
+            }
         }
+    }
 
-        /*Update patch parameters for location.*/
-        setPatchLoc(p,s,meta,f->skipFile,f->skipSamp,lineToBeRead);
-        processPatch(p,signalGetRec,r,s);/*SAR Process patch.*/
-        writePatch(p,s,meta,f,patchNo);/*Output patch data to file.*/
-    } /***********************end patch loop***********************************/
-
-
-    destroyPatch(p);
+    if (thread_count<=1)
+    {
+    /*
+    Create "patch" of data.  This patch is re-used to process
+    all of the input data.
+    */
+        p=newPatch(n_az,n_range);
+
+    /*Loop over each patch of data present, and process it.*/
+        for (patchNo=1; patchNo<=f->nPatches; patchNo++)
+        {
+            int lineToBeRead;
+            if (!quietflag) printf("\n   *****    PROCESSING PATCH %i    *****\n\n",patchNo);
+
+            lineToBeRead = f->firstLineToProcess + (patchNo-1) * f->n_az_valid;
+            if (lineToBeRead+p->n_az>signalGetRec->nLines) {
+              if (!quietflag) printf("   Read all the patches in the input file.\n");
+              if (logflag) printLog("   Read all the patches in the input file.\n");
+              break;
+            }
+
+            /*Update patch parameters for location.*/
+            setPatchLoc(p,s,meta,f->skipFile,f->skipSamp,lineToBeRead);
+            processPatch(p,signalGetRec,r,s);/*SAR Process patch.*/
+            printPatchTimes(p);
+            writePatch(p,s,meta,f,patchNo);/*Output patch data to file.*/
+        } /***********************end patch loop***********************************/
+
+
+        destroyPatch(p);
+    }
 /*  if (!quietflag) printf("\nPROGRAM COMPLETED\n\n");*/
 
     if (logflag) {
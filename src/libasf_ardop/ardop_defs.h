@@ -22,6 +22,8 @@
 #ifndef __ASPMATH_H     /* include only once */
 #define __ASPMATH_H
 
+#include <sys/time.h>
+
 /*-----------------------------------------------------*/
 /* define complex variable type if not already defined */
 /*-----------------------------------------------------*/
@@ -83,6 +85,10 @@ void cfft1d(int n, complexFloat *c, int dir);
 #define NO_RCM 32768
 #define NO_AZIMUTH 65536
 
+/*Stages of processPatch that are timed: range compression, azimuth
+  transform, range migration and azimuth compression.*/
+#define PATCH_STAGES 4
+
 
 /*-------------Structures:---------------
 patch: a chunk of SAR data, throughout the processor.
@@ -99,6 +105,7 @@ typedef struct {
 	float xResampScale,xResampOffset;/*Resampling range coefficients.*/
 	float yResampScale,yResampOffset;/*Resampling azimuth coefficients.*/
 	int fromSample,fromLine;/*Patch's location in original file.*/
+	int stageTime[PATCH_STAGES];/*Seconds taken by each stage of processPatch (-1 if skipped).*/
 } patch;
 
 typedef struct {
@@ -161,7 +168,7 @@ int ardop(struct INPUT_ARDOP_PARAMS * params);
 double fftEstDop(getRec *inFile,int startLine,int xStride,int nLines);
 void estdop(char file[], int nDopLines, float *a, float *b,float *c);
 void calc_range_ref(complexFloat *range_ref, int rangeFFT, int refLen);
-void elapse(int fnc);
+int elapse(struct timeval *start,int fnc);
 void multilook(complexFloat *patch,int n_range,int nlooks, float *pwrs);
 
 /*-------------Populating ARDOP_PARAMS and the metadata---------------*/
@@ -182,6 +189,7 @@ void debugWritePatch_Line(int lineNo, complexFloat *line, char *basename,
                           int n_range, int n_az);
 void processPatch(patch *p,const getRec *signalGetRec,
 	const rangeRef *r,const satellite *s);
+void printPatchTimes(const patch *p);
 void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
 	const file *f,int patchNo);
 void destroyPatch(patch *p);
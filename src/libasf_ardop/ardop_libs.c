@@ -30,7 +30,7 @@ complexFloat    Cmplx(float a, float b)     Returns Complex a + bi
 complexFloat    Csmul(float s, complexFloat a)  Returns Complex s times a
 complexFloat    Cmul(complexFloat a, complexFloat b)    Returns Complex a times b
 
-void    elapse(int fnc)         Elapsed wall clock timer
+int     elapse(struct timeval *start, int fnc)  Elapsed wall clock timer
 
 void    yaxb(float[], float[], int, float*, float*)
     --Computes a linear regression based on least squares fit
@@ -48,19 +48,17 @@ PROGRAM HISTORY:  Ver 1.0  T. Logan - Most routines are new
 #include "ardop_defs.h"
 #include "locinc.h"
 
-/* Global Variables used by the complexFloat Arithmetic Routines */
-complexFloat a,b,x;
-float d;
-int i;
+/* The complexFloat Arithmetic Routines keep no state of their own, so they
+   may be called from several patch-processing threads at once. */
 
 float  Cabs(complexFloat a)
 {
-  d = sqrt (a.real*a.real + a.imag*a.imag);
-  return d;
+  return sqrt (a.real*a.real + a.imag*a.imag);
 }
 
 complexFloat Cconj(complexFloat a)
 {
+  complexFloat x;
   x.real = a.real;
   x.imag = -a.imag;
   return x;
@@ -68,6 +66,7 @@ complexFloat Cconj(complexFloat a)
 
 complexFloat Czero()
 {
+  complexFloat x;
   x.real = 0.0;
   x.imag = 0.0;
   return x;
@@ -75,6 +74,7 @@ complexFloat Czero()
 
 complexFloat Cadd (complexFloat a, complexFloat b)
 {
+  complexFloat x;
   x.real = a.real+b.real;
   x.imag = a.imag+b.imag;
   return x;
@@ -82,6 +82,7 @@ complexFloat Cadd (complexFloat a, complexFloat b)
 
 complexFloat Cmplx(float a, float b)
 {
+  complexFloat x;
   x.real = a;
   x.imag = b;
   return x;
@@ -89,6 +90,7 @@ complexFloat Cmplx(float a, float b)
 
 complexFloat Csmul(float s, complexFloat a)
 {
+  complexFloat x;
   x.real=s*a.real;
   x.imag=s*a.imag;
   return x;
@@ -96,6 +98,7 @@ complexFloat Csmul(float s, complexFloat a)
 
 complexFloat Cmul (complexFloat a, complexFloat b)
 {
+  complexFloat x;
   x.real = a.real*b.real - a.imag*b.imag;
   x.imag = a.real*b.imag + a.imag*b.real;
   return x;
@@ -103,24 +106,25 @@ complexFloat Cmul (complexFloat a, complexFloat b)
 
 /****************************************************************
 FUNCTION NAME: elapse - an elapsed time wall clock timer
-PARAMETER:   fnc  int   start (0) / stop (!0) switch
+PARAMETER:   start  struct timeval *  the caller's timer
+             fnc    int               start (0) / stop (!0) switch
 DESCRIPTION:
     The input parameter is the start/stop button.  If mode = 0, the timer
-    is started.  If mode != 0, the timer is stopped and the elapsed time
-    is displayed.
+    is started.  If mode != 0, the elapsed time in seconds since the
+    timer was started is returned.  Each caller keeps its own timer, so
+    patches being processed on different threads can be timed at once.
 HISTORY: 1.0 - Tom Logan   4/97  Modified from stopwatch functions
 ****************************************************************/
-void elapse(int fnc)
+int elapse(struct timeval *start, int fnc)
   {
-    struct timeval tp2;
-    static struct timeval tp1;
-
-    if (fnc == 0)
-      gettimeofday(&tp1,NULL);
-    else {
-      gettimeofday(&tp2,NULL);
-      if (!quietflag) printf("   elapsed time = %i seconds.\n\n",(int)(tp2.tv_sec-tp1.tv_sec));
+    struct timeval now;
+
+    if (fnc == 0) {
+      gettimeofday(start,NULL);
+      return 0;
     }
+    gettimeofday(&now,NULL);
+    return (int)(now.tv_sec-start->tv_sec);
   }
 
 /******************************************************************************
@@ -30,13 +30,14 @@ PARAMETERS:
     
 DESCRIPTION:
     Performs a fourier transform of the input data using the asf_fft.a
-  routines. 
+  FFT plans.  The reverse transform is normalized by 1/n.
   
 RETURN VALUE:	None
 
 SPECIAL CONSIDERATIONS:
-   Automatically initializes fft cosine/coefficients array.
-   Keeps work array EVEN if different size fft is called for.
+   Any length n works, though powers of two are fastest.  The plans are
+   cached and shared between threads, so dir==0 only builds them ahead
+   of time.
 
 ****************************************************************/
 #include "asf.h"
@@ -46,28 +47,19 @@ SPECIAL CONSIDERATIONS:
 
 void cfft1d(int n, complexFloat *c, int dir)
 {
-        static int prev_m = 0;
- 	int m=(int)(log(n)/log(2.0)+0.5);
 	if (dir == 0)
 	{
-            //printf("fftInit called for m=%d\n", m);
-            if (prev_m != m) {
-                if (prev_m > 0) {
-                    //printf("Freeing FFT data for m=%d\n", prev_m);
-                    fftFree();
-                }
-		int ret=fftInit(m);
-		if (ret!=0) {
-		  sprintf(errbuf,"   ERROR: Problem %d in FFT!\n",ret);
-		  printErr(errbuf);
-		}
-                prev_m = m;
-            } else {
-                //printf("Already initialized FFT for m=%d.\n", m);
-            }
+		fft_plan_get(n, FFT_FORWARD);
+		fft_plan_get(n, FFT_INVERSE);
 	}
-	if (dir > 0)  iffts((float *)c,m,1);
-	if (dir < 0)  ffts((float *)c,m, 1);
+	if (dir > 0)
+	{
+		float *data=(float *)c, scale=1.0/n;
+		int i;
+		fft_plan_execute(fft_plan_get(n, FFT_INVERSE), data, 1);
+		for (i=0; i<2*n; i++)
+			data[i]*=scale;
+	}
+	if (dir < 0)
+		fft_plan_execute(fft_plan_get(n, FFT_FORWARD), (float *)c, 1);
 }
-
-
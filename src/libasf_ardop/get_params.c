@@ -94,6 +94,7 @@ void fill_default_ardop_params(struct ARDOP_PARAMS *g)
     g->na_valid = -99;  /* Valid output samples per patch (-99->determine)*/
     g->iflag = 1;       /* Debug Flag                                     */
     g->deskew=0;
+    g->nthreads = 1;    /* Process one patch at a time                    */
     g->sloper = g->interr = g->slopea = g->intera = 0.0;
     g->dsloper = g->dinterr = g->dslopea = g->dintera = 0.0;  
     strcpy(g->CALPRMS,"NO");
@@ -300,39 +300,61 @@ void debugWritePatch(const patch *p,char *basename)
 void processPatch(patch *p,const getRec *signalGetRec,const rangeRef *r,
           const satellite *s)
 {
+  struct timeval timer;
   int i;
 
   update_status("Range compressing");
-  if (!quietflag) printf("   RANGE COMPRESSING CHANNELS...\n");
-  elapse(0);
+  elapse(&timer,0);
   rciq(p,signalGetRec,r);
-  if (!quietflag) elapse(1);
+  p->stageTime[0]=elapse(&timer,1);
   if (s->debugFlag & AZ_RAW_T) debugWritePatch(p,"az_raw_t");
 
   update_status("Starting azimuth compression");
-  if (!quietflag) printf("   TRANSFORMING LINES...\n");
-  elapse(0);
+  elapse(&timer,0);
   cfft1d(p->n_az,NULL,0);
   for (i=0; i<p->n_range; i++) cfft1d(p->n_az,&p->trans[i*p->n_az],-1);
-  if (!quietflag) elapse(1);
+  p->stageTime[1]=elapse(&timer,1);
   if (s->debugFlag & AZ_RAW_F) debugWritePatch(p,"az_raw_f");
+  p->stageTime[2]=-1;
   if (!(s->debugFlag & NO_RCM))
     {
       update_status("Range cell migration");
-      if (!quietflag) printf("   START RANGE MIGRATION CORRECTION...\n");
-      elapse(0);
+      elapse(&timer,0);
       rmpatch(p,s);
-      if (!quietflag) elapse(1);
+      p->stageTime[2]=elapse(&timer,1);
       if (s->debugFlag & AZ_MIG_F) debugWritePatch(p,"az_mig_f");
     }
   update_status("Finishing azimuth compression");
-  if (!quietflag) printf("   INVERSE TRANSFORMING LINES...\n");
-  elapse(0);
+  elapse(&timer,0);
   acpatch(p,s);
-  if (!quietflag) elapse(1);
+  p->stageTime[3]=elapse(&timer,1);
 
   /*    if (!quietflag) printf("  Range-Doppler done...\n");*/
 }
+
+/*
+  printPatchTimes:
+  Reports how long each stage of processPatch took on the given patch.
+  Only the thread writing the patches out calls this, so the reports
+  come out whole and in patch order.
+*/
+void printPatchTimes(const patch *p)
+{
+  static const char *stages[PATCH_STAGES]={
+    "RANGE COMPRESSING CHANNELS",
+    "TRANSFORMING LINES",
+    "START RANGE MIGRATION CORRECTION",
+    "INVERSE TRANSFORMING LINES"
+  };
+  int i;
+
+  if (quietflag)
+    return;
+  for (i=0; i<PATCH_STAGES; i++)
+    if (p->stageTime[i]>=0)
+      printf("   %s...\n   elapsed time = %i seconds.\n\n",
+             stages[i],p->stageTime[i]);
+}
 /*
   writePatch:
   Outputs one full patch of data to the given file.
@@ -354,6 +376,7 @@ void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
                 antenna pattern */
   int off_slc = f->n_az_valid * (patchNo-1);
   int off_ml = f->n_az_valid * (patchNo-1) / (f->nlooks);
+  struct timeval timer;
 
   if (patchNo==1)
     openMode="wb";   /* for first patch, truncate output. */
@@ -364,7 +387,7 @@ void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
 
   update_status("Range-doppler done");
   if (!quietflag) printf("   WRITING PATCH OUT...\n");
-  elapse(0);
+  elapse(&timer,0);
 
   /* Allocate buffer space  ------------------------*/
   amps = (float *) MALLOC(p->n_range*sizeof(float));
@@ -568,7 +591,8 @@ void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
   if (metaSigma) meta_free(metaSigma);
   if (metaGamma) meta_free(metaGamma);
   if (metaBeta)  meta_free(metaBeta);
-  if (!quietflag) elapse(1);
+  if (!quietflag)
+    printf("   elapsed time = %i seconds.\n\n",elapse(&timer,1));
 }
 
 
@@ -51,7 +51,7 @@ extern struct ARDOP_PARAMS g;/*ARDOP Globals, defined in ardop_params.h*/
 
 void rciq(patch *p,const getRec *signalGetRec,const rangeRef *r)
 {
-  static complexFloat *fft=NULL;
+  complexFloat *fft;/*Not static: several patches may be compressed at once.*/
   register int i,lineNo;
   int readSamples=p->n_range+r->refLen;/*readSamples is the number of samples 
 				  of uncompressed signal which are to be read in.*/
@@ -63,8 +63,7 @@ void rciq(patch *p,const getRec *signalGetRec,const rangeRef *r)
   if (g.iflag & RANGE_X_F) r_x_f=copyPatch(p);
 
 /*Initialize fft buffer.*/
-  if (fft==NULL)
-    fft=(complexFloat *)MALLOC(sizeof(complexFloat)*r->rangeFFT);
+  fft=(complexFloat *)MALLOC(sizeof(complexFloat)*r->rangeFFT);
 
 /*Check to see if we're reading past the end of the file.*/
   if (p->fromSample+readSamples>signalGetRec->nSamples)
@@ -124,6 +123,7 @@ void rciq(patch *p,const getRec *signalGetRec,const rangeRef *r)
   if (raw_t) {debugWritePatch(raw_t,"range_raw_t"); destroyPatch(raw_t);}
   if (raw_f) {debugWritePatch(raw_f,"range_raw_f"); destroyPatch(raw_f);}
   if (r_x_f) {debugWritePatch(r_x_f,"range_X_f"); destroyPatch(r_x_f);}
+  FREE((void *)fft);
   return;
 }
 
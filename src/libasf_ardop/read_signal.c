@@ -18,6 +18,11 @@ void getSignalLine(getRec *r,long long lineNo,complexFloat *destArr,int readStar
 #include "asf_meta.h"
 #include "ardop_defs.h"
 #include "ceos.h"
+#include <glib.h>
+
+/* getRec's file pointer and input buffer are shared by every thread
+   fetching signal lines from it. */
+G_LOCK_DEFINE_STATIC(signal_read);
 
 /****************************************
 getSignalFormat:
@@ -181,6 +186,7 @@ void getSignalLine(const getRec *r,long long lineNo,complexFloat *destArr,int re
     if (rightClip>r->nSamples) rightClip=r->nSamples;
 
 /*Read line of raw signal data.*/
+    G_LOCK(signal_read);
     FSEEK64(r->fp_in,r->header+lineNo*r->lineSize+leftClip*r->sampleSize,0);
     if (rightClip-leftClip!=
         fread(r->inputArr,r->sampleSize,rightClip-leftClip,r->fp_in))
@@ -215,6 +221,7 @@ void getSignalLine(const getRec *r,long long lineNo,complexFloat *destArr,int re
             destArr[x].real=agcScale*(r->inputArr[index]-r->dcOffsetI);
             destArr[x].imag=agcScale*(r->inputArr[index+1]-r->dcOffsetQ);
         }
+    G_UNLOCK(signal_read);
 
 /*Fill the right side with zeros.*/
     for (x=rightClip;x<readLen;x++)
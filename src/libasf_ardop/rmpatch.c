@@ -52,16 +52,19 @@ PROGRAM HISTORY:  converted from H. Zebker's RMpatch.f - T. Logan 8/96
 #include "asf.h"
 #include "asf_meta.h"
 #include "ardop_defs.h"
+#include <glib.h>
 void create_sinc(int nfilter, float *xintp);
 
 void rmpatch(patch *p,const satellite *s)
 {
 #define OVERLAP 10 /*Zero pixels to append to end of single-line buffer*/
 #define NUM_SINC 2048
+    /*The interpolation kernels are shared by every patch; the work buffers
+    are not, since several patches may be migrated at once.*/
     static float *sincInterp=NULL;
-    static complexFloat *trans_buf,*interpolated_line;
-    static double  *SR;
-    static float   *f0, *f_rate, *xResampVec;
+    complexFloat *trans_buf,*interpolated_line;
+    double  *SR;
+    float   *f0, *f_rate, *xResampVec;
 
     double wavPerPix;/*Wavelengths per pixel*/
     double invN_azPRF,invPRF;
@@ -70,17 +73,18 @@ void rmpatch(patch *p,const satellite *s)
     float outScale,outOffset;
 
     /********* initializations *********/
-    if (sincInterp==NULL)
+    if (g_once_init_enter(&sincInterp))
     {
-        sincInterp=(float *)MALLOC(8*sizeof(float)*NUM_SINC);
-        create_sinc(NUM_SINC,sincInterp);
-        trans_buf=(complexFloat *)MALLOC(sizeof(complexFloat)*(p->n_range+2*OVERLAP));
-        interpolated_line=(complexFloat *)MALLOC(sizeof(complexFloat)*p->n_range);
-        SR=(double *)MALLOC(sizeof(double)*p->n_range);
-        f0=(float *)MALLOC(sizeof(float)*p->n_range);
-        f_rate=(float *)MALLOC(sizeof(float)*p->n_range);
-        xResampVec=(float *)MALLOC(sizeof(float)*p->n_range);
+        float *kernels=(float *)MALLOC(8*sizeof(float)*NUM_SINC);
+        create_sinc(NUM_SINC,kernels);
+        g_once_init_leave(&sincInterp,kernels);
     }
+    trans_buf=(complexFloat *)MALLOC(sizeof(complexFloat)*(p->n_range+2*OVERLAP));
+    interpolated_line=(complexFloat *)MALLOC(sizeof(complexFloat)*p->n_range);
+    SR=(double *)MALLOC(sizeof(double)*p->n_range);
+    f0=(float *)MALLOC(sizeof(float)*p->n_range);
+    f_rate=(float *)MALLOC(sizeof(float)*p->n_range);
+    xResampVec=(float *)MALLOC(sizeof(float)*p->n_range);
 
     /*Azimuth distance on the ground per pulse.*/
     wavPerPix=s->wavl/p->slantPer;
@@ -156,6 +160,13 @@ and offset as a function of input pixel, we must convert:*/
             p->trans[i*p->n_az+azimuth_line] = interpolated_line[i];
     }
     /* ... end of along-range line loop */
+
+    FREE((void *)trans_buf);
+    FREE((void *)interpolated_line);
+    FREE((void *)SR);
+    FREE((void *)f0);
+    FREE((void *)f_rate);
+    FREE((void *)xResampVec);
 }
 /****************************************************************
 FUNCTION NAME:  create_sinc
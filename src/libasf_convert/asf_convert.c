@@ -20,7 +20,9 @@
 #include <ctype.h>
 #include <string.h>
 #include <sys/types.h> /* 'DIR' structure (for opendir) */
+#include <sys/stat.h>
 #include <dirent.h>    /* for opendir itself            */
+#include <glib.h>
 
 #define UNIT_TESTS_MICRON 0.000000001
 #define FLOAT_COMPARE(a, b) (abs((a) - (b)) \
@@ -49,7 +51,7 @@ static char *touzi4_decomposition[3] =
 static char *touzi5_decomposition[4] = 
   {"TSVM_alpha_s","TSVM_phi_s","TSVM_tau_m","TSVM_psi"};
 
-static char *find_decomposition(meta_parameters *meta)
+static char *find_decomposition(const meta_parameters *meta)
 {
   int ii, kk;
   char *decomposition = MALLOC(sizeof(char)*25);
@@ -2491,6 +2493,12 @@ static char *do_processing(convert_config *cfg, const char *inFile_in, int saveD
     else
       sprintf(outFile, "%s", cfg->general->out_name);
     
+    set_dem_cache(cfg->terrain_correct->dem_cache,
+                  (long long) cfg->terrain_correct->dem_cache_size * 1024 * 1024);
+    if (cfg->terrain_correct->memory_limit >= 0)
+      set_terrcorr_memory_limit(
+        (long long) cfg->terrain_correct->memory_limit * 1024 * 1024);
+
     // Call asf_terrcorr!  Or refine_geolocation!
     if (cfg->terrain_correct->refine_geolocation_only) {
       update_status("Refining Geolocation...");
@@ -2742,6 +2750,9 @@ static int asf_convert_file(char *configFileName, int saveDEM)
   convert_config *cfg = read_convert_config(configFileName);
   if (cfg->general->status_file && strlen(cfg->general->status_file) > 0)
     set_status_file(cfg->general->status_file);
+  set_data_lines_use_mmap(cfg->general->mmap_inputs);
+  meta_set_geo_grid_persist(cfg->general->save_geo_grids);
+  meta_set_binary_sidecar(cfg->general->meta_sidecars);
   
   update_status("Processing...");
   
@@ -3248,7 +3259,8 @@ static int asf_convert_file(char *configFileName, int saveDEM)
       sprintf(tmp, "%s%cimport.meta", cfg->general->tmp_dir, DIR_SEPARATOR);
       if (!fileExists(tmp))
 	asfPrintError("Can't save incidence angle map!\n");
-      meta_parameters *meta = meta_read(tmp);
+      // Only looked at, and read again for the layover mask below
+      const meta_parameters *meta = meta_read_shared(tmp);
       free(tmp);
       sprintf(inFile, "%s", outFile);
       if (meta->general->image_data_type == POLARIMETRIC_DECOMPOSITION)
@@ -3257,7 +3269,7 @@ static int asf_convert_file(char *configFileName, int saveDEM)
       else
 	sprintf(outFile, "%s%cterrcorr_side_products", cfg->general->out_name,
 		DIR_SEPARATOR);
-      meta_free(meta);
+      meta_release(meta);
     }
     else {
       sprintf(inFile, "%s", outFile);
@@ -3332,7 +3344,7 @@ static int asf_convert_file(char *configFileName, int saveDEM)
       char *tmp = 
 	(char *) MALLOC(sizeof(char)*(strlen(cfg->general->tmp_dir)+20));
       sprintf(tmp, "%s%cimport.meta", cfg->general->tmp_dir, DIR_SEPARATOR);
-      meta_parameters *meta = meta_read(tmp);
+      const meta_parameters *meta = meta_read_shared(tmp);
       free(tmp);
       sprintf(inFile, "%s", outFile);
       if (meta->general->image_data_type == POLARIMETRIC_DECOMPOSITION)
@@ -3341,7 +3353,7 @@ static int asf_convert_file(char *configFileName, int saveDEM)
       else
 	sprintf(outFile, "%s%clayover_mask", cfg->general->out_name,
 		DIR_SEPARATOR);
-      meta_free(meta);
+      meta_release(meta);
     }
     else {
       sprintf(inFile, "%s", outFile);
@@ -3434,6 +3446,346 @@ static int asf_convert_file(char *configFileName, int saveDEM)
   return TRUE;
 }
 
+// One granule of a batch run
+typedef struct {
+  char item[255];         // Granule, without extension
+  char file[255];         // ... and without directory
+  char dir[255];
+  char tmp_dir[255];      // Its own directory for intermediate files
+  char cfg_name[512];     // Its temporary configuration file
+  char log_name[512];     // Its log, when granules run side by side
+  double size;            // Input size in MB, for the memory budget
+  int done;               // Finished by an earlier run of the batch
+  int finished;
+  int ret;
+} batch_item_t;
+
+typedef struct {
+  convert_config *cfg;
+  char *defaults;         // Default values file, with its directory
+  batch_item_t *items;
+  int count;
+  int jobs;               // Granules processed at once
+  int next;               // Next granule to start
+  int reported;           // Granules reported so far
+  int running;
+  double memory;          // MB of granules running
+  int job_memory;         // MB each granule's terrain correction may keep
+                          // in memory, -1 to leave it to the configuration
+  int n_ok, n_bad;
+  FILE *fDone;            // Granules finished, for resuming the batch
+  GMutex lock;
+  GCond changed;
+} batch_queue_t;
+
+// Size in MB of the files of a granule: all files in its directory whose
+// name contains the granule's.  This is what the memory budget is
+// charged, as the memory a granule's processing takes grows with it.
+static double batch_item_size(batch_item_t *bi)
+{
+  struct dirent *dp;
+  struct stat st;
+  char name[1024];
+  double size = 0.0;
+  DIR *dirp = opendir(strlen(bi->dir) > 0 ? bi->dir : ".");
+
+  if (!dirp)
+    return 0.0;
+  while ((dp = readdir(dirp)) != NULL) {
+    if (strstr(dp->d_name, bi->file) == NULL)
+      continue;
+    sprintf(name, "%s%s", bi->dir, dp->d_name);
+    if (stat(name, &st) == 0 && S_ISREG(st.st_mode))
+      size += st.st_size / (1024.0*1024.0);
+  }
+  closedir(dirp);
+
+  return size;
+}
+
+// Write the temporary configuration file for a granule, in its own
+// temporary directory.
+static void stage_batch_item(batch_queue_t *q, batch_item_t *bi)
+{
+  convert_config *cfg = q->cfg;
+  convert_config *tmp_cfg;
+
+  // Granules running side by side can't share a temporary directory, so
+  // if one was given, each granule gets its own inside it.
+  if (strlen(cfg->general->tmp_dir) > 0)
+    sprintf(bi->tmp_dir, "%s%c%s", cfg->general->tmp_dir, DIR_SEPARATOR,
+            bi->file);
+  else
+    strcpy(bi->tmp_dir, "");
+  create_and_set_tmp_dir(bi->item, cfg->general->default_out_dir,
+                         bi->tmp_dir);
+  sprintf(bi->cfg_name, "%s/%s.cfg", bi->tmp_dir, bi->file);
+  sprintf(bi->log_name, "%s.log", bi->tmp_dir);
+
+  FILE *fConfig = FOPEN(bi->cfg_name, "w");
+  fprintf(fConfig, "asf_mapready temporary configuration file\n\n");
+  fprintf(fConfig, "[General]\n");
+  fprintf(fConfig, "default values = %s\n", q->defaults);
+  fprintf(fConfig, "input file = %s\n", bi->item);
+  if (strlen(cfg->general->default_out_dir) == 0)
+    fprintf(fConfig, "output file = %s%s%s\n",
+            cfg->general->prefix, bi->file, cfg->general->suffix);
+  else
+    fprintf(fConfig, "output file = %s%c%s%s%s\n",
+            cfg->general->default_out_dir, DIR_SEPARATOR,
+            cfg->general->prefix, bi->file, cfg->general->suffix);
+  fprintf(fConfig, "tmp dir = %s\n", bi->tmp_dir);
+  FCLOSE(fConfig);
+
+  // Extend the temporary configuration file
+  tmp_cfg = read_convert_config(bi->cfg_name);
+  if (q->job_memory >= 0)
+    tmp_cfg->terrain_correct->memory_limit = q->job_memory;
+  check_return(write_convert_config(bi->cfg_name, tmp_cfg),
+               "Could not update configuration file");
+  free_convert_config(tmp_cfg);
+}
+
+// Report the granules that are finished, in the order of the batch file,
+// so the output doesn't depend on which granule finishes first.  Called
+// with the lock held.
+static void report_batch_items(batch_queue_t *q)
+{
+  while (q->reported < q->count && q->items[q->reported].finished) {
+    batch_item_t *bi = &q->items[q->reported];
+
+    if (bi->done) {
+      asfPrintStatus("\n%s: ok (processed earlier)\n", bi->item);
+      ++q->n_ok;
+    }
+    else {
+      if (q->jobs > 1) {
+        // Pass on what the granule reported
+        char line[1024];
+        FILE *fp = fopen(bi->log_name, "r");
+        asfPrintStatus("\nProcessing %s ...\n", bi->item);
+        if (fp) {
+          while (fgets(line, sizeof(line), fp) != NULL)
+            asfPrintStatus("%s", line);
+          fclose(fp);
+          remove(bi->log_name);
+        }
+      }
+      if (bi->ret != 0) {
+        asfPrintStatus("%s: failed\n", bi->item);
+        ++q->n_bad;
+      }
+      else {
+        asfPrintStatus("%s: ok\n", bi->item);
+        ++q->n_ok;
+      }
+    }
+    ++q->reported;
+  }
+}
+
+static gpointer batch_worker(gpointer data)
+{
+  batch_queue_t *q = (batch_queue_t *) data;
+  double budget = q->cfg->general->batch_memory;
+  char cmd[2048];
+
+  g_mutex_lock(&q->lock);
+  for (;;) {
+    // Granules start in order; the next one waits until it fits into
+    // the memory budget, unless nothing else is running.
+    while (q->next < q->count && q->items[q->next].done) {
+      q->items[q->next++].finished = TRUE;
+      report_batch_items(q);
+    }
+    if (q->next >= q->count)
+      break;
+    batch_item_t *bi = &q->items[q->next];
+    if (budget > 0 && q->running > 0 && q->memory + bi->size > budget) {
+      g_cond_wait(&q->changed, &q->lock);
+      continue;
+    }
+    ++q->next;
+    ++q->running;
+    q->memory += bi->size;
+    stage_batch_item(q, bi);
+    g_mutex_unlock(&q->lock);
+
+    // This is really quite a kludge-- we used to call the library
+    // function here, now we shell out and run the tool directly, sort
+    // of a step backwards, it seems.  Unfortunately, in order to keep
+    // processing the batch even if an error occurs, we're stuck with
+    // this method.  (Otherwise, we'd have to teach asfPrintError to
+    // get us back here, to continue the loop.)
+    if (q->jobs > 1) {
+      // Each granule logs on its own, and is reported when its turn
+      // comes.
+      sprintf(cmd, "%sasf_mapready%s -quiet -log %s %s",
+              get_argv0(), bin_postfix(), bi->log_name, bi->cfg_name);
+    }
+    else {
+      asfPrintStatus("\nProcessing %s ...\n", bi->item);
+      if (logflag)
+        sprintf(cmd, "%sasf_mapready%s -log %s %s",
+                get_argv0(), bin_postfix(), logFile, bi->cfg_name);
+      else
+        sprintf(cmd, "%sasf_mapready%s %s",
+                get_argv0(), bin_postfix(), bi->cfg_name);
+    }
+    bi->ret = asfSystem(cmd);
+
+    g_mutex_lock(&q->lock);
+    --q->running;
+    q->memory -= bi->size;
+    bi->finished = TRUE;
+    if (bi->ret == 0 && q->fDone) {
+      fprintf(q->fDone, "%s\n", bi->item);
+      fflush(q->fDone);
+    }
+    report_batch_items(q);
+    g_cond_broadcast(&q->changed);
+  }
+  g_mutex_unlock(&q->lock);
+
+  return NULL;
+}
+
+/* Run asf_mapready on every granule listed in the batch file, up to
+   "batch jobs" of them at once (one per processor if 0).  Granules whose
+   files add up to more than "batch memory" MB are not started side by
+   side.  Granules that finish fine are listed in <batch file>.done;
+   with "batch resume" set, the ones already listed there are not
+   processed again.  */
+static void process_batch(convert_config *cfg)
+{
+  batch_queue_t q;
+  char line[255], done_name[1024];
+  GHashTable *done = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           g_free, NULL);
+  int ii, pending, size = 64;
+
+  // The default values file is read by granules running in their own
+  // temporary directory
+  char *tmpDir = MALLOC(sizeof(char)*(strlen(cfg->general->defaults)+1));
+  char *tmpFile = MALLOC(sizeof(char)*(strlen(cfg->general->defaults)+1));
+  split_dir_and_file(cfg->general->defaults, tmpDir, tmpFile);
+  char cwd[10000];
+  char *buf = getcwd(cwd,10000);
+  if (!buf) asfPrintError("Error determining cwd: %s\n", strerror(errno));
+  int defaultsLen;
+  if (strlen(cfg->general->defaults) > strlen(cwd)+strlen(tmpFile)) {
+    defaultsLen = strlen(cfg->general->defaults);
+  } else {
+    defaultsLen = strlen(cwd)+strlen(tmpFile);
+  }
+  q.defaults = MALLOC(sizeof(char)*defaultsLen+2);
+  if (0==strlen(tmpDir)) {
+    sprintf(q.defaults,"%s/%s",cwd,tmpFile);
+  } else {
+    strcpy(q.defaults,cfg->general->defaults);
+  }
+  FREE(tmpDir);
+  FREE(tmpFile);
+
+  // Granules finished by an earlier run
+  sprintf(done_name, "%s.done", cfg->general->batchFile);
+  if (cfg->general->batch_resume && fileExists(done_name)) {
+    FILE *fp = FOPEN(done_name, "r");
+    while (fgets(line, 255, fp) != NULL) {
+      char item[255];
+      if (sscanf(line, "%s", item) == 1)
+        g_hash_table_insert(done, g_strdup(item), GINT_TO_POINTER(1));
+    }
+    FCLOSE(fp);
+  }
+
+  // Read the batch file
+  q.cfg = cfg;
+  q.count = 0;
+  q.items = MALLOC(sizeof(batch_item_t)*size);
+  FILE *fBatch = FOPEN(cfg->general->batchFile, "r");
+  while (fgets(line, 255, fBatch) != NULL) {
+    batch_item_t *bi;
+    char batchItem[255];
+    if (sscanf(line, "%s", batchItem) != 1)
+      continue;
+    if (q.count == size) {
+      size *= 2;
+      q.items = (batch_item_t *) realloc(q.items, sizeof(batch_item_t)*size);
+    }
+    bi = &q.items[q.count++];
+    memset(bi, 0, sizeof(batch_item_t));
+
+    // strip off known extensions
+    char *p = findExt(batchItem);
+    if (p) *p = '\0';
+    strcpy(bi->item, batchItem);
+    split_dir_and_file(bi->item, bi->dir, bi->file);
+    bi->done = g_hash_table_lookup(done, bi->item) != NULL;
+    if (!bi->done && cfg->general->batch_memory > 0)
+      bi->size = batch_item_size(bi);
+  }
+  FCLOSE(fBatch);
+  g_hash_table_destroy(done);
+
+  for (ii=0, pending=0; ii<q.count; ii++)
+    if (!q.items[ii].done)
+      ++pending;
+
+  q.fDone = FOPEN(done_name, cfg->general->batch_resume ? "a" : "w");
+  q.jobs = cfg->general->batch_jobs > 0 ? cfg->general->batch_jobs :
+    (int) g_get_num_processors();
+  if (q.jobs > pending)
+    q.jobs = pending;
+  q.next = q.reported = q.running = 0;
+  q.memory = 0.0;
+
+  // Each granule's terrain correction would otherwise keep up to the
+  // whole limit in memory, so granules running side by side split it,
+  // and the memory budget if one was given.
+  q.job_memory = -1;
+  if (q.jobs > 1) {
+    long long limit = cfg->terrain_correct->memory_limit >= 0 ?
+      (long long) cfg->terrain_correct->memory_limit :
+      get_terrcorr_memory_limit() / (1024*1024);
+    if (cfg->general->batch_memory > 0 && limit > cfg->general->batch_memory)
+      limit = (long long) cfg->general->batch_memory;
+    q.job_memory = (int) (limit / q.jobs);
+  }
+  q.n_ok = q.n_bad = 0;
+  g_mutex_init(&q.lock);
+  g_cond_init(&q.changed);
+
+  if (q.jobs <= 1) {
+    batch_worker(&q);
+  }
+  else {
+    asfPrintStatus("\nProcessing %d granules, %d at a time ...\n",
+                   pending, q.jobs);
+    GThread **threads = (GThread **) MALLOC(sizeof(GThread *)*q.jobs);
+    for (ii=0; ii<q.jobs; ii++)
+      threads[ii] = g_thread_new("batch", batch_worker, &q);
+    for (ii=0; ii<q.jobs; ii++)
+      g_thread_join(threads[ii]);
+    FREE(threads);
+  }
+
+  FCLOSE(q.fDone);
+  g_mutex_clear(&q.lock);
+  g_cond_clear(&q.changed);
+
+  asfPrintStatus("\n\nBatch Complete.\n");
+  asfPrintStatus("Successfully processed %d/%d file%s.\n", q.n_ok,
+      q.n_ok + q.n_bad, q.n_ok + q.n_bad == 1 ? "" : "s");
+
+  if (q.n_bad > 0)
+      asfPrintStatus("  *** %d file%s failed. ***\n", q.n_bad,
+          q.n_bad==1 ? "" : "s");
+
+  FREE(q.items);
+  FREE(q.defaults);
+}
+
 int asf_convert_ext(int createflag, char *configFileName, int saveDEM)
 {
   convert_config *cfg;
@@ -3645,6 +3997,12 @@ int asf_convert_ext(int createflag, char *configFileName, int saveDEM)
           fprintf(fDef, "digital elevation model = %s\n",
                   cfg->terrain_correct->dem);
           fprintf(fDef, "mask = %s\n", cfg->terrain_correct->mask);
+          fprintf(fDef, "dem cache directory = %s\n",
+                  cfg->terrain_correct->dem_cache);
+          fprintf(fDef, "dem cache size = %d\n",
+                  cfg->terrain_correct->dem_cache_size);
+          fprintf(fDef, "terrcorr memory limit = %d\n",
+                  cfg->terrain_correct->memory_limit);
           fprintf(fDef, "smooth dem holes =1\n");
           fprintf(fDef, "do radiometric = %d\n",
                   cfg->terrain_correct->do_radiometric);
@@ -3774,111 +4132,7 @@ int asf_convert_ext(int createflag, char *configFileName, int saveDEM)
 
   // Batch mode processing
   else if (strlen(cfg->general->batchFile) > 0) {
-    convert_config *tmp_cfg=NULL;
-    char tmp_dir[255];
-    char tmpCfgName[255];
-    char line[255];
-    int n_ok = 0, n_bad = 0;
-    FILE *fBatch = FOPEN(cfg->general->batchFile, "r");
-
-    strcpy(tmp_dir, cfg->general->tmp_dir);
-    while (fgets(line, 255, fBatch) != NULL) {
-      char batchItem[255], batchItemFile[255], batchItemDir[255];
-      sscanf(line, "%s", batchItem);
-
-      // strip off known extensions
-      char *p = findExt(batchItem);
-      if (p) *p = '\0';
-
-      split_dir_and_file(batchItem, batchItemDir, batchItemFile);
-
-      char *tmpDir = MALLOC(sizeof(char)*(strlen(cfg->general->defaults)+1));
-      char *tmpFile = MALLOC(sizeof(char)*(strlen(cfg->general->defaults)+1));
-      split_dir_and_file(cfg->general->defaults, tmpDir, tmpFile);
-      char cwd[10000];
-      char *buf = getcwd(cwd,10000);
-      if (!buf) asfPrintError("Error determining cwd: %s\n", strerror(errno));
-      int defaultsLen;
-      if (strlen(cfg->general->defaults) > strlen(cwd)+strlen(tmpFile)) {
-        defaultsLen = strlen(cfg->general->defaults);
-      } else {
-        defaultsLen = strlen(cwd)+strlen(tmpFile);
-      }
-      char *defaults = MALLOC(sizeof(char)*defaultsLen+2);
-      if (0==strlen(tmpDir)) {
-        sprintf(defaults,"%s/%s",cwd,tmpFile);
-      } else {
-        strcpy(defaults,cfg->general->defaults);
-      }
-      FREE(tmpDir);
-      FREE(tmpFile);
-
-      // Create temporary configuration file
-      create_and_set_tmp_dir(batchItem, cfg->general->default_out_dir, tmp_dir);
-      sprintf(tmpCfgName, "%s/%s.cfg", tmp_dir, batchItemFile);
-
-
-      FILE *fConfig = FOPEN(tmpCfgName, "w");
-      fprintf(fConfig, "asf_mapready temporary configuration file\n\n");
-      fprintf(fConfig, "[General]\n");
-      fprintf(fConfig, "default values = %s\n", defaults);
-      fprintf(fConfig, "input file = %s\n", batchItem);
-      if (strlen(cfg->general->default_out_dir) == 0)
-        fprintf(fConfig, "output file = %s%s%s\n",
-                cfg->general->prefix, batchItemFile, cfg->general->suffix);
-      else
-        fprintf(fConfig, "output file = %s%c%s%s%s\n",
-                cfg->general->default_out_dir, DIR_SEPARATOR,
-                cfg->general->prefix, batchItemFile, cfg->general->suffix);
-      fprintf(fConfig, "tmp dir = %s\n", tmp_dir);
-      FCLOSE(fConfig);
-      FREE(defaults);
-
-      // Extend the temporary configuration file
-      tmp_cfg = read_convert_config(tmpCfgName);
-      check_return(write_convert_config(tmpCfgName, tmp_cfg),
-                   "Could not update configuration file");
-      free_convert_config(tmp_cfg);
-
-      // Run asf_mapready for temporary configuration file
-
-      // This is really quite a kludge-- we used to call the library
-      // function here, now we shell out and run the tool directly, sort
-      // of a step backwards, it seems.  Unfortunately, in order to keep
-      // processing the batch even if an error occurs, we're stuck with
-      // this method.  (Otherwise, we'd have to teach asfPrintError to
-      // get us back here, to continue the loop.)
-      asfPrintStatus("\nProcessing %s ...\n", batchItem);
-      char cmd[1024];
-      if (logflag) {
-          sprintf(cmd, "%sasf_mapready%s -log %s %s",
-                get_argv0(), bin_postfix(), logFile, tmpCfgName);
-      }
-      else {
-          sprintf(cmd, "%sasf_mapready%s %s",
-                get_argv0(), bin_postfix(), tmpCfgName);
-      }
-      int ret = asfSystem(cmd);
-
-      if (ret != 0) {
-          asfPrintStatus("%s: failed\n", batchItem);
-          ++n_bad;
-      } else {
-          asfPrintStatus("%s: ok\n", batchItem);
-          ++n_ok;
-      }
-
-      strcpy(tmp_dir, cfg->general->tmp_dir);
-    }
-    FCLOSE(fBatch);
-
-    asfPrintStatus("\n\nBatch Complete.\n");
-    asfPrintStatus("Successfully processed %d/%d file%s.\n", n_ok,
-        n_ok + n_bad, n_ok + n_bad == 1 ? "" : "s");
-
-    if (n_bad > 0)
-        asfPrintStatus("  *** %d file%s failed. ***\n", n_bad,
-            n_bad==1 ? "" : "s");
+    process_batch(cfg);
   }
   // Regular processing
   else {
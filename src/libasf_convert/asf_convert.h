@@ -34,6 +34,12 @@ typedef struct
   int dump_envi;          // true if we should dump .hdr files
   char *defaults;         // default values file
   char *batchFile;        // batch file name
+  int batch_jobs;         // data sets of the batch processed at once
+  int batch_memory;       // MB of data sets processed at once (0: no limit)
+  int batch_resume;       // flag to skip data sets already processed
+  int mmap_inputs;        // flag to read image files through memory maps
+  int save_geo_grids;     // flag to save geometry grids for reuse
+  int meta_sidecars;      // flag to save parsed metadata as <image>.metab
   char *prefix;           // prefix for output file naming scheme
   char *suffix;           // suffix for output file naming scheme
   char *tmp_dir;          // name of the directory for intermediate files
@@ -205,6 +211,10 @@ typedef struct
   int if_coreg_fails_use_zero_offsets; // If TRUE, if coreg fails redo with
                      // no_matching turned on
   int use_nearest_neighbor; // Resampling method during geometric correction
+  char *dem_cache;        // directory for DEMs built from DEM directories
+  int dem_cache_size;     // size limit of the DEM cache in MB, 0 for none
+  int memory_limit;       // MB the intermediate images may be kept in memory,
+                          // -1 for the default
 } s_terrain_correct;
 
 typedef struct
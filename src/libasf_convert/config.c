@@ -306,6 +306,38 @@ int init_convert_config(char *configFile)
   fprintf(fConfig, "# asf_mapready can be used in a batch mode to run a large number of data\n"
           "# sets through the processing flow with the same processing parameters.\n\n");
   fprintf(fConfig, "batch file = \n\n");
+  // batch jobs
+  fprintf(fConfig, "# Number of data sets of the batch that are processed at the same time\n"
+          "# (0 for one per processor)\n\n");
+  fprintf(fConfig, "batch jobs = 1\n\n");
+  // batch memory
+  fprintf(fConfig, "# Data sets are only processed at the same time while the sizes of their\n"
+          "# files add up to no more than this many MB (0 for no limit)\n\n");
+  fprintf(fConfig, "batch memory = 0\n\n");
+  // batch resume
+  fprintf(fConfig, "# Data sets that were processed successfully are listed in a file named\n"
+          "# after the batch file, with the extension .done added.  The batch resume\n"
+          "# flag skips the data sets listed there (1 for skipping them, 0 for\n"
+          "# processing the whole batch again)\n\n");
+  fprintf(fConfig, "batch resume = 0\n\n");
+  // memory map inputs
+  fprintf(fConfig, "# Image files can be read through memory maps instead of being read line by\n"
+          "# line (1 for memory maps, 0 for reading).  That is faster, but only safe\n"
+          "# when no other program writes to or truncates the input files while they\n"
+          "# are processed\n\n");
+  fprintf(fConfig, "memory map inputs = 0\n\n");
+  // save geometry grids
+  fprintf(fConfig, "# The incidence angles used by calibration and radiometric terrain\n"
+          "# correction are interpolated from a grid sampled over the image.  With\n"
+          "# this flag set (1), the grid is saved next to the image's metadata (as\n"
+          "# <image>.geogrid) and reused as long as the metadata doesn't change\n\n");
+  fprintf(fConfig, "save geometry grids = 0\n\n");
+  // save binary metadata
+  fprintf(fConfig, "# Every processing step reads the metadata of its input again.  With this\n"
+          "# flag set (1), the parsed metadata is also saved in binary form next to\n"
+          "# the .meta file (as <image>.metab), so that later steps and later runs\n"
+          "# can load it without parsing the .meta again\n\n");
+  fprintf(fConfig, "save binary metadata = 0\n\n");
   // prefix
   fprintf(fConfig, "# A prefix can be added to the outfile name to avoid overwriting\n"
           "# files (e.g. when running the same data sets through the processing flow\n"
@@ -397,6 +429,7 @@ void free_convert_config(convert_config *cfg)
         if (cfg->terrain_correct) {
             FREE(cfg->terrain_correct->dem);
             FREE(cfg->terrain_correct->mask);
+            FREE(cfg->terrain_correct->dem_cache);
             FREE(cfg->terrain_correct);
         }
         if (cfg->calibrate) {
@@ -486,6 +519,12 @@ convert_config *init_fill_convert_config(char *configFile)
   cfg->general->mosaic = 0;
   cfg->general->batchFile = (char *)MALLOC(sizeof(char)*255);
   strcpy(cfg->general->batchFile, "");
+  cfg->general->batch_jobs = 1;
+  cfg->general->batch_memory = 0;
+  cfg->general->batch_resume = 0;
+  cfg->general->mmap_inputs = 0;
+  cfg->general->save_geo_grids = 0;
+  cfg->general->meta_sidecars = 0;
   cfg->general->defaults = (char *)MALLOC(sizeof(char)*255);
   strcpy(cfg->general->defaults, "");
   cfg->general->status_file = (char *)MALLOC(sizeof(char)*1024);
@@ -625,6 +664,10 @@ convert_config *init_fill_convert_config(char *configFile)
   cfg->terrain_correct->if_coreg_fails_use_zero_offsets = 0;
   cfg->terrain_correct->save_incid_angles = 0;
   cfg->terrain_correct->use_nearest_neighbor = 0;
+  cfg->terrain_correct->dem_cache = (char *)MALLOC(sizeof(char)*255);
+  strcpy(cfg->terrain_correct->dem_cache, "");
+  cfg->terrain_correct->dem_cache_size = 0;
+  cfg->terrain_correct->memory_limit = -1;
 
   cfg->calibrate->radiometry = (char *)MALLOC(sizeof(char)*25);
   strcpy(cfg->calibrate->radiometry, "AMPLITUDE_IMAGE");
@@ -900,6 +943,14 @@ convert_config *init_fill_convert_config(char *configFile)
         if (strncmp(test, "use nearest neighbor", 20)==0)
           cfg->terrain_correct->use_nearest_neighbor =
             read_int(line, "use nearest neighbor");
+        if (strncmp(test, "dem cache directory", 19)==0)
+          strcpy(cfg->terrain_correct->dem_cache,
+                 read_str(line, "dem cache directory"));
+        if (strncmp(test, "dem cache size", 14)==0)
+          cfg->terrain_correct->dem_cache_size = read_int(line, "dem cache size");
+        if (strncmp(test, "terrcorr memory limit", 21)==0)
+          cfg->terrain_correct->memory_limit =
+            read_int(line, "terrcorr memory limit");
 
         // Geocoding
         if (strncmp(test, "projection", 10)==0)
@@ -969,6 +1020,15 @@ convert_config *init_fill_convert_config(char *configFile)
 	if (strncmp(test, "use nearest neighbor", 20) == 0)
 	  cfg->terrain_correct->use_nearest_neighbor = 
 	    read_int(line, "use nearest neighbor");
+	if (strncmp(test, "dem cache directory", 19) == 0)
+	  strcpy(cfg->terrain_correct->dem_cache,
+		 read_str(line, "dem cache directory"));
+	if (strncmp(test, "dem cache size", 14) == 0)
+	  cfg->terrain_correct->dem_cache_size =
+	    read_int(line, "dem cache size");
+	if (strncmp(test, "terrcorr memory limit", 21) == 0)
+	  cfg->terrain_correct->memory_limit =
+	    read_int(line, "terrcorr memory limit");
 	FREE(test);
       }
       if (strncmp(line, "[Geocoding]", 11) == 0)
@@ -1049,6 +1109,18 @@ convert_config *init_fill_convert_config(char *configFile)
             strcpy(cfg->general->status_file, read_str(line, "status file"));
         if (strncmp(test, "batch file", 10)==0)
             strcpy(cfg->general->batchFile, read_str(line, "batch file"));
+        if (strncmp(test, "batch jobs", 10)==0)
+            cfg->general->batch_jobs = read_int(line, "batch jobs");
+        if (strncmp(test, "batch memory", 12)==0)
+            cfg->general->batch_memory = read_int(line, "batch memory");
+        if (strncmp(test, "batch resume", 12)==0)
+            cfg->general->batch_resume = read_int(line, "batch resume");
+        if (strncmp(test, "memory map inputs", 17)==0)
+            cfg->general->mmap_inputs = read_int(line, "memory map inputs");
+        if (strncmp(test, "save geometry grids", 19)==0)
+            cfg->general->save_geo_grids = read_int(line, "save geometry grids");
+        if (strncmp(test, "save binary metadata", 20)==0)
+            cfg->general->meta_sidecars = read_int(line, "save binary metadata");
         if (strncmp(test, "prefix", 6)==0)
             strcpy(cfg->general->prefix, read_str(line, "prefix"));
         if (strncmp(test, "suffix", 6)==0)
@@ -1131,6 +1203,18 @@ convert_config *read_convert_config(char *configFile)
         strcpy(cfg->general->status_file, read_str(line, "status file"));
       if (strncmp(test, "batch file", 10)==0)
         strcpy(cfg->general->batchFile, read_str(line, "batch file"));
+      if (strncmp(test, "batch jobs", 10)==0)
+        cfg->general->batch_jobs = read_int(line, "batch jobs");
+      if (strncmp(test, "batch memory", 12)==0)
+        cfg->general->batch_memory = read_int(line, "batch memory");
+      if (strncmp(test, "batch resume", 12)==0)
+        cfg->general->batch_resume = read_int(line, "batch resume");
+      if (strncmp(test, "memory map inputs", 17)==0)
+        cfg->general->mmap_inputs = read_int(line, "memory map inputs");
+      if (strncmp(test, "save geometry grids", 19)==0)
+        cfg->general->save_geo_grids = read_int(line, "save geometry grids");
+      if (strncmp(test, "save binary metadata", 20)==0)
+        cfg->general->meta_sidecars = read_int(line, "save binary metadata");
       if (strncmp(test, "prefix", 6)==0)
         strcpy(cfg->general->prefix, read_str(line, "prefix"));
       if (strncmp(test, "suffix", 6)==0)
@@ -1369,6 +1453,14 @@ convert_config *read_convert_config(char *configFile)
       if (strncmp(test, "use nearest neighbor", 20)==0)
         cfg->terrain_correct->use_nearest_neighbor =
 	  read_int(line, "use nearest neighbor");
+      if (strncmp(test, "dem cache directory", 19)==0)
+        strcpy(cfg->terrain_correct->dem_cache,
+               read_str(line, "dem cache directory"));
+      if (strncmp(test, "dem cache size", 14)==0)
+        cfg->terrain_correct->dem_cache_size = read_int(line, "dem cache size");
+      if (strncmp(test, "terrcorr memory limit", 21)==0)
+        cfg->terrain_correct->memory_limit =
+          read_int(line, "terrcorr memory limit");
       FREE(test);
     }
 
@@ -2142,6 +2234,24 @@ int write_convert_config(char *configFile, convert_config *cfg)
                 "# is used.\n\n");
       fprintf(fConfig, "use nearest neighbor = %d\n",
               cfg->terrain_correct->use_nearest_neighbor);
+      if (!shortFlag)
+        fprintf(fConfig, "\n# When the digital elevation model is a directory of DEMs (or a file\n"
+                "# listing such directories), the DEM built for each data set is kept in\n"
+                "# this directory, so that other data sets covering the same area can use\n"
+                "# it instead of building their own.  Leave empty to not keep them.\n\n");
+      fprintf(fConfig, "dem cache directory = %s\n",
+              cfg->terrain_correct->dem_cache);
+      if (!shortFlag)
+        fprintf(fConfig, "\n# The least recently used DEMs are removed from the DEM cache\n"
+                "# directory when it grows past this many MB (0 for no limit)\n\n");
+      fprintf(fConfig, "dem cache size = %d\n",
+              cfg->terrain_correct->dem_cache_size);
+      if (!shortFlag)
+        fprintf(fConfig, "\n# Terrain correction keeps its intermediate images in memory instead\n"
+                "# of writing them out, up to this many MB (0 or -1 to write them out,\n"
+                "# the default).  Batch jobs run side by side split it.\n\n");
+      fprintf(fConfig, "terrcorr memory limit = %d\n",
+              cfg->terrain_correct->memory_limit);
 
     }
 
@@ -2289,6 +2399,38 @@ int write_convert_config(char *configFile, convert_config *cfg)
       fprintf(fConfig, "# asf_mapready has a batch mode to run a large number of data sets\n"
               "# through the processing flow with the same processing parameters\n\n");
     fprintf(fConfig, "batch file = %s\n\n", cfg->general->batchFile);
+    if (!shortFlag)
+      fprintf(fConfig, "# Number of data sets of the batch that are processed at the same time\n"
+              "# (0 for one per processor)\n\n");
+    fprintf(fConfig, "batch jobs = %d\n\n", cfg->general->batch_jobs);
+    if (!shortFlag)
+      fprintf(fConfig, "# Data sets are only processed at the same time while the sizes of their\n"
+              "# files add up to no more than this many MB (0 for no limit)\n\n");
+    fprintf(fConfig, "batch memory = %d\n\n", cfg->general->batch_memory);
+    if (!shortFlag)
+      fprintf(fConfig, "# Data sets that were processed successfully are listed in a file named\n"
+              "# after the batch file, with the extension .done added.  The batch resume\n"
+              "# flag skips the data sets listed there (1 for skipping them, 0 for\n"
+              "# processing the whole batch again)\n\n");
+    fprintf(fConfig, "batch resume = %d\n\n", cfg->general->batch_resume);
+    if (!shortFlag)
+      fprintf(fConfig, "# Image files can be read through memory maps instead of being read line by\n"
+              "# line (1 for memory maps, 0 for reading).  That is faster, but only safe\n"
+              "# when no other program writes to or truncates the input files while they\n"
+              "# are processed\n\n");
+    fprintf(fConfig, "memory map inputs = %d\n\n", cfg->general->mmap_inputs);
+    if (!shortFlag)
+      fprintf(fConfig, "# The incidence angles used by calibration and radiometric terrain\n"
+              "# correction are interpolated from a grid sampled over the image.  With\n"
+              "# this flag set (1), the grid is saved next to the image's metadata (as\n"
+              "# <image>.geogrid) and reused as long as the metadata doesn't change\n\n");
+    fprintf(fConfig, "save geometry grids = %d\n\n", cfg->general->save_geo_grids);
+    if (!shortFlag)
+      fprintf(fConfig, "# Every processing step reads the metadata of its input again.  With this\n"
+              "# flag set (1), the parsed metadata is also saved in binary form next to\n"
+              "# the .meta file (as <image>.metab), so that later steps and later runs\n"
+              "# can load it without parsing the .meta again\n\n");
+    fprintf(fConfig, "save binary metadata = %d\n\n", cfg->general->meta_sidecars);
     if (!shortFlag)
       fprintf(fConfig, "# A prefix can be added to the outfile name to avoid overwriting\n"
               "# files (e.g. when running the same data sets through the processing flow\n"
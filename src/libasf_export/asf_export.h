@@ -233,6 +233,38 @@ void write_datum_key (GTIF *ogtif, datum_type_t datum);
 void write_spheroid_key (GTIF *ogtif, spheroid_type_t spheroid, double re_major,
 			 double re_minor);
 
+// Prototypes from tiff_tiles.c
+typedef enum {
+  TIFF_STRIPS=0,                // One line per strip (the default)
+  TIFF_COG                      // Tiles and overviews, in COG layout
+} tiff_layout_t;
+typedef enum {
+  TIFF_DEFLATE=1,
+  TIFF_LZW,
+  TIFF_ZSTD,                    // Only if libtiff was built with it
+  TIFF_UNCOMPRESSED
+} tiff_compression_t;
+void set_tiff_export_layout(tiff_layout_t layout,
+                            tiff_compression_t compression);
+tiff_layout_t get_tiff_export_layout(void);
+tiff_compression_t get_tiff_export_compression(void);
+void set_tiff_export_thread_count(int thread_count);
+int get_tiff_export_thread_count(void);
+void tiff_tiles_begin(TIFF *otif);
+int tiff_tiles_write_line(TIFF *otif, void *buf, int line);
+void tiff_tiles_finish(TIFF *otif);
+
+// Prototypes from line_queue.c
+typedef struct export_line_queue export_line_queue;
+void set_export_thread_count(int thread_count);
+int get_export_thread_count(void);
+export_line_queue *export_line_queue_new(const char *data_file,
+                                         meta_parameters *md,
+                                         int band_count, const int *bands,
+                                         int as_byte);
+void export_line_queue_get(export_line_queue *q, int b, int line, void *dest);
+void export_line_queue_free(export_line_queue *q);
+
 // Prototypes from write_line.c
 void write_tiff_byte2byte(TIFF *otif, unsigned char *byte_line,
                           channel_stats_t stats, scale_t sample_mapping,
@@ -275,7 +275,8 @@ void initialize_tiff_file (TIFF **otif, GTIF **ogtif,
                    //((OPT_STRIP_BYTES / (sample_size * md->general->sample_count)) < 16) ? 8  :
                    //((OPT_STRIP_BYTES / (sample_size * md->general->sample_count)) < 32) ? 16 :
                      //                                             (unsigned short) USHORT_MAX;
-  TIFFSetField(*otif, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
+  if (get_tiff_export_layout() == TIFF_STRIPS)
+    TIFFSetField(*otif, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
 
   TIFFSetField(*otif, TIFFTAG_XRESOLUTION, 1.0);
   TIFFSetField(*otif, TIFFTAG_YRESOLUTION, 1.0);
@@ -298,6 +299,11 @@ void initialize_tiff_file (TIFF **otif, GTIF **ogtif,
     FREE(xml_meta);
   }
 
+  // Tiles and overviews are set up last, once all of the tags they
+  // copy (colormap, no data value) are in place.
+  if (get_tiff_export_layout() == TIFF_COG)
+    tiff_tiles_begin(*otif);
+
   *palette_color_tiff = palette_color;
 
   meta_free(md);
@@ -1298,6 +1304,7 @@ void finalize_tiff_file(TIFF *otif, GTIF *ogtif, int is_geotiff)
 
   // Finalize the TIFF file
   if (otif != NULL) {
+    tiff_tiles_finish (otif);
     XTIFFClose (otif);
   }
 }
@@ -1342,6 +1349,261 @@ int multiband(char *format, char **band_name, int band_count)
     return FALSE;
 }
 
+// Band of the image that band_name[kk] is exported from
+static int export_channel(meta_parameters *md, char **band_name, int kk)
+{
+  int channel;
+
+  if (md->general->image_data_type >  POLARIMETRIC_IMAGE &&
+      md->general->image_data_type <= POLARIMETRIC_T4_MATRIX)
+    channel = kk;
+  else {
+    if (md->general->band_count == 1)
+      channel = 0;
+    else
+      channel = get_band_number(md->general->bands, md->general->band_count,
+                                band_name[kk]);
+    asfRequire(channel >= 0 && channel <= MAX_BANDS,
+      "Band number out of range\n");
+  }
+
+  return channel;
+}
+
+// Can the byte scaling of this channel use the statistics stored in the
+// metadata?  A histogram is never stored, so histogram equalization can't.
+static int have_meta_stats(meta_parameters *md, int channel,
+                           scale_t sample_mapping)
+{
+  return md->stats                  &&
+    md->stats->band_count > channel &&
+    meta_is_valid_double(md->stats->band_stats[channel].mean) &&
+    meta_is_valid_double(md->stats->band_stats[channel].min) &&
+    meta_is_valid_double(md->stats->band_stats[channel].max) &&
+    meta_is_valid_double(md->stats->band_stats[channel].std_deviation) &&
+    sample_mapping != HISTOGRAM_EQUALIZE;
+}
+
+// One output file for a band of a multi-band image: opened and set up
+// by export_band_image(), then written out by write_band_file().
+typedef struct {
+  meta_parameters *md;
+  const char *image_data_file_name;
+  output_format_t format;
+  scale_t sample_mapping;
+  channel_stats_t stats;
+  char *lut_file;
+  int channel;
+  int is_colormap_band;
+  int as_byte;
+  int show_progress;        // Line meter (only when writing one at a time)
+  int is_geotiff;
+  TIFF *otif;
+  GTIF *ogtif;
+  FILE *ojpeg, *opgm, *opng, *ofp;
+  struct jpeg_compress_struct cinfo;
+  png_structp png_ptr;
+  png_infop png_info_ptr;
+} band_file;
+
+// Scales and encodes one band file, with the band read ahead of the
+// writer, and frees the band_file.  Band files share nothing but the
+// metadata, which is only read here, so several of them can be written
+// at once, each on its own thread.
+static void write_band_file(band_file *bf)
+{
+  meta_parameters *md = bf->md;
+  output_format_t format = bf->format;
+  scale_t sample_mapping = bf->sample_mapping;
+  channel_stats_t stats = bf->stats;
+  char *lut_file = bf->lut_file;
+  int is_colormap_band = bf->is_colormap_band;
+  int is_geotiff = bf->is_geotiff;
+  TIFF *otif = bf->otif;
+  GTIF *ogtif = bf->ogtif;
+  FILE *ojpeg = bf->ojpeg, *opgm = bf->opgm, *opng = bf->opng, *ofp = bf->ofp;
+  struct jpeg_compress_struct *cinfo = &bf->cinfo;
+  png_structp png_ptr = bf->png_ptr;
+  png_infop png_info_ptr = bf->png_info_ptr;
+  int sample_count = md->general->sample_count;
+  int ii;
+
+  export_line_queue *lq =
+    export_line_queue_new(bf->image_data_file_name, md, 1, &bf->channel,
+                          bf->as_byte);
+  float *float_line = (float *) MALLOC(sizeof(float) * sample_count);
+  unsigned char *byte_line = MALLOC(sizeof(unsigned char) * sample_count);
+
+  if (is_colormap_band)
+  { // Apply look up table
+    for (ii=0; ii<md->general->line_count; ii++ ) {
+      if ((md->optical || md->general->data_type == ASF_BYTE) &&
+          md->general->image_data_type != POLARIMETRIC_PARAMETER) {
+        export_line_queue_get(lq, 0, ii, byte_line);
+        if (format == TIF || format == GEOTIFF)
+          write_tiff_byte2lut(otif, byte_line, ii, sample_count,
+          lut_file);
+        else if (format == JPEG)
+          write_jpeg_byte2lut(ojpeg, byte_line, cinfo, sample_count,
+          lut_file);
+        else if (format == PNG || format == PNG_ALPHA || format == PNG_GE)
+          write_png_byte2lut(opng, byte_line, png_ptr, png_info_ptr,
+          sample_count, lut_file);
+        else
+          asfPrintError("Impossible: unexpected format %s\n", format2str(format));
+      }
+      else {
+        // Force a sample mapping of TRUNCATE for PolSARpro classifications
+        // (They contain low integer values stored in floats ...contrast
+        //  expansion will break the look up in the look up table.)
+        export_line_queue_get(lq, 0, ii, float_line);
+        if (format == TIF || format == GEOTIFF)
+          // Unlike the other graphics file formats, the TIFF file uses an embedded
+          // colormap (palette) and therefore each pixel should be a single byte value
+          // where each byte value is an index into the colormap.  The other graphics
+          // file formats use interlaced RGB lines and no index or colormap instead.
+          write_tiff_float2byte(otif, float_line, stats,
+          //is_colormap_band ? TRUNCATE : sample_mapping,
+          sample_mapping,
+          md->general->no_data, ii, sample_count);
+        else if (format == JPEG)
+          // Use lut to write an RGB line to the file
+          write_jpeg_float2lut(ojpeg, float_line, cinfo, stats,
+          //is_colormap_band ? TRUNCATE : sample_mapping,
+          sample_mapping,
+          md->general->no_data,
+          sample_count, lut_file);
+        else if (format == PNG || format == PNG_ALPHA || format == PNG_GE)
+          // Use lut to write an RGB line to the file
+          write_png_float2lut(opng, float_line, png_ptr, png_info_ptr,
+          stats,
+          //is_colormap_band ? TRUNCATE : sample_mapping,
+          sample_mapping,
+          md->general->no_data,
+          sample_count, lut_file);
+        else if (format == PGM) {
+          // Can't put color in a PGM file, so map it to greyscale and write that
+          write_pgm_float2byte(opgm, float_line, stats,
+            //is_colormap_band ? TRUNCATE : sample_mapping,
+            sample_mapping,
+            md->general->no_data, sample_count);
+        }
+        else
+          asfPrintError("Impossible: unexpected format %s\n", format2str(format));
+      }
+      if (bf->show_progress)
+        asfLineMeter(ii, md->general->line_count);
+    }
+  }
+  else {
+    // Regular old single band image (no look up table applied)
+    for (ii=0; ii<md->general->line_count; ii++ ) {
+      if (md->optical || md->general->data_type == ASF_BYTE) {
+        export_line_queue_get(lq, 0, ii, byte_line);
+        if (format == TIF || format == GEOTIFF)
+          write_tiff_byte2byte(otif, byte_line, stats, sample_mapping,
+          sample_count, ii);
+        else if (format == JPEG)
+          write_jpeg_byte2byte(ojpeg, byte_line, stats, sample_mapping,
+          cinfo, sample_count);
+        else if (format == PNG)
+          write_png_byte2byte(opng, byte_line, stats, sample_mapping,
+          png_ptr, png_info_ptr, sample_count);
+        else if (format == PNG_ALPHA) {
+          asfPrintError("PNG_ALPHA not supported.\n");
+        }
+        else if (format == PNG_GE)
+          write_png_byte2rgbalpha(opng, byte_line, stats, sample_mapping,
+                                  png_ptr, png_info_ptr, sample_count);
+        else if (format == PGM)
+          write_pgm_byte2byte(opgm, byte_line, stats, sample_mapping,
+          sample_count);
+        else
+          asfPrintError("Impossible: unexpected format %s\n", format2str(format));
+      }
+      else if (sample_mapping == NONE && !is_colormap_band) {
+        export_line_queue_get(lq, 0, ii, float_line);
+        if (format == GEOTIFF || format == TIF) {
+          if (md->general->data_type == REAL32)
+            write_tiff_float2float(otif, float_line, ii);
+          else if (md->general->data_type == INTEGER16)
+            write_tiff_float2int(otif, float_line, ii,
+                                 md->general->sample_count);
+        }
+        else if (format == POLSARPRO_HDR) {
+          int sample;
+          for (sample=0; sample<sample_count; sample++)
+            ieee_lil32(float_line[sample]);
+          fwrite(float_line,4,sample_count,ofp);
+        }
+        else
+          asfPrintError("Impossible: unexpected format %s\n", format2str(format));
+      }
+      else {
+        export_line_queue_get(lq, 0, ii, float_line);
+        if (format == TIF || format == GEOTIFF)
+          write_tiff_float2byte(otif, float_line, stats,
+          //is_colormap_band ? TRUNCATE : sample_mapping,
+          sample_mapping,
+          md->general->no_data, ii, sample_count);
+        else if (format == JPEG)
+          write_jpeg_float2byte(ojpeg, float_line, cinfo, stats,
+          //is_colormap_band ? TRUNCATE : sample_mapping,
+          sample_mapping,
+          md->general->no_data,
+          sample_count);
+        else if (format == PNG || format == PNG_ALPHA || format == PNG_GE)
+          write_png_float2byte(opng, float_line, png_ptr, png_info_ptr,
+          stats,
+          //is_colormap_band ? TRUNCATE : sample_mapping,
+          sample_mapping,
+          md->general->no_data,
+          sample_count);
+        else if (format == PGM)
+          write_pgm_float2byte(opgm, float_line, stats,
+          //is_colormap_band ? TRUNCATE : sample_mapping,
+          sample_mapping,
+          md->general->no_data, sample_count);
+        else if (format == POLSARPRO_HDR) {
+          int sample;
+          for (sample=0; sample<sample_count; sample++)
+            ieee_lil32(float_line[sample]);
+          fwrite(float_line,4,sample_count,ofp);
+        }
+        else
+          asfPrintError("Impossible: unexpected format %s\n", format2str(format));
+      }
+      if (bf->show_progress)
+        asfLineMeter(ii, md->general->line_count);
+    } // End for each line
+  } // End if multi or single band
+  // Free memory
+  FREE(float_line);
+  FREE(byte_line);
+  if (stats.hist) gsl_histogram_free(stats.hist);
+  if (stats.hist_pdf) gsl_histogram_pdf_free(stats.hist_pdf);
+
+  // Finalize the chosen format
+  if (format == TIF || format == GEOTIFF)
+    finalize_tiff_file(otif, ogtif, is_geotiff);
+  else if (format == JPEG)
+    finalize_jpeg_file(ojpeg, cinfo);
+  else if (format == PNG || format == PNG_ALPHA || format == PNG_GE)
+    finalize_png_file(opng, png_ptr, png_info_ptr);
+  else if (format == PGM)
+    finalize_ppm_file(opgm);
+  else if (format == POLSARPRO_HDR)
+    FCLOSE(ofp);
+
+  export_line_queue_free(lq);
+  FREE(bf);
+}
+
+static void band_file_worker(gpointer data, gpointer user_data)
+{
+  write_band_file((band_file *) data);
+}
+
 void
 export_band_image (const char *metadata_file_name,
                    const char *image_data_file_name,
@@ -1504,174 +1766,74 @@ export_band_image (const char *metadata_file_name,
                   "different than expected.\n");
 
         /*** Normal straight per-channel stats (no combined-band stats) */
-
-        // Red channel statistics
-        if (!ignored[red_channel]                           &&  // Non-blank band
-            sample_mapping != NONE                          &&  // Float-to-byte resampling needed
-            sample_mapping != HISTOGRAM_EQUALIZE            &&  // A histogram is not needed
-            md->stats      != NULL                          &&  // Stats exist and are valid
-            md->stats       > 0                             &&
-            meta_is_valid_string(band_name[0])              &&  // Band name exists and is valid
-            strlen(band_name[0]) > 0)
-        {
-          // If the stats already exist, then use them
-          int band_no = get_band_number(md->general->bands,
-                                        md->general->band_count,
-                                        band_name[0]);
-          red_stats.min  = md->stats->band_stats[band_no].min;
-          red_stats.max  = md->stats->band_stats[band_no].max;
-          red_stats.mean = md->stats->band_stats[band_no].mean;
-          red_stats.standard_deviation = md->stats->band_stats[band_no].std_deviation;
-          red_stats.hist     = NULL;
-          red_stats.hist_pdf = NULL;
-          if (sample_mapping == SIGMA) {
-            double omin = red_stats.mean - 2*red_stats.standard_deviation;
-            double omax = red_stats.mean + 2*red_stats.standard_deviation;
-            if (omin > red_stats.min) red_stats.min = omin;
-            if (omax < red_stats.max) red_stats.max = omax;
-          }
-	  else if (sample_mapping == MINMAX_MEDIAN)
-	    calc_minmax_median(image_data_file_name, band_name[0], 
-			       md->general->no_data, 
-			       &red_stats.min, &red_stats.max);
-        }
-        else {
-          // Calculate the stats if you have to...
-          if (sample_mapping != NONE && !ignored[red_channel]) { // byte image
-            asfPrintStatus("\nGathering red channel statistics ...\n");
-            calc_stats_from_file(image_data_file_name, band_name[0],
-                                md->general->no_data,
-                                &red_stats.min, &red_stats.max, &red_stats.mean,
-                                &red_stats.standard_deviation, &red_stats.hist);
-            if (sample_mapping == SIGMA) {
-              double omin = red_stats.mean - 2*red_stats.standard_deviation;
-              double omax = red_stats.mean + 2*red_stats.standard_deviation;
-              if (omin > red_stats.min) red_stats.min = omin;
-              if (omax < red_stats.max) red_stats.max = omax;
-            }
-            else if ( sample_mapping == HISTOGRAM_EQUALIZE ) {
-              red_stats.hist_pdf = gsl_histogram_pdf_alloc (256);
-              gsl_histogram_pdf_init (red_stats.hist_pdf, red_stats.hist);
-            }
-	    else if (sample_mapping == MINMAX_MEDIAN)
-	      calc_minmax_median(image_data_file_name, band_name[0], 
-				 md->general->no_data, 
-				 &red_stats.min, &red_stats.max);
+        channel_stats_t *rgb_stats[3] = { &red_stats, &green_stats, &blue_stats };
+        int rgb_channel[3] = { red_channel, green_channel, blue_channel };
+        const char *rgb_color[3] = { "red", "green", "blue" };
+        channel_stats_t gathered[3];
+        char *gather_band[3];
+        int use_meta[3];
+        int gather = FALSE;
+
+        for (ii=0; ii<3; ii++) {
+          use_meta[ii] =
+            !ignored[rgb_channel[ii]]               &&  // Non-blank band
+            sample_mapping != NONE                  &&  // Float-to-byte resampling needed
+            sample_mapping != HISTOGRAM_EQUALIZE    &&  // A histogram is not needed
+            md->stats      != NULL                  &&  // Stats exist and are valid
+            meta_is_valid_string(band_name[ii])     &&  // Band name exists and is valid
+            strlen(band_name[ii]) > 0;
+          gather_band[ii] = NULL;
+          if (!use_meta[ii] && sample_mapping != NONE &&
+              !ignored[rgb_channel[ii]]) { // byte image
+            asfPrintStatus("\nGathering %s channel statistics ...\n",
+                           rgb_color[ii]);
+            gather_band[ii] = band_name[ii];
+            gather = TRUE;
           }
         }
 
-        // Green channel statistics
-        if (!ignored[green_channel]                          &&  // Non-blank band
-             sample_mapping != NONE                          &&  // Float-to-byte resampling needed
-             sample_mapping != HISTOGRAM_EQUALIZE            &&  // A histogram is not needed
-             md->stats      != NULL                          &&  // Stats exist and are valid
-             md->stats       > 0                             &&
-             meta_is_valid_string(band_name[1])              &&  // Band name exists and is valid
-             strlen(band_name[1]) > 0)
-        {
-          // If the stats already exist, then use them
-          int band_no = get_band_number(md->general->bands,
-                                        md->general->band_count,
-                                        band_name[1]);
-          green_stats.min  = md->stats->band_stats[band_no].min;
-          green_stats.max  = md->stats->band_stats[band_no].max;
-          green_stats.mean = md->stats->band_stats[band_no].mean;
-          green_stats.standard_deviation = md->stats->band_stats[band_no].std_deviation;
-          green_stats.hist     = NULL;
-          green_stats.hist_pdf = NULL;
-          if (sample_mapping == SIGMA) {
-            double omin = green_stats.mean - 2*green_stats.standard_deviation;
-            double omax = green_stats.mean + 2*green_stats.standard_deviation;
-            if (omin > green_stats.min) green_stats.min = omin;
-            if (omax < green_stats.max) green_stats.max = omax;
+        // Calculate the stats if you have to... all channels at once,
+        // each on its own thread
+        if (gather)
+          calc_band_stats_from_file(image_data_file_name, 3, gather_band,
+                                    md->general->no_data,
+                                    sample_mapping == HISTOGRAM_EQUALIZE,
+                                    gathered);
+
+        for (ii=0; ii<3; ii++) {
+          channel_stats_t *cs = rgb_stats[ii];
+          if (use_meta[ii]) {
+            // If the stats already exist, then use them
+            int band_no = get_band_number(md->general->bands,
+                                          md->general->band_count,
+                                          band_name[ii]);
+            cs->min  = md->stats->band_stats[band_no].min;
+            cs->max  = md->stats->band_stats[band_no].max;
+            cs->mean = md->stats->band_stats[band_no].mean;
+            cs->standard_deviation = md->stats->band_stats[band_no].std_deviation;
+            cs->hist     = NULL;
+            cs->hist_pdf = NULL;
           }
-	  else if (sample_mapping == MINMAX_MEDIAN)
-	    calc_minmax_median(image_data_file_name, band_name[1], 
-			       md->general->no_data, 
-			       &green_stats.min, &green_stats.max);
-        }
-        else {
-          // Calculate the stats if you have to...
-          if (sample_mapping != NONE && !ignored[green_channel]) { // byte image
-            asfPrintStatus("\nGathering green channel statistics ...\n");
-            calc_stats_from_file(image_data_file_name, band_name[1],
-                                md->general->no_data,
-                                &green_stats.min, &green_stats.max,
-                                &green_stats.mean,
-                                &green_stats.standard_deviation,
-                                &green_stats.hist);
-            if (sample_mapping == SIGMA) {
-              double omin = green_stats.mean - 2*green_stats.standard_deviation;
-              double omax = green_stats.mean + 2*green_stats.standard_deviation;
-              if (omin > green_stats.min) green_stats.min = omin;
-              if (omax < green_stats.max) green_stats.max = omax;
+          else if (gather_band[ii]) {
+            *cs = gathered[ii];
+            if (sample_mapping == HISTOGRAM_EQUALIZE) {
+              cs->hist_pdf = gsl_histogram_pdf_alloc (256);
+              gsl_histogram_pdf_init (cs->hist_pdf, cs->hist);
             }
-            else if ( sample_mapping == HISTOGRAM_EQUALIZE ) {
-              green_stats.hist_pdf = gsl_histogram_pdf_alloc(256);
-              gsl_histogram_pdf_init (green_stats.hist_pdf, green_stats.hist);
-            }
-	    else if (sample_mapping == MINMAX_MEDIAN)
-	      calc_minmax_median(image_data_file_name, band_name[1], 
-				 md->general->no_data, 
-				 &green_stats.min, &green_stats.max);
           }
-        }
+          else
+            continue;
 
-        // Blue channel statistics
-        if (!ignored[blue_channel]                          &&  // Non-blank band
-             sample_mapping != NONE                         &&  // Float-to-byte resampling needed
-             sample_mapping != HISTOGRAM_EQUALIZE           &&  // A histogram is not needed
-             md->stats      != NULL                         &&  // Stats exist and are valid
-             md->stats       > 0                            &&
-             meta_is_valid_string(band_name[2])             &&  // Band name exists and is valid
-             strlen(band_name[2]) > 0)
-        {
-          // If the stats already exist, then use them
-          int band_no = get_band_number(md->general->bands,
-                                        md->general->band_count,
-                                        band_name[2]);
-          blue_stats.min  = md->stats->band_stats[band_no].min;
-          blue_stats.max  = md->stats->band_stats[band_no].max;
-          blue_stats.mean = md->stats->band_stats[band_no].mean;
-          blue_stats.standard_deviation = md->stats->band_stats[band_no].std_deviation;
-          blue_stats.hist     = NULL;
-          blue_stats.hist_pdf = NULL;
           if (sample_mapping == SIGMA) {
-            double omin = blue_stats.mean - 2*blue_stats.standard_deviation;
-            double omax = blue_stats.mean + 2*blue_stats.standard_deviation;
-            if (omin > blue_stats.min) blue_stats.min = omin;
-            if (omax < blue_stats.max) blue_stats.max = omax;
-          }
-	  else if (sample_mapping == MINMAX_MEDIAN)
-	    calc_minmax_median(image_data_file_name, band_name[2], 
-			       md->general->no_data, 
-			       &blue_stats.min, &blue_stats.max);
-        }
-        else {
-          // Calculate the stats if you have to...
-          if (sample_mapping != NONE && !ignored[blue_channel]) { // byte image
-            asfPrintStatus("\nGathering blue channel statistics ...\n");
-            calc_stats_from_file(image_data_file_name, band_name[2],
-                                md->general->no_data,
-                                &blue_stats.min, &blue_stats.max,
-                                &blue_stats.mean,
-                                &blue_stats.standard_deviation,
-                                &blue_stats.hist);
-            if (sample_mapping == SIGMA) {
-              double omin = blue_stats.mean - 2*blue_stats.standard_deviation;
-              double omax = blue_stats.mean + 2*blue_stats.standard_deviation;
-              if (omin > blue_stats.min) blue_stats.min = omin;
-              if (omax < blue_stats.max) blue_stats.max = omax;
-            }
-            else if ( sample_mapping == HISTOGRAM_EQUALIZE ) {
-              blue_stats.hist_pdf = gsl_histogram_pdf_alloc (256);
-              gsl_histogram_pdf_init (blue_stats.hist_pdf, blue_stats.hist);
-            }
-	    else if (sample_mapping == MINMAX_MEDIAN)
-	      calc_minmax_median(image_data_file_name, band_name[2], 
-				 md->general->no_data, 
-				 &blue_stats.min, &blue_stats.max);
+            double omin = cs->mean - 2*cs->standard_deviation;
+            double omax = cs->mean + 2*cs->standard_deviation;
+            if (omin > cs->min) cs->min = omin;
+            if (omax < cs->max) cs->max = omax;
           }
+          else if (sample_mapping == MINMAX_MEDIAN)
+            calc_minmax_median(image_data_file_name, band_name[ii],
+                               md->general->no_data,
+                               &cs->min, &cs->max);
         }
     }
 
@@ -1683,11 +1845,7 @@ export_band_image (const char *metadata_file_name,
     unsigned char *green_byte_line = NULL;
     unsigned char *blue_byte_line = NULL;
 
-    // Write the data to the file
-    FILE *fp = FOPEN(image_data_file_name, "rb");
-
     int sample_count = md->general->sample_count;
-    int offset = md->general->line_count;
 
     // Allocate some memory
     if (md->optical || md->general->data_type == ASF_BYTE) {
@@ -1755,108 +1913,85 @@ export_band_image (const char *metadata_file_name,
       asfPrintStatus("\nSampling color channels for 2-sigma contrast-expanded %s output...\n",
                      true_color ? "True Color" : false_color ? "False Color" : "Unknown");
 
-      // Set up red resampling
-      if (md->stats                                     &&
-          md->stats->band_count >= 3                    &&
-          meta_is_valid_string(band_name[0])            &&
-          strlen(band_name[0]) > 0                      &&
-          sample_mapping != HISTOGRAM_EQUALIZE)
-      {
+      // Set up the resampling of each channel.  Stats that aren't in the
+      // metadata are gathered for all channels at once.
+      channel_stats_t *rgb_stats[3] = { &red_stats, &green_stats, &blue_stats };
+      double *rgb_omin[3] = { &r_omin, &g_omin, &b_omin };
+      double *rgb_omax[3] = { &r_omax, &g_omax, &b_omax };
+      const char *rgb_color[3] = { "red", "green", "blue" };
+      channel_stats_t gathered[3];
+      char *gather_band[3];
+      int gather = FALSE;
+
+      for (ii=0; ii<3; ii++) {
+        channel_stats_t *cs = rgb_stats[ii];
+        gather_band[ii] = NULL;
+        if (md->stats                                     &&
+            md->stats->band_count >= 3                    &&
+            meta_is_valid_string(band_name[ii])           &&
+            strlen(band_name[ii]) > 0                     &&
+            sample_mapping != HISTOGRAM_EQUALIZE)
+        {
           // If the stats already exist, then use them
-        int band_no = get_band_number(md->general->bands,
-                                      md->general->band_count,
-                                      band_name[0]);
-        red_stats.min  = md->stats->band_stats[band_no].min;
-        red_stats.max  = md->stats->band_stats[band_no].max;
-        red_stats.mean = md->stats->band_stats[band_no].mean;
-        red_stats.standard_deviation = md->stats->band_stats[band_no].std_deviation;
-        red_stats.hist     = NULL;
-        red_stats.hist_pdf = NULL;
-      }
-      else {
-        asfPrintStatus("\nGathering red channel statistics...\n");
-        calc_stats_from_file(image_data_file_name, band_name[0],
-                             md->general->no_data,
-                             &red_stats.min, &red_stats.max, &red_stats.mean,
-                             &red_stats.standard_deviation, &red_stats.hist);
-      }
-      r_omin = red_stats.mean - 2*red_stats.standard_deviation;
-      r_omax = red_stats.mean + 2*red_stats.standard_deviation;
-      if (r_omin < red_stats.min) r_omin = red_stats.min;
-      if (r_omax > red_stats.max) r_omax = red_stats.max;
-
-      // Set up green resampling
-      if (md->stats                                       &&
-          md->stats->band_count >= 3                      &&
-          meta_is_valid_string(band_name[1])              &&
-          strlen(band_name[1]) > 0                        &&
-          sample_mapping != HISTOGRAM_EQUALIZE)
-      {
-        // If the stats already exist, then use them
-        int band_no = get_band_number(md->general->bands,
-                                      md->general->band_count,
-                                      band_name[1]);
-        green_stats.min  = md->stats->band_stats[band_no].min;
-        green_stats.max  = md->stats->band_stats[band_no].max;
-        green_stats.mean = md->stats->band_stats[band_no].mean;
-        green_stats.standard_deviation = md->stats->band_stats[band_no].std_deviation;
-        green_stats.hist     = NULL;
-        green_stats.hist_pdf = NULL;
-      }
-      else {
-        asfPrintStatus("\nGathering green channel statistics...\n");
-        calc_stats_from_file(image_data_file_name, band_name[1],
-                              md->general->no_data,
-                              &green_stats.min, &green_stats.max, &green_stats.mean,
-                              &green_stats.standard_deviation, &green_stats.hist);
-      }
-      g_omin = green_stats.mean - 2*green_stats.standard_deviation;
-      g_omax = green_stats.mean + 2*green_stats.standard_deviation;
-      if (g_omin < green_stats.min) g_omin = green_stats.min;
-      if (g_omax > green_stats.max) g_omax = green_stats.max;
-
-      // Set up blue resampling
-      if (md->stats                                      &&
-          md->stats->band_count >= 3                     &&
-          meta_is_valid_string(band_name[2])             &&
-          strlen(band_name[2]) > 0                       &&
-          sample_mapping != HISTOGRAM_EQUALIZE)
-      {
-        // If the stats already exist, then use them
-        int band_no = get_band_number(md->general->bands,
-                                      md->general->band_count,
-                                      band_name[2]);
-        blue_stats.min  = md->stats->band_stats[band_no].min;
-        blue_stats.max  = md->stats->band_stats[band_no].max;
-        blue_stats.mean = md->stats->band_stats[band_no].mean;
-        blue_stats.standard_deviation = md->stats->band_stats[band_no].std_deviation;
-        blue_stats.hist     = NULL;
-        blue_stats.hist_pdf = NULL;
+          int band_no = get_band_number(md->general->bands,
+                                        md->general->band_count,
+                                        band_name[ii]);
+          cs->min  = md->stats->band_stats[band_no].min;
+          cs->max  = md->stats->band_stats[band_no].max;
+          cs->mean = md->stats->band_stats[band_no].mean;
+          cs->standard_deviation = md->stats->band_stats[band_no].std_deviation;
+          cs->hist     = NULL;
+          cs->hist_pdf = NULL;
+        }
+        else {
+          asfPrintStatus("\nGathering %s channel statistics...\n",
+                         rgb_color[ii]);
+          gather_band[ii] = band_name[ii];
+          gather = TRUE;
+        }
       }
-      else {
-        asfPrintStatus("\nGathering blue channel statistics...\n\n");
-        calc_stats_from_file(image_data_file_name, band_name[2],
-                             md->general->no_data,
-                             &blue_stats.min, &blue_stats.max, &blue_stats.mean,
-                             &blue_stats.standard_deviation, &blue_stats.hist);
+      if (gather)
+        calc_band_stats_from_file(image_data_file_name, 3, gather_band,
+                                  md->general->no_data, FALSE, gathered);
+
+      for (ii=0; ii<3; ii++) {
+        channel_stats_t *cs = rgb_stats[ii];
+        if (gather_band[ii])
+          *cs = gathered[ii];
+        *rgb_omin[ii] = cs->mean - 2*cs->standard_deviation;
+        *rgb_omax[ii] = cs->mean + 2*cs->standard_deviation;
+        if (*rgb_omin[ii] < cs->min) *rgb_omin[ii] = cs->min;
+        if (*rgb_omax[ii] > cs->max) *rgb_omax[ii] = cs->max;
       }
-      b_omin = blue_stats.mean - 2*blue_stats.standard_deviation;
-      b_omax = blue_stats.mean + 2*blue_stats.standard_deviation;
-      if (b_omin < blue_stats.min) b_omin = blue_stats.min;
-      if (b_omax > blue_stats.max) b_omax = blue_stats.max;
 
       asfPrintStatus("Applying 2-sigma contrast expansion to color bands...\n\n");
     }
 
+    // Write the data to the file.  The channels are read ahead of the
+    // writer, each on its own thread.
+    int channels[3] = { red_channel, green_channel, blue_channel };
+    int queue_band[3] = { -1, -1, -1 };
+    int read_channel[3];
+    int read_count = 0;
+    for (jj=0; jj<3; jj++) {
+      if (!ignored[channels[jj]]) {
+        queue_band[jj] = read_count;
+        read_channel[read_count++] = channels[jj];
+      }
+    }
+    export_line_queue *lq =
+      export_line_queue_new(image_data_file_name, md, read_count, read_channel,
+                            md->optical || md->general->data_type == ASF_BYTE);
+
     for (ii=0; ii<md->general->line_count; ii++) {
       if (md->optical || md->general->data_type == ASF_BYTE) {
         // Optical images come as byte in the first place
         if (!ignored[red_channel])
-          get_byte_line(fp, md, ii+red_channel*offset, red_byte_line);
+          export_line_queue_get(lq, queue_band[0], ii, red_byte_line);
         if (!ignored[green_channel])
-          get_byte_line(fp, md, ii+green_channel*offset, green_byte_line);
+          export_line_queue_get(lq, queue_band[1], ii, green_byte_line);
         if (!ignored[blue_channel])
-          get_byte_line(fp, md, ii+blue_channel*offset, blue_byte_line);
+          export_line_queue_get(lq, queue_band[2], ii, blue_byte_line);
         // If true or false color flag was set, then (re)sample with 2-sigma
         // contrast expansion
         if (true_color || false_color) {
@@ -1891,11 +2026,11 @@ export_band_image (const char *metadata_file_name,
       else if (sample_mapping == NONE) {
         // Write float->float lines if float image
         if (!ignored[red_channel])
-          get_float_line(fp, md, ii+red_channel*offset, red_float_line);
+          export_line_queue_get(lq, queue_band[0], ii, red_float_line);
         if (!ignored[green_channel])
-          get_float_line(fp, md, ii+green_channel*offset, green_float_line);
+          export_line_queue_get(lq, queue_band[1], ii, green_float_line);
         if (!ignored[blue_channel])
-          get_float_line(fp, md, ii+blue_channel*offset, blue_float_line);
+          export_line_queue_get(lq, queue_band[2], ii, blue_float_line);
         if (format == GEOTIFF || format == TIF)
           write_rgb_tiff_float2float(otif, red_float_line, green_float_line,
                                      blue_float_line, ii, sample_count);
@@ -1905,11 +2040,11 @@ export_band_image (const char *metadata_file_name,
       else {
         // Write float->byte lines if byte image
         if (!ignored[red_channel])
-          get_float_line(fp, md, ii+red_channel*offset, red_float_line);
+          export_line_queue_get(lq, queue_band[0], ii, red_float_line);
         if (!ignored[green_channel])
-          get_float_line(fp, md, ii+green_channel*offset, green_float_line);
+          export_line_queue_get(lq, queue_band[1], ii, green_float_line);
         if (!ignored[blue_channel])
-          get_float_line(fp, md, ii+blue_channel*offset, blue_float_line);
+          export_line_queue_get(lq, queue_band[2], ii, blue_float_line);
         if (format == TIF || format == GEOTIFF)
           write_rgb_tiff_float2byte(otif, red_float_line, green_float_line,
                                     blue_float_line, red_stats, green_stats,
@@ -1958,7 +2093,7 @@ export_band_image (const char *metadata_file_name,
     if (blue_stats.hist) gsl_histogram_free(blue_stats.hist);
     if (blue_stats.hist_pdf) gsl_histogram_pdf_free(blue_stats.hist_pdf);
 
-    FCLOSE(fp);
+    export_line_queue_free(lq);
 
     // set the output filename
     *noutputs = 1;
@@ -2125,6 +2260,46 @@ export_band_image (const char *metadata_file_name,
     int kk;
     int is_colormap_band;
 
+    // If the bands are each scaled to byte with their own statistics,
+    // gather the ones that aren't in the metadata up front, several
+    // bands at once.  Bands that get a look up table or are skipped
+    // below don't need any, so leave out anything that might.
+    channel_stats_t *gathered = NULL;
+    char **gather_band = NULL;
+    if (band_count > 1 && !have_look_up_table && !md->colormap &&
+        format != POLSARPRO_HDR &&
+        sample_mapping != NONE && sample_mapping != TRUNCATE) {
+      int gather_count = 0;
+      gather_band = (char **) CALLOC(band_count, sizeof(char *));
+      for (kk=0; kk<band_count; kk++) {
+        if (band_name[kk] && strcmp_case(band_name[kk], "AMP") != 0 &&
+            !have_meta_stats(md, export_channel(md, band_name, kk),
+                             sample_mapping)) {
+          gather_band[kk] = band_name[kk];
+          gather_count++;
+        }
+      }
+      if (gather_count > 1) {
+        asfPrintStatus("\nGathering statistics for %d bands ...\n",
+                       gather_count);
+        gathered = (channel_stats_t *)
+          MALLOC(sizeof(channel_stats_t) * band_count);
+        calc_band_stats_from_file(image_data_file_name, band_count,
+                                  gather_band, md->general->no_data,
+                                  sample_mapping == HISTOGRAM_EQUALIZE,
+                                  gathered);
+      }
+    }
+
+    // Separate band files are scaled and encoded in parallel, as many at
+    // a time as there are export threads (-threads).  The files are still
+    // opened, and their statistics gathered, one band after the other
+    // here.
+    GThreadPool *band_pool = NULL;
+    if (band_count > 1 && get_export_thread_count() > 1)
+      band_pool = g_thread_pool_new(band_file_worker, NULL,
+                                    get_export_thread_count(), TRUE, NULL);
+
     for (kk=0; kk<band_count; kk++) {
       if (band_name[kk]) {
         is_colormap_band = FALSE;
@@ -2416,6 +2591,8 @@ export_band_image (const char *metadata_file_name,
         if (strcmp(band_name[0], MAGIC_UNSET_STRING) != 0)
           asfPrintStatus("\nWriting band '%s' ...\n", band_name[kk]);
 
+        band_file *bf = (band_file *) CALLOC(1, sizeof(band_file));
+
         if (format == TIF || format == GEOTIFF) {
           is_geotiff = (format == GEOTIFF) ? 1 : 0;
           append_ext_if_needed (out_file, ".tif", ".tiff");
@@ -2440,11 +2617,11 @@ export_band_image (const char *metadata_file_name,
           append_ext_if_needed (out_file, ".jpg", ".jpeg");
           if (is_colormap_band) {
             initialize_jpeg_file(out_file, md,
-              &ojpeg, &cinfo, TRUE);
+              &ojpeg, &bf->cinfo, TRUE);
           }
           else {
             initialize_jpeg_file(out_file, md,
-              &ojpeg, &cinfo, rgb);
+              &ojpeg, &bf->cinfo, rgb);
           }
         }
         else if (format == PNG) {
@@ -2484,21 +2661,7 @@ export_band_image (const char *metadata_file_name,
         *noutputs += 1;
 
         // Determine which channel to read
-        int channel;
-        if (md->general->image_data_type >  POLARIMETRIC_IMAGE &&
-	    md->general->image_data_type <= POLARIMETRIC_T4_MATRIX)
-          channel = kk;
-        else {
-          if (md->general->band_count == 1)
-            channel = 0;
-          else
-            channel = get_band_number(md->general->bands, band_count, band_name[kk]);
-          asfRequire(channel >= 0 && channel <= MAX_BANDS,
-            "Band number out of range\n");
-        }
-
-        int sample_count = md->general->sample_count;
-        int offset = md->general->line_count;
+        int channel = export_channel(md, band_name, kk);
 
         // Get the statistics if necessary
         channel_stats_t stats;
@@ -2509,13 +2672,7 @@ export_band_image (const char *metadata_file_name,
           asfRequire (sizeof(unsigned char) == 1,
             "Size of the unsigned char data type on this machine is "
             "different than expected.\n");
-          if (md->stats                  &&
-            md->stats->band_count > 0  &&
-            meta_is_valid_double(md->stats->band_stats[channel].mean) &&
-            meta_is_valid_double(md->stats->band_stats[channel].min) &&
-            meta_is_valid_double(md->stats->band_stats[channel].max) &&
-            meta_is_valid_double(md->stats->band_stats[channel].std_deviation) &&
-            sample_mapping != HISTOGRAM_EQUALIZE)
+          if (have_meta_stats(md, channel, sample_mapping))
           {
             asfPrintStatus("Using metadata statistics - skipping stats computations.\n");
             stats.min  = md->stats->band_stats[channel].min;
@@ -2524,12 +2681,16 @@ export_band_image (const char *metadata_file_name,
             stats.standard_deviation = md->stats->band_stats[channel].std_deviation;
             stats.hist = NULL;
           }
+          else if (gathered && gather_band[kk]) {
+            // Gathered along with the other bands, before the loop
+            stats = gathered[kk];
+            gather_band[kk] = NULL;
+          }
           else {
             asfPrintStatus("Gathering statistics ...\n");
-            calc_stats_from_file(image_data_file_name, band_name[kk],
-              md->general->no_data,
-              &stats.min, &stats.max, &stats.mean,
-              &stats.standard_deviation, &stats.hist);
+            calc_band_stats_from_file(image_data_file_name, 1, &band_name[kk],
+              md->general->no_data, sample_mapping == HISTOGRAM_EQUALIZE,
+              &stats);
           }
           if (sample_mapping == TRUNCATE && !have_look_up_table) {
             if (stats.mean >= 255)
@@ -2556,175 +2717,53 @@ export_band_image (const char *metadata_file_name,
           }
         }
 
-        // Write the output image
-        FILE *fp = FOPEN(image_data_file_name, "rb");
-        float *float_line = (float *) MALLOC(sizeof(float) * sample_count);
-        unsigned char *byte_line = MALLOC(sizeof(unsigned char) * sample_count);
-
-        asfPrintStatus("Writing output file...\n");
-        if (is_colormap_band)
-        { // Apply look up table
-          for (ii=0; ii<md->general->line_count; ii++ ) {
-            if ((md->optical || md->general->data_type == ASF_BYTE) &&
-		md->general->image_data_type != POLARIMETRIC_PARAMETER) {
-              get_byte_line(fp, md, ii+channel*offset, byte_line);
-              if (format == TIF || format == GEOTIFF)
-                write_tiff_byte2lut(otif, byte_line, ii, sample_count,
-                lut_file);
-              else if (format == JPEG)
-                write_jpeg_byte2lut(ojpeg, byte_line, &cinfo, sample_count,
-                lut_file);
-              else if (format == PNG || format == PNG_ALPHA || format == PNG_GE)
-                write_png_byte2lut(opng, byte_line, png_ptr, png_info_ptr,
-                sample_count, lut_file);
-              else
-                asfPrintError("Impossible: unexpected format %s\n", format2str(format));
-            }
-            else {
-              // Force a sample mapping of TRUNCATE for PolSARpro classifications
-              // (They contain low integer values stored in floats ...contrast
-              //  expansion will break the look up in the look up table.)
-              get_float_line(fp, md, ii+channel*offset, float_line);
-              if (format == TIF || format == GEOTIFF)
-                // Unlike the other graphics file formats, the TIFF file uses an embedded
-                // colormap (palette) and therefore each pixel should be a single byte value
-                // where each byte value is an index into the colormap.  The other graphics
-                // file formats use interlaced RGB lines and no index or colormap instead.
-                write_tiff_float2byte(otif, float_line, stats,
-                //is_colormap_band ? TRUNCATE : sample_mapping,
-                sample_mapping,
-                md->general->no_data, ii, sample_count);
-              else if (format == JPEG)
-                // Use lut to write an RGB line to the file
-                write_jpeg_float2lut(ojpeg, float_line, &cinfo, stats,
-                //is_colormap_band ? TRUNCATE : sample_mapping,
-                sample_mapping,
-                md->general->no_data,
-                sample_count, lut_file);
-              else if (format == PNG || format == PNG_ALPHA || format == PNG_GE)
-                // Use lut to write an RGB line to the file
-                write_png_float2lut(opng, float_line, png_ptr, png_info_ptr,
-                stats,
-                //is_colormap_band ? TRUNCATE : sample_mapping,
-                sample_mapping,
-                md->general->no_data,
-                sample_count, lut_file);
-              else if (format == PGM) {
-                // Can't put color in a PGM file, so map it to greyscale and write that
-                write_pgm_float2byte(opgm, float_line, stats,
-                  //is_colormap_band ? TRUNCATE : sample_mapping,
-                  sample_mapping,
-                  md->general->no_data, sample_count);
-              }
-              else
-                asfPrintError("Impossible: unexpected format %s\n", format2str(format));
-            }
-            asfLineMeter(ii, md->general->line_count);
-          }
+        // Write the output image: on one of the band writer threads, or
+        // right here for a look up table, which apply_look_up_table_byte()
+        // and friends keep in static buffers
+        int in_background = band_pool && !is_colormap_band;
+        bf->md = md;
+        bf->image_data_file_name = image_data_file_name;
+        bf->format = format;
+        bf->sample_mapping = sample_mapping;
+        bf->stats = stats;
+        bf->lut_file = lut_file;
+        bf->channel = channel;
+        bf->is_colormap_band = is_colormap_band;
+        bf->as_byte = (md->optical || md->general->data_type == ASF_BYTE) &&
+          !(is_colormap_band &&
+            md->general->image_data_type == POLARIMETRIC_PARAMETER);
+        bf->show_progress = !in_background;
+        bf->is_geotiff = is_geotiff;
+        bf->otif = otif;
+        bf->ogtif = ogtif;
+        bf->ojpeg = ojpeg;
+        bf->opgm = opgm;
+        bf->opng = opng;
+        bf->ofp = ofp;
+        bf->png_ptr = png_ptr;
+        bf->png_info_ptr = png_info_ptr;
+        if (in_background) {
+          asfPrintStatus("Writing output file in the background...\n");
+          g_thread_pool_push(band_pool, bf, NULL);
         }
         else {
-          // Regular old single band image (no look up table applied)
-          for (ii=0; ii<md->general->line_count; ii++ ) {
-            if (md->optical || md->general->data_type == ASF_BYTE) {
-              get_byte_line(fp, md, ii+channel*offset, byte_line);
-              if (format == TIF || format == GEOTIFF)
-                write_tiff_byte2byte(otif, byte_line, stats, sample_mapping,
-                sample_count, ii);
-              else if (format == JPEG)
-                write_jpeg_byte2byte(ojpeg, byte_line, stats, sample_mapping,
-                &cinfo, sample_count);
-              else if (format == PNG)
-                write_png_byte2byte(opng, byte_line, stats, sample_mapping,
-                png_ptr, png_info_ptr, sample_count);
-              else if (format == PNG_ALPHA) {
-                asfPrintError("PNG_ALPHA not supported.\n");
-              }
-              else if (format == PNG_GE)
-                write_png_byte2rgbalpha(opng, byte_line, stats, sample_mapping,
-                                        png_ptr, png_info_ptr, sample_count);
-              else if (format == PGM)
-                write_pgm_byte2byte(opgm, byte_line, stats, sample_mapping,
-                sample_count);
-              else
-                asfPrintError("Impossible: unexpected format %s\n", format2str(format));
-            }
-            else if (sample_mapping == NONE && !is_colormap_band) {
-              get_float_line(fp, md, ii+channel*offset, float_line);
-              if (format == GEOTIFF || format == TIF) {
-		if (md->general->data_type == REAL32)
-		  write_tiff_float2float(otif, float_line, ii);
-		else if (md->general->data_type == INTEGER16)
-		  write_tiff_float2int(otif, float_line, ii,
-				       md->general->sample_count);
-	      }
-              else if (format == POLSARPRO_HDR) {
-                int sample;
-                for (sample=0; sample<sample_count; sample++)
-                  ieee_lil32(float_line[sample]);
-                fwrite(float_line,4,sample_count,ofp);
-              }
-              else
-                asfPrintError("Impossible: unexpected format %s\n", format2str(format));
-            }
-            else {
-              get_float_line(fp, md, ii+channel*offset, float_line);
-              if (format == TIF || format == GEOTIFF)
-                write_tiff_float2byte(otif, float_line, stats,
-                //is_colormap_band ? TRUNCATE : sample_mapping,
-                sample_mapping,
-                md->general->no_data, ii, sample_count);
-              else if (format == JPEG)
-                write_jpeg_float2byte(ojpeg, float_line, &cinfo, stats,
-                //is_colormap_band ? TRUNCATE : sample_mapping,
-                sample_mapping,
-                md->general->no_data,
-                sample_count);
-              else if (format == PNG || format == PNG_ALPHA || format == PNG_GE)
-                write_png_float2byte(opng, float_line, png_ptr, png_info_ptr,
-                stats,
-                //is_colormap_band ? TRUNCATE : sample_mapping,
-                sample_mapping,
-                md->general->no_data,
-                sample_count);
-              else if (format == PGM)
-                write_pgm_float2byte(opgm, float_line, stats,
-                //is_colormap_band ? TRUNCATE : sample_mapping,
-                sample_mapping,
-                md->general->no_data, sample_count);
-              else if (format == POLSARPRO_HDR) {
-                int sample;
-                for (sample=0; sample<sample_count; sample++)
-                  ieee_lil32(float_line[sample]);
-                fwrite(float_line,4,sample_count,ofp);
-              }
-              else
-                asfPrintError("Impossible: unexpected format %s\n", format2str(format));
-            }
-            asfLineMeter(ii, md->general->line_count);
-          } // End for each line
-        } // End if multi or single band
-        // Free memory
-        FREE(float_line);
-        FREE(byte_line);
-        if (stats.hist) gsl_histogram_free(stats.hist);
-        if (stats.hist_pdf) gsl_histogram_pdf_free(stats.hist_pdf);
-
-        // Finalize the chosen format
-        if (format == TIF || format == GEOTIFF)
-          finalize_tiff_file(otif, ogtif, is_geotiff);
-        else if (format == JPEG)
-          finalize_jpeg_file(ojpeg, &cinfo);
-        else if (format == PNG || format == PNG_ALPHA || format == PNG_GE)
-          finalize_png_file(opng, png_ptr, png_info_ptr);
-        else if (format == PGM)
-          finalize_ppm_file(opgm);
-        else if (format == POLSARPRO_HDR)
-          FCLOSE(ofp);
-
-        FCLOSE(fp);
+          asfPrintStatus("Writing output file...\n");
+          write_band_file(bf);
+        }
         FREE(out_file);
       }
     } // End for each band (kk is band number)
+    if (band_pool)
+      g_thread_pool_free(band_pool, FALSE, TRUE);
+
+    if (gathered) {
+      // Stats of bands that were skipped after all
+      for (kk=0; kk<band_count; kk++)
+        if (gather_band[kk] && gathered[kk].hist)
+          gsl_histogram_free(gathered[kk].hist);
+      FREE(gathered);
+    }
+    FREE(gather_band);
 
     if (free_band_names) {
       for (ii=0; ii<band_count; ++ii)
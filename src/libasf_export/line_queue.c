@@ -0,0 +1,236 @@
+/*******************************************************************
+Read-ahead for band export
+
+export_band_image() writes its output a line at a time, and the
+PNG, JPEG and TIFF writers all have to be fed in order from one
+thread.  What can be taken off that thread is the reading: an
+export_line_queue reads the bands being exported on threads of their
+own, one per band, each with its own stream, into a ring of blocks of
+lines.  The ring is bounded, so the readers never get more than a few
+blocks ahead of the writer.
+
+The writer asks for its lines in order with export_line_queue_get(),
+which copies a line out of the block holding it.  A block goes back
+to the readers as soon as the writer asks for a line past it.  With
+one export thread, the lines are read in the calling thread instead,
+a block at a time.
+*******************************************************************/
+#include <glib.h>
+
+#include "asf.h"
+#include "asf_export.h"
+
+// Lines per block, and blocks in the ring.
+#define QUEUE_BLOCK_LINES 64
+#define QUEUE_BLOCKS 4
+
+// Number of threads used by export_band_image().  0 means one per
+// processor.
+static int export_thread_count = 0;
+
+void set_export_thread_count(int thread_count)
+{
+  asfRequire(thread_count >= 0, "Invalid export thread count: %d\n",
+             thread_count);
+  export_thread_count = thread_count;
+}
+
+int get_export_thread_count(void)
+{
+  if (export_thread_count == 0)
+    return g_get_num_processors();
+  return export_thread_count;
+}
+
+struct export_line_queue {
+  meta_parameters *md;
+  int band_count;
+  int *bands;                 // Band numbers in the file.
+  int as_byte;                // Read bytes instead of floats?
+  size_t line_size;           // In bytes.
+  int block_count;
+  int ring_size;
+  unsigned char **block;      // Block of band b in slot s is
+                              // block[s*band_count + b].
+  int *filled;                // Bands read into each slot.
+  int released;               // Blocks the writer is done with.
+  int current;                // Block the writer is reading from.
+  int stop;                   // Set if the writer quits early.
+  GMutex lock;
+  GCond block_filled, block_released;
+  GThread **readers;
+  FILE *fp;                   // Only used without reader threads.
+};
+
+typedef struct {
+  export_line_queue *q;
+  const char *data_file;
+  int band;                   // Index into q->bands.
+} queue_reader_t;
+
+static void read_block(export_line_queue *q, FILE *fp, int b, int blk,
+                       unsigned char *dest)
+{
+  int nl = q->md->general->line_count;
+  int first = blk * QUEUE_BLOCK_LINES;
+  int lines = MIN(QUEUE_BLOCK_LINES, nl - first);
+
+  if (q->as_byte)
+    get_byte_lines(fp, q->md, q->bands[b]*nl + first, lines, dest);
+  else
+    get_band_float_lines(fp, q->md, q->bands[b], first, lines,
+                         (float *) dest);
+}
+
+static gpointer queue_reader(gpointer data)
+{
+  queue_reader_t *r = (queue_reader_t *) data;
+  export_line_queue *q = r->q;
+  FILE *fp = FOPEN(r->data_file, "rb");
+  int blk;
+
+  for (blk = 0; blk < q->block_count; blk++) {
+    int slot = blk % q->ring_size;
+    int stop;
+
+    g_mutex_lock(&q->lock);
+    while (!q->stop && blk - q->released >= q->ring_size)
+      g_cond_wait(&q->block_released, &q->lock);
+    stop = q->stop;
+    g_mutex_unlock(&q->lock);
+    if (stop)
+      break;
+
+    read_block(q, fp, r->band, blk, q->block[slot*q->band_count + r->band]);
+
+    g_mutex_lock(&q->lock);
+    q->filled[slot]++;
+    g_cond_broadcast(&q->block_filled);
+    g_mutex_unlock(&q->lock);
+  }
+
+  FCLOSE(fp);
+  FREE(r);
+  return NULL;
+}
+
+/*******************************************************************
+FUNCTION NAME:   export_line_queue_new - starts reading bands of an
+                 image ahead of the writer
+
+  band_count bands are read, band number bands[b] of the image being
+the queue's band b.  Lines are read as bytes (get_byte_line()) if
+as_byte is set, as floats (get_float_line()) otherwise.
+*******************************************************************/
+export_line_queue *export_line_queue_new(const char *data_file,
+                                         meta_parameters *md,
+                                         int band_count, const int *bands,
+                                         int as_byte)
+{
+  export_line_queue *q = MALLOC(sizeof(export_line_queue));
+  int nl = md->general->line_count;
+  int ns = md->general->sample_count;
+  int ii;
+
+  q->md = md;
+  q->band_count = band_count;
+  q->bands = MALLOC(sizeof(int) * band_count);
+  for (ii = 0; ii < band_count; ii++)
+    q->bands[ii] = bands[ii];
+  q->as_byte = as_byte;
+  q->line_size = (size_t) ns * (as_byte ? sizeof(unsigned char) : sizeof(float));
+  q->block_count = (nl + QUEUE_BLOCK_LINES - 1) / QUEUE_BLOCK_LINES;
+  q->ring_size = get_export_thread_count() > 1 ?
+    MIN(QUEUE_BLOCKS, q->block_count) : 1;
+  if (q->ring_size < 1)
+    q->ring_size = 1;
+  q->block = MALLOC(sizeof(unsigned char *) * q->ring_size * band_count);
+  for (ii = 0; ii < q->ring_size * band_count; ii++)
+    q->block[ii] = MALLOC(q->line_size * QUEUE_BLOCK_LINES);
+  q->filled = CALLOC(q->ring_size, sizeof(int));
+  q->released = 0;
+  q->current = -1;
+  q->stop = FALSE;
+  q->readers = NULL;
+  q->fp = NULL;
+
+  if (get_export_thread_count() > 1 && q->block_count > 0) {
+    g_mutex_init(&q->lock);
+    g_cond_init(&q->block_filled);
+    g_cond_init(&q->block_released);
+    q->readers = MALLOC(sizeof(GThread *) * band_count);
+    for (ii = 0; ii < band_count; ii++) {
+      queue_reader_t *r = MALLOC(sizeof(queue_reader_t));
+      r->q = q;
+      r->data_file = data_file;
+      r->band = ii;
+      q->readers[ii] = g_thread_new("export reader", queue_reader, r);
+    }
+  }
+  else {
+    q->fp = FOPEN(data_file, "rb");
+  }
+
+  return q;
+}
+
+// Copy line 'line' of the queue's band b into dest.  Lines have to be
+// asked for in order, although the bands can come in any order.
+void export_line_queue_get(export_line_queue *q, int b, int line, void *dest)
+{
+  int blk = line / QUEUE_BLOCK_LINES;
+  int slot = blk % q->ring_size;
+
+  asfRequire(blk >= q->current && blk < q->block_count,
+             "Line %d requested out of order\n", line);
+
+  if (blk != q->current) {
+    if (q->readers) {
+      g_mutex_lock(&q->lock);
+      if (q->current >= 0) {
+        // Hand the block we're done with back to the readers.
+        q->filled[q->current % q->ring_size] = 0;
+        q->released = q->current + 1;
+        g_cond_broadcast(&q->block_released);
+      }
+      while (q->filled[slot] < q->band_count)
+        g_cond_wait(&q->block_filled, &q->lock);
+      g_mutex_unlock(&q->lock);
+    }
+    else {
+      int ii;
+      for (ii = 0; ii < q->band_count; ii++)
+        read_block(q, q->fp, ii, blk, q->block[slot*q->band_count + ii]);
+    }
+    q->current = blk;
+  }
+
+  memcpy(dest, q->block[slot*q->band_count + b] +
+         (line - blk*QUEUE_BLOCK_LINES) * q->line_size, q->line_size);
+}
+
+void export_line_queue_free(export_line_queue *q)
+{
+  int ii;
+
+  if (q->readers) {
+    g_mutex_lock(&q->lock);
+    q->stop = TRUE;
+    g_cond_broadcast(&q->block_released);
+    g_mutex_unlock(&q->lock);
+    for (ii = 0; ii < q->band_count; ii++)
+      g_thread_join(q->readers[ii]);
+    FREE(q->readers);
+    g_mutex_clear(&q->lock);
+    g_cond_clear(&q->block_filled);
+    g_cond_clear(&q->block_released);
+  }
+  if (q->fp)
+    FCLOSE(q->fp);
+  for (ii = 0; ii < q->ring_size * q->band_count; ii++)
+    FREE(q->block[ii]);
+  FREE(q->block);
+  FREE(q->filled);
+  FREE(q->bands);
+  FREE(q);
+}
@@ -0,0 +1,707 @@
+/*******************************************************************
+Tiled TIFF export
+
+After set_tiff_export_layout(TIFF_COG, ...), initialize_tiff_file()
+sets each TIFF up with tiles instead of one line strips.  The
+write_tiff_*() functions then pass their lines to
+tiff_tiles_write_line() instead of TIFFWriteScanline().  Every sample
+mapping, look up table and palette path therefore produces the same
+pixels as before, just laid out differently.
+
+Lines are collected into a band one tile high.  When a band is full,
+its tiles are cut out and compressed on a pool of worker threads.
+LZW, DEFLATE and uncompressed tiles are prepared here, so they can be
+done in parallel.  Any other codec is left to libtiff, which runs in
+the calling thread.  Finished tiles are kept in a scratch file next to
+the output, which is unlinked as soon as it is opened where the system
+allows it.  Each pair of lines is also averaged 2x2 into a line of
+the next overview level.  Palette images take the nearest pixel
+instead.  Overview levels are tiled the same way, and they stop once
+an overview fits in a single tile.
+
+finalize_tiff_file() calls tiff_tiles_finish(), which writes out the
+directories and the tiles.  With libtiff 4.1 or later, the file has
+the Cloud Optimized GeoTIFF layout.  All of the directories come
+first.  They are followed by the tiles, from the smallest overview up
+to the full resolution image.  Older versions of libtiff can't write
+the directories before the tiles.  There, the overviews become
+ordinary reduced resolution subfiles, written after the image.
+*******************************************************************/
+#include <glib.h>
+#include <zlib.h>
+
+#include "asf.h"
+#include "asf_nan.h"
+#include "asf_export.h"
+
+// Tile width and height, in pixels.
+#define TILE_SIZE 512
+
+// Name the tiling state is attached to its TIFF under.
+#define TILES_CLIENT "asf_tiles"
+
+#if defined(TIFFLIB_VERSION) && TIFFLIB_VERSION >= 20191103
+#define TIFF_COG_LAYOUT
+#endif
+
+static tiff_layout_t tiff_layout = TIFF_STRIPS;
+static tiff_compression_t tiff_compression = TIFF_DEFLATE;
+
+void set_tiff_export_layout(tiff_layout_t layout,
+                            tiff_compression_t compression)
+{
+  tiff_layout = layout;
+  tiff_compression = compression;
+}
+
+tiff_layout_t get_tiff_export_layout(void)
+{
+  return tiff_layout;
+}
+
+tiff_compression_t get_tiff_export_compression(void)
+{
+  return tiff_compression;
+}
+
+// Number of threads compressing tiles.  0 means one per processor.
+static int tiles_thread_count = 0;
+
+void set_tiff_export_thread_count(int thread_count)
+{
+  asfRequire(thread_count >= 0, "Invalid TIFF export thread count: %d\n",
+             thread_count);
+  tiles_thread_count = thread_count;
+}
+
+int get_tiff_export_thread_count(void)
+{
+  if (tiles_thread_count == 0)
+    return g_get_num_processors();
+  return tiles_thread_count;
+}
+
+// One resolution level: the full image, or one of its overviews.
+typedef struct {
+  int ns, nl;               // Size of this level.
+  int across, down;         // Tiles across and down.
+  unsigned char *band;      // The row of tiles being filled.
+  unsigned char *last;      // First line of a pair, for the next level.
+  unsigned char *reduced;   // Line made for the next level.
+  int lines;                // Lines received so far.
+  long long *offset;        // Where each tile is in the scratch file,
+  int *size;                // and how many bytes it takes.
+} tile_level;
+
+typedef struct {
+  uint16 bps, spp, format, photometric;
+  int palette;              // Palette (colormapped) image?
+  uint16 *colormap;         // Red, green and blue, for palette images.
+  int pixel;                // Bytes per pixel.
+  uint16 compression, predictor;
+  int encode;               // Do we compress the tiles ourselves?
+  int have_no_data;
+  double no_data;
+  int level_count;
+  tile_level *level;
+  char *scratch_name;
+  FILE *scratch;
+} tiled_tiff;
+
+/******************************** LZW *********************************/
+
+// TIFF flavor of LZW: codes are 9 to 12 bits, most significant bit
+// first, and the code width goes up one code early.  The encoder
+// works the same way as the one in libtiff, so that every reader can
+// decode the output.
+#define LZW_HSIZE 9001      // Hash table size, prime.
+#define LZW_CLEAR 256
+#define LZW_EOI   257
+#define LZW_FIRST 258
+#define LZW_MAX   4095      // Largest 12 bit code.
+
+typedef struct {
+  int key;                  // (prefix << 8) | byte, or -1 if empty.
+  int code;
+} lzw_entry;
+
+typedef struct {
+  unsigned char *out;
+  int size;
+  unsigned long data;
+  int bits, nbits;
+} lzw_output;
+
+static void lzw_put(lzw_output *o, int code)
+{
+  o->data = (o->data << o->nbits) | code;
+  o->bits += o->nbits;
+  while (o->bits >= 8) {
+    o->bits -= 8;
+    o->out[o->size++] = (unsigned char) (o->data >> o->bits);
+  }
+  o->data &= (1UL << o->bits) - 1;
+}
+
+static void lzw_clear(lzw_entry *table)
+{
+  int ii;
+  for (ii = 0; ii < LZW_HSIZE; ii++)
+    table[ii].key = -1;
+}
+
+// Worst case size of n bytes of LZW output.
+static int lzw_bound(int n)
+{
+  return n + n/2 + n/1024 + 16;
+}
+
+static int lzw_encode(const unsigned char *in, int n, unsigned char *out,
+                      lzw_entry *table)
+{
+  lzw_output o = { out, 0, 0, 0, 9 };
+  int maxcode = (1 << 9) - 1, free_ent = LZW_FIRST;
+  int ent, ii;
+
+  lzw_clear(table);
+  lzw_put(&o, LZW_CLEAR);
+  if (n == 0) {
+    lzw_put(&o, LZW_EOI);
+    if (o.bits > 0)
+      out[o.size++] = (unsigned char) (o.data << (8 - o.bits));
+    return o.size;
+  }
+
+  ent = in[0];
+  for (ii = 1; ii < n; ii++) {
+    int c = in[ii];
+    int key = (ent << 8) | c;
+    int h = key % LZW_HSIZE;
+    int disp = h == 0 ? 1 : LZW_HSIZE - h;
+
+    while (table[h].key != -1 && table[h].key != key) {
+      h -= disp;
+      if (h < 0)
+        h += LZW_HSIZE;
+    }
+    if (table[h].key == key) {
+      ent = table[h].code;
+      continue;
+    }
+
+    lzw_put(&o, ent);
+    ent = c;
+    table[h].key = key;
+    table[h].code = free_ent++;
+    if (free_ent == LZW_MAX - 1) {
+      // Table is full, start over.
+      lzw_clear(table);
+      lzw_put(&o, LZW_CLEAR);
+      free_ent = LZW_FIRST;
+      o.nbits = 9;
+      maxcode = (1 << 9) - 1;
+    }
+    else if (free_ent > maxcode) {
+      o.nbits++;
+      maxcode = (1 << o.nbits) - 1;
+    }
+  }
+
+  // The decoder adds one more entry after reading the last code, so
+  // the end of information code may need to be a bit wider.
+  lzw_put(&o, ent);
+  free_ent++;
+  if (free_ent == LZW_MAX - 1) {
+    lzw_put(&o, LZW_CLEAR);
+    o.nbits = 9;
+  }
+  else if (free_ent > maxcode)
+    o.nbits++;
+  lzw_put(&o, LZW_EOI);
+  if (o.bits > 0)
+    out[o.size++] = (unsigned char) (o.data << (8 - o.bits));
+
+  return o.size;
+}
+
+/******************************* Tiles ********************************/
+
+// Copies tile number col of the band (rows lines of it) into tile,
+// padding it out with zeros past the edges of the image.
+static void cut_tile(const tiled_tiff *t, const tile_level *lev, int rows,
+                     int col, unsigned char *tile)
+{
+  size_t line_bytes = (size_t) lev->ns * t->pixel;
+  size_t tile_line = (size_t) TILE_SIZE * t->pixel;
+  int first = col * TILE_SIZE;
+  size_t width = (size_t) MIN(TILE_SIZE, lev->ns - first) * t->pixel;
+  int ii;
+
+  for (ii = 0; ii < rows; ii++) {
+    memcpy(tile + ii*tile_line, lev->band + ii*line_bytes + first*t->pixel,
+           width);
+    if (width < tile_line)
+      memset(tile + ii*tile_line + width, 0, tile_line - width);
+  }
+  if (rows < TILE_SIZE)
+    memset(tile + rows*tile_line, 0, (TILE_SIZE - rows)*tile_line);
+}
+
+// Horizontal differencing (TIFF predictor 2) of each line of a tile.
+static void predict_tile(const tiled_tiff *t, unsigned char *tile)
+{
+  int n = TILE_SIZE * t->spp;
+  int ii, jj;
+
+  for (ii = 0; ii < TILE_SIZE; ii++) {
+    if (t->bps == 8) {
+      unsigned char *p = tile + (size_t) ii*n;
+      for (jj = n - 1; jj >= t->spp; jj--)
+        p[jj] -= p[jj - t->spp];
+    }
+    else {
+      unsigned short *p = (unsigned short *) tile + (size_t) ii*n;
+      for (jj = n - 1; jj >= t->spp; jj--)
+        p[jj] -= p[jj - t->spp];
+    }
+  }
+}
+
+// Compresses a tile into a new buffer and returns its size.
+static int encode_tile(const tiled_tiff *t, unsigned char *tile, int n,
+                       unsigned char **out, lzw_entry *table)
+{
+  if (t->predictor == PREDICTOR_HORIZONTAL)
+    predict_tile(t, tile);
+
+  if (t->compression == COMPRESSION_ADOBE_DEFLATE) {
+    uLongf size = compressBound(n);
+    *out = (unsigned char *) MALLOC(size);
+    if (compress2(*out, &size, tile, n, Z_DEFAULT_COMPRESSION) != Z_OK)
+      asfPrintError("Error compressing TIFF tile.\n");
+    return (int) size;
+  }
+  else if (t->compression == COMPRESSION_LZW) {
+    *out = (unsigned char *) MALLOC(lzw_bound(n));
+    return lzw_encode(tile, n, *out, table);
+  }
+  else {
+    *out = (unsigned char *) MALLOC(n);
+    memcpy(*out, tile, n);
+    return n;
+  }
+}
+
+// One row of tiles, shared by the threads preparing them.
+typedef struct {
+  const tiled_tiff *t;
+  const tile_level *lev;
+  int rows;                 // Lines in the band.
+  unsigned char **out;      // Prepared tiles, one per column,
+  int *size;                // and their sizes.
+  int next;                 // Next column to claim.
+} tile_queue;
+
+static gpointer tile_worker(gpointer data)
+{
+  tile_queue *q = (tile_queue *) data;
+  const tiled_tiff *t = q->t;
+  int n = TILE_SIZE * TILE_SIZE * t->pixel;
+  unsigned char *tile = (unsigned char *) MALLOC(n);
+  lzw_entry *table = NULL;
+  int col;
+
+  if (t->compression == COMPRESSION_LZW)
+    table = (lzw_entry *) MALLOC(LZW_HSIZE * sizeof(lzw_entry));
+
+  while ((col = g_atomic_int_add(&q->next, 1)) < q->lev->across) {
+    cut_tile(t, q->lev, q->rows, col, tile);
+    if (t->encode)
+      q->size[col] = encode_tile(t, tile, n, &q->out[col], table);
+    else {
+      // libtiff compresses these as they are written.
+      q->out[col] = tile;
+      q->size[col] = n;
+      tile = (unsigned char *) MALLOC(n);
+    }
+  }
+
+  FREE(tile);
+  if (table)
+    FREE(table);
+  return NULL;
+}
+
+// Prepares the row of tiles in a level's band and adds them to the
+// scratch file.
+static void flush_band(tiled_tiff *t, tile_level *lev, int rows)
+{
+  int first = (lev->lines - rows) / TILE_SIZE * lev->across;
+  int thread_count = MIN(get_tiff_export_thread_count(), lev->across);
+  tile_queue q;
+  int ii;
+
+  q.t = t;
+  q.lev = lev;
+  q.rows = rows;
+  q.out = (unsigned char **) MALLOC(lev->across * sizeof(unsigned char *));
+  q.size = (int *) MALLOC(lev->across * sizeof(int));
+  q.next = 0;
+
+  if (thread_count <= 1)
+    tile_worker(&q);
+  else {
+    GThread **threads = (GThread **) MALLOC(thread_count * sizeof(GThread *));
+    for (ii = 0; ii < thread_count; ii++)
+      threads[ii] = g_thread_new("tiff tiles", tile_worker, &q);
+    for (ii = 0; ii < thread_count; ii++)
+      g_thread_join(threads[ii]);
+    FREE(threads);
+  }
+
+  for (ii = 0; ii < lev->across; ii++) {
+    lev->offset[first + ii] = FTELL64(t->scratch);
+    lev->size[first + ii] = q.size[ii];
+    ASF_FWRITE(q.out[ii], 1, q.size[ii], t->scratch);
+    FREE(q.out[ii]);
+  }
+  FREE(q.out);
+  FREE(q.size);
+}
+
+/****************************** Overviews *****************************/
+
+static double get_sample(const tiled_tiff *t, const unsigned char *line,
+                         int ii)
+{
+  if (t->bps == 8)
+    return line[ii];
+  else if (t->bps == 16)
+    return ((const unsigned short *) line)[ii];
+  else
+    return ((const float *) line)[ii];
+}
+
+static void put_sample(const tiled_tiff *t, unsigned char *line, int ii,
+                       double value)
+{
+  if (t->bps == 8)
+    line[ii] = (unsigned char) (value + 0.5);
+  else if (t->bps == 16)
+    ((unsigned short *) line)[ii] = (unsigned short) (value + 0.5);
+  else
+    ((float *) line)[ii] = (float) value;
+}
+
+// Makes a line of the next level from lines a and b (b is NULL when a
+// is the last line of an image with an odd number of lines).  Each
+// output pixel is the average of the 2x2 block of valid pixels it
+// covers, or no data if there are none.  Palette indices can't be
+// averaged, so those take the top left pixel.
+static void reduce_lines(const tiled_tiff *t, int ns,
+                         const unsigned char *a, const unsigned char *b,
+                         unsigned char *out)
+{
+  int out_ns = (ns + 1) / 2;
+  int ii, kk;
+
+  if (t->palette || (t->bps != 8 && t->bps != 16 && t->bps != 32)) {
+    for (ii = 0; ii < out_ns; ii++)
+      memcpy(out + ii*t->pixel, a + 2*ii*t->pixel, t->pixel);
+    return;
+  }
+
+  for (ii = 0; ii < out_ns; ii++) {
+    for (kk = 0; kk < t->spp; kk++) {
+      const unsigned char *lines[2] = { a, b };
+      double sum = 0.0;
+      int count = 0, ll, xx;
+
+      for (ll = 0; ll < 2 && lines[ll]; ll++) {
+        for (xx = 2*ii; xx < MIN(2*ii + 2, ns); xx++) {
+          double value = get_sample(t, lines[ll], xx*t->spp + kk);
+          if (ISNAN(value) || (t->have_no_data && value == t->no_data))
+            continue;
+          sum += value;
+          count++;
+        }
+      }
+
+      if (count > 0)
+        put_sample(t, out, ii*t->spp + kk, sum / count);
+      else if (t->have_no_data)
+        put_sample(t, out, ii*t->spp + kk, t->no_data);
+      else
+        put_sample(t, out, ii*t->spp + kk,
+                   t->format == SAMPLEFORMAT_IEEEFP ? NAN : 0.0);
+    }
+  }
+}
+
+// Adds the next line to level k, and passes it on to the level below.
+static void add_line(tiled_tiff *t, int k, const unsigned char *line)
+{
+  tile_level *lev = &t->level[k];
+  size_t line_bytes = (size_t) lev->ns * t->pixel;
+  int row = lev->lines % TILE_SIZE;
+
+  memcpy(lev->band + row*line_bytes, line, line_bytes);
+  lev->lines++;
+  if (row == TILE_SIZE - 1 || lev->lines == lev->nl)
+    flush_band(t, lev, row + 1);
+
+  if (k + 1 < t->level_count) {
+    if (lev->lines % 2 == 1 && lev->lines < lev->nl)
+      memcpy(lev->last, line, line_bytes);
+    else {
+      if (lev->lines % 2 == 0)
+        reduce_lines(t, lev->ns, lev->last, line, lev->reduced);
+      else
+        reduce_lines(t, lev->ns, line, NULL, lev->reduced);
+      add_line(t, k + 1, lev->reduced);
+    }
+  }
+}
+
+/******************************* Setup ********************************/
+
+// Sets up a TIFF, whose image tags have all been set already, to be
+// written in tiles with overviews.
+void tiff_tiles_begin(TIFF *otif)
+{
+  tiled_tiff *t = (tiled_tiff *) CALLOC(1, sizeof(tiled_tiff));
+  uint32 ns, nl;
+  char *no_data = NULL;
+  int ns_k, nl_k, k;
+
+  TIFFGetField(otif, TIFFTAG_IMAGEWIDTH, &ns);
+  TIFFGetField(otif, TIFFTAG_IMAGELENGTH, &nl);
+  TIFFGetField(otif, TIFFTAG_BITSPERSAMPLE, &t->bps);
+  TIFFGetField(otif, TIFFTAG_SAMPLESPERPIXEL, &t->spp);
+  TIFFGetField(otif, TIFFTAG_SAMPLEFORMAT, &t->format);
+  TIFFGetField(otif, TIFFTAG_PHOTOMETRIC, &t->photometric);
+  t->pixel = t->spp * t->bps / 8;
+  t->palette = t->photometric == PHOTOMETRIC_PALETTE;
+
+  if (t->palette) {
+    uint16 *red, *green, *blue;
+    int map_size = 1 << t->bps;
+    TIFFGetField(otif, TIFFTAG_COLORMAP, &red, &green, &blue);
+    t->colormap = (uint16 *) MALLOC(3 * map_size * sizeof(uint16));
+    memcpy(t->colormap, red, map_size * sizeof(uint16));
+    memcpy(t->colormap + map_size, green, map_size * sizeof(uint16));
+    memcpy(t->colormap + 2*map_size, blue, map_size * sizeof(uint16));
+  }
+
+  // Overviews leave out the same no data value the image does.
+  if (TIFFGetField(otif, TIFFTAG_GDAL_NODATA, &no_data) && no_data) {
+    t->have_no_data = TRUE;
+    t->no_data = atof(no_data);
+  }
+
+  t->encode = TRUE;
+  switch (get_tiff_export_compression()) {
+    case TIFF_UNCOMPRESSED:
+      t->compression = COMPRESSION_NONE;
+      break;
+    case TIFF_LZW:
+      t->compression = COMPRESSION_LZW;
+      break;
+    case TIFF_DEFLATE:
+      t->compression = COMPRESSION_ADOBE_DEFLATE;
+      break;
+    case TIFF_ZSTD:
+#ifdef COMPRESSION_ZSTD
+      if (!TIFFIsCODECConfigured(COMPRESSION_ZSTD))
+        asfPrintError("This libtiff was built without ZSTD compression.\n");
+      t->compression = COMPRESSION_ZSTD;
+      t->encode = FALSE;
+#else
+      asfPrintError("This libtiff does not know ZSTD compression.\n");
+#endif
+      break;
+  }
+  t->predictor = PREDICTOR_NONE;
+  if (!t->palette && t->format == SAMPLEFORMAT_UINT &&
+      (t->bps == 8 || t->bps == 16) && t->compression != COMPRESSION_NONE)
+    t->predictor = PREDICTOR_HORIZONTAL;
+
+  TIFFSetField(otif, TIFFTAG_COMPRESSION, t->compression);
+  if (t->predictor != PREDICTOR_NONE)
+    TIFFSetField(otif, TIFFTAG_PREDICTOR, t->predictor);
+  TIFFSetField(otif, TIFFTAG_TILEWIDTH, TILE_SIZE);
+  TIFFSetField(otif, TIFFTAG_TILELENGTH, TILE_SIZE);
+
+  // Halve the image until it fits in one tile.
+  t->level_count = 1;
+  for (ns_k = ns, nl_k = nl; ns_k > TILE_SIZE || nl_k > TILE_SIZE;
+       ns_k = (ns_k + 1) / 2, nl_k = (nl_k + 1) / 2)
+    t->level_count++;
+
+  t->level = (tile_level *) CALLOC(t->level_count, sizeof(tile_level));
+  for (k = 0, ns_k = ns, nl_k = nl; k < t->level_count;
+       k++, ns_k = (ns_k + 1) / 2, nl_k = (nl_k + 1) / 2)
+  {
+    tile_level *lev = &t->level[k];
+    size_t line_bytes = (size_t) ns_k * t->pixel;
+    int tiles;
+
+    lev->ns = ns_k;
+    lev->nl = nl_k;
+    lev->across = (ns_k + TILE_SIZE - 1) / TILE_SIZE;
+    lev->down = (nl_k + TILE_SIZE - 1) / TILE_SIZE;
+    tiles = lev->across * lev->down;
+    lev->band = (unsigned char *) MALLOC(TILE_SIZE * line_bytes);
+    if (k + 1 < t->level_count) {
+      lev->last = (unsigned char *) MALLOC(line_bytes);
+      lev->reduced = (unsigned char *)
+        MALLOC((size_t) ((ns_k + 1) / 2) * t->pixel);
+    }
+    lev->offset = (long long *) MALLOC(tiles * sizeof(long long));
+    lev->size = (int *) MALLOC(tiles * sizeof(int));
+  }
+
+  t->scratch_name = (char *) MALLOC(strlen(TIFFFileName(otif)) + 10);
+  sprintf(t->scratch_name, "%s.tiles", TIFFFileName(otif));
+  t->scratch = FOPEN(t->scratch_name, "w+b");
+#ifndef win32
+  // Nobody else opens the scratch file, so its name can go right away.
+  // That way it isn't left behind when an export fails.
+  unlink(t->scratch_name);
+#endif
+
+  TIFFSetClientInfo(otif, t, TILES_CLIENT);
+}
+
+// Writes line number 'line' of a tiled TIFF.  Returns FALSE if otif
+// isn't tiled, in which case the caller should write the scanline.
+int tiff_tiles_write_line(TIFF *otif, void *buf, int line)
+{
+  tiled_tiff *t = (tiled_tiff *) TIFFGetClientInfo(otif, TILES_CLIENT);
+
+  if (!t)
+    return FALSE;
+  asfRequire(line == t->level[0].lines,
+             "Tiled TIFF lines must be written in order "
+             "(got line %d, expected %d)\n", line, t->level[0].lines);
+  add_line(t, 0, (const unsigned char *) buf);
+  return TRUE;
+}
+
+/****************************** Writing *******************************/
+
+static void set_overview_tags(TIFF *otif, const tiled_tiff *t, int k)
+{
+  TIFFSetField(otif, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+  TIFFSetField(otif, TIFFTAG_IMAGEWIDTH, t->level[k].ns);
+  TIFFSetField(otif, TIFFTAG_IMAGELENGTH, t->level[k].nl);
+  TIFFSetField(otif, TIFFTAG_BITSPERSAMPLE, t->bps);
+  TIFFSetField(otif, TIFFTAG_SAMPLESPERPIXEL, t->spp);
+  TIFFSetField(otif, TIFFTAG_SAMPLEFORMAT, t->format);
+  TIFFSetField(otif, TIFFTAG_PHOTOMETRIC, t->photometric);
+  if (t->palette) {
+    int map_size = 1 << t->bps;
+    TIFFSetField(otif, TIFFTAG_COLORMAP, t->colormap,
+                 t->colormap + map_size, t->colormap + 2*map_size);
+  }
+  TIFFSetField(otif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(otif, TIFFTAG_COMPRESSION, t->compression);
+  if (t->predictor != PREDICTOR_NONE)
+    TIFFSetField(otif, TIFFTAG_PREDICTOR, t->predictor);
+  TIFFSetField(otif, TIFFTAG_TILEWIDTH, TILE_SIZE);
+  TIFFSetField(otif, TIFFTAG_TILELENGTH, TILE_SIZE);
+}
+
+// Copies the tiles of level k from the scratch file into the current
+// directory.
+static void write_level_tiles(TIFF *otif, tiled_tiff *t, int k)
+{
+  tile_level *lev = &t->level[k];
+  int tiles = lev->across * lev->down;
+  unsigned char *buf = NULL;
+  int buf_size = 0, ii;
+
+  for (ii = 0; ii < tiles; ii++) {
+    tsize_t ret;
+
+    if (lev->size[ii] > buf_size) {
+      if (buf)
+        FREE(buf);
+      buf_size = lev->size[ii];
+      buf = (unsigned char *) MALLOC(buf_size);
+    }
+    FSEEK64(t->scratch, lev->offset[ii], SEEK_SET);
+    ASF_FREAD(buf, 1, lev->size[ii], t->scratch);
+    if (t->encode)
+      ret = TIFFWriteRawTile(otif, ii, buf, lev->size[ii]);
+    else
+      ret = TIFFWriteEncodedTile(otif, ii, buf, lev->size[ii]);
+    if (ret < 0)
+      asfPrintError("Error writing TIFF tile %d.\n", ii);
+  }
+  if (buf)
+    FREE(buf);
+}
+
+// Writes out the directories and tiles of a tiled TIFF, once all of
+// its lines have been written.  Does nothing for other TIFFs.
+void tiff_tiles_finish(TIFF *otif)
+{
+  tiled_tiff *t = (tiled_tiff *) TIFFGetClientInfo(otif, TILES_CLIENT);
+  int k;
+
+  if (!t)
+    return;
+  asfRequire(t->level[0].lines == t->level[0].nl,
+             "Tiled TIFF is incomplete (%d of %d lines written)\n",
+             t->level[0].lines, t->level[0].nl);
+
+#ifdef TIFF_COG_LAYOUT
+  // The directories go out first, with room for their tile offsets,
+  // which are filled in as the tiles follow them.
+  for (k = 0; k < t->level_count; k++) {
+    if (k > 0)
+      set_overview_tags(otif, t, k);
+    TIFFDeferStrileArrayWriting(otif);
+    TIFFWriteCheck(otif, TRUE, "tiff_tiles_finish");
+    if (!TIFFWriteDirectory(otif))
+      asfPrintError("Error writing TIFF directory.\n");
+  }
+  for (k = t->level_count - 1; k >= 0; k--) {
+    if (!TIFFSetDirectory(otif, k))
+      asfPrintError("Error reading back TIFF directory %d.\n", k);
+    write_level_tiles(otif, t, k);
+    if (!TIFFForceStrileArrayWriting(otif))
+      asfPrintError("Error writing TIFF tile offsets.\n");
+  }
+#else
+  for (k = 0; k < t->level_count; k++) {
+    if (k > 0)
+      set_overview_tags(otif, t, k);
+    write_level_tiles(otif, t, k);
+    if (!TIFFWriteDirectory(otif))
+      asfPrintError("Error writing TIFF directory.\n");
+  }
+#endif
+
+  FCLOSE(t->scratch);
+#ifdef win32
+  remove_file(t->scratch_name);
+#endif
+  FREE(t->scratch_name);
+  for (k = 0; k < t->level_count; k++) {
+    tile_level *lev = &t->level[k];
+    FREE(lev->band);
+    if (lev->last) {
+      FREE(lev->last);
+      FREE(lev->reduced);
+    }
+    FREE(lev->offset);
+    FREE(lev->size);
+  }
+  FREE(t->level);
+  if (t->colormap)
+    FREE(t->colormap);
+  FREE(t);
+  TIFFSetClientInfo(otif, NULL, TILES_CLIENT);
+}
@@ -0,0 +1,284 @@
+// Writes small tiled TIFFs through tiff_tiles.c, with each of the
+// codecs it supports, and reads every directory back with libtiff to
+// check that the full resolution image decodes to what was written and
+// that each overview has the right size and pixels.
+
+#include "asf_export.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Three tiles across and down, the last ones cut off by the image edge.
+// The odd width leaves a single column to average at each level, and
+// it takes two overviews (551 x 515, then 276 x 258) to fit in a tile.
+#define NS 1101
+#define NL 1030
+#define TILE 512
+
+static int failures = 0;
+
+// The first tile is noise, which fills the LZW table (4094 codes)
+// several times over, so the encoder has to clear it and start over
+// part way through.  The others are smooth ramps, which make long
+// strings and wide codes.
+static double sample(int line, int samp)
+{
+  if (line < TILE && samp < TILE)
+    return rand() % 256;
+  return (line + 3*samp) % 256;
+}
+
+static double get_value(int bps, const unsigned char *p, size_t ii)
+{
+  if (bps == 8)
+    return p[ii];
+  else if (bps == 16)
+    return ((const unsigned short *) p)[ii];
+  else
+    return ((const float *) p)[ii];
+}
+
+static void put_value(int bps, unsigned char *p, size_t ii, double value)
+{
+  if (bps == 8)
+    p[ii] = (unsigned char) (value + 0.5);
+  else if (bps == 16)
+    ((unsigned short *) p)[ii] = (unsigned short) (value + 0.5);
+  else
+    ((float *) p)[ii] = (float) value;
+}
+
+// The next overview of an ns x nl image, worked out directly: each
+// pixel is the average of the 2x2 block it covers, or the top left
+// pixel of it for a palette image.  There is no no data value here.
+static unsigned char *reduce(const unsigned char *image, int ns, int nl,
+                             int bps, int palette)
+{
+  int pixel = bps / 8, out_ns = (ns + 1) / 2, out_nl = (nl + 1) / 2;
+  unsigned char *out =
+    (unsigned char *) MALLOC((size_t) out_ns * out_nl * pixel);
+  int ii, jj, yy, xx;
+
+  for (ii = 0; ii < out_nl; ii++) {
+    for (jj = 0; jj < out_ns; jj++) {
+      double sum = 0.0;
+      int count = 0;
+
+      if (palette) {
+        out[(size_t) ii*out_ns + jj] = image[(size_t) 2*ii*ns + 2*jj];
+        continue;
+      }
+      for (yy = 2*ii; yy < MIN(2*ii + 2, nl); yy++) {
+        for (xx = 2*jj; xx < MIN(2*jj + 2, ns); xx++) {
+          sum += get_value(bps, image, (size_t) yy*ns + xx);
+          count++;
+        }
+      }
+      put_value(bps, out, (size_t) ii*out_ns + jj, sum / count);
+    }
+  }
+  return out;
+}
+
+// Reads the current directory back tile by tile and compares it with
+// image, which is ns x nl.  Returns the number of problems found.
+static int check_level(const char *what, TIFF *otif, int level,
+                       const unsigned char *image, int ns, int nl, int bps,
+                       int predictor)
+{
+  int pixel = bps / 8;
+  int across = (ns + TILE - 1) / TILE, down = (nl + TILE - 1) / TILE;
+  unsigned char *tile;
+  uint32 width = 0, length = 0;
+  uint16 compression = COMPRESSION_NONE, pred = PREDICTOR_NONE;
+  int ii, tx, ty, bad = 0;
+
+  TIFFGetField(otif, TIFFTAG_IMAGEWIDTH, &width);
+  TIFFGetField(otif, TIFFTAG_IMAGELENGTH, &length);
+  if ((int) width != ns || (int) length != nl) {
+    printf("%s: level %d is %u x %u, expected %d x %d\n", what, level,
+           (unsigned) width, (unsigned) length, ns, nl);
+    return 1;
+  }
+  if (level > 0) {
+    uint32 subfile = 0;
+    TIFFGetField(otif, TIFFTAG_SUBFILETYPE, &subfile);
+    if (!(subfile & FILETYPE_REDUCEDIMAGE)) {
+      printf("%s: level %d isn't marked as an overview\n", what, level);
+      bad++;
+    }
+  }
+  // libtiff only knows the predictor tag when there is a codec.
+  TIFFGetField(otif, TIFFTAG_COMPRESSION, &compression);
+  if (compression != COMPRESSION_NONE)
+    TIFFGetField(otif, TIFFTAG_PREDICTOR, &pred);
+  if (pred != predictor) {
+    printf("%s: level %d has predictor %d, expected %d\n", what, level,
+           pred, predictor);
+    bad++;
+  }
+  if ((int) TIFFNumberOfTiles(otif) != across * down) {
+    printf("%s: level %d has %d tiles, expected %d\n", what, level,
+           (int) TIFFNumberOfTiles(otif), across * down);
+    return bad + 1;
+  }
+
+  tile = (unsigned char *) MALLOC(TILE * TILE * pixel);
+  for (ty = 0; ty < down; ty++) {
+    for (tx = 0; tx < across; tx++) {
+      int rows = MIN(TILE, nl - ty*TILE), cols = MIN(TILE, ns - tx*TILE);
+      if (TIFFReadEncodedTile(otif, ty*across + tx, tile, -1) !=
+          TILE * TILE * pixel) {
+        printf("%s: level %d tile %d,%d could not be read\n", what, level,
+               tx, ty);
+        bad++;
+        continue;
+      }
+      for (ii = 0; ii < rows; ii++) {
+        if (memcmp(tile + (size_t) ii*TILE*pixel,
+                   image + ((size_t) (ty*TILE + ii)*ns + tx*TILE)*pixel,
+                   (size_t) cols*pixel) != 0) {
+          printf("%s: level %d tile %d,%d differs in line %d\n", what,
+                 level, tx, ty, ii);
+          bad++;
+          break;
+        }
+      }
+    }
+  }
+  FREE(tile);
+  return bad;
+}
+
+static void tiles_test(const char *what, tiff_compression_t compression,
+                       int bps, int palette)
+{
+  const char *file = "tiff_tiles_test.tif";
+  int pixel = bps / 8;
+  unsigned char *image = (unsigned char *) MALLOC((size_t) NS * NL * pixel);
+  unsigned char *level_image;
+  uint16 colormap[3*256];
+  int predictor;
+  TIFF *otif;
+  int ii, jj, ns, nl, level, bad = 0;
+
+  srand(1234);
+  for (ii = 0; ii < NL; ii++) {
+    for (jj = 0; jj < NS; jj++) {
+      double value = sample(ii, jj);
+      if (bps == 16)
+        value = value * 251 + jj;
+      else if (bps == 32)
+        value /= 7.0;
+      put_value(bps, image, (size_t) ii*NS + jj, value);
+    }
+  }
+
+  // What tiff_tiles_begin() should pick.
+  predictor = !palette && bps != 32 && compression != TIFF_UNCOMPRESSED ?
+    PREDICTOR_HORIZONTAL : PREDICTOR_NONE;
+
+  set_tiff_export_layout(TIFF_COG, compression);
+  otif = XTIFFOpen(file, "w");
+  if (!otif)
+    asfPrintError("Could not create %s\n", file);
+  TIFFSetField(otif, TIFFTAG_IMAGEWIDTH, NS);
+  TIFFSetField(otif, TIFFTAG_IMAGELENGTH, NL);
+  TIFFSetField(otif, TIFFTAG_BITSPERSAMPLE, bps);
+  TIFFSetField(otif, TIFFTAG_SAMPLESPERPIXEL, 1);
+  TIFFSetField(otif, TIFFTAG_SAMPLEFORMAT,
+               bps == 32 ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
+  if (palette) {
+    for (ii = 0; ii < 256; ii++) {
+      colormap[ii] = ii * 257;
+      colormap[256 + ii] = (255 - ii) * 257;
+      colormap[512 + ii] = (ii * 7 % 256) * 257;
+    }
+    TIFFSetField(otif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_PALETTE);
+    TIFFSetField(otif, TIFFTAG_COLORMAP, colormap, colormap + 256,
+                 colormap + 512);
+  }
+  else
+    TIFFSetField(otif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+  TIFFSetField(otif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  tiff_tiles_begin(otif);
+  for (ii = 0; ii < NL; ii++)
+    tiff_tiles_write_line(otif, image + (size_t) ii*NS*pixel, ii);
+  tiff_tiles_finish(otif);
+  XTIFFClose(otif);
+
+  otif = XTIFFOpen(file, "r");
+  if (!otif)
+    asfPrintError("Could not read back %s\n", file);
+  level_image = image;
+  ns = NS;
+  nl = NL;
+  for (level = 0; ns > TILE || nl > TILE || level == 0; level++) {
+    unsigned char *next;
+
+    if (level > 0) {
+      next = reduce(level_image, ns, nl, bps, palette);
+      if (level_image != image)
+        FREE(level_image);
+      level_image = next;
+      ns = (ns + 1) / 2;
+      nl = (nl + 1) / 2;
+    }
+    if (!TIFFSetDirectory(otif, level)) {
+      printf("%s: there is no level %d\n", what, level);
+      bad++;
+      break;
+    }
+    bad += check_level(what, otif, level, level_image, ns, nl, bps,
+                       predictor);
+    if (palette) {
+      uint16 *red, *green, *blue;
+      if (!TIFFGetField(otif, TIFFTAG_COLORMAP, &red, &green, &blue) ||
+          memcmp(red, colormap, 256*sizeof(uint16)) != 0 ||
+          memcmp(green, colormap + 256, 256*sizeof(uint16)) != 0 ||
+          memcmp(blue, colormap + 512, 256*sizeof(uint16)) != 0) {
+        printf("%s: level %d lost its palette\n", what, level);
+        bad++;
+      }
+    }
+  }
+  if (TIFFSetDirectory(otif, level)) {
+    printf("%s: more than %d levels\n", what, level);
+    bad++;
+  }
+  XTIFFClose(otif);
+
+  printf("%s: %s\n", what, bad ? "FAILED" : "ok");
+  failures += bad;
+  remove(file);
+  if (level_image != image)
+    FREE(level_image);
+  FREE(image);
+}
+
+int main(int argc, char *argv[])
+{
+  set_tiff_export_thread_count(2);
+  tiles_test("LZW, 8 bit", TIFF_LZW, 8, FALSE);
+  tiles_test("LZW, 16 bit", TIFF_LZW, 16, FALSE);
+  tiles_test("LZW, float", TIFF_LZW, 32, FALSE);
+  tiles_test("DEFLATE, 8 bit", TIFF_DEFLATE, 8, FALSE);
+  tiles_test("DEFLATE, 16 bit", TIFF_DEFLATE, 16, FALSE);
+  tiles_test("DEFLATE, palette", TIFF_DEFLATE, 8, TRUE);
+  tiles_test("uncompressed, 8 bit", TIFF_UNCOMPRESSED, 8, FALSE);
+#ifdef COMPRESSION_ZSTD
+  if (TIFFIsCODECConfigured(COMPRESSION_ZSTD)) {
+    tiles_test("ZSTD, 8 bit", TIFF_ZSTD, 8, FALSE);
+    tiles_test("ZSTD, 16 bit", TIFF_ZSTD, 16, FALSE);
+  }
+  else
+    printf("ZSTD: not built into this libtiff, skipped\n");
+#endif
+
+  if (failures > 0) {
+    printf("%d checks FAILED\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
@@ -1,6 +1,13 @@
 #include "asf.h"
 #include "asf_export.h"
 
+// Tiled TIFFs collect their lines into tiles instead (see tiff_tiles.c).
+static void write_tiff_line(TIFF *otif, void *buf, int line)
+{
+  if (!tiff_tiles_write_line(otif, buf, line))
+    TIFFWriteScanline(otif, buf, line, 0);
+}
+
 void write_tiff_byte2byte(TIFF *otif, unsigned char *byte_line,
                           channel_stats_t stats, scale_t sample_mapping,
                           int sample_count, int line)
@@ -13,12 +20,12 @@ void write_tiff_byte2byte(TIFF *otif, unsigned char *byte_line,
                            stats.hist, stats.hist_pdf, NAN);
     }
   }
-  TIFFWriteScanline (otif, byte_line, line, 0);
+  write_tiff_line(otif, byte_line, line);
 }
 
 void write_tiff_float2float(TIFF *otif, float *float_line, int line)
 {
-  TIFFWriteScanline (otif, float_line, line, 0);
+  write_tiff_line(otif, float_line, line);
 }
 
 void write_tiff_float2int(TIFF *otif, float *float_line, int line, 
@@ -31,7 +38,7 @@ void write_tiff_float2int(TIFF *otif, float *float_line, int line,
 
   for (jj=0; jj<sample_count; jj++)
     int_line[jj] = (int) float_line[jj];
-  TIFFWriteScanline (otif, int_line, line, 0);
+  write_tiff_line(otif, int_line, line);
   FREE(int_line);
 }
 
@@ -49,7 +56,7 @@ void write_tiff_float2byte(TIFF *otif, float *float_line,
       pixel_float2byte(float_line[jj], sample_mapping, stats.min, stats.max,
                stats.hist, stats.hist_pdf, no_data);
   }
-  TIFFWriteScanline (otif, byte_line, line, 0);
+  write_tiff_line(otif, byte_line, line);
   FREE(byte_line);
 }
 
@@ -70,7 +77,7 @@ void write_rgb_tiff_byte2byte(TIFF *otif,
     rgb_byte_line[(jj*3)+1] = green_byte_line[jj];
     rgb_byte_line[(jj*3)+2] = blue_byte_line[jj];
   }
-  TIFFWriteScanline (otif, rgb_byte_line, line, 0);
+  write_tiff_line(otif, rgb_byte_line, line);
   FREE(rgb_byte_line);
 }
 
@@ -84,7 +91,7 @@ void write_tiff_byte2lut(TIFF *otif, unsigned char *byte_line,
   apply_look_up_table_byte(look_up_table_name, byte_line, sample_count,
                            rgb_line);
 
-  TIFFWriteScanline (otif, rgb_line, line, 0);
+  write_tiff_line(otif, rgb_line, line);
   FREE(rgb_line);
 }
 
@@ -104,7 +111,7 @@ void write_rgb_tiff_float2float(TIFF *otif,
     rgb_float_line[(jj*3)+1] = green_float_line[jj];
     rgb_float_line[(jj*3)+2] = blue_float_line[jj];
   }
-  TIFFWriteScanline (otif, rgb_float_line, line, 0);
+  write_tiff_line(otif, rgb_float_line, line);
   FREE(rgb_float_line);
 }
 
@@ -138,7 +145,7 @@ void write_rgb_tiff_float2byte(TIFF *otif,
                blue_stats.min, blue_stats.max, blue_stats.hist,
                blue_stats.hist_pdf, no_data);
   }
-  TIFFWriteScanline (otif, rgb_byte_line, line, 0);
+  write_tiff_line(otif, rgb_byte_line, line);
   FREE(rgb_byte_line);
 }
 
@@ -165,7 +172,7 @@ void write_tiff_float2lut(TIFF *otif, float *float_line,
   apply_look_up_table_byte(look_up_table_name, byte_line, sample_count,
               rgb_line);
 
-  TIFFWriteScanline (otif, rgb_line, line, 0);
+  write_tiff_line(otif, rgb_line, line);
   FREE(byte_line);
   FREE(rgb_line);
 }
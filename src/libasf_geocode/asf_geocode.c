@@ -356,107 +356,231 @@ struct data_to_fit {
   double *sparse_y_proj;
   double *sparse_x_pix;
   double *sparse_y_pix;
+
+  // Reverse mapping splines fitted to the sparse grid, see
+  // reverse_map_context_new.  NULL until the grid has been filled in.
+  struct reverse_map_context *rm;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-// Hold your nose...
+// Reverse mapping.
+//
+// The splines used to map from projection coordinates back to input
+// image pixel coordinates come in two parts.  The column splines run
+// vertically through the columns of the sparse grid; they are built
+// once per data_to_fit, and only read after that, so they live in a
+// reverse_map_context hung off the data_to_fit and are shared by
+// everybody.  The row splines run horizontally between the column
+// splines at a particular projection y coordinate; they have to be
+// rebuilt every time y changes, so every thread doing reverse mapping
+// keeps its own in a reverse_map_row_state.  (These all used to be
+// function scoped statics in reverse_map_x and reverse_map_y, which
+// made the mapping non-reentrant.)
 //
-// These used to be function scoped statics in reverse_map_x and
-// reverse_map_y routines, but that broke horribly when this program
-// got converted into a library function because they never got reset
-// between calls, so now these are globals so that we can reset them
-// all to their initial state when we get to the end of the function.
-// The little '_rmx' and '_rmy' suffixes help remind us that these
-// globals go with the reverse_map_x and reverse_map_y routines,
-// repsectively.
-
-  // True iff this is our first time through this routine.
-  static gboolean first_time_through_rmx = TRUE;
-  // Accelerators and interpolators for the all the vertical columns
-  // of sample points.  Filled in first time through routine.
-  static gsl_interp_accel **y_accel_rmx;
-  static gsl_spline **y_spline_rmx;
-  // Current accelerator and interpolator.  Updated when y argument is
-  // different between calls.
-  static gsl_interp_accel *crnt_accel_rmx;
-  static gsl_spline *crnt_rmx;
-  // Value of y for which current interpolator works.
-  static double last_y_rmx;
-
-  // True iff this is our first time through this routine.
-  static gboolean first_time_through_rmy = TRUE;
-  // Accelerators and interpolators for the all the vertical columns
-  // of sample points.  Filled in first time through routine.
-  static gsl_interp_accel **y_accel_rmy;
-  static gsl_spline **y_spline_rmy;
-  // Current accelerator and interpolator.  Updated when y argument is
-  // different between calls.
-  static gsl_interp_accel *crnt_accel_rmy;
-  static gsl_spline *crnt_rmy;
-  // Value of y for which current interpolator works.
-  static double last_y_rmy;
-
 ///////////////////////////////////////////////////////////////////////////////
 
-// Reverse map from projection coordinates x, y to input pixel
-// coordinate X.  This function looks at the data to fit on the first
-// time through, in order to set up vertical splines, after which this
-// argument is mostly ignored.  But not entirely, so you can't free or
-// change the dtf.  Mapping is efficient only if the y coordinates are
-// usually identical between calls, since when y changes a new spline
-// between splines has to be created.
-static double
-reverse_map_x (struct data_to_fit *dtf, double x, double y)
+struct reverse_map_context {
+  size_t sgs;                  // Sparse grid size (points on a side).
+  gsl_spline **x_col_splines;  // Input x pixel vs. projection y, per column.
+  gsl_spline **y_col_splines;  // Input y pixel vs. projection y, per column.
+  // State used by the single threaded reverse_map_x and reverse_map_y.
+  struct reverse_map_row_state *default_state;
+};
+
+struct reverse_map_row_state {
+  struct reverse_map_context *ctx;
+  // Our own accelerators for the shared column splines.
+  gsl_interp_accel **x_col_accels;
+  gsl_interp_accel **y_col_accels;
+  // Row splines for the current y, and their accelerators.
+  gsl_spline *x_row_spline;
+  gsl_spline *y_row_spline;
+  gsl_interp_accel *x_row_accel;
+  gsl_interp_accel *y_row_accel;
+  // Scratch space for the column spline values at the current y.
+  double *points;
+  // True iff the row splines have been set up for last_y.
+  gboolean have_row;
+  double last_y;
+};
+
+static struct reverse_map_row_state *
+reverse_map_row_state_new (struct reverse_map_context *ctx);
+static void
+reverse_map_row_state_free (struct reverse_map_row_state *rms);
+
+// Build the column splines for the sparse grid of dtf, which must
+// already be filled in.
+static struct reverse_map_context *
+reverse_map_context_new (struct data_to_fit *dtf)
 {
-  // Convenience aliases.
-  size_t sgs = dtf->sparse_grid_size;
-  double *xprojs = dtf->sparse_x_proj;
-  double *yprojs = dtf->sparse_y_proj;
-  double *xpixs = dtf->sparse_x_pix;
-
-  if ( G_UNLIKELY (first_time_through_rmx || y != last_y_rmx) ) {
-    if ( !first_time_through_rmx ) {
-      // Free the spline from the last line.
-      gsl_interp_accel_free (crnt_accel_rmx);
-      gsl_spline_free (crnt_rmx);
-    } else {
-      // Its our first time through, so set up the splines for the
-      // grid point columns.
-      y_accel_rmx = g_new (gsl_interp_accel *, sgs);
-      y_spline_rmx = g_new (gsl_spline *, sgs);
-      size_t ii;
-      for ( ii = 0 ; ii < sgs ; ii++ ) {
-  gsl_vector *cypv = gsl_vector_alloc (sgs);
-  gsl_vector *cxpixv = gsl_vector_alloc (sgs);
-  size_t jj;
-  for ( jj = 0 ; jj < sgs ; jj++ ) {
-    gsl_vector_set (cypv, jj, yprojs[jj * sgs + ii]);
-    gsl_vector_set (cxpixv, jj, xpixs[jj * sgs + ii]);
-  }
-  y_accel_rmx[ii] = gsl_interp_accel_alloc ();
-  y_spline_rmx[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
-  gsl_spline_init (y_spline_rmx[ii], cypv->data, cxpixv->data, sgs);
-  gsl_vector_free (cxpixv);
-  gsl_vector_free (cypv);
-      }
-      first_time_through_rmx = FALSE;
+  struct reverse_map_context *ctx = g_new (struct reverse_map_context, 1);
+  size_t sgs = dtf->sparse_grid_size;   // Convenience alias.
+
+  ctx->sgs = sgs;
+  ctx->x_col_splines = g_new (gsl_spline *, sgs);
+  ctx->y_col_splines = g_new (gsl_spline *, sgs);
+
+  double *cyp = g_new (double, sgs);     // Current y projection values.
+  double *cxpix = g_new (double, sgs);   // Current x pixel values.
+  double *cypix = g_new (double, sgs);   // Current y pixel values.
+  size_t ii, jj;
+  for ( ii = 0 ; ii < sgs ; ii++ ) {
+    for ( jj = 0 ; jj < sgs ; jj++ ) {
+      cyp[jj] = dtf->sparse_y_proj[jj * sgs + ii];
+      cxpix[jj] = dtf->sparse_x_pix[jj * sgs + ii];
+      cypix[jj] = dtf->sparse_y_pix[jj * sgs + ii];
     }
-    // Set up the spline that runs horizontally, between the column
-    // splines.
-    crnt_accel_rmx = gsl_interp_accel_alloc ();
-    crnt_rmx = gsl_spline_alloc (gsl_interp_cspline, sgs);
-    double *crnt_points = g_new (double, sgs);
-    size_t ii;
-    for ( ii = 0 ; ii < sgs ; ii++ ) {
-      crnt_points[ii] = gsl_spline_eval_check (y_spline_rmx[ii], y, y_accel_rmx[ii]);
+    ctx->x_col_splines[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
+    gsl_spline_init (ctx->x_col_splines[ii], cyp, cxpix, sgs);
+    ctx->y_col_splines[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
+    gsl_spline_init (ctx->y_col_splines[ii], cyp, cypix, sgs);
+  }
+  g_free (cypix);
+  g_free (cxpix);
+  g_free (cyp);
+
+  ctx->default_state = NULL;
+  ctx->default_state = reverse_map_row_state_new (ctx);
+
+  return ctx;
+}
+
+static void
+reverse_map_context_free (struct reverse_map_context *ctx)
+{
+  reverse_map_row_state_free (ctx->default_state);
+
+  size_t ii;
+  for ( ii = 0 ; ii < ctx->sgs ; ii++ ) {
+    gsl_spline_free (ctx->x_col_splines[ii]);
+    gsl_spline_free (ctx->y_col_splines[ii]);
+  }
+  g_free (ctx->x_col_splines);
+  g_free (ctx->y_col_splines);
+  g_free (ctx);
+}
+
+// Create a new row state for use with the splines in ctx.  Each
+// thread doing reverse mapping needs its own.
+static struct reverse_map_row_state *
+reverse_map_row_state_new (struct reverse_map_context *ctx)
+{
+  struct reverse_map_row_state *rms = g_new (struct reverse_map_row_state, 1);
+  size_t sgs = ctx->sgs;   // Convenience alias.
+
+  rms->ctx = ctx;
+  rms->x_col_accels = g_new (gsl_interp_accel *, sgs);
+  rms->y_col_accels = g_new (gsl_interp_accel *, sgs);
+  size_t ii;
+  for ( ii = 0 ; ii < sgs ; ii++ ) {
+    rms->x_col_accels[ii] = gsl_interp_accel_alloc ();
+    rms->y_col_accels[ii] = gsl_interp_accel_alloc ();
+  }
+  rms->x_row_spline = gsl_spline_alloc (gsl_interp_cspline, sgs);
+  rms->y_row_spline = gsl_spline_alloc (gsl_interp_cspline, sgs);
+  rms->x_row_accel = gsl_interp_accel_alloc ();
+  rms->y_row_accel = gsl_interp_accel_alloc ();
+  rms->points = g_new (double, sgs);
+  rms->have_row = FALSE;
+  rms->last_y = 0;
+
+  return rms;
+}
+
+static void
+reverse_map_row_state_free (struct reverse_map_row_state *rms)
+{
+  size_t ii;
+  for ( ii = 0 ; ii < rms->ctx->sgs ; ii++ ) {
+    gsl_interp_accel_free (rms->x_col_accels[ii]);
+    gsl_interp_accel_free (rms->y_col_accels[ii]);
+  }
+  g_free (rms->x_col_accels);
+  g_free (rms->y_col_accels);
+  gsl_spline_free (rms->x_row_spline);
+  gsl_spline_free (rms->y_row_spline);
+  gsl_interp_accel_free (rms->x_row_accel);
+  gsl_interp_accel_free (rms->y_row_accel);
+  g_free (rms->points);
+  g_free (rms);
+}
+
+// Make sure the row splines in rms are the ones for projection y
+// coordinate y.  The x projection coordinates of the sparse grid
+// columns are taken from xprojs.
+static void
+reverse_map_set_row (struct reverse_map_row_state *rms, const double *xprojs,
+                     double y)
+{
+  if ( G_LIKELY (rms->have_row && y == rms->last_y) ) {
+    return;
+  }
+
+  struct reverse_map_context *ctx = rms->ctx;
+  size_t sgs = ctx->sgs;
+  size_t ii;
+
+  for ( ii = 0 ; ii < sgs ; ii++ ) {
+    rms->points[ii] = gsl_spline_eval_check (ctx->x_col_splines[ii], y,
+                                             rms->x_col_accels[ii]);
+  }
+  gsl_spline_init (rms->x_row_spline, xprojs, rms->points, sgs);
+  gsl_interp_accel_reset (rms->x_row_accel);
+
+  for ( ii = 0 ; ii < sgs ; ii++ ) {
+    rms->points[ii] = gsl_spline_eval_check (ctx->y_col_splines[ii], y,
+                                             rms->y_col_accels[ii]);
+  }
+  gsl_spline_init (rms->y_row_spline, xprojs, rms->points, sgs);
+  gsl_interp_accel_reset (rms->y_row_accel);
+
+  rms->have_row = TRUE;
+  rms->last_y = y;
+}
+
+// Reverse map the n points with projection coordinates (x[ii], y) on
+// a single row to input image pixel coordinates x_pix[ii], y_pix[ii].
+// The row splines are built at most once for the whole row.
+static void
+reverse_map_row (struct data_to_fit *dtf, struct reverse_map_row_state *rms,
+                 double y, const double *x, size_t n, double *x_pix,
+                 double *y_pix)
+{
+  reverse_map_set_row (rms, dtf->sparse_x_proj, y);
+
+  size_t ii;
+  for ( ii = 0 ; ii < n ; ii++ ) {
+    x_pix[ii] = gsl_spline_eval_check (rms->x_row_spline, x[ii],
+                                       rms->x_row_accel);
+    y_pix[ii] = gsl_spline_eval_check (rms->y_row_spline, x[ii],
+                                       rms->y_row_accel);
+    if (!meta_is_valid_double(x_pix[ii])) {
+      asfPrintError("reverse_map_x invalid at L,S: %f,%f: %f\n",
+                    y, x[ii], x_pix[ii]);
+    }
+    if (!meta_is_valid_double(y_pix[ii])) {
+      asfPrintError("reverse_map_y invalid at L,S %f,%f: %f\n",
+                    y, x[ii], y_pix[ii]);
     }
-    gsl_spline_init (crnt_rmx, xprojs, crnt_points, sgs);
-    g_free (crnt_points);
-    last_y_rmx = y;
   }
+}
+
+// Reverse map from projection coordinates x, y to input pixel
+// coordinate X.  Mapping is efficient only if the y coordinates are
+// usually identical between calls, since when y changes new splines
+// between splines have to be created.  Uses the single threaded
+// default state of the data to fit, so use reverse_map_row with a
+// state of your own from other threads.
+static double
+reverse_map_x (struct data_to_fit *dtf, double x, double y)
+{
+  struct reverse_map_row_state *rms = dtf->rm->default_state;
 
-  double ret = gsl_spline_eval_check (crnt_rmx, x, crnt_accel_rmx);
+  reverse_map_set_row (rms, dtf->sparse_x_proj, y);
+
+  double ret = gsl_spline_eval_check (rms->x_row_spline, x, rms->x_row_accel);
 
   if (!meta_is_valid_double(ret)) {
     asfPrintError("reverse_map_x invalid at L,S: %f,%f: %f\n", y,x,ret);
@@ -470,55 +594,11 @@ reverse_map_x (struct data_to_fit *dtf, double x, double y)
 static double
 reverse_map_y (struct data_to_fit *dtf, double x, double y)
 {
-  size_t sgs = dtf->sparse_grid_size;
-  double *xprojs = dtf->sparse_x_proj;
-  double *yprojs = dtf->sparse_y_proj;
-  double *ypixs = dtf->sparse_y_pix;
-
-  if ( G_UNLIKELY (first_time_through_rmy || y != last_y_rmy) ) {
-    if ( !first_time_through_rmy ) {
-      // Free the spline from the last line.
-      gsl_interp_accel_free (crnt_accel_rmy);
-      gsl_spline_free (crnt_rmy);
-    } else {
-      // Its our first time through, so set up the splines for the
-      // grid point columns.
-      y_accel_rmy = g_new (gsl_interp_accel *, sgs);
-      y_spline_rmy = g_new (gsl_spline *, sgs);
-      size_t ii;
-      for ( ii = 0 ; ii < sgs ; ii++ ) {
-  // Current y projection value.
-  gsl_vector *cypv = gsl_vector_alloc (sgs);
-  // Current y pixel value.
-  gsl_vector *cypixv = gsl_vector_alloc (sgs);
-  size_t jj;
-  for ( jj = 0 ; jj < sgs ; jj++ ) {
-    gsl_vector_set (cypv, jj, yprojs[jj * sgs + ii]);
-    gsl_vector_set (cypixv, jj, ypixs[jj * sgs + ii]);
-  }
-  y_accel_rmy[ii] = gsl_interp_accel_alloc ();
-  y_spline_rmy[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
-  gsl_spline_init (y_spline_rmy[ii], cypv->data, cypixv->data, sgs);
-  gsl_vector_free (cypixv);
-  gsl_vector_free (cypv);
-      }
-      first_time_through_rmy = FALSE;
-    }
-    // Set up the spline that runs horizontally, between the column
-    // splines.
-    crnt_accel_rmy = gsl_interp_accel_alloc ();
-    crnt_rmy = gsl_spline_alloc (gsl_interp_cspline, sgs);
-    double *crnt_points = g_new (double, sgs);
-    size_t ii;
-    for ( ii = 0 ; ii < sgs ; ii++ ) {
-      crnt_points[ii] = gsl_spline_eval_check (y_spline_rmy[ii], y, y_accel_rmy[ii]);
-    }
-    gsl_spline_init (crnt_rmy, xprojs, crnt_points, sgs);
-    g_free (crnt_points);
-    last_y_rmy = y;
-  }
+  struct reverse_map_row_state *rms = dtf->rm->default_state;
 
-  double ret = gsl_spline_eval_check (crnt_rmy, x, crnt_accel_rmy);
+  reverse_map_set_row (rms, dtf->sparse_x_proj, y);
+
+  double ret = gsl_spline_eval_check (rms->y_row_spline, x, rms->y_row_accel);
 
   if (!meta_is_valid_double(ret)) {
     asfPrintError("reverse_map_y invalid at L,S %f,%f: %f\n", y, x, ret);
@@ -670,6 +750,344 @@ static float dem_sample(FloatImage *dem, float x, float y,
     return 0; // not reached
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// Multithreaded resampling.
+//
+// When we are writing the output line by line (i.e. we aren't
+// mosaicking) and working in floating point, the output rows don't
+// depend on each other, so they can be resampled by a pool of worker
+// threads.  The workers share the input image through its concurrent
+// tile cache, so each input tile is only loaded once however many
+// threads need it, and announce the footprint of each row to its
+// prefetch thread before sampling it.  Each worker has its own
+// reverse mapping splines, and puts finished rows into a ring of row
+// buffers.  The calling thread takes the rows out of the ring in
+// order and writes them, so the output is identical to what the
+// single threaded loop in asf_mosaic produces.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Number of threads to use for resampling.  1 means use the original
+// single threaded loop, 0 means use one thread per processor.
+static int geocode_thread_count = 1;
+
+void set_geocode_thread_count(int thread_count)
+{
+  asfRequire(thread_count >= 0, "Invalid geocoding thread count: %d\n",
+             thread_count);
+  geocode_thread_count = thread_count;
+}
+
+int get_geocode_thread_count(void)
+{
+  if (geocode_thread_count == 0)
+    return g_get_num_processors();
+  return geocode_thread_count;
+}
+
+// State shared by the calling thread and all the workers.
+typedef struct {
+  // Read-only after setup.
+  struct data_to_fit *dtf;
+  meta_parameters *imd;
+  meta_parameters *omd;
+  size_t oix_max, oiy_max;
+  size_t ii_size_x, ii_size_y;
+  float_image_sample_method_t sample_method;
+  float background_val;
+  gboolean save_mapping;
+
+  // Everything below is protected by lock.
+  GMutex lock;
+  GCond row_done;        // A worker finished a row.
+  GCond slot_free;       // The writer wrote a row, freeing its slot.
+  size_t next_row;       // Next row to be handed out to a worker.
+  size_t rows_written;   // Number of rows written so far.
+  size_t ring_size;      // Number of row slots.
+  float **rows;          // Resampled rows, indexed by row % ring_size.
+  float **line_rows;     // Line mapping rows (only with save_mapping).
+  float **samp_rows;     // Sample mapping rows (only with save_mapping).
+  long *negative;        // BYTE out of range counts for each slot.
+  long *positive;
+  gboolean *row_ready;   // True iff the row in the slot is finished.
+} resample_shared_t;
+
+// What each worker gets.
+typedef struct {
+  resample_shared_t *shared;
+  FloatImage *iim;       // The input image, shared by all workers.
+  struct reverse_map_row_state *rms;
+  double *proj_x;        // Projection x coordinates of the output columns.
+  double *input_x_pixels;
+  double *input_y_pixels;
+} resample_worker_t;
+
+// Resample output row oiy into the slot buffers.  This does exactly
+// what the single threaded loop in asf_mosaic does for the first (and
+// only) input image when output_by_line is set and the image isn't
+// processed as byte.
+static void
+resample_row (resample_worker_t *w, size_t oiy, float *output_line,
+              float *line_out, float *samp_out, long *negative,
+              long *positive)
+{
+  resample_shared_t *sh = w->shared;
+  meta_parameters *imd = sh->imd;
+  meta_parameters *omd = sh->omd;
+  size_t ii_size_x = sh->ii_size_x;
+  size_t ii_size_y = sh->ii_size_y;
+  size_t oix;
+
+  *negative = *positive = 0;
+
+  // Input image pixel coordinates for the whole row.
+  double oiy_pc = omd->projection->startY + oiy * omd->projection->perY;
+  reverse_map_row (sh->dtf, w->rms, oiy_pc, w->proj_x, sh->oix_max,
+                   w->input_x_pixels, w->input_y_pixels);
+
+  // Let the input image start loading the footprint of the row while
+  // we work through it.  Rows can run diagonally across the input, so
+  // we announce the neighborhoods (big enough for the bicubic kernel)
+  // of points along the row, rather than its bounding box, skipping
+  // points that are close to the last one announced.
+  double last_x = -1e9, last_y = -1e9;
+  for ( oix = 0 ; oix < sh->oix_max ; oix += 8 ) {
+    double x = w->input_x_pixels[oix], y = w->input_y_pixels[oix];
+    if ( !(x > -10 && x < ii_size_x + 10 && y > -10 && y < ii_size_y + 10) ) {
+      continue;
+    }
+    if ( fabs (x - last_x) > 8 || fabs (y - last_y) > 8 ) {
+      float_image_prefetch_region (w->iim, (ssize_t) x - 10,
+                                   (ssize_t) y - 10, 21, 21);
+      last_x = x;
+      last_y = y;
+    }
+  }
+
+  for ( oix = 0 ; oix < sh->oix_max ; oix++ ) {
+
+    double input_x_pixel = w->input_x_pixels[oix];
+    double input_y_pixel = w->input_y_pixels[oix];
+
+    gboolean outside = input_x_pixel < 0 ||
+      input_x_pixel > (ssize_t) ii_size_x - 1.0 ||
+      input_y_pixel < 0 ||
+      input_y_pixel > (ssize_t) ii_size_y - 1.0;
+
+    if (line_out)
+      line_out[oix] = outside ? 0 : input_y_pixel;
+    if (samp_out)
+      samp_out[oix] = outside ? 0 : input_x_pixel;
+
+    if (outside) {
+      output_line[oix] = sh->background_val;
+      continue;
+    }
+
+    float value;
+    if ( imd->general->image_data_type == DEM ) {
+      value = dem_sample(w->iim, input_x_pixel, input_y_pixel,
+                         sh->sample_method);
+    }
+    else {
+      if (imd->general->radiometry >= r_SIGMA_DB &&
+          imd->general->radiometry <= r_GAMMA_DB) {
+        float power = float_image_sample(w->iim, input_x_pixel,
+                                         input_y_pixel, sh->sample_method);
+        value = 10.0 * log10(power);
+      }
+      else
+        value = float_image_sample(w->iim, input_x_pixel, input_y_pixel,
+                                   sh->sample_method);
+
+      if (omd->general->data_type == ASF_BYTE && value < 0.0) {
+        value = 0.0;
+        (*negative)++;
+      }
+      if (omd->general->data_type == ASF_BYTE && value > 255.0) {
+        value = 255.0;
+        (*positive)++;
+      }
+    }
+
+    // With a single input image, "no data" and valid pixels alike end
+    // up in the output unchanged.
+    output_line[oix] = value;
+  }
+}
+
+static gpointer
+resample_worker (gpointer data)
+{
+  resample_worker_t *w = (resample_worker_t *) data;
+  resample_shared_t *sh = w->shared;
+
+  for ( ; ; ) {
+    // Grab the next row, as long as there is room for it in the ring.
+    g_mutex_lock (&sh->lock);
+    while (sh->next_row < sh->oiy_max &&
+           sh->next_row >= sh->rows_written + sh->ring_size)
+      g_cond_wait (&sh->slot_free, &sh->lock);
+    if (sh->next_row >= sh->oiy_max) {
+      g_mutex_unlock (&sh->lock);
+      break;
+    }
+    size_t oiy = sh->next_row++;
+    g_mutex_unlock (&sh->lock);
+
+    size_t slot = oiy % sh->ring_size;
+    resample_row (w, oiy, sh->rows[slot],
+                  sh->save_mapping ? sh->line_rows[slot] : NULL,
+                  sh->save_mapping ? sh->samp_rows[slot] : NULL,
+                  &sh->negative[slot], &sh->positive[slot]);
+
+    g_mutex_lock (&sh->lock);
+    sh->row_ready[slot] = TRUE;
+    g_cond_broadcast (&sh->row_done);
+    g_mutex_unlock (&sh->lock);
+  }
+
+  return NULL;
+}
+
+// Resample band kk of the input image iim into the output files, using
+// thread_count worker threads.  The line and sample mapping files are
+// written too if outLineFp and outSampFp are non-NULL, and the rows are
+// added to out_stats if that is.
+static void
+resample_band_threaded (int thread_count, struct data_to_fit *dtf,
+                        meta_parameters *imd, meta_parameters *omd,
+                        FloatImage *iim, size_t oix_max, size_t oiy_max,
+                        float_image_sample_method_t sample_method,
+                        float background_val, FILE *outFp,
+                        FILE *outLineFp, FILE *outSampFp,
+                        band_stats_t *out_stats,
+                        unsigned long *out_of_range_negative,
+                        unsigned long *out_of_range_positive)
+{
+  resample_shared_t sh;
+  size_t ii;
+  int jj;
+
+  sh.dtf = dtf;
+  sh.imd = imd;
+  sh.omd = omd;
+  sh.oix_max = oix_max;
+  sh.oiy_max = oiy_max;
+  sh.ii_size_x = imd->general->sample_count;
+  sh.ii_size_y = imd->general->line_count;
+  sh.sample_method = sample_method;
+  sh.background_val = background_val;
+  sh.save_mapping = outLineFp != NULL && outSampFp != NULL;
+
+  g_mutex_init (&sh.lock);
+  g_cond_init (&sh.row_done);
+  g_cond_init (&sh.slot_free);
+  sh.next_row = 0;
+  sh.rows_written = 0;
+
+  // A few rows per worker keeps everybody busy while the writer
+  // catches up, without holding much of the image in memory.
+  sh.ring_size = 4 * thread_count;
+  sh.rows = g_new (float *, sh.ring_size);
+  sh.line_rows = g_new0 (float *, sh.ring_size);
+  sh.samp_rows = g_new0 (float *, sh.ring_size);
+  sh.negative = g_new0 (long, sh.ring_size);
+  sh.positive = g_new0 (long, sh.ring_size);
+  sh.row_ready = g_new0 (gboolean, sh.ring_size);
+  for ( ii = 0 ; ii < sh.ring_size ; ii++ ) {
+    sh.rows[ii] = g_new (float, oix_max);
+    if (sh.save_mapping) {
+      sh.line_rows[ii] = g_new (float, oix_max);
+      sh.samp_rows[ii] = g_new (float, oix_max);
+    }
+  }
+
+  float_image_set_concurrent (iim, TRUE);
+  float_image_set_prefetch (iim, TRUE);
+  resample_worker_t *workers = g_new (resample_worker_t, thread_count);
+  GThread **threads = g_new (GThread *, thread_count);
+  // The projection x coordinates are the same for every row.
+  double *proj_x = g_new (double, oix_max);
+  for ( ii = 0 ; ii < oix_max ; ii++ )
+    proj_x[ii] = omd->projection->startX + ii * omd->projection->perX;
+  for ( jj = 0 ; jj < thread_count ; jj++ ) {
+    workers[jj].shared = &sh;
+    workers[jj].iim = iim;
+    workers[jj].rms = reverse_map_row_state_new (dtf->rm);
+    workers[jj].proj_x = proj_x;
+    workers[jj].input_x_pixels = g_new (double, oix_max);
+    workers[jj].input_y_pixels = g_new (double, oix_max);
+  }
+  for ( jj = 0 ; jj < thread_count ; jj++ ) {
+    threads[jj] = g_thread_new ("geocode", resample_worker, &workers[jj]);
+  }
+
+  // Write the rows in order as they become available.
+  size_t oiy;
+  for ( oiy = 0 ; oiy < oiy_max ; oiy++ ) {
+    size_t slot = oiy % sh.ring_size;
+
+    asfLineMeter(oiy, oiy_max);
+
+    g_mutex_lock (&sh.lock);
+    while (!sh.row_ready[slot])
+      g_cond_wait (&sh.row_done, &sh.lock);
+    g_mutex_unlock (&sh.lock);
+
+    put_float_line(outFp, omd, oiy, sh.rows[slot]);
+    if (out_stats)
+      band_stats_add(out_stats, sh.rows[slot], oix_max);
+    if (sh.save_mapping) {
+      put_float_line(outLineFp, omd, oiy, sh.line_rows[slot]);
+      put_float_line(outSampFp, omd, oiy, sh.samp_rows[slot]);
+    }
+    *out_of_range_negative += sh.negative[slot];
+    *out_of_range_positive += sh.positive[slot];
+
+    g_mutex_lock (&sh.lock);
+    sh.row_ready[slot] = FALSE;
+    sh.rows_written++;
+    g_cond_broadcast (&sh.slot_free);
+    g_mutex_unlock (&sh.lock);
+  }
+
+  for ( jj = 0 ; jj < thread_count ; jj++ ) {
+    g_thread_join (threads[jj]);
+    reverse_map_row_state_free (workers[jj].rms);
+    g_free (workers[jj].input_x_pixels);
+    g_free (workers[jj].input_y_pixels);
+  }
+  float_image_cache_stats stats;
+  float_image_get_cache_stats (iim, &stats);
+  asfPrintStatus ("Input tile cache: %llu misses for %llu tiles, "
+                  "%llu of %llu prefetched tiles used.\n",
+                  (unsigned long long) stats.misses,
+                  (unsigned long long) iim->tile_count,
+                  (unsigned long long) stats.prefetch_hits,
+                  (unsigned long long) stats.prefetches);
+  float_image_set_concurrent (iim, FALSE);
+  g_free (proj_x);
+  g_free (threads);
+  g_free (workers);
+
+  for ( ii = 0 ; ii < sh.ring_size ; ii++ ) {
+    g_free (sh.rows[ii]);
+    g_free (sh.line_rows[ii]);
+    g_free (sh.samp_rows[ii]);
+  }
+  g_free (sh.rows);
+  g_free (sh.line_rows);
+  g_free (sh.samp_rows);
+  g_free (sh.negative);
+  g_free (sh.positive);
+  g_free (sh.row_ready);
+  g_cond_clear (&sh.slot_free);
+  g_cond_clear (&sh.row_done);
+  g_mutex_clear (&sh.lock);
+}
+
 int asf_geocode_utm(resample_method_t resample_method, double average_height,
                     datum_type_t datum, double pixel_size,
                     char *band_id, char *in_base_name, char *out_base_name,
@@ -1557,8 +1975,8 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
   if (omd->stats != NULL) {
     // Geocoding results in resampling.  Consequently, the stats info
     // that may have existed in the metadata is no longer accurate.
-    // Best to remove it now and let it get recalculated 'just in time'
-    // when some other later process needs it.
+    // Best to remove it now.  New stats are gathered below, while the
+    // output is written.
     FREE(omd->stats);
     omd->stats = NULL;
   }
@@ -1712,6 +2130,8 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 
   double *projX = MALLOC(sizeof(double)*oix_max);
   double *projY = MALLOC(sizeof(double)*oix_max);
+  double *pixX = MALLOC(sizeof(double)*oix_max);
+  double *pixY = MALLOC(sizeof(double)*oix_max);
 
   // When mosaicing -- use banded_float_image to store the output, write
   //                   it out after processing all inputs
@@ -1726,6 +2146,20 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
   float *output_line = NULL;
   int output_by_line = n_input_images == 1;
 
+  // Gather the statistics of the output bands as they are written, so
+  // that later steps (asf_export's byte scaling, for one) can take them
+  // from the metadata instead of making another pass over the image.
+  // Only float output is done: anything else (optical data included) is
+  // rounded and clipped on the way out, so its stats would be a little off.
+  band_stats_t *out_stats = NULL;
+  if (omd->general->data_type == REAL32 && !omd->optical) {
+    int kk;
+    out_stats = (band_stats_t *)
+      MALLOC(sizeof(band_stats_t) * omd->general->band_count);
+    for (kk=0; kk<omd->general->band_count; ++kk)
+      band_stats_init(&out_stats[kk], omd->general->no_data);
+  }
+
   if (n_input_images > 1) {
     output_bfi = banded_float_image_new(n_bands, oix_max, oiy_max);
     if (!output_bfi) {
@@ -1932,6 +2366,7 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
       dtf.sparse_y_proj = g_new0 (double, sparse_mapping_count);
       dtf.sparse_x_pix = g_new0 (double, sparse_mapping_count);
       dtf.sparse_y_pix = g_new0 (double, sparse_mapping_count);
+      dtf.rm = NULL;
       // Spacing between grid points, in output projection coordinates.
       double x_spacing = x_range_size / (grid_size - 1);
       double y_spacing = y_range_size / (grid_size - 1);
@@ -2029,6 +2464,9 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
         }
       }
       
+      // Fit the column splines of the model, once for all the bands.
+      dtf.rm = reverse_map_context_new (&dtf);
+
       // Here are some convenience macros for the spline model.
 #define X_PIXEL(x, y) reverse_map_x (&dtf, x, y)
 #define Y_PIXEL(x, y) reverse_map_y (&dtf, x, y)
@@ -2370,27 +2808,46 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 		
 					// Set the pixels of the output image.
 					size_t oix, oiy;    // Output image pixel indicies.
-					for (oiy = 0 ; oiy < oiy_max ; oiy++) {
+					// With more than one thread, the rows are resampled by
+					// resample_band_threaded, and the loop below has nothing
+					// left to do.
+					size_t oiy_first = 0;
+					int thread_count = get_geocode_thread_count();
+					if (thread_count > 1 && output_by_line && !process_as_byte) {
+						asfPrintStatus("Using %d threads.\n", thread_count);
+						resample_band_threaded(thread_count, &dtf, imd, omd, iim,
+							oix_max, oiy_max, float_image_sample_method, background_val,
+							outFp, outLineFp, outSampFp,
+							out_stats ? &out_stats[multiband ? kk : 0] : NULL,
+							&out_of_range_negative, &out_of_range_positive);
+						oiy_first = oiy_max;
+					}
+					for (oiy = oiy_first ; oiy < oiy_max ; oiy++) {
 			
 						asfLineMeter(oiy, oiy_max);
 			
 						int oix_first_valid = -1;
 						int oix_last_valid = -1;
 			
+						// Projection coordinates for the centers of the pixels
+						// in this row.
+						double oiy_pc = omd->projection->startY + oiy * omd->projection->perY;
 						for ( oix = 0 ; oix < oix_max ; oix++ ) {
+							projX[oix] = omd->projection->startX + oix * omd->projection->perX;
+							projY[oix] = oiy_pc;
+						}
 
-							// Projection coordinates for the center of this pixel.
-										double oix_pc = omd->projection->startX + oix * omd->projection->perX;
-										double oiy_pc = omd->projection->startY + oiy * omd->projection->perY;
+						// Determine pixels of interest in input image, for the
+						// whole row at once.  The fractional part is desired, we
+						// will use some sampling method to interpolate between
+						// pixel values.
+						reverse_map_row (&dtf, dtf.rm->default_state, oiy_pc, projX,
+														 oix_max, pixX, pixY);
 
-							projX[oix] = oix_pc;
-							projY[oix] = oiy_pc;
-				
-							// Determine pixel of interest in input image.  The fractional
-							// part is desired, we will use some sampling method to
-							// interpolate between pixel values.
-							double input_x_pixel = X_PIXEL (oix_pc, oiy_pc);
-							double input_y_pixel = Y_PIXEL (oix_pc, oiy_pc);
+						for ( oix = 0 ; oix < oix_max ; oix++ ) {
+
+							double input_x_pixel = pixX[oix];
+							double input_y_pixel = pixY[oix];
 	
 							if (line_out) {
 								if (input_y_pixel < 0 || input_x_pixel < 0)
@@ -2590,6 +3047,9 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 	    // write the line, if we're doing line-by-line output
 	    if (output_by_line) {
               put_float_line(outFp, omd, oiy, output_line);
+	      if (out_stats)
+		band_stats_add(&out_stats[multiband ? kk : 0],
+			       output_line, oix_max);
 	    }
 	    
 	    if (line_out)
@@ -2640,29 +3100,12 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
       
       /////////////////////////////////////////////////////////////////////////
       //
-      // Clear out all the persistent spline memory goop used by the
-      // reverse_map_x and reverse_map_y routines (see comments near the
-      // declarations of these variables).
+      // Clear out all the spline memory goop used by the reverse
+      // mapping routines.
       //
       
-      size_t sgs = dtf.sparse_grid_size; // Convenience alias.
-      
-      first_time_through_rmx = TRUE;
-      first_time_through_rmy = TRUE;
-      for ( ii = 0 ; ii < sgs ; ii++ ) {
-				gsl_interp_accel_free (y_accel_rmx[ii]);
-				gsl_interp_accel_free (y_accel_rmy[ii]);
-				gsl_spline_free (y_spline_rmx[ii]);
-				gsl_spline_free (y_spline_rmy[ii]);
-      }
-      g_free (y_accel_rmx);
-      g_free (y_accel_rmy);
-      g_free (y_spline_rmx);
-      g_free (y_spline_rmy);
-      gsl_interp_accel_free (crnt_accel_rmx);
-      gsl_interp_accel_free (crnt_accel_rmy);
-      gsl_spline_free (crnt_rmx);
-      gsl_spline_free (crnt_rmy);
+      reverse_map_context_free (dtf.rm);
+      dtf.rm = NULL;
       
       /////////////////////////////////////////////////////////////////////////
       // Done with the data being modeled.
@@ -2693,6 +3136,8 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 
   free(projX);
   free(projY);
+  free(pixX);
+  free(pixY);
 
   if (output_by_line)
     free(output_line);
@@ -2714,6 +3159,15 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 			}
 			FloatImage *fi = banded_float_image_get_band(output_bfi, kk);
 			float_image_band_store(fi, output_image, omd, kk>0);
+			if (out_stats) {
+				float *row = MALLOC(sizeof(float) * fi->size_x);
+				size_t oiy;
+				for (oiy = 0 ; oiy < fi->size_y ; oiy++) {
+					float_image_get_row(fi, oiy, row);
+					band_stats_add(&out_stats[kk], row, fi->size_x);
+				}
+				FREE(row);
+			}
 		}
 		banded_float_image_free(output_bfi);
 		if (tbi) {
@@ -2736,6 +3190,23 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
         out_of_range_positive, pct_too_positive);
   }
 
+  if (out_stats) {
+    int kk;
+    char **out_band_name =
+      extract_band_names(omd->general->bands, omd->general->band_count);
+    omd->stats = meta_statistics_init(omd->general->band_count);
+    for (kk=0; kk<omd->general->band_count; ++kk)
+      band_stats_to_meta(&out_stats[kk],
+                         out_band_name ? out_band_name[kk] : "01",
+                         &omd->stats->band_stats[kk]);
+    if (out_band_name) {
+      for (kk=0; kk<omd->general->band_count; ++kk)
+        FREE(out_band_name[kk]);
+      FREE(out_band_name);
+    }
+    FREE(out_stats);
+  }
+
   meta_write (omd, output_meta_data);
   meta_free (omd);
 
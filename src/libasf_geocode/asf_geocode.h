@@ -140,6 +140,12 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
                char *out_base_name, float background_val, double lat_min,
                double lat_max, double lon_min, double lon_max,
 	       const char *overlap, int save_line_sample_mapping);
+// Set the number of threads used to resample the output image when
+// geocoding a single input image.  The default, 1, resamples on the
+// calling thread; 0 means use one thread per processor.  The output is
+// the same for any thread count.
+void set_geocode_thread_count(int thread_count);
+int get_geocode_thread_count(void);
 void sigsegv_handler (int signal_number);
 int geoid_adjust(const char *input, const char *output);
 void test_geoid(void);
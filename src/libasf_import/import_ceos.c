@@ -1298,7 +1298,8 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
   unsigned char *amp_byte_buf=NULL;
   float *amp_float_buf=NULL;
   float *phase_float_buf=NULL;
-  float *incid=NULL;
+  float *incid=NULL, *incid_line=NULL;
+  cal_kernel *cal=NULL;
   complexFloat cpx, *cpxFloat_buf=NULL, *cpx_float_ml_buf=NULL;
 
   // Output file will stay open through multiple calls to this function.
@@ -1650,6 +1651,15 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
     incid = incid_init(meta);
   }
 
+  // Compile the calibration for the scene up front, and calibrate a line
+  // at a time.  Geocoded images get their incidence angles per line.
+  if (meta->sar && radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB &&
+      (data_type >= COMPLEX_BYTE || !lutName)) {
+    cal = cal_kernel_new(meta, bandExt, projected ? NULL : incid, db_flag);
+    if (projected)
+      incid_line = (float *) MALLOC(sizeof(float)*ns);
+  }
+
   // Check whether image needs to be flipped
   if (meta->general->orbit_direction == 'D' &&
       (!meta->projection || meta->projection->type != SCANSAR_PROJECTION) &&
@@ -1834,16 +1844,7 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
               cpx_float_ml_buf[ll*ns + kk].imag = cpx.imag;
             }
             else {
-                double incidence_angle;
-                if (projected) {
-		  incidence_angle = quadratic_2_incidence_angle(ll, kk, incid);
-                }
-                else {
-		  incidence_angle = incid[kk];
-                }
-                amp_float_buf[ll*ns + kk] = 
-		  get_cal_dn(meta, incidence_angle, kk, fValue, bandExt, 
-			     db_flag);
+                amp_float_buf[ll*ns + kk] = fValue;
                 phase_float_buf[ll*ns + kk] =  atan2(cpx.imag, cpx.real);
             }
           }
@@ -1871,6 +1872,14 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
             }
           }
         }
+
+        if (cal && !multilook_flag) {
+          if (projected)
+            for (kk=0; kk<ns; kk++)
+              incid_line[kk] = quadratic_2_incidence_angle(ll, kk, incid);
+          cal_kernel_line(cal, amp_float_buf + ll*ns, incid_line,
+                          amp_float_buf + ll*ns);
+        }
       }
 
       // Multilook if requested
@@ -1902,9 +1911,8 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
 	      incidence_angle = quadratic_2_incidence_angle(ll, kk+nn/2, incid);
 	    else
 	      incidence_angle = incid[kk];
-	    amp_float_buf[idx] = 
-	      get_cal_dn(meta, incidence_angle, kk+nn/2, sqrt(amp), bandExt, 
-			 db_flag);
+	    amp_float_buf[idx] =
+	      cal_kernel_value(cal, kk+nn/2, incidence_angle, sqrt(amp));
 	  }
 	  else 
 	    amp_float_buf[idx] = sqrt(amp);
@@ -2094,16 +2102,7 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                         byte_buf[kk] = tmp_byte_buf[ns-kk-1];
                     }
                     if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB) {
-                        double incidence_angle;
-                        if (projected) {
-                            incidence_angle = quadratic_2_incidence_angle(ii, kk, incid);
-                        }
-                        else {
-                            incidence_angle = incid[kk];
-                        }
-                        amp_float_buf[kk] = 
-			  get_cal_dn(meta, incidence_angle, kk, 
-				     (float)byte_buf[kk], bandExt, db_flag);
+                        amp_float_buf[kk] = (float) byte_buf[kk];
                     }
                     else if (radiometry == r_POWER) {
                         amp_float_buf[kk] = (float) byte_buf[kk]*byte_buf[kk];
@@ -2126,16 +2125,7 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                         short_buf[kk] = tmp_short_buf[ns-kk-1];
                     }
                     if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB) {
-                        double incidence_angle;
-                        if (projected) {
-                            incidence_angle = quadratic_2_incidence_angle(ii, kk, incid);
-                        }
-                        else {
-                            incidence_angle = incid[kk];
-                        }
-                        amp_float_buf[kk] = 
-			  get_cal_dn(meta, incidence_angle, kk, 
-				     (float)short_buf[kk], bandExt, db_flag);
+                        amp_float_buf[kk] = (float) short_buf[kk];
                     }
                     else if (radiometry == r_POWER) {
                         amp_float_buf[kk] = (float) short_buf[kk]*short_buf[kk];
@@ -2149,16 +2139,7 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                         int_buf[kk] = tmp_int_buf[ns-kk-1];
                     }
                     if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB) {
-                        double incidence_angle;
-                        if (projected) {
-                            incidence_angle = quadratic_2_incidence_angle(ii, kk, incid);
-                        }
-                        else {
-                            incidence_angle = incid[kk];
-                        }
-                        amp_float_buf[kk] = 
-			  get_cal_dn(meta, incidence_angle, kk, 
-				     (float)int_buf[kk], bandExt, db_flag);
+                        amp_float_buf[kk] = (float) int_buf[kk];
                     }
                     else if (radiometry == r_POWER) {
                         amp_float_buf[ns+kk] = (float) int_buf[kk]*int_buf[kk];
@@ -2172,16 +2153,7 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                         float_buf[kk] = tmp_float_buf[ns-kk-1];
                     }
                     if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB) {
-                        double incidence_angle;
-                        if (projected) {
-                            incidence_angle = quadratic_2_incidence_angle(ii, kk, incid);
-                        }
-                        else {
-                            incidence_angle = incid[kk];
-                        }
-                        amp_float_buf[kk] = 
-			  get_cal_dn(meta, incidence_angle, kk, float_buf[kk], 
-				     bandExt, db_flag);
+                        amp_float_buf[kk] = float_buf[kk];
                     }
                     else if (radiometry == r_POWER) {
                         amp_float_buf[kk] = float_buf[kk]*float_buf[kk];
@@ -2195,16 +2167,7 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                         double_buf[kk] = tmp_double_buf[ns-kk-1];
                     }
                     if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB) {
-                        double incidence_angle;
-                        if (projected) {
-                            incidence_angle = quadratic_2_incidence_angle(ii, kk, incid);
-                        }
-                        else {
-                            incidence_angle = incid[kk];
-                        }
-                        amp_float_buf[kk] = 
-			  get_cal_dn(meta, incidence_angle, kk, 
-				     (float)double_buf[kk], bandExt, db_flag);
+                        amp_float_buf[kk] = (float) double_buf[kk];
                     }
                     else if (radiometry == r_POWER) {
                         amp_float_buf[kk] = (float) double_buf[kk]*double_buf[kk];
@@ -2221,10 +2184,17 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                     break;
             }
         }
-            if (strcmp(meta->general->sensor,"ERS2") == 0 && apply_ers2_gain_fix_flag)
-            amp_float_buf[kk] =
-                apply_ers2_gain_fix(radiometry, gain_adj, amp_float_buf[kk]);
       }
+      if (cal && !lutName) {
+        if (projected)
+          for (kk=0; kk<ns; kk++)
+            incid_line[kk] = quadratic_2_incidence_angle(ii, kk, incid);
+        cal_kernel_line(cal, amp_float_buf, incid_line, amp_float_buf);
+      }
+      if (strcmp(meta->general->sensor,"ERS2") == 0 && apply_ers2_gain_fix_flag)
+        for (kk=0; kk<ns; kk++)
+          amp_float_buf[kk] =
+            apply_ers2_gain_fix(radiometry, gain_adj, amp_float_buf[kk]);
       if (import_single_band) {
           put_band_float_line(fpOut, meta, 0, ii, amp_float_buf);
       }
@@ -2264,6 +2234,10 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
   // Clean up
   if (incid)
     FREE(incid);
+  if (cal)
+    cal_kernel_free(cal);
+  if (incid_line)
+    FREE(incid_line);
   if (byte_buf) {
     FREE(byte_buf);
     FREE(tmp_byte_buf);
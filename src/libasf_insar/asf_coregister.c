@@ -1,3 +1,5 @@
+#include <glib.h>
+
 #include "asf.h"
 #include "asf_meta.h"
 #include "ardop_defs.h"
@@ -124,21 +126,85 @@ void topOffPeak(float *peaks,int i, int j, int maxI, int maxJ,
   else *dy=0;
 }
 
-// getPeak:
-// This function computes a correlation peak, with SNR, between
-// the two given images at the given points.
-void getPeak(int x1,int y1,char *szImg1,int x2,int y2,char *szImg2,
-	     int srcSize, int trgSize,
-             float *peakX,float *peakY, float *snr)
+// Number of threads get_chip_peaks uses.  0 means one per processor.
+static int coregister_thread_count = 0;
+
+void set_coregister_thread_count(int thread_count)
+{
+  asfRequire(thread_count >= 0, "Invalid coregistration thread count: %d\n",
+             thread_count);
+  coregister_thread_count = thread_count;
+}
+
+int get_coregister_thread_count(void)
+{
+  if (coregister_thread_count == 0)
+    return g_get_num_processors();
+  return coregister_thread_count;
+}
+
+// Working arrays for correlating one pair of chips
+typedef struct {
+  complexFloat *s;        // Conjugated source chip
+  complexFloat *product;  // Interferogram at one offset
+  complexFloat *work;     // Its transpose, for the column FFTs
+  float *peaks;           // Correlation at each offset
+} chip_work;
+
+static void chip_work_init(chip_work *w, int srcSize, int trgSize)
+{
+  w->s = (complexFloat *) MALLOC(sizeof(complexFloat)*srcSize*srcSize);
+  w->product = (complexFloat *) MALLOC(sizeof(complexFloat)*srcSize*srcSize);
+  w->work = (complexFloat *) MALLOC(sizeof(complexFloat)*srcSize*srcSize);
+  w->peaks = (float *) MALLOC(sizeof(float)*trgSize*trgSize);
+}
+
+static void chip_work_free(chip_work *w)
+{
+  FREE(w->s);
+  FREE(w->product);
+  FREE(w->work);
+  FREE(w->peaks);
+}
+
+// Same as getFFTCorrelation, for a square igram: the largest amplitude
+// in its two dimensional FFT.  The lines and then the columns are
+// transformed all at once, through the cached FFT plans, and igram is
+// overwritten.
+static float fftPeakAmplitude(complexFloat *igram, complexFloat *work,
+                              int size)
+{
+  int fftpowr = (log(size)/log(2));
+  int line, samp, k;
+  float power, maxPow=0;
+
+  ffts((float *)igram, fftpowr, size);
+  for (line=0; line<size; line++)
+    for (samp=0; samp<size; samp++)
+      work[samp*size+line] = igram[line*size+samp];
+  ffts((float *)work, fftpowr, size);
+
+  for (k=0; k<size*size; k++) {
+    power = work[k].real*work[k].real + work[k].imag*work[k].imag;
+    if (power>maxPow)
+      maxPow=power;
+  }
+  return sqrt(maxPow);
+}
+
+// chipPeak:
+// Computes a correlation peak, with SNR, between the source chip that
+// is the center of the trgSize x trgSize chip src, and the target chip
+// trg.  Both chips are centered on the points to be matched.
+static void chipPeak(const complexFloat *src, const complexFloat *t,
+                     int srcSize, int trgSize, chip_work *w,
+                     float *peakX, float *peakY, float *snr)
 {
-  FILE *fpSource, *fpTarget;
-  meta_parameters *metaSource, *metaTarget;
-  static float *peaks;
-  static complexFloat *bufSource, *bufTarget;
-  static complexFloat *s=NULL, *t, *product; // Keep working arrays around
-  int srcSamples, trgSamples;
+  complexFloat *s = w->s, *product = w->product;
+  float *peaks = w->peaks;
   int peakMaxX, peakMaxY, x,y,xOffset,yOffset,count;
   int xOffsetStart, yOffsetStart, xOffsetEnd, yOffsetEnd;
+  int border = trgSize/2 - srcSize/2;
   float dx,dy,accel1 = (float)(trgSize/2 - srcSize/2);
   float peakMax, thisMax, peakSum;
   float xmep = 4.1;    // x maximum error pixel value that is accepted
@@ -155,51 +221,14 @@ void getPeak(int x1,int y1,char *szImg1,int x2,int y2,char *szImg2,
   yOffsetStart = (trgSize/2 - srcSize/2) - (int)(ymep);
   yOffsetEnd = (trgSize/2 - srcSize/2) + (int)(ymep);
 
-  // Read metadata
-  metaSource = meta_read(szImg1);
-  metaTarget = meta_read(szImg2);
-  srcSamples = metaSource->general->sample_count;
-  trgSamples = metaTarget->general->sample_count;
-
-  // Allocate working arrays if we haven't already done so
-  if (s==NULL)
-    {
-      bufSource = (complexFloat *) 
-	MALLOC(sizeof(complexFloat)*srcSize*srcSamples);
-      bufTarget = (complexFloat *) 
-	MALLOC(sizeof(complexFloat)*trgSize*trgSamples);
-      s = (complexFloat *)(MALLOC(srcSize*srcSize*sizeof(complexFloat)));
-      t = (complexFloat *)(MALLOC(trgSize*trgSize*sizeof(complexFloat)));
-      product = (complexFloat *)(MALLOC(srcSize*srcSize*sizeof(complexFloat)));
-      peaks=(float *)MALLOC(sizeof(float)*trgSize*trgSize);
-    }
-
-  // Open files, read lines and create subset
-  fpSource = FOPEN(szImg1, "rb");
-  fpTarget = FOPEN(szImg2, "rb");
-  get_complexFloat_lines(fpSource, metaSource, y1-srcSize/2+1, srcSize, 
-			 bufSource);
-  get_complexFloat_lines(fpTarget, metaTarget, y2-trgSize/2+1, trgSize, 
-			 bufTarget);
-  FCLOSE(fpSource);
-  FCLOSE(fpTarget);
-  for (y=0; y<srcSize; y++) {
-    int srcIndex = y*srcSize;
-    for (x=0; x<srcSize; x++)
-      s[srcIndex++] = bufSource[x1-srcSize/2+1+x+y*srcSamples];
-  }
-  for (y=0; y<trgSize; y++) {
-    int trgIndex = y*trgSize;
-    for (x=0; x<trgSize; x++)
-      t[trgIndex++] = bufTarget[x2-trgSize/2+1+x+y*trgSamples];
-  }
-
   // Take the complex conjugate of the source chunk (so we only have to do 
   // so once)
   for(y=0;y<srcSize;y++) {
     int srcIndex=y*srcSize;
-    for(x=0;x<srcSize;x++)
+    for(x=0;x<srcSize;x++) {
+      s[srcIndex] = src[(border+y)*trgSize+border+x];
       s[srcIndex++].imag*=-1;
+    }
   }
 
   // Now compute the best possible offset between these two images,
@@ -219,7 +248,7 @@ void getPeak(int x1,int y1,char *szImg1,int x2,int y2,char *szImg2,
         }
       }
 
-      thisMax = getFFTCorrelation(product, srcSize, srcSize);
+      thisMax = fftPeakAmplitude(product, w->work, srcSize);
 
       // Possibly save this coherence value
       if (thisMax > peakMax) {
@@ -247,6 +276,95 @@ void getPeak(int x1,int y1,char *szImg1,int x2,int y2,char *szImg2,
   *peakY=((float)(peakMaxY) + dy - accel1 );
 }
 
+typedef struct {
+  int first;  // First line of the chip
+  int index;  // Which chip
+} chip_line;
+
+static int compare_chip_lines(const void *a, const void *b)
+{
+  const chip_line *ca = (const chip_line *) a;
+  const chip_line *cb = (const chip_line *) b;
+  if (ca->first != cb->first)
+    return ca->first < cb->first ? -1 : 1;
+  return ca->index - cb->index;
+}
+
+// readChips:
+// Reads the size x size chips centered on (x[i],y[i]) -- with the same
+// upper left corner as getPeak uses -- from an image, in one pass from
+// top to bottom.  Lines that no chip needs are skipped.  Chips that
+// have use[i] FALSE are not read, use may be NULL.
+static void readChips(char *file, int count, const int *x, const int *y,
+                      const int *use, int size, complexFloat **chips)
+{
+  meta_parameters *meta = meta_read(file);
+  FILE *fp = fopenImage(file, "rb");
+  complexFloat *buf = (complexFloat *)
+    MALLOC(sizeof(complexFloat)*meta->general->sample_count);
+  chip_line *order = (chip_line *) MALLOC(sizeof(chip_line)*count);
+  int ii, n=0, lo=0, hi=0, line;
+
+  for (ii=0; ii<count; ii++) {
+    if (use && !use[ii])
+      continue;
+    order[n].first = y[ii] - size/2 + 1;
+    order[n].index = ii;
+    n++;
+  }
+  qsort(order, n, sizeof(chip_line), compare_chip_lines);
+
+  // Chips lo..hi-1 are the ones that the current line runs through
+  line = n > 0 ? order[0].first : 0;
+  while (lo < n) {
+    while (hi < n && order[hi].first <= line)
+      hi++;
+    while (lo < hi && order[lo].first + size <= line)
+      lo++;
+    if (lo == hi) {
+      if (lo < n)
+        line = order[lo].first;
+      continue;
+    }
+    get_complexFloat_line(fp, meta, line, buf);
+    for (ii=lo; ii<hi; ii++) {
+      int k = order[ii].index;
+      memcpy(chips[k] + (line - order[ii].first)*size,
+             buf + x[k] - size/2 + 1, sizeof(complexFloat)*size);
+    }
+    line++;
+  }
+
+  FREE(order);
+  FREE(buf);
+  FCLOSE(fp);
+  meta_free(meta);
+}
+
+// getPeak:
+// This function computes a correlation peak, with SNR, between
+// the two given images at the given points.
+void getPeak(int x1,int y1,char *szImg1,int x2,int y2,char *szImg2,
+	     int srcSize, int trgSize,
+             float *peakX,float *peakY, float *snr)
+{
+  complexFloat *source, *target;
+  chip_work w;
+
+  // The source chip is the middle of a target sized chip
+  source = (complexFloat *) MALLOC(sizeof(complexFloat)*trgSize*trgSize);
+  target = (complexFloat *) MALLOC(sizeof(complexFloat)*trgSize*trgSize);
+  readChips(szImg1, 1, &x1, &y1, NULL, trgSize, &source);
+  readChips(szImg2, 1, &x2, &y2, NULL, trgSize, &target);
+
+  chip_work_init(&w, srcSize, trgSize);
+  chipPeak(source, target, srcSize, trgSize, &w, peakX, peakY, snr);
+  chip_work_free(&w);
+
+  FREE(source);
+  FREE(target);
+}
+
 bool outOfBoundary(int x1, int y1, int x2, int y2, int srcSize, int trgSize,
 		   int nl, int ns)
 {
@@ -261,14 +379,137 @@ bool outOfBoundary(int x1, int y1, int x2, int y2, int srcSize, int trgSize,
   return FALSE;
 }
 
+// State shared by the get_chip_peaks workers
+typedef struct {
+  chip_peak *points;
+  complexFloat **master, **slave;  // Chips around each point
+  int count;
+  int next;                        // Next point for a worker to claim
+  int srcSize, trgSize;
+  float minSNR;
+} chip_queue;
+
+static gpointer chip_peak_worker(gpointer data)
+{
+  chip_queue *q = (chip_queue *) data;
+  chip_work w;
+  int ii;
+
+  chip_work_init(&w, q->srcSize, q->trgSize);
+  while ((ii = g_atomic_int_add(&q->next, 1)) < q->count) {
+    chip_peak *p = &q->points[ii];
+    if (!p->inside)
+      continue;
+    // ...forward correlation...
+    chipPeak(q->master[ii], q->slave[ii], q->srcSize, q->trgSize, &w,
+             &p->dxFW, &p->dyFW, &p->snrFW);
+    // ...and, if that's any good, backward correlation
+    if (p->snrFW > q->minSNR) {
+      chipPeak(q->slave[ii], q->master[ii], q->srcSize, q->trgSize, &w,
+               &p->dxBW, &p->dyBW, &p->snrBW);
+      p->dxBW *= -1.0;
+      p->dyBW *= -1.0;
+    }
+  }
+  chip_work_free(&w);
+
+  return NULL;
+}
+
+// get_chip_peaks:
+// Correlates the chips around each of the given points, forward
+// (master chip in slave) and, if that gives an SNR above minSNR,
+// backward.  Both images are read once, and the points are spread
+// over get_coregister_thread_count() threads.
+void get_chip_peaks(char *masterFile, char *slaveFile, int srcSize,
+                    int trgSize, float minSNR, int count, chip_peak *points)
+{
+  meta_parameters *meta = meta_read(masterFile);
+  int ns = meta->general->sample_count;
+  int nl = meta->general->line_count;
+  int thread_count = get_coregister_thread_count();
+  int *x1, *y1, *x2, *y2, *inside;
+  chip_queue q;
+  int ii;
+
+  meta_free(meta);
+  asfRequire(srcSize <= trgSize, "Source chip is larger than the target\n");
+
+  x1 = (int *) MALLOC(sizeof(int)*count);
+  y1 = (int *) MALLOC(sizeof(int)*count);
+  x2 = (int *) MALLOC(sizeof(int)*count);
+  y2 = (int *) MALLOC(sizeof(int)*count);
+  inside = (int *) MALLOC(sizeof(int)*count);
+  q.master = (complexFloat **) MALLOC(sizeof(complexFloat *)*count);
+  q.slave = (complexFloat **) MALLOC(sizeof(complexFloat *)*count);
+  for (ii=0; ii<count; ii++) {
+    chip_peak *p = &points[ii];
+    p->inside =
+      !(outOfBoundary(p->x1, p->y1, p->x2, p->y2, srcSize, trgSize, nl, ns) ||
+        outOfBoundary(p->x2, p->y2, p->x1, p->y1, srcSize, trgSize, nl, ns));
+    p->dxFW = p->dyFW = p->snrFW = 0.0;
+    p->dxBW = p->dyBW = p->snrBW = 0.0;
+    x1[ii] = p->x1;
+    y1[ii] = p->y1;
+    x2[ii] = p->x2;
+    y2[ii] = p->y2;
+    inside[ii] = p->inside;
+    q.master[ii] = q.slave[ii] = NULL;
+    if (p->inside) {
+      q.master[ii] = (complexFloat *)
+        MALLOC(sizeof(complexFloat)*trgSize*trgSize);
+      q.slave[ii] = (complexFloat *)
+        MALLOC(sizeof(complexFloat)*trgSize*trgSize);
+    }
+  }
+
+  // Both chips are read at the target size -- the source chips are
+  // their middles
+  readChips(masterFile, count, x1, y1, inside, trgSize, q.master);
+  readChips(slaveFile, count, x2, y2, inside, trgSize, q.slave);
+
+  q.points = points;
+  q.count = count;
+  q.next = 0;
+  q.srcSize = srcSize;
+  q.trgSize = trgSize;
+  q.minSNR = minSNR;
+
+  thread_count = MIN(thread_count, count);
+  if (thread_count <= 1) {
+    chip_peak_worker(&q);
+  }
+  else {
+    GThread **threads = (GThread **) MALLOC(thread_count * sizeof(GThread *));
+    for (ii=0; ii<thread_count; ii++)
+      threads[ii] = g_thread_new("coregister", chip_peak_worker, &q);
+    for (ii=0; ii<thread_count; ii++)
+      g_thread_join(threads[ii]);
+    FREE(threads);
+  }
+
+  for (ii=0; ii<count; ii++) {
+    FREE(q.master[ii]);
+    FREE(q.slave[ii]);
+  }
+  FREE(q.master);
+  FREE(q.slave);
+  FREE(x1);
+  FREE(y1);
+  FREE(x2);
+  FREE(y2);
+  FREE(inside);
+}
+
 int coregister_fine(char *masterFile, char *slaveFile, int nOffX, int nOffY,
                     char *ficoFile, char *maskFile, int gridSize)
 {
-  int x1, x2, y1, y2, srcSize=32, trgSize, borderX=80, borderY=80;
-  int gridResolution=20, pointNo, goodPoints, attemptedPoints;
+  int srcSize=32, trgSize, borderX=80, borderY=80;
+  int gridResolution=20, pointNo, pointCount, goodPoints;
   float minSNR = 0.3;  // Threshold for deleting points
   float maxDisp = 1.8; // Forward and reverse correlations which differ by more
                        // than this will be deleted
+  chip_peak *points;
 
   // calculate parameters
   trgSize = 2*srcSize;
@@ -291,48 +532,41 @@ int coregister_fine(char *masterFile, char *slaveFile, int nOffX, int nOffY,
     printf("   Sampling rectangular grid, %ix%i resolution.\n",
            gridResolution,gridResolution);
 
-  // Loop over grid, performing forward and backward correlations
-  pointNo = goodPoints = attemptedPoints = 0;
-  while (pointNo < (gridResolution*gridResolution)) {
-    float dx, dy, snr, dxFW, dyFW, snrFW, dxBW, dyBW, snrBW;
+  // Lay out the grid, and do the forward and backward correlations
+  pointCount = gridResolution*gridResolution;
+  points = (chip_peak *) MALLOC(sizeof(chip_peak)*pointCount);
+  for (pointNo=0; pointNo<pointCount; pointNo++) {
     int unscaledX = pointNo % gridResolution;
     int unscaledY = pointNo / gridResolution;
-    x1 = unscaledX*(ns-2*borderX)/(gridResolution-1) + borderX;
-    y1 = unscaledY*(nl-2*borderY)/(gridResolution-1) + borderY;
-    x2 = x1 - nOffX;
-    y2 = y1 - nOffY;
-    pointNo++;
-    attemptedPoints++;
-
-    // Check bounds...
-    if (!(outOfBoundary(x1, y1, x2, y2, srcSize, trgSize, nl, ns) ||
-          outOfBoundary(x2, y2, x1, y1, srcSize, trgSize, nl, ns))) {
-      // ...check forward correlation...
-      getPeak(x1, y1, masterFile, x2, y2, slaveFile, srcSize, trgSize,
-	      &dxFW, &dyFW, &snrFW);
-      if (snrFW > minSNR) {
-        // ...check backward correlation...
-        getPeak(x2, y2, slaveFile, x1, y1, masterFile, srcSize, trgSize,
-		&dxBW, &dyBW, &snrBW);
-        dxBW *= -1.0;
-        dyBW *= -1.0;
-        if ((snrBW > minSNR) &&
-            (fabs(dxFW-dxBW) < maxDisp) &&
-            (fabs(dyFW-dyBW) < maxDisp)) {
-          goodPoints++;
-          dx = (dxFW+dxBW)/2;
-          dy = (dyFW+dyBW)/2;
-          snr = snrFW*snrBW;
-          fprintf(fp,"%6d %6d %8.5f %8.5f %4.2f\n",
-                  x1, y1, x2+dx, y2+dy, snr);
-          fflush(fp);
-          if (!quietflag && (goodPoints <= 10 || !(goodPoints%100)))
-            printf("\t%6d %6d %8.5f %8.5f %4.2f/%4.2f\n",
-                   x1, y1, dx, dy, snrFW, snrBW);
-        }
-      }
+    points[pointNo].x1 = unscaledX*(ns-2*borderX)/(gridResolution-1) + borderX;
+    points[pointNo].y1 = unscaledY*(nl-2*borderY)/(gridResolution-1) + borderY;
+    points[pointNo].x2 = points[pointNo].x1 - nOffX;
+    points[pointNo].y2 = points[pointNo].y1 - nOffY;
+  }
+  get_chip_peaks(masterFile, slaveFile, srcSize, trgSize, minSNR,
+                 pointCount, points);
+
+  // Keep the points that correlated the same both ways
+  goodPoints = 0;
+  for (pointNo=0; pointNo<pointCount; pointNo++) {
+    chip_peak *p = &points[pointNo];
+    float dx, dy, snr;
+    if (p->inside && p->snrFW > minSNR && p->snrBW > minSNR &&
+        (fabs(p->dxFW-p->dxBW) < maxDisp) &&
+        (fabs(p->dyFW-p->dyBW) < maxDisp)) {
+      goodPoints++;
+      dx = (p->dxFW+p->dxBW)/2;
+      dy = (p->dyFW+p->dyBW)/2;
+      snr = p->snrFW*p->snrBW;
+      fprintf(fp,"%6d %6d %8.5f %8.5f %4.2f\n",
+              p->x1, p->y1, p->x2+dx, p->y2+dy, snr);
+      if (!quietflag && (goodPoints <= 10 || !(goodPoints%100)))
+        printf("\t%6d %6d %8.5f %8.5f %4.2f/%4.2f\n",
+               p->x1, p->y1, dx, dy, p->snrFW, p->snrBW);
     }
   }
+  FCLOSE(fp);
+  FREE(points);
 
   if (goodPoints<20)
     asfPrintError("   coregister_fine was only able to find %i points which\n"
@@ -340,7 +574,7 @@ int coregister_fine(char *masterFile, char *slaveFile, int nOffX, int nOffY,
                   "   is not enough for a planar map!\n", goodPoints);
   else
     asfPrintStatus("   coregister_fine attempted %d correlations, %d succeeded"
-                   ".\n\n", attemptedPoints, goodPoints);
+                   ".\n\n", pointCount, goodPoints);
 
   return (0);
 }
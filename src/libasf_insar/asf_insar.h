@@ -38,6 +38,18 @@ double meta_flat_phase(meta_parameters *sar,const baseline base,int y,int x);
 double meta_phase_rate(meta_parameters *sar,const baseline base,int y,int x);
 
 // Prototypes from asf_coregister.c
+typedef struct {
+  int x1, y1;                // Point in the master image
+  int x2, y2;                // Where it is expected in the slave image
+  int inside;                // Are both chips inside the images?
+  float dxFW, dyFW, snrFW;   // Master chip correlated with the slave
+  float dxBW, dyBW, snrBW;   // Slave chip correlated with the master,
+                             // offsets negated.  0 if snrFW was too low.
+} chip_peak;
+void get_chip_peaks(char *masterFile, char *slaveFile, int srcSize,
+                    int trgSize, float minSNR, int count, chip_peak *points);
+void set_coregister_thread_count(int thread_count);
+int get_coregister_thread_count(void);
 int average_in_doppler(char *inFileMaster, char *inFileSlave, char *outFile);
 int asf_coregister(int datatype, char *coregType, char *baseName, int deskew,
 		   long *p1_master_start, long *p1_slave_start, int p1_patches,
@@ -226,6 +226,20 @@ char *proj2str(projection_type_t type);
 ****************************************************************************/
 void project_set_avg_height(double height);
 
+/**************************************************************************
+   project_set_handle_caching, project_free_cached_handles
+
+   Initialized libproj projections are cached per thread, keyed by
+   their projection description (which includes the datum), so that
+   repeated projection calls only pay for the transformation.  Caching
+   is on by default; turning it off frees the calling thread's cache.
+   Each thread's cache is freed when the thread exits (for threads
+   started through glib or pthreads), and project_free_cached_handles
+   frees the calling thread's cache right away.
+****************************************************************************/
+void project_set_handle_caching(int enabled);
+void project_free_cached_handles(void);
+
 /* open a projection file */
 FILE *fopen_proj_file(const char *file, const char *mode);
 
@@ -0,0 +1,87 @@
+// Benchmark for the projection handle cache.  Times project_utm_arr()
+// with and without the cache, on the short arrays the geocoding and
+// terrain correction loops typically pass in, and checks that the
+// results are identical.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "asf.h"
+#include "libasf_proj.h"
+
+#define DEG_TO_RAD 0.0174532925199432958
+
+// Points per call, and number of calls timed.
+#define POINTS 16
+#define CALLS 3000
+
+static double elapsed_seconds(struct timeval *start, struct timeval *end)
+{
+  return (end->tv_sec - start->tv_sec) +
+    (end->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static double time_calls(project_parameters_t *pps, double *lat, double *lon,
+                         double **x, double **y)
+{
+  struct timeval start, end;
+  int ii;
+
+  gettimeofday(&start, NULL);
+  for (ii = 0; ii < CALLS; ++ii)
+    project_utm_arr(pps, lat, lon, NULL, x, y, NULL, POINTS, WGS84_DATUM);
+  gettimeofday(&end, NULL);
+
+  return elapsed_seconds(&start, &end);
+}
+
+int main(int argc, char *argv[])
+{
+  double lat[POINTS], lon[POINTS];
+  double *x_cached, *y_cached, *x_uncached, *y_uncached;
+  project_parameters_t pps;
+  int ii, wrong = 0;
+
+  pps.utm.zone = 6;
+  pps.utm.lon0 = -147 * DEG_TO_RAD;
+  pps.utm.lat0 = 0;
+  pps.utm.false_easting = 500000;
+  pps.utm.false_northing = 0;
+  pps.utm.scale_factor = 0.9996;
+
+  // Same points every run
+  srand(20202);
+  for (ii = 0; ii < POINTS; ++ii) {
+    lat[ii] = (64 + (double)rand() / (double)RAND_MAX) * DEG_TO_RAD;
+    lon[ii] = (-147.5 + (double)rand() / (double)RAND_MAX) * DEG_TO_RAD;
+  }
+
+  x_cached = (double *) MALLOC(sizeof(double) * POINTS);
+  y_cached = (double *) MALLOC(sizeof(double) * POINTS);
+  x_uncached = (double *) MALLOC(sizeof(double) * POINTS);
+  y_uncached = (double *) MALLOC(sizeof(double) * POINTS);
+
+  project_set_handle_caching(FALSE);
+  double uncached_time = time_calls(&pps, lat, lon, &x_uncached, &y_uncached);
+  project_set_handle_caching(TRUE);
+  double cached_time = time_calls(&pps, lat, lon, &x_cached, &y_cached);
+
+  printf("project_utm_arr, %d calls of %d points: %.3fs uncached, "
+         "%.3fs cached\n", CALLS, POINTS, uncached_time, cached_time);
+
+  for (ii = 0; ii < POINTS; ++ii)
+    if (x_cached[ii] != x_uncached[ii] || y_cached[ii] != y_uncached[ii])
+      ++wrong;
+  if (wrong > 0)
+    printf("Cached and uncached results don't agree: %d of %d wrong\n",
+           wrong, POINTS);
+
+  project_free_cached_handles();
+  FREE(y_uncached);
+  FREE(x_uncached);
+  FREE(y_cached);
+  FREE(x_cached);
+
+  return wrong > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
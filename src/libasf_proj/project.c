@@ -6,6 +6,8 @@
 #include <assert.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <glib.h>
 
 #include "proj_api.h"
 #include "spheroids.h"
@@ -37,6 +39,127 @@ round (double arg)
 #endif /* #ifndef darwin */
 #endif /* #ifndef linux */
 
+/* Initializing a libproj projection is much more expensive than
+   using it, and the same few projections get used over and over in
+   tight loops (geocoding, terrain correction, planning), so each
+   thread keeps a small cache of initialized projections, keyed by
+   their description.  The description includes the datum.  libproj
+   projections shouldn't be shared between threads, which is why the
+   cache is thread local rather than protected by a lock.  A thread's
+   cache is freed when the thread exits. */
+#define PROJ_HANDLE_CACHE_SIZE 8
+
+typedef struct {
+    char *description;
+    projPJ pj;
+} proj_handle_cache_entry;
+
+typedef struct {
+    /* Most recently used entries first. */
+    proj_handle_cache_entry entries[PROJ_HANDLE_CACHE_SIZE];
+    int count;
+} proj_handle_cache;
+
+static void free_handle_cache_entries(proj_handle_cache *cache)
+{
+    int i;
+    for (i = 0; i < cache->count; ++i) {
+        pj_free(cache->entries[i].pj);
+        FREE(cache->entries[i].description);
+    }
+    cache->count = 0;
+}
+
+static void free_handle_cache(gpointer data)
+{
+    proj_handle_cache *cache = (proj_handle_cache *) data;
+    free_handle_cache_entries(cache);
+    FREE(cache);
+}
+
+static GPrivate handle_cache_key = G_PRIVATE_INIT(free_handle_cache);
+static volatile gint handle_caching = TRUE;
+
+static proj_handle_cache *get_handle_cache(void)
+{
+    proj_handle_cache *cache =
+        (proj_handle_cache *) g_private_get(&handle_cache_key);
+    if (!cache) {
+        cache = (proj_handle_cache *) CALLOC(1, sizeof(proj_handle_cache));
+        g_private_set(&handle_cache_key, cache);
+    }
+    return cache;
+}
+
+void project_set_handle_caching(int enabled)
+{
+    g_atomic_int_set(&handle_caching, enabled);
+    if (!enabled)
+        project_free_cached_handles();
+}
+
+void project_free_cached_handles(void)
+{
+    proj_handle_cache *cache =
+        (proj_handle_cache *) g_private_get(&handle_cache_key);
+    if (cache)
+        free_handle_cache_entries(cache);
+}
+
+/* Returns an initialized projection for the given description, or
+   NULL if libproj couldn't initialize it.  Projections obtained here
+   must be given back with release_proj_handle, along with the cached
+   flag set here, and not pj_free'd.  Whether caching is on can change
+   in between, so it is the flag that says who owns the projection. */
+static projPJ get_proj_handle(const char *description, int *cached)
+{
+    proj_handle_cache *cache;
+    proj_handle_cache_entry *entries;
+    int i;
+
+    *cached = FALSE;
+    if (!g_atomic_int_get(&handle_caching))
+        return pj_init_plus(description);
+
+    cache = get_handle_cache();
+    entries = cache->entries;
+    for (i = 0; i < cache->count; ++i) {
+        if (strcmp(entries[i].description, description) == 0) {
+            proj_handle_cache_entry hit = entries[i];
+            for (; i > 0; --i)
+                entries[i] = entries[i-1];
+            entries[0] = hit;
+            *cached = TRUE;
+            return hit.pj;
+        }
+    }
+
+    projPJ pj = pj_init_plus(description);
+    if (!pj)
+        return NULL;
+
+    /* Evict the least recently used entry if we're full. */
+    if (cache->count == PROJ_HANDLE_CACHE_SIZE) {
+        --cache->count;
+        pj_free(entries[cache->count].pj);
+        FREE(entries[cache->count].description);
+    }
+    for (i = cache->count; i > 0; --i)
+        entries[i] = entries[i-1];
+    entries[0].description = STRDUP(description);
+    entries[0].pj = pj;
+    ++cache->count;
+
+    *cached = TRUE;
+    return pj;
+}
+
+static void release_proj_handle(projPJ pj, int cached)
+{
+    if (!cached)
+        pj_free(pj);
+}
+
 #ifdef linux
 /* Some missing prototypes */
 int putenv(char *);
@@ -90,12 +213,13 @@ static const char * datum_str(datum_type_t datum)
 int test_nad27(double lat, double lon)
 {
     projPJ ll_proj, utm_proj;
-    ll_proj = pj_init_plus(latlon_description);
+    int ll_cached, utm_cached;
+    ll_proj = get_proj_handle(latlon_description, &ll_cached);
 
     char desc[255];
     int zone = utm_zone(lon);
     sprintf(desc, "+proj=utm +zone=%d +datum=NAD27", zone);
-    utm_proj = pj_init_plus(desc);
+    utm_proj = get_proj_handle(desc, &utm_cached);
 /*
     double *px, *py, *pz;
     px = MALLOC(sizeof(double));
@@ -107,6 +231,7 @@ int test_nad27(double lat, double lon)
     px[0] = lon*D2R;
     pz[0] = 0;
 
+    pj_errno = 0;
     pj_transform (ll_proj, utm_proj, 1, 1, px, py, pz);
 
     int ret = TRUE;
@@ -120,8 +245,8 @@ int test_nad27(double lat, double lon)
 		      pj_strerrno(pj_errno));
     }
 
-    pj_free(ll_proj);
-    pj_free(utm_proj);
+    release_proj_handle(ll_proj, ll_cached);
+    release_proj_handle(utm_proj, utm_cached);
 
     return ret;
 }
@@ -151,6 +276,7 @@ static int project_worker_arr(const char * projection_description,
                               double **projected_z, long length)
 {
   projPJ geographic_projection, output_projection;
+  int geographic_cached, output_cached;
   int i, ok = TRUE;
 
   // This section is a bit confusing.  The interfaces to the single
@@ -246,9 +372,14 @@ static int project_worker_arr(const char * projection_description,
   //printf("proj: +from %s +to %s\n",
   //       latlon_description, projection_description);
 
-  geographic_projection = pj_init_plus (latlon_description);
+  // Cached projections don't reset pj_errno the way initializing
+  // them does, so do it here.
+  pj_errno = 0;
 
-  if (pj_errno != 0)
+  geographic_projection = get_proj_handle (latlon_description,
+                                           &geographic_cached);
+
+  if (geographic_projection == NULL)
   {
       asfPrintError("libproj Error: %s (initializing geographic projection)\n",
 		    pj_strerrno(pj_errno));
@@ -257,11 +388,10 @@ static int project_worker_arr(const char * projection_description,
 
   if (ok)
   {
-      assert (geographic_projection != NULL);
-
-      output_projection = pj_init_plus (projection_description);
+      output_projection = get_proj_handle (projection_description,
+                                           &output_cached);
 
-      if (pj_errno != 0)
+      if (output_projection == NULL)
       {
 	printf("proj: %s\n", projection_description);
     asfPrintError("libproj Error: %s (initializing output projection)\n", 
@@ -271,8 +401,7 @@ static int project_worker_arr(const char * projection_description,
 
       if (ok)
       {
-    assert (output_projection != NULL);
-
+    pj_errno = 0;
     pj_transform (geographic_projection, output_projection, length, 1,
       px, py, pz);
 
@@ -283,10 +412,10 @@ static int project_worker_arr(const char * projection_description,
         ok = FALSE;
     }
 
-    pj_free(output_projection);
+    release_proj_handle(output_projection, output_cached);
       }
 
-      pj_free(geographic_projection);
+      release_proj_handle(geographic_projection, geographic_cached);
   }
 
   // Free memory temporarily allocated for height values that we don't
@@ -308,6 +437,7 @@ project_worker_arr_inv(const char * projection_description,
                        long length)
 {
   projPJ geographic_projection, output_projection;
+  int geographic_cached, output_cached;
   int i, ok = TRUE;
 
   // Same issue here as above.  Because both single and array
@@ -396,9 +526,14 @@ project_worker_arr_inv(const char * projection_description,
   //printf("proj: +from %s +to %s\n",
   //       projection_description, latlon_description);
 
-  geographic_projection = pj_init_plus ( latlon_description );
+  // Cached projections don't reset pj_errno the way initializing
+  // them does, so do it here.
+  pj_errno = 0;
+
+  geographic_projection = get_proj_handle ( latlon_description,
+                                            &geographic_cached );
 
-  if (pj_errno != 0)
+  if (geographic_projection == NULL)
   {
       asfPrintError("libproj Error: %s (initializing inverse geographic "
 		    "projection)\n", pj_strerrno(pj_errno));
@@ -407,11 +542,10 @@ project_worker_arr_inv(const char * projection_description,
 
   if (ok)
   {
-      assert (geographic_projection != NULL);
+      output_projection = get_proj_handle (projection_description,
+                                           &output_cached);
 
-      output_projection = pj_init_plus (projection_description);
-
-      if (pj_errno != 0)
+      if (output_projection == NULL)
       {
     asfPrintError("libproj Error: %s\n (initializing inverse output "
 		  "projection)\n", pj_strerrno(pj_errno));
@@ -420,8 +554,7 @@ project_worker_arr_inv(const char * projection_description,
 
       if (ok)
       {
-    assert (output_projection != NULL);
-
+    pj_errno = 0;
     pj_transform (output_projection, geographic_projection, length, 1,
       plon, plat, pheight);
 
@@ -432,10 +565,10 @@ project_worker_arr_inv(const char * projection_description,
         ok = FALSE;
     }
 
-    pj_free(output_projection);
+    release_proj_handle(output_projection, output_cached);
       }
 
-      pj_free(geographic_projection);
+      release_proj_handle(geographic_projection, geographic_cached);
   }
 
   // Free memory temporarily allocated for height values that we don't
@@ -7,6 +7,7 @@
 #include <sys/time.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <glib.h>
 
 #define DEG_TO_RAD 0.0174532925199432958
 
@@ -972,6 +973,173 @@ void perf_test_ps()
     free(x);
 }
 
+/* The short arrays the geocoding and terrain correction loops
+   typically pass to project_utm_arr. */
+#define CACHE_TEST_SIZE 16
+
+static void utm_cache_test_setup(project_parameters_t *pps,
+                                 double *lat, double *lon)
+{
+    int i;
+
+    pps->utm.zone = 6;
+    pps->utm.lon0 = -147 * DEG_TO_RAD;
+    pps->utm.lat0 = 0;
+    pps->utm.false_easting = 500000;
+    pps->utm.false_northing = 0;
+    pps->utm.scale_factor = 0.9996;
+
+    /* use same seed each time */
+    srand(20202);
+
+    for (i = 0; i < CACHE_TEST_SIZE; ++i)
+    {
+        lat[i] = (64 + (double)rand() / (double)RAND_MAX) * DEG_TO_RAD;
+        lon[i] = (-147.5 + (double)rand() / (double)RAND_MAX) * DEG_TO_RAD;
+    }
+}
+
+/* Number of points where (x,y) and (xo,yo) aren't identical. */
+static int count_different(double *x, double *y, double *xo, double *yo)
+{
+    int i, n = 0;
+
+    for (i = 0; i < CACHE_TEST_SIZE; ++i)
+    {
+        CU_ASSERT(x[i] == xo[i]);
+        CU_ASSERT(y[i] == yo[i]);
+        if (x[i] != xo[i] || y[i] != yo[i])
+            ++n;
+    }
+    return n;
+}
+
+/* project_utm_arr has to give identical results whether the projection
+   handles come from the cache or not, including on a cache hit. */
+void test_utm_handle_cache()
+{
+    double lat[CACHE_TEST_SIZE], lon[CACHE_TEST_SIZE];
+    double *x_cached, *y_cached, *x_uncached, *y_uncached;
+    project_parameters_t pps;
+    int pass, n = 0;
+
+    utm_cache_test_setup(&pps, lat, lon);
+
+    x_cached = (double *) malloc(sizeof(double) * CACHE_TEST_SIZE);
+    y_cached = (double *) malloc(sizeof(double) * CACHE_TEST_SIZE);
+    x_uncached = (double *) malloc(sizeof(double) * CACHE_TEST_SIZE);
+    y_uncached = (double *) malloc(sizeof(double) * CACHE_TEST_SIZE);
+
+    project_set_handle_caching(FALSE);
+    project_utm_arr(&pps, lat, lon, NULL, &x_uncached, &y_uncached, NULL,
+                    CACHE_TEST_SIZE, datum);
+
+    /* first pass fills the cache, the second one hits it */
+    project_set_handle_caching(TRUE);
+    for (pass = 0; pass < 2; ++pass)
+    {
+        project_utm_arr(&pps, lat, lon, NULL, &x_cached, &y_cached, NULL,
+                        CACHE_TEST_SIZE, datum);
+        n += count_different(x_cached, y_cached, x_uncached, y_uncached);
+    }
+
+    if (n > 0)
+    {
+        ++nfail;
+        printf("Fail: test_utm_handle_cache results don't agree! "
+               "wrong: %d of %d\n", n, 2 * CACHE_TEST_SIZE);
+    }
+    else
+    {
+        ++nok;
+    }
+
+    free(y_uncached);
+    free(x_uncached);
+    free(y_cached);
+    free(x_cached);
+}
+
+/* Caching is a global switch, but each thread holds its own cached
+   handles.  Turning caching off and on again while another thread is
+   in the middle of a projection (holding a handle it got from its
+   cache) must neither free that handle from under it nor leak the
+   uncached ones it gets meanwhile. */
+#define TOGGLE_CALLS 2000
+
+static volatile gint toggling;
+
+static gpointer toggle_handle_caching(gpointer data)
+{
+    int on = FALSE;
+
+    while (g_atomic_int_get(&toggling))
+    {
+        project_set_handle_caching(on);
+        on = !on;
+    }
+    project_set_handle_caching(TRUE);
+    return NULL;
+}
+
+void test_utm_handle_cache_toggle()
+{
+    double lat[CACHE_TEST_SIZE], lon[CACHE_TEST_SIZE];
+    double *x, *y, *xo, *yo;
+    project_parameters_t pps;
+    GThread *toggler;
+    int j, n = 0;
+
+    utm_cache_test_setup(&pps, lat, lon);
+
+    x = (double *) malloc(sizeof(double) * CACHE_TEST_SIZE);
+    y = (double *) malloc(sizeof(double) * CACHE_TEST_SIZE);
+    xo = (double *) malloc(sizeof(double) * CACHE_TEST_SIZE);
+    yo = (double *) malloc(sizeof(double) * CACHE_TEST_SIZE);
+
+    project_set_handle_caching(TRUE);
+    project_utm_arr(&pps, lat, lon, NULL, &xo, &yo, NULL,
+                    CACHE_TEST_SIZE, datum);
+
+    g_atomic_int_set(&toggling, TRUE);
+    toggler = g_thread_new("toggle_handle_caching", toggle_handle_caching,
+                           NULL);
+    for (j = 0; j < TOGGLE_CALLS; ++j)
+    {
+        project_utm_arr(&pps, lat, lon, NULL, &x, &y, NULL,
+                        CACHE_TEST_SIZE, datum);
+        n += count_different(x, y, xo, yo);
+    }
+    g_atomic_int_set(&toggling, FALSE);
+    g_thread_join(toggler);
+
+    /* and in the same thread, between calls */
+    project_set_handle_caching(FALSE);
+    project_utm_arr(&pps, lat, lon, NULL, &x, &y, NULL,
+                    CACHE_TEST_SIZE, datum);
+    n += count_different(x, y, xo, yo);
+    project_set_handle_caching(TRUE);
+    project_utm_arr(&pps, lat, lon, NULL, &x, &y, NULL,
+                    CACHE_TEST_SIZE, datum);
+    n += count_different(x, y, xo, yo);
+
+    if (n > 0)
+    {
+        ++nfail;
+        printf("Fail: test_utm_handle_cache_toggle results don't agree! "
+               "wrong: %d\n", n);
+    }
+    else
+    {
+        ++nok;
+    }
+
+    free(yo);
+    free(xo);
+    free(y);
+    free(x);
+}
+
 void test_project()
 {
     test_poly();
@@ -982,6 +1150,8 @@ void test_project()
     test_alb();
 
     perf_test_ps();
+    test_utm_handle_cache();
+    test_utm_handle_cache_toggle();
 
     test_random_all();
 
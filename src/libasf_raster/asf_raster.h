@@ -76,6 +76,30 @@ typedef struct {
   gsl_histogram_pdf *hist_pdf;
 } channel_stats_t;
 
+// Fine bins of the histogram kept by band_stats_add()
+#define BAND_STATS_BINS 4096
+
+// Logarithmic bins kept by band_stats_add() for quantiles, on each side of
+// zero, and how many bits of a float's mantissa go into picking one
+#define BAND_STATS_QBINS 4096
+#define BAND_STATS_QBITS 7
+
+// Running statistics of a band, see band_stats_add()
+typedef struct {
+  double mask;          // Value left out of the statistics (NAN for none)
+  double min, max;
+  double mean, m2;      // Running mean, and sum of squared deviations
+  long long count;      // Pixels that went into the statistics
+  long long total;      // All pixels seen
+  double bin_start;     // Histogram range starts here,
+  double bin_width;     // in bins this wide (0 until a pixel is counted)
+  long long bins[BAND_STATS_BINS];
+  long long zeros;      // Counted pixels that are zero
+  int qtop[2];          // Highest bin key below (0) and above (1) zero, -1
+                        // until a pixel on that side is counted
+  long long qbins[2][BAND_STATS_QBINS];
+} band_stats_t;
+
 typedef struct
 {
   int n;
@@ -138,6 +162,21 @@ calc_stats_from_file_with_formula(const char *inFile, char *bands,
 void calc_minmax_median(const char *inFile, char *band, double mask, 
 			double *min, double *max);
 void calc_minmax_polsarpro(const char *inFile, double *min, double *max);
+void set_stats_thread_count(int thread_count);
+int get_stats_thread_count(void);
+void band_stats_init(band_stats_t *bs, double mask);
+void band_stats_add(band_stats_t *bs, const float *data, int n);
+void band_stats_merge(band_stats_t *bs, const band_stats_t *other);
+void band_stats_get(const band_stats_t *bs, double *min, double *max,
+                    double *mean, double *stdDev, double *percentValid);
+double band_stats_quantile(const band_stats_t *bs, double q);
+gsl_histogram *band_stats_histogram(const band_stats_t *bs, int num_bins,
+                                    double lo, double hi);
+void band_stats_to_meta(const band_stats_t *bs, const char *band_id,
+                        meta_stats *ms);
+void calc_band_stats_from_file(const char *inFile, int count, char **bands,
+                               double mask, int histogram,
+                               channel_stats_t *stats);
 
 /* Prototypes from kernel.c **************************************************/
 float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
@@ -145,6 +184,11 @@ float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
 	     int nLooks);
 void kernel_filter(char *inFile, char *outFile, filter_type_t filter, 
 		   int kernel_size, float damping, int nLooks);
+typedef struct kernel_stream_struct kernel_stream;
+kernel_stream *kernel_stream_new(filter_type_t filter, int kernel_size,
+				 float damping, int nLooks, int nSamples);
+int kernel_stream_push(kernel_stream *ks, const float *line, float *outbuf);
+void kernel_stream_free(kernel_stream *ks);
 
 /* Prototypes from interpolate.c *********************************************/
 float interpolate(interpolate_type_t interpolation, FloatImage *inbuf, float yLine,
@@ -185,6 +229,21 @@ int fftMatch_either(char *inFile1, char *inFile2, float *offsetX,
                     float *offsetY, float *certainty);
 int fftMatch_projList(char *inFile1, char *descFile);
 int fftMatch_opt(char *inFile1, char *inFile2, float *offsetX, float *offsetY);
+// Matches count size x size chips of inFile2 against the same chips of
+// inFile1, with their top left corners at (x[i],y[i]), in parallel.
+void fftMatch_chips(char *inFile1, char *inFile2, int count,
+                    const int *x, const int *y, int size,
+                    float *dx, float *dy, float *certainty);
+void set_fftmatch_thread_count(int thread_count);
+int get_fftmatch_thread_count(void);
+// A correlator reads and transforms the master image once, so it can
+// then be matched against any number of slaves, the same as fftMatch
+// would do.  A correlator should only be used by one thread at a time.
+typedef struct fft_correlator fft_correlator;
+fft_correlator *fft_correlator_new(const char *masterFile);
+int fft_correlator_match(fft_correlator *corr, const char *slaveFile,
+                         float *dx, float *dy, float *certainty);
+void fft_correlator_free(fft_correlator *corr);
 
          
 /* Prototypes from shaded_relief.c *******************************************/
@@ -208,6 +267,16 @@ int resample_to_pixsiz_nn(const char *infile, const char *outfile,
 int smooth(const char *infile, const char *outfile, int kernel_size,
            edge_strategy_t edge_strategy);
 
+/* Prototypes from strips.c *************************************************/
+typedef void (*strip_filter_t)(void *data, const float *in, int in_first,
+                               int in_lines, float *out, int out_first,
+                               int out_lines);
+void set_filter_thread_count(int thread_count);
+int get_filter_thread_count(void);
+void filter_band_strips(FILE *fpIn, meta_parameters *inMeta, int in_band,
+                        FILE *fpOut, meta_parameters *outMeta, int out_band,
+                        int halo, strip_filter_t func, void *data);
+
 // Prototypes from tile.c
 void create_image_tiles(char *inFile, char *outBaseName, int tile_size);
 void create_image_hierarchy(char *inFile, char *outBaseName, int tile_size);
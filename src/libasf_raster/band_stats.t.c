@@ -0,0 +1,148 @@
+#include "asf_raster.h"
+#include "asf_meta.h"
+#include "asf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Quantiles should be good to a bin of the logarithmic histogram
+static const double tol = 1.0/128.0;
+
+static int failures = 0;
+
+static int compare_floats(const void *a, const void *b)
+{
+  float fa = *(const float *) a, fb = *(const float *) b;
+  return fa < fb ? -1 : fa > fb ? 1 : 0;
+}
+
+// Value below which a fraction q of the sorted values lie
+static double exact_quantile(const float *sorted, int n, double q)
+{
+  int ii = (int) ceil(q * n) - 1;
+  if (ii < 0) ii = 0;
+  if (ii >= n) ii = n - 1;
+  return sorted[ii];
+}
+
+static void check_quantiles(const char *what, const band_stats_t *bs,
+                            const float *sorted, int n)
+{
+  static const double qs[] = { 1.0/16.0, 0.25, 0.5, 0.75, 15.0/16.0 };
+  int ii;
+
+  for (ii=0; ii<sizeof(qs)/sizeof(qs[0]); ii++) {
+    double exact = exact_quantile(sorted, n, qs[ii]);
+    double got = band_stats_quantile(bs, qs[ii]);
+    int ok = fabs(got - exact) <= tol * fabs(exact) + 1.E-30;
+    printf("%s: quantile %6.4f: %12.6g, exact %12.6g %s\n", what, qs[ii],
+           got, exact, ok ? "" : "<-- FAILED");
+    if (!ok)
+      ++failures;
+  }
+}
+
+// The stats tool prints and saves histograms as whole numbers, so the
+// counts have to be whole, and none may go missing: they add up to all
+// of the pixels in [min,max), give or take those equal to max, which
+// may share a fine bin with smaller values
+static void check_histogram(const char *what, const band_stats_t *bs,
+                            const float *data, int n)
+{
+  gsl_histogram *hist = band_stats_histogram(bs, 256, bs->min, bs->max);
+  double total = 0.0;
+  long long expected = 0;
+  int ii, ok, whole = TRUE;
+
+  for (ii=0; ii<n; ii++)
+    if (data[ii] < bs->max)
+      ++expected;
+  for (ii=0; ii<256; ii++) {
+    if (hist->bin[ii] != floor(hist->bin[ii]))
+      whole = FALSE;
+    total += hist->bin[ii];
+  }
+  ok = whole && total >= expected && total <= bs->count;
+  printf("%s: histogram total %.0f, expected %lld to %lld%s %s\n", what,
+         total, expected, (long long) bs->count,
+         whole ? "" : ", not whole numbers", ok ? "" : "<-- FAILED");
+  if (!ok)
+    ++failures;
+  gsl_histogram_free(hist);
+}
+
+static void quantile_test(const char *what, float *data, int n)
+{
+  band_stats_t *bs = MALLOC(sizeof(band_stats_t));
+  band_stats_t *strip = MALLOC(sizeof(band_stats_t));
+  band_stats_t *merged = MALLOC(sizeof(band_stats_t));
+  float *sorted = MALLOC(sizeof(float) * n);
+  const int line = 1000;
+  int ii, kk;
+
+  // All at once, a line at a time
+  band_stats_init(bs, NAN);
+  for (ii=0; ii<n; ii+=line)
+    band_stats_add(bs, data + ii, MIN(line, n - ii));
+
+  // The same lines in strips, merged afterwards in reverse order
+  band_stats_init(merged, NAN);
+  for (kk=n; kk>0; kk-=n/4) {
+    band_stats_init(strip, NAN);
+    for (ii=MAX(0, kk - n/4); ii<kk; ii+=line)
+      band_stats_add(strip, data + ii, MIN(line, kk - ii));
+    band_stats_merge(merged, strip);
+  }
+
+  memcpy(sorted, data, sizeof(float) * n);
+  qsort(sorted, n, sizeof(float), compare_floats);
+
+  check_quantiles(what, bs, sorted, n);
+  check_histogram(what, bs, data, n);
+  for (ii=0; ii<BAND_STATS_QBINS; ii++)
+    if (bs->qbins[0][ii] != merged->qbins[0][ii] ||
+        bs->qbins[1][ii] != merged->qbins[1][ii])
+      break;
+  if (ii < BAND_STATS_QBINS || bs->zeros != merged->zeros) {
+    printf("%s: merged strips differ <-- FAILED\n", what);
+    ++failures;
+  }
+
+  FREE(sorted);
+  FREE(merged);
+  FREE(strip);
+  FREE(bs);
+}
+
+int main(int argc, char *argv[])
+{
+  const int n = 1000000;
+  float *data = MALLOC(sizeof(float) * (n + 10));
+  int ii;
+
+  srand48(4242);
+
+  // Exponentially distributed backscatter, mean 0.05, with a few bright
+  // outliers that stretch the range by orders of magnitude
+  for (ii=0; ii<n; ii++)
+    data[ii] = -0.05 * log(1.0 - drand48());
+  for (ii=0; ii<10; ii++)
+    data[(long long) ii * n / 10 + 5] = 200.0;
+  quantile_test("exponential with outliers", data, n);
+
+  // The same in dB, so the values are on both sides of zero, and some
+  // are zero
+  for (ii=0; ii<n; ii++)
+    data[ii] = ii % 1000 == 0 ? 0.0 : 10.0 * log10(data[ii] * 20.0);
+  quantile_test("dB with outliers", data, n);
+
+  FREE(data);
+
+  if (failures > 0) {
+    printf("%d checks FAILED\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
@@ -1,3 +1,5 @@
+#include <glib.h>
+
 #include "asf.h"
 #include "asf_meta.h"
 #include <math.h>
@@ -18,18 +20,73 @@
 #define modX(x,ns) ((x+ns)%ns)  /*Return x, wrapped to [0..ns-1]*/
 #define modY(y,nl) ((y+nl)%nl)  /*Return y, wrapped to [0..nl-1]*/
 
-/* readImg: reads the image file given by in
+/* Number of threads fftMatch_gridded and fftMatch_chips use to match
+   chips.  0 means one per processor. */
+static int fftmatch_thread_count = 0;
+
+void set_fftmatch_thread_count(int thread_count)
+{
+  asfRequire(thread_count >= 0, "Invalid fftMatch thread count: %d\n",
+             thread_count);
+  fftmatch_thread_count = thread_count;
+}
+
+int get_fftmatch_thread_count(void)
+{
+  if (fftmatch_thread_count == 0)
+    return g_get_num_processors();
+  return fftmatch_thread_count;
+}
+
+/* Where the pixels of an image being matched come from: an open image
+   file, or lines that are already in memory. */
+typedef struct {
+  FILE *fp;               /* If not NULL, lines are read from here, */
+  meta_parameters *meta;
+  const float *data;      /* otherwise line y starts at data+y*stride. */
+  int stride;
+  int ns, nl;             /* Size of the image. */
+} match_source;
+
+static void file_source(match_source *src, FILE *fp, meta_parameters *meta)
+{
+  src->fp = fp;
+  src->meta = meta;
+  src->data = NULL;
+  src->stride = 0;
+  src->ns = meta->general->sample_count;
+  src->nl = meta->general->line_count;
+}
+
+static void memory_source(match_source *src, const float *data, int stride,
+                          int ns, int nl)
+{
+  src->fp = NULL;
+  src->meta = NULL;
+  src->data = data;
+  src->stride = stride;
+  src->ns = ns;
+  src->nl = nl;
+}
+
+/* readImage: reads the image given by src
    into the (nl x ns) float array dest.  Reads a total of
    (delY x delX) pixels into topleft corner of dest, starting
-   at (startY , startX) in the input file.
+   at (startY , startX) in the input.  Unusable pixels are set to
+   zero.  If valid isn't NULL, it is set to 1 where dest holds a usable
+   pixel, and 0 elsewhere.  Returns TRUE if every pixel of dest is
+   usable.
 */
-static void readImage(FILE *in,meta_parameters *meta,
+static int readImage(const match_source *src,
               int startX,int startY,int delX,int delY,
-              float add,float *sum, float *dest, int nl, int ns)
+              float add,float *sum, float *dest, float *valid, int nl, int ns)
 {
-  float *inBuf=(float *)MALLOC(sizeof(float)*(meta->general->sample_count));
+  float *inBuf = src->fp ?
+    (float *)MALLOC(sizeof(float)*(src->meta->general->sample_count)) : NULL;
+  const float *line;
   register int x,y,l;
   double tempSum=0;
+  int full = delX==ns && delY==nl;
 
   // We've had some problems matching images with some extremely large
   // or NaN values.  If only some pixels in the image have these values,
@@ -42,25 +99,29 @@ static void readImage(FILE *in,meta_parameters *meta,
   /*Read portion of input image into topleft of dest array.*/
   for (y=0;y<delY;y++) {
       l=ns*y;
-      get_float_line(in,meta,startY+y,inBuf);
-      if (sum==NULL) {
-          for (x=0;x<delX;x++) {
-              if (fabs(inBuf[startX+x]) < maxval && meta_is_valid_double(inBuf[startX+x])) {
-                  dest[l+x]=inBuf[startX+x]+add;
-              }
-          }
+      if (src->fp) {
+          get_float_line(src->fp,src->meta,startY+y,inBuf);
+          line=inBuf;
       }
       else {
-          for (x=0;x<delX;x++) {
-              if (fabs(inBuf[startX+x]) < maxval && meta_is_valid_double(inBuf[startX+x]))
-              {
-                  tempSum+=inBuf[startX+x];
-                  dest[l+x]=inBuf[startX+x]+add;
-              }
+          line=src->data+(size_t)(startY+y)*src->stride;
+      }
+      for (x=0;x<delX;x++) {
+          if (fabs(line[startX+x]) < maxval && meta_is_valid_double(line[startX+x]))
+          {
+              tempSum+=line[startX+x];
+              dest[l+x]=line[startX+x]+add;
+              if (valid) valid[l+x]=1.0;
+          }
+          else {
+              dest[l+x]=0.0;
+              if (valid) valid[l+x]=0.0;
+              full=FALSE;
           }
       }
       for (x=delX;x<ns;x++) {
           dest[l+x]=0.0; /*Fill rest of line with zeros.*/
+          if (valid) valid[l+x]=0.0;
       }
   }
 
@@ -69,12 +130,14 @@ static void readImage(FILE *in,meta_parameters *meta,
       l=ns*y;
       for (x=0;x<ns;x++) {
           dest[l+x]=0.0; /*Fill rest of in2 with zeros.*/
+          if (valid) valid[l+x]=0.0;
       }
   }
   if (sum!=NULL) {
       *sum=(float)tempSum;
   }
   FREE(inBuf);
+  return full;
 }
 
 
@@ -156,73 +219,125 @@ static void findPeak(float *corrImage,float *dx,float *dy,float *doubt,
 }
 
 
-/* las_fftProd: reads both given files, and correlates them into the
-created outReal (nl x ns) float array.*/
-static void fftProd(FILE *in1F,meta_parameters *metaMaster,
-            FILE *in2F,meta_parameters *metaSlave,float *outReal[],
-            int ns, int nl, int mX, int mY,
-            int chipX, int chipY, int chipDX, int chipDY,
-            int searchX, int searchY)
+/* FFT size for matching against a master image of the given size. */
+static void fftSize(int sample_count, int line_count, int *mX, int *mY)
+{
+  /*Round to find nearest power of 2 for FFT size.*/
+  *mX = (int)(log((float)sample_count)/log(2.0)+0.5);
+  *mY = (int)(log((float)line_count)/log(2.0)+0.5);
+
+  /* Keep size of fft's reasonable */
+  if (*mX > 13) *mX = 13;
+  if (*mY > 15) *mY = 15;
+}
+
+/* Where the chip is taken from the slave image, and how far
+   to search for the peak. */
+typedef struct {
+  int chipX, chipY;        /*Chip location (top left corner) in second image*/
+  int chipDX,chipDY;       /*Chip size in second image.*/
+  int searchX,searchY;     /*Maximum distance to search for peak*/
+} match_chip;
+
+static void setChip(match_chip *c, const match_source *slave, int ns, int nl)
+{
+  /*Set up search chip size.*/
+  c->chipDX=MINI(slave->ns,ns)*3/4;
+  c->chipDY=MINI(slave->nl,nl)*3/4;
+  c->chipX=MINI(slave->ns,ns)/8;
+  c->chipY=MINI(slave->nl,nl)/8;
+  c->searchX=MINI(slave->ns,ns)*3/8;
+  c->searchY=MINI(slave->nl,nl)*3/8;
+}
+
+/* slaveSpectrum: reads the chip from the slave image into in2, takes
+   off its average brightness and returns the conjugate of its spectrum.
+   Returns the (negated) average, which must be added to the master
+   image before it is correlated with this spectrum.*/
+static float slaveSpectrum(const match_source *slave, const match_chip *c,
+                           float *in2, float *cols,
+                           int ns, int nl, int mX, int mY)
 {
-  float scaleFact=1.0/(chipDX*chipDY);
-  register float *in1,*in2,*out;
+  float scaleFact=1.0/(c->chipDX*c->chipDY);
   register int x,y,l;
   float aveChip;
 
-  in1=(float *)MALLOC(sizeof(float)*ns*nl);
-  in2=(float *)MALLOC(sizeof(float)*ns*nl);
-  out=in2;
-  *outReal=in2;
-
   /*Read image 2 (chip)*/
-  //asfPrintStatus("Reading Image 2\n");
-  readImage(in2F,metaSlave,
-            chipX,chipY,chipDX,chipDY,
-            0.0,&aveChip,in2,nl,ns);
+  readImage(slave,c->chipX,c->chipY,c->chipDX,c->chipDY,
+            0.0,&aveChip,in2,NULL,nl,ns);
 
   /*Compute average brightness of chip.*/
-  aveChip/=-(float)chipDY*chipDX;
+  aveChip/=-(float)c->chipDY*c->chipDX;
 
   /*Subtract this average off of image 2(chip):*/
-  for (y=0;y<chipDY;y++) {
+  for (y=0;y<c->chipDY;y++) {
     l=ns*y;
-    for (x=0;x<chipDX;x++) {
+    for (x=0;x<c->chipDX;x++) {
       in2[l+x]=(in2[l+x]+aveChip)*scaleFact;
     }
   }
 
   /*FFT image 2 */
-  //asfPrintStatus("FFT Image 2\n");
-  rfft2d(in2,mY,mX);
-
-  /*Read image 1: Much easier, now that we know the average brightness. */
-  //asfPrintStatus("Reading Image 1\n");
-  readImage(in1F,metaMaster,
-            0,0,MINI(metaMaster->general->sample_count,ns),
-            MINI(metaMaster->general->line_count,nl),
-            aveChip,NULL,in1,nl,ns);
-
-  /*FFT Image 1 */
-  //asfPrintStatus("FFT Image 1\n");
-  rfft2d(in1,mY,mX);
+  rfft2d_r(in2,mY,mX,cols);
 
   /*Conjugate in2.*/
-  //asfPrintStatus("Conjugate Image 2\n");
   for (y=0;y<nl;y++) {
     l=ns*y;
     x = (y < 2) ? 1 : 0;
-    //if (y<2) x=1; else x=0;
     for (;x<ns/2;x++) {
       in2[l+2*x+1]*=-1.0;
     }
   }
 
+  return aveChip;
+}
+
+/* Multiplies the spectrum in out by the spectrum of (master + add*box),
+   given the spectra of the master image and the box, the same way as
+   rspect2dprod.  Since the transform is linear, this is what we'd get by
+   adding 'add' to the master image where the box is 1 before taking its
+   spectrum. */
+static void boxedProd(const float *master, const float *box, float add,
+                      float *out, int nl, int ns)
+{
+  int N = nl*ns/2;  /*Offset of the nyquist row.*/
+  int k;
+
+  out[0]*=master[0]+add*box[0];
+  out[1]*=master[1]+add*box[1];
+  out[N]*=master[N]+add*box[N];
+  out[N+1]*=master[N+1]+add*box[N+1];
+
+  for (k=2;k<2*N;k+=2) {
+    float re,im,a,b;
+    if (k==N) continue;
+    re=master[k]+add*box[k];
+    im=master[k+1]+add*box[k+1];
+    a=out[k];
+    b=out[k+1];
+    out[k]=re*a-im*b;
+    out[k+1]=re*b+im*a;
+  }
+}
+
+/* correlate: multiplies the conjugated slave spectrum in in2 by the
+   master spectrum, and turns the product into the correlation image.
+   If box isn't NULL, the master spectrum is that of
+   (master + add*box); see boxedProd. */
+static void correlate(const float *master, const float *box, float add,
+                      float *in2, float *cols,
+                      int ns, int nl, int mX, int mY)
+{
+  register float *out=in2;
+  register int x,y,l;
+
   /*Take complex product of in1 and in2 into out.*/
-  //asfPrintStatus("Complex Product\n");
-  rspect2dprod(in1,in2,out,nl,ns);
+  if (box)
+    boxedProd(master,box,add,out,nl,ns);
+  else
+    rspect2dprod((float *)master,in2,out,nl,ns);
 
   /*Zero out the low frequencies of the correlation image.*/
-  //asfPrintStatus("Zero low frequencies.\n");
   for (y=0;y<4;y++) {
     l=ns*y;
     for (x=0;x<8;x++) out[l+x]=0;
@@ -231,50 +346,340 @@ static void fftProd(FILE *in1F,meta_parameters *metaMaster,
   }
 
   /*Inverse-fft the product*/
-  //asfPrintStatus("I-FFT\n");
-  rifft2d(out,mY,mX);
+  rifft2d_r(out,mY,mX,cols);
+}
 
-  FREE(in1);/*Note: in2 shouldn't be freed, because we return it.*/
+struct fft_correlator {
+  int mX,mY;               /*Invariant: 2^mX=ns; 2^mY=nl.*/
+  int ns,nl;
+  float *spectrum;         /*Spectrum of the master image.*/
+  float *box;              /*Spectrum of the master's valid pixels, or NULL
+                             if every pixel of the FFT area is valid.*/
+  float *in2, *cols;       /*Work space for matching.*/
+};
+
+fft_correlator *fft_correlator_new(const char *masterFile)
+{
+  fft_correlator *corr = (fft_correlator *)MALLOC(sizeof(fft_correlator));
+  meta_parameters *metaMaster = meta_read(masterFile);
+  FILE *in1F = fopenImage(masterFile,"rb");
+  match_source master;
+  int ns,nl,mX,mY,full;
+
+  fftSize(metaMaster->general->sample_count,
+          metaMaster->general->line_count, &mX, &mY);
+  ns = 1<<mX;
+  nl = 1<<mY;
+
+  /* Test chip size to see if we have enough memory for it */
+  /* Reduce it if necessary, but not below 1024x1024 (which needs 4 Mb of memory) */
+  float *test_mem = (float *)malloc(sizeof(float)*ns*nl*3);
+  if (!test_mem && !quietflag) asfPrintStatus("\n");
+  while (!test_mem) {
+      mX--;
+      mY--;
+      ns = 1<<mX;
+      nl = 1<<mY;
+      if (ns < 1024 || nl < 1024) {
+          asfPrintError("FFT Size too small (%dx%d)...\n", ns, nl);
+      }
+      if (!quietflag) asfPrintStatus("   Not enough memory... reducing FFT Size to %dx%d\n", ns, nl);
+      test_mem = (float *)malloc(sizeof(float)*ns*nl*3);
+  }
+  FREE(test_mem);
+  if (!quietflag) asfPrintStatus("\n");
+
+  fft2dInit(mY, mX);
+
+  corr->mX = mX;
+  corr->mY = mY;
+  corr->ns = ns;
+  corr->nl = nl;
+  corr->spectrum = (float *)MALLOC(sizeof(float)*ns*nl);
+  corr->box = (float *)MALLOC(sizeof(float)*ns*nl);
+  corr->in2 = (float *)MALLOC(sizeof(float)*ns*nl);
+  corr->cols = (float *)MALLOC(sizeof(float)*4*2*nl);
+
+  /*Read image 1, and which of its pixels are usable.  Each slave chip
+    has its own average, which has to be added to the usable pixels;
+    it's added to the spectrum by way of the box.*/
+  file_source(&master, in1F, metaMaster);
+  full = readImage(&master,0,0,MINI(master.ns,ns),MINI(master.nl,nl),
+                   0.0,NULL,corr->spectrum,corr->box,nl,ns);
+  rfft2d_r(corr->spectrum,mY,mX,corr->cols);
+
+  /*If the box is the whole FFT area, adding to it only changes the
+    zero frequency, and that gets zeroed out anyway.*/
+  if (full) {
+    FREE(corr->box);
+    corr->box = NULL;
+  }
+  else {
+    rfft2d_r(corr->box,mY,mX,corr->cols);
+  }
+
+  FCLOSE(in1F);
+  meta_free(metaMaster);
+
+  return corr;
 }
 
-static int mini(int a, int b)
+void fft_correlator_free(fft_correlator *corr)
 {
-  return a<b ? a : b;
+  if (corr) {
+    FREE(corr->spectrum);
+    FREE(corr->box);
+    FREE(corr->in2);
+    FREE(corr->cols);
+    FREE(corr);
+  }
+}
+
+/* Correlates the slave with the correlator's master, and leaves the
+   correlation image in corr->in2. */
+static void correlator_prod(fft_correlator *corr, const match_source *slave,
+                            const match_chip *c)
+{
+  float aveChip = slaveSpectrum(slave,c,corr->in2,corr->cols,
+                                corr->ns,corr->nl,corr->mX,corr->mY);
+  correlate(corr->spectrum,corr->box,aveChip,corr->in2,corr->cols,
+            corr->ns,corr->nl,corr->mX,corr->mY);
 }
 
-static int fftMatchBF(char *file1, char *file2, float *dx, float *dy, float *cert, double tol)
+int fft_correlator_match(fft_correlator *corr, const char *slaveFile,
+                         float *dx, float *dy, float *cert)
 {
-  int qf_saved = quietflag;
-  quietflag = TRUE;
-  int ok = FALSE;
+  meta_parameters *metaSlave = meta_read(slaveFile);
+  FILE *in2F = fopenImage(slaveFile,"rb");
+  match_source slave;
+  match_chip c;
+  float doubt;
+
+  file_source(&slave, in2F, metaSlave);
+  setChip(&c, &slave, corr->ns, corr->nl);
+  correlator_prod(corr, &slave, &c);
+
+  /*Search correlation image for a peak.*/
+  findPeak(corr->in2,dx,dy,&doubt,corr->nl,corr->ns,
+           c.chipX,c.chipY,c.searchX,c.searchY);
+  *cert = 1-doubt;
+
+  FCLOSE(in2F);
+  meta_free(metaSlave);
+
+  return (0);
+}
+
+/* One pair of chips to match, and the result. */
+typedef struct {
+  match_source src1, src2;
+  int both_ways;           /*Match 2 to 1 too, and require they agree.*/
+  double tol;              /*Minimum certainty, if both_ways.*/
+  float dx, dy, cert;
+  int ok;
+} chip_match;
+
+/* Work space for matching one pair of chips. */
+typedef struct {
+  int mX,mY,ns,nl;
+  float *in1, *in2, *cols;
+} chip_buffers;
 
+static void chip_buffers_init(chip_buffers *b, int mX, int mY)
+{
+  b->mX = mX;
+  b->mY = mY;
+  b->ns = 1<<mX;
+  b->nl = 1<<mY;
+  b->in1 = (float *)MALLOC(sizeof(float)*b->ns*b->nl);
+  b->in2 = (float *)MALLOC(sizeof(float)*b->ns*b->nl);
+  b->cols = (float *)MALLOC(sizeof(float)*4*2*b->nl);
+}
+
+static void chip_buffers_free(chip_buffers *b)
+{
+  FREE(b->in1);
+  FREE(b->in2);
+  FREE(b->cols);
+}
+
+/* Same as fftMatch, on two chips. */
+static void matchChip(chip_buffers *b, const match_source *master,
+                      const match_source *slave,
+                      float *dx, float *dy, float *cert)
+{
+  match_chip c;
+  float aveChip, doubt;
+
+  setChip(&c, slave, b->ns, b->nl);
+  aveChip = slaveSpectrum(slave,&c,b->in2,b->cols,b->ns,b->nl,b->mX,b->mY);
+
+  /*Read image 1: Much easier, now that we know the average brightness. */
+  readImage(master,0,0,MINI(master->ns,b->ns),MINI(master->nl,b->nl),
+            aveChip,NULL,b->in1,NULL,b->nl,b->ns);
+  rfft2d_r(b->in1,b->mY,b->mX,b->cols);
+
+  correlate(b->in1,NULL,0.0,b->in2,b->cols,b->ns,b->nl,b->mX,b->mY);
+
+  findPeak(b->in2,dx,dy,&doubt,b->nl,b->ns,
+           c.chipX,c.chipY,c.searchX,c.searchY);
+  *cert = 1-doubt;
+}
+
+static void runChipMatch(chip_buffers *b, chip_match *m)
+{
   float dx1=0, dx2=0, dy1=0, dy2=0, cert1=0, cert2=0;
-  fftMatch(file1, file2, NULL, &dx1, &dy1, &cert1);
-  if (!meta_is_valid_double(dx1) || !meta_is_valid_double(dy1) || cert1<tol) {
-    *dx = *dy = *cert = 0;
+
+  matchChip(b, &m->src1, &m->src2, &dx1, &dy1, &cert1);
+  if (!m->both_ways) {
+    m->dx = dx1;
+    m->dy = dy1;
+    m->cert = cert1;
+    m->ok = TRUE;
+  }
+  else if (!meta_is_valid_double(dx1) || !meta_is_valid_double(dy1) || cert1<m->tol) {
+    m->dx = m->dy = m->cert = 0;
+    m->ok = FALSE;
   }
   else {
-    fftMatch(file2, file1, NULL, &dx2, &dy2, &cert2);
-    if (!meta_is_valid_double(dx2) || !meta_is_valid_double(dy2) || cert2<tol) {
-      *dx = *dy = *cert = 0;
+    matchChip(b, &m->src2, &m->src1, &dx2, &dy2, &cert2);
+    if (!meta_is_valid_double(dx2) || !meta_is_valid_double(dy2) || cert2<m->tol) {
+      m->dx = m->dy = m->cert = 0;
+      m->ok = FALSE;
     }
     else if (fabs(dx1 + dx2) > .25 || fabs(dy1 + dy2) > .25) {
-      *dx = *dy = *cert = 0;
+      m->dx = m->dy = m->cert = 0;
+      m->ok = FALSE;
     }
     else {
-      *dx = (dx1 - dx2) * 0.5;
-      *dy = (dy1 - dy2) * 0.5;
-      *cert = cert1 < cert2 ? cert1 : cert2; 
-      ok = TRUE;
+      m->dx = (dx1 - dx2) * 0.5;
+      m->dy = (dy1 - dy2) * 0.5;
+      m->cert = cert1 < cert2 ? cert1 : cert2;
+      m->ok = TRUE;
     }
   }
+}
+
+/* The chips handed to the workers of matchChips. */
+typedef struct {
+  chip_match *matches;
+  int count;
+  int next;                /*Next match for a worker to claim.*/
+  int mX,mY;
+} chip_queue;
+
+static gpointer chip_worker(gpointer data)
+{
+  chip_queue *q = (chip_queue *) data;
+  chip_buffers b;
+  int idx;
+
+  chip_buffers_init(&b, q->mX, q->mY);
+  while ((idx = g_atomic_int_add(&q->next, 1)) < q->count)
+    runChipMatch(&b, &q->matches[idx]);
+  chip_buffers_free(&b);
+
+  return NULL;
+}
+
+/* Matches count pairs of chips, all of them size x size pixels, on
+   up to get_fftmatch_thread_count() threads. */
+static void matchChips(chip_match *matches, int count, int size)
+{
+  int thread_count = MINI(get_fftmatch_thread_count(), count);
+  chip_queue q;
+  int ii;
+
+  if (count <= 0)
+    return;
+
+  q.matches = matches;
+  q.count = count;
+  q.next = 0;
+  fftSize(size, size, &q.mX, &q.mY);
+  fft2dInit(q.mY, q.mX);
+
+  if (thread_count <= 1) {
+    chip_worker(&q);
+  }
+  else {
+    GThread **threads = (GThread **) MALLOC(thread_count * sizeof(GThread *));
+    for (ii = 0; ii < thread_count; ii++)
+      threads[ii] = g_thread_new("fftMatch", chip_worker, &q);
+    for (ii = 0; ii < thread_count; ii++)
+      g_thread_join(threads[ii]);
+    FREE(threads);
+  }
+}
+
+/* Reads the size x size chip of an image with its top left corner at
+   (x,y).  Any part of the chip that's off the image is filled with
+   zeros, like trim does. */
+static float *readChip(FILE *fp, meta_parameters *meta, int x, int y,
+                       int size)
+{
+  int ns = meta->general->sample_count;
+  int nl = meta->general->line_count;
+  float *chip = (float *)CALLOC((size_t)size*size, sizeof(float));
+  float *line = (float *)MALLOC(sizeof(float)*ns);
+  int ii, jj;
+
+  for (ii = 0; ii < size; ii++) {
+    if (y+ii < 0 || y+ii >= nl)
+      continue;
+    get_float_line(fp, meta, y+ii, line);
+    for (jj = 0; jj < size; jj++) {
+      if (x+jj >= 0 && x+jj < ns)
+        chip[(size_t)ii*size+jj] = line[x+jj];
+    }
+  }
+
+  FREE(line);
+  return chip;
+}
+
+void fftMatch_chips(char *inFile1, char *inFile2, int count,
+                    const int *x, const int *y, int size,
+                    float *dx, float *dy, float *cert)
+{
+  meta_parameters *meta1 = meta_read(inFile1);
+  meta_parameters *meta2 = meta_read(inFile2);
+  FILE *fp1 = fopenImage(inFile1, "rb");
+  FILE *fp2 = fopenImage(inFile2, "rb");
+  chip_match *matches = (chip_match *)MALLOC(sizeof(chip_match)*count);
+  float **chips = (float **)MALLOC(sizeof(float *)*2*count);
+  int ii;
+
+  for (ii=0; ii<count; ++ii) {
+    chips[2*ii] = readChip(fp1, meta1, x[ii], y[ii], size);
+    chips[2*ii+1] = readChip(fp2, meta2, x[ii], y[ii], size);
+    memory_source(&matches[ii].src1, chips[2*ii], size, size, size);
+    memory_source(&matches[ii].src2, chips[2*ii+1], size, size, size);
+    matches[ii].both_ways = FALSE;
+    matches[ii].tol = 0;
+  }
+  FCLOSE(fp1);
+  FCLOSE(fp2);
+
+  matchChips(matches, count, size);
+
+  for (ii=0; ii<count; ++ii) {
+    dx[ii] = matches[ii].dx;
+    dy[ii] = matches[ii].dy;
+    cert[ii] = matches[ii].cert;
+    FREE(chips[2*ii]);
+    FREE(chips[2*ii+1]);
+  }
 
-  quietflag = qf_saved;
-  //asfPrintStatus("Result %s:\n"
-  //               "dx1=%8.2f dy1=%8.2f cert=%f\n"
-  //               "dx2=%8.2f dy2=%8.2f cert=%f\n", ok?"Yes":"No", dx1, dy1, cert1, dx2, dy2, cert2);
+  FREE(chips);
+  FREE(matches);
+  meta_free(meta1);
+  meta_free(meta2);
+}
 
-  return ok; 
+static int mini(int a, int b)
+{
+  return a<b ? a : b;
 }
 
 typedef struct offset_point {
@@ -433,8 +838,6 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
   asfPrintStatus("Tile overlap is %d pixels\n", overlap);
   asfPrintStatus("Match tolerance is %.2f\n", tol);
 
-  long long lsz = (long long)size;
-
   int num_x = (ns - size) / (size - overlap);
   int num_y = (nl - size) / (size - overlap);
   int len = num_x*num_y;
@@ -443,6 +846,16 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
 
   offset_point_t *matches = MALLOC(sizeof(offset_point_t)*len); 
 
+  /* The tiles of a row are matched together, from bands of lines that
+     are read once from each image. */
+  int ns1 = meta1->general->sample_count;
+  int ns2 = meta2->general->sample_count;
+  FILE *fp1 = fopenImage(inFile1, "rb");
+  FILE *fp2 = fopenImage(inFile2, "rb");
+  float *band1 = (float *)MALLOC(sizeof(float)*ns1*size);
+  float *band2 = (float *)MALLOC(sizeof(float)*ns2*size);
+  chip_match *row = (chip_match *)MALLOC(sizeof(chip_match)*num_x);
+
   int ii, jj, kk=0, nvalid=0;
   for (ii=0; ii<num_y; ++ii) {
     int tile_y = ii*(size - overlap);
@@ -451,6 +864,8 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
         asfPrintError("Bad tile_y: %d %d %d %d %d\n", ii, num_y, tile_y, size, nl);
       tile_y = nl - size;
     }
+    get_float_lines(fp1, meta1, tile_y, size, band1);
+    get_float_lines(fp2, meta2, tile_y, size, band2);
     for (jj=0; jj<num_x; ++jj) {
       int tile_x = jj*(size - overlap);
       if (tile_x + size > ns) {
@@ -458,40 +873,33 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
           asfPrintError("Bad tile_x: %d %d %d %d %d\n", jj, num_x, tile_x, size, ns);
         tile_x = ns - size;
       }
-      //asfPrintStatus("Matching tile starting at (L,S) (%d,%d)\n", tile_y, tile_x);
-      char trim_append[64];
-      sprintf(trim_append, "_chip_%05d_%05d", tile_y, tile_x);
-      char *trim_chip1 = appendToBasename(inFile1, trim_append);
-      char *trim_chip2 = appendToBasename(inFile2, trim_append);
-      trim(inFile1, trim_chip1, (long long)tile_x, (long long)tile_y, lsz, lsz);
-      trim(inFile2, trim_chip2, (long long)tile_x, (long long)tile_y, lsz, lsz);
-      //char smooth_append[64];
-      //sprintf(smooth_append, "_smooth_chip_%05d_%05d", tile_x, tile_y);
-      //char *smooth_chip1 = appendToBasename(inFile1, smooth_append);
-      //smooth(trim_chip1, smooth_chip1, 3, EDGE_TRUNCATE);
-      float dx, dy, cert;
-      int ok = fftMatchBF(trim_chip1, trim_chip2, &dx, &dy, &cert, tol);
-      matches[kk].x_pos = tile_x;
-      matches[kk].y_pos = tile_y;
-      matches[kk].cert = cert;
-      matches[kk].x_offset = dx;
-      matches[kk].y_offset = dy;
-      matches[kk].valid = ok && cert>tol;
+      memory_source(&row[jj].src1, band1 + tile_x, ns1, size, size);
+      memory_source(&row[jj].src2, band2 + tile_x, ns2, size, size);
+      row[jj].both_ways = TRUE;
+      row[jj].tol = tol;
+      matches[kk+jj].x_pos = tile_x;
+      matches[kk+jj].y_pos = tile_y;
+    }
+    matchChips(row, num_x, size);
+    for (jj=0; jj<num_x; ++jj) {
+      matches[kk].cert = row[jj].cert;
+      matches[kk].x_offset = row[jj].dx;
+      matches[kk].y_offset = row[jj].dy;
+      matches[kk].valid = row[jj].ok && row[jj].cert>tol;
       asfPrintStatus("%s: %5d %5d dx=%7.3f, dy=%7.3f, cert=%5.3f\n",
-                     matches[kk].valid?"GOOD":"BAD ", tile_y, tile_x, dx, dy, cert);
+                     matches[kk].valid?"GOOD":"BAD ", tile_y,
+                     matches[kk].x_pos, row[jj].dx, row[jj].dy, row[jj].cert);
       if (matches[kk].valid) ++nvalid;
       ++kk;
-      //printf("%4.1f ", dx);
-      removeImgAndMeta(trim_chip1);
-      FREE(trim_chip1);
-      removeImgAndMeta(trim_chip2);
-      FREE(trim_chip2);
-      //unlink(smooth_chip1);
-      //FREE(smooth_chip1);
     }
-    //printf("\n");
   }
 
+  FCLOSE(fp1);
+  FCLOSE(fp2);
+  FREE(band1);
+  FREE(band2);
+  FREE(row);
+
   //print_matches(matches, num_x, num_y, stdout);
 
   asfPrintStatus("Removing grid offset outliers.\n");
@@ -828,88 +1236,50 @@ int fftMatch_projList(char *inFile, char *descFile)
 int fftMatch(char *inFile1, char *inFile2, char *corrFile,
           float *bestLocX, float *bestLocY, float *certainty)
 {
-  int nl,ns;
-  int mX,mY;               /*Invariant: 2^mX=ns; 2^mY=nl.*/
-  int chipX, chipY;        /*Chip location (top left corner) in second image*/
-  int chipDX,chipDY;       /*Chip size in second image.*/
-  int searchX,searchY;     /*Maximum distance to search for peak*/
-
   int x,y;
   float doubt;
-  float *corrImage=NULL;
-  FILE *corrF=NULL,*in1F,*in2F;
-  meta_parameters *metaMaster, *metaSlave, *metaOut;
+  float *corrImage;
+  FILE *corrF=NULL,*in2F;
+  meta_parameters *metaSlave, *metaOut=NULL;
+  fft_correlator *corr;
+  match_source slave;
+  match_chip c;
+
+  corr = fft_correlator_new(inFile1);
+  int ns = corr->ns, nl = corr->nl;
 
-  in1F = fopenImage(inFile1,"rb");
   in2F = fopenImage(inFile2,"rb");
-  metaMaster = meta_read(inFile1);
   metaSlave = meta_read(inFile2);
+  file_source(&slave, in2F, metaSlave);
+  setChip(&c, &slave, ns, nl);
 
-  /*Round to find nearest power of 2 for FFT size.*/
-  mX = (int)(log((float)(metaMaster->general->sample_count))/log(2.0)+0.5);
-  mY = (int)(log((float)(metaMaster->general->line_count))/log(2.0)+0.5);
-
-  /* Keep size of fft's reasonable */
-  if (mX > 13) mX = 13;
-  if (mY > 15) mY = 15;
-  ns = 1<<mX;
-  nl = 1<<mY;
-
-  /* Test chip size to see if we have enough memory for it */
-  /* Reduce it if necessary, but not below 1024x1024 (which needs 4 Mb of memory) */
-  float *test_mem = (float *)malloc(sizeof(float)*ns*nl*2);
-  if (!test_mem && !quietflag) asfPrintStatus("\n");
-  while (!test_mem) {
-      mX--;
-      mY--;
-      ns = 1<<mX;
-      nl = 1<<mY;
-      if (ns < 1024 || nl < 1024) {
-          asfPrintError("FFT Size too small (%dx%d)...\n", ns, nl);
-      }
-      if (!quietflag) asfPrintStatus("   Not enough memory... reducing FFT Size to %dx%d\n", ns, nl);
-      test_mem = (float *)malloc(sizeof(float)*ns*nl*2);
-  }
-  FREE(test_mem);
-  if (!quietflag) asfPrintStatus("\n");
-
-  /*Set up search chip size.*/
-  chipDX=MINI(metaSlave->general->sample_count,ns)*3/4;
-  chipDY=MINI(metaSlave->general->line_count,nl)*3/4;
-  chipX=MINI(metaSlave->general->sample_count,ns)/8;
-  chipY=MINI(metaSlave->general->line_count,nl)/8;
-  searchX=MINI(metaSlave->general->sample_count,ns)*3/8;
-  searchY=MINI(metaSlave->general->line_count,nl)*3/8;
-
-  fft2dInit(mY, mX);
-
-  if (!quietflag && ns*nl*2*sizeof(float)>20*1024*1024) {
+  if (!quietflag && ns*nl*3*sizeof(float)>20*1024*1024) {
     asfPrintStatus(
             "   These images will take %d megabytes of memory to match.\n\n",
-            ns*nl*2*sizeof(float)/(1024*1024));
+            ns*nl*3*sizeof(float)/(1024*1024));
   }
 
   /*Optionally open the correlation image file.*/
   if (corrFile) {
     metaOut = meta_read(inFile1);
     metaOut->general->data_type= REAL32;
-    metaOut->general->line_count = 2*searchY;
-    metaOut->general->sample_count = 2*searchX;
+    metaOut->general->line_count = 2*c.searchY;
+    metaOut->general->sample_count = 2*c.searchX;
     corrF=fopenImage(corrFile,"w");
   }
 
   /*Perform the correlation.*/
-  fftProd(in1F,metaMaster,in2F,metaSlave,&corrImage,ns,nl,mX,mY,
-          chipX,chipY,chipDX,chipDY,searchX,searchY);
+  correlator_prod(corr, &slave, &c);
+  corrImage = corr->in2;
 
   /*Optionally write out correlation image.*/
   if (corrFile) {
     int outY=0;
     float *outBuf=(float*)MALLOC(sizeof(float)*metaOut->general->sample_count);
-    for (y=chipY-searchY;y<chipY+searchY;y++) {
+    for (y=c.chipY-c.searchY;y<c.chipY+c.searchY;y++) {
       int index=ns*modY(y,nl);
       int outX=0;
-      for (x=chipX-searchX;x<chipX+searchX;x++) {
+      for (x=c.chipX-c.searchX;x<c.chipX+c.searchX;x++) {
         outBuf[outX++]=corrImage[index+modX(x,ns)];
       }
       put_float_line(corrF,metaOut,outY++,outBuf);
@@ -922,18 +1292,16 @@ int fftMatch(char *inFile1, char *inFile2, char *corrFile,
 
   /*Search correlation image for a peak.*/
   findPeak(corrImage,bestLocX,bestLocY,&doubt,nl,ns,
-           chipX,chipY,searchX,searchY);
+           c.chipX,c.chipY,c.searchX,c.searchY);
            *certainty = 1-doubt;
 
-  FREE(corrImage);
+  fft_correlator_free(corr);
   if (!quietflag) {
     asfPrintStatus("   Offset slave image: dx = %f, dy = %f\n"
                    "   Certainty: %f%%\n",*bestLocX,*bestLocY,100*(1-doubt));
   }
 
   meta_free(metaSlave);
-  meta_free(metaMaster);
-  FCLOSE(in1F);
   FCLOSE(in2F);
 
   return (0);
@@ -61,6 +61,11 @@ G_LOCK_DEFINE_STATIC (current_tile_file_number);
 G_LOCK_DEFINE_STATIC (signal_block_activity);
 #endif
 
+// Without positional I/O, threads using the concurrent cache share
+// the position of the tile file, so their seek-and-read sequences have
+// to be serialized.
+G_LOCK_DEFINE_STATIC (tile_file_position);
+
 // Return a FILE pointer refering to a new, already unlinked file in a
 // location which hopefully has enough free space to serve as a block
 // cache.
@@ -1199,6 +1204,8 @@ load_tile (FloatImage *self, ssize_t x, ssize_t y)
   // Offset of tile in flattened array.
   size_t tile_offset = self->tile_count_x * y + x;
 
+  self->misses++;
+
   // We have to check and see if we have to displace an already loaded
   // tile or not.
   if ( self->tile_queue->length == self->cache_size_in_tiles ) {
@@ -1248,6 +1255,701 @@ load_tile (FloatImage *self, ssize_t x, ssize_t y)
   return tile_address;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// Concurrent tile cache (see float_image_set_concurrent)
+//
+// The memory cache is split into slots of one tile each, and the
+// slots are split into shards, with tile n always cached in shard n %
+// shard_count.  Each shard has its own lock, which is taken only to
+// load a tile into one of its slots.  Tiles that are already loaded
+// are found and pinned without locking: the slot holding each tile is
+// kept in tile_slots, and a slot can't be given to another tile while
+// its pin count is positive.  To take a slot for a new tile, the
+// loading thread swaps the pin count from 0 to SLOT_EVICTING, so
+// anyone trying to pin it in the meantime sees a negative count and
+// goes to the lock instead.  Slots to reuse are picked with the clock
+// algorithm.  The tile file is read and written with pread and pwrite,
+// so no file position is shared between threads.
+//
+// Optionally (see float_image_set_prefetch), a background thread
+// loads tiles that are announced with float_image_prefetch_region, or
+// that look like they're next when misses walk along a row or column
+// of tiles.  It only uses slots that nobody seems to need any more.
+//
+// Lookups are counted per slot, to keep the threads looking up
+// different tiles off each others' cache lines, and added to the
+// shard totals when the slot is reused.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Pin count of a slot that is being given to a new tile.
+#define SLOT_EVICTING (-(1 << 30))
+
+// Most shards we split the cache into, and the fewest slots per shard.
+#define MAX_SHARDS 16
+#define MIN_SLOTS_PER_SHARD 4
+
+// How many tiles ahead we prefetch when misses walk along a row or
+// column of tiles.
+#define PREFETCH_DEPTH 2
+
+// Values of tile_slot.prefetched.
+enum { NOT_PREFETCHED, PREFETCHED, PREFETCH_USED };
+
+typedef struct {
+  float *data;          // Tile pixels, in the image memory cache.
+  gint tile;            // Offset of tile held, or -1.
+  gint pins;            // Threads using data, or negative during eviction.
+  gint referenced;      // Used since the clock hand last went by.
+  gint dirty;           // Set since loaded.
+  gint prefetched;      // Whether tile was loaded by the prefetch thread.
+} tile_slot;
+
+typedef struct {
+  GMutex lock;          // Held while loading tiles into the shard.
+  GCond unpinned;       // For threads waiting for a slot to become free.
+  gint waiters;         // Number of such threads.
+  tile_slot *slots;
+  size_t slot_count;
+  size_t hand;          // Clock hand.
+  // Statistics for the tiles that have been loaded (or, for
+  // prefetch_hits, have left the shard).  Under the lock.
+  guint64 misses, prefetches, prefetch_hits;
+} tile_shard;
+
+struct float_image_shared_cache {
+  tile_shard shards[MAX_SHARDS];
+  size_t shard_count;
+  gint *tile_slots;     // Slot in its shard holding each tile, or -1.
+  int fd;               // Descriptor of tile_file.
+  GThread *prefetch_thread;     // Background loader, or NULL.
+  GAsyncQueue *prefetch_queue;  // Tiles for it to load, plus one.
+  gint prefetch_stopping;       // Set to have it skip the rest of the queue.
+  gint last_miss;       // Tile most recently loaded on demand.
+};
+
+// Read or write (if store is TRUE) tile number tile of the tile file
+// from or to buffer, without using the position of the tile file.
+static void
+tile_file_io (FloatImage *self, size_t tile, float *buffer, gboolean store)
+{
+  off_t offset = (off_t) tile * self->tile_area * sizeof (float);
+  size_t size = self->tile_area * sizeof (float);
+
+#ifndef win32
+  char *pos = (char *) buffer;
+  while ( size > 0 ) {
+    ssize_t count = (store ? pwrite (self->shared->fd, pos, size, offset)
+                           : pread (self->shared->fd, pos, size, offset));
+    if ( count < 0 && errno == EINTR ) {
+      continue;
+    }
+    if ( count <= 0 ) {
+      fprintf (stderr, "error %s tile cache file at offset %lld: %s\n",
+               store ? "writing" : "reading", (long long) offset,
+               count < 0 ? strerror (errno) : "unexpected end of file");
+      g_assert_not_reached ();
+    }
+    pos += count;
+    offset += count;
+    size -= count;
+  }
+#else
+  // No positional I/O here, so we share the file position carefully.
+  G_LOCK (tile_file_position);
+  int return_code = FSEEK64 (self->tile_file, offset, SEEK_SET);
+  g_assert (return_code == 0);
+  size_t count = (store ? fwrite (buffer, 1, size, self->tile_file)
+                        : fread (buffer, 1, size, self->tile_file));
+  if ( count < size ) {
+    perror ("error accessing tile cache file");
+    g_assert_not_reached ();
+  }
+  G_UNLOCK (tile_file_position);
+#endif
+}
+
+static struct float_image_shared_cache *
+shared_cache_new (FloatImage *self)
+{
+  struct float_image_shared_cache *sc
+    = g_new0 (struct float_image_shared_cache, 1);
+  size_t ii, jj;
+
+  sc->shard_count = self->cache_size_in_tiles / MIN_SLOTS_PER_SHARD;
+  if ( sc->shard_count > MAX_SHARDS ) {
+    sc->shard_count = MAX_SHARDS;
+  }
+  if ( sc->shard_count < 1 ) {
+    sc->shard_count = 1;
+  }
+
+  // Hand out the cache memory a tile at a time.
+  float *data = self->cache;
+  for ( ii = 0 ; ii < sc->shard_count ; ii++ ) {
+    tile_shard *shard = &(sc->shards[ii]);
+    g_mutex_init (&(shard->lock));
+    g_cond_init (&(shard->unpinned));
+    shard->slot_count = self->cache_size_in_tiles / sc->shard_count;
+    shard->slots = g_new0 (tile_slot, shard->slot_count);
+    for ( jj = 0 ; jj < shard->slot_count ; jj++ ) {
+      shard->slots[jj].data = data;
+      shard->slots[jj].tile = -1;
+      data += self->tile_area;
+    }
+  }
+  g_assert (data <= self->cache + self->cache_area);
+
+  sc->tile_slots = g_new (gint, self->tile_count);
+  for ( ii = 0 ; ii < self->tile_count ; ii++ ) {
+    sc->tile_slots[ii] = -1;
+  }
+
+  sc->fd = fileno (self->tile_file);
+  sc->last_miss = -1;
+
+  return sc;
+}
+
+static void
+unpin_slot (tile_shard *shard, tile_slot *slot)
+{
+  if ( g_atomic_int_dec_and_test (&(slot->pins))
+       && g_atomic_int_get (&(shard->waiters)) > 0 ) {
+    g_mutex_lock (&(shard->lock));
+    g_cond_broadcast (&(shard->unpinned));
+    g_mutex_unlock (&(shard->lock));
+  }
+}
+
+// Find a slot in shard nobody is using and claim it for eviction, or
+// return NULL if every slot is pinned.  Called with the shard lock held.
+static tile_slot *
+claim_slot (tile_shard *shard)
+{
+  size_t ii;
+
+  // Twice around the clock: the first pass may only clear the
+  // referenced flags.
+  for ( ii = 0 ; ii < 2 * shard->slot_count ; ii++ ) {
+    tile_slot *slot = &(shard->slots[shard->hand]);
+    shard->hand = (shard->hand + 1) % shard->slot_count;
+    if ( g_atomic_int_get (&(slot->pins)) != 0 ) {
+      continue;
+    }
+    if ( g_atomic_int_get (&(slot->referenced)) ) {
+      g_atomic_int_set (&(slot->referenced), FALSE);
+      continue;
+    }
+    if ( g_atomic_int_compare_and_exchange (&(slot->pins), 0,
+                                            SLOT_EVICTING) ) {
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+// Like claim_slot, but only takes slots that are empty or haven't been
+// used since the clock hand last went by, and doesn't move the hand,
+// so that prefetching never pushes out tiles that are still wanted.
+static tile_slot *
+claim_free_slot (tile_shard *shard)
+{
+  size_t ii;
+
+  for ( ii = 0 ; ii < shard->slot_count ; ii++ ) {
+    tile_slot *slot
+      = &(shard->slots[(shard->hand + ii) % shard->slot_count]);
+    if ( slot->tile >= 0
+         && (g_atomic_int_get (&(slot->referenced))
+             || g_atomic_int_get (&(slot->prefetched)) == PREFETCHED) ) {
+      continue;
+    }
+    if ( g_atomic_int_compare_and_exchange (&(slot->pins), 0,
+                                            SLOT_EVICTING) ) {
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+// Put tile in claimed slot, evicting the tile already there (and
+// writing it back if it has changed).  Called with the shard lock
+// held.  The slot is still claimed afterwards.
+static void
+load_slot (FloatImage *self, tile_shard *shard, tile_slot *slot,
+           size_t tile, gboolean prefetch)
+{
+  struct float_image_shared_cache *sc = self->shared;
+
+  if ( slot->tile >= 0 ) {
+    if ( slot->dirty ) {
+      tile_file_io (self, slot->tile, slot->data, TRUE);
+      slot->dirty = FALSE;
+    }
+    g_atomic_int_set (&(sc->tile_slots[slot->tile]), -1);
+    g_atomic_int_set (&(slot->tile), -1);
+    if ( slot->prefetched == PREFETCH_USED ) {
+      shard->prefetch_hits++;
+    }
+  }
+
+  tile_file_io (self, tile, slot->data, FALSE);
+  g_atomic_int_set (&(slot->prefetched),
+                    prefetch ? PREFETCHED : NOT_PREFETCHED);
+  g_atomic_int_set (&(slot->referenced), TRUE);
+  g_atomic_int_set (&(slot->tile), (gint) tile);
+  g_atomic_int_set (&(sc->tile_slots[tile]), (gint) (slot - shard->slots));
+}
+
+// Note that slot, which holds a tile, is being used.  Lookups aren't
+// counted: the slots sit next to each other, so every thread would be
+// writing to the same few cache lines.  Once referenced is set this
+// only reads.
+static void
+mark_used (tile_slot *slot)
+{
+  if ( !g_atomic_int_get (&(slot->referenced)) ) {
+    g_atomic_int_set (&(slot->referenced), TRUE);
+  }
+  if ( G_UNLIKELY (g_atomic_int_get (&(slot->prefetched)) == PREFETCHED) ) {
+    g_atomic_int_compare_and_exchange (&(slot->prefetched), PREFETCHED,
+                                       PREFETCH_USED);
+  }
+}
+
+// Ask the prefetch thread to load tile, if it isn't loaded already.
+// The queue is kept to half the cache, since asking for more than that
+// would just push out the tiles we asked for first.
+static void
+queue_prefetch (FloatImage *self, size_t tile)
+{
+  struct float_image_shared_cache *sc = self->shared;
+
+  if ( g_atomic_int_get (&(sc->tile_slots[tile])) < 0
+       && g_async_queue_length (sc->prefetch_queue)
+          < (gint) self->cache_size_in_tiles / 2 ) {
+    g_async_queue_push (sc->prefetch_queue, GINT_TO_POINTER (tile + 1));
+  }
+}
+
+// If tile, just loaded on demand, follows the last tile loaded on
+// demand along a row or column of tiles, queue the next few tiles in
+// that direction.
+static void
+detect_sequential_misses (FloatImage *self, size_t tile)
+{
+  struct float_image_shared_cache *sc = self->shared;
+  gint last = g_atomic_int_get (&(sc->last_miss));
+  size_t step = 0, ii;
+
+  g_atomic_int_set (&(sc->last_miss), (gint) tile);
+  if ( sc->prefetch_queue == NULL || last < 0 ) {
+    return;
+  }
+
+  if ( tile == (size_t) last + 1 ) {
+    step = 1;
+  }
+  else if ( tile == (size_t) last + self->tile_count_x ) {
+    step = self->tile_count_x;
+  }
+
+  for ( ii = 1 ; step != 0 && ii <= PREFETCH_DEPTH ; ii++ ) {
+    size_t next = tile + ii * step;
+    // Don't wrap around to the next row of tiles.
+    if ( next >= self->tile_count
+         || (step == 1 && next % self->tile_count_x == 0) ) {
+      break;
+    }
+    queue_prefetch (self, next);
+  }
+}
+
+// Load tile into a slot, returning it pinned.  This is the slow path
+// of pin_tile, and could find another thread has loaded the tile in
+// the meantime.
+static tile_slot *
+pin_tile_locked (FloatImage *self, tile_shard *shard, size_t tile)
+{
+  struct float_image_shared_cache *sc = self->shared;
+  tile_slot *slot;
+
+  g_mutex_lock (&(shard->lock));
+
+  for ( ; ; ) {
+    // Slots can only change hands with the lock held, so if the tile
+    // is loaded it is staying put.
+    gint index = sc->tile_slots[tile];
+    if ( index >= 0 ) {
+      slot = &(shard->slots[index]);
+      g_atomic_int_inc (&(slot->pins));
+      mark_used (slot);
+      break;
+    }
+
+    // Announce ourselves before looking for a free slot, so a thread
+    // that unpins one after we've looked at it will wake us.
+    g_atomic_int_inc (&(shard->waiters));
+    slot = claim_slot (shard);
+    if ( slot != NULL ) {
+      g_atomic_int_add (&(shard->waiters), -1);
+    }
+    else {
+      g_cond_wait (&(shard->unpinned), &(shard->lock));
+      g_atomic_int_add (&(shard->waiters), -1);
+      continue;
+    }
+
+    load_slot (self, shard, slot, tile, FALSE);
+    shard->misses++;
+    mark_used (slot);
+    // Trade the eviction claim for our pin.
+    g_atomic_int_add (&(slot->pins), 1 - SLOT_EVICTING);
+    detect_sequential_misses (self, tile);
+    break;
+  }
+
+  g_mutex_unlock (&(shard->lock));
+
+  return slot;
+}
+
+// Return the slot holding tile, loading it if necessary, pinned so
+// that it stays put until the caller is done with it and calls
+// unpin_slot.  Callers mustn't pin more than one tile at a time, or
+// they could end up waiting for each other.
+static tile_slot *
+pin_tile (FloatImage *self, size_t tile, tile_shard **shard)
+{
+  struct float_image_shared_cache *sc = self->shared;
+
+  *shard = &(sc->shards[tile % sc->shard_count]);
+
+  gint index = g_atomic_int_get (&(sc->tile_slots[tile]));
+  if ( G_LIKELY (index >= 0) ) {
+    tile_slot *slot = &((*shard)->slots[index]);
+    // If the slot was being evicted or has moved on to another tile
+    // since we looked it up, take the slow path.
+    if ( G_LIKELY (g_atomic_int_add (&(slot->pins), 1) >= 0
+                   && g_atomic_int_get (&(slot->tile)) == (gint) tile) ) {
+      mark_used (slot);
+      return slot;
+    }
+    unpin_slot (*shard, slot);
+  }
+
+  return pin_tile_locked (self, *shard, tile);
+}
+
+// Load tile into a slot nobody needs, if there is one.  Run by the
+// prefetch thread.
+static void
+prefetch_tile (FloatImage *self, size_t tile)
+{
+  struct float_image_shared_cache *sc = self->shared;
+  tile_shard *shard = &(sc->shards[tile % sc->shard_count]);
+
+  if ( g_atomic_int_get (&(sc->tile_slots[tile])) >= 0 ) {
+    return;
+  }
+
+  g_mutex_lock (&(shard->lock));
+  if ( sc->tile_slots[tile] < 0 ) {
+    tile_slot *slot = claim_free_slot (shard);
+    if ( slot != NULL ) {
+      load_slot (self, shard, slot, tile, TRUE);
+      shard->prefetches++;
+      // Release the claim, and let anyone waiting have a look.
+      g_atomic_int_add (&(slot->pins), -SLOT_EVICTING);
+      if ( g_atomic_int_get (&(shard->waiters)) > 0 ) {
+        g_cond_broadcast (&(shard->unpinned));
+      }
+    }
+  }
+  g_mutex_unlock (&(shard->lock));
+}
+
+static gpointer
+prefetch_thread_func (gpointer data)
+{
+  FloatImage *self = data;
+
+  for ( ; ; ) {
+    gint item
+      = GPOINTER_TO_INT (g_async_queue_pop (self->shared->prefetch_queue));
+    if ( item < 0 ) {           // Told to stop.
+      break;
+    }
+    if ( !g_atomic_int_get (&(self->shared->prefetch_stopping)) ) {
+      prefetch_tile (self, item - 1);
+    }
+  }
+
+  return NULL;
+}
+
+static void
+stop_prefetch_thread (struct float_image_shared_cache *sc)
+{
+  if ( sc->prefetch_thread != NULL ) {
+    // There's no point loading the rest of the queue.
+    g_atomic_int_set (&(sc->prefetch_stopping), TRUE);
+    g_async_queue_push (sc->prefetch_queue, GINT_TO_POINTER (-1));
+    g_thread_join (sc->prefetch_thread);
+    g_async_queue_unref (sc->prefetch_queue);
+    sc->prefetch_thread = NULL;
+    sc->prefetch_queue = NULL;
+  }
+}
+
+static float
+shared_get_pixel (FloatImage *self, size_t tile, size_t offset)
+{
+  tile_shard *shard;
+  tile_slot *slot = pin_tile (self, tile, &shard);
+  float value = slot->data[offset];
+  unpin_slot (shard, slot);
+
+  return value;
+}
+
+static void
+shared_set_pixel (FloatImage *self, size_t tile, size_t offset, float value)
+{
+  tile_shard *shard;
+  tile_slot *slot = pin_tile (self, tile, &shard);
+  slot->data[offset] = value;
+  if ( !g_atomic_int_get (&(slot->dirty)) ) {
+    g_atomic_int_set (&(slot->dirty), TRUE);
+  }
+  unpin_slot (shard, slot);
+}
+
+// Copy a region out a tile at a time, pinning each tile once.
+static void
+shared_get_region (FloatImage *self, size_t x, size_t y, size_t size_x,
+                   size_t size_y, float *buffer)
+{
+  size_t ts = self->tile_size;   // Convenience alias.
+  size_t tx, ty, row;
+
+  for ( ty = y / ts ; ty <= (y + size_y - 1) / ts ; ty++ ) {
+    // Rows of the region in this row of tiles.
+    size_t row_start = MAX (y, ty * ts);
+    size_t row_end = MIN (y + size_y, (ty + 1) * ts);
+    for ( tx = x / ts ; tx <= (x + size_x - 1) / ts ; tx++ ) {
+      size_t col_start = MAX (x, tx * ts);
+      size_t col_end = MIN (x + size_x, (tx + 1) * ts);
+      tile_shard *shard;
+      tile_slot *slot = pin_tile (self, ty * self->tile_count_x + tx, &shard);
+      for ( row = row_start ; row < row_end ; row++ ) {
+        memcpy (buffer + (row - y) * size_x + (col_start - x),
+                slot->data + (row - ty * ts) * ts + (col_start - tx * ts),
+                (col_end - col_start) * sizeof (float));
+      }
+      unpin_slot (shard, slot);
+    }
+  }
+}
+
+// Statistics of the concurrent cache alone.
+static void
+shared_cache_stats (FloatImage *self, float_image_cache_stats *stats)
+{
+  struct float_image_shared_cache *sc = self->shared;
+  size_t ii, jj;
+
+  memset (stats, 0, sizeof (*stats));
+  for ( ii = 0 ; ii < sc->shard_count ; ii++ ) {
+    tile_shard *shard = &(sc->shards[ii]);
+    g_mutex_lock (&(shard->lock));
+    stats->misses += shard->misses;
+    stats->prefetches += shard->prefetches;
+    stats->prefetch_hits += shard->prefetch_hits;
+    for ( jj = 0 ; jj < shard->slot_count ; jj++ ) {
+      tile_slot *slot = &(shard->slots[jj]);
+      if ( g_atomic_int_get (&(slot->prefetched)) == PREFETCH_USED ) {
+        stats->prefetch_hits++;
+      }
+    }
+    g_mutex_unlock (&(shard->lock));
+  }
+}
+
+static void
+shared_cache_reset_stats (FloatImage *self)
+{
+  struct float_image_shared_cache *sc = self->shared;
+  size_t ii, jj;
+
+  for ( ii = 0 ; ii < sc->shard_count ; ii++ ) {
+    tile_shard *shard = &(sc->shards[ii]);
+    g_mutex_lock (&(shard->lock));
+    shard->misses = 0;
+    shard->prefetches = shard->prefetch_hits = 0;
+    for ( jj = 0 ; jj < shard->slot_count ; jj++ ) {
+      g_atomic_int_compare_and_exchange (&(shard->slots[jj].prefetched),
+                                         PREFETCH_USED, NOT_PREFETCHED);
+    }
+    g_mutex_unlock (&(shard->lock));
+  }
+}
+
+// Write any tiles changed in the concurrent cache back to the tile
+// file.  Nobody may be using the image at the time.
+static void
+shared_cache_flush (FloatImage *self)
+{
+  struct float_image_shared_cache *sc = self->shared;
+  size_t ii, jj;
+
+  for ( ii = 0 ; ii < sc->shard_count ; ii++ ) {
+    tile_shard *shard = &(sc->shards[ii]);
+    for ( jj = 0 ; jj < shard->slot_count ; jj++ ) {
+      tile_slot *slot = &(shard->slots[jj]);
+      if ( slot->tile >= 0 && slot->dirty ) {
+        tile_file_io (self, slot->tile, slot->data, TRUE);
+        slot->dirty = FALSE;
+      }
+    }
+  }
+}
+
+static void
+shared_cache_free (FloatImage *self)
+{
+  struct float_image_shared_cache *sc = self->shared;
+  float_image_cache_stats stats;
+  size_t ii;
+
+  stop_prefetch_thread (sc);
+  shared_cache_flush (self);
+
+  // Keep the statistics with the image.
+  shared_cache_stats (self, &stats);
+  self->misses += stats.misses;
+  self->prefetches += stats.prefetches;
+  self->prefetch_hits += stats.prefetch_hits;
+
+  for ( ii = 0 ; ii < sc->shard_count ; ii++ ) {
+    g_mutex_clear (&(sc->shards[ii].lock));
+    g_cond_clear (&(sc->shards[ii].unpinned));
+    g_free (sc->shards[ii].slots);
+  }
+  g_free (sc->tile_slots);
+  g_free (sc);
+  self->shared = NULL;
+}
+
+static void
+synchronize_tile_file_with_memory_cache (FloatImage *self);
+
+void
+float_image_set_concurrent (FloatImage *self, gboolean concurrent)
+{
+  g_assert (self->reference_count > 0); // Harden against missed ref=1 in new
+
+  // Images that fit in a single tile are always in memory, so there
+  // is nothing to do.
+  if ( self->tile_file == NULL ) {
+    return;
+  }
+
+  if ( concurrent && self->shared == NULL ) {
+    // Put everything in the usual cache on disk, then empty it so the
+    // memory can be used for slots.
+    synchronize_tile_file_with_memory_cache (self);
+    int return_code = fflush (self->tile_file);
+    g_assert (return_code == 0);
+    while ( !g_queue_is_empty (self->tile_queue) ) {
+      size_t tile_offset
+        = GPOINTER_TO_INT (g_queue_pop_tail (self->tile_queue));
+      self->tile_addresses[tile_offset] = NULL;
+    }
+    self->shared = shared_cache_new (self);
+  }
+  else if ( !concurrent && self->shared != NULL ) {
+    // The usual cache starts out empty and reads what we write here.
+    shared_cache_free (self);
+  }
+}
+
+void
+float_image_set_prefetch (FloatImage *self, gboolean prefetch)
+{
+  if ( prefetch ) {
+    float_image_set_concurrent (self, TRUE);
+    // Nothing to prefetch if the image is all in memory.
+    if ( self->shared != NULL && self->shared->prefetch_thread == NULL ) {
+      self->shared->prefetch_stopping = FALSE;
+      self->shared->prefetch_queue = g_async_queue_new ();
+      self->shared->prefetch_thread
+        = g_thread_new ("float_image_prefetch", prefetch_thread_func, self);
+    }
+  }
+  else if ( self->shared != NULL ) {
+    stop_prefetch_thread (self->shared);
+  }
+}
+
+void
+float_image_prefetch_region (FloatImage *self, ssize_t x, ssize_t y,
+                             ssize_t size_x, ssize_t size_y)
+{
+  if ( self->shared == NULL || self->shared->prefetch_queue == NULL ) {
+    return;
+  }
+
+  // Clip to the image, so callers can just pad their footprints.
+  ssize_t x_end = MIN (x + size_x, (ssize_t) self->size_x);
+  ssize_t y_end = MIN (y + size_y, (ssize_t) self->size_y);
+  x = MAX (x, 0);
+  y = MAX (y, 0);
+  if ( x >= x_end || y >= y_end ) {
+    return;
+  }
+
+  size_t ts = self->tile_size;   // Convenience alias.
+  size_t tx, ty;
+  for ( ty = y / ts ; ty <= (size_t) (y_end - 1) / ts ; ty++ ) {
+    for ( tx = x / ts ; tx <= (size_t) (x_end - 1) / ts ; tx++ ) {
+      queue_prefetch (self, ty * self->tile_count_x + tx);
+    }
+  }
+}
+
+void
+float_image_get_cache_stats (FloatImage *self,
+                             float_image_cache_stats *stats)
+{
+  // Counts from the usual cache, and from earlier concurrent caches.
+  stats->misses = self->misses;
+  stats->prefetches = self->prefetches;
+  stats->prefetch_hits = self->prefetch_hits;
+
+  if ( self->shared != NULL ) {
+    float_image_cache_stats shared_stats;
+    shared_cache_stats (self, &shared_stats);
+    stats->misses += shared_stats.misses;
+    stats->prefetches += shared_stats.prefetches;
+    stats->prefetch_hits += shared_stats.prefetch_hits;
+  }
+}
+
+void
+float_image_reset_cache_stats (FloatImage *self)
+{
+  self->misses = 0;
+  self->prefetches = self->prefetch_hits = 0;
+  if ( self->shared != NULL ) {
+    shared_cache_reset_stats (self);
+  }
+}
+
 float
 float_image_get_pixel (FloatImage *self, ssize_t x, ssize_t y)
 {
@@ -1268,6 +1970,11 @@ float_image_get_pixel (FloatImage *self, ssize_t x, ssize_t y)
   // Offset of tile x, y, where tiles are viewed as pixels normally are.
   size_t tile_offset = self->tile_count_x * pc_y.quot + pc_x.quot;
 
+  if ( self->shared != NULL ) {
+    return shared_get_pixel (self, tile_offset,
+                             self->tile_size * pc_y.rem + pc_x.rem);
+  }
+
   // Address of data for tile containing pixel of interest (may still
   // have to be loaded from disk cache).
   float *tile_address = self->tile_addresses[tile_offset];
@@ -1295,6 +2002,12 @@ float_image_set_pixel (FloatImage *self, ssize_t x, ssize_t y, float value)
   // Offset of tile x, y, where tiles are viewed as pixels normally are.
   size_t tile_offset = self->tile_count_x * pc_y.quot + pc_x.quot;
 
+  if ( self->shared != NULL ) {
+    shared_set_pixel (self, tile_offset,
+                      self->tile_size * pc_y.rem + pc_x.rem, value);
+    return;
+  }
+
   // Address of data for tile containing pixel of interest (may still
   // have to be loaded from disk cache).
   float *tile_address = self->tile_addresses[tile_offset];
@@ -1321,6 +2034,13 @@ float_image_get_region (FloatImage *self, ssize_t x, ssize_t y, ssize_t size_x,
   g_assert (y >= 0);
   g_assert ((size_t) y + (size_t) size_y - 1 < self->size_y);
 
+  if ( self->shared != NULL ) {
+    if ( size_x > 0 && size_y > 0 ) {
+      shared_get_region (self, x, y, size_x, size_y, buffer);
+    }
+    return;
+  }
+
   ssize_t ii, jj;               // Index variables.
   for ( ii = 0 ; ii < size_y ; ii++ ) {
     for ( jj = 0 ; jj < size_x ; jj++ ) {
@@ -1672,6 +2392,72 @@ float_image_apply_kernel (FloatImage *self, ssize_t x, ssize_t y,
   return sum;
 }
 
+// Splines and accelerators used for bicubic sampling.  These used to
+// be function scoped statics in float_image_sample, which made
+// concurrent sampling of different images impossible, so now each
+// thread gets its own set the first time it needs one.
+typedef struct {
+  double *x_indicies;
+  double *values;
+  gsl_spline **xss;
+  gsl_interp_accel **xias;
+  double *y_spline_indicies;
+  double *y_spline_values;
+  gsl_spline *ys;
+  gsl_interp_accel *yia;
+  size_t ss;
+} bicubic_workspace_t;
+
+static bicubic_workspace_t *
+bicubic_workspace_new (size_t ss)
+{
+  bicubic_workspace_t *self = g_new (bicubic_workspace_t, 1);
+  size_t ii;
+
+  self->ss = ss;
+
+  // Allocate memory for the splines in the x direction.
+  self->x_indicies = g_new (double, ss);
+  self->values = g_new (double, ss);
+  self->xss = g_new (gsl_spline *, ss);
+  self->xias = g_new (gsl_interp_accel *, ss);
+  for ( ii = 0 ; ii < ss ; ii++ ) {
+    self->xss[ii] = gsl_spline_alloc (gsl_interp_cspline, ss);
+    self->xias[ii] = gsl_interp_accel_alloc ();
+  }
+
+  // Allocate memory for the spline in the y direction.
+  self->y_spline_indicies = g_new (double, ss);
+  self->y_spline_values = g_new (double, ss);
+  self->ys = gsl_spline_alloc (gsl_interp_cspline, ss);
+  self->yia = gsl_interp_accel_alloc ();
+
+  return self;
+}
+
+static void
+bicubic_workspace_free (gpointer data)
+{
+  bicubic_workspace_t *self = data;
+  size_t ii;
+
+  for ( ii = 0 ; ii < self->ss ; ii++ ) {
+    gsl_spline_free (self->xss[ii]);
+    gsl_interp_accel_free (self->xias[ii]);
+  }
+  g_free (self->x_indicies);
+  g_free (self->values);
+  g_free (self->xss);
+  g_free (self->xias);
+  g_free (self->y_spline_indicies);
+  g_free (self->y_spline_values);
+  gsl_spline_free (self->ys);
+  gsl_interp_accel_free (self->yia);
+  g_free (self);
+}
+
+static GPrivate bicubic_workspace_key = G_PRIVATE_INIT (bicubic_workspace_free);
+
 float
 float_image_sample (FloatImage *self, float x, float y,
                     float_image_sample_method_t sample_method)
@@ -1706,14 +2492,26 @@ float_image_sample (FloatImage *self, float x, float y,
         size_t tx = xb / ts, ty = yb / ts;
         // Tile offset in flattened list of tile addresses.
         size_t tile_offset = ty * self->tile_count_x + tx;
-        float *tile_address = self->tile_addresses[tile_offset];
-        if ( G_UNLIKELY (tile_address == NULL) ) {
-          tile_address = load_tile (self, tx, ty);
+        if ( self->shared != NULL ) {
+          // Keep the tile pinned while we read all four.
+          tile_shard *shard;
+          tile_slot *slot = pin_tile (self, tile_offset, &shard);
+          ul = slot->data[ybto * self->tile_size + xbto];
+          ur = slot->data[ybto * self->tile_size + xato];
+          ll = slot->data[yato * self->tile_size + xbto];
+          lr = slot->data[yato * self->tile_size + xato];
+          unpin_slot (shard, slot);
+        }
+        else {
+          float *tile_address = self->tile_addresses[tile_offset];
+          if ( G_UNLIKELY (tile_address == NULL) ) {
+            tile_address = load_tile (self, tx, ty);
+          }
+          ul = tile_address[ybto * self->tile_size + xbto];
+          ur = tile_address[ybto * self->tile_size + xato];
+          ll = tile_address[yato * self->tile_size + xbto];
+          lr = tile_address[yato * self->tile_size + xato];
         }
-        ul = tile_address[ybto * self->tile_size + xbto];
-        ur = tile_address[ybto * self->tile_size + xato];
-        ll = tile_address[yato * self->tile_size + xbto];
-        lr = tile_address[yato * self->tile_size + xato];
       }
       else {
         // We are spanning a tile edge, so we just get the pixels
@@ -1733,42 +2531,30 @@ float_image_sample (FloatImage *self, float x, float y,
     break;
   case FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC:
     {
-      static gboolean first_time_through = TRUE;
-      // Splines in the x direction, and their lookup accelerators.
-      static double *x_indicies;
-      static double *values;
-      static gsl_spline **xss;
-      static gsl_interp_accel **xias;
-      // Spline between splines in the y direction, and lookup accelerator.
-      static double *y_spline_indicies;
-      static double *y_spline_values;
-      static gsl_spline *ys;
-      static gsl_interp_accel *yia;
-
       // All these splines have size 4.
       const size_t ss = 4;
 
       size_t ii;                // Index variable.
 
-      if ( first_time_through ) {
-        // Allocate memory for the splines in the x direction.
-        x_indicies = g_new (double, ss);
-        values = g_new (double, ss);
-        xss = g_new (gsl_spline *, ss);
-        xias = g_new (gsl_interp_accel *, ss);
-        for ( ii = 0 ; ii < ss ; ii++ ) {
-          xss[ii] = gsl_spline_alloc (gsl_interp_cspline, ss);
-          xias[ii] = gsl_interp_accel_alloc ();
-        }
-
-        // Allocate memory for the spline in the y direction.
-        y_spline_indicies = g_new (double, ss);
-        y_spline_values = g_new (double, ss);
-        ys = gsl_spline_alloc (gsl_interp_cspline, ss);
-        yia = gsl_interp_accel_alloc ();
-        first_time_through = FALSE;
+      // The spline workspace is per thread, so that images can be
+      // sampled from several threads at once.
+      bicubic_workspace_t *bw = g_private_get (&bicubic_workspace_key);
+      if ( G_UNLIKELY (bw == NULL) ) {
+        bw = bicubic_workspace_new (ss);
+        g_private_set (&bicubic_workspace_key, bw);
       }
 
+      // Splines in the x direction, and their lookup accelerators.
+      double *x_indicies = bw->x_indicies;
+      double *values = bw->values;
+      gsl_spline **xss = bw->xss;
+      gsl_interp_accel **xias = bw->xias;
+      // Spline between splines in the y direction, and lookup accelerator.
+      double *y_spline_indicies = bw->y_spline_indicies;
+      double *y_spline_values = bw->y_spline_values;
+      gsl_spline *ys = bw->ys;
+      gsl_interp_accel *yia = bw->yia;
+
       // Get the values for the nearest 16 points.
       size_t jj;                // Index variable.
       for ( ii = 0 ; ii < ss ; ii++ ) {
@@ -1875,6 +2661,11 @@ synchronize_tile_file_with_memory_cache (FloatImage *self)
   // sense.
   g_assert (self->tile_file != NULL);
 
+  if ( self->shared != NULL ) {
+    shared_cache_flush (self);
+    return;
+  }
+
   guint ii;
   for ( ii = 0 ; ii < self->tile_queue->length ; ii++ ) {
     size_t tile_offset = GPOINTER_TO_INT (g_queue_peek_nth (self->tile_queue,
@@ -2712,6 +3503,10 @@ float_image_unref (FloatImage *self)
 void
 float_image_free (FloatImage *self)
 {
+  if ( self->shared != NULL ) {
+    shared_cache_free (self);
+  }
+
   // Close the tile file (which shouldn't have to remove it since its
   // already unlinked), if we were ever using it.
   if ( self->tile_file != NULL ) {
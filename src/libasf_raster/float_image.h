@@ -5,8 +5,10 @@
 // accesses are spatially correlated.  A variety of useful methods are
 // implemented (filtering, subsetting, interpolating, etc.)
 //
-// Don't try to access the same instance concurrently.  Split your
-// images up into separate instances if you must parallelize things.
+// Don't try to access the same instance concurrently, unless you have
+// switched it to its concurrent cache (see float_image_set_concurrent).
+// Otherwise, split your images up into separate instances if you must
+// parallelize things.
 //
 // For many methods, arguments of type ssize_t are used, but are not
 // allowed to be negative.  This is to help prevent people from
@@ -33,6 +35,13 @@
 #define SSIZE_MAX 32767
 #endif
 
+// Counts of tile cache activity (see float_image_get_cache_stats).
+typedef struct {
+  guint64 misses;           // Lookups that had to wait for their tile.
+  guint64 prefetches;       // Tiles loaded by the prefetch thread.
+  guint64 prefetch_hits;    // Prefetched tiles used before being evicted.
+} float_image_cache_stats;
+
 // Instance structure.  Everything here is private and need not be
 // used or understood by client code, except for the size_x and size_y
 // fields.
@@ -52,6 +61,9 @@ typedef struct {
   FILE *tile_file;          // File with tiles stored contiguously.
   GString *tile_file_name;  // Name of the tile file
   int reference_count;      // For optional reference counting.
+  struct float_image_shared_cache *shared; // Concurrent cache, or NULL.
+  guint64 misses;           // Statistics, not counting the concurrent
+  guint64 prefetches, prefetch_hits; // cache currently in use.
 } FloatImage;
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -497,6 +509,60 @@ float_image_export_as_csv (FloatImage *self, const char *file);
 size_t
 float_image_get_cache_size (FloatImage *self);
 
+// Switch self to a cache that any number of threads can use at once
+// (or back to the usual one, if concurrent is FALSE).  In the
+// concurrent cache, the get_pixel, set_pixel, get_region, sample and
+// other methods that only read or set pixels may be called from
+// different threads at the same time, but different threads setting
+// the same pixel, or reading a pixel being set, get no guarantees.
+// Tiles are pinned while they are being read or written, and the tile
+// file is read with positional I/O, so misses in different parts of
+// the image don't wait for each other.  Lookups are a little slower
+// than in the usual cache, so only use this while sharing self
+// between threads.  Switching must be done while nobody else is using
+// self.
+void
+float_image_set_concurrent (FloatImage *self, gboolean concurrent);
+
+// Start (or stop) a background thread that loads tiles before they
+// are needed, overlapping disk reads with whatever the callers are
+// doing.  It loads the tiles in regions announced with
+// float_image_prefetch_region, and the next few tiles when misses walk
+// along a row or column of tiles.  It only uses cache slots whose
+// tiles haven't been used for a while, so prefetching can't push out
+// tiles that are still being sampled.  Prefetching needs the
+// concurrent cache, so turning it on also switches to that; turning
+// it off leaves the concurrent cache on.  Like set_concurrent, this
+// must be called while nobody else is using self.
+void
+float_image_set_prefetch (FloatImage *self, gboolean prefetch);
+
+// Announce that the region of size_x by size_y pixels with upper left
+// corner x, y will be used soon.  The region may extend past the edges
+// of the image.  Does nothing unless prefetching is on, and can be
+// called from any thread.  Only a region that fits comfortably in the
+// cache is worth announcing: tiles beyond half the cache are dropped.
+void
+float_image_prefetch_region (FloatImage *self, ssize_t x, ssize_t y,
+                             ssize_t size_x, ssize_t size_y);
+
+// Get counts of tile cache activity since self was created (or since
+// the last float_image_reset_cache_stats call).  Lookups that find
+// their tile loaded aren't counted, to keep them cheap.  Misses well
+// above self->tile_count mean tiles are being loaded again and again:
+// the cache is too small for the access pattern, and should be
+// enlarged or the accesses made more local.  With
+// prefetching, prefetch_hits well below prefetches means tiles are
+// being prefetched that are never used.  In the concurrent cache, the
+// counts can be a little off if other threads are using self.
+void
+float_image_get_cache_stats (FloatImage *self,
+                             float_image_cache_stats *stats);
+
+// Zero the counts returned by float_image_get_cache_stats.
+void
+float_image_reset_cache_stats (FloatImage *self);
+
 // Set the image memory cache to size bytes.  Changing the cache size
 // requires the tiling to be recomputed, the on-disk tile cache to be
 // regenerated, and the in memory cache to be flushed, so its slow.
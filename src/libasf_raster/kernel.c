@@ -12,6 +12,7 @@ INPUT: inbuf          - input image buffer
        nLooks         - number of looks in radar image
 *******************************************************************/
 #include <assert.h>
+#include <string.h>
 
 #include "asf.h"
 #include "asf_raster.h"
@@ -64,15 +65,80 @@ double calc_std_dev(float *inbuf, int nSamples, int xSample, int kernel_size,
   return standard_deviation;
 }
 
+/* The speckle filters that only need the center pixel, mean and standard
+   deviation of the window.  Shared by kernel() and the streaming filter, so
+   that they always agree. */
+static float stats_filter(filter_type_t filter_type, double center,
+			  double mean, double standard_deviation,
+			  float damping_factor, int nLooks)
+{
+  double value = 0.0, weight, ci, cu, cmax, a, b, d, rf;
+
+  switch(filter_type)
+    {
+    case LEE:
+      ci = standard_deviation/mean;
+      cu = sqrt(1/(double)nLooks);
+      weight = 1 - SQR(cu)/SQR(ci);
+      value = center*weight + mean*(1-weight);
+      break;
+
+    case ENHANCED_LEE:
+      ci = standard_deviation/mean;
+      cu = sqrt(1/(double)nLooks);
+      cmax = sqrt(1+2.0/(double)nLooks);
+      weight = exp(-damping_factor*(ci-cu)/(cmax-ci));
+      rf = center*weight + center*(1-weight);
+      if (ci <= cu) value = mean;
+      else if ((cu < ci) && (ci < cmax)) value = rf;
+      else if (ci >= cmax) value = center;
+      break;
+
+    case GAMMA_MAP:
+      ci = standard_deviation/mean;
+      cu = sqrt(1/(double)nLooks);
+      cmax = sqrt(2.0)*cu;
+      a = (1+SQR(cu)) / (SQR(ci)-SQR(cu));
+      b = a - nLooks - 1;
+      d = SQR(mean)*SQR(b) + 4*a*nLooks*mean*center;
+      rf = (b*mean + sqrt(d)) / (2*a);
+      if (ci <= cu) value = mean;
+      else if ((cu < ci) && (ci < cmax)) value = rf;
+      else if (ci >= cmax) value = center;
+      break;
+
+    case KUAN:
+      ci = standard_deviation/mean;
+      cu = sqrt(1/(double)nLooks);
+      weight = (1 - SQR(cu)/SQR(ci))/(1 + SQR(cu));
+      value = center*weight + mean*(1-weight);
+      break;
+
+    default:
+      assert (FALSE);
+    }
+
+  return value;
+}
+
+/* FROST weighs column j by exp(-a*|j-half|), with j the column's index in
+   the image.  Far from the left edge those weights underflow, so they are
+   scaled by the largest one in the window (which cancels out) first. */
+static int frost_offset(int xSample, int half)
+{
+  if (xSample-half > half) return xSample-2*half;
+  return 0;
+}
+
 float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples, 
 	     int yLine, int xSample, int kernel_size, float damping_factor, 
 	     int nLooks)
 {
-  double sum = 0.0, mean, standard_deviation, weight, value = 0.0, sigmsq=4;
+  double sum = 0.0, mean, standard_deviation, value = 0.0, sigmsq=4;
   int half = (kernel_size-1)/2;
   int base = xSample-half; //+(nLines-half)*nSamples;
   int total = 0;
-  double ci, cu, cmax, center, a, b, d, rf = 0.0, x, y, m;
+  double ci, cu, cmax, center, a, rf = 0.0, x, y, m;
   float *pix;
   register int i, j;
   
@@ -214,29 +280,15 @@ float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
       break;
 
     case LEE:
-      center = inbuf[base + half + half*nSamples];
-      mean = calc_mean(inbuf, nSamples, xSample, kernel_size);
-      standard_deviation = 
-	calc_std_dev(inbuf, nSamples, xSample, kernel_size, mean);
-      ci = standard_deviation/mean;
-      cu = sqrt(1/(double)nLooks);
-      weight = 1 - SQR(cu)/SQR(ci);
-      value = center*weight + mean*(1-weight);
-      break;
-
     case ENHANCED_LEE:
+    case GAMMA_MAP:
+    case KUAN:
       center = inbuf[base + half + half*nSamples];
       mean = calc_mean(inbuf, nSamples, xSample, kernel_size);
       standard_deviation = 
 	calc_std_dev(inbuf, nSamples, xSample, kernel_size, mean);
-      ci = standard_deviation/mean;
-      cu = sqrt(1/(double)nLooks);
-      cmax = sqrt(1+2.0/(double)nLooks);
-      weight = exp(-damping_factor*(ci-cu)/(cmax-ci));
-      rf = center*weight + center*(1-weight);
-      if (ci <= cu) value = mean;
-      else if ((cu < ci) && (ci < cmax)) value = rf;
-      else if (ci >= cmax) value = center;
+      value = stats_filter(filter_type, center, mean, standard_deviation,
+			   damping_factor, nLooks);
       break;
 
     case FROST:
@@ -247,7 +299,7 @@ float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
       a = damping_factor * SQR(ci);
       for (i=yLine-half; i<=yLine+half; i++) {
 	for (j=xSample-half; j<=xSample+half; j++) {
-          m = exp(-a * abs(j-half));
+          m = exp(-a * (abs(j-half) - frost_offset(xSample, half)));
           rf += m * inbuf[base];
           sum += m;
           base++;
@@ -290,112 +342,402 @@ float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
       else if ((cu <= ci) && (ci <= cmax)) value = sqrt(rf);
       else if (ci > cmax) value = sqrt(center);
       break;
+    }
+
+  return value;
+}
+
+/*******************************************************************
+Streaming kernel filter
+
+kernel_filter() used to re-read kernel_size lines for every output
+line and recompute each window from scratch, which is O(k^2) work per
+pixel.  The stream below reads every input line once into a ring of
+kernel_size lines and keeps running sums for the filters that only
+need window statistics:
+
+  - per-column sums of the values and their squares are updated as
+    lines enter and leave the ring (and recomputed every kernel_size
+    lines, so rounding errors can't build up),
+  - window sums slide along the line using those column sums, so
+    AVERAGE, EDGE, LEE, ENHANCED_LEE, GAMMA_MAP and KUAN cost O(1) per
+    pixel and FROST O(k),
+  - MEDIAN keeps each column of the window sorted and slides a sorted
+    window along the line by merging, instead of sorting k^2 values
+    per pixel.
+
+The remaining filters hand the window in the ring to kernel(), which
+sees exactly the buffer layout kernel_filter() always passed it.
+*******************************************************************/
+
+/* Ordering used for the median: NaNs sort after all numbers. */
+#define SORTS_BEFORE(a,b) ((a) < (b) || ((b) != (b) && (a) == (a)))
+#define SAME_VALUE(a,b) ((a) == (b) || ((a) != (a) && (b) != (b)))
+
+struct kernel_stream_struct {
+  filter_type_t filter;
+  int kernel_size, half, nSamples, nLooks;
+  float damping;
+  int lines;       /* Lines pushed so far. */
 
+  /* Line n is stored at ring lines n%k and n%k+k, so the k most recent
+     lines are always contiguous, oldest first. */
+  float *ring;
+
+  double *col_sum, *col_sum_sq;   /* Running column sums. */
+  float *col_sorted;              /* MEDIAN: each column, sorted. */
+  float *win, *win_next;          /* MEDIAN: the window, sorted. */
+  float *scratch;                 /* ENHANCED_FROST: copy of the window. */
+};
+
+static int uses_window_sums(filter_type_t filter)
+{
+  switch (filter) {
+    case AVERAGE:
+    case EDGE:
+    case LEE:
+    case ENHANCED_LEE:
     case GAMMA_MAP:
-      center = inbuf[base + half + half*nSamples];
-      mean = calc_mean(inbuf, nSamples, xSample, kernel_size);
-      standard_deviation = 
-	calc_std_dev(inbuf, nSamples, xSample, kernel_size, mean);
-      ci = standard_deviation/mean;
-      cu = sqrt(1/(double)nLooks);
-      cmax = sqrt(2.0)*cu;
-      a = (1+SQR(cu)) / (SQR(ci)-SQR(cu));
-      b = a - nLooks - 1;
-      d = SQR(mean)*SQR(b) + 4*a*nLooks*mean*center;
-      rf = (b*mean + sqrt(d)) / (2*a);
-      if (ci <= cu) value = mean;
-      else if ((cu < ci) && (ci < cmax)) value = rf;
-      else if (ci >= cmax) value = center;
-      break;
-     
     case KUAN:
-      center = inbuf[base + half + half*nSamples];
-      mean = calc_mean(inbuf, nSamples, xSample, kernel_size);
-      standard_deviation = 
-	calc_std_dev(inbuf, nSamples, xSample, kernel_size, mean);
-      ci = standard_deviation/mean;
-      cu = sqrt(1/(double)nLooks);
-      weight = (1 - SQR(cu)/SQR(ci))/(1 + SQR(cu));
-      value = center*weight + mean*(1-weight);
-      break;
+    case FROST:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static int compare_nan_last(const void *a, const void *b)
+{
+  float fa = *(const float *)a, fb = *(const float *)b;
+  if (SORTS_BEFORE(fa, fb)) return -1;
+  if (SORTS_BEFORE(fb, fa)) return 1;
+  return 0;
+}
+
+kernel_stream *kernel_stream_new(filter_type_t filter, int kernel_size,
+				 float damping, int nLooks, int nSamples)
+{
+  kernel_stream *ks;
+  int k = kernel_size;
+
+  if (kernel_size < 1 || kernel_size%2 != 1)
+    asfPrintError("Kernel size must be odd.\n");
+
+  ks = (kernel_stream *) MALLOC(sizeof(kernel_stream));
+  ks->filter = filter;
+  ks->kernel_size = k;
+  ks->half = (k-1)/2;
+  ks->nSamples = nSamples;
+  ks->nLooks = nLooks;
+  ks->damping = damping;
+  ks->lines = 0;
+  ks->ring = (float *) MALLOC(2*k*nSamples*sizeof(float));
+  ks->col_sum = ks->col_sum_sq = NULL;
+  ks->col_sorted = ks->win = ks->win_next = ks->scratch = NULL;
+
+  if (uses_window_sums(filter)) {
+    ks->col_sum = (double *) CALLOC(nSamples, sizeof(double));
+    ks->col_sum_sq = (double *) CALLOC(nSamples, sizeof(double));
+  }
+  else if (filter == MEDIAN) {
+    ks->col_sorted = (float *) MALLOC(k*nSamples*sizeof(float));
+    ks->win = (float *) MALLOC(k*k*sizeof(float));
+    ks->win_next = (float *) MALLOC(k*k*sizeof(float));
+  }
+  else if (filter == ENHANCED_FROST)
+    ks->scratch = (float *) MALLOC(k*nSamples*sizeof(float));
+
+  return ks;
+}
+
+void kernel_stream_free(kernel_stream *ks)
+{
+  if (!ks)
+    return;
+  FREE(ks->ring);
+  if (ks->col_sum) FREE(ks->col_sum);
+  if (ks->col_sum_sq) FREE(ks->col_sum_sq);
+  if (ks->col_sorted) FREE(ks->col_sorted);
+  if (ks->win) FREE(ks->win);
+  if (ks->win_next) FREE(ks->win_next);
+  if (ks->scratch) FREE(ks->scratch);
+  FREE(ks);
+}
+
+/* Replace 'old' by 'new' in the sorted column 'col' of 'count' values
+   ('old' is ignored when count < k, the column is still filling up). */
+static void column_replace(float *col, int count, int full, float old,
+			   float new)
+{
+  int ii;
+
+  if (count == full) {
+    for (ii=0; ii<count && !SAME_VALUE(col[ii], old); ii++)
+      ;
+    assert (ii < count);
+    for (; ii<count-1; ii++)
+      col[ii] = col[ii+1];
+    --count;
+  }
+  for (ii=count; ii>0 && SORTS_BEFORE(new, col[ii-1]); ii--)
+    col[ii] = col[ii-1];
+  col[ii] = new;
+}
+
+/* Slide the sorted window one column: drop the values in 'out', add the
+   ones in 'in' (both sorted, k values each). */
+static void window_slide(const float *win, int n, const float *out,
+			 const float *in, int k, float *next)
+{
+  int ii, oo = 0, pp = 0, nn = 0;
+
+  for (ii=0; ii<n; ii++) {
+    while (pp < k && SORTS_BEFORE(in[pp], win[ii]))
+      next[nn++] = in[pp++];
+    if (oo < k && SAME_VALUE(win[ii], out[oo]))
+      oo++;
+    else
+      next[nn++] = win[ii];
+  }
+  while (pp < k)
+    next[nn++] = in[pp++];
+  assert (oo == k && nn == n);
+}
+
+static void median_line(kernel_stream *ks, float *outbuf)
+{
+  int k = ks->kernel_size, half = ks->half, ns = ks->nSamples;
+  int n = k*k, jj;
+  /* Same rank kernel() picks, which is one past the middle. */
+  int rank = n/2 + 1 < n ? n/2 + 1 : n - 1;
+  float *tmp;
+
+  if (ns < k)
+    return;
+  memcpy(ks->win, ks->col_sorted, n*sizeof(float));
+  qsort(ks->win, n, sizeof(float), compare_nan_last);
+  outbuf[half] = ks->win[rank];
+
+  for (jj=half+1; jj<ns-half; jj++) {
+    window_slide(ks->win, n, ks->col_sorted + (jj-half-1)*k,
+		 ks->col_sorted + (jj+half)*k, k, ks->win_next);
+    tmp = ks->win;
+    ks->win = ks->win_next;
+    ks->win_next = tmp;
+    outbuf[jj] = ks->win[rank];
+  }
+}
+
+static void window_sums_line(kernel_stream *ks, const float *window,
+			     float *outbuf)
+{
+  int k = ks->kernel_size, half = ks->half, ns = ks->nSamples;
+  int n = k*k, ii, jj, offset;
+  double s1 = 0.0, s2 = 0.0, mean, var, standard_deviation, center;
+  double ci, a, m, rf, sum;
+  const double *c1 = ks->col_sum, *c2 = ks->col_sum_sq;
+
+  for (jj=half; jj<ns-half; jj++) {
+    // Slide the window sums, starting over every k columns.
+    if ((jj-half)%k == 0) {
+      s1 = s2 = 0.0;
+      for (ii=jj-half; ii<=jj+half; ii++) {
+	s1 += c1[ii];
+	s2 += c2[ii];
+      }
+    }
+    else {
+      s1 += c1[jj+half] - c1[jj-half-1];
+      s2 += c2[jj+half] - c2[jj-half-1];
     }
 
-  return value;
+    mean = s1/n;
+    // Anything below the rounding noise of the sums is a flat window.
+    var = s2 - s1*mean;
+    if (var <= 1e-12*s2)
+      var = 0.0;
+    standard_deviation = n > 1 ? sqrt(var/(n-1)) : 0.0;
+    center = window[jj + half*ns];
+
+    switch (ks->filter)
+      {
+      case AVERAGE:
+	outbuf[jj] = mean;
+	break;
+
+      case EDGE:
+	outbuf[jj] = center - (float)mean;
+	break;
+
+      case FROST:
+	// Same weights as kernel(), summed a column at a time.
+	ci = standard_deviation/mean;
+	a = ks->damping * SQR(ci);
+	rf = sum = 0.0;
+	offset = frost_offset(jj, half);
+	for (ii=jj-half; ii<=jj+half; ii++) {
+	  m = exp(-a * (abs(ii-half) - offset));
+	  rf += m * c1[ii];
+	  sum += m;
+	}
+	outbuf[jj] = rf / (sum*k);
+	break;
+
+      default:
+	outbuf[jj] = stats_filter(ks->filter, center, mean,
+				  standard_deviation, ks->damping, ks->nLooks);
+	break;
+      }
+  }
+}
+
+static void column_sums_add(kernel_stream *ks, const float *line, int sign)
+{
+  int jj;
+  for (jj=0; jj<ks->nSamples; jj++) {
+    ks->col_sum[jj] += sign*(double)line[jj];
+    ks->col_sum_sq[jj] += sign*SQR((double)line[jj]);
+  }
+}
+
+/*******************************************************************
+FUNCTION NAME:   kernel_stream_push - feeds the next input line
+                 into a streaming kernel filter
+
+  Returns TRUE once enough lines have been pushed to fill the kernel,
+in which case outbuf holds the filtered line kernel_size/2 lines
+above the one just pushed.  Until then outbuf isn't touched, and may
+be NULL.  As in kernel_filter(), the kernel_size/2
+samples at either end of the line are set to zero.
+*******************************************************************/
+int kernel_stream_push(kernel_stream *ks, const float *line, float *outbuf)
+{
+  int k = ks->kernel_size, half = ks->half, ns = ks->nSamples;
+  int n = ks->lines, slot = n%k, jj;
+  float *window;
+
+  if (ks->col_sum && n >= k && n%k != 0)
+    column_sums_add(ks, ks->ring + slot*ns, -1);
+  if (ks->col_sorted) {
+    for (jj=0; jj<ns; jj++)
+      column_replace(ks->col_sorted + jj*k, n < k ? n : k, k,
+		     n < k ? 0.0 : ks->ring[jj + slot*ns], line[jj]);
+  }
+
+  memcpy(ks->ring + slot*ns, line, ns*sizeof(float));
+  memcpy(ks->ring + (slot+k)*ns, line, ns*sizeof(float));
+  ks->lines = ++n;
+
+  if (ks->col_sum) {
+    if (n > k && slot == 0) {
+      // Start over from the lines in the ring now and again.
+      memset(ks->col_sum, 0, ns*sizeof(double));
+      memset(ks->col_sum_sq, 0, ns*sizeof(double));
+      for (jj=0; jj<k; jj++)
+	column_sums_add(ks, ks->ring + jj*ns, 1);
+    }
+    else
+      column_sums_add(ks, line, 1);
+  }
+
+  if (n < k)
+    return FALSE;
+
+  window = ks->ring + (n%k)*ns;
+  for (jj=0; jj<half && jj<ns; jj++)
+    outbuf[jj] = outbuf[ns-1-jj] = 0.0;
+
+  if (ks->col_sum)
+    window_sums_line(ks, window, outbuf);
+  else if (ks->col_sorted)
+    median_line(ks, outbuf);
+  else {
+    if (ks->scratch) {
+      // ENHANCED_FROST works on its input buffer in place.
+      memcpy(ks->scratch, window, k*ns*sizeof(float));
+      window = ks->scratch;
+    }
+    for (jj=half; jj<ns-half; jj++)
+      outbuf[jj] = kernel(ks->filter, window, k, ns, n-1-half, jj, k,
+			  ks->damping, ks->nLooks);
+  }
+
+  return TRUE;
+}
+
+/* Parameters of kernel_filter()'s strip filter. */
+typedef struct {
+  filter_type_t filter;
+  int kernel_size, nLooks;
+  float damping;
+  int nLines, nSamples;
+} kernel_strip_params;
+
+/* Filters one strip of the image with a kernel_stream of its own.  The
+   kernel_size/2 lines at the top and bottom of the image are set to zero. */
+static void kernel_strip(void *data, const float *in, int in_first,
+			 int in_lines, float *out, int out_first, int out_lines)
+{
+  kernel_strip_params *p = (kernel_strip_params *) data;
+  int ns = p->nSamples, half = (p->kernel_size - 1) / 2;
+  int ii, line;
+  kernel_stream *ks;
+
+  for (ii=0; ii<out_lines; ii++) {
+    line = out_first + ii;
+    if (line < half || line >= p->nLines - half)
+      memset(out + (size_t)ii*ns, 0, ns*sizeof(float));
+  }
+
+  ks = kernel_stream_new(p->filter, p->kernel_size, p->damping, p->nLooks,
+			 ns);
+  for (ii=0; ii<in_lines; ii++) {
+    // Makes output line in_first+ii-half, once the kernel is full.
+    line = in_first + ii - half;
+    if (ii < p->kernel_size - 1)
+      kernel_stream_push(ks, in + (size_t)ii*ns, NULL);
+    else {
+      assert (line >= out_first && line < out_first + out_lines);
+      kernel_stream_push(ks, in + (size_t)ii*ns,
+			 out + (size_t)(line - out_first)*ns);
+    }
+  }
+  kernel_stream_free(ks);
 }
 
 void kernel_filter(char *inFile, char *outFile, filter_type_t filter, 
 		   int kernel_size, float damping, int nLooks)
 {
-  int ii, jj, kk;
+  int kk;
   char **band_names=NULL;
+  kernel_strip_params params;
 
   // Create metadata
   meta_parameters *inMeta = meta_read(inFile);
   meta_parameters *outMeta = meta_read(inFile);
   outMeta->general->data_type = REAL32;
   
-  int inLines = inMeta->general->line_count;
-  int inSamples = inMeta->general->sample_count;
-  int half = (kernel_size - 1) / 2;
-  int numLines = kernel_size;
-  
   // Open output files
   FILE *fpIn = fopenImage(inFile,"rb");
   FILE *fpOut = fopenImage(outFile,"wb");
-    
-  // Allocate memory for input and output file
-  float *inbuf= (float*) MALLOC (kernel_size*inSamples*sizeof(float));
-  float *outbuf = (float*) MALLOC (inSamples*sizeof(float));
 
-  // Go through all bands
+  params.filter = filter;
+  params.kernel_size = kernel_size;
+  params.damping = damping;
+  params.nLooks = nLooks;
+  params.nLines = inMeta->general->line_count;
+  params.nSamples = inMeta->general->sample_count;
+    
+  // Go through all bands, a strip of lines per thread at a time
   int band_count = inMeta->general->band_count;
   band_names = extract_band_names(inMeta->general->bands, band_count);
   for (kk=0; kk<band_count; kk++) {
-  
     asfPrintStatus("\nFiltering %s ...\n", band_names[kk]);
-
-    // Set upper margin of image to input pixel values
-    for (ii=0; ii<half; ii++) {
-      for (jj=0; jj<inSamples; jj++) outbuf[jj] = 0.0;
-      put_band_float_line(fpOut, outMeta, kk, ii, outbuf);
-      asfLineMeter(ii, inLines);
-    }
-  
-    int startLine;
-    
-    // Filtering the 'regular' lines
-    for (ii=half; ii<inLines-half; ii++) {
-      
-      // Read next set of lines for kernel
-      startLine = ii - half;
-      if (startLine<0) startLine = 0;
-      if (inLines < (kernel_size+startLine)) numLines = inLines - startLine;
-      get_band_float_lines(fpIn, inMeta, kk, startLine, numLines, inbuf); 
-      
-      // Calculate the usual output line
-      for (jj=0; jj<half; jj++) outbuf[jj] = 0.0;
-      for (jj=half; jj<inSamples-half; jj++) {
-	outbuf[jj] = kernel(filter, inbuf, numLines, inSamples, ii, jj,
-			    kernel_size, damping, nLooks);
-      }
-      for (jj=inSamples-half; jj<inSamples; jj++) outbuf[jj] = 0.0;
-      
-      // Write line to disk
-      put_band_float_line(fpOut, outMeta, kk, ii, outbuf);
-      asfLineMeter(ii, inLines);
-    }
-    
-    // Set lower margin of image to input pixel values
-    for (ii=inLines-half; ii<inLines; ii++) {
-      for (jj=0; jj<inSamples; jj++) outbuf[jj] = 0.0;
-      put_band_float_line(fpOut, outMeta, kk, ii, outbuf);
-      asfLineMeter(ii, inLines);
-    }  
+    filter_band_strips(fpIn, inMeta, kk, fpOut, outMeta, kk,
+		       (kernel_size - 1) / 2, kernel_strip, &params);
   }
 
   // Clean up
-  FREE(inbuf);
-  FREE(outbuf);
   FCLOSE(fpOut);
   FCLOSE(fpIn);
   
@@ -0,0 +1,178 @@
+// Benchmark for the streaming kernel filter kernel_filter() uses.  On a
+// synthetic speckled scene, reports the time per line of the original
+// per-pixel kernel() loop (re-reading kernel_size lines per output line)
+// and of kernel_stream_push(), for several filters and kernel sizes, and
+// checks that they agree: exactly for MEDIAN and the filters the stream
+// hands to kernel(), and to within rounding for the ones it computes
+// from running sums.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "asf.h"
+#include "asf_raster.h"
+
+// Size of the synthetic scene.
+#define LINES 1024
+#define SAMPLES 2048
+
+// Lines the original loop is timed (and compared) on.
+#define REFERENCE_LINES 48
+
+// Number of looks of the speckle.
+#define LOOKS 4
+
+// Mean backscatter of the scene.
+#define MEAN 200.0
+
+// Filters computed from running sums may differ from kernel() by this
+// much, relative to the scene's mean, from summing in a different order.
+#define TOLERANCE 1e-4
+
+static const char *filter_name(filter_type_t filter)
+{
+  switch (filter) {
+    case AVERAGE:        return "AVERAGE";
+    case GAUSSIAN:       return "GAUSSIAN";
+    case EDGE:           return "EDGE";
+    case MEDIAN:         return "MEDIAN";
+    case LEE:            return "LEE";
+    case ENHANCED_LEE:   return "ENHANCED_LEE";
+    case FROST:          return "FROST";
+    case GAMMA_MAP:      return "GAMMA_MAP";
+    case KUAN:           return "KUAN";
+    case ENHANCED_FROST: return "ENHANCED_FROST";
+    case SOBEL:          return "SOBEL";
+    default:             return "?";
+  }
+}
+
+static double elapsed_seconds(struct timeval *start, struct timeval *end)
+{
+  return (end->tv_sec - start->tv_sec) +
+    (end->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+// Whether the stream computes filter from running sums, which round
+// differently from kernel()'s sums.
+static int rounds_differently(filter_type_t filter)
+{
+  switch (filter) {
+    case AVERAGE:
+    case EDGE:
+    case LEE:
+    case ENHANCED_LEE:
+    case GAMMA_MAP:
+    case KUAN:
+    case FROST:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+// Bright and dark blocks, with LOOKS-look gamma speckle on top.
+static float *make_scene(void)
+{
+  float *scene = (float *) MALLOC(sizeof(float) * LINES * SAMPLES);
+  int ii, jj, kk;
+
+  for (ii = 0; ii < LINES; ii++)
+    for (jj = 0; jj < SAMPLES; jj++) {
+      double backscatter = ((ii / 64 + jj / 64) % 3 + 1) * MEAN / 2;
+      double speckle = 0.0;
+      for (kk = 0; kk < LOOKS; kk++)
+        speckle -= log((rand() + 1.0) / (RAND_MAX + 2.0));
+      scene[ii * SAMPLES + jj] = backscatter * speckle / LOOKS;
+    }
+
+  return scene;
+}
+
+static int benchmark(const float *scene, filter_type_t filter, int size)
+{
+  int half = (size - 1) / 2, first = LINES / 2;
+  float *inbuf = (float *) MALLOC(sizeof(float) * size * SAMPLES);
+  float *ref = (float *) CALLOC(REFERENCE_LINES * SAMPLES, sizeof(float));
+  float *outbuf = (float *) MALLOC(sizeof(float) * SAMPLES);
+  double tolerance = rounds_differently(filter) ? TOLERANCE * MEAN : 0.0;
+  double reference_time, stream_time, max_diff = 0.0;
+  struct timeval start, end;
+  long mismatches = 0;
+  kernel_stream *ks;
+  int ii, jj, ok;
+
+  // The original loop, on lines first .. first+REFERENCE_LINES-1.
+  gettimeofday(&start, NULL);
+  for (ii = 0; ii < REFERENCE_LINES; ii++) {
+    memcpy(inbuf, scene + (first + ii - half) * SAMPLES,
+           size * SAMPLES * sizeof(float));
+    for (jj = half; jj < SAMPLES - half; jj++)
+      ref[ii * SAMPLES + jj] = kernel(filter, inbuf, size, SAMPLES,
+                                      first + ii, jj, size, 1.0, LOOKS);
+  }
+  gettimeofday(&end, NULL);
+  reference_time = elapsed_seconds(&start, &end) / REFERENCE_LINES;
+
+  // The stream, on the whole scene.
+  gettimeofday(&start, NULL);
+  ks = kernel_stream_new(filter, size, 1.0, LOOKS, SAMPLES);
+  for (ii = 0; ii < LINES; ii++) {
+    int line = ii - half;
+    if (!kernel_stream_push(ks, scene + ii * SAMPLES, outbuf))
+      continue;
+    if (line < first || line >= first + REFERENCE_LINES)
+      continue;
+    for (jj = 0; jj < SAMPLES; jj++) {
+      float expected = ref[(line - first) * SAMPLES + jj];
+      double diff = fabs(outbuf[jj] - expected);
+      if (outbuf[jj] == expected || (isnan(outbuf[jj]) && isnan(expected)))
+        continue;
+      if (!(diff <= tolerance))
+        mismatches++;
+      else if (diff > max_diff)
+        max_diff = diff;
+    }
+  }
+  kernel_stream_free(ks);
+  gettimeofday(&end, NULL);
+  stream_time = elapsed_seconds(&start, &end) / (LINES - 2 * half);
+
+  ok = mismatches == 0;
+  printf("%-14s %2dx%-2d  kernel() %8.3f ms/line  stream %7.3f ms/line  "
+         "x%6.1f  max diff %.1e", filter_name(filter), size, size,
+         reference_time * 1e3, stream_time * 1e3,
+         reference_time / stream_time, max_diff);
+  if (!ok)
+    printf("  MISMATCH (%ld samples)", mismatches);
+  printf("\n");
+
+  FREE(inbuf);
+  FREE(ref);
+  FREE(outbuf);
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  static const filter_type_t filters[] = { AVERAGE, EDGE, LEE, ENHANCED_LEE,
+                                           GAMMA_MAP, KUAN, FROST, MEDIAN,
+                                           GAUSSIAN };
+  static const int sizes[] = { 3, 7, 15 };
+  float *scene = make_scene();
+  int ii, jj, ok = TRUE;
+
+  for (ii = 0; ii < (int) (sizeof(filters) / sizeof(filters[0])); ii++)
+    for (jj = 0; jj < (int) (sizeof(sizes) / sizeof(sizes[0])); jj++)
+      ok &= benchmark(scene, filters[ii], sizes[jj]);
+
+  // The filters the stream leaves to kernel().
+  ok &= benchmark(scene, ENHANCED_FROST, 3);
+  ok &= benchmark(scene, SOBEL, 3);
+
+  FREE(scene);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
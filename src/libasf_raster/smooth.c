@@ -2,11 +2,15 @@
 #include "asf_raster.h"
 #include <assert.h>
 
-static float prev_col_result = -99999.99999;
-static int prev_col_total = -1;
+// Running result along a line, carried from one pixel to the next.
+typedef struct {
+  float prev_col_result;
+  int prev_col_total;
+} smooth_state;
 
 static float filter(      /****************************************/
-    float *inbuf,         /* input image buffer                   */
+    smooth_state *st,     /* result for the previous pixel        */
+    const float *inbuf,   /* input image buffer                   */
     int    nl,            /* number of lines for inbuf            */
     int    ns,            /* number of samples per line for inbuf */
     int    y,             /* line number in the image             */
@@ -18,16 +22,16 @@ static float filter(      /****************************************/
   // off the window, add the row that moved into the window
   if (x>0) {
 
-    //assert(prev_col_result != -99999.99999);
-    assert(prev_col_total != -1);
+    //assert(st->prev_col_result != -99999.99999);
+    assert(st->prev_col_total != -1);
 
     int half = (nsk-1)/2;
-    float kersum = prev_col_result*prev_col_total;
+    float kersum = st->prev_col_result*st->prev_col_total;
     int left = x-half-1;
     int include_left = left>=0;
     int right = x+half;
     int include_right = x+half<ns;
-    int total = prev_col_total;
+    int total = st->prev_col_total;
     int i;
 
     if (include_left) {
@@ -53,8 +57,8 @@ static float filter(      /****************************************/
     if (total != 0)
       kersum /= (float)total;
 
-    prev_col_result = kersum;
-    prev_col_total = total;
+    st->prev_col_result = kersum;
+    st->prev_col_total = total;
 
     return kersum;
   }
@@ -94,13 +98,51 @@ static float filter(      /****************************************/
     if (total != 0)
       kersum /= (float) total;
 
-    prev_col_result = kersum;
-    prev_col_total = total;
+    st->prev_col_result = kersum;
+    st->prev_col_total = total;
 
     return (kersum);
   }
 }
 
+// Parameters of smooth()'s strip filter.
+typedef struct {
+  int kernel_size;
+  int nl, ns;
+} smooth_params;
+
+static void smooth_strip(void *data, const float *in, int in_first,
+                         int in_lines, float *out, int out_first,
+                         int out_lines)
+{
+  smooth_params *p = (smooth_params *) data;
+  int kernel_size = p->kernel_size, nl = p->nl, ns = p->ns;
+  int half = (kernel_size-1)/2;
+  smooth_state st = { -99999.99999, -1 };
+  int ii, jj;
+
+  for (ii=0; ii<out_lines; ++ii) {
+    int line = out_first + ii;
+
+    // figure out which window in the image we need
+    int start_line = line - half;
+    if (start_line < 0) start_line = 0;
+
+    int n_lines = kernel_size;
+    if (nl < kernel_size + start_line)
+      n_lines = nl-start_line;
+
+    assert(start_line >= in_first &&
+           start_line + n_lines <= in_first + in_lines);
+    const float *inbuf = in + (size_t)(start_line - in_first)*ns;
+
+    // apply the smoothing
+    for (jj = 0; jj < ns; jj++)
+      out[(size_t)ii*ns + jj] =
+        filter(&st, inbuf, n_lines, ns, line, jj, kernel_size);
+  }
+}
+
 static const char *edge_strat_to_string(edge_strategy_t edge_strategy)
 {
   switch (edge_strategy) {
@@ -141,61 +183,27 @@ int smooth(const char *infile, const char *outfile, int kernel_size,
 
   meta_parameters *metaIn = meta_read(infile);
   meta_parameters *metaOut = meta_read(infile);
-  int nl = metaIn->general->line_count;
-  int ns = metaIn->general->sample_count;
-
-  float *inbuf = (float *) MALLOC (kernel_size*ns*sizeof(float));
-  float *outbuf = (float *) MALLOC (ns*sizeof(float));
+  smooth_params params;
+  params.kernel_size = kernel_size;
+  params.nl = metaIn->general->line_count;
+  params.ns = metaIn->general->sample_count;
 
   char **band_name = extract_band_names(metaIn->general->bands,
                                         metaIn->general->band_count);
 
   FILE *fpin = fopenImage(in_img, "rb");
+  FILE *fpout = fopenImage(out_img, "wb");
 
-  int ii, jj, kk;
+  // Each band is smoothed a strip of lines per thread at a time
+  int ii, kk;
   for (kk = 0; kk < metaIn->general->band_count; ++kk) {
     if (metaIn->general->band_count != 1)
       asfPrintStatus("Smoothing band: %s\n", band_name[kk]);
-
-    FILE *fpout = fopenImage(out_img, kk==0 ? "wb" : "ab");
-
-    for (ii=0; ii<nl; ++ii) {
-
-      // figure out which window in the image we need to read
-      int start_line = ii - half;
-      if (start_line < 0) start_line = 0;
-
-      int n_lines = kernel_size;
-      if (nl < kernel_size + start_line)
-        n_lines = nl-start_line;
-
-      // adjust for the band number
-      start_line += kk*nl; 
-
-      if (ii==0) {
-        // read the window
-        get_float_lines(fpin, metaIn, start_line, n_lines, inbuf);
-      }
-      else {
-        // already read in most of these lines -- shift items in the buffer
-        if (start_line > 0)
-          for (jj = 0; jj < n_lines-1; ++jj)
-            memcpy(inbuf + jj*ns, inbuf + (jj+1)*ns, ns*sizeof(float));
-        int new_line = start_line + n_lines - 1;
-        if (new_line < nl)
-          get_float_line(fpin, metaIn, new_line, inbuf + (n_lines-1)*ns);
-      }
-
-      // apply the smoothing
-      for (jj = 0; jj < ns; jj++)
-        outbuf[jj] = filter(inbuf,n_lines,ns,ii,jj,kernel_size);
-
-      put_float_line(fpout, metaOut, ii, outbuf);
-      asfLineMeter(ii,nl);
-    }
-
-    FCLOSE(fpout);
+    filter_band_strips(fpin, metaIn, kk, fpout, metaOut, kk, half,
+                       smooth_strip, &params);
   }
+
+  FCLOSE(fpout);
   FCLOSE(fpin);
 
   // metadata does not need any changes
@@ -209,9 +217,6 @@ int smooth(const char *infile, const char *outfile, int kernel_size,
   meta_free(metaOut);
   meta_free(metaIn);
 
-  FREE(inbuf);
-  FREE(outbuf);
-
   free(in_img);
   free(out_img);
   free(out_meta_name);
@@ -1,15 +1,18 @@
 #include <math.h>
 #include <assert.h>
+#include <glib.h>
 #include "asf.h"
 #include "asf_endian.h"
 #include "asf_nan.h"
 #include "asf_raster.h"
 #include "envi.h"
 
-#define SWAP(a,b) { register float t=(a); (a)=(b); (b)=t; }
-#define EPSILON 1.E-15
 #define INIT_MINMAX 1.E+30 
 
+static void band_stats_from_file(const char *inFile, meta_parameters *meta,
+                                 int band_number, int thread_count,
+                                 int report, band_stats_t *bs);
+
 /* Calculate minimum, maximum, mean and standard deviation for a floating point
    image. A mask value can be defined that is excluded from this calculation.
    If no mask value is supposed to be used, pass the mask value as NAN. */
@@ -89,52 +92,34 @@ void estimate_stats(FILE *fpIn, meta_parameters *meta, int lines, int samples,
             double *stdDev)
 {
   float *imgLine = (float *) MALLOC(sizeof(float) * samples);
-  double *stats, sum=0.0, variance=0.0;
-  int ii, kk, line_increment, sample_increment;
-  long pix=0, valid=0;
+  float *points;
+  band_stats_t *bs = MALLOC(sizeof(band_stats_t));
+  double percentValid;
+  int ii, kk, pix, line_increment, sample_increment;
 
 #define grid 100
 
   /* Define the necessary parameters */
-  stats = (double *) MALLOC(sizeof(double) * grid * grid);
-  line_increment = lines / grid;
-  sample_increment = samples / grid;
+  line_increment = MAX(lines / grid, 1);
+  sample_increment = MAX(samples / grid, 1);
+  points = (float *) MALLOC(sizeof(float) * (samples / sample_increment + 1));
 
-  /* Collect values from sample grid */
+  /* Collect values from sample grid, a line at a time */
+  band_stats_init(bs, mask);
   for (ii=0; ii<lines; ii+=line_increment) {
       get_float_line(fpIn, meta, ii, imgLine);
-      for (kk=0; kk<samples; kk+=sample_increment) {
-          if (!ISNAN(mask)) {
-              if (FLOAT_EQUIVALENT(imgLine[kk], mask)) stats[pix] = NAN;
-              else {
-                  stats[pix] = imgLine[kk];
-                  valid++;
-              }
-          }
-          else {
-              stats[pix] = imgLine[kk];
-              valid++;
-          }
-          pix++;
-      }
+      for (pix=0, kk=0; kk<samples; kk+=sample_increment)
+          points[pix++] = imgLine[kk];
+      band_stats_add(bs, points, pix);
   }
   FSEEK64(fpIn, 0, 0);
 
   /* Estimate min, max, mean and standard deviation */
-  *min = 99999;
-  *max = -99999;
-  for (ii=0; ii<grid*grid; ii++)
-      if (!ISNAN(stats[ii])) {
-          if (stats[ii] < *min) *min = stats[ii];
-          if (stats[ii] > *max) *max = stats[ii];
-          sum += stats[ii];
-      }
-      *mean = sum / valid;
-      for (ii=0; ii<grid*grid; ii++)
-          if (!ISNAN(stats[ii])) variance += (stats[ii]-*mean) * (stats[ii]-*mean);
-      *stdDev = sqrt(variance / (valid-1));
+  band_stats_get(bs, min, max, mean, stdDev, &percentValid);
 
-  return;
+  FREE(points);
+  FREE(imgLine);
+  FREE(bs);
 }
 
 void
@@ -308,12 +293,7 @@ calc_stats_from_file_ext(const char *inFile, char *band, double mask,
                          double *stdDev, double *percentValid, 
                          gsl_histogram **histogram)
 {
-    int ii,jj;
-
-    *min = 999999;
-    *max = -999999;
-    *mean = 0.0;
-    *percentValid = 0.0;
+    band_stats_t *bs = MALLOC(sizeof(band_stats_t));
 
     meta_parameters *meta = meta_read(inFile);
     int band_number;
@@ -326,68 +306,21 @@ calc_stats_from_file_ext(const char *inFile, char *band, double mask,
                                     meta->general->band_count, band);
     }
 
-    long offset = meta->general->line_count * band_number;
-    float *data = MALLOC(sizeof(float) * meta->general->sample_count);
-
-    // pass 1 -- calculate mean, min & max
-    FILE *fp = FOPEN(inFile, "rb");
-    long long pixel_count=0;
-    asfPrintStatus("\nCalculating min, max, and mean...\n");
-    for (ii=0; ii<meta->general->line_count; ++ii) {
-        asfPercentMeter(((double)ii/(double)meta->general->line_count));
-        get_float_line(fp, meta, ii + offset, data);
-
-        for (jj=0; jj<meta->general->sample_count; ++jj) {
-          if (meta_is_valid_double(data[jj])) {
-            if (ISNAN(mask) || !FLOAT_EQUIVALENT(data[jj], mask)) {
-                if (data[jj] < *min) *min = data[jj];
-                if (data[jj] > *max) *max = data[jj];
-                *mean += data[jj];
-                ++pixel_count;
-            }
-          }
-        }
-    }
-    asfPercentMeter(1.0);
-    FCLOSE(fp);
-
-    *mean /= pixel_count;
-    long total_count = meta->general->line_count*meta->general->sample_count;
-    *percentValid = (double)pixel_count*100.0/total_count;
+    // Single pass -- min, max, mean, standard deviation and histogram
+    asfPrintStatus("\nCalculating min, max, mean, standard deviation "
+                   "and histogram...\n");
+    band_stats_init(bs, mask);
+    band_stats_from_file(inFile, meta, band_number, get_stats_thread_count(),
+                         TRUE, bs);
+    band_stats_get(bs, min, max, mean, stdDev, percentValid);
 
     // Guard against weird data
     if(!(*min<*max)) *max = *min + 1;
 
-    // Initialize the histogram.
-    const int num_bins = 256;
-    gsl_histogram *hist = gsl_histogram_alloc (num_bins);
-    gsl_histogram_set_ranges_uniform (hist, *min, *max);
-    *stdDev = 0.0;
-
-    // pass 2 -- update histogram, calculate standard deviation
-    fp = FOPEN(inFile, "rb");
-    asfPrintStatus("\nCalculating standard deviation and histogram...\n");
-    for (ii=0; ii<meta->general->line_count; ++ii) {
-        asfPercentMeter(((double)ii/(double)meta->general->line_count));
-        get_float_line(fp, meta, ii + offset, data);
-
-        for (jj=0; jj<meta->general->sample_count; ++jj) {
-          if (meta_is_valid_double(data[jj])) {
-            if (ISNAN(mask) || !FLOAT_EQUIVALENT(data[jj], mask)) {
-                *stdDev += (data[jj] - *mean) * (data[jj] - *mean);
-                gsl_histogram_increment (hist, data[jj]);
-            }
-          }
-        }
-    }
-    asfPercentMeter(1.0);
-    FCLOSE(fp);
-    *stdDev = sqrt(*stdDev/(pixel_count - 1));
+    *histogram = band_stats_histogram(bs, 256, *min, *max);
 
-    FREE(data);
+    FREE(bs);
     meta_free(meta);
-
-    *histogram = hist;
 }
 
 void
@@ -407,81 +340,34 @@ calc_stats_rmse_from_file_ext(const char *inFile, char *band, double mask,
                               double *stdDev, double *rmse, 
                               double *percentValid, gsl_histogram **histogram)
 {
-    double se;
-    int ii,jj;
-
-    *min = 999999;
-    *max = -999999;
-    *mean = 0.0;
-    *percentValid = 0.0;
+    band_stats_t *bs = MALLOC(sizeof(band_stats_t));
 
     meta_parameters *meta = meta_read(inFile);
     int band_number =
         (!band || strlen(band) == 0 || strcmp(band, "???") == 0) ? 0 :
         get_band_number(meta->general->bands, meta->general->band_count, band);
-    long offset = meta->general->line_count * band_number;
-    float *data = MALLOC(sizeof(float) * meta->general->sample_count);
-
-    // pass 1 -- calculate mean, min & max
-    FILE *fp = FOPEN(inFile, "rb");
-    long long pixel_count=0;
-    asfPrintStatus("\nCalculating min, max, and mean...\n");
-    for (ii=0; ii<meta->general->line_count; ++ii) {
-        asfPercentMeter(((double)ii/(double)meta->general->line_count));
-        get_float_line(fp, meta, ii + offset, data);
 
-        for (jj=0; jj<meta->general->sample_count; ++jj) {
-            if (ISNAN(mask) || !FLOAT_EQUIVALENT(data[jj], mask)) {
-                if (data[jj] < *min) *min = data[jj];
-                if (data[jj] > *max) *max = data[jj];
-                *mean += data[jj];
-                ++pixel_count;
-            }
-        }
-    }
-    asfPercentMeter(1.0);
-    FCLOSE(fp);
+    // Single pass -- min, max, mean, standard deviation, rmse and histogram
+    asfPrintStatus("\nCalculating min, max, mean, standard deviation, rmse, "
+                   "and histogram...\n");
+    band_stats_init(bs, mask);
+    band_stats_from_file(inFile, meta, band_number, get_stats_thread_count(),
+                         TRUE, bs);
+    band_stats_get(bs, min, max, mean, stdDev, percentValid);
 
-    *mean /= pixel_count;
-    long total_count = meta->general->line_count*meta->general->sample_count;
-    *percentValid = (double)pixel_count*100.0/total_count;
+    // The rmse is taken about the mean
+    *rmse = *stdDev;
 
     // Guard against weird data
     if(!(*min<*max)) *max = *min + 1;
 
-    // Initialize the histogram.
-    const int num_bins = 256;
-    gsl_histogram *hist = gsl_histogram_alloc (num_bins);
     if (meta->general->data_type == ASF_BYTE)
-      gsl_histogram_set_ranges_uniform (hist, 0, 255);
+      *histogram = band_stats_histogram(bs, 256, 0, 255);
     else
-      gsl_histogram_set_ranges_uniform (hist, *min, *max);
-    *stdDev = 0.0;
-
-    // pass 2 -- update histogram, calculate standard deviation
-    fp = FOPEN(inFile, "rb");
-    asfPrintStatus("\nCalculating standard deviation, rmse, and histogram...\n");
-    se = 0.0;
-    for (ii=0; ii<meta->general->line_count; ++ii) {
-        asfPercentMeter(((double)ii/(double)meta->general->line_count));
-        get_float_line(fp, meta, ii + offset, data);
+      *histogram = band_stats_histogram(bs, 256, *min, *max);
 
-        for (jj=0; jj<meta->general->sample_count; ++jj) {
-            if (ISNAN(mask) || !FLOAT_EQUIVALENT(data[jj], mask)) {
-                *stdDev += (data[jj] - *mean) * (data[jj] - *mean);
-                gsl_histogram_increment (hist, data[jj]);
-                se += (data[jj] - *mean) * (data[jj] - *mean);
-            }
-        }
-    }
-    asfPercentMeter(1.0);
-    FCLOSE(fp);
-    *stdDev = sqrt(*stdDev/(pixel_count - 1));
-    *rmse = sqrt(se/(pixel_count - 1));
-
-    FREE(data);
-
-    *histogram = hist;
+    FREE(bs);
+    meta_free(meta);
 }
 
 void calc_minmax_polsarpro(const char *inFile, double *min, double *max)
@@ -517,154 +403,642 @@ void calc_minmax_polsarpro(const char *inFile, double *min, double *max)
   FREE(enviName);
 }
 
-// Coming from "Numerical recipes in C" - Eric Pottier's implementation
-static float median_value(float *data, long n)
+/* Robust min and max of a band, for stretching it: the median of the
+   lower half of the pixels, then of the lower half of those, and once
+   more (the 1/16 quantile), and the same on the upper side for the
+   max.  Both are read off the band's quantile bins in one pass.  */
+void calc_minmax_median(const char *inFile, char *band, double mask, 
+			double *min, double *max)
 {
-  int low = 0;
-  int high = n - 1;
-  int median = (low + high) / 2;
-  int middle, ll, hh;
+  band_stats_t *bs = MALLOC(sizeof(band_stats_t));
   
-  for (;;) {
-    if (high <= low)
-      return data[median];
-    if (high == low + 1) {
-      if (data[low] > data[high])
-	SWAP(data[low], data[high]);
-      return data[median];
+  meta_parameters *meta = meta_read(inFile);
+  int band_number =
+    (!band || strlen(band) == 0 || strcmp(band, "???") == 0) ? 0 :
+    get_band_number(meta->general->bands, meta->general->band_count, band);
+
+  asfPrintStatus("\nCalculating min and max using median...\n");
+  band_stats_init(bs, mask);
+  band_stats_from_file(inFile, meta, band_number, get_stats_thread_count(),
+                       TRUE, bs);
+
+  *min = band_stats_quantile(bs, 1.0/16.0);
+  *max = band_stats_quantile(bs, 15.0/16.0);
+
+  FREE(bs);
+  meta_free(meta);
+}
+
+// Number of bands calc_band_stats_from_file() works on at once.
+// 0 means one per processor.
+static int stats_thread_count = 0;
+
+void set_stats_thread_count(int thread_count)
+{
+  asfRequire(thread_count >= 0, "Invalid statistics thread count: %d\n",
+             thread_count);
+  stats_thread_count = thread_count;
+}
+
+int get_stats_thread_count(void)
+{
+  if (stats_thread_count == 0)
+    return g_get_num_processors();
+  return stats_thread_count;
+}
+
+/* Running statistics of one band, accumulated a line at a time as the
+   band is read or written, so a single pass over the data gives all of
+   them: min, max, mean, standard deviation, a histogram and quantiles.
+   Pixels are skipped the same way calc_stats_from_file() skips them:
+   invalid values, and values equal to the mask (unless it is NAN).
+
+   The histogram is kept in BAND_STATS_BINS fine bins whose width is a
+   power of two and whose edges are multiples of the width.  When a value
+   falls outside their range, the bins are moved to take it in, and
+   made twice as wide (pairs of bins merged) as often as needed.  Since
+   the edges of a grid are also edges of any finer one, histograms can
+   always be brought to the same grid and added, so statistics of strips
+   read by different threads merge exactly like the moments do.
+   Histograms over other bins (band_stats_histogram()) are derived from
+   the fine bins, so they are good to within a fine bin.
+
+   That is too coarse for quantiles: a few outliers stretch the fine
+   bins until most of the pixels share a handful of them.  Quantiles
+   (band_stats_quantile()) come from a second set of bins, spaced
+   logarithmically on each side of zero instead.  A bin is picked by the
+   exponent and the top BAND_STATS_QBITS bits of the mantissa of a
+   pixel's magnitude, so each spans a fixed fraction of its values
+   (1/128), and the bins are the same for every band.  Only the
+   BAND_STATS_QBINS bins up to the largest magnitude seen are kept (32
+   octaves); smaller magnitudes go into the lowest of them.  These merge
+   exactly as well.  */
+
+static int band_stats_counted(float value, double mask)
+{
+  return meta_is_valid_double(value) &&
+    (ISNAN(mask) || !FLOAT_EQUIVALENT(value, mask));
+}
+
+// Move the histogram onto the grid of bins of the given width starting at
+// start.  The width must be a multiple of the current one.
+static void band_stats_rebin(band_stats_t *bs, double width, double start)
+{
+  long long bins[BAND_STATS_BINS];
+  int ii, bin;
+
+  memset(bins, 0, sizeof(bins));
+  if (bs->bin_width > 0.0) {
+    for (ii=0; ii<BAND_STATS_BINS; ii++) {
+      if (bs->bins[ii] == 0)
+        continue;
+      bin = (int) floor((bs->bin_start + ii * bs->bin_width - start) / width);
+      if (bin < 0) bin = 0;
+      if (bin >= BAND_STATS_BINS) bin = BAND_STATS_BINS - 1;
+      bins[bin] += bs->bins[ii];
     }
-  
-    middle = (low + high) / 2;
-    if (data[middle] > data[high])
-      SWAP(data[middle], data[high]);
-    if (data[low] > data[high])
-      SWAP(data[low], data[high]);
-    if (data[middle] > data[low])
-      SWAP(data[middle], data[low]);
-
-    SWAP(data[middle], data[low+1]);
-
-    ll = low + 1;
-    hh = high;
-    for (;;) {
-      do ll++; while (data[low] > data[ll]);
-      do hh--; while (data[hh] > data[low]);
-      if (hh < ll)
-	break;
-      SWAP(data[ll], data[hh]);
+  }
+  memcpy(bs->bins, bins, sizeof(bins));
+  bs->bin_width = width;
+  bs->bin_start = start;
+}
+
+// Make sure the histogram covers [lo,hi] with bins at least min_width
+// wide.
+static void band_stats_cover(band_stats_t *bs, double lo, double hi,
+                             double min_width)
+{
+  double width = bs->bin_width;
+  double first, last, slack;
+  int exponent;
+
+  if (bs->count > 0) {
+    if (bs->min < lo) lo = bs->min;
+    if (bs->max > hi) hi = bs->max;
+  }
+  if (width == 0.0) {
+    // First values in: take the finest grid that holds them
+    double range = hi - lo;
+    if (!(range > 0.0))
+      range = MAX(fabs(lo), 1.0) * 1.E-6;
+    frexp(range / BAND_STATS_BINS, &exponent);
+    width = ldexp(1.0, exponent);
+  }
+  while (width < min_width)
+    width *= 2.0;
+  if (width == bs->bin_width && lo >= bs->bin_start &&
+      hi < bs->bin_start + BAND_STATS_BINS * width)
+    return;
+
+  while (floor(hi / width) - floor(lo / width) >= BAND_STATS_BINS)
+    width *= 2.0;
+
+  // Center the values, to leave room on both sides for the next ones
+  first = floor(lo / width);
+  last = floor(hi / width);
+  slack = BAND_STATS_BINS - 1 - (last - first);
+  band_stats_rebin(bs, width, (first - floor(slack / 2)) * width);
+}
+
+// Logarithmic bin key of a float: the bits of its magnitude, less the
+// low bits of the mantissa.  Keys increase with the magnitude.
+static int band_stats_qkey(float value)
+{
+  union { float f; guint32 u; } bits;
+
+  bits.f = fabsf(value);
+  return (int) (bits.u >> (23 - BAND_STATS_QBITS));
+}
+
+// Smallest magnitude in the bin with the given key
+static double band_stats_qkey_value(int key)
+{
+  union { float f; guint32 u; } bits;
+
+  bits.u = (guint32) key << (23 - BAND_STATS_QBITS);
+  return bits.f;
+}
+
+// Key of the lowest kept logarithmic bin, when top is the highest
+static int band_stats_qbase(int top)
+{
+  return top >= BAND_STATS_QBINS ? top - BAND_STATS_QBINS + 1 : 0;
+}
+
+// Make sure the logarithmic bins on one side of zero reach up to the bin
+// with key top, folding the ones that drop out into the lowest kept bin.
+static void band_stats_qcover(band_stats_t *bs, int side, int top)
+{
+  long long *bins = bs->qbins[side];
+  int shift, ii;
+
+  if (top <= bs->qtop[side])
+    return;
+  if (bs->qtop[side] >= 0) {
+    shift = band_stats_qbase(top) - band_stats_qbase(bs->qtop[side]);
+    if (shift >= BAND_STATS_QBINS) {
+      for (ii=1; ii<BAND_STATS_QBINS; ii++)
+        bins[0] += bins[ii];
+      memset(bins + 1, 0, sizeof(long long) * (BAND_STATS_QBINS - 1));
+    }
+    else if (shift > 0) {
+      for (ii=1; ii<=shift; ii++)
+        bins[0] += bins[ii];
+      memmove(bins + 1, bins + shift + 1,
+              sizeof(long long) * (BAND_STATS_QBINS - shift - 1));
+      memset(bins + BAND_STATS_QBINS - shift, 0, sizeof(long long) * shift);
     }
+  }
+  bs->qtop[side] = top;
+}
 
-    SWAP(data[low], data[hh]);
+void band_stats_init(band_stats_t *bs, double mask)
+{
+  bs->mask = mask;
+  bs->min = INIT_MINMAX;
+  bs->max = -INIT_MINMAX;
+  bs->mean = 0.0;
+  bs->m2 = 0.0;
+  bs->count = 0;
+  bs->total = 0;
+  bs->bin_start = 0.0;
+  bs->bin_width = 0.0;
+  memset(bs->bins, 0, sizeof(bs->bins));
+  bs->zeros = 0;
+  bs->qtop[0] = bs->qtop[1] = -1;
+  memset(bs->qbins, 0, sizeof(bs->qbins));
+}
 
-    if (hh <= median) 
-      low = ll;
-    if (hh >= median)
-      high = hh - 1;
+// Fold the moments of a set of count pixels into the running ones
+static void band_stats_combine(band_stats_t *bs, double min, double max,
+                               double mean, double m2, long long count)
+{
+  long long total = bs->count + count;
+  double delta = mean - bs->mean;
+
+  if (count == 0)
+    return;
+  if (bs->count == 0) {
+    bs->min = min;
+    bs->max = max;
+    bs->mean = mean;
+    bs->m2 = m2;
+    bs->count = count;
+    return;
   }
+
+  bs->mean += delta * count / total;
+  bs->m2 += m2 + delta * delta * ((double)bs->count * count / total);
+  if (min < bs->min) bs->min = min;
+  if (max > bs->max) bs->max = max;
+  bs->count = total;
 }
 
-void calc_minmax_median(const char *inFile, char *band, double mask, 
-			double *min, double *max)
+void band_stats_add(band_stats_t *bs, const float *data, int n)
 {
-  long long ii, jj;
-  float logeps = 10.0 * log10(EPSILON);
-  float median, median0;
-  
-  meta_parameters *meta = meta_read(inFile);
-  int band_number =
-    (!band || strlen(band) == 0 || strcmp(band, "???") == 0) ? 0 :
-    get_band_number(meta->general->bands, meta->general->band_count, band);
-  long sample_count = meta->general->sample_count;
-  long line_count = meta->general->line_count;
-  long pixel_count = sample_count*line_count;
-  long offset = line_count * band_number;
-  float *data_line = MALLOC(sizeof(float) * sample_count);
-  float *data = MALLOC(sizeof(float) * pixel_count);
-  float *data2 = MALLOC(sizeof(float) * pixel_count);
-			    
-  // Culling invalid pixels
-  FILE *fp = FOPEN(inFile, "rb");
-  long valid_pixel_count = 0;
-  asfPrintStatus("\nCalculating min and max using median...\n");
-  for (ii=0; ii<line_count; ++ii) {
-    get_float_line(fp, meta, ii + offset, data_line);
-    asfPercentMeter(((double)ii/(double)line_count));
-    for (jj=0; jj<sample_count; ++jj) {
-      if (!FLOAT_EQUIVALENT(data_line[jj], -9999.99) ||
-	  !FLOAT_EQUIVALENT(data_line[jj], logeps) ||
-	  ISNAN(mask)) {
-	data[valid_pixel_count] = data_line[jj];
-	valid_pixel_count++;
+  double min = INIT_MINMAX, max = -INIT_MINMAX;
+  double sum = 0.0, mean, m2 = 0.0, scale;
+  long long count = 0;
+  int ii, bin, side, qbase[2];
+
+  // The line is small enough to stay in cache, so take its range and
+  // mean first, and its squared deviations from that mean and its
+  // histograms in a second sweep, then fold it into the running totals.
+  bs->total += n;
+  for (ii=0; ii<n; ii++) {
+    if (band_stats_counted(data[ii], bs->mask)) {
+      if (data[ii] < min) min = data[ii];
+      if (data[ii] > max) max = data[ii];
+      sum += data[ii];
+      ++count;
+    }
+  }
+  if (count == 0)
+    return;
+
+  mean = sum / count;
+  band_stats_cover(bs, min, max, 0.0);
+  if (min < 0.0)
+    band_stats_qcover(bs, 0, band_stats_qkey(min));
+  if (max > 0.0)
+    band_stats_qcover(bs, 1, band_stats_qkey(max));
+  qbase[0] = band_stats_qbase(bs->qtop[0]);
+  qbase[1] = band_stats_qbase(bs->qtop[1]);
+  scale = 1.0 / bs->bin_width;
+  for (ii=0; ii<n; ii++) {
+    if (band_stats_counted(data[ii], bs->mask)) {
+      m2 += (data[ii] - mean) * (data[ii] - mean);
+      bin = (int) ((data[ii] - bs->bin_start) * scale);
+      if (bin < 0) bin = 0;
+      if (bin >= BAND_STATS_BINS) bin = BAND_STATS_BINS - 1;
+      bs->bins[bin]++;
+      if (data[ii] == 0.0) {
+        bs->zeros++;
+        continue;
       }
+      side = data[ii] > 0.0;
+      bin = band_stats_qkey(data[ii]) - qbase[side];
+      if (bin < 0) bin = 0;
+      bs->qbins[side][bin]++;
     }
   }
-  asfPercentMeter(1.0);
-  FCLOSE(fp);
-  FREE(data_line);
-  
-  // Determine initial min and max
-  *min = INIT_MINMAX;
-  *max = -INIT_MINMAX;
-  float minmin = INIT_MINMAX;
-  float maxmax = -INIT_MINMAX;
-  for (ii=0; ii<valid_pixel_count; ++ii) {
-    data2[ii] = data[ii];
-    if (data[ii] < minmin)
-      minmin = data[ii];
-    if (data[ii] > maxmax)
-      maxmax = data[ii];
+  band_stats_combine(bs, min, max, mean, m2, count);
+}
+
+// Combine the statistics of two disjoint sets of pixels, e.g. two
+// strips of the same band gathered by different threads.
+void band_stats_merge(band_stats_t *bs, const band_stats_t *other)
+{
+  int ii, bin, side, base, other_base;
+
+  bs->total += other->total;
+  if (other->count == 0)
+    return;
+
+  band_stats_cover(bs, other->min, other->max, other->bin_width);
+  for (ii=0; ii<BAND_STATS_BINS; ii++) {
+    if (other->bins[ii] == 0)
+      continue;
+    bin = (int) floor((other->bin_start + ii * other->bin_width -
+                       bs->bin_start) / bs->bin_width);
+    if (bin < 0) bin = 0;
+    if (bin >= BAND_STATS_BINS) bin = BAND_STATS_BINS - 1;
+    bs->bins[bin] += other->bins[ii];
   }
 
-  median0 = median_value(data, valid_pixel_count);
-
-  // Determine minimum
-  median = median0;
-  *min = median0;
-  for (ii=0; ii<3; ii++) {
-    pixel_count = -1;
-    for (jj=0; jj<valid_pixel_count; ++jj)
-      if (median0 == minmin) {
-	if (data[jj] <= median) {
-	  pixel_count++;
-	  data2[pixel_count] = data[jj];
-	}
-      }
-      else {
-	if (data[jj] < median) {
-	  pixel_count++;
-	  data2[pixel_count] = data[jj];
-	}
-      }
-    median = median_value(data2, pixel_count);
-    if (median == minmin)
-      median = *min;
-    *min = median;
+  bs->zeros += other->zeros;
+  for (side=0; side<2; side++) {
+    if (other->qtop[side] < 0)
+      continue;
+    band_stats_qcover(bs, side, other->qtop[side]);
+    base = band_stats_qbase(bs->qtop[side]);
+    other_base = band_stats_qbase(other->qtop[side]);
+    for (ii=0; ii<BAND_STATS_QBINS; ii++) {
+      if (other->qbins[side][ii] == 0)
+        continue;
+      bin = other_base + ii - base;
+      if (bin < 0) bin = 0;
+      bs->qbins[side][bin] += other->qbins[side][ii];
+    }
   }
 
-  // Determine maximum
-  median = median0;
-  *max = median0;
-  for (ii=0; ii<3; ii++) {
-    pixel_count = -1;
-    for (jj=0; jj<valid_pixel_count; ++jj)
-      if (median0 == maxmax) {
-	if (data[jj] >= median) {
-	  pixel_count++;
-	  data2[pixel_count] = data[jj];
-	}
-      }
-      else {
-	if (data[jj] > median) {
-	  pixel_count++;
-	  data2[pixel_count] = data[jj];
-	}
+  band_stats_combine(bs, other->min, other->max, other->mean, other->m2,
+                     other->count);
+}
+
+void band_stats_get(const band_stats_t *bs, double *min, double *max,
+                    double *mean, double *stdDev, double *percentValid)
+{
+  *min = bs->min;
+  *max = bs->max;
+  *mean = bs->mean;
+  *stdDev = bs->count > 1 ? sqrt(bs->m2 / (bs->count - 1)) : 0.0;
+  *percentValid = bs->total > 0 ? (double)bs->count*100.0/bs->total : 0.0;
+}
+
+/* Value below which a fraction q of the counted pixels lie, interpolated
+   linearly within the logarithmic bin holding it, so it is good to 1/128
+   of its value (unless it is more than 32 octaves smaller than the
+   largest magnitude on its side of zero).  band_stats_quantile(bs, 0.5)
+   is the median.  */
+double band_stats_quantile(const band_stats_t *bs, double q)
+{
+  double target, below = 0.0, lo, hi, value;
+  int found = FALSE;
+  long long n;
+  int ii, base;
+
+  if (bs->count == 0)
+    return NAN;
+  if (q <= 0.0)
+    return bs->min;
+  if (q >= 1.0)
+    return bs->max;
+
+  // Walk the bins in increasing order of value: the negative ones from
+  // the largest magnitude down, then zero, then the positive ones up.
+  target = q * bs->count;
+  value = bs->max;
+  base = band_stats_qbase(bs->qtop[0]);
+  for (ii=BAND_STATS_QBINS-1; ii>=0 && bs->qtop[0]>=0 && !found; ii--) {
+    n = bs->qbins[0][ii];
+    if (n > 0 && below + n >= target) {
+      hi = band_stats_qkey_value(base + ii + 1);
+      lo = ii > 0 ? band_stats_qkey_value(base + ii) : 0.0;
+      value = -(hi - (target - below) / n * (hi - lo));
+      found = TRUE;
+    }
+    below += n;
+  }
+  if (!found && bs->zeros > 0 && below + bs->zeros >= target) {
+    value = 0.0;
+    found = TRUE;
+  }
+  below += bs->zeros;
+  base = band_stats_qbase(bs->qtop[1]);
+  for (ii=0; ii<BAND_STATS_QBINS && bs->qtop[1]>=0 && !found; ii++) {
+    n = bs->qbins[1][ii];
+    if (n > 0 && below + n >= target) {
+      lo = ii > 0 ? band_stats_qkey_value(base + ii) : 0.0;
+      hi = band_stats_qkey_value(base + ii + 1);
+      value = lo + (target - below) / n * (hi - lo);
+      found = TRUE;
+    }
+    below += n;
+  }
+
+  if (value < bs->min) value = bs->min;
+  if (value > bs->max) value = bs->max;
+  return value;
+}
+
+/* Histogram of the counted pixels over num_bins bins between lo and hi,
+   as calc_stats_from_file() would have made it.  The pixels of a fine
+   bin are spread over the bins it overlaps in proportion to the
+   overlap, rounded so that every bin still holds a whole number of
+   pixels and none go missing; pixels outside [lo,hi) are left out.  */
+gsl_histogram *band_stats_histogram(const band_stats_t *bs, int num_bins,
+                                    double lo, double hi)
+{
+  gsl_histogram *hist = gsl_histogram_alloc(num_bins);
+  double width = (hi - lo) / num_bins;
+  int ii, kk;
+
+  gsl_histogram_set_ranges_uniform(hist, lo, hi);
+  for (ii=0; ii<BAND_STATS_BINS; ii++) {
+    if (bs->bins[ii] == 0)
+      continue;
+
+    // Part of the fine bin the pixels can actually be in
+    double a = MAX(bs->bin_start + ii * bs->bin_width, bs->min);
+    double b = MIN(bs->bin_start + (ii + 1) * bs->bin_width, bs->max);
+    if (!(a < b)) {
+      gsl_histogram_accumulate(hist, a, bs->bins[ii]);
+      continue;
+    }
+    if (b <= lo || a >= hi)
+      continue;
+
+    // Round the running total, not each share, so the shares add up
+    int first = (int) floor((MAX(a, lo) - lo) / width);
+    int last = (int) floor((MIN(b, hi) - lo) / width);
+    double covered = MAX(a, lo) - a;
+    long long given = llround(bs->bins[ii] * covered / (b - a));
+    if (last >= num_bins) last = num_bins - 1;
+    for (kk=first; kk<=last; kk++) {
+      double overlap = MIN(b, lo + (kk + 1) * width) - MAX(a, lo + kk * width);
+      if (overlap > 0.0) {
+        long long upto;
+        covered += overlap;
+        upto = llround(bs->bins[ii] * MIN(covered / (b - a), 1.0));
+        if (upto > given)
+          gsl_histogram_accumulate(hist, lo + (kk + 0.5) * width,
+                                   upto - given);
+        given = upto;
       }
-    median = median_value(data2, pixel_count);
-    if (median == maxmax)
-      median = *max;
-    *max = median;
+    }
   }
 
-  FREE(data);
-  FREE(data2);
+  return hist;
+}
+
+// Fill in a metadata statistics block, the same way the stats tool does
+// (the rmse it reports is taken about the mean, so it matches stdDev).
+void band_stats_to_meta(const band_stats_t *bs, const char *band_id,
+                        meta_stats *ms)
+{
+  strncpy(ms->band_id, band_id ? band_id : "", sizeof(ms->band_id) - 1);
+  ms->band_id[sizeof(ms->band_id) - 1] = '\0';
+  band_stats_get(bs, &ms->min, &ms->max, &ms->mean, &ms->std_deviation,
+                 &ms->percent_valid);
+  ms->rmse = ms->std_deviation;
+  ms->mask = bs->mask;
+}
+
+typedef struct {
+  const char *inFile;
+  meta_parameters *meta;
+  int band_number;
+  int first_line, line_count;
+  int report;
+  band_stats_t *bs;
+} band_strip_t;
+
+static gpointer band_strip_worker(gpointer data)
+{
+  band_strip_t *strip = (band_strip_t *) data;
+  int ns = strip->meta->general->sample_count;
+  float *line = MALLOC(sizeof(float) * ns);
+  FILE *fp = FOPEN(strip->inFile, "rb");
+  int ii;
+
+  for (ii=0; ii<strip->line_count; ii++) {
+    if (strip->report)
+      asfPercentMeter((double)ii/(double)strip->line_count);
+    get_band_float_line(fp, strip->meta, strip->band_number,
+                        strip->first_line + ii, line);
+    band_stats_add(strip->bs, line, ns);
+  }
+  if (strip->report)
+    asfPercentMeter(1.0);
+
+  FCLOSE(fp);
+  FREE(line);
+  return NULL;
+}
+
+/* Accumulate one band of a file into bs, in one pass.  The band is split
+   into strips of lines read on up to thread_count threads, and the strip
+   statistics are merged in order, so the result only depends on the
+   number of threads.  The calling thread reads the first strip, and
+   reports its progress if asked to.  */
+static void band_stats_from_file(const char *inFile, meta_parameters *meta,
+                                 int band_number, int thread_count,
+                                 int report, band_stats_t *bs)
+{
+  int nl = meta->general->line_count;
+  int ii;
+
+  // Not worth a thread for a few lines
+  if (thread_count > nl / 256)
+    thread_count = nl / 256;
+
+  if (thread_count <= 1) {
+    band_strip_t strip = { inFile, meta, band_number, 0, nl, report, bs };
+    band_strip_worker(&strip);
+    return;
+  }
+
+  band_strip_t *strips = MALLOC(sizeof(band_strip_t) * thread_count);
+  GThread **threads = MALLOC(sizeof(GThread *) * thread_count);
+  for (ii=0; ii<thread_count; ii++) {
+    strips[ii].inFile = inFile;
+    strips[ii].meta = meta;
+    strips[ii].band_number = band_number;
+    strips[ii].first_line = (int) ((long long) nl * ii / thread_count);
+    strips[ii].line_count =
+      (int) ((long long) nl * (ii + 1) / thread_count) - strips[ii].first_line;
+    strips[ii].report = ii == 0 ? report : FALSE;
+    strips[ii].bs = MALLOC(sizeof(band_stats_t));
+    band_stats_init(strips[ii].bs, bs->mask);
+  }
+  for (ii=1; ii<thread_count; ii++)
+    threads[ii] = g_thread_new("band strip", band_strip_worker, &strips[ii]);
+  band_strip_worker(&strips[0]);
+  for (ii=0; ii<thread_count; ii++) {
+    if (ii > 0)
+      g_thread_join(threads[ii]);
+    band_stats_merge(bs, strips[ii].bs);
+    FREE(strips[ii].bs);
+  }
+  FREE(threads);
+  FREE(strips);
+}
+
+typedef struct {
+  const char *inFile;
+  meta_parameters *meta;
+  int count;
+  char **bands;
+  double mask;
+  int histogram;
+  int strip_threads;
+  channel_stats_t *stats;
+  volatile gint next;
+} band_stats_queue;
+
+// Gather the statistics of one band, histogram included, in one pass.
+static void gather_band_stats(band_stats_queue *q, int idx)
+{
+  meta_parameters *meta = q->meta;
+  channel_stats_t *cs = &q->stats[idx];
+  band_stats_t *bs = MALLOC(sizeof(band_stats_t));
+  double percentValid;
+  int band_number;
+
+  if (strlen(q->bands[idx]) == 0 || strcmp(q->bands[idx], "???") == 0 ||
+      meta->general->band_count == 1)
+    band_number = 0;
+  else
+    band_number = get_band_number(meta->general->bands,
+                                  meta->general->band_count, q->bands[idx]);
+
+  band_stats_init(bs, q->mask);
+  band_stats_from_file(q->inFile, meta, band_number, q->strip_threads,
+                       FALSE, bs);
+  band_stats_get(bs, &cs->min, &cs->max, &cs->mean, &cs->standard_deviation,
+                 &percentValid);
+  cs->median = band_stats_quantile(bs, 0.5);
+
+  // Guard against weird data
+  if (!(cs->min < cs->max)) cs->max = cs->min + 1;
+
+  cs->hist = NULL;
+  cs->hist_pdf = NULL;
+  if (q->histogram)
+    cs->hist = band_stats_histogram(bs, 256, cs->min, cs->max);
+  FREE(bs);
+}
+
+static gpointer band_stats_worker(gpointer data)
+{
+  band_stats_queue *q = (band_stats_queue *) data;
+  int idx;
+
+  while ((idx = g_atomic_int_add(&q->next, 1)) < q->count)
+    if (q->bands[idx])
+      gather_band_stats(q, idx);
+
+  return NULL;
+}
+
+/* Gather the statistics of several bands of a file at once, each band in
+   one pass on its own thread (or several, when there are fewer bands
+   than threads).  Gives the same min, max, mean and standard deviation
+   as calc_stats_from_file() would for each of them, the median, and if
+   histogram is set the histogram.  Bands whose name is NULL are
+   skipped.  */
+void calc_band_stats_from_file(const char *inFile, int count, char **bands,
+                               double mask, int histogram,
+                               channel_stats_t *stats)
+{
+  band_stats_queue q;
+  int band_count = 0;
+  int thread_count;
+  int ii;
+
+  for (ii=0; ii<count; ii++)
+    if (bands[ii])
+      ++band_count;
+  thread_count = MIN(get_stats_thread_count(), band_count);
+
+  q.inFile = inFile;
+  q.meta = meta_read(inFile);
+  q.count = count;
+  q.bands = bands;
+  q.mask = mask;
+  q.histogram = histogram;
+  q.strip_threads = band_count > 0 ?
+    MAX(1, get_stats_thread_count() / band_count) : 1;
+  q.stats = stats;
+  q.next = 0;
+
+  for (ii=0; ii<count; ii++) {
+    stats[ii].hist = NULL;
+    stats[ii].hist_pdf = NULL;
+  }
+
+  if (thread_count <= 1) {
+    band_stats_worker(&q);
+  }
+  else {
+    GThread **threads = (GThread **) MALLOC(thread_count * sizeof(GThread *));
+    for (ii=0; ii<thread_count; ii++)
+      threads[ii] = g_thread_new("band stats", band_stats_worker, &q);
+    for (ii=0; ii<thread_count; ii++)
+      g_thread_join(threads[ii]);
+    FREE(threads);
+  }
+
+  meta_free(q.meta);
 }
@@ -0,0 +1,221 @@
+/*******************************************************************
+Strip-parallel filtering
+
+Filters such as kernel_filter() and smooth() compute each output line
+from a fixed window of input lines around it, so the image can be cut
+into horizontal strips that are filtered independently: a strip of
+output lines only needs its own input lines plus 'halo' lines above
+and below.
+
+filter_band_strips() runs a strip filter over one band on a pool of
+worker threads.  The calling thread does all of the file I/O: it reads
+each strip's input (halo included) with get_band_float_lines() and
+writes finished strips back in order with put_band_float_line(), so
+the output is the same whatever the number of threads.  Strips live in
+a ring of thread_count+1 buffers, each worker owns the strip it is
+filtering, and the filter is handed only that strip's buffers.
+*******************************************************************/
+#include <glib.h>
+
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_raster.h"
+
+// Smallest strip we hand to a worker, in output lines.
+#define STRIP_LINES 128
+
+// Number of threads the strip filters use.  0 means one per processor.
+static int filter_thread_count = 0;
+
+void set_filter_thread_count(int thread_count)
+{
+  asfRequire(thread_count >= 0, "Invalid filter thread count: %d\n",
+             thread_count);
+  filter_thread_count = thread_count;
+}
+
+int get_filter_thread_count(void)
+{
+  if (filter_thread_count == 0)
+    return g_get_num_processors();
+  return filter_thread_count;
+}
+
+typedef struct {
+  int out_first, out_lines;   // Output lines of this strip.
+  int in_first, in_lines;     // Input lines it needs, halo included.
+  float *in, *out;
+  int ready;                  // Has it been filtered?
+} strip_t;
+
+// State shared by the calling thread and the workers.
+typedef struct {
+  int strip_count;
+  int ring_size;
+  strip_t *ring;              // Strip k lives in ring[k % ring_size].
+  int loaded;                 // Strips whose input has been read.
+  int next;                   // Next strip for a worker to claim.
+  GMutex lock;
+  GCond strip_loaded, strip_done;
+  strip_filter_t func;
+  void *data;
+} strip_queue;
+
+static gpointer strip_worker(gpointer data)
+{
+  strip_queue *q = (strip_queue *) data;
+
+  for (;;) {
+    int idx;
+    strip_t *s;
+
+    g_mutex_lock(&q->lock);
+    while (q->next < q->strip_count && q->next >= q->loaded)
+      g_cond_wait(&q->strip_loaded, &q->lock);
+    if (q->next >= q->strip_count) {
+      g_mutex_unlock(&q->lock);
+      break;
+    }
+    idx = q->next++;
+    g_mutex_unlock(&q->lock);
+
+    s = &q->ring[idx % q->ring_size];
+    q->func(q->data, s->in, s->in_first, s->in_lines,
+            s->out, s->out_first, s->out_lines);
+
+    g_mutex_lock(&q->lock);
+    s->ready = TRUE;
+    g_cond_broadcast(&q->strip_done);
+    g_mutex_unlock(&q->lock);
+  }
+
+  return NULL;
+}
+
+// Set up strip number idx and read its input lines.
+static void load_strip(strip_t *s, int idx, int strip_lines, int halo,
+                       FILE *fpIn, meta_parameters *inMeta, int in_band)
+{
+  int nl = inMeta->general->line_count;
+
+  s->out_first = idx * strip_lines;
+  s->out_lines = MIN(strip_lines, nl - s->out_first);
+  s->in_first = MAX(0, s->out_first - halo);
+  s->in_lines = MIN(nl, s->out_first + s->out_lines + halo) - s->in_first;
+  s->ready = FALSE;
+  get_band_float_lines(fpIn, inMeta, in_band, s->in_first, s->in_lines, s->in);
+}
+
+static void write_strip(const strip_t *s, FILE *fpOut,
+                        meta_parameters *outMeta, int out_band)
+{
+  int nl = outMeta->general->line_count;
+  int ns = outMeta->general->sample_count;
+  int ii;
+
+  for (ii = 0; ii < s->out_lines; ii++) {
+    put_band_float_line(fpOut, outMeta, out_band, s->out_first + ii,
+                        s->out + (size_t) ii * ns);
+    asfLineMeter(s->out_first + ii, nl);
+  }
+}
+
+/*******************************************************************
+FUNCTION NAME:   filter_band_strips - runs a strip filter over one
+                 band of an image
+
+  Output line n of band out_band is computed by func from input lines
+n-halo .. n+halo of band in_band (clipped to the image).  func is
+called with in_lines lines starting at image line in_first, and fills
+in out_lines lines starting at image line out_first; it may be called
+from several threads at once, for different strips.  Strips are longer
+than 2*halo+1 lines, so the first strip's input holds a full window.
+*******************************************************************/
+void filter_band_strips(FILE *fpIn, meta_parameters *inMeta, int in_band,
+                        FILE *fpOut, meta_parameters *outMeta, int out_band,
+                        int halo, strip_filter_t func, void *data)
+{
+  int nl = inMeta->general->line_count;
+  int ns = inMeta->general->sample_count;
+  int strip_lines = MAX(STRIP_LINES, 4*(2*halo + 1));
+  int thread_count = get_filter_thread_count();
+  strip_queue q;
+  GThread **threads;
+  int ii, idx;
+
+  if (nl <= 0)
+    return;
+
+  q.strip_count = (nl + strip_lines - 1) / strip_lines;
+  thread_count = MIN(thread_count, q.strip_count);
+  q.ring_size = thread_count > 1 ? MIN(thread_count + 1, q.strip_count) : 1;
+  q.ring = (strip_t *) MALLOC(q.ring_size * sizeof(strip_t));
+  for (ii = 0; ii < q.ring_size; ii++) {
+    q.ring[ii].in = (float *)
+      MALLOC((size_t) (strip_lines + 2*halo) * ns * sizeof(float));
+    q.ring[ii].out = (float *)
+      MALLOC((size_t) strip_lines * ns * sizeof(float));
+  }
+  q.func = func;
+  q.data = data;
+
+  if (thread_count <= 1) {
+    // No point in handing strips to a single worker.
+    strip_t *s = &q.ring[0];
+    for (idx = 0; idx < q.strip_count; idx++) {
+      load_strip(s, idx, strip_lines, halo, fpIn, inMeta, in_band);
+      func(data, s->in, s->in_first, s->in_lines,
+           s->out, s->out_first, s->out_lines);
+      write_strip(s, fpOut, outMeta, out_band);
+    }
+  }
+  else {
+    q.next = 0;
+    g_mutex_init(&q.lock);
+    g_cond_init(&q.strip_loaded);
+    g_cond_init(&q.strip_done);
+
+    for (ii = 0; ii < q.ring_size; ii++)
+      load_strip(&q.ring[ii], ii, strip_lines, halo, fpIn, inMeta, in_band);
+    q.loaded = q.ring_size;
+
+    threads = (GThread **) MALLOC(thread_count * sizeof(GThread *));
+    for (ii = 0; ii < thread_count; ii++)
+      threads[ii] = g_thread_new("strip filter", strip_worker, &q);
+
+    for (idx = 0; idx < q.strip_count; idx++) {
+      strip_t *s = &q.ring[idx % q.ring_size];
+
+      g_mutex_lock(&q.lock);
+      while (!s->ready)
+        g_cond_wait(&q.strip_done, &q.lock);
+      g_mutex_unlock(&q.lock);
+
+      write_strip(s, fpOut, outMeta, out_band);
+
+      // Hand this buffer to the strip that follows it.
+      if (idx + q.ring_size < q.strip_count) {
+        load_strip(s, idx + q.ring_size, strip_lines, halo,
+                   fpIn, inMeta, in_band);
+        g_mutex_lock(&q.lock);
+        q.loaded++;
+        g_cond_broadcast(&q.strip_loaded);
+        g_mutex_unlock(&q.lock);
+      }
+    }
+
+    for (ii = 0; ii < thread_count; ii++)
+      g_thread_join(threads[ii]);
+    FREE(threads);
+
+    g_mutex_clear(&q.lock);
+    g_cond_clear(&q.strip_loaded);
+    g_cond_clear(&q.strip_done);
+  }
+
+  for (ii = 0; ii < q.ring_size; ii++) {
+    FREE(q.ring[ii].in);
+    FREE(q.ring[ii].out);
+  }
+  FREE(q.ring);
+}
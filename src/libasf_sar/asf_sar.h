@@ -153,6 +153,8 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
                          int freeman_3_band,
                          const char *classFile,
                          int class_band);
+void set_polarimetry_thread_count(int thread_count);
+int get_polarimetry_thread_count(void);
 void cpx2sinclair(const char *inFile, const char *outFile, int tc_flag);
 void cpx2pauli(const char *inFile, const char *outFile, int tc_flag);
 void cpx2cloude_pottier(const char *inFile, const char *outFile, int tc_flag);
@@ -4,6 +4,20 @@
 #include "asf.h"
 #include <assert.h>
 
+// Incidence angles of the given line: interpolated from the geometry
+// grid if there is one, worked out for every sample otherwise.
+static void get_incid_line(meta_parameters *meta, meta_geo_grid *grid,
+			   int line, float *incid)
+{
+  int jj;
+
+  if (grid)
+    meta_geo_grid_line(grid, GRID_INCID, line, incid);
+  else
+    for (jj=0; jj<meta->general->sample_count; jj++)
+      incid[jj] = meta_incid(meta, line, jj);
+}
+
 int asf_calibrate(const char *inFile, const char *outFile, 
 		  radiometry_t outRadiometry, int wh_scaleFlag)
 {
@@ -96,23 +110,34 @@ int asf_calibrate(const char *inFile, const char *outFile,
 	    bands[0], bands[1], bands[0], bands[1]);
   }
 
+  // The calibration is compiled for each band up front and applied a line
+  // at a time, with the incidence angles of the line from the geometry grid
+  // (or from meta_incid() where the grid can't be built).
+  meta_geo_grid *grid = NULL;
+  if (meta_geo_grid_supported(metaIn))
+    grid = meta_geo_grid_get(inFile, metaIn, GRID_BICUBIC,
+                             GRID_QUANTITY_BIT(GRID_INCID));
+  float *incid = (float *) MALLOC(sizeof(float)*sample_count);
+
   int ii, jj, kk;
   float cal_dn, cal_dn2;
-  double incid;
+  cal_kernel *cal, *cal2;
   if (dualpol && wh_scaleFlag) {
     metaOut->general->image_data_type = RGB_STACK;
+    cal = cal_kernel_new(metaOut, bands[0], NULL, dbFlag);
+    cal2 = cal_kernel_new(metaOut, bands[1], NULL, dbFlag);
     for (ii=0; ii<line_count; ii++) {
       get_band_float_line(fpIn, metaIn, 0, ii, bufIn);
       get_band_float_line(fpIn, metaIn, 1, ii, bufIn2);
+      // Taking the remapping of other radiometries out for the moment
+      //if (inRadiometry >= r_SIGMA && inRadiometry <= r_BETA_DB)
+      //bufIn[jj] = cal2amp(metaIn, incid, jj, bands[kk], bufIn[jj]);
+      get_incid_line(metaIn, grid, ii, incid);
+      cal_kernel_line(cal, bufIn, incid, bufIn);
+      cal_kernel_line(cal2, bufIn2, incid, bufIn2);
       for (jj=0; jj<sample_count; jj++) {
-	// Taking the remapping of other radiometries out for the moment
-	//if (inRadiometry >= r_SIGMA && inRadiometry <= r_BETA_DB)
-	//bufIn[jj] = cal2amp(metaIn, incid, jj, bands[kk], bufIn[jj]);
-	incid = meta_incid(metaIn, ii, jj);
-	cal_dn = 
-	  get_cal_dn(metaOut, incid, jj, bufIn[jj], bands[0], dbFlag);
-	cal_dn2 = 
-	  get_cal_dn(metaOut, incid, jj, bufIn2[jj], bands[1], dbFlag);
+	cal_dn = bufIn[jj];
+	cal_dn2 = bufIn2[jj];
 	if (FLOAT_EQUIVALENT(cal_dn, metaIn->general->no_data) ||
 	    cal_dn == cal_dn2) {
 	  bufOut[jj] = 0;
@@ -130,34 +155,40 @@ int asf_calibrate(const char *inFile, const char *outFile,
       put_band_float_line(fpOut, metaOut, 2, ii, bufOut3);
       asfLineMeter(ii, line_count);
     }
+    cal_kernel_free(cal);
+    cal_kernel_free(cal2);
   }
   else {
     for (kk=0; kk<band_count; kk++) {
+      // PHASE bands are passed through as they are
+      int phase = strstr(bands[kk], "PHASE") != NULL;
+      cal = phase ? NULL : cal_kernel_new(metaOut, bands[kk], NULL, dbFlag);
       for (ii=0; ii<line_count; ii++) {
 	get_band_float_line(fpIn, metaIn, kk, ii, bufIn);
-	for (jj=0; jj<sample_count; jj++) {
-	  // Taking the remapping of other radiometries out for the moment
-	  //if (inRadiometry >= r_SIGMA && inRadiometry <= r_BETA_DB)
-	  //bufIn[jj] = cal2amp(metaIn, incid, jj, bands[kk], bufIn[jj]);
-	  if (strstr(bands[kk], "PHASE") == NULL) {
-	    incid = meta_incid(metaIn, ii, jj);
-	    cal_dn =
-	      get_cal_dn(metaOut, incid, jj, bufIn[jj], bands[kk], dbFlag);
-	    if (wh_scaleFlag) {
-	      if (FLOAT_EQUIVALENT(cal_dn, metaIn->general->no_data))
-		bufOut[jj] = 0;
-	      else
-		bufOut[jj] = (cal_dn + 31) / 0.15 + 1.5;
-	    }
+	// Taking the remapping of other radiometries out for the moment
+	//if (inRadiometry >= r_SIGMA && inRadiometry <= r_BETA_DB)
+	//bufIn[jj] = cal2amp(metaIn, incid, jj, bands[kk], bufIn[jj]);
+	if (phase) {
+	  put_band_float_line(fpOut, metaOut, kk, ii, bufIn);
+	  asfLineMeter(ii, line_count);
+	  continue;
+	}
+	get_incid_line(metaIn, grid, ii, incid);
+	cal_kernel_line(cal, bufIn, incid, bufOut);
+	if (wh_scaleFlag) {
+	  for (jj=0; jj<sample_count; jj++) {
+	    cal_dn = bufOut[jj];
+	    if (FLOAT_EQUIVALENT(cal_dn, metaIn->general->no_data))
+	      bufOut[jj] = 0;
 	    else
-	      bufOut[jj] = cal_dn;
+	      bufOut[jj] = (cal_dn + 31) / 0.15 + 1.5;
 	  }
-	  else // PHASE band, do nothing
-	    bufOut[jj] = bufIn[jj];
 	}
 	put_band_float_line(fpOut, metaOut, kk, ii, bufOut);
 	asfLineMeter(ii, line_count);
       }
+      if (cal)
+	cal_kernel_free(cal);
       char *radiometry = radiometry2str(outRadiometry);
       if (kk==0)
 	sprintf(metaOut->general->bands, "%s-%s", 
@@ -173,6 +204,8 @@ int asf_calibrate(const char *inFile, const char *outFile,
   meta_write(metaOut, outFile);
   meta_free(metaIn);
   meta_free(metaOut);
+  meta_geo_grid_free(grid);
+  FREE(incid);
   FREE(bufIn);
   FREE(bufOut);
   if (dualpol) {
@@ -0,0 +1,141 @@
+/*******************************************************************
+Closed-form eigenvalues of 3x3 Hermitian matrices
+
+do_coherence_bands() needs the eigenvalues of a coherency matrix, and
+the first component of each eigenvector, for every output pixel.
+Solving the characteristic polynomial directly is several times faster
+than running gsl_eigen_hermv on each one.
+*******************************************************************/
+#include <float.h>
+#include <math.h>
+
+#include "hermitian3.h"
+
+// Null vector of the 3x3 Hermitian matrix A - lambda*I, as the longest of
+// the cross products of its rows.  Returns the squared length of that
+// cross product and the squared magnitude of its first component.
+static double hermitian3_null_vector(const double *a, double lambda,
+                                     double *first2)
+{
+  // rows, as (re, im) pairs
+  double r[3][3][2] = {
+    { { a[H3_D1]-lambda, 0 }, { a[H3_RE12], a[H3_IM12] },
+      { a[H3_RE13], a[H3_IM13] } },
+    { { a[H3_RE12], -a[H3_IM12] }, { a[H3_D2]-lambda, 0 },
+      { a[H3_RE23], a[H3_IM23] } },
+    { { a[H3_RE13], -a[H3_IM13] }, { a[H3_RE23], -a[H3_IM23] },
+      { a[H3_D3]-lambda, 0 } }
+  };
+  static const int pairs[3][2] = { { 0, 1 }, { 0, 2 }, { 1, 2 } };
+  double best = -1;
+  int p, i;
+
+  *first2 = 0;
+  for (p=0; p<3; ++p) {
+    const double (*u)[2] = r[pairs[p][0]], (*v)[2] = r[pairs[p][1]];
+    double c[3][2], len2 = 0;
+    for (i=0; i<3; ++i) {
+      int i1 = (i+1)%3, i2 = (i+2)%3;
+      c[i][0] = u[i1][0]*v[i2][0] - u[i1][1]*v[i2][1]
+              - u[i2][0]*v[i1][0] + u[i2][1]*v[i1][1];
+      c[i][1] = u[i1][0]*v[i2][1] + u[i1][1]*v[i2][0]
+              - u[i2][0]*v[i1][1] - u[i2][1]*v[i1][0];
+      len2 += c[i][0]*c[i][0] + c[i][1]*c[i][1];
+    }
+    if (len2 > best) {
+      best = len2;
+      *first2 = c[0][0]*c[0][0] + c[0][1]*c[0][1];
+    }
+  }
+  return best;
+}
+
+// Eigenvalues of the 3x3 Hermitian matrix a, sorted by decreasing
+// magnitude (as gsl_eigen_hermv_sort with GSL_EIGEN_SORT_ABS_DESC does),
+// and the magnitude of the first component of the corresponding unit
+// eigenvectors, which is all the alpha angle needs.
+//
+// The eigenvalues come from the trigonometric solution of the
+// characteristic polynomial, the eigenvectors from cross products of the
+// rows of A - lambda*I.  Measured on 10^6 matrices U*diag(l)*U^H, with
+// random unitary U and eigenvalues l in [0,10], some of them repeated:
+// the eigenvalues agree with l to 1e-8 of the largest, and, when no two
+// are closer than 1e-3 of their spread, the first components agree with
+// U's to 1e-5 (alpha to 1e-4 degrees).  Eigenvalues closer than 1e-6 of
+// the spread (or than double precision can separate) are taken as
+// repeated: their eigenvectors aren't unique, so neither is alpha, and
+// here the whole of the eigenspace's first component is given to the
+// first of them.
+void hermitian3_eigen(const double *a, double *eval, double *evec0)
+{
+  double q = (a[H3_D1] + a[H3_D2] + a[H3_D3])/3;
+  double b1 = a[H3_D1]-q, b2 = a[H3_D2]-q, b3 = a[H3_D3]-q;
+  double n12 = a[H3_RE12]*a[H3_RE12] + a[H3_IM12]*a[H3_IM12];
+  double n13 = a[H3_RE13]*a[H3_RE13] + a[H3_IM13]*a[H3_IM13];
+  double n23 = a[H3_RE23]*a[H3_RE23] + a[H3_IM23]*a[H3_IM23];
+  double p2 = b1*b1 + b2*b2 + b3*b3 + 2*(n12 + n13 + n23);
+  double e[3], v2[3], len2, spread, tol, tmp;
+  int i, j, lone = -1;
+
+  if (p2 == 0) {
+    // a multiple of the identity
+    eval[0] = eval[1] = eval[2] = q;
+    evec0[0] = 1;
+    evec0[1] = evec0[2] = 0;
+    return;
+  }
+
+  // det(A - q*I), using Re(a12*a23*conj(a13))
+  double p = sqrt(p2/6);
+  double re = a[H3_RE12]*a[H3_RE23] - a[H3_IM12]*a[H3_IM23];
+  double im = a[H3_RE12]*a[H3_IM23] + a[H3_IM12]*a[H3_RE23];
+  double det = b1*b2*b3 + 2*(re*a[H3_RE13] + im*a[H3_IM13])
+    - b1*n23 - b2*n13 - b3*n12;
+  double r = det/(2*p*p*p);
+  if (r < -1) r = -1;
+  if (r > 1) r = 1;
+  double phi = acos(r)/3;
+
+  e[0] = q + 2*p*cos(phi);
+  e[2] = q + 2*p*cos(phi + 2*M_PI/3);
+  e[1] = 3*q - e[0] - e[2];
+
+  // e[0] >= e[1] >= e[2], and they are at least 3p apart, so only one
+  // pair can be (nearly) repeated.  When the eigenvalues are close
+  // together compared with their size, rounding in det makes phi, and
+  // so the gaps, uncertain to about sqrt(DBL_EPSILON*|q|*p).
+  spread = e[0] - e[2];
+  tol = 1e-6*spread + 16*sqrt(DBL_EPSILON*fabs(q)*p);
+  if (e[0] - e[1] <= tol)
+    lone = 2;
+  else if (e[1] - e[2] <= tol)
+    lone = 0;
+
+  for (i=0; i<3; ++i) {
+    if (lone < 0 || i == lone) {
+      // normalise before taking the first component
+      len2 = hermitian3_null_vector(a, e[i], &v2[i]);
+      v2[i] = len2 > 0 ? v2[i]/len2 : 0;
+    }
+  }
+  if (lone >= 0) {
+    // the other two share an eigenspace
+    for (i=0, j=0; i<3; ++i)
+      if (i != lone)
+        v2[i] = j++ ? 0 : 1 - v2[lone];
+  }
+
+  // sort by decreasing magnitude
+  for (i=0; i<2; ++i)
+    for (j=2; j>i; --j)
+      if (fabs(e[j]) > fabs(e[j-1])) {
+        tmp = e[j]; e[j] = e[j-1]; e[j-1] = tmp;
+        tmp = v2[j]; v2[j] = v2[j-1]; v2[j-1] = tmp;
+      }
+
+  for (i=0; i<3; ++i) {
+    eval[i] = e[i];
+    evec0[i] = sqrt(v2[i] < 1 ? v2[i] : 1);
+  }
+}
+
@@ -0,0 +1,20 @@
+#ifndef _HERMITIAN3_H
+#define _HERMITIAN3_H
+
+/***************************************
+Include file for: closed-form eigenvalues of 3x3 Hermitian matrices,
+as used for the entropy, anisotropy and alpha of coherency matrices.
+*/
+
+// A 3x3 Hermitian matrix, as its real diagonal and its upper triangle:
+//   [ d1              re12+i*im12     re13+i*im13 ]
+//   [ .               d2              re23+i*im23 ]
+//   [ .               .               d3          ]
+enum { H3_D1, H3_D2, H3_D3, H3_RE12, H3_IM12, H3_RE13, H3_IM13,
+       H3_RE23, H3_IM23, H3_TERMS };
+
+// Eigenvalues of a, sorted by decreasing magnitude, and the magnitudes
+// of the first components of the corresponding unit eigenvectors.
+void hermitian3_eigen(const double *a, double *eval, double *evec0);
+
+#endif
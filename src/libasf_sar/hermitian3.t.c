@@ -0,0 +1,131 @@
+// Checks hermitian3_eigen() on matrices with known eigenvalues and
+// eigenvectors, U*diag(l)*U^H for random unitary U, including repeated
+// eigenvalues.
+
+#include "hermitian3.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define TRIALS 1000
+
+static int failures = 0;
+
+// Random unitary matrix, as (re, im) pairs, from Gram-Schmidt on random
+// complex columns.
+static void random_unitary(double u[3][3][2])
+{
+  int i, j, k;
+
+  for (k=0; k<3; ++k) {
+    double len = 0;
+    for (i=0; i<3; ++i) {
+      u[i][k][0] = 2*drand48() - 1;
+      u[i][k][1] = 2*drand48() - 1;
+    }
+    for (j=0; j<k; ++j) {
+      // subtract the projection on column j: (u_j^H u_k) u_j
+      double re = 0, im = 0;
+      for (i=0; i<3; ++i) {
+        re += u[i][j][0]*u[i][k][0] + u[i][j][1]*u[i][k][1];
+        im += u[i][j][0]*u[i][k][1] - u[i][j][1]*u[i][k][0];
+      }
+      for (i=0; i<3; ++i) {
+        u[i][k][0] -= re*u[i][j][0] - im*u[i][j][1];
+        u[i][k][1] -= re*u[i][j][1] + im*u[i][j][0];
+      }
+    }
+    for (i=0; i<3; ++i)
+      len += u[i][k][0]*u[i][k][0] + u[i][k][1]*u[i][k][1];
+    len = sqrt(len);
+    for (i=0; i<3; ++i) {
+      u[i][k][0] /= len;
+      u[i][k][1] /= len;
+    }
+  }
+}
+
+// Element (i,j) of U*diag(l)*U^H.
+static void element(double u[3][3][2], const double *l, int i, int j,
+                    double *re, double *im)
+{
+  int k;
+
+  *re = *im = 0;
+  for (k=0; k<3; ++k) {
+    *re += l[k]*(u[i][k][0]*u[j][k][0] + u[i][k][1]*u[j][k][1]);
+    *im += l[k]*(u[i][k][1]*u[j][k][0] - u[i][k][0]*u[j][k][1]);
+  }
+}
+
+// l must be in decreasing order.  With repeated eigenvalues, only the
+// total first component of their eigenspace is checked.
+static void eigen_test(const char *what, const double *l)
+{
+  double max_eval = 0, max_evec = 0;
+  int t, k, bad = 0;
+
+  for (t=0; t<TRIALS; ++t) {
+    double u[3][3][2], a[H3_TERMS], eval[3], evec0[3], im;
+    random_unitary(u);
+    element(u, l, 0, 0, &a[H3_D1], &im);
+    element(u, l, 1, 1, &a[H3_D2], &im);
+    element(u, l, 2, 2, &a[H3_D3], &im);
+    element(u, l, 0, 1, &a[H3_RE12], &a[H3_IM12]);
+    element(u, l, 0, 2, &a[H3_RE13], &a[H3_IM13]);
+    element(u, l, 1, 2, &a[H3_RE23], &a[H3_IM23]);
+
+    hermitian3_eigen(a, eval, evec0);
+
+    for (k=0; k<3; ++k) {
+      double err = fabs(eval[k] - l[k]) / l[0];
+      if (err > max_eval)
+        max_eval = err;
+    }
+    // sum the squared first components over each eigenspace
+    for (k=0; k<3; ) {
+      double want = 0, got = 0, err;
+      int m = k;
+      while (m < 3 && l[m] == l[k]) {
+        want += u[0][m][0]*u[0][m][0] + u[0][m][1]*u[0][m][1];
+        got += evec0[m]*evec0[m];
+        ++m;
+      }
+      err = fabs(sqrt(got) - sqrt(want));
+      if (err > max_evec)
+        max_evec = err;
+      k = m;
+    }
+  }
+
+  if (max_eval > 1e-8 || max_evec > 1e-5)
+    bad = 1;
+  printf("%s: eigenvalues %.2g, first components %.2g %s\n", what,
+         max_eval, max_evec, bad ? "<-- FAILED" : "");
+  failures += bad;
+}
+
+int main(int argc, char *argv[])
+{
+  static const double distinct[3] = { 6, 3, 1 };
+  static const double upper_pair[3] = { 4, 4, 1 };
+  static const double lower_pair[3] = { 5, 2, 2 };
+  // close together compared with their size
+  static const double close_pair[3] = { 7.67388, 7.67388, 7.67377 };
+  static const double all_same[3] = { 3, 3, 3 };
+
+  srand48(1313);
+  eigen_test("distinct", distinct);
+  eigen_test("largest two repeated", upper_pair);
+  eigen_test("smallest two repeated", lower_pair);
+  eigen_test("close repeated pair", close_pair);
+  eigen_test("all repeated", all_same);
+
+  if (failures > 0) {
+    printf("%d checks FAILED\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
@@ -3,7 +3,9 @@
 #include "asf_raster.h"
 #include "asf_nan.h"
 #include "asf_complex.h"
+#include "hermitian3.h"
 #include <assert.h>
+#include <glib.h>
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_complex.h>
 #include <gsl/gsl_complex_math.h>
@@ -785,6 +787,38 @@ static void polarimetric_image_rows_free(PolarimetricImageRows* self)
     free(self);
 }
 
+// Copies the rows held by src into dst, which must have been created with
+// the same metadata and number of rows.  The copy's line pointers stay at
+// their natural locations, line i of the copy holding what line i of src
+// points at.
+static void polarimetric_image_rows_copy(PolarimetricImageRows *dst,
+                                         PolarimetricImageRows *src)
+{
+    int i, j, ns = src->meta->general->sample_count;
+
+    dst->current_row = src->current_row;
+    memcpy(dst->amp, src->amp, sizeof(float)*ns);
+    for (i=0; i<src->nrows; ++i) {
+        if (src->meta->general->image_data_type == POLARIMETRIC_S2_MATRIX ||
+            src->meta->general->image_data_type == POLARIMETRIC_IMAGE)
+          memcpy(dst->s2_lines[i], src->s2_lines[i],
+                 sizeof(quadPolS2Float)*ns);
+        else if (src->meta->general->image_data_type ==
+                 POLARIMETRIC_C3_MATRIX)
+          memcpy(dst->c3_lines[i], src->c3_lines[i],
+                 sizeof(quadPolC3Float)*ns);
+        memcpy(dst->pauli_lines[i], src->pauli_lines[i],
+               sizeof(floatVector)*ns);
+        for (j=0; j<ns; ++j) {
+            complexMatrix *a = dst->coh_lines[i][j];
+            complexMatrix *b = src->coh_lines[i][j];
+            memcpy(a->coeff[0], b->coeff[0], sizeof(complexFloat)*3);
+            memcpy(a->coeff[1], b->coeff[1], sizeof(complexFloat)*3);
+            memcpy(a->coeff[2], b->coeff[2], sizeof(complexFloat)*3);
+        }
+    }
+}
+
 static double log3(double v)
 {
     return log(v)/log(3.);
@@ -1028,10 +1062,18 @@ static double calc_alpha_real(double e)
   return alpha;
 }
 
-static double calc_alpha(gsl_complex z)
+// Adds (sign=1) or removes (sign=-1) coherency matrix m to/from sum.
+static void hermitian3_add(double *sum, const complexMatrix *m, int sign)
 {
-  // alpha: acos(e[0]), e=eigenvector of coherence matrix
-  return calc_alpha_real(GSL_REAL(z));
+  sum[H3_D1] += sign*m->coeff[0][0].real;
+  sum[H3_D2] += sign*m->coeff[1][1].real;
+  sum[H3_D3] += sign*m->coeff[2][2].real;
+  sum[H3_RE12] += sign*m->coeff[0][1].real;
+  sum[H3_IM12] += sign*m->coeff[0][1].imag;
+  sum[H3_RE13] += sign*m->coeff[0][2].real;
+  sum[H3_IM13] += sign*m->coeff[0][2].imag;
+  sum[H3_RE23] += sign*m->coeff[1][2].real;
+  sum[H3_IM23] += sign*m->coeff[1][2].imag;
 }
 
 static void add_boundary(int wide)
@@ -1072,26 +1114,26 @@ static void add_boundary(int wide)
 
 static void do_sinclair_bands(int band1, int band2, int band3,
                               PolarimetricImageRows *img_rows,
-                              int line, int l, int multi, int chunk_size,
-                              meta_parameters *outMeta, FILE *fout,
-                              float *buf)
+                              int l, int multi, int chunk_size, int ns,
+                              float **out)
 {
   int j, m;
-  int ns = outMeta->general->sample_count;
+  float *buf;
 
   if (multi) {
     // multilook case -- average all buffered lines to produce a
     // single output line
     if (band1 >= 0) {
+      buf = out[band1];
       for (j=0; j<ns; ++j) {
         buf[j] = 0.0;
         for (m=0; m<chunk_size; ++m)
           buf[j] += complex_amp(img_rows->s2_lines[m][j].hh);
         buf[j] /= (float)chunk_size;
       }
-      put_band_float_line(fout, outMeta, band1, line, buf);
     }
     if (band2 >= 0) {
+      buf = out[band2];
       for (j=0; j<ns; ++j) {
         buf[j] = 0.0;
         for (m=0; m<chunk_size; ++m) {
@@ -1101,54 +1143,53 @@ static void do_sinclair_bands(int band1, int band2, int band3,
         }
         buf[j] /= (float)chunk_size;
       }
-      put_band_float_line(fout, outMeta, band2, line, buf);
     }
     if (band3 >= 0) {
+      buf = out[band3];
       for (j=0; j<ns; ++j) {
         buf[j] = 0.0;
         for (m=0; m<chunk_size; ++m)
           buf[j] += complex_amp(img_rows->s2_lines[m][j].vv);
         buf[j] /= (float)chunk_size;
       }
-      put_band_float_line(fout, outMeta, band3, line, buf);
     }
   }
   else {
     // not multilooking -- no averaging necessary
     if (band1 >= 0) {
+      buf = out[band1];
       for (j=0; j<ns; ++j)
         buf[j] = complex_amp(img_rows->s2_lines[l][j].hh);
-      put_band_float_line(fout, outMeta, band1, line, buf);
     }
     if (band2 >= 0) {
+      buf = out[band2];
       for (j=0; j<ns; ++j) {
         complexFloat c = complex_add(img_rows->s2_lines[l][j].hv,
                                      img_rows->s2_lines[l][j].vh);
         buf[j] = complex_amp(complex_scale(c, 0.5));
       }
-      put_band_float_line(fout, outMeta, band2, line, buf);
     }
     if (band3 >= 0) {
+      buf = out[band3];
       for (j=0; j<ns; ++j)
         buf[j] = complex_amp(img_rows->s2_lines[l][j].vv);
-      put_band_float_line(fout, outMeta, band3, line, buf);
     }
   }
 }
 
 static void do_pauli_bands(int band1, int band2, int band3,
                            PolarimetricImageRows *img_rows,
-                           int line, int l, int multi, int chunk_size,
-                           meta_parameters *outMeta, FILE *fout,
-                           float *buf)
+                           int l, int multi, int chunk_size, int ns,
+                           float **out)
 {
   int j, m;
-  int ns = outMeta->general->sample_count;
+  float *buf;
 
   if (multi) {
     // multilook case -- average all buffered lines to produce a
     // single output line
     if (band1 >= 0) {
+      buf = out[band1];
       for (j=0; j<ns; ++j) {
         buf[j] = 0.0;
         for (m=0; m<chunk_size; ++m)
@@ -1156,9 +1197,9 @@ static void do_pauli_bands(int band1, int band2, int band3,
 	//buf[j] += complex_amp(img_rows->pauli_lines[m][j].A);
         buf[j] /= (float)chunk_size;
       }
-      put_band_float_line(fout, outMeta, band1, line, buf);
     }
     if (band2 >= 0) {
+      buf = out[band2];
       for (j=0; j<ns; ++j) {
         buf[j] = 0.0;
         for (m=0; m<chunk_size; ++m)
@@ -1166,9 +1207,9 @@ static void do_pauli_bands(int band1, int band2, int band3,
 	//buf[j] += complex_amp(img_rows->pauli_lines[m][j].B);
         buf[j] /= (float)chunk_size;
       }
-      put_band_float_line(fout, outMeta, band2, line, buf);
     }
     if (band3 >= 0) {
+      buf = out[band3];
       for (j=0; j<ns; ++j) {
         buf[j] = 0.0;
         for (m=0; m<chunk_size; ++m)
@@ -1176,28 +1217,27 @@ static void do_pauli_bands(int band1, int band2, int band3,
 	//buf[j] += complex_amp(img_rows->pauli_lines[m][j].C);
         buf[j] /= (float)chunk_size;
       }
-      put_band_float_line(fout, outMeta, band3, line, buf);
     }
   }
   else {
     // not multilooking -- no averaging necessary
     if (band1 >= 0) {
+      buf = out[band1];
       for (j=0; j<ns; ++j)
         buf[j] = img_rows->pauli_lines[l][j].A;
       //buf[j] = complex_amp(img_rows->pauli_lines[l][j].A);
-      put_band_float_line(fout, outMeta, band1, line, buf);
     }
     if (band2 >= 0) {
+      buf = out[band2];
       for (j=0; j<ns; ++j)
         buf[j] = img_rows->pauli_lines[l][j].B;
       //buf[j] = complex_amp(img_rows->pauli_lines[l][j].B);
-      put_band_float_line(fout, outMeta, band2, line, buf);
     }
     if (band3 >= 0) {
+      buf = out[band3];
       for (j=0; j<ns; ++j)
         buf[j] = img_rows->pauli_lines[l][j].C;
       //buf[j] = complex_amp(img_rows->pauli_lines[l][j].C);
-      put_band_float_line(fout, outMeta, band3, line, buf);
     }
   }
 }
@@ -1207,21 +1247,13 @@ do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
                    int class_band,
                    PolarimetricImageRows *img_rows,
                    int line, int l, int multi, int chunk_size,
-                   gsl_matrix_complex *T, gsl_vector *eval,
-                   gsl_matrix_complex *evec, gsl_eigen_hermv_workspace *ws,
-                   meta_parameters *outMeta, FILE *fout,
-                   float *buf, classifier_t *classifier)
+                   int onl, int ns, float **out,
+                   float *entropy, float *anisotropy, float *alpha,
+                   classifier_t *classifier)
 {
   if (entropy_band >= 0 || anisotropy_band >= 0 || alpha_band >= 0 || 
       class_band >= 0)
   {
-    int ns = outMeta->general->sample_count;
-    int onl = outMeta->general->line_count;
-
-    float *entropy = MALLOC(sizeof(float)*ns);
-    float *anisotropy = MALLOC(sizeof(float)*ns);
-    float *alpha = MALLOC(sizeof(float)*ns);
-
     // size of the horizontal window, used for ensemble averaging
     // actual window size is hw*2+1
     int hw;
@@ -1230,38 +1262,46 @@ do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
     else
       hw = 2; // 5 pixels averaging horizontally
 
-    // coherence -- do ensemble averaging for each element
-    int j;
+    // coherence -- do ensemble averaging for each element.  First sum
+    // each column over the rows in the window, then slide the horizontal
+    // window along those sums: each pixel adds one column and drops one
+    // (starting over every window width, so rounding can't build up).
+    // Entropy, anisotropy and alpha don't depend on the scale of the
+    // matrix, so the sums are used as they are.
+    double (*col)[H3_TERMS] = CALLOC(ns, sizeof(double[H3_TERMS]));
+    double T[H3_TERMS];
+    int j, k, m, ii;
+    for (m=0; m<chunk_size; ++m) {
+      if (m+line>l && m+line<onl-l) {
+        for (k=0; k<ns; ++k)
+          hermitian3_add(col[k], img_rows->coh_lines[m][k], 1);
+      }
+    }
+
     for (j=0; j<ns; ++j) {
-      int ii,jj,m;
-      for (ii=0; ii<3; ++ii) {
-        for (jj=0; jj<3; ++jj) {
-          gsl_complex c = gsl_complex_rect(0,0);
-          int k,n=0;
-          for (m=0; m<chunk_size; ++m) {
-            for (k=j-hw;k<=j+hw;++k) {
-              if (k>=0 && k<ns && m+line>l && m+line<onl-l) {
-                ++n;
-                complexFloat f =
-                  img_rows->coh_lines[m][k]->coeff[ii][jj];
-                c = gsl_complex_add_real(c, f.real);
-                c = gsl_complex_add_imag(c, f.imag);
-              }
-            }
-          }
-          if (n>1) {
-            gsl_complex_div_real(c, (float)n);
-          }
-          gsl_matrix_complex_set(T,ii,jj,c);
+      if (j%(2*hw+1) == 0) {
+        for (ii=0; ii<H3_TERMS; ++ii)
+          T[ii] = 0;
+        for (k=j-hw; k<=j+hw; ++k)
+          if (k>=0 && k<ns)
+            for (ii=0; ii<H3_TERMS; ++ii)
+              T[ii] += col[k][ii];
+      }
+      else {
+        for (ii=0; ii<H3_TERMS; ++ii) {
+          if (j+hw<ns)
+            T[ii] += col[j+hw][ii];
+          if (j-hw-1>=0)
+            T[ii] -= col[j-hw-1][ii];
         }
       }
-      
-      gsl_eigen_hermv(T, eval, evec, ws);
-      gsl_eigen_hermv_sort(eval, evec, GSL_EIGEN_SORT_ABS_DESC);
-      
-      double e1 = gsl_vector_get(eval, 0);
-      double e2 = gsl_vector_get(eval, 1);
-      double e3 = gsl_vector_get(eval, 2);
+
+      double eval[3], evec0[3];
+      hermitian3_eigen(T, eval, evec0);
+
+      double e1 = eval[0];
+      double e2 = eval[1];
+      double e3 = eval[2];
       
       double eT = e1+e2+e3;
       
@@ -1310,9 +1350,9 @@ do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
       // this is the polar angle when expressing each eigenvector
       // in spherical coordinates.  the mean alpha is weighted by
       // the eigenvector (so weight by P1-3)
-      double alpha1 = calc_alpha(gsl_matrix_complex_get(evec, 0, 0));
-      double alpha2 = calc_alpha(gsl_matrix_complex_get(evec, 0, 1));
-      double alpha3 = calc_alpha(gsl_matrix_complex_get(evec, 0, 2));
+      double alpha1 = calc_alpha_real(evec0[0]);
+      double alpha2 = calc_alpha_real(evec0[1]);
+      double alpha3 = calc_alpha_real(evec0[2]);
       
       alpha[j] = R2D*(P1*alpha1 + P2*alpha2 + P3*alpha3);
       if (!meta_is_valid_double(alpha[j]))
@@ -1320,41 +1360,45 @@ do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
     }
     
     if (entropy_band >= 0)
-      put_band_float_line(fout, outMeta, entropy_band, line, entropy);
+      memcpy(out[entropy_band], entropy, sizeof(float)*ns);
     if (anisotropy_band >= 0)
-      put_band_float_line(fout, outMeta, anisotropy_band, line, anisotropy);
+      memcpy(out[anisotropy_band], anisotropy, sizeof(float)*ns);
     if (alpha_band >= 0)
-      put_band_float_line(fout, outMeta, alpha_band, line, alpha);
+      memcpy(out[alpha_band], alpha, sizeof(float)*ns);
     
     if (class_band >= 0) {
       assert(classifier != NULL);
       for (j=0; j<ns; ++j) {
-        buf[j] = (float)classify(classifier, entropy[j], anisotropy[j],
-                                 alpha[j]);
+        out[class_band][j] = (float)classify(classifier, entropy[j],
+                                             anisotropy[j], alpha[j]);
       }
-      put_band_float_line(fout, outMeta, class_band, line, buf);
     }
 
-    for (j=0; j<ns; ++j) {
-      int entropy_index = entropy[j]*(float)HIST_SIZE;
-      if (entropy_index<0) entropy_index=0;
-      if (entropy_index>HIST_SIZE-1) entropy_index=HIST_SIZE-1;
-            
-      int alpha_index = HIST_SIZE-1-alpha[j]/90.0*(float)HIST_SIZE;
-      if (alpha_index<0) alpha_index=0;
-      if (alpha_index>HIST_SIZE-1) alpha_index=HIST_SIZE-1;
-      
-      //printf("%10.1f %10.1f %5d %5d --> %4d\n",
-      //       entropy[j], alpha[j],
-      //       entropy_index, alpha_index,
-      //      ea_hist[entropy_index][alpha_index]+1);
-      int anisotropy_index = anisotropy[j]*(float)HIST_SIZE;
-      hist_vals[entropy_index][alpha_index][anisotropy_index] += 1;
-    }
+    FREE(col);
+  }
+}
 
-    free(entropy);
-    free(anisotropy);
-    free(alpha);
+// Adds a line of entropy/anisotropy/alpha values to the population
+// histogram.
+static void add_to_histogram(const float *entropy, const float *anisotropy,
+                             const float *alpha, int ns)
+{
+  int j;
+  for (j=0; j<ns; ++j) {
+    int entropy_index = entropy[j]*(float)HIST_SIZE;
+    if (entropy_index<0) entropy_index=0;
+    if (entropy_index>HIST_SIZE-1) entropy_index=HIST_SIZE-1;
+
+    int alpha_index = HIST_SIZE-1-alpha[j]/90.0*(float)HIST_SIZE;
+    if (alpha_index<0) alpha_index=0;
+    if (alpha_index>HIST_SIZE-1) alpha_index=HIST_SIZE-1;
+
+    //printf("%10.1f %10.1f %5d %5d --> %4d\n",
+    //       entropy[j], alpha[j],
+    //       entropy_index, alpha_index,
+    //      ea_hist[entropy_index][alpha_index]+1);
+    int anisotropy_index = anisotropy[j]*(float)HIST_SIZE;
+    hist_vals[entropy_index][alpha_index][anisotropy_index] += 1;
   }
 }
 
@@ -1485,8 +1529,8 @@ static void solve_fd2(float hh2, float vv2, complexFloat hhvv,
 
 static void do_freeman(int band1, int band2, int band3,
                        PolarimetricImageRows *img_rows,
-                       int line, int l, int multi, int chunk_size,
-                       meta_parameters *outMeta, FILE *fout)
+                       int l, int multi, int chunk_size, int ns,
+                       float **out)
 {
   if (band1 >= 0 || band2 >= 0 || band3 >= 0)
   {
@@ -1496,7 +1540,6 @@ static void do_freeman(int band1, int band2, int band3,
     //}
 
     int j, m;
-    int ns = outMeta->general->sample_count;
 
     float *hh2 = MALLOC(sizeof(float)*ns);
     float *vv2 = MALLOC(sizeof(float)*ns);
@@ -1547,9 +1590,9 @@ static void do_freeman(int band1, int band2, int band3,
       }
     }
 
-    float *Ps = MALLOC(sizeof(float)*ns);
-    float *Pd = MALLOC(sizeof(float)*ns);
-    float *Pv = MALLOC(sizeof(float)*ns);
+    float *Ps = band1 >= 0 ? out[band1] : MALLOC(sizeof(float)*ns);
+    float *Pd = band2 >= 0 ? out[band2] : MALLOC(sizeof(float)*ns);
+    float *Pv = band3 >= 0 ? out[band3] : MALLOC(sizeof(float)*ns);
 
     // now calculate fs, fd and alpha or beta for each sample, and
     // from those we can get the Ps, Pd, and Pv values
@@ -1595,16 +1638,12 @@ static void do_freeman(int band1, int band2, int band3,
     free(hv2);
     free(hhvv);
 
-    if (band1 >= 0)
-      put_band_float_line(fout, outMeta, band1, line, Ps);
-    if (band2 >= 0)
-      put_band_float_line(fout, outMeta, band2, line, Pd);
-    if (band3 >= 0)
-      put_band_float_line(fout, outMeta, band3, line, Pv);
-
-    free(Pd);
-    free(Ps);
-    free(Pv);
+    if (band1 < 0)
+      free(Ps);
+    if (band2 < 0)
+      free(Pd);
+    if (band3 < 0)
+      free(Pv);
   }
 }
 
@@ -1736,6 +1775,300 @@ static void do_class_map(classifier_t *classifier, int class_band, int wide,
   }
 }
 
+// Number of threads polarimetric_decomp() computes output lines on.
+// 0 means one per processor.
+static int polarimetry_thread_count = 0;
+
+void set_polarimetry_thread_count(int thread_count)
+{
+  asfRequire(thread_count >= 0, "Invalid polarimetry thread count: %d\n",
+             thread_count);
+  polarimetry_thread_count = thread_count;
+}
+
+int get_polarimetry_thread_count(void)
+{
+  if (polarimetry_thread_count == 0)
+    return g_get_num_processors();
+  return polarimetry_thread_count;
+}
+
+// What polarimetric_decomp() was asked to generate, and where.
+typedef struct {
+  int amplitude_band;
+  int pauli_1_band, pauli_2_band, pauli_3_band;
+  int entropy_band, anisotropy_band, alpha_band;
+  int sinclair_1_band, sinclair_2_band, sinclair_3_band;
+  int freeman_1_band, freeman_2_band, freeman_3_band;
+  int class_band;
+  classifier_t *classifier;
+  int multi, chunk_size;
+  meta_parameters *outMeta;
+} DecompositionParams;
+
+// One output line: the rows it is computed from, and its bands.
+typedef struct {
+  int line;
+  PolarimetricImageRows *rows; // copy of the window for this line
+  float **bands;               // indexed by output band number
+  float *entropy, *anisotropy, *alpha; // for the population histogram
+  int ready;                   // have the bands been computed?
+} DecompositionLine;
+
+static int has_coherence_bands(const DecompositionParams *p)
+{
+  return p->entropy_band >= 0 || p->anisotropy_band >= 0 ||
+         p->alpha_band >= 0 || p->class_band >= 0;
+}
+
+static DecompositionLine *decomposition_line_new(const DecompositionParams *p,
+                                                 meta_parameters *inMeta)
+{
+  int i, ns = p->outMeta->general->sample_count;
+  DecompositionLine *self = MALLOC(sizeof(DecompositionLine));
+
+  self->line = -1;
+  self->rows = NULL;
+  if (inMeta) {
+    self->rows = polarimetric_image_rows_new(inMeta, p->chunk_size, p->multi);
+  }
+  self->bands = MALLOC(sizeof(float*)*p->outMeta->general->band_count);
+  for (i=0; i<p->outMeta->general->band_count; ++i)
+    self->bands[i] = MALLOC(sizeof(float)*ns);
+  self->entropy = MALLOC(sizeof(float)*ns);
+  self->anisotropy = MALLOC(sizeof(float)*ns);
+  self->alpha = MALLOC(sizeof(float)*ns);
+  self->ready = FALSE;
+
+  return self;
+}
+
+static void decomposition_line_free(DecompositionLine *self,
+                                    const DecompositionParams *p)
+{
+  int i;
+  if (self->rows)
+    polarimetric_image_rows_free(self->rows);
+  for (i=0; i<p->outMeta->general->band_count; ++i)
+    free(self->bands[i]);
+  free(self->bands);
+  free(self->entropy);
+  free(self->anisotropy);
+  free(self->alpha);
+  free(self);
+}
+
+// Computes all the requested bands of output line 'line' from the rows
+// in img_rows, into out's buffers.  Only touches img_rows and those
+// buffers, so lines can be computed in parallel, each from its own copy
+// of the rows.
+static void decompose_line(const DecompositionParams *p,
+                           PolarimetricImageRows *img_rows, int line,
+                           DecompositionLine *out)
+{
+  // Indicates which line in the various *lines arrays contains
+  // what corresponds to line i in the output. since the line pointers
+  // slide, this never changes.
+  const int l = (p->chunk_size-1)/2;
+  int ns = p->outMeta->general->sample_count;
+  int onl = p->outMeta->general->line_count;
+
+  // normal amplitude band (usually, this is added to allow terrcorr)
+  if (p->amplitude_band >= 0)
+    memcpy(out->bands[p->amplitude_band], img_rows->amp, sizeof(float)*ns);
+
+  // if requested, generate sinlair output
+  do_sinclair_bands(p->sinclair_1_band, p->sinclair_2_band,
+                    p->sinclair_3_band, img_rows, l, p->multi,
+                    p->chunk_size, ns, out->bands);
+
+  // calculate the pauli output (magnitude of already-calculated
+  // complex pauli basis elements), and save the requested pauli
+  // bands in the output
+  do_pauli_bands(p->pauli_1_band, p->pauli_2_band, p->pauli_3_band,
+                 img_rows, l, p->multi, p->chunk_size, ns, out->bands);
+
+  // Freeman-Durden
+  do_freeman(p->freeman_1_band, p->freeman_2_band, p->freeman_3_band,
+             img_rows, l, p->multi, p->chunk_size, ns, out->bands);
+
+  // do any polarimetry that uses the coherence matrix
+  do_coherence_bands(p->entropy_band, p->anisotropy_band, p->alpha_band,
+                     p->class_band, img_rows, line, l, p->multi,
+                     p->chunk_size, onl, ns, out->bands,
+                     out->entropy, out->anisotropy, out->alpha,
+                     p->classifier);
+}
+
+// Writes a computed line to the output file, and adds it to the
+// population histogram.
+static void write_decomposition_line(const DecompositionParams *p,
+                                     const DecompositionLine *out, FILE *fout)
+{
+  int b;
+  for (b=0; b<p->outMeta->general->band_count; ++b)
+    put_band_float_line(fout, p->outMeta, b, out->line, out->bands[b]);
+  if (has_coherence_bands(p))
+    add_to_histogram(out->entropy, out->anisotropy, out->alpha,
+                     p->outMeta->general->sample_count);
+}
+
+// Loads the next window of rows -- for the line after 'line' -- into
+// img_rows.
+static void load_rows_for_next_line(PolarimetricImageRows *img_rows,
+                                    int multi, int line, FILE *fin)
+{
+  if (multi) {
+    polarimetric_image_rows_load_new_rows(img_rows, fin);
+  }
+  else {
+    polarimetric_image_rows_load_next_row(img_rows, fin);
+    assert(img_rows->current_row == line+1);
+  }
+}
+
+// Pipelined version of the output loop of polarimetric_decomp().  A reader
+// thread slides the window of rows down the image exactly as the
+// single-threaded loop does, leaving a copy of it for each output line in
+// a ring of lines; worker threads compute the bands of those lines, and
+// the calling thread writes them out in order.  Since every line is
+// computed from the same rows either way, the output doesn't depend on
+// the number of threads.
+typedef struct {
+  const DecompositionParams *p;
+  PolarimetricImageRows *img_rows;
+  FILE *fin;
+  int onl;
+  int ring_size;
+  DecompositionLine **ring;   // line i lives in ring[i % ring_size]
+  int loaded;                 // lines whose rows have been copied
+  int next;                   // next line for a worker to compute
+  int written;                // lines written out
+  GMutex lock;
+  GCond line_loaded, line_done, line_written;
+} DecompositionQueue;
+
+static gpointer decomposition_reader(gpointer data)
+{
+  DecompositionQueue *q = (DecompositionQueue *) data;
+  int i;
+
+  for (i=0; i<q->onl; ++i) {
+    DecompositionLine *out = q->ring[i % q->ring_size];
+
+    // wait for the line using this slot to be written
+    g_mutex_lock(&q->lock);
+    while (i - q->written >= q->ring_size)
+      g_cond_wait(&q->line_written, &q->lock);
+    g_mutex_unlock(&q->lock);
+
+    polarimetric_image_rows_copy(out->rows, q->img_rows);
+    g_mutex_lock(&q->lock);
+    out->line = i;
+    out->ready = FALSE;
+    q->loaded++;
+    g_cond_broadcast(&q->line_loaded);
+    g_mutex_unlock(&q->lock);
+
+    // load the next row, if there are still more to go
+    if (i<q->onl-1)
+      load_rows_for_next_line(q->img_rows, q->p->multi, i, q->fin);
+  }
+
+  return NULL;
+}
+
+static gpointer decomposition_worker(gpointer data)
+{
+  DecompositionQueue *q = (DecompositionQueue *) data;
+
+  for (;;) {
+    int i;
+    DecompositionLine *out;
+
+    g_mutex_lock(&q->lock);
+    while (q->next < q->onl && q->next >= q->loaded)
+      g_cond_wait(&q->line_loaded, &q->lock);
+    if (q->next >= q->onl) {
+      g_mutex_unlock(&q->lock);
+      break;
+    }
+    i = q->next++;
+    g_mutex_unlock(&q->lock);
+
+    out = q->ring[i % q->ring_size];
+    decompose_line(q->p, out->rows, i, out);
+
+    g_mutex_lock(&q->lock);
+    out->ready = TRUE;
+    g_cond_broadcast(&q->line_done);
+    g_mutex_unlock(&q->lock);
+  }
+
+  return NULL;
+}
+
+static void decompose_lines_threaded(const DecompositionParams *p,
+                                     meta_parameters *inMeta,
+                                     PolarimetricImageRows *img_rows,
+                                     FILE *fin, FILE *fout, int thread_count)
+{
+  int onl = p->outMeta->general->line_count;
+  DecompositionQueue q;
+  GThread *reader, **workers;
+  int i;
+
+  q.p = p;
+  q.img_rows = img_rows;
+  q.fin = fin;
+  q.onl = onl;
+  q.ring_size = MIN(2*thread_count, onl);
+  q.ring = MALLOC(sizeof(DecompositionLine*)*q.ring_size);
+  for (i=0; i<q.ring_size; ++i)
+    q.ring[i] = decomposition_line_new(p, inMeta);
+  q.loaded = q.next = q.written = 0;
+  g_mutex_init(&q.lock);
+  g_cond_init(&q.line_loaded);
+  g_cond_init(&q.line_done);
+  g_cond_init(&q.line_written);
+
+  reader = g_thread_new("polarimetry reader", decomposition_reader, &q);
+  workers = MALLOC(sizeof(GThread*)*thread_count);
+  for (i=0; i<thread_count; ++i)
+    workers[i] = g_thread_new("polarimetry", decomposition_worker, &q);
+
+  for (i=0; i<onl; ++i) {
+    DecompositionLine *out = q.ring[i % q.ring_size];
+
+    g_mutex_lock(&q.lock);
+    while (out->line != i || !out->ready)
+      g_cond_wait(&q.line_done, &q.lock);
+    g_mutex_unlock(&q.lock);
+
+    write_decomposition_line(p, out, fout);
+    asfLineMeter(i,onl);
+
+    g_mutex_lock(&q.lock);
+    q.written++;
+    g_cond_broadcast(&q.line_written);
+    g_mutex_unlock(&q.lock);
+  }
+
+  g_thread_join(reader);
+  for (i=0; i<thread_count; ++i)
+    g_thread_join(workers[i]);
+  free(workers);
+
+  g_mutex_clear(&q.lock);
+  g_cond_clear(&q.line_loaded);
+  g_cond_clear(&q.line_done);
+  g_cond_clear(&q.line_written);
+
+  for (i=0; i<q.ring_size; ++i)
+    decomposition_line_free(q.ring[i], p);
+  free(q.ring);
+}
+
 void polarimetric_decomp(const char *inFile, const char *outFile,
                          int amplitude_band,
                          int pauli_1_band,
@@ -1786,7 +2119,6 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
 
   // aliases
   int nl = inMeta->general->line_count;
-  int ns = inMeta->general->sample_count;
 
   FILE *fin = fopenImage(in_img_name, "rb");
   FILE *fout = fopenImage(out_img_name, "wb");
@@ -1804,8 +2136,6 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
       asfPrintError("Not all required bands found-- "
                     "is this SLC quad-pol data?\n");
 
-  float *buf = MALLOC(sizeof(float)*ns);
-
   // at the start, we want to load the buffers as follows: (for chunk_size=5)
   //   *lines[0] = ALL ZEROS
   //   *lines[1] = ALL ZEROS
@@ -1935,58 +2265,46 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
   //-----------------------------------------------------------------------
   // done setting up metadata, now write the data
 
-  // gsl infrastructure for calculating eigen- vals & vecs for the
-  // coherence matrix
-  gsl_matrix_complex *T = gsl_matrix_complex_alloc(3,3);
-  gsl_vector *eval = gsl_vector_alloc(3);
-  gsl_matrix_complex *evec = gsl_matrix_complex_alloc(3,3);
-  gsl_eigen_hermv_workspace *ws = gsl_eigen_hermv_alloc(3);
-
-  // now loop through the lines of the output image
-  for (i=0; i<onl; ++i) {
-
-      // Indicates which line in the various *lines arrays contains
-      // what corresponds to line i in the output. since the line pointers
-      // slide, this never changes.
-      const int l = (chunk_size-1)/2;
-
-      // normal amplitude band (usually, this is added to allow terrcorr)
-      if (amplitude_band >= 0)
-        put_band_float_line(fout, outMeta, amplitude_band, i, img_rows->amp);
-
-      // if requested, generate sinlair output
-      do_sinclair_bands(sinclair_1_band, sinclair_2_band, sinclair_3_band,
-                        img_rows, i, l, multi, chunk_size, outMeta, fout, buf);
-
-      // calculate the pauli output (magnitude of already-calculated
-      // complex pauli basis elements), and save the requested pauli
-      // bands in the output
-      do_pauli_bands(pauli_1_band, pauli_2_band, pauli_3_band,
-                     img_rows, i, l, multi, chunk_size, outMeta, fout, buf);
-
-
-      // Freeman-Durden
-      do_freeman(freeman_1_band, freeman_2_band, freeman_3_band,
-                 img_rows, i, l, multi, chunk_size, outMeta, fout);
-
-      // do any polarimetry that uses the coherence matrix
-      do_coherence_bands(entropy_band, anisotropy_band, alpha_band, class_band,
-                         img_rows, i, l, multi, chunk_size, T, eval, evec, ws,
-                         outMeta, fout, buf, classifier);
-                         
+  DecompositionParams params;
+  params.amplitude_band = amplitude_band;
+  params.pauli_1_band = pauli_1_band;
+  params.pauli_2_band = pauli_2_band;
+  params.pauli_3_band = pauli_3_band;
+  params.entropy_band = entropy_band;
+  params.anisotropy_band = anisotropy_band;
+  params.alpha_band = alpha_band;
+  params.sinclair_1_band = sinclair_1_band;
+  params.sinclair_2_band = sinclair_2_band;
+  params.sinclair_3_band = sinclair_3_band;
+  params.freeman_1_band = freeman_1_band;
+  params.freeman_2_band = freeman_2_band;
+  params.freeman_3_band = freeman_3_band;
+  params.class_band = class_band;
+  params.classifier = classifier;
+  params.multi = multi;
+  params.chunk_size = chunk_size;
+  params.outMeta = outMeta;
+
+  int thread_count = MIN(get_polarimetry_thread_count(), onl);
+  if (thread_count > 1) {
+    decompose_lines_threaded(&params, inMeta, img_rows, fin, fout,
+                             thread_count);
+  }
+  else {
+    // now loop through the lines of the output image
+    DecompositionLine *out = decomposition_line_new(&params, NULL);
+    for (i=0; i<onl; ++i) {
+      out->line = i;
+      decompose_line(&params, img_rows, i, out);
+      write_decomposition_line(&params, out, fout);
 
       // load the next row, if there are still more to go
-      if (i<onl-1) {
-          if (multi) {
-              polarimetric_image_rows_load_new_rows(img_rows, fin);
-          }
-          else {
-              polarimetric_image_rows_load_next_row(img_rows, fin);
-              assert(img_rows->current_row == i+1);
-          }
-      }
+      if (i<onl-1)
+        load_rows_for_next_line(img_rows, multi, i, fin);
 
       asfLineMeter(i,onl);
+    }
+    decomposition_line_free(out, &params);
   }
 
   if (entropy_band >= 0 || anisotropy_band >= 0 || alpha_band >= 0 || 
@@ -2014,18 +2332,11 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
     do_class_map(classifier, class_band, wide, outFile);
   }
 
-  gsl_vector_free(eval);
-  gsl_eigen_hermv_free(ws);
-  gsl_matrix_complex_free(evec);
-  gsl_matrix_complex_free(T);
-
   polarimetric_image_rows_free(img_rows);
 
   fclose(fin);
   fclose(fout);
 
-  free(buf);
-
   free(out_img_name);
   free(in_img_name);
   free(meta_name);
@@ -11,6 +11,8 @@
 #include <limits.h>
 #include <assert.h>
 
+#include <glib.h>
+
 #include <asf.h>
 #include <asf_endian.h>
 #include <asf_meta.h>
@@ -32,6 +34,20 @@ const int MATCHING_NONE = 0;
 const int MATCHING_FULL = 1;
 const int MATCHING_GRID = 2;
 
+// Memory, in bytes, asf_terrcorr_ext() may use to keep its intermediate
+// images out of the file system.  Off (0) unless asked for.
+static long long terrcorr_memory_limit = 0;
+
+void set_terrcorr_memory_limit(long long bytes)
+{
+  terrcorr_memory_limit = bytes > 0 ? bytes : 0;
+}
+
+long long get_terrcorr_memory_limit(void)
+{
+  return terrcorr_memory_limit;
+}
+
 static void ensure_ext(char **filename, const char *ext)
 {
   char *ret = MALLOC(sizeof(char)*(strlen(*filename)+strlen(ext)+5));
@@ -73,6 +89,18 @@ static char *getOutName(const char *dir, const char *base, const char *suffix)
     return ret;
 }
 
+// "<file>.img" is an intermediate image, which asf_terrcorr_ext() may
+// keep in memory (see scratch.c)
+static void scratch_image(const char *file)
+{
+    if (file)
+    {
+        char * img_file = appendExt(file, ".img");
+        scratch_file_add(img_file);
+        free(img_file);
+    }
+}
+
 // attempt to remove "<file>.img" and "<file>.meta", etc files
 static void clean(const char *file)
 {
@@ -96,9 +124,10 @@ static void clean(const char *file)
     }
 }
 
+// If master isn't NULL, it holds file1, already transformed.
 static void
-fftMatchQ(char *file1, char *file2, float *dx, float *dy, float *cert,
-          int use_grid_matching)
+fftMatchQ(fft_correlator *master, char *file1, char *file2,
+          float *dx, float *dy, float *cert, int use_grid_matching)
 {
   int qf_saved = quietflag;
   //quietflag = 1;
@@ -110,7 +139,10 @@ fftMatchQ(char *file1, char *file2, float *dx, float *dy, float *cert,
     fftMatch_gridded(file1, file2, match_file, dx, dy, cert, -1, -1, -1);
   }
   else {
-    fftMatch(file1, file2, NULL, dx, dy, cert);
+    if (master)
+      fft_correlator_match(master, file2, dx, dy, cert);
+    else
+      fftMatch(file1, file2, NULL, dx, dy, cert);
     asfPrintStatus("Regular matching: dx=%6.3f, dy=%6.3f\n", *dx, *dy);
 
     // We don't do this for the grid matching, as that already does
@@ -150,26 +182,17 @@ static void update_meta_offsets(const char *filename, double t_offset,
 }
 
 static void
-fftMatch_atCorners(char *output_dir, char *sar, char *dem, const int size)
+fftMatch_atCorners(char *sar, char *dem, const int size)
 {
-  float dx_ur, dy_ur;
-  float dx_ul, dy_ul;
-  float dx_lr, dy_lr;
-  float dx_ll, dy_ll;
-  float cert;
+  float dx[4], dy[4], cert[4];
+  int x[4], y[4];
   double rsf, asf;
-
-  char *chopped_sar, *chopped_dem;
-  int nl, ns;
+  int ii, nl, ns;
   meta_parameters *meta_sar, *meta_dem;
-  long long lsz = (long long)size;
 
   meta_sar = meta_read(sar);
   meta_dem = meta_read(dem);
 
-  chopped_sar = getOutName(output_dir, sar, "_chip");
-  chopped_dem = getOutName(output_dir, dem, "_chip");
-
   nl = mini(meta_sar->general->line_count, meta_dem->general->line_count);
   ns = mini(meta_sar->general->sample_count, meta_dem->general->sample_count);
 
@@ -182,52 +205,45 @@ fftMatch_atCorners(char *output_dir, char *sar, char *dem, const int size)
   //  return;
   //}
 
-  trim(sar, chopped_sar, (long long)0, (long long)0, lsz, lsz);
-  trim(dem, chopped_dem, (long long)0, (long long)0, lsz, lsz);
-
-  fftMatchQ(chopped_sar, chopped_dem, &dx_ur, &dy_ur, &cert, FALSE);
-  asfPrintStatus("UR: %14.10f %14.10f %14.10f\n", dx_ur, dy_ur, cert);
-
-  trim(sar, chopped_sar, (long long)(ns-size), (long long)0, lsz, lsz);
-  trim(dem, chopped_dem, (long long)(ns-size), (long long)0, lsz, lsz);
-
-  fftMatchQ(chopped_sar, chopped_dem, &dx_ul, &dy_ul, &cert, FALSE);
-  asfPrintStatus("UL: %14.10f %14.10f %14.10f\n", dx_ul, dy_ul, cert);
-
-  trim(sar, chopped_sar, (long long)0, (long long)(nl-size), lsz, lsz);
-  trim(dem, chopped_dem, (long long)0, (long long)(nl-size), lsz, lsz);
-
-  fftMatchQ(chopped_sar, chopped_dem, &dx_lr, &dy_lr, &cert, FALSE);
-  asfPrintStatus("LR: %14.10f %14.10f %14.10f\n", dx_lr, dy_lr, cert);
-
-  trim(sar, chopped_sar, (long long)(ns-size), (long long)(nl-size),
-       lsz, lsz);
-  trim(dem, chopped_dem, (long long)(ns-size), (long long)(nl-size),
-       lsz, lsz);
+  // UR, UL, LR, LL -- all four are read in one pass, and matched at once
+  x[0] = 0;       y[0] = 0;
+  x[1] = ns-size; y[1] = 0;
+  x[2] = 0;       y[2] = nl-size;
+  x[3] = ns-size; y[3] = nl-size;
+  fftMatch_chips(sar, dem, 4, x, y, size, dx, dy, cert);
+
+  for (ii=0; ii<4; ++ii) {
+    if (!meta_is_valid_double(dx[ii]) || !meta_is_valid_double(dy[ii])) {
+      // bad match the first way, try with the chips taken from the
+      // other file, as fftMatchQ does
+      float rdx, rdy;
+      fftMatch_chips(dem, sar, 1, &x[ii], &y[ii], size, &rdx, &rdy,
+                     &cert[ii]);
+      dx[ii] = meta_is_valid_double(rdx) ? -rdx : rdx;
+      dy[ii] = meta_is_valid_double(rdy) ? -rdy : rdy;
+    }
+  }
 
-  fftMatchQ(chopped_sar, chopped_dem, &dx_ll, &dy_ll, &cert, FALSE);
-  asfPrintStatus("LL: %14.10f %14.10f %14.10f\n", dx_ll, dy_ll, cert);
+  asfPrintStatus("UR: %14.10f %14.10f %14.10f\n", dx[0], dy[0], cert[0]);
+  asfPrintStatus("UL: %14.10f %14.10f %14.10f\n", dx[1], dy[1], cert[1]);
+  asfPrintStatus("LR: %14.10f %14.10f %14.10f\n", dx[2], dy[2], cert[2]);
+  asfPrintStatus("LL: %14.10f %14.10f %14.10f\n", dx[3], dy[3], cert[3]);
 
-  asfPrintStatus("Range shift: %14.10f top\n", (double)(dx_ul-dx_ur));
-  asfPrintStatus("             %14.10f bottom\n", (double)(dx_ll-dx_lr));
-  asfPrintStatus("   Az shift: %14.10f left\n", (double)(dy_ul-dy_ll));
-  asfPrintStatus("             %14.10f right\n\n", (double)(dy_ur-dy_lr));
+  asfPrintStatus("Range shift: %14.10f top\n", (double)(dx[1]-dx[0]));
+  asfPrintStatus("             %14.10f bottom\n", (double)(dx[3]-dx[2]));
+  asfPrintStatus("   Az shift: %14.10f left\n", (double)(dy[1]-dy[3]));
+  asfPrintStatus("             %14.10f right\n\n", (double)(dy[0]-dy[2]));
 
   nl = meta_sar->general->line_count;
   ns = meta_sar->general->sample_count;
 
-  rsf = 1 - (fabs((double)(dx_ul-dx_ur)) + fabs((double)(dx_ll-dx_lr)))/ns/2;
-  asf = 1 - (fabs((double)(dy_ul-dy_ll)) + fabs((double)(dy_ur-dy_lr)))/nl/2;
+  rsf = 1 - (fabs((double)(dx[1]-dx[0])) + fabs((double)(dx[3]-dx[2])))/ns/2;
+  asf = 1 - (fabs((double)(dy[1]-dy[3])) + fabs((double)(dy[0]-dy[2])))/nl/2;
 
   asfPrintStatus("Suggested scale factors: %14.10f range\n", rsf);
   asfPrintStatus("                         %14.10f azimuth\n\n", asf);
 
   meta_free(meta_sar);
-
-  clean(chopped_sar);
-  clean(chopped_dem);
-  free(chopped_sar);
-  free(chopped_dem);
 }
 
 int asf_terrcorr(char *sarFile, char *demFile, char *userMaskFile,
@@ -668,6 +684,7 @@ int match_dem(meta_parameters *metaSAR,
   float dx=0, dy=0, cert=0;
   int idx=0, idy=0;
   const float cert_cutoff = 0.4; // is this a good cutoff !?
+  fft_correlator *srCorr = NULL;
 
   double saved_time_shift = metaSAR->sar->time_shift;
   double saved_slant_shift = metaSAR->sar->slant_shift;
@@ -708,6 +725,7 @@ int match_dem(meta_parameters *metaSAR,
              "(iteration #%d)\n", demFile, num_attempts);
 
     demClipped = getOutName(output_dir, demFile, "_clip");
+    scratch_image(demClipped);
 
     // Clip the DEM to the same size as the SAR image.  If a user mask was
     // provided, we must clip that one, too.
@@ -739,6 +757,8 @@ int match_dem(meta_parameters *metaSAR,
                    "simulated sar image...\n");
     demSlant = getOutName(output_dir, demFile, "_slant");
     demSimSar = getOutName(output_dir, demFile, "_sim_sar");
+    scratch_image(demSlant);
+    scratch_image(demSimSar);
 
     reskew_dem_rad(srFile, demClipped, demSlant, demGround, demSimSar,
                    userMaskClipped, metaSAR->general->radiometry,add_speckle);
@@ -831,13 +851,16 @@ int match_dem(meta_parameters *metaSAR,
                                                     "_sim_sar_trim_for_fft");
               char *srTrimSimSar = getOutName(output_dir, srFile,
                                               "_src_trim_for_fft");
+              scratch_image(demTrimSimSar_ffft);
+              scratch_image(srTrimSimSar);
 
               //asfPrintStatus("Creating trimmed regions:\n %s->%s\n %s->%s\n",
               //               demTrimSimSar, demTrimSimSar_ffft,
               //               srFile, srTrimSimSar);
               trim(demTrimSimSar, demTrimSimSar_ffft,xtl,ytl,xbr-xtl,ybr-ytl);
               trim(srFile, srTrimSimSar, xtl, ytl, xbr-xtl, ybr-ytl);
-              fftMatchQ(srTrimSimSar, demTrimSimSar_ffft, &dx, &dy, &cert, FALSE);
+              fftMatchQ(NULL, srTrimSimSar, demTrimSimSar_ffft, &dx, &dy, &cert,
+                        FALSE);
 
               if (cert < cert_cutoff) {
                   asfPrintStatus("Match: %.2f%% certainty. (%f,%f)\n"
@@ -881,7 +904,12 @@ int match_dem(meta_parameters *metaSAR,
       // This is the normal case -- no user mask, regular matching
       // Match the real and simulated SAR image to determine the offset.
       int use_grid_matching = matching_level == MATCHING_GRID;
-      fftMatchQ(srFile, demTrimSimSar, &dx, &dy, &cert, use_grid_matching);
+      // Only the metadata of srFile changes from one attempt to the
+      // next, so its spectrum is computed once and reused.
+      if (!use_grid_matching && !srCorr)
+        srCorr = fft_correlator_new(srFile);
+      fftMatchQ(srCorr, srFile, demTrimSimSar, &dx, &dy, &cert,
+                use_grid_matching);
 
       // Now that we've generated the grid, we are done, user must use
       // fit_warp and remap
@@ -966,7 +994,7 @@ int match_dem(meta_parameters *metaSAR,
       int chipsz = 256;
       asfPrintStatus("Doing corner fftMatching... (using %dx%d chips)\n",
              chipsz, chipsz);
-      fftMatch_atCorners(output_dir, srFile, demTrimSimSar, chipsz);
+      fftMatch_atCorners(srFile, demTrimSimSar, chipsz);
     }
 
     // Apply the offset to the simulated sar image.
@@ -979,7 +1007,7 @@ int match_dem(meta_parameters *metaSAR,
       float dx2, dy2;
 
       asfPrintStatus("Verifying offsets are now close to zero...\n");
-      fftMatchQ(srFile, demTrimSimSar, &dx2, &dy2, &cert, FALSE);
+      fftMatchQ(srCorr, srFile, demTrimSimSar, &dx2, &dy2, &cert, FALSE);
 
       asfPrintStatus("Correlation after shift (cert=%5.2f%%): "
                      "dx=%f, dy=%f.\n",
@@ -1006,6 +1034,7 @@ int match_dem(meta_parameters *metaSAR,
           clean(demClipped);   FREE(demClipped);
           clean(demSimSar);    FREE(demSimSar);
           clean(demSlant);     FREE(demSlant);
+          fft_correlator_free(srCorr);
 	 
           // restore original shifts
           metaSAR->sar->time_shift = saved_time_shift;
@@ -1083,6 +1112,7 @@ int match_dem(meta_parameters *metaSAR,
   FREE(demClipped);
   FREE(demSimSar);
   FREE(demSlant);
+  fft_correlator_free(srCorr);
 
   *t_offset = t_off;
   *x_offset = x_off;
@@ -1128,20 +1158,21 @@ int asf_check_geolocation(char *sarFile, char *demFile, char *userMaskFile,
   return 0;
 }
 
-int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
-                     char *outFile_in, double pixel_size, int clean_files,
-                     int do_resample, int do_corner_matching, int do_interp,
-                     int do_fftMatch_verification, int dem_grid_size,
-                     int do_terrain_correction, int fill_value,
-                     int generate_water_mask, int save_clipped_dem,
-                     int update_original_metadata_with_offsets,
-                     float mask_height_cutoff, int doRadiometric,
-                     int smooth_dem_holes,
-                     char **other_files_to_update_with_offset,
-                     int matching_level, double range_offset,
-                     double azimuth_offset, int use_gr_dem, int add_speckle,
-                     int if_coreg_fails_use_zero_offsets, int save_ground_dem,
-                     int save_incid_angles, int use_nearest_neighbor)
+static int
+terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
+             char *outFile_in, double pixel_size, int clean_files,
+             int do_resample, int do_corner_matching, int do_interp,
+             int do_fftMatch_verification, int dem_grid_size,
+             int do_terrain_correction, int fill_value,
+             int generate_water_mask, int save_clipped_dem,
+             int update_original_metadata_with_offsets,
+             float mask_height_cutoff, int doRadiometric,
+             int smooth_dem_holes,
+             char **other_files_to_update_with_offset,
+             int matching_level, double range_offset,
+             double azimuth_offset, int use_gr_dem, int add_speckle,
+             int if_coreg_fails_use_zero_offsets, int save_ground_dem,
+             int save_incid_angles, int use_nearest_neighbor)
 {
   char *resampleFile = NULL, *srFile = NULL, *resampleFile_2 = NULL;
   char *demTrimSimSar = NULL, *demTrimSlant = NULL, *demGround = NULL;
@@ -1275,6 +1306,8 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
 
   asfPrintStatus("Checking %s ... \n", demFile_in);
   char *demFile = build_dem(metaSAR, demFile_in, output_dir);
+  // a DEM built from a directory of DEMs is one of our intermediates
+  char *builtDem = strcmp(demFile, demFile_in) != 0 ? STRDUP(demFile) : NULL;
 
   asfPrintStatus("Reading DEM metadata from: %s\n", demFile);
   asfRequire(extExists(demFile, ".meta") || extExists(demFile, ".ddr"),
@@ -1354,6 +1387,7 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
   {
       maskRes = metamask->general->x_pixel_size;
       userMaskClipped = getOutName(output_dir, userMaskFile, "_clip");
+      scratch_image(userMaskClipped);
   }
 
   // Check if the user requested a pixel size that requires
@@ -1532,6 +1566,10 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
   demTrimSimSar = getOutName(output_dir, demChunk, "_sim_sar_trim");
   demTrimSlant = getOutName(output_dir, demChunk, "_slant_trim");
   demGround = getOutName(output_dir, demFile, "_ground");
+  scratch_image(demTrimSimSar);
+  scratch_image(demTrimSlant);
+  if (!save_ground_dem)
+    scratch_image(demGround);
 
   match_dem(metaSAR, sarFile, demChunk, srFile, output_dir, userMaskFile,
         demTrimSimSar, demTrimSlant, demGround, userMaskClipped, dem_grid_size,
@@ -1573,6 +1611,9 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
       padFile = getOutName(output_dir, srFile, "_pad");
       deskewDemFile = getOutName(output_dir, srFile, "_dd");
       deskewDemMask = getOutName(output_dir, srFile, "_ddm");
+      scratch_image(padFile);
+      scratch_image(deskewDemFile);
+      scratch_image(deskewDemMask);
       trim(srFile, padFile, 0, 0, metaSAR->general->sample_count + PAD,
            metaSAR->general->line_count);
       deskew_dem(demTrimSlant, demGround, deskewDemFile, padFile, FALSE,
@@ -1696,7 +1737,10 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
         if (strstr(demFile, "_tc_smooth"))
             clean(demFile);
     }
+    if (builtDem)
+        clean(builtDem);
   }
+  FREE(builtDem);
 
   if (generate_water_mask)
     FREE(userMaskFile);
@@ -1725,3 +1769,50 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
   asfPrintStatus("Done!\n");
   return 0; // success
 }
+
+int asf_terrcorr_ext(char *sarFile, char *demFile, char *userMaskFile,
+                     char *outFile, double pixel_size, int clean_files,
+                     int do_resample, int do_corner_matching, int do_interp,
+                     int do_fftMatch_verification, int dem_grid_size,
+                     int do_terrain_correction, int fill_value,
+                     int generate_water_mask, int save_clipped_dem,
+                     int update_original_metadata_with_offsets,
+                     float mask_height_cutoff, int doRadiometric,
+                     int smooth_dem_holes,
+                     char **other_files_to_update_with_offset,
+                     int matching_level, double range_offset,
+                     double azimuth_offset, int use_gr_dem, int add_speckle,
+                     int if_coreg_fails_use_zero_offsets, int save_ground_dem,
+                     int save_incid_angles, int use_nearest_neighbor)
+{
+  // The intermediate images are only kept in memory if that was asked
+  // for, and they were going to be deleted anyway.  Otherwise they go to
+  // disk, as always, but still through the scratch files, so the bytes
+  // written to them are counted in both cases and the report below can
+  // be compared between the two.
+  long long memory_limit = clean_files ? get_terrcorr_memory_limit() : 0;
+  long long memory_bytes = 0, disk_bytes = 0, peak_bytes = 0;
+  GTimer *timer = g_timer_new();
+  int ret;
+
+  scratch_files_begin(memory_limit);
+  ret = terrcorr_ext(sarFile, demFile, userMaskFile, outFile, pixel_size,
+                     clean_files, do_resample, do_corner_matching, do_interp,
+                     do_fftMatch_verification, dem_grid_size,
+                     do_terrain_correction, fill_value, generate_water_mask,
+                     save_clipped_dem, update_original_metadata_with_offsets,
+                     mask_height_cutoff, doRadiometric, smooth_dem_holes,
+                     other_files_to_update_with_offset, matching_level,
+                     range_offset, azimuth_offset, use_gr_dem, add_speckle,
+                     if_coreg_fails_use_zero_offsets, save_ground_dem,
+                     save_incid_angles, use_nearest_neighbor);
+  scratch_files_end(&memory_bytes, &disk_bytes, &peak_bytes);
+  asfPrintStatus("Terrain correction took %.1f seconds.  Intermediate "
+                 "images: %.1f MB written to disk, %.1f MB kept in memory "
+                 "(%.1f MB at most).\n", g_timer_elapsed(timer, NULL),
+                 disk_bytes / 1048576.0, memory_bytes / 1048576.0,
+                 peak_bytes / 1048576.0);
+
+  g_timer_destroy(timer);
+  return ret;
+}
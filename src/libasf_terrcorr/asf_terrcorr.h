@@ -52,6 +52,21 @@ int asf_terrcorr_ext(char *sarFile, char *demFile, char *inMaskFile,
                      int if_coreg_fails_use_zero_offsets, int save_ground_dem,
                      int save_incid_angles, int use_nearest_neighbor);
 
+/* Memory, in bytes, asf_terrcorr_ext may use to keep the intermediate
+   images (clipped and slant range DEMs, simulated SAR images, masks) in
+   memory instead of writing them to disk.  Only used when clean_files
+   is set; the default, 0, writes them all to disk. */
+void set_terrcorr_memory_limit(long long bytes);
+long long get_terrcorr_memory_limit(void);
+
+/* Directory in which the DEMs built from a directory of DEM tiles are
+   kept, so that the granules of a batch covering the same region don't
+   each have to build their own, along with an index of the DEM
+   directories searched.  The least recently used DEMs are removed when
+   the cache grows past max_bytes (0 for no limit).  No directory (NULL
+   or "", the default) turns the cache off. */
+void set_dem_cache(const char *dir, long long max_bytes);
+
 void
 clip_dem(meta_parameters *metaSAR, char *srFile, char *demFile,
          char *demClipped, char *what, char *otherFile, char *otherClipped,
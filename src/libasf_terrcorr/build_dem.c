@@ -9,6 +9,13 @@
 #include <unistd.h>
 #endif
 
+#ifndef win32
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -93,29 +100,65 @@ int lineSegmentsIntersect(
   return TRUE;
 }
 
-// return TRUE if there is any overlap between the two scenes
-static int test_overlap(meta_parameters *meta1, meta_parameters *meta2)
+// corners of a scene or a DEM, in the order they are found going around
+// the image: (0,0), (nl-1,0), (nl-1,ns-1), (0,ns-1)
+typedef struct {
+    double lat[4], lon[4];
+    double center_lat, center_lon;
+} footprint_t;
+
+// fills in the center lat/lon in the metadata, if it isn't there already
+static void get_footprint(meta_parameters *meta, footprint_t *fp)
 {
-    if (!meta_is_valid_double(meta1->general->center_longitude)) {
-        int nl = meta1->general->line_count;
-        int ns = meta1->general->sample_count;
+    int nl = meta->general->line_count;
+    int ns = meta->general->sample_count;
 
-        meta_get_latLon(meta1, nl/2, ns/2, 0,
-            &meta1->general->center_latitude,
-            &meta1->general->center_longitude);
+    if (!meta_is_valid_double(meta->general->center_longitude)) {
+        meta_get_latLon(meta, nl/2, ns/2, 0,
+            &meta->general->center_latitude,
+            &meta->general->center_longitude);
     }
 
-    if (!meta_is_valid_double(meta2->general->center_longitude)) {
-        int nl = meta2->general->line_count;
-        int ns = meta2->general->sample_count;
+    fp->center_lat = meta->general->center_latitude;
+    fp->center_lon = meta->general->center_longitude;
 
-        meta_get_latLon(meta2, nl/2, ns/2, 0,
-            &meta2->general->center_latitude,
-            &meta2->general->center_longitude);
+    if (meta->location) {
+        // use the location block if available
+        meta_location *ml = meta->location;
+        fp->lat[0] = ml->lat_start_near_range;
+        fp->lon[0] = ml->lon_start_near_range;
+        fp->lat[1] = ml->lat_start_far_range;
+        fp->lon[1] = ml->lon_start_far_range;
+        fp->lat[2] = ml->lat_end_far_range;
+        fp->lon[2] = ml->lon_end_far_range;
+        fp->lat[3] = ml->lat_end_near_range;
+        fp->lon[3] = ml->lon_end_near_range;
+    } else {
+        // must call meta_get_latLon for each corner
+        meta_get_latLon(meta, 0, 0, 0, &fp->lat[0], &fp->lon[0]);
+        meta_get_latLon(meta, nl-1, 0, 0, &fp->lat[1], &fp->lon[1]);
+        meta_get_latLon(meta, nl-1, ns-1, 0, &fp->lat[2], &fp->lon[2]);
+        meta_get_latLon(meta, 0, ns-1, 0, &fp->lat[3], &fp->lon[3]);
     }
+}
+
+// footprint of a lat/lon box
+static void get_footprint_box(double lat_lo, double lat_hi,
+                              double lon_lo, double lon_hi, footprint_t *fp)
+{
+    fp->lat[0] = fp->lat[3] = lat_lo;
+    fp->lat[1] = fp->lat[2] = lat_hi;
+    fp->lon[0] = fp->lon[1] = lon_lo;
+    fp->lon[2] = fp->lon[3] = lon_hi;
+    fp->center_lat = (lat_lo + lat_hi) / 2;
+    fp->center_lon = (lon_lo + lon_hi) / 2;
+}
 
-    int zone1 = utm_zone(meta1->general->center_longitude);
-    int zone2 = utm_zone(meta2->general->center_longitude);
+// return TRUE if there is any overlap between the two footprints
+static int test_overlap(const footprint_t *fp1, const footprint_t *fp2)
+{
+    int zone1 = utm_zone(fp1->center_lon);
+    int zone2 = utm_zone(fp2->center_lon);
 
     // if zone1 & zone2 differ by more than 1, we can stop now
     if (iabs(zone1-zone2) > 1) {
@@ -123,86 +166,29 @@ static int test_overlap(meta_parameters *meta1, meta_parameters *meta2)
     }
 
     // The Plan:
-    // Generate polygons for each metadata, then test of any pair of
+    // Generate polygons for each footprint, then test of any pair of
     // line segments between the polygons intersect.
 
-    // Other possibility: meta1 is completely contained within meta2,
+    // Other possibility: fp1 is completely contained within fp2,
     // or the reverse.
 
-    // corners of meta1.
+    // corners of both, in the zone of fp1
     double xp_1[5], yp_1[5];
+    double xp_2[5], yp_2[5];
+    int i, j;
 
-    if (meta1->location) {
-        // use the location block if available
-        latLon2UTM_zone(meta1->location->lat_start_near_range,
-            meta1->location->lon_start_near_range, 0, zone1, &xp_1[0], &yp_1[0]);
-        latLon2UTM_zone(meta1->location->lat_start_far_range,
-            meta1->location->lon_start_far_range, 0, zone1, &xp_1[1], &yp_1[1]);
-        latLon2UTM_zone(meta1->location->lat_end_far_range,
-            meta1->location->lon_end_far_range, 0, zone1, &xp_1[2], &yp_1[2]);
-        latLon2UTM_zone(meta1->location->lat_end_near_range,
-            meta1->location->lon_end_near_range, 0, zone1, &xp_1[3], &yp_1[3]);
-    } else {
-        double lat, lon;
-        int nl1 = meta1->general->line_count;
-        int ns1 = meta1->general->sample_count;
-
-        // must call meta_get_latLon for each corner
-        meta_get_latLon(meta1, 0, 0, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_1[0], &yp_1[0]);
-
-        meta_get_latLon(meta1, nl1-1, 0, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_1[1], &yp_1[1]);
-
-        meta_get_latLon(meta1, nl1-1, ns1-1, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_1[2], &yp_1[2]);
-
-        meta_get_latLon(meta1, 0, ns1-1, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_1[3], &yp_1[3]);
+    for (i = 0; i < 4; ++i) {
+        latLon2UTM_zone(fp1->lat[i], fp1->lon[i], 0, zone1, &xp_1[i], &yp_1[i]);
+        latLon2UTM_zone(fp2->lat[i], fp2->lon[i], 0, zone1, &xp_2[i], &yp_2[i]);
     }
 
-    // close the polygon
+    // close the polygons
     xp_1[4] = xp_1[0];
     yp_1[4] = yp_1[0];
-
-    // corners of meta2.
-    double xp_2[5], yp_2[5];
-
-    if (meta2->location) {
-        // use the location block if available
-        latLon2UTM_zone(meta2->location->lat_start_near_range,
-            meta2->location->lon_start_near_range, 0, zone1, &xp_2[0], &yp_2[0]);
-        latLon2UTM_zone(meta2->location->lat_start_far_range,
-            meta2->location->lon_start_far_range, 0, zone1, &xp_2[1], &yp_2[1]);
-        latLon2UTM_zone(meta2->location->lat_end_far_range,
-            meta2->location->lon_end_far_range, 0, zone1, &xp_2[2], &yp_2[2]);
-        latLon2UTM_zone(meta2->location->lat_end_near_range,
-            meta2->location->lon_end_near_range, 0, zone1, &xp_2[3], &yp_2[3]);
-    } else {
-        double lat, lon;
-        int nl2 = meta2->general->line_count;
-        int ns2 = meta2->general->sample_count;
-
-        // must call meta_get_latLon for each corner
-        meta_get_latLon(meta2, 0, 0, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_2[0], &yp_2[0]);
-
-        meta_get_latLon(meta2, nl2-1, 0, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_2[1], &yp_2[1]);
-
-        meta_get_latLon(meta2, nl2-1, ns2-1, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_2[2], &yp_2[2]);
-
-        meta_get_latLon(meta2, 0, ns2-1, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_2[3], &yp_2[3]);
-    }
-
-    // close the polygon
     xp_2[4] = xp_2[0];
     yp_2[4] = yp_2[0];
 
     // loop over each pair of line segments, testing for intersection
-    int i, j;
     for (i = 0; i < 4; ++i) {
         for (j = 0; j < 4; ++j) {
             if (lineSegmentsIntersect(
@@ -214,7 +200,7 @@ static int test_overlap(meta_parameters *meta1, meta_parameters *meta2)
         }
     }
 
-    // test for containment: meta2 in meta1
+    // test for containment: fp2 in fp1
     int all_in=TRUE;
     for (i=0; i<4; ++i) {
         if (!pnpoly(5, xp_1, yp_1, xp_2[i], yp_2[i])) {
@@ -226,7 +212,7 @@ static int test_overlap(meta_parameters *meta1, meta_parameters *meta2)
     if (all_in)
         return TRUE;
 
-    // test for containment: meta1 in meta2
+    // test for containment: fp1 in fp2
     all_in = TRUE;
     for (i=0; i<4; ++i) {
         if (!pnpoly(5, xp_2, yp_2, xp_1[i], yp_1[i])) {
@@ -242,6 +228,242 @@ static int test_overlap(meta_parameters *meta1, meta_parameters *meta2)
     return FALSE;
 }
 
+static long file_mtime(const char *file)
+{
+    struct stat stbuf;
+    if (stat(file, &stbuf) == -1)
+        return -1;
+    return (long) stbuf.st_mtime;
+}
+
+// Settings for the DEM cache -- see set_dem_cache() in asf_terrcorr.h.
+// No directory means no caching, a size of 0 means no limit.
+static char *dem_cache_dir = NULL;
+static long long dem_cache_max_bytes = 0;
+
+void set_dem_cache(const char *dir, long long max_bytes)
+{
+    FREE(dem_cache_dir);
+    dem_cache_dir = NULL;
+    if (dir && strlen(dir) > 0) {
+        if (!is_dir(dir) && create_dir(dir) != 0)
+            asfPrintError("Cannot create DEM cache directory: %s\n", dir);
+        dem_cache_dir = STRDUP(dir);
+    }
+    dem_cache_max_bytes = max_bytes;
+}
+
+// name of a file in the cache directory -- free the result
+static char *dem_cache_file(const char *name)
+{
+    char *file = MALLOC(sizeof(char)*(strlen(dem_cache_dir)+strlen(name)+2));
+    sprintf(file, "%s%c%s", dem_cache_dir, DIR_SEPARATOR, name);
+    return file;
+}
+
+// The DEM index: the footprint of every .img found while looking for
+// DEMs, along with the modification time of its .meta.  When a cache
+// directory is set, the index is saved there, one per DEM argument
+// (directory, or file listing directories), so that the next search of
+// the same DEMs only reads the .meta files that are new or have
+// changed.
+typedef struct {
+    char *file;         // the .img
+    long mtime;         // of the .meta, when it was read
+    int is_dem;
+    footprint_t fp;
+    int seen;           // found by this search?
+} dem_index_entry_t;
+
+typedef struct {
+    char *dem_arg;
+    char *index_file;   // NULL if not saved
+    int num, size;
+    int num_sorted;     // entries[0..num_sorted) were loaded, sorted by file
+    dem_index_entry_t *entries;
+    int changed;
+} dem_index_t;
+
+static int compare_index_entries(const void *a, const void *b)
+{
+    return strcmp(((const dem_index_entry_t *) a)->file,
+                  ((const dem_index_entry_t *) b)->file);
+}
+
+static dem_index_entry_t *add_index_entry(dem_index_t *index)
+{
+    if (index->num == index->size) {
+        index->size = index->size ? 2*index->size : 64;
+        index->entries = (dem_index_entry_t *) realloc(index->entries,
+            sizeof(dem_index_entry_t)*index->size);
+    }
+    return &index->entries[index->num++];
+}
+
+static dem_index_t *dem_index_load(const char *dem_arg)
+{
+    dem_index_t *index = MALLOC(sizeof(dem_index_t));
+    index->dem_arg = STRDUP(dem_arg);
+    index->index_file = NULL;
+    index->num = index->size = index->num_sorted = 0;
+    index->entries = NULL;
+    index->changed = FALSE;
+
+    if (!dem_cache_dir)
+        return index;
+
+    // the index file is named after a hash of the DEM argument, the
+    // argument itself is on the first line
+    unsigned long hash = 5381;
+    const char *p;
+    for (p = dem_arg; *p; ++p)
+        hash = hash*33 + (unsigned char) *p;
+    char name[64];
+    sprintf(name, "dems_%08lx.idx", hash & 0xffffffffUL);
+    index->index_file = dem_cache_file(name);
+
+    FILE *fp = fopen(index->index_file, "r");
+    if (!fp)
+        return index;
+
+    char line[2048];
+    int ok = FALSE;
+    if (fgets(line, sizeof(line), fp) && strncmp(line, "dem index ", 10) == 0) {
+        while (strlen(line) > 0 && isspace(line[strlen(line)-1]))
+            line[strlen(line)-1] = '\0';
+        ok = strcmp(line+10, dem_arg) == 0;
+    }
+
+    while (ok && fgets(line, sizeof(line), fp)) {
+        dem_index_entry_t e;
+        int i, n, k;
+        char *q;
+        if (sscanf(line, "%d %ld%n", &e.is_dem, &e.mtime, &n) != 2)
+            continue;
+        q = line + n;
+        for (i = 0; i < 4; ++i) {
+            if (sscanf(q, "%lf %lf%n", &e.fp.lat[i], &e.fp.lon[i], &k) != 2)
+                break;
+            q += k;
+        }
+        if (i < 4 || sscanf(q, "%lf %lf %n", &e.fp.center_lat,
+                            &e.fp.center_lon, &k) != 2)
+            continue;
+        q += k;
+        while (strlen(q) > 0 && isspace(q[strlen(q)-1]))
+            q[strlen(q)-1] = '\0';
+        if (strlen(q) == 0)
+            continue;
+        e.file = STRDUP(q);
+        e.seen = FALSE;
+        *add_index_entry(index) = e;
+    }
+    fclose(fp);
+
+    qsort(index->entries, index->num, sizeof(dem_index_entry_t),
+          compare_index_entries);
+    index->num_sorted = index->num;
+
+    return index;
+}
+
+// Returns the entry for the given .img file, reading its metadata if the
+// file isn't in the index yet, or if the .meta changed since it was read.
+static dem_index_entry_t *dem_index_lookup(dem_index_t *index,
+                                           const char *file)
+{
+    char *meta_filename = appendExt(file, ".meta");
+    long mtime = file_mtime(meta_filename);
+    dem_index_entry_t key, *e;
+
+    key.file = (char *) file;
+    e = (dem_index_entry_t *) bsearch(&key, index->entries, index->num_sorted,
+        sizeof(dem_index_entry_t), compare_index_entries);
+
+    if (e && e->mtime == mtime && mtime != -1) {
+        e->seen = TRUE;
+        free(meta_filename);
+        return e;
+    }
+
+    meta_parameters *meta_dem = meta_read(meta_filename);
+    if (!e) {
+        e = add_index_entry(index);
+        e->file = STRDUP(file);
+    }
+    e->mtime = mtime;
+    e->is_dem = meta_dem->general->image_data_type == DEM;
+    get_footprint(meta_dem, &e->fp);
+    e->seen = TRUE;
+    index->changed = TRUE;
+
+    free(meta_filename);
+    meta_free(meta_dem);
+
+    return e;
+}
+
+// drops the entries for files not found by this search, and saves the
+// index if it has changed
+static void dem_index_save(dem_index_t *index)
+{
+    int i, n = 0;
+    for (i = 0; i < index->num; ++i) {
+        if (index->entries[i].seen)
+            index->entries[n++] = index->entries[i];
+        else {
+            free(index->entries[i].file);
+            index->changed = TRUE;
+        }
+    }
+    index->num = n;
+    index->num_sorted = 0;
+
+    if (!index->index_file || !index->changed)
+        return;
+
+    // write to a temporary file and move it into place, so that another
+    // process never sees a partly written index
+    char *tmp = MALLOC(sizeof(char)*(strlen(index->index_file)+32));
+    sprintf(tmp, "%s.%d", index->index_file, (int) getpid());
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        asfPrintWarning("Cannot write DEM index: %s\n", tmp);
+        free(tmp);
+        return;
+    }
+
+    fprintf(fp, "dem index %s\n", index->dem_arg);
+    for (i = 0; i < index->num; ++i) {
+        dem_index_entry_t *e = &index->entries[i];
+        int j;
+        fprintf(fp, "%d %ld", e->is_dem, e->mtime);
+        for (j = 0; j < 4; ++j)
+            fprintf(fp, " %.10f %.10f", e->fp.lat[j], e->fp.lon[j]);
+        fprintf(fp, " %.10f %.10f %s\n", e->fp.center_lat, e->fp.center_lon,
+                e->file);
+    }
+    fclose(fp);
+
+    if (rename(tmp, index->index_file) != 0) {
+        asfPrintWarning("Cannot write DEM index: %s\n", index->index_file);
+        remove_file(tmp);
+    }
+    free(tmp);
+    index->changed = FALSE;
+}
+
+static void dem_index_free(dem_index_t *index)
+{
+    int i;
+    for (i = 0; i < index->num; ++i)
+        free(index->entries[i].file);
+    FREE(index->entries);
+    FREE(index->index_file);
+    free(index->dem_arg);
+    free(index);
+}
+
 // this is just to make the recursive searching of directories look nice
 static char *spaces(int n)
 {
@@ -256,13 +478,15 @@ static char *spaces(int n)
 // process_file as appropriate
 static void process(const char *what, int level, int recursive,
                     char *overlapping_dems[], int *next_dem_number,
-                    meta_parameters *meta, int *n_dems_total);
+                    const footprint_t *fp, dem_index_t *index,
+                    int *n_dems_total);
 
 // process all things in a directory.  Calls "process" to decide
 // if the "thing" is a dir (process_dir) or a file (process_file)
 static void process_dir(const char *dir, int top, int recursive,
                         char *overlapping_dems[], int *next_dem_number,
-                        meta_parameters *meta, int *n_dems_total)
+                        const footprint_t *fp, dem_index_t *index,
+                        int *n_dems_total)
 {
   char name[1024];
   struct dirent *dp;
@@ -287,7 +511,7 @@ static void process_dir(const char *dir, int top, int recursive,
       // process this entry
       sprintf(name, "%s%c%s", dir, DIR_SEPARATOR, dp->d_name);
       process(name, top, recursive, overlapping_dems, next_dem_number,
-          meta, n_dems_total);
+          fp, index, n_dems_total);
     }
   }
   closedir(dfd);
@@ -296,7 +520,8 @@ static void process_dir(const char *dir, int top, int recursive,
 // if a file is a .img file, test it for overlap, otherwise do nothing
 static void process_file(const char *file, int level,
                          char *overlapping_dems[], int *next_dem_number,
-                         meta_parameters *meta, int *n_dems_total)
+                         const footprint_t *fp, dem_index_t *index,
+                         int *n_dems_total)
 {
     char *base = get_filename(file);
     char *ext = findExt(base);
@@ -305,12 +530,11 @@ static void process_file(const char *file, int level,
         char *does;
         ++(*n_dems_total);
 
-        char *meta_filename = appendExt(file, ".meta");
-        meta_parameters *meta_dem = meta_read(meta_filename);
+        dem_index_entry_t *e = dem_index_lookup(index, file);
 
-        if (meta_dem->general->image_data_type != DEM) {
+        if (!e->is_dem) {
             does = "Not a DEM";
-        } else if (test_overlap(meta, meta_dem)) {
+        } else if (test_overlap(fp, &e->fp)) {
             // overlaps!
             overlapping_dems[*next_dem_number] = STRDUP(file);
             ++(*next_dem_number);
@@ -319,9 +543,6 @@ static void process_file(const char *file, int level,
             does = "No";
         }
 
-        free(meta_filename);
-        meta_free(meta_dem);
-
         asfPrintStatus("  %s%s - %s\n", spaces(level), base, does);
     }
     else if (ext && (strcmp_case(ext, ".meta") == 0 ||
@@ -340,7 +561,8 @@ static void process_file(const char *file, int level,
 // calls either process_dir or process_file, above
 static void process(const char *what, int level, int recursive,
                     char *overlapping_dems[], int *next_dem_number,
-                    meta_parameters *meta, int *n_dems_total)
+                    const footprint_t *fp, dem_index_t *index,
+                    int *n_dems_total)
 {
   struct stat stbuf;
 
@@ -355,7 +577,7 @@ static void process(const char *what, int level, int recursive,
       if (level==0 || recursive) {
           asfPrintStatus("  %s%s/\n", spaces(level), base);
           process_dir(what, level+1, recursive, overlapping_dems,
-              next_dem_number, meta, n_dems_total);
+              next_dem_number, fp, index, n_dems_total);
       }
       else {
           asfPrintStatus("  %s%s (skipped)\n", spaces(level), base);
@@ -363,7 +585,7 @@ static void process(const char *what, int level, int recursive,
   }
   else {
       process_file(what, level, overlapping_dems, next_dem_number,
-          meta, n_dems_total);
+          fp, index, n_dems_total);
   }
 
   FREE(base);
@@ -371,8 +593,9 @@ static void process(const char *what, int level, int recursive,
 
 // in a given directory, find all overlapping dems.  Calls
 // "process" to do the real work
-static char **find_overlapping_dems_dir(meta_parameters *meta,
+static char **find_overlapping_dems_dir(const footprint_t *fp,
                                         const char *dem_dir,
+                                        dem_index_t *index,
                                         int *n_dems_total)
 {
     int i,n=0;
@@ -384,7 +607,7 @@ static char **find_overlapping_dems_dir(meta_parameters *meta,
     for (i=0; i<max_dems; ++i)
         overlapping_dems[i] = NULL;
 
-    process(dem_dir, 0, recursive, overlapping_dems, &n, meta,
+    process(dem_dir, 0, recursive, overlapping_dems, &n, fp, index,
         n_dems_total);
 
     if (n > 0) {
@@ -407,8 +630,9 @@ static char **find_overlapping_dems_dir(meta_parameters *meta,
 // given a metadata file, and a file that contains a list of
 // directories containing DEMs, return the DEMs that overlap
 // with the given metadata.
-static char **find_overlapping_dems(meta_parameters *meta,
+static char **find_overlapping_dems(const footprint_t *footprint,
                                     const char *file_with_dem_dirs,
+                                    dem_index_t *index,
                                     int *n_dems_found)
 {
     // hard-coded limit of 100 dems
@@ -431,7 +655,8 @@ static char **find_overlapping_dems(meta_parameters *meta,
     while (NULL != fgets(line, 512, fp)) {
         while (isspace(line[strlen(line)-1])) line[strlen(line)-1] = '\0';
         asfPrintStatus("Looking for DEMs in directory: %s\n", line);
-        char **dems = find_overlapping_dems_dir(meta, line, &n_dems_total);
+        char **dems = find_overlapping_dems_dir(footprint, line, index,
+                                                &n_dems_total);
         if (dems) {
             char **p = dems;
             while (*p) {
@@ -442,7 +667,7 @@ static char **find_overlapping_dems(meta_parameters *meta,
                     asfPrintWarning("Too many DEMS!");
                 }
                 free(*p);
-                ++(*p);
+                ++p;
             }
             free(dems);
         }
@@ -660,6 +885,593 @@ static int asf_mosaic_utm(char **files, char *outfile, int zone,
         lat_lo, lat_hi, lon_lo, lon_hi, overlap, FALSE);
 }
 
+// The cached DEMs are listed in dem_cache.txt in the cache directory:
+// for each, the zone, pixel size and background value it was built
+// with, the lat/lon box it covers, when it was last used, its size,
+// and the tiles it was mosaicked from along with their modification
+// times.  A cached DEM covers the bounding box of the granule it was
+// built for widened out to a DEM_CACHE_SNAP degree grid, so that it
+// can be used for the neighbouring granules as well.
+//
+// DEMs being built are listed too, with the process building them.
+// A job that needs a box one of them will cover waits for it instead of
+// building a copy of its own, checking back every DEM_CACHE_POLL
+// seconds.  A build stops counting once its process has gone (when it
+// ran on this host), or after DEM_CACHE_BUILD_TIMEOUT seconds.
+#define DEM_CACHE_SNAP 0.5
+#define DEM_CACHE_POLL 10
+#define DEM_CACHE_BUILD_TIMEOUT 3600
+
+typedef struct {
+    int id;             // the DEM is dem_<id>.img
+    int zone;
+    double ps, background;
+    double lat_lo, lat_hi, lon_lo, lon_hi;
+    long last_used;
+    long long bytes;
+    int num_tiles;
+    char **tiles;
+    long *mtimes;
+} dem_cache_entry_t;
+
+typedef struct {
+    int id;             // building_<id>, to become dem_<id>
+    long pid;
+    char host[256];
+    int zone;
+    double ps, background;
+    double lat_lo, lat_hi, lon_lo, lon_hi;
+    long started;
+} dem_cache_build_t;
+
+typedef struct {
+    int next_id;
+    int num, size;
+    dem_cache_entry_t *entries;
+    int num_builds;
+    dem_cache_build_t *builds;
+} dem_cache_t;
+
+static char *dem_cache_entry_file(int id)
+{
+    char name[64];
+    sprintf(name, "dem_%d", id);
+    return dem_cache_file(name);
+}
+
+static void dem_cache_entry_free(dem_cache_entry_t *e)
+{
+    int i;
+    for (i = 0; i < e->num_tiles; ++i)
+        free(e->tiles[i]);
+    FREE(e->tiles);
+    FREE(e->mtimes);
+}
+
+static dem_cache_entry_t *add_cache_entry(dem_cache_t *cache)
+{
+    if (cache->num == cache->size) {
+        cache->size = cache->size ? 2*cache->size : 16;
+        cache->entries = (dem_cache_entry_t *) realloc(cache->entries,
+            sizeof(dem_cache_entry_t)*cache->size);
+    }
+    return &cache->entries[cache->num++];
+}
+
+// removes entry i, and its DEM.  Jobs still using the DEM have links of
+// their own to it, see pin_cached_dem().
+static void dem_cache_remove(dem_cache_t *cache, int i)
+{
+    char *file = dem_cache_entry_file(cache->entries[i].id);
+    removeImgAndMeta(file);
+    free(file);
+
+    dem_cache_entry_free(&cache->entries[i]);
+    cache->entries[i] = cache->entries[--cache->num];
+}
+
+static dem_cache_t *dem_cache_read(void)
+{
+    dem_cache_t *cache = MALLOC(sizeof(dem_cache_t));
+    cache->next_id = 1;
+    cache->num = cache->size = 0;
+    cache->entries = NULL;
+    cache->num_builds = 0;
+    cache->builds = NULL;
+
+    char *catalog = dem_cache_file("dem_cache.txt");
+    FILE *fp = fopen(catalog, "r");
+    free(catalog);
+    if (!fp)
+        return cache;
+
+    char line[2048];
+    dem_cache_entry_t *e = NULL;
+    while (fgets(line, sizeof(line), fp)) {
+        int n;
+        if (sscanf(line, "next_id %d", &n) == 1) {
+            cache->next_id = n;
+        }
+        else if (strncmp(line, "building ", 9) == 0) {
+            dem_cache_build_t b;
+            if (sscanf(line+9, "%d %ld %255s %d %lf %lf %lf %lf %lf %lf %ld",
+                       &b.id, &b.pid, b.host, &b.zone, &b.ps, &b.background,
+                       &b.lat_lo, &b.lat_hi, &b.lon_lo, &b.lon_hi,
+                       &b.started) == 11)
+            {
+                cache->builds = (dem_cache_build_t *) realloc(cache->builds,
+                    sizeof(dem_cache_build_t)*(cache->num_builds+1));
+                cache->builds[cache->num_builds++] = b;
+            }
+        }
+        else if (strncmp(line, "entry ", 6) == 0) {
+            e = add_cache_entry(cache);
+            if (sscanf(line+6, "%d %d %lf %lf %lf %lf %lf %lf %ld %lld %d",
+                       &e->id, &e->zone, &e->ps, &e->background,
+                       &e->lat_lo, &e->lat_hi, &e->lon_lo, &e->lon_hi,
+                       &e->last_used, &e->bytes, &e->num_tiles) != 11 ||
+                e->num_tiles <= 0)
+            {
+                --cache->num;
+                e = NULL;
+                continue;
+            }
+            e->tiles = CALLOC(e->num_tiles, sizeof(char*));
+            e->mtimes = CALLOC(e->num_tiles, sizeof(long));
+            n = e->num_tiles;
+            e->num_tiles = 0;
+            while (e->num_tiles < n && fgets(line, sizeof(line), fp)) {
+                int k;
+                long mtime;
+                if (sscanf(line, "tile %ld %n", &mtime, &k) != 1)
+                    break;
+                char *q = line + k;
+                while (strlen(q) > 0 && isspace(q[strlen(q)-1]))
+                    q[strlen(q)-1] = '\0';
+                e->tiles[e->num_tiles] = STRDUP(q);
+                e->mtimes[e->num_tiles] = mtime;
+                ++e->num_tiles;
+            }
+            if (e->num_tiles < n) {
+                // truncated entry -- forget about it
+                dem_cache_entry_free(e);
+                --cache->num;
+            }
+            if (e->id >= cache->next_id)
+                cache->next_id = e->id + 1;
+            e = NULL;
+        }
+    }
+    fclose(fp);
+
+    return cache;
+}
+
+static void dem_cache_write(dem_cache_t *cache)
+{
+    char *catalog = dem_cache_file("dem_cache.txt");
+    char *tmp = MALLOC(sizeof(char)*(strlen(catalog)+32));
+    sprintf(tmp, "%s.%d", catalog, (int) getpid());
+
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        asfPrintWarning("Cannot write DEM cache list: %s\n", tmp);
+    }
+    else {
+        int i, j;
+        fprintf(fp, "next_id %d\n", cache->next_id);
+        for (i = 0; i < cache->num; ++i) {
+            dem_cache_entry_t *e = &cache->entries[i];
+            fprintf(fp, "entry %d %d %.17g %.17g %.10f %.10f %.10f %.10f "
+                    "%ld %lld %d\n", e->id, e->zone, e->ps, e->background,
+                    e->lat_lo, e->lat_hi, e->lon_lo, e->lon_hi,
+                    e->last_used, e->bytes, e->num_tiles);
+            for (j = 0; j < e->num_tiles; ++j)
+                fprintf(fp, "tile %ld %s\n", e->mtimes[j], e->tiles[j]);
+        }
+        for (i = 0; i < cache->num_builds; ++i) {
+            dem_cache_build_t *b = &cache->builds[i];
+            fprintf(fp, "building %d %ld %s %d %.17g %.17g %.10f %.10f "
+                    "%.10f %.10f %ld\n", b->id, b->pid, b->host, b->zone,
+                    b->ps, b->background, b->lat_lo, b->lat_hi, b->lon_lo,
+                    b->lon_hi, b->started);
+        }
+        fclose(fp);
+        if (rename(tmp, catalog) != 0) {
+            asfPrintWarning("Cannot write DEM cache list: %s\n", catalog);
+            remove_file(tmp);
+        }
+    }
+
+    free(tmp);
+    free(catalog);
+}
+
+static void dem_cache_free(dem_cache_t *cache)
+{
+    int i;
+    for (i = 0; i < cache->num; ++i)
+        dem_cache_entry_free(&cache->entries[i]);
+    FREE(cache->entries);
+    FREE(cache->builds);
+    free(cache);
+}
+
+// Only one process at a time reads and updates the cache, holding a
+// lock on dem_cache.lock while doing so.  Returns the lock file's
+// descriptor, or -1 if it couldn't be locked.
+static int dem_cache_lock(void)
+{
+#ifndef win32
+    char *lock_file = dem_cache_file("dem_cache.lock");
+    int fd = open(lock_file, O_RDWR | O_CREAT, 0666);
+    free(lock_file);
+    if (fd < 0)
+        return -1;
+
+    struct flock fl;
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 0;
+    while (fcntl(fd, F_SETLKW, &fl) == -1) {
+        if (errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+static void dem_cache_unlock(int fd)
+{
+#ifndef win32
+    if (fd >= 0)
+        close(fd);
+#endif
+}
+
+static int same_value(double a, double b)
+{
+    return a == b || (ISNAN(a) && ISNAN(b));
+}
+
+// Returns the index of the cached DEM that can be used for the given
+// box, or -1 if there isn't one.  Cached DEMs built from tiles that have
+// changed or gone away since are removed along the way.
+static int dem_cache_find(dem_cache_t *cache, int zone, double ps,
+                          double background, double lat_lo, double lat_hi,
+                          double lon_lo, double lon_hi, char **dems)
+{
+    int i = 0, j;
+
+    while (i < cache->num) {
+        dem_cache_entry_t *e = &cache->entries[i];
+        int stale = FALSE;
+
+        for (j = 0; j < e->num_tiles; ++j) {
+            if (file_mtime(e->tiles[j]) != e->mtimes[j]) {
+                stale = TRUE;
+                break;
+            }
+        }
+        char *file = dem_cache_entry_file(e->id);
+        if (!stale && (!extExists(file, ".img") || !extExists(file, ".meta")))
+            stale = TRUE;
+        free(file);
+        if (stale) {
+            dem_cache_remove(cache, i);
+            continue;
+        }
+
+        if (e->zone == zone && same_value(e->ps, ps) &&
+            same_value(e->background, background) &&
+            e->lat_lo <= lat_lo && e->lat_hi >= lat_hi &&
+            e->lon_lo <= lon_lo && e->lon_hi >= lon_hi)
+        {
+            // must have been built from all of the tiles overlapping
+            // this box
+            char **p;
+            for (p = dems; *p; ++p) {
+                for (j = 0; j < e->num_tiles; ++j)
+                    if (strcmp(*p, e->tiles[j]) == 0)
+                        break;
+                if (j == e->num_tiles)
+                    break;
+            }
+            if (!*p)
+                return i;
+        }
+        ++i;
+    }
+
+    return -1;
+}
+
+static void this_host(char *host, size_t size)
+{
+#ifndef win32
+    if (gethostname(host, size) == 0) {
+        host[size-1] = '\0';
+        if (strlen(host) > 0 && !strchr(host, ' '))
+            return;
+    }
+#endif
+    strcpy(host, "-");
+}
+
+static void dem_cache_remove_build(dem_cache_t *cache, int i)
+{
+    cache->builds[i] = cache->builds[--cache->num_builds];
+}
+
+// Returns the index of a DEM being built that will cover the given box,
+// or -1 if there isn't one.  Builds that have died or have taken too
+// long are forgotten along the way.
+static int dem_cache_find_build(dem_cache_t *cache, int zone, double ps,
+                                double background, double lat_lo,
+                                double lat_hi, double lon_lo, double lon_hi)
+{
+#ifndef win32
+    char host[256];
+    long now = (long) time(NULL);
+    int i = 0;
+
+    this_host(host, sizeof(host));
+    while (i < cache->num_builds) {
+        dem_cache_build_t *b = &cache->builds[i];
+        if (now - b->started > DEM_CACHE_BUILD_TIMEOUT ||
+            (strcmp(b->host, host) == 0 &&
+             kill((pid_t) b->pid, 0) != 0 && errno == ESRCH))
+        {
+            dem_cache_remove_build(cache, i);
+            continue;
+        }
+
+        if (b->zone == zone && same_value(b->ps, ps) &&
+            same_value(b->background, background) &&
+            b->lat_lo <= lat_lo && b->lat_hi >= lat_hi &&
+            b->lon_lo <= lon_lo && b->lon_hi >= lon_hi)
+            return i;
+        ++i;
+    }
+#endif
+    return -1;
+}
+
+// removes the least recently used DEMs, other than the one with the
+// given id, until the cache is below its size limit
+static void dem_cache_trim(dem_cache_t *cache, int keep_id)
+{
+    if (dem_cache_max_bytes <= 0)
+        return;
+
+    while (1) {
+        long long total = 0;
+        int i, oldest = -1;
+        for (i = 0; i < cache->num; ++i) {
+            dem_cache_entry_t *e = &cache->entries[i];
+            total += e->bytes;
+            if (e->id != keep_id &&
+                (oldest < 0 || e->last_used < cache->entries[oldest].last_used))
+                oldest = i;
+        }
+        if (total <= dem_cache_max_bytes || oldest < 0)
+            break;
+        asfPrintStatus("Removing DEM %d from the DEM cache\n",
+                       cache->entries[oldest].id);
+        dem_cache_remove(cache, oldest);
+    }
+}
+
+// name of the DEM built for a granule, in the directory its temporary
+// files go to -- free the result
+static char *built_dem_name(const char *dir_for_tmp_dem)
+{
+    char *built_dem;
+    if (strlen(dir_for_tmp_dem) > 0) {
+        built_dem = MALLOC(sizeof(char)*(strlen(dir_for_tmp_dem)+11));
+        sprintf(built_dem, "%s/built_dem", dir_for_tmp_dem);
+    } else
+        built_dem = STRDUP("built_dem");
+    return built_dem;
+}
+
+// Gives the job its own name for a cached DEM: a hard link (a copy where
+// links can't be made) next to its other temporary files.  The job then
+// keeps the DEM for as long as it needs it, even if another job removes
+// it from the cache in the meantime.  Must be called with the cache
+// locked.
+static char *pin_cached_dem(const char *cached, const char *dir_for_tmp_dem)
+{
+    const char *exts[] = { ".meta", ".img" };
+    char *pinned = built_dem_name(dir_for_tmp_dem);
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        char *src = appendExt(cached, exts[i]);
+        char *dst = appendExt(pinned, exts[i]);
+        if (fileExists(dst))
+            unlink(dst);
+#ifdef win32
+        fileCopy(src, dst);
+#else
+        if (link(src, dst) != 0)
+            fileCopy(src, dst);
+#endif
+        free(src);
+        free(dst);
+    }
+
+    return pinned;
+}
+
+// Returns a DEM covering the given box, taken from the cache, or built
+// (and added to the cache) if there is none.  "dems" are the DEMs
+// overlapping the granule, the index is used to find the ones
+// overlapping the widened box the cached DEM is built for.  The
+// returned DEM is the job's own, see pin_cached_dem().
+//
+// The cache is only locked while the list is read and updated.  A DEM
+// is built under a name of its own, and added to the list once done, so
+// that other jobs aren't kept waiting in the meantime -- unless they
+// need the same box, in which case they wait for this DEM rather than
+// build it again.
+static char *build_dem_cached(dem_index_t *index, char **dems, int zone,
+                              double lat_lo, double lat_hi,
+                              double lon_lo, double lon_hi,
+                              double background_val,
+                              const char *dir_for_tmp_dem)
+{
+    const double ps = -1;
+    int fd, waited = FALSE;
+    dem_cache_t *cache;
+    dem_cache_entry_t e;
+    dem_cache_build_t *b;
+    footprint_t box;
+    char *built_dem, *cached, *building, name[64];
+    char **p;
+    int i;
+
+    e.zone = zone;
+    e.ps = ps;
+    e.background = background_val;
+    e.lat_lo = floor(lat_lo/DEM_CACHE_SNAP)*DEM_CACHE_SNAP;
+    e.lat_hi = ceil(lat_hi/DEM_CACHE_SNAP)*DEM_CACHE_SNAP;
+    e.lon_lo = floor(lon_lo/DEM_CACHE_SNAP)*DEM_CACHE_SNAP;
+    e.lon_hi = ceil(lon_hi/DEM_CACHE_SNAP)*DEM_CACHE_SNAP;
+    if (e.lat_lo < -90) e.lat_lo = -90;
+    if (e.lat_hi > 90) e.lat_hi = 90;
+
+    while (1) {
+        fd = dem_cache_lock();
+        cache = dem_cache_read();
+        i = dem_cache_find(cache, zone, ps, background_val,
+                           lat_lo, lat_hi, lon_lo, lon_hi, dems);
+
+        if (i >= 0) {
+            cached = dem_cache_entry_file(cache->entries[i].id);
+            cache->entries[i].last_used = (long) time(NULL);
+            asfPrintStatus("Using cached DEM: %s\n", cached);
+            built_dem = pin_cached_dem(cached, dir_for_tmp_dem);
+            free(cached);
+
+            dem_cache_write(cache);
+            dem_cache_free(cache);
+            dem_cache_unlock(fd);
+            return built_dem;
+        }
+
+        i = dem_cache_find_build(cache, zone, ps, background_val,
+                                 lat_lo, lat_hi, lon_lo, lon_hi);
+        if (i < 0)
+            break;
+
+        // another job is building it -- wait for that one
+        if (!waited)
+            asfPrintStatus("Waiting for DEM %d, which another job is "
+                           "building for the DEM cache\n",
+                           cache->builds[i].id);
+        waited = TRUE;
+        dem_cache_write(cache);
+        dem_cache_free(cache);
+        dem_cache_unlock(fd);
+#ifndef win32
+        sleep(DEM_CACHE_POLL);
+#endif
+    }
+
+    // not in the cache -- take an id for it, say we are building it, and
+    // let go of the lock
+    e.id = cache->next_id++;
+    cache->builds = (dem_cache_build_t *) realloc(cache->builds,
+        sizeof(dem_cache_build_t)*(cache->num_builds+1));
+    b = &cache->builds[cache->num_builds++];
+    b->id = e.id;
+#ifndef win32
+    b->pid = (long) getpid();
+#else
+    b->pid = 0;
+#endif
+    this_host(b->host, sizeof(b->host));
+    b->zone = zone;
+    b->ps = ps;
+    b->background = background_val;
+    b->lat_lo = e.lat_lo;
+    b->lat_hi = e.lat_hi;
+    b->lon_lo = e.lon_lo;
+    b->lon_hi = e.lon_hi;
+    b->started = (long) time(NULL);
+    dem_cache_write(cache);
+    dem_cache_free(cache);
+    dem_cache_unlock(fd);
+
+    // tiles: the ones overlapping the granule, plus any others
+    // overlapping the widened box
+    get_footprint_box(e.lat_lo, e.lat_hi, e.lon_lo, e.lon_hi, &box);
+    e.num_tiles = 0;
+    for (p = dems; *p; ++p)
+        ++e.num_tiles;
+    e.tiles = MALLOC(sizeof(char*)*(e.num_tiles+index->num+1));
+    e.num_tiles = 0;
+    for (p = dems; *p; ++p)
+        e.tiles[e.num_tiles++] = STRDUP(*p);
+    for (i = 0; i < index->num; ++i) {
+        dem_index_entry_t *ie = &index->entries[i];
+        int j;
+        if (!ie->is_dem || !test_overlap(&box, &ie->fp))
+            continue;
+        for (j = 0; j < e.num_tiles; ++j)
+            if (strcmp(e.tiles[j], ie->file) == 0)
+                break;
+        if (j == e.num_tiles)
+            e.tiles[e.num_tiles++] = STRDUP(ie->file);
+    }
+    e.tiles[e.num_tiles] = NULL;
+
+    // modification times from before the build, so that a tile changing
+    // while it is being read makes the cached DEM stale
+    e.mtimes = MALLOC(sizeof(long)*e.num_tiles);
+    for (i = 0; i < e.num_tiles; ++i)
+        e.mtimes[i] = file_mtime(e.tiles[i]);
+
+    sprintf(name, "building_%d", e.id);
+    building = dem_cache_file(name);
+    asfPrintStatus("Building DEM for the DEM cache from %d tile%s: %s\n",
+                   e.num_tiles, e.num_tiles==1?"":"s", building);
+    asf_mosaic_utm(e.tiles, building, zone, e.lat_lo, e.lat_hi,
+        e.lon_lo, e.lon_hi, background_val);
+
+    char *img = appendExt(building, ".img");
+    char *meta = appendExt(building, ".meta");
+    e.bytes = fileSize(img) + fileSize(meta);
+    free(img);
+    free(meta);
+
+    // add it to the cache, in place of the build
+    fd = dem_cache_lock();
+    cache = dem_cache_read();
+    for (i = 0; i < cache->num_builds; ++i)
+        if (cache->builds[i].id == e.id)
+            dem_cache_remove_build(cache, i--);
+    cached = dem_cache_entry_file(e.id);
+    renameImgAndMeta(building, cached);
+    built_dem = pin_cached_dem(cached, dir_for_tmp_dem);
+    e.last_used = (long) time(NULL);
+    *add_cache_entry(cache) = e;
+    dem_cache_trim(cache, e.id);
+    dem_cache_write(cache);
+    dem_cache_free(cache);
+    dem_cache_unlock(fd);
+
+    free(building);
+    free(cached);
+    return built_dem;
+}
+
 // External entry point
 //  --> meta: SAR metadata
 //  --> dem_cla_arg: either (1) a DEM, (2) a directory with DEMs,
@@ -698,13 +1510,17 @@ char *build_dem(meta_parameters *meta, const char *dem_cla_arg,
         }
     }
 
+    footprint_t fp;
+    get_footprint(meta, &fp);
+    dem_index_t *index = dem_index_load(dem_cla_arg);
+
     char **list_of_dems = NULL;
     // Eliminated case (1) -- try case (2)
     if (is_dir_s(dem_cla_arg)) {
         asfPrintStatus("%s: directory containing DEMs.\n", dem_cla_arg);
         int n;
         list_of_dems =
-            find_overlapping_dems_dir(meta, dem_cla_arg, &n);
+            find_overlapping_dems_dir(&fp, dem_cla_arg, index, &n);
     }
     else {
         // this is case (3)
@@ -712,33 +1528,44 @@ char *build_dem(meta_parameters *meta, const char *dem_cla_arg,
         if (fileExists(dem_cla_arg)) {
             int n;
             list_of_dems =
-                find_overlapping_dems(meta, dem_cla_arg, &n);
+                find_overlapping_dems(&fp, dem_cla_arg, index, &n);
         }
     }
 
+    dem_index_save(index);
+
     if (list_of_dems) {
         // form a bounding box
         double lat_lo, lat_hi, lon_lo, lon_hi;
         get_bounding_box_latlon(meta, &lat_lo, &lat_hi, &lon_lo, &lon_hi);
 
-        // hard-coded name of the built dem
-        char *built_dem;
-        if (strlen(dir_for_tmp_dem) > 0) {
-            built_dem = MALLOC(sizeof(char)*(strlen(dir_for_tmp_dem)+10));
-            sprintf(built_dem, "%s/built_dem", dir_for_tmp_dem);
-        } else
-            built_dem = STRDUP("built_dem");
-
         // always geocode to utm -- we may wish change this to use the
         // user's preferred projection...
-        asf_mosaic_utm(list_of_dems, built_dem,
-            utm_zone(meta->general->center_longitude), lat_lo, lat_hi,
-            lon_lo, lon_hi, meta->general->no_data);
+        int zone = utm_zone(meta->general->center_longitude);
+        char *built_dem;
+
+        if (dem_cache_dir) {
+            built_dem = build_dem_cached(index, list_of_dems, zone,
+                lat_lo, lat_hi, lon_lo, lon_hi, meta->general->no_data,
+                dir_for_tmp_dem);
+        }
+        else {
+            built_dem = built_dem_name(dir_for_tmp_dem);
+            asf_mosaic_utm(list_of_dems, built_dem, zone, lat_lo, lat_hi,
+                lon_lo, lon_hi, meta->general->no_data);
+        }
+
+        char **p;
+        for (p = list_of_dems; *p; ++p)
+            free(*p);
+        free(list_of_dems);
+        dem_index_free(index);
 
         asfPrintStatus("Constructed DEM: %s\n", built_dem);
         return built_dem;
     }
     else {
+        dem_index_free(index);
         asfPrintError("DEM not found: %s\n", dem_cla_arg);
         return NULL; // not reached
     }
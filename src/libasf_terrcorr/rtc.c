@@ -289,9 +289,14 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
 
   float corr[ns];
   float incid_angles[ns];
+  float incid_line[ns];
   float bufIn[ns];
   float bufOut[ns];
 
+  // Ellipsoid incidence angles come from the geometry grid, a line at a time
+  meta_geo_grid *grid = meta_geo_grid_get(input_file, meta_in, GRID_BICUBIC,
+                                          GRID_QUANTITY_BIT(GRID_INCID));
+
   asfPrintStatus("Applying radiometric correction...\n");
 
   int ii, jj, kk;
@@ -319,6 +324,7 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
 
   // We aren't applying the correction to the edges of the image
   // (corr[jj] == 1 for the whole row)
+  meta_geo_grid_line(grid, GRID_INCID, 0, incid_line);
   for(kk = 0; kk < nb; ++kk) {
     get_band_float_line(fpIn, meta_in, kk, 0, bufIn);
     if (strstr(bands[kk], "PHASE") != NULL) {
@@ -331,8 +337,8 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
     }
     else {
       for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = 
-	  get_rad_cal_dn(meta_in, 0, jj, bands[kk], bufIn[jj], corr[jj]);
+	bufOut[jj] = get_rad_cal_dn_incid(meta_in, incid_line[jj], jj,
+					  bands[kk], bufIn[jj], corr[jj]);
     }
     put_band_float_line(fpOut, meta_out, kk, 0, bufOut);
   }
@@ -342,11 +348,12 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
 			  ii + 1);
     corr[0] = corr[ns-1] = 1;
     Vector satpos = get_satpos(meta_in, ii);
-    incid_angles[0] = incid_angles[nl-1] = 0;
+    meta_geo_grid_line(grid, GRID_INCID, ii, incid_line);
+    incid_angles[0] = incid_angles[ns-1] = 0;
 
     // calculate the Ulander correction for this line
     for(jj = 1; jj < ns - 1; ++jj) {
-      incid_angles[jj] = meta_incid(meta_in, ii, jj);
+      incid_angles[jj] = incid_line[jj];
       Vector * normal = calculate_normal(localVectors, jj);
       corr[jj] = calculate_correction(meta_in, ii, jj, &satpos, normal, 
 				      localVectors[1][jj], &nextVectors[jj], 
@@ -392,8 +399,8 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
       // amplitude, or complex I or Q -- apply the radiometric correction
       else {
         for (jj=0; jj<ns; ++jj)
-          bufOut[jj] = 
-	    get_rad_cal_dn(meta_in, ii, jj, bands[kk], bufIn[jj], corr[jj]);
+          bufOut[jj] = get_rad_cal_dn_incid(meta_in, incid_line[jj], jj,
+					    bands[kk], bufIn[jj], corr[jj]);
       }
 
       // write out the corrected line
@@ -405,6 +412,7 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
 
   // bottom line of the image, here we are cheating and reusing the previous
   // line's correction factors
+  meta_geo_grid_line(grid, GRID_INCID, nl-1, incid_line);
   for(kk = 0; kk < nb; ++kk) {
     get_band_float_line(fpIn, meta_in, kk, nl-1, bufIn);
     if (strstr(bands[kk], "PHASE") != NULL) {
@@ -417,8 +425,8 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
     }
     else {
       for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = 
-	  get_rad_cal_dn(meta_in, nl-1, jj, bands[kk], bufIn[jj], corr[jj]);
+	bufOut[jj] = get_rad_cal_dn_incid(meta_in, incid_line[jj], jj,
+					  bands[kk], bufIn[jj], corr[jj]);
     }
     put_band_float_line(fpOut, meta_out, kk, nl-1, bufIn);
   }
@@ -433,6 +441,7 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
   FCLOSE(fpOut);
   FCLOSE(fpIn);
   if (fpSide) FCLOSE(fpSide);
+  meta_geo_grid_free(grid);
 
   // update output metadata
   for (ii=0; ii<meta_out->general->band_count; ii++) {
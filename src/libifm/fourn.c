@@ -16,7 +16,7 @@ DESCRIPTION:
 	Replaces data by its ndim-dimensional discrete Fourier transform, if
 	isign is input as 1. nn[1..ndim] is an integer array containing the
 	lengths (number of complex values) of each dimension (the 0 position
-	is not used) which must all be powers of 2. data is a real array of
+	is not used).  Powers of 2 are fastest, but any length works. data is a real array of
 	length twice the product of these lengths, in which the data are
 	stored as in a multidimensional complex array: real and imaginary
 	parts of each element are in consecutive locations, and the rightmost
@@ -29,103 +29,70 @@ RETURN VALUE:
         None. 
 
 SPECIAL CONSIDERATIONS:
-        Check Numerical Recipes in C for more information.
+        Check Numerical Recipes in C for more information.  The transforms
+        are done with the asf_fft plans (see fft.h); isign has the same
+        meaning as their FFT_INVERSE/FFT_FORWARD directions.
 
 PROGRAM HISTORY:
         1.0 - Mike Shindle - original porting
+        2.0 - Run on the cached asf_fft plans.
 ****************************************************************/
 
 #include "ifm.h"
+#include "fft.h"
 
 void fourn(float *data, int *nn, int ndim, int isign)
 {
+  int   idim, n, nmax, nprev, nrem, ntot;
   int   i1, i2, i3;
-  int   i2rev,i3rev;
-  int   ip1, ip2, ip3;
-  int   ifp1, ifp2;
-  int   ibit, idim;
-  int   k1, k2;
-  int   n, nprev, nrem, ntot;
-  float tempi, tempr;
-  float theta, wi, wpi, wpr, wr, wtemp;
-  float pi;
+  float *line = NULL;
+  const fft_plan *plan;
 
-  pi = 4.0 * atan(1.0);
-  ntot=1;
+  /* Numerical Recipes arrays start at 1. */
+  data++;
 
   /* Compute total number of complex values. */
-  for (idim = 1; idim <= ndim; idim++) 
+  ntot = 1;
+  nmax = 1;
+  for (idim = 1; idim <= ndim; idim++) {
      ntot *= nn[idim];
-  nprev=1;
+     if (nn[idim] > nmax)
+        nmax = nn[idim];
+  }
+
+  /* Strided dimensions are copied into line to be transformed. */
+  if (ndim > 1)
+     line = (float *) MALLOC(2 * nmax * sizeof(float));
 
-  /* Main loop over the dimensions */
-  /* printf("fourn():\n"); */
+  /* Main loop over the dimensions, rightmost (contiguous) one first */
+  nprev = 1;
   for (idim = ndim; idim >= 1; idim--) {
      n = nn[idim];
-     /* printf("\tdimension = %d  n = %d\n", idim, n); */
      nrem = ntot / (n*nprev);
-     ip1 = nprev << 1;
-     ip2 = ip1*n;
-     ip3 = ip2*nrem;
-     i2rev = 1;
+     plan = fft_plan_get(n, isign > 0 ? FFT_INVERSE : FFT_FORWARD);
 
-     /* this is the bit reversal section of the routine */
-     for(i2 = 1; i2 <= ip2; i2 += ip1) {
-        if (i2 < i2rev) {
-          for(i1 = i2; i1 <= i2 + ip1 - 2; i1 += 2) {
-            for (i3 = i1; i3 <= ip3; i3 += ip2) {
-               i3rev = i2rev + i3 - i2;
-               /* swap variables */ 
-	         tempr = data[i3];
-               data[i3]  = data[i3rev];
-               data[i3rev] = tempr;
-               
-               tempr = data[i3+1];
-               data[i3+1] = data[i3rev+1];
-               data[i3rev+1] = tempr;
-
-            }
-          }
-        }
-
-        ibit = ip2 >> 1;
-        while (ibit >= ip1 && i2rev > ibit) {
-           i2rev -= ibit;
-           ibit = ibit >> 1;
-        }
-        i2rev += ibit;
+     if (nprev == 1) {
+        fft_plan_execute(plan, data, nrem);
      }
-     ifp1 = ip1;
-     
-     /* Here begins the Danielson-Lanczos section of the routine */
-     while (ifp1 < ip2) {
-        ifp2  = ifp1 << 1;
-        theta = isign* 2.0 * pi /(ifp2/ip1);
-        wtemp = sin(0.5*theta);
-        wpr = -2.0*wtemp*wtemp;
-        wpi = sin(theta);
-        wr = 1.0;
-        wi = 0.0;
-        for (i3 = 1; i3 <= ifp1; i3 += ip1) {
-           for (i1 = i3; i1 <= i3 + ip1 - 2; i1 += 2) {
-              for (i2 = i1; i2 <= ip3; i2 += ifp2) {
-                 k1 = i2;
-                 k2 = k1 + ifp1;
-                 tempr = wr * data[k2] - wi * data[k2+1];
-                 tempi = wr * data[k2+1] + wi * data[k2];
-                 data[k2] = data[k1] - tempr;
-                 data[k2+1] = data[k1+1] - tempi;
-                 data[k1] += tempr;
-                 data[k1+1] += tempi;
+     else {
+        /* Gather each line with stride nprev, transform, scatter back. */
+        for (i3 = 0; i3 < nrem; i3++) {
+           for (i1 = 0; i1 < nprev; i1++) {
+              float *start = data + 2 * ((long)i3 * n * nprev + i1);
+              for (i2 = 0; i2 < n; i2++) {
+                 line[2*i2]   = start[2*(long)i2*nprev];
+                 line[2*i2+1] = start[2*(long)i2*nprev+1];
+              }
+              fft_plan_execute(plan, line, 1);
+              for (i2 = 0; i2 < n; i2++) {
+                 start[2*(long)i2*nprev]   = line[2*i2];
+                 start[2*(long)i2*nprev+1] = line[2*i2+1];
               }
            }
-           wtemp = wr;
-           wr = wr * wpr - wi * wpi + wr;
-           wi = wi * wpr + wtemp * wpi + wi;
         }
-        ifp1 = ifp2;
      }
      nprev *= n;
   }
+  FREE(line);
   return;
 }
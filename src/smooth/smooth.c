@@ -2,6 +2,7 @@
 
 #define ASF_USAGE_STRING \
 "   "ASF_NAME_STRING" [-log <logfile>] [-quiet] [-k <kernel size>]\n"\
+"          [-threads <count>]\n"\
 "          <in_base_name> <out_base_name>\n"
 
 #define ASF_DESCRIPTION_STRING \
@@ -25,6 +26,11 @@
 "          pixel.  For example, a kernel size of 3 will average together 9\n"\
 "          pixels to produce each output pixel.\n"\
 "\n"\
+"     -threads <count>\n"\
+"          Smooth the image using this many threads.  Use 0 to run one\n"\
+"          thread per processor, which is the default.  The output does\n"\
+"          not depend on the number of threads.\n"\
+"\n"\
 "     -log <log file>\n"\
 "          Output will be written to a specified log file.\n"\
 "\n"\
@@ -136,6 +142,13 @@ main (int argc, char *argv[])
       CHECK_ARG(1);
       kernel_size = atoi(GET_ARG(1));
     }
+    else if (strmatches(key,"-threads","--threads",NULL)) {
+      CHECK_ARG(1);
+      int thread_count = atoi(GET_ARG(1));
+      if (thread_count < 0)
+        asfPrintError("Invalid number of threads: %d\n", thread_count);
+      set_filter_thread_count(thread_count);
+    }
     else {
         --currArg;
         break;